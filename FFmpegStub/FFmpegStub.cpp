@@ -0,0 +1,159 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// ffmpeg stub, for testing media capture
+//
+// This stands in for ffmpeg.exe when testing the media capture code.
+// The PinballYTests capture planner tests run it directly, and it can
+// also be substituted for the real ffmpeg in a live PinballY session
+// via the Capture.FFmpegPath config variable, to check the commands a
+// capture session runs and how they're scheduled, without capturing
+// anything.
+//
+// The stub doesn't read its inputs.  It parses the command line the
+// way ffmpeg does for the options PinballY uses - every option takes
+// a value, and an argument that isn't an option or an option value is
+// an output file - and "writes" each output by creating a small
+// placeholder file when the output's "-t" time limit has elapsed.  An
+// output without a time limit (a still image, or an encoding step) is
+// written immediately.  The stub exits with status 0 after writing the
+// last output.
+//
+// Each run appends a record to a log file, one tab-separated line per
+// event, with the time in milliseconds on the system clock (so that
+// the records from overlapping runs can be compared) and the process
+// ID:
+//
+//   <time>  <pid>  start   <command line>
+//   <time>  <pid>  output  <filename>
+//   <time>  <pid>  end
+//
+// Environment variables:
+//
+//   FFMPEG_STUB_LOG          log file path; default is FFmpegStub.log
+//                            in the stub's program folder
+//
+//   FFMPEG_STUB_TIME_SCALE   multiplier for the "-t" times, so that a
+//                            test can run a 30-second capture in a
+//                            fraction of the time; default 1.0
+//
+
+#include <Windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// log file handle
+static HANDLE hLog = INVALID_HANDLE_VALUE;
+
+// current system time in milliseconds
+static long long NowMs()
+{
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((long long)ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10000;
+}
+
+// Write a log line.  The file is opened for appending, so each write
+// goes at the end of the file even when several stub processes are
+// running at once.
+static void Log(const WCHAR *event, const WCHAR *detail)
+{
+	WCHAR prefix[64];
+	swprintf_s(prefix, L"%lld\t%lu\t", NowMs(), GetCurrentProcessId());
+	std::wstring line = std::wstring(prefix) + event;
+	if (detail != nullptr)
+		line += std::wstring(L"\t") + detail;
+	line += L"\r\n";
+
+	// write it as UTF-8
+	int len = WideCharToMultiByte(CP_UTF8, 0, line.c_str(), (int)line.length(), NULL, 0, NULL, NULL);
+	std::vector<char> buf(len);
+	WideCharToMultiByte(CP_UTF8, 0, line.c_str(), (int)line.length(), buf.data(), len, NULL, NULL);
+	DWORD actual;
+	WriteFile(hLog, buf.data(), len, &actual, NULL);
+}
+
+int wmain(int argc, WCHAR **argv)
+{
+	// get the log file name
+	std::wstring logFile;
+	WCHAR buf[MAX_PATH];
+	if (GetEnvironmentVariableW(L"FFMPEG_STUB_LOG", buf, MAX_PATH) != 0)
+		logFile = buf;
+	else
+	{
+		GetModuleFileNameW(NULL, buf, MAX_PATH);
+		logFile = buf;
+		logFile = logFile.substr(0, logFile.find_last_of(L'\\') + 1) + L"FFmpegStub.log";
+	}
+
+	// get the time scale
+	double timeScale = 1.0;
+	if (GetEnvironmentVariableW(L"FFMPEG_STUB_TIME_SCALE", buf, MAX_PATH) != 0)
+		timeScale = _wtof(buf);
+
+	// open the log file for appending
+	hLog = CreateFileW(logFile.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE,
+		NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hLog == INVALID_HANDLE_VALUE)
+		return 2;
+
+	// note the start time, and log the command line
+	long long t0 = NowMs();
+	Log(L"start", GetCommandLineW());
+
+	// Parse the arguments.  Every option takes a value; anything else is
+	// an output file, which takes the "-t" time limit set since the last
+	// output, if any.
+	struct Output
+	{
+		std::wstring filename;
+		long long time;     // write time, in milliseconds after start
+	};
+	std::vector<Output> outputs;
+	long long t = 0;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (argv[i][0] == '-' && i + 1 < argc)
+		{
+			if (wcscmp(argv[i], L"-t") == 0)
+				t = (long long)(_wtof(argv[i + 1]) * 1000.0 * timeScale);
+			++i;
+		}
+		else
+		{
+			outputs.push_back({ argv[i], t });
+			t = 0;
+		}
+	}
+
+	// write the outputs in order of their time limits
+	std::stable_sort(outputs.begin(), outputs.end(), [](const Output &a, const Output &b) { return a.time < b.time; });
+	for (auto &o : outputs)
+	{
+		// wait until the output is due
+		long long now = NowMs() - t0;
+		if (o.time > now)
+			Sleep((DWORD)(o.time - now));
+
+		// write the placeholder file
+		HANDLE hFile = CreateFileW(o.filename.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile != INVALID_HANDLE_VALUE)
+		{
+			static const char contents[] = "FFmpegStub output\r\n";
+			DWORD actual;
+			WriteFile(hFile, contents, sizeof(contents) - 1, &actual, NULL);
+			CloseHandle(hFile);
+		}
+
+		Log(L"output", o.filename.c_str());
+	}
+
+	// done
+	Log(L"end", nullptr);
+	CloseHandle(hLog);
+	return 0;
+}
@@ -37,6 +37,9 @@
 #include "InstCardView.h"
 #include "AudioManager.h"
 #include "DOFClient.h"
+#include "DOFOutput.h"
+#include "CapturePlanner.h"
+#include "CaptureEncoder.h"
 #include "TextureShader.h"
 #include "I420Shader.h"
 #include "DMDShader.h"
@@ -47,6 +50,8 @@
 #include "RefTableList.h"
 #include "CaptureStatusWin.h"
 #include "LogFile.h"
+#include "SpriteCompositor.h"
+#include "DecodedImageCache.h"
 
 // --------------------------------------------------------------------------
 //
@@ -233,9 +238,13 @@ int Application::EventLoop(int nCmdShow)
 	CheckRunAtStartup();
 
 	// set up DOF before creating the UI
+	DOFOutput::Init(new DOFOutput::DOFClientBackend());
 	CapturingErrorHandler dofErrs;
 	DOFClient::Init(dofErrs);
 
+	// start the background capture encoder
+	CaptureEncoder::Init();
+
 	// initialize the game list
 	CapturingErrorHandler loadErrs;
 	if (!InitGameList(loadErrs, InteractiveErrorHandler()))
@@ -345,6 +354,9 @@ int Application::EventLoop(int nCmdShow)
 		gameMonitor = nullptr;
 	}
 
+	// stop the background capture encoder, abandoning any jobs in progress
+	CaptureEncoder::Shutdown();
+
 	// If there's a new file scanner thread running, give it a few seconds
 	// to finish.
 	if (newFileScanThread != nullptr)
@@ -539,6 +551,12 @@ bool Application::Init()
 	if (!D3D::Init())
 		return false;
 
+	// start the sprite compositor threads
+	SpriteCompositor::Init();
+
+	// set up the decoded image cache
+	DecodedImageCache::Init();
+
 	// create the texture shader
 	textureShader.reset(new TextureShader());
 	if (!textureShader->Init())
@@ -570,8 +588,9 @@ bool Application::Init()
 
 Application::~Application()
 {
-	// shut down the DOF client
+	// shut down the DOF client and its output thread
 	DOFClient::Shutdown();
+	DOFOutput::Shutdown();
 
 	// delete the game list
 	GameList::Shutdown();
@@ -585,6 +604,12 @@ Application::~Application()
 	// shut down the audio manager
 	AudioManager::Shutdown();
 
+	// shut down the sprite compositor threads
+	SpriteCompositor::Shutdown();
+
+	// close the decoded image cache
+	DecodedImageCache::Shutdown();
+
 	// shut down D3D
 	D3D::Shutdown();
 
@@ -660,6 +685,9 @@ bool Application::ReloadConfig()
 	// clear media in all windows
 	ClearMedia();
 
+	// discard pending high score requests for the old game list
+	highScores->OnGameListShutdown();
+
 	// delete the game list
 	GameList::Shutdown();
 
@@ -1455,9 +1483,18 @@ bool Application::GameMonitorThread::Launch(
 		auto cfg = ConfigManager::GetInstance();
 		capture.startupDelay = captureStartupDelay * 1000;
 		totalTime += capture.startupDelay;
+		DWORD maxCaptureTime = 0;
 
-		// remember the two-pass encoding option
+		// remember the encoding options
 		capture.twoPassEncoding = cfg->GetBool(ConfigVars::CaptureTwoPassEncoding, false);
+		capture.combined = cfg->GetBool(ConfigVars::CaptureCombined, true);
+		capture.ffmpegPath = cfg->Get(ConfigVars::CaptureFFmpegPath, _T(""));
+
+		// In combined mode, all of the items are captured in a single
+		// ffmpeg run, which lasts as long as the longest item, plus a
+		// couple of seconds of overhead launching the capture program.
+		if (capture.combined)
+			totalTime += 2000;
 
 		// build our local list of capture items
 		for (auto &cap : *captureList)
@@ -1474,27 +1511,15 @@ bool Application::GameMonitorThread::Launch(
 			if (auto cfgvar = item.mediaType.captureTimeConfigVar; cfgvar != nullptr)
 				item.captureTime = cfg->GetInt(cfgvar, 30) * 1000;
 
-			// add it to the total time, plus a couple of seconds of
-			// overhead launching the capture program
-			totalTime += item.captureTime + 2000;
-
-			// If we're doing two-pass encoding, add an estimate of the second
-			// pass encoding time.  This option is normally used only on a machine
-			// that can't keep up with real-time encoding, so it's a good bet that
-			// the encoding time will exceed the capture time - by how much, though,
-			// is pretty much impossible to estimate without more knowledge of the
-			// local machine than we can be bothered to gather.  So we'll just make
-			// a wild guess.  It's hard to run VP successfully on *too* slow a 
-			// machine; the slowest machines capable of good VP operation are
-			// probably only borderline too slow for real-time encoding, so let's
-			// assume that a factor of two (times the video running time) is a 
-			// decent upper bound.  And of course we've already established that 
-			// a factor of one is a good lower bound if we're using this mode.
-			// So let's just split the difference and call it 1.5x.
-			if (capture.twoPassEncoding 
-				&& (item.mediaType.format == MediaType::Format::SilentVideo
-					|| item.mediaType.format == MediaType::Format::VideoWithAudio))
-				totalTime += item.captureTime*3/2;
+			// Add it to the total time.  In combined mode, the longest
+			// item determines the time; otherwise each item is a separate
+			// run, so add its time plus the launch overhead.  Note that
+			// the second pass of a two-pass capture doesn't count, since
+			// that runs in the background after the game exits.
+			if (capture.combined)
+				maxCaptureTime = max(maxCaptureTime, item.captureTime);
+			else
+				totalTime += item.captureTime + 2000;
 
 			// get the source window's rotation
 			item.windowRotation = cap.win->GetRotation();
@@ -1511,6 +1536,9 @@ bool Application::GameMonitorThread::Launch(
 			OffsetRect(&item.rc, pt.x, pt.y);
 		}
 
+		// add the combined capture time
+		totalTime += maxCaptureTime;
+
 		// create the status window
 		capture.statusWin.Attach(new CaptureStatusWin());
 		capture.statusWin->Create(NULL, _T("PinballY"), WS_POPUP, SW_SHOWNOACTIVATE);
@@ -2526,111 +2554,99 @@ DWORD Application::GameMonitorThread::Main()
 			}
 		}
 
-		// Get the path to ffmpeg.exe
-		TCHAR ffmpeg[MAX_PATH];
-		GetDeployedFilePath(ffmpeg, _T("ffmpeg\\ffmpeg.exe"), _T(""));
-
-		// Audio capture device name, to pass to ffmpeg.  We populate
-		// this the first time we need it.
-		TSTRING audioCaptureDevice;
-
-		// Capture one item.  Returns true to continue capturing
-		// additional items, false to end the capture process.
-		// A true return doesn't necessarily mean that the 
-		// individual capture succeeded; it just means that we
-		// didn't run into a condition that ends the whole
-		// process, such as the game exiting prematurely.
-		for (auto &item: capture.items)
+		// Set up the capture planner options.  The config can override the
+		// ffmpeg path; otherwise use the copy deployed with the program.
+		CapturePlanner::Options opts;
+		if (capture.ffmpegPath.length() != 0)
 		{
-			// get the descriptor for the item, for status messages
-			TSTRINGEx itemDesc;
-			itemDesc.Load(item.mediaType.nameStrId);
-
-			// If the game has already exited, or a shutdown or close event
-			// is already pending, abort this capture before it starts
+			opts.ffmpeg = capture.ffmpegPath;
+		}
+		else
+		{
+			TCHAR ffmpeg[MAX_PATH];
+			GetDeployedFilePath(ffmpeg, _T("ffmpeg\\ffmpeg.exe"), _T(""));
+			opts.ffmpeg = ffmpeg;
+		}
+		opts.twoPass = capture.twoPassEncoding;
+		opts.combine = capture.combined;
+
+		// Use the current time as the session ID, so that our intermediate
+		// files can't collide with any that the background encoder is still
+		// working on from an earlier session.
+		opts.sessionId = GetTickCount();
+
+		// If we're capturing audio for any items, find the audio capture
+		// device.  We use FFMPEG's DirectShow (dshow) audio capture
+		// capability, so we have to find the device using the dshow API
+		// to make sure we see the same device name that FFMPEG will see
+		// when it scans for a device.  Note that Windows has multiple
+		// media APIs that can access the same audio devices, but it's
+		// important to use the same API that FFMPEG uses, since the
+		// different APIs can use different names for the same devices.
+		// For example, dshow truncates long device names in different
+		// ways on different Windows versions.
+		if (!abortCapture
+			&& std::any_of(capture.items.begin(), capture.items.end(), [](const CaptureItem &item) {
+				return item.mediaType.format == MediaType::VideoWithAudio && item.enableAudio; }))
+		{
+			// friendly name pattern we're scanning for
+			std::basic_regex<WCHAR> stmixPat(L"\\bstereo mix\\b", std::regex_constants::icase);
+
+			// create the audio device enumerator
+			RefPtr<ICreateDevEnum> pCreateDevEnum;
+			RefPtr<IEnumMoniker> pEnumMoniker;
+			LPMALLOC coMalloc = nullptr;
+			if (SUCCEEDED(CoGetMalloc(1, &coMalloc))
+				&& SUCCEEDED(CoCreateInstance(CLSID_SystemDeviceEnum, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pCreateDevEnum)))
+				&& SUCCEEDED(pCreateDevEnum->CreateClassEnumerator(CLSID_AudioInputDeviceCategory, &pEnumMoniker, 0)))
 			{
-				HANDLE h[] = { hGameProc, shutdownEvent, closeEvent };
-				if (WaitForMultipleObjects(countof(h), h, FALSE, 0) != WAIT_TIMEOUT)
+				// scan through the audio devices
+				RefPtr<IMoniker> m;
+				while (pEnumMoniker->Next(1, &m, NULL) == S_OK)
 				{
-					abortCapture = true;
-					captureOkay = false;
+					// get the friendly name from the object's properties
+					RefPtr<IBindCtx> bindCtx;
+					RefPtr<IPropertyBag> propertyBag;
+					VARIANTEx v(VT_BSTR);
+					if (SUCCEEDED(CreateBindCtx(0, &bindCtx))
+						&& SUCCEEDED(m->BindToStorage(bindCtx, NULL, IID_PPV_ARGS(&propertyBag)))
+						&& SUCCEEDED(propertyBag->Read(L"FriendlyName", &v, NULL)))
+					{
+						// check if the name matches our pattern
+						if (std::regex_search(v.bstrVal, stmixPat))
+						{
+							// use this source
+							opts.audioDevice = v.bstrVal;
+							break;
+						}
+					}
 				}
 			}
+		}
+
+		// Prepare the items, and build the planner's item list
+		std::vector<CapturePlanner::Item> planItems;
+		for (auto &item : capture.items)
+		{
+			// get the descriptor for the item, for status messages
+			TSTRINGEx itemDesc;
+			itemDesc.Load(item.mediaType.nameStrId);
 
 			// if we've already decided to abort, just add a status message
 			// for this item saying so
 			if (abortCapture)
 			{
 				statusList.Error(MsgFmt(_T("%s: %s"), itemDesc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_NOT_STARTED).c_str()));
-				break;
-			}
-
-			// set the status window message
-			curStatus.Format(LoadStringT(IDS_CAPSTAT_ITEM), itemDesc.c_str());
-			capture.statusWin->SetCaptureStatus(curStatus, item.captureTime);
-
-			// Move the status window over the playfield window when capturing
-			// in any other window, and move it over the backglass window when
-			// capturing the playfield.
-			switch (item.mediaType.nameStrId)
-			{
-			case IDS_MEDIATYPE_PFPIC:
-			case IDS_MEDIATYPE_PFVID:
-				capture.statusWin->PositionOver(Application::Get()->GetBackglassWin());
-				break;
-
-			default:
-				capture.statusWin->PositionOver(Application::Get()->GetPlayfieldWin());
-				break;
+				continue;
 			}
 
-			// If we're capturing audio for this item, and we haven't found
-			// the audio capture device yet, find it now.  We use FFMPEG's
-			// DirectShow (dshow) audio capture capability, so we have to 
-			// find the device using the dshow API to make sure we see the
-			// same device name that FFMPEG will see when it scans for a
-			// device.  Note that Windows has multiple media APIs that can
-			// access the same audio devices, but it's important to use the
-			// same API that FFMPEG uses, since the different APIs can use
-			// different names for the same devices.  For example, dshow 
-			// truncates long device names in different ways on different
-			// Windows versions.
-			if (item.mediaType.format == MediaType::VideoWithAudio && item.enableAudio
-				&& audioCaptureDevice.length() == 0)
+			// if the background encoder is still writing this file from an
+			// earlier capture, skip it
+			if (CaptureEncoder::Get()->IsPending(item.filename.c_str()))
 			{
-				// friendly name pattern we're scanning for
-				std::basic_regex<WCHAR> stmixPat(L"\\bstereo mix\\b", std::regex_constants::icase);
-
-				// create the audio device enumerator
-				RefPtr<ICreateDevEnum> pCreateDevEnum;
-				RefPtr<IEnumMoniker> pEnumMoniker;
-				LPMALLOC coMalloc = nullptr;
-				if (SUCCEEDED(CoGetMalloc(1, &coMalloc))
-					&& SUCCEEDED(CoCreateInstance(CLSID_SystemDeviceEnum, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&pCreateDevEnum)))
-					&& SUCCEEDED(pCreateDevEnum->CreateClassEnumerator(CLSID_AudioInputDeviceCategory, &pEnumMoniker, 0)))
-				{
-					// scan through the audio devices
-					RefPtr<IMoniker> m;
-					while (pEnumMoniker->Next(1, &m, NULL) == S_OK)
-					{
-						// get the friendly name from the object's properties
-						RefPtr<IBindCtx> bindCtx;
-						RefPtr<IPropertyBag> propertyBag;
-						VARIANTEx v(VT_BSTR);
-						if (SUCCEEDED(CreateBindCtx(0, &bindCtx))
-							&& SUCCEEDED(m->BindToStorage(bindCtx, NULL, IID_PPV_ARGS(&propertyBag)))
-							&& SUCCEEDED(propertyBag->Read(L"FriendlyName", &v, NULL)))
-						{
-							// check if the name matches our pattern
-							if (std::regex_search(v.bstrVal, stmixPat))
-							{
-								// use this source
-								audioCaptureDevice = v.bstrVal;
-								break;
-							}
-						}
-					}
-				}
+				statusList.Error(MsgFmt(_T("%s: %s"), itemDesc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_ENCODING_BUSY).c_str()));
+				captureOkay = false;
+				continue;
 			}
 
 			// save (by renaming) any existing files of the type we're about to capture
@@ -2663,191 +2679,200 @@ DWORD Application::GameMonitorThread::Main()
 				continue;
 			}
 
-			// Figure the required image/video rotation parameter for ffmpeg
-			int rotate = item.mediaRotation - item.windowRotation;
-			const TCHAR *rotateOpt = _T("");
-			switch ((rotate + 360) % 360)
-			{
-			case 90:
-				rotateOpt = _T("-vf \"transpose=1\"");  // 90 degrees clockwise
-				break;
+			// add it to the planner list
+			bool isVideo = item.mediaType.format == MediaType::SilentVideo
+				|| item.mediaType.format == MediaType::VideoWithAudio;
+			bool withAudio = item.mediaType.format == MediaType::VideoWithAudio && item.enableAudio;
+			planItems.emplace_back(itemDesc.c_str(), item.filename.c_str(), item.rc,
+				item.mediaRotation - item.windowRotation, isVideo, withAudio, item.captureTime);
+		}
 
-			case 180:
-				rotateOpt = _T("-vf \"hflip,vflip\"");  // mirror both axes
-				break;
+		// plan the ffmpeg runs
+		CapturePlanner::Plan plan;
+		CapturePlanner::MakePlan(planItems, opts, plan);
 
-			case 270:
-				rotateOpt = _T("-vf \"transpose=2\"");	// 90 degrees counterclockwise
-				break;
+		// second-pass encoding jobs for the background encoder
+		std::list<CaptureEncoder::Job> encodeJobs;
+
+		// run the capture steps
+		for (auto &step : plan.capture)
+		{
+			// build the description of the step's items, for status messages
+			TSTRING stepDesc;
+			for (auto i : step.items)
+			{
+				if (stepDesc.length() != 0)
+					stepDesc += _T(", ");
+				stepDesc += planItems[i].desc;
 			}
 
-			// set up the ffmpeg command line
-			TSTRINGEx audioOpts;
-			const TCHAR *framerateOpt = _T("");
-			TSTRINGEx timeLimitOpt;
-			bool isVideo = false;
-			switch (item.mediaType.format)
+			// If the game has already exited, or a shutdown or close event
+			// is already pending, abort this capture before it starts
 			{
-			case MediaType::Image:
-				// image capture - capture one frame only (-vframes 1)
-				audioOpts = _T("-vframes 1");
-				break;
+				HANDLE h[] = { hGameProc, shutdownEvent, closeEvent };
+				if (WaitForMultipleObjects(countof(h), h, FALSE, 0) != WAIT_TIMEOUT)
+				{
+					abortCapture = true;
+					captureOkay = false;
+				}
+			}
 
-			case MediaType::SilentVideo:
-				// video capture, no audio
-				isVideo = true;
-				framerateOpt = _T("-framerate 30");
-				timeLimitOpt.Format(_T("-t %d"), item.captureTime / 1000);
-				audioOpts = _T("-c:a none");
-				break;
+			// add a status line for each item in the step
+			auto StatusForItems = [&statusList, &planItems, &step](int msgId)
+			{
+				for (auto i : step.items)
+					statusList.Error(MsgFmt(_T("%s: %s"), planItems[i].desc.c_str(), LoadStringT(msgId).c_str()));
+			};
 
-			case MediaType::VideoWithAudio:
-				// video capture with optional audio
-				isVideo = true;
-				framerateOpt = _T("-framerate 30");
-				timeLimitOpt.Format(_T("-t %d"), item.captureTime / 1000);
-				if (item.enableAudio && audioCaptureDevice.length() != 0)
-					audioOpts.Format(_T("-f dshow -i audio=\"%s\""), audioCaptureDevice.c_str());
-				else
-					audioOpts = _T("-c:a none");
-				break;
+			// if we've already decided to abort, just note that the items
+			// weren't captured
+			if (abortCapture)
+			{
+				StatusForItems(IDS_ERR_CAP_ITEM_NOT_STARTED);
+				continue;
 			}
 
-			// Build the full command line, depending on whether we're in 
-			// normal one-pass mode or two-pass video mode.
-			TSTRINGEx cmdline1;
-			TSTRINGEx cmdline2;
-			TSTRINGEx tmpfile;
-			if (isVideo && capture.twoPassEncoding)
+			// set the status window message
+			curStatus.Format(LoadStringT(IDS_CAPSTAT_ITEM), stepDesc.c_str());
+			capture.statusWin->SetCaptureStatus(curStatus, step.time);
+
+			// Move the status window over the first visible window that
+			// this step isn't capturing.  If we're capturing all of them,
+			// which is the usual case in combined mode, look for a window
+			// where we're only capturing still images.  ffmpeg grabs a
+			// still as soon as it starts, so we can move the status window
+			// over that window once the still images are written, and
+			// keep it there for the rest of the step.  Hide the status
+			// window until then, or for the whole step if every window
+			// has a video capture.
+			FrameWin *statusOver = nullptr, *stillOver = nullptr;
+			std::vector<size_t> stillItems;
+			auto app = Application::Get();
+			for (FrameWin *win : { (FrameWin*)app->GetPlayfieldWin(), (FrameWin*)app->GetBackglassWin(),
+				(FrameWin*)app->GetDMDWin(), (FrameWin*)app->GetTopperWin() })
 			{
-				// Two-pass encoding.  Capture the video with the lossless h265
-				// code in the fastest mode, with no rotation, to a temp file.
-				// We'll re-encode to the actual output file and apply rotations
-				// in the second pass.
-				tmpfile = std::regex_replace(item.filename, std::basic_regex<TCHAR>(_T("\\.([^.]+)$")), _T(".tmp.$1"));
-				cmdline1.Format(_T("\"%s\" -loglevel error")
-					_T(" -f gdigrab %s")
-					_T(" -offset_x %d -offset_y %d -video_size %dx%d -i desktop")
-					_T(" %s %s -c:v libx264 -crf 0 -preset ultrafast \"%s\""),
-					ffmpeg, framerateOpt,
-					item.rc.left, item.rc.top, item.rc.right - item.rc.left, item.rc.bottom - item.rc.top,
-					audioOpts.c_str(), timeLimitOpt.c_str(), tmpfile.c_str());
-
-				// Format the command line for the second pass while we're here
-				cmdline2.Format(_T("\"%s\" -loglevel error")
-					_T(" -i \"%s\"")
-					_T(" %s -c:a copy -max_muxing_queue_size 1024 \"%s\""),
-					ffmpeg,
-					tmpfile.c_str(),
-					rotateOpt, item.filename.c_str());
+				RECT rcWin;
+				if (win == nullptr || !IsWindowVisible(win->GetHWnd()) || !GetWindowRect(win->GetHWnd(), &rcWin))
+					continue;
+
+				// find the items capturing this window
+				std::vector<size_t> overlapping;
+				for (auto i : step.items)
+				{
+					RECT rcOverlap;
+					if (IntersectRect(&rcOverlap, &rcWin, &planItems[i].rc))
+						overlapping.push_back(i);
+				}
+
+				// if there are none, use this window
+				if (overlapping.size() == 0)
+				{
+					statusOver = win;
+					break;
+				}
+
+				// note the first window with only still image captures
+				if (stillOver == nullptr
+					&& std::none_of(overlapping.begin(), overlapping.end(), [&planItems](size_t i) { return planItems[i].isVideo; }))
+				{
+					stillOver = win;
+					stillItems = std::move(overlapping);
+				}
 			}
-			else
+			if (statusOver != nullptr)
 			{
-				// normal one-pass encoding - include all options and encode
-				// directly to the desired output file
-				cmdline1.Format(_T("\"%s\" -loglevel error")
-					_T(" -f gdigrab %s")
-					_T(" -offset_x %d -offset_y %d -video_size %dx%d -i desktop")
-					_T(" %s %s %s \"%s\""),
-					ffmpeg, framerateOpt,
-					item.rc.left, item.rc.top, item.rc.right - item.rc.left, item.rc.bottom - item.rc.top,
-					audioOpts.c_str(), rotateOpt, timeLimitOpt.c_str(), item.filename.c_str());
+				capture.statusWin->PositionOver(statusOver);
+				stillOver = nullptr;
 			}
+			else
+				ShowWindow(capture.statusWin->GetHWnd(), SW_HIDE);
 
-			auto RunFFMPEG = [this, &statusList, &curStatus, &itemDesc, &captureOkay, &abortCapture](TSTRINGEx &cmdline, bool logSuccess)
+			// Log the command for debugging purposes, as there's a lot that
+			// can go wrong here and little information back from ffmpeg that
+			// we can analyze mechanically.
+			LogFile::Get()->Write(LogFile::Info, LogFile::SysCapture, _T("%s:\n> %s\n"), curStatus.c_str(), step.cmdline.c_str());
+
+			// launch ffmpeg
+			bool stepOkay = false;
+			HandleHolder hFfmpegProc;
+			if (CaptureEncoder::LaunchFFmpeg(step.cmdline, 0, hFfmpegProc))
 			{
-				// presume failure
-				bool result = false;
-
-				// Log the command for debugging purposes, as there's a lot that
-				// can go wrong here and little information back from ffmpeg that
-				// we can analyze mechanically.
-				LogFile::Get()->Write(_T("%s:\n> %s\n"), curStatus.c_str(), cmdline.c_str());
-
-				// open the NUL file as stdin for the child
-				SECURITY_ATTRIBUTES sa;
-				sa.nLength = sizeof(sa);
-				sa.lpSecurityDescriptor = NULL;
-				sa.bInheritHandle = TRUE;
-				HandleHolder hNulIn = CreateFile(_T("NUL"), GENERIC_READ, 0, &sa, OPEN_EXISTING, 0, NULL);
-
-				// Set up the startup info.  Use Show-No-Activate to try to keep
-				// the game window activated and in the foreground, since VP (and
-				// probably others) stop animations when in the background.
-				STARTUPINFO startupInfo;
-				ZeroMemory(&startupInfo, sizeof(startupInfo));
-				startupInfo.cb = sizeof(startupInfo);
-				startupInfo.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES;
-				startupInfo.wShowWindow = SW_SHOWNOACTIVATE;
-				startupInfo.hStdInput = hNulIn;
-				startupInfo.hStdOutput = startupInfo.hStdError = LogFile::Get()->GetFileHandle();
-
-				// launch the process
-				PROCESS_INFORMATION procInfo;
-				if (CreateProcess(NULL, cmdline.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW, 
-					NULL, NULL, &startupInfo, &procInfo))
+				// ffmpeg launched successfully.  Wait for ffmpeg to finish, for
+				// the game to exit, or for one of our cancellation events.
+				// If we're waiting to move the status window over a window
+				// with only still image captures, check periodically for the
+				// still images to be written.
+				HANDLE h[] = { hFfmpegProc, hGameProc, shutdownEvent, closeEvent };
+				DWORD result;
+				while ((result = WaitForMultipleObjects(countof(h), h, FALSE, stillOver != nullptr ? 100 : INFINITE)) == WAIT_TIMEOUT)
 				{
-					// ffmpeg launched successfully.  Wait for ffmpeg to finish, for
-					// the game to exit, or for one of our  cancellation events.
-					HandleHolder hFfmpegProc(procInfo.hProcess);
-					CloseHandle(procInfo.hThread);
-					HANDLE h[] = { hFfmpegProc, hGameProc, shutdownEvent, closeEvent };
-					switch (WaitForMultipleObjects(countof(h), h, FALSE, INFINITE))
+					if (std::all_of(stillItems.begin(), stillItems.end(), [&planItems](size_t i) { return FileExists(planItems[i].filename.c_str()); }))
 					{
-					case WAIT_OBJECT_0:
-						// ffmpeg finished.  Count this as a success.
-						if (logSuccess)
-							statusList.Error(MsgFmt(_T("%s: %s"), itemDesc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_OK).c_str()));
-						result = true;
-						break;
-
-					case WAIT_OBJECT_0 + 1:
-					case WAIT_OBJECT_0 + 2:
-					case WAIT_OBJECT_0 + 3:
-					default:
-						// Shutdown event, close event, or premature game termination,
-						// or another error.  Count this as an interrupted capture.
-						statusList.Error(MsgFmt(_T("%s: %s"), itemDesc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_INTERRUPTED).c_str()));
-						captureOkay = false;
-						abortCapture = true;
-						break;
+						capture.statusWin->PositionOver(stillOver);
+						stillOver = nullptr;
 					}
 				}
-				else
+				switch (result)
 				{
-					// Error launching ffmpeg.  It's likely that all subsequent
-					// ffmpeg launch attempts will fail, because the problem is
-					// probably something permanent (e.g., ffmpeg.exe isn't
-					// installed where we expect it to be installed, or there's
-					// a file permissions problem).  So skip any remaining items
-					// by setting the 'abort' flag.
-					statusList.Error(MsgFmt(_T("%s: %s"), itemDesc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_NOT_STARTED).c_str()));
+				case WAIT_OBJECT_0:
+					// ffmpeg finished.  Count this as a success.
+					stepOkay = true;
+					break;
+
+				case WAIT_OBJECT_0 + 1:
+				case WAIT_OBJECT_0 + 2:
+				case WAIT_OBJECT_0 + 3:
+				default:
+					// Shutdown event, close event, or premature game termination,
+					// or another error.  Count this as an interrupted capture.
+					StatusForItems(IDS_ERR_CAP_ITEM_INTERRUPTED);
 					captureOkay = false;
 					abortCapture = true;
+					break;
 				}
+			}
+			else
+			{
+				// Error launching ffmpeg.  It's likely that all subsequent
+				// ffmpeg launch attempts will fail, because the problem is
+				// probably something permanent (e.g., ffmpeg.exe isn't
+				// installed where we expect it to be installed, or there's
+				// a file permissions problem).  So skip any remaining items
+				// by setting the 'abort' flag.
+				StatusForItems(IDS_ERR_CAP_ITEM_NOT_STARTED);
+				captureOkay = false;
+				abortCapture = true;
+			}
 
-				// add a blank line to the log for readability 
-				LogFile::Get()->Write(_T("\n"));
-
-				// return the status
-				return result;
-			};
+			// add a blank line to the log for readability 
+			LogFile::Get()->Write(LogFile::Info, LogFile::SysCapture, _T("\n"));
 
-			// run the first pass
-			if (RunFFMPEG(cmdline1, cmdline1.length() == 0))
+			// Wrap up the items.  For a two-pass video, queue the second
+			// pass for the background encoder if the capture succeeded, and
+			// otherwise discard the intermediate file.  Update the media
+			// index for everything else now.
+			for (auto i : step.items)
 			{
-				// success - if there's a second pass, run it
-				if (cmdline2.length() != 0)
+				auto &planItem = planItems[i];
+				auto enc = std::find_if(plan.encode.begin(), plan.encode.end(), [i](const CapturePlanner::Step &e) { return e.items[0] == i; });
+				if (enc == plan.encode.end())
+				{
+					if (stepOkay)
+						statusList.Error(MsgFmt(_T("%s: %s"), planItem.desc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_OK).c_str()));
+
+					GameList::Get()->GetMediaIndex()->OnFileChanged(planItem.filename.c_str());
+				}
+				else if (stepOkay)
 				{
-					curStatus.Format(LoadStringT(IDS_CAPSTAT_ENCODING_ITEM), itemDesc.c_str());
-					capture.statusWin->SetCaptureStatus(curStatus.c_str(), item.captureTime*3/2);
-					RunFFMPEG(cmdline2, true);
+					statusList.Error(MsgFmt(_T("%s: %s"), planItem.desc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_ENCODING).c_str()));
+					encodeJobs.emplace_back(enc->cmdline.c_str(), planItem.desc.c_str(), planItem.filename.c_str(), enc->tempFiles[0].c_str());
+				}
+				else
+				{
+					if (FileExists(enc->tempFiles[0].c_str()))
+						DeleteFile(enc->tempFiles[0].c_str());
 				}
 			}
-
-			// if there's a temp file, delete it
-			if (tmpfile.length() != 0 && FileExists(tmpfile.c_str()))
-				DeleteFile(tmpfile.c_str());
 		}
 
 		// We're done with the capture process, either because we finished
@@ -2858,6 +2883,9 @@ DWORD Application::GameMonitorThread::Main()
 		if (WaitForSingleObject(hGameProc, 0) == WAIT_TIMEOUT)
 			CloseGame();
 
+		// hand off the second-pass encoding jobs to the background encoder
+		CaptureEncoder::Get()->Queue(game.title.c_str(), encodeJobs);
+
 		// close the capture status window
 		capture.statusWin->PostMessage(WM_CLOSE);
 
@@ -3491,7 +3519,8 @@ void Application::AdminHost::Shutdown()
 //
 
 Application::NewFileScanThread::NewFileScanThread() :
-	hwndPlayfieldView(NULL)
+	hwndPlayfieldView(NULL),
+	mediaIndex(nullptr)
 {
 }
 
@@ -3529,6 +3558,10 @@ bool Application::NewFileScanThread::Launch()
 	// from accessing the game list data from a thread.
 	GameList::Get()->EnumTableFileSets([this](const TableFileSet &t) { dirs.emplace_back(t); });
 
+	// Get the media file index.  The index does its own locking, so
+	// the thread can access it directly.
+	mediaIndex = GameList::Get()->GetMediaIndex();
+
 	// let the thread start executing
 	ResumeThread(hThread);
 
@@ -3565,6 +3598,12 @@ namespace fs = std::experimental::filesystem;
 
 DWORD Application::NewFileScanThread::Main()
 {
+	// Check the media folders for changes made by other programs while
+	// we were in the background.  This marks any modified folders for
+	// re-listing on the next media lookup.
+	if (mediaIndex != nullptr)
+		mediaIndex->CheckForChanges();
+
 	// scan each directory in our list
 	for (auto &d : dirs)
 	{
@@ -376,6 +376,10 @@ protected:
 		// playfield view window handle
 		HWND hwndPlayfieldView;
 
+		// Media file index.  We check the indexed media folders for
+		// external changes while we're scanning for new table files.
+		MediaFileIndex *mediaIndex;
+
 		// List of directories to scan, and existing files already
 		// in the game list.  This is essentially a private copy of
 		// the TableFileSet list from the GameList object.  We make
@@ -543,7 +547,7 @@ protected:
 		};
 		struct CaptureInfo
 		{
-			CaptureInfo() : startupDelay(5000), twoPassEncoding(false) { }
+			CaptureInfo() : startupDelay(5000), twoPassEncoding(false), combined(true) { }
 
 			// startup delay time, in milliseconds
 			DWORD startupDelay;
@@ -551,6 +555,12 @@ protected:
 			// two-pass encoding mode
 			bool twoPassEncoding;
 
+			// combined capture mode (capture all items in one ffmpeg run)
+			bool combined;
+
+			// ffmpeg path from the config, or empty to use the deployed copy
+			TSTRING ffmpegPath;
+
 			// capture list
 			std::list<CaptureItem> items;
 
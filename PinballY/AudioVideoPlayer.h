@@ -104,6 +104,12 @@ public:
 	// Is a frame ready yet?
 	virtual bool IsFrameReady() const = 0;
 
+	// Is a new frame ready to render?  This returns true if a frame
+	// has been decoded since the last Render() call, meaning that the
+	// next render will show something new.  Implementations that can't
+	// tell assume that a playing video always has a new frame.
+	virtual bool IsNewFrameReady() const { return IsPlaying(); }
+
 	// Set looping playback.  When set, we'll automatically
 	// restart the video from the beginning whenever we reach
 	// the end.
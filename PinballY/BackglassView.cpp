@@ -156,6 +156,10 @@ void BackglassBaseView::RemoveInstructionCard()
 		// start the fade-out, and set the timer to monitor for completion
 		instructionCard->StartFade(-1, instCardFadeTime);
 		SetTimer(hWnd, animTimerID, animTimerInterval, 0);
+
+		// we're called from the main view, so request the first frame
+		// of the fade explicitly
+		InvalidateRender();
 	}
 }
 
@@ -183,7 +183,10 @@ void BaseView::AsyncSpriteLoader::AsyncLoad(
 	RefPtr<VideoSprite> sprite(new VideoSprite());
 
 	// load it
-	load(sprite);
+	{
+		PERF_ZONE(_T("AsyncSpriteLoad"));
+		load(sprite);
+	}
 
 	// complete the loading
 	done(sprite);
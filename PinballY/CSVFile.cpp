@@ -2,33 +2,338 @@
 // Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
 //
 #include "stdafx.h"
+#include <intrin.h>
+#include <emmintrin.h>
 #include "Resource.h"
 #include "CSVFile.h"
+#include "DateUtil.h"
 
-CSVFile::CSVFile() : dirty(false)
+CSVFile::CSVFile() : 
+	dirty(false),
+	fileView(nullptr),
+	viewCodePage(CP_ACP)
 {
 }
 
 CSVFile::~CSVFile()
 {
+	ReleaseFileView(false);
 }
 
-CSVFile::Column *CSVFile::DefineColumn(const TCHAR *name)
+CSVFile::Column *CSVFile::DefineColumn(const TCHAR *name, Column::Type type)
 {
 	// look for an existing column of the same name
 	if (auto it = columns.find(name); it != columns.end())
-		return &it->second;
+	{
+		// if the caller is specifying a type, apply it
+		Column *col = &it->second;
+		if (type != Column::String && type != col->type)
+		{
+			col->type = type;
+			col->RebuildTypedValues();
+		}
+		return col;
+	}
 
 	// it's not there yet - add a new column
 	auto it = columns.emplace(
 		std::piecewise_construct,
 		std::forward_as_tuple(name),
-		std::forward_as_tuple(this, name, (int)columns.size()));
-	return &it.first->second;
+		std::forward_as_tuple(this, name, (int)columns.size(), type));
+
+	// if it's typed, set up its typed value array for any existing rows
+	Column *col = &it.first->second;
+	col->RebuildTypedValues();
+	return col;
+}
+
+// Find the next field separator (comma, CR, or LF) in a multibyte
+// buffer, or the end of the buffer if there are no more separators.
+// This checks 16 bytes at a time with SSE2 compares.  The separators
+// are all ASCII characters below 0x40, which never appear as trail
+// bytes in UTF-8 or in the Windows DBCS code pages, so a byte-wise
+// search is safe for all of the multibyte formats we read.
+static char *ScanForSeparator(char *p, char *endp)
+{
+	const __m128i comma = _mm_set1_epi8(','), cr = _mm_set1_epi8(13), lf = _mm_set1_epi8(10);
+	for (; endp - p >= 16; p += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i m = _mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, cr)), _mm_cmpeq_epi8(v, lf));
+		if (int mask = _mm_movemask_epi8(m); mask != 0)
+		{
+			unsigned long i;
+			_BitScanForward(&i, mask);
+			return p + i;
+		}
+	}
+
+	// finish up byte by byte
+	for (; p != endp && *p != ',' && *p != 10 && *p != 13; ++p);
+	return p;
+}
+
+// Find the next double quote in a multibyte buffer, or the end of the
+// buffer if there are no more quotes
+static char *ScanForQuote(char *p, char *endp)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	for (; endp - p >= 16; p += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)); mask != 0)
+		{
+			unsigned long i;
+			_BitScanForward(&i, mask);
+			return p + i;
+		}
+	}
+
+	// finish up byte by byte
+	for (; p != endp && *p != '"'; ++p);
+	return p;
+}
+
+void CSVFile::Field::Materialize(UINT codePage) const
+{
+	// if the field isn't a view of the file data, there's nothing to do
+	if (raw == nullptr)
+		return;
+
+	// convert the text to wide characters in our private buffer
+	int n = rawLen == 0 ? 0 : MultiByteToWideChar(codePage, 0, raw, (int)rawLen, nullptr, 0);
+	TCHAR *dst = Reserve(n + 1);
+	if (n != 0)
+		MultiByteToWideChar(codePage, 0, raw, (int)rawLen, dst, n);
+	dst[n] = 0;
+
+	// the converted text is now the value
+	value = dst;
+	raw = nullptr;
+}
+
+void CSVFile::ReleaseFileView(bool keepValues)
+{
+	// if there's no view, there's nothing to do
+	if (fileView == nullptr)
+		return;
+
+	// convert any fields still referring to the view, if desired
+	if (keepValues)
+	{
+		for (auto &row : rows)
+		{
+			for (auto &field : row.fields)
+				field.Materialize(viewCodePage);
+		}
+	}
+
+	// unmap the view and close the mapping
+	UnmapViewOfFile(fileView);
+	fileView = nullptr;
+	hFileMapping.Clear();
+}
+
+bool CSVFile::ReadMapped(UINT mbCodePage)
+{
+	// open the file and get its size
+	HandleHolder hFile = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0 || size.HighPart != 0)
+		return false;
+
+	// Map it copy-on-write.  This lets us modify the view in place to
+	// remove the quotes from quoted fields, without affecting the file.
+	// Only the pages we actually modify are copied.
+	HandleHolder hMap = CreateFileMapping(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (hMap == NULL)
+		return false;
+
+	char *view = static_cast<char*>(MapViewOfFile(hMap, FILE_MAP_COPY, 0, 0, 0));
+	if (view == nullptr)
+		return false;
+
+	// Check for byte-order markers.  A UTF-8 marker overrides the
+	// caller's code page.  A UTF-16 or UTF-32 marker means that this
+	// isn't a multibyte file at all, so let the caller read it through
+	// the wide-character reader.
+	const BYTE *b = reinterpret_cast<const BYTE*>(view);
+	char *p = view, *endp = view + size.LowPart;
+	UINT codePage = mbCodePage;
+	if (size.LowPart >= 3 && b[0] == 0xEF && b[1] == 0xBB && b[2] == 0xBF)
+	{
+		codePage = CP_UTF8;
+		p += 3;
+	}
+	else if (size.LowPart >= 2
+		&& ((b[0] == 0xFF && (b[1] == 0xFE || b[1] == 0xFD)) || (b[1] == 0xFF && (b[0] == 0xFE || b[0] == 0xFD))))
+	{
+		UnmapViewOfFile(view);
+		return false;
+	}
+
+	// clear all existing rows, and switch to the new view
+	rows.clear();
+	ReleaseFileView(false);
+	fileContents.reset();
+	hFileMapping = hMap.Detach();
+	fileView = view;
+	viewCodePage = codePage;
+
+	// we're now synced with the disk version
+	dirty = false;
+
+	// Parse a field.  This follows the same rules as the wide-character
+	// parser in Read(), but works on the bytes of the mapped view, and
+	// returns the field as a view of the bytes rather than a null-
+	// terminated string.
+	bool eol = false;
+	bool eof = false;
+	size_t fieldLen = 0;
+	auto ParseField = [&p, endp, &eol, &eof, &fieldLen]()
+	{
+		// presume we won't reach the end of the line or end of file
+		eol = false;
+		eof = false;
+
+		char *start;
+		if (p != endp && *p == '"')
+		{
+			// It's a quoted value.  Find the closing quote.  As long as
+			// there are no stuttered quotes, the value is simply the text
+			// between the quotes, which we can use where it lies.  At
+			// the first stuttered quote, start compacting the rest of the
+			// value over the removed quotes.  'dst' is the output
+			// position for the compacted text, once we've started.
+			start = ++p;
+			char *dst = nullptr;
+			char *end;
+			for (;;)
+			{
+				// find the next quote, moving the text before it into
+				// place if we're compacting
+				char *q = ScanForQuote(p, endp);
+				if (dst != nullptr)
+				{
+					memmove(dst, p, q - p);
+					dst += q - p;
+				}
+				p = q;
+
+				// stop at end of file
+				if (p == endp)
+				{
+					end = dst != nullptr ? dst : p;
+					break;
+				}
+
+				// Skip the quote.  If it's not stuttered, it's our closing
+				// quote, so stop here.  If another quote immediately 
+				// follows, keep one quote - the "" sequence turns into a
+				// single ".
+				if (++p != endp && *p == '"')
+				{
+					if (dst == nullptr)
+						dst = p;
+					else
+						*dst++ = '"';
+					++p;
+					continue;
+				}
+
+				end = dst != nullptr ? dst : p - 1;
+				break;
+			}
+			fieldLen = end - start;
+
+			// If we're not at a newline, comma, or end of file, the quoted
+			// item is ill-formed.  Simply skip any intervening characters
+			// until the next separator.
+			p = ScanForSeparator(p, endp);
+		}
+		else
+		{
+			// It's not quoted.  Parse everything up to the end of the
+			// field - comma, newline, or end of file.
+			start = p;
+			p = ScanForSeparator(p, endp);
+			fieldLen = p - start;
+		}
+
+		// If we're not at end-of-file, we're at a separator.  Skip it
+		// so that we're positioned at the start of the next field.
+		// If we're at a newline, skip all consecutive newlines.
+		if (p == endp)
+			eof = eol = true;
+		else if (*p == ',')
+			++p;
+		else
+			for (eol = true; p != endp && (*p == 10 || *p == 13); ++p);
+
+		// return the start of the field
+		return start;
+	};
+
+	// Parse the typed column values for all rows, as in Read()
+	auto ParseTypedColumns = [this]()
+	{
+		for (auto &c : columns)
+			c.second.RebuildTypedValues();
+		return true;
+	};
+
+	// skip any leading blank lines
+	for (; p != endp && (*p == 10 || *p == 13); ++p);
+	if (p == endp)
+		return ParseTypedColumns();
+
+	// Parse the column list from the first line
+	for (int colno = 0; !eol; ++colno)
+	{
+		// parse a field, and convert it to a wide-character column name
+		const char *colname = ParseField();
+		Field f(colname, fieldLen);
+
+		// look it up, and set the column index to match the file layout
+		Column *col = DefineColumn(f.Get(codePage, _T("")));
+		col->index = colno;
+	}
+
+	// Now parse each line
+	while (!eof)
+	{
+		// skip blank lines
+		for (; p != endp && (*p == 10 || *p == 13); ++p);
+		if (p == endp)
+			return ParseTypedColumns();
+
+		// create a new row
+		rows.emplace_back();
+		Row &row = rows.back();
+
+		// parse the fields
+		for (eol = false; !eol; )
+		{
+			const char *val = ParseField();
+			row.fields.emplace_back(val, fieldLen);
+		}
+	}
+
+	// parse the typed columns, and return success
+	return ParseTypedColumns();
 }
 
 bool CSVFile::Read(ErrorHandler &eh, UINT mbCodePage)
 {
+	// If it's a multibyte file, read it through a memory mapping
+	if (ReadMapped(mbCodePage))
+		return true;
+
 	// read the file into memory
 	long fileLen;
 	wchar_t *contents = ReadFileAsWStr(filename.c_str(), eh, fileLen, ReadFileAsStr_NullTerm, mbCodePage);
@@ -37,8 +342,10 @@ bool CSVFile::Read(ErrorHandler &eh, UINT mbCodePage)
 	if (contents == nullptr)
 		return false;
 
-	// clear all existing rows
+	// clear all existing rows, and release any mapped view from a
+	// previous read
 	rows.clear();
+	ReleaseFileView(false);
 
 	// we're now synced with the disk verison
 	dirty = false;
@@ -136,10 +443,20 @@ bool CSVFile::Read(ErrorHandler &eh, UINT mbCodePage)
 		return start;
 	};
 
+	// Parse the typed column values for all rows.  We do this once at
+	// load time, so that the typed getters can read the parsed values
+	// directly rather than re-parsing the text on each access.
+	auto ParseTypedColumns = [this]()
+	{
+		for (auto &c : columns)
+			c.second.RebuildTypedValues();
+		return true;
+	};
+
 	// skip any leading blank lines
 	for (; *p == 10 || *p == 13; ++p);
 	if (*p == 0)
-		return true;
+		return ParseTypedColumns();
 
 	// The first line of a CSV is the column list.  Parse it.  For each
 	// column, determine if the column exists in our current column set:
@@ -163,7 +480,7 @@ bool CSVFile::Read(ErrorHandler &eh, UINT mbCodePage)
 		// skip blank lines
 		for (; *p == 10 || *p == 13; ++p);
 		if (*p == 0)
-			return true;
+			return ParseTypedColumns();
 
 		// create a new row
 		rows.emplace_back();
@@ -177,12 +494,17 @@ bool CSVFile::Read(ErrorHandler &eh, UINT mbCodePage)
 		}
 	}
 
-	// success
-	return true;
+	// parse the typed columns, and return success
+	return ParseTypedColumns();
 }
 
 bool CSVFile::Write(ErrorHandler &eh)
 {
+	// If we have a mapped view of the file, convert all of the fields
+	// that still refer to it and release it, since Windows won't let
+	// us rewrite a file while it's mapped.
+	ReleaseFileView(true);
+
 	// open the file
 	FILE *fp = nullptr;
 	if (int err = _tfopen_s(&fp, filename.c_str(), _T("w,ccs=UTF-16LE")); err != 0)
@@ -246,7 +568,7 @@ bool CSVFile::Write(ErrorHandler &eh)
 				return ReportError(errno);
 
 			// write the column value
-			if (!CSVify(field.Get(), -1, WriteSegment))
+			if (!CSVify(field.Get(viewCodePage), -1, WriteSegment))
 				return false;
 
 			// we'll need a comma before the next column
@@ -469,6 +791,13 @@ int CSVFile::CreateRow()
 	// add a row at the end of the vector
 	rows.emplace_back();
 
+	// add an empty parsed value to each typed column
+	for (auto &c : columns)
+	{
+		if (c.second.type != Column::String)
+			c.second.typedValues.emplace_back();
+	}
+
 	// return the row number
 	return (int)(rows.size() - 1);
 }
@@ -477,33 +806,153 @@ const TCHAR *CSVFile::Column::Get(int rowIndex, const TCHAR *defaultVal) const
 {
 	// get the value from the field, if it exists; otherwise use the default
 	if (Field *field = GetField(rowIndex); field != nullptr)
-		return field->Get(defaultVal);
+		return field->Get(csv->viewCodePage, defaultVal);
 	else
 		return defaultVal;
 }
 
+// Text parsing rules for the typed getters.  The typed value cache
+// uses the same rules, so that a typed column returns exactly what the
+// text getters would.
+static bool ParseIntValue(const TCHAR *val, int &i)
+{
+	if (val == nullptr || val[0] == 0)
+		return false;
+	i = _ttoi(val);
+	return true;
+}
+
+static bool ParseFloatValue(const TCHAR *val, float &f)
+{
+	if (val == nullptr || val[0] == 0)
+		return false;
+	f = _tcstof(val, nullptr);
+	return true;
+}
+
+static bool ParseBoolValue(const TCHAR *val, bool &b)
+{
+	if (val == nullptr)
+		return false;
+	b = val[0] == 'Y' || val[0] == 'y' || _ttoi(val) != 0;
+	return true;
+}
+
+static bool ParseDateValue(const TCHAR *val, DATE &d)
+{
+	if (val == nullptr || val[0] == 0)
+		return false;
+	DateTime dt(val);
+	if (!dt.IsValid())
+		return false;
+	d = dt.ToVariantDate();
+	return true;
+}
+
 int CSVFile::Column::GetInt(int rowIndex, int defaultVal) const
 {
-	if (const TCHAR *val = Get(rowIndex, nullptr); val != nullptr && val[0] != 0)
-		return _ttoi(val);
-	else
-		return defaultVal;
+	int i;
+	if (type == Int)
+	{
+		const TypedValue *tv = GetTypedValue(rowIndex);
+		return tv != nullptr ? tv->i : defaultVal;
+	}
+	return ParseIntValue(Get(rowIndex, nullptr), i) ? i : defaultVal;
 }
 
 float CSVFile::Column::GetFloat(int rowIndex, float defaultVal) const
 {
-	if (const TCHAR *val = Get(rowIndex, nullptr); val != nullptr && val[0] != 0)
-		return _tcstof(val, nullptr);
-	else
-		return defaultVal;
+	float f;
+	if (type == Float)
+	{
+		const TypedValue *tv = GetTypedValue(rowIndex);
+		return tv != nullptr ? tv->f : defaultVal;
+	}
+	return ParseFloatValue(Get(rowIndex, nullptr), f) ? f : defaultVal;
 }
 
 bool CSVFile::Column::GetBool(int rowIndex, bool defaultVal) const
 {
-	if (const TCHAR *val = Get(rowIndex, nullptr); val != nullptr)
-		return val[0] == 'Y' || val[0] == 'y' || _ttoi(val) != 0;
-	else
-		return defaultVal;
+	bool b;
+	if (type == Bool)
+	{
+		const TypedValue *tv = GetTypedValue(rowIndex);
+		return tv != nullptr ? tv->b : defaultVal;
+	}
+	return ParseBoolValue(Get(rowIndex, nullptr), b) ? b : defaultVal;
+}
+
+DATE CSVFile::Column::GetDate(int rowIndex, DATE defaultVal) const
+{
+	DATE d;
+	if (type == Date)
+	{
+		const TypedValue *tv = GetTypedValue(rowIndex);
+		return tv != nullptr ? tv->d : defaultVal;
+	}
+	return ParseDateValue(Get(rowIndex, nullptr), d) ? d : defaultVal;
+}
+
+bool CSVFile::Column::HasValue(int rowIndex) const
+{
+	const TCHAR *val = Get(rowIndex, nullptr);
+	return val != nullptr && val[0] != 0;
+}
+
+const CSVFile::Column::TypedValue *CSVFile::Column::GetTypedValue(int rowIndex) const
+{
+	if (rowIndex < 0 || rowIndex >= (int)typedValues.size() || !typedValues[rowIndex].present)
+		return nullptr;
+
+	return &typedValues[rowIndex];
+}
+
+void CSVFile::Column::ParseTypedValue(int rowIndex) const
+{
+	// make sure the array covers the row
+	if (rowIndex < 0)
+		return;
+	if (rowIndex >= (int)typedValues.size())
+		typedValues.resize(csv->rows.size());
+
+	// parse the text according to the column type
+	TypedValue &tv = typedValues[rowIndex];
+	const TCHAR *val = Get(rowIndex, nullptr);
+	switch (type)
+	{
+	case Int:
+		tv.present = ParseIntValue(val, tv.i);
+		break;
+
+	case Float:
+		tv.present = ParseFloatValue(val, tv.f);
+		break;
+
+	case Bool:
+		tv.present = ParseBoolValue(val, tv.b);
+		break;
+
+	case Date:
+		tv.present = ParseDateValue(val, tv.d);
+		break;
+
+	default:
+		tv.present = false;
+		break;
+	}
+}
+
+void CSVFile::Column::RebuildTypedValues() const
+{
+	// String columns don't keep parsed values
+	typedValues.clear();
+	if (type == String)
+		return;
+
+	// parse each row
+	typedValues.resize(csv->rows.size());
+	for (int i = 0; i < (int)typedValues.size(); ++i)
+		ParseTypedValue(i);
 }
 
 CSVFile::Column::ParsedData *CSVFile::Column::GetParsedData(int rowIndex) const
@@ -559,6 +1008,10 @@ void CSVFile::Column::Set(int rowIndex, const TCHAR *val) const
 		// store the new value
 		field->Set(val);
 
+		// update the parsed value for a typed column
+		if (type != String)
+			ParseTypedValue(rowIndex);
+
 		// mark the in-memory database as updated
 		csv->dirty = true;
 	}
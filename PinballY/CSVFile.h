@@ -3,6 +3,24 @@
 //
 // CSVFile - simple database manager for CSV files
 //
+// The file is stored in memory as text, one string per field, so that
+// we can write it back exactly as we read it.  Columns that hold
+// numeric, boolean, or date values can optionally be declared with a
+// type, in which case we also keep a parsed copy of the column's
+// values in a contiguous array, indexed by row.  The typed accessors
+// (GetInt, GetFloat, GetBool, GetDate) then read the array directly
+// instead of re-parsing the text on every call.  The parsed values are
+// built when the file is loaded, and updated whenever a field in the
+// column is set.
+//
+// Files in single-byte or UTF-8 format (which includes our large
+// reference lists, such as the IPDB table list) are read through a
+// copy-on-write memory mapping of the file, and parsed in place.  The
+// fields are initially just views into the mapped bytes; we only
+// convert a field to a wide-character string the first time someone
+// asks for its value.  UTF-16 files are read into memory and parsed
+// as wide-character text.
+//
 
 #pragma once
 
@@ -70,19 +88,43 @@ public:
 		friend class CSVFile;
 
 	public:
-		Column(CSVFile *csv, const TCHAR *name, int index) : csv(csv), name(name), index(index) { }
+		// Column value type.  String columns are stored as text only.
+		// The other types are also kept in parsed form, for fast access
+		// via the typed getters.  Date values use the "YYYYMMDDhhmmss"
+		// format of DateTime::ToString().
+		enum Type
+		{
+			String,
+			Int,
+			Float,
+			Bool,
+			Date
+		};
+
+		Column(CSVFile *csv, const TCHAR *name, int index, Type type = String) : 
+			csv(csv), name(name), index(index), type(type) { }
 		virtual ~Column() { }
 
 		// get the column name and index
 		const TCHAR *GetName() const { return name.c_str(); }
 		int GetIndex() const { return index; }
 
+		// get the column type
+		Type GetType() const { return type; }
+
 		// get the value from a row
 		const TCHAR *Get(int row, const TCHAR *defaultVal = nullptr) const;
 		int GetInt(int row, int defaultVal = 0) const;
 		float GetFloat(int row, float defaultVal = 0.0f) const;
 		bool GetBool(int row, bool defaultVal = false) const;
 
+		// Get a date value from a row, as a Variant DATE.  Returns the
+		// default if the field is empty or isn't a valid date.
+		DATE GetDate(int row, DATE defaultVal = 0) const;
+
+		// does the row have a non-empty value in this column?
+		bool HasValue(int row) const;
+
 		// set the value in a row
 		void Set(int row, const TCHAR *value) const;
 		void Set(int row, int value) const;
@@ -111,6 +153,33 @@ public:
 		Field *GetField(int rowIndex) const;
 		Field *GetOrCreateField(int rowIndex) const;
 
+		// Parsed value, for typed columns.  'present' follows the
+		// conventions of the text getters: for Int, Float, and Date
+		// columns, it means the field is non-empty (and, for a date,
+		// valid); for Bool columns, it means the field exists at all.
+		struct TypedValue
+		{
+			TypedValue() : present(false), d(0) { }
+
+			bool present;
+			union
+			{
+				int i;
+				float f;
+				bool b;
+				DATE d;
+			};
+		};
+
+		// get the parsed value for a row, or null if it's not present
+		const TypedValue *GetTypedValue(int rowIndex) const;
+
+		// parse the text value of a row into the typed value array
+		void ParseTypedValue(int rowIndex) const;
+
+		// rebuild the typed value array for all rows
+		void RebuildTypedValues() const;
+
 		// my container CSV file
 		CSVFile *csv;
 
@@ -119,12 +188,22 @@ public:
 
 		// column index
 		int index;
+
+		// value type
+		Type type;
+
+		// Parsed values, indexed by row number.  This is empty for String
+		// columns.  It's mutable because it's a cache of the text values,
+		// which the (const) setters update along with the text.
+		mutable std::vector<TypedValue> typedValues;
 	};
 
 	// Define a column.  The client calls this to define the columns in
 	// its schema.  This returns a Column accessor object that the client
-	// can use to access the column field for a given row.
-	Column *DefineColumn(const TCHAR *name);
+	// can use to access the column field for a given row.  If the column
+	// has a type other than String, we keep its values in parsed form as
+	// well as text.
+	Column *DefineColumn(const TCHAR *name, Column::Type type = Column::String);
 
 protected:
 	// filename
@@ -138,61 +217,119 @@ protected:
 	struct Field
 	{
 	public:
-		Field(TCHAR *value) : value(nullptr), fileStorage(nullptr), fileStorageLen(0)
+		Field(TCHAR *value) : Field()
 			{ Set(value); }
 
-		Field(TCHAR *fileStorage, size_t fileStorageLen)
-			: value(fileStorage), fileStorage(fileStorage), fileStorageLen(fileStorageLen) { }
+		// field loaded from wide-character file text
+		Field(TCHAR *fileStorage, size_t fileStorageLen) : Field()
+			{ value = this->fileStorage = fileStorage; this->fileStorageLen = fileStorageLen; }
 
-		Field(Field &field) : value(nullptr), fileStorage(field.fileStorage), fileStorageLen(field.fileStorageLen)
-			{ Set(field.value); }
+		// field loaded from a multibyte file view
+		Field(const char *raw, size_t rawLen) : Field()
+			{ this->raw = raw; this->rawLen = rawLen; }
 
-		~Field() { Clear(); }
+		Field(const Field &field) : Field()
+		{
+			fileStorage = field.fileStorage;
+			fileStorageLen = field.fileStorageLen;
+			raw = field.raw;
+			rawLen = field.rawLen;
+			if (field.value == field.fileStorage)
+				value = fileStorage;
+			else if (field.value != nullptr)
+				Set(field.value);
+		}
 
-		const TCHAR *Get(const TCHAR *defaultVal = nullptr) const
-			{ return value != nullptr ? value : defaultVal; }
+		Field(Field &&field) noexcept :
+			value(field.value), buf(field.buf), bufLen(field.bufLen),
+			fileStorage(field.fileStorage), fileStorageLen(field.fileStorageLen),
+			raw(field.raw), rawLen(field.rawLen), parsedData(std::move(field.parsedData))
+		{
+			field.value = field.buf = nullptr;
+			field.bufLen = 0;
+		}
+
+		~Field() { delete[] buf; }
+
+		// Get the value.  If the field is still a view of the file data,
+		// this converts it to wide characters, using the given code page.
+		const TCHAR *Get(UINT codePage, const TCHAR *defaultVal = nullptr) const
+		{
+			if (value == nullptr && raw != nullptr)
+				Materialize(codePage);
+			return value != nullptr ? value : defaultVal;
+		}
 
 		void Set(const TCHAR *val)
 		{
-			// If we can fit the value into the original file storage
-			// area, reuse that space.  Otherwise, allocate new memory.
-			Clear();
+			// the field is no longer a view of the file data
+			raw = nullptr;
+			value = nullptr;
 			if (val != nullptr)
 			{
+				// If we can fit the value into the original file storage
+				// area, reuse that space.  Otherwise, use our private
+				// buffer, reallocating it only if it's too small.
 				size_t lenNeeded = _tcslen(val) + 1;
 				if (lenNeeded <= fileStorageLen)
-					_tcscpy_s(this->value = fileStorage, fileStorageLen, val);
+					_tcscpy_s(value = fileStorage, fileStorageLen, val);
 				else
-					_tcscpy_s(this->value = new TCHAR[lenNeeded], lenNeeded, val);
+					_tcscpy_s(value = Reserve(lenNeeded), lenNeeded, val);
 			}
 		}
 
+		// Convert the file data view to wide characters, if we haven't
+		// already.  After this, the field no longer refers to the file
+		// data.
+		void Materialize(UINT codePage) const;
+
 		// get/set the parsed data object
 		Column::ParsedData *GetParsedData() const { return parsedData.get(); }
 		void SetParsedData(Column::ParsedData *d) { parsedData.reset(d); }
 
 	protected:
-		// clear the value
-		void Clear()
+		Field() : value(nullptr), buf(nullptr), bufLen(0), 
+			fileStorage(nullptr), fileStorageLen(0), raw(nullptr), rawLen(0) { }
+
+		// make sure the private buffer can hold 'len' characters
+		TCHAR *Reserve(size_t len) const
 		{
-			if (value != nullptr && value != fileStorage)
+			if (len > bufLen)
 			{
-				delete value;
-				value = nullptr;
+				delete[] buf;
+				buf = new TCHAR[bufLen = len];
 			}
+			return buf;
 		}
 
 		// Pointer to the underlying value.  If the value hasn't been
 		// changed since the underlying file was loaded, this points
-		// directly to the file data.  Otherwise it points to our private
-		// value store.
-		TCHAR *value;
-
-		// Original file storage area.  If the field was loaded from file
-		// data, this points to the original file storage area.
+		// directly to the file data (for a wide-character file) or to
+		// the converted copy of the data (for a multibyte file).  If the
+		// value has been changed, it points to the file storage area or
+		// our private buffer.  Null if the field is a null value, or if
+		// a multibyte value hasn't been converted yet.
+		mutable TCHAR *value;
+
+		// Private buffer, for converted and updated values, and its
+		// allocated length in characters.  We keep the buffer across
+		// updates, so that a new value that fits in the old space
+		// doesn't require a new allocation.
+		mutable TCHAR *buf;
+		mutable size_t bufLen;
+
+		// Original file storage area.  If the field was loaded from a
+		// wide-character file, this points to the original file storage.
 		TCHAR *fileStorage;
 		size_t fileStorageLen;
 
+		// Multibyte file data view.  If the field was loaded from a
+		// multibyte file, this points to the field's text within the
+		// mapped file view, until we convert it.  The text isn't null-
+		// terminated, so we also need the length in bytes.
+		mutable const char *raw;
+		size_t rawLen;
+
 		// client-defined parsed data
 		std::unique_ptr<Column::ParsedData> parsedData;
 	};
@@ -206,9 +343,27 @@ protected:
 	// Row list
 	std::vector<Row> rows;
 
-	// Raw file contents
+	// Raw file contents, for a wide-character file
 	std::unique_ptr<wchar_t> fileContents;
 
+	// Read a multibyte file through a memory mapping.  Returns true if
+	// the file was read this way; returns false if the file couldn't be
+	// mapped, or it's a UTF-16 file, in which case the caller should
+	// read it as a wide-character file instead.
+	bool ReadMapped(UINT mbCodePage);
+
+	// Release the mapped file view.  If 'keepValues' is true, we first
+	// convert any fields that still refer to the view.
+	void ReleaseFileView(bool keepValues);
+
+	// Mapped file view, for a multibyte file.  The view is mapped copy-
+	// on-write, so that we can parse quoted fields in place.
+	HandleHolder hFileMapping;
+	char *fileView;
+
+	// code page of the text in the mapped view
+	UINT viewCodePage;
+
 	// have we written field values since loading the file?
 	bool dirty;
 };
@@ -13,4 +13,6 @@ namespace ConfigVars
 	static const TCHAR *CaptureDMVideoTime = _T("Capture.DMDVideoTime");
 	static const TCHAR *CaptureTPVideoTime = _T("Capture.TopperVideoTime");
 	static const TCHAR *CaptureTwoPassEncoding = _T("Capture.TwoPassEncoding");
+	static const TCHAR *CaptureCombined = _T("Capture.CombinedCapture");
+	static const TCHAR *CaptureFFmpegPath = _T("Capture.FFmpegPath");
 }
@@ -0,0 +1,377 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Background capture encoder
+
+#include "stdafx.h"
+#include "CaptureEncoder.h"
+#include "Application.h"
+#include "GameList.h"
+#include "LogFile.h"
+#include "PlayfieldView.h"
+#include "Resource.h"
+
+// global singleton instance
+CaptureEncoder *CaptureEncoder::inst = nullptr;
+
+void CaptureEncoder::Init()
+{
+	if (inst == nullptr)
+		inst = new CaptureEncoder();
+}
+
+void CaptureEncoder::Shutdown()
+{
+	delete inst;
+	inst = nullptr;
+}
+
+CaptureEncoder::CaptureEncoder() :
+	threadExited(false)
+{
+	// Run one job per two processors, up to a small limit.  ffmpeg's
+	// encoders are multi-threaded on their own, so running more jobs
+	// than this would just have them competing with each other (and
+	// with the game, if one is running).
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	maxRunning = max(1, min((int)si.dwNumberOfProcessors / 2, 3));
+
+	// create the events
+	hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	hShutdownEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+	// launch the thread
+	DWORD tid;
+	hThread = CreateThread(NULL, 0, &CaptureEncoder::SThreadMain, this, 0, &tid);
+}
+
+CaptureEncoder::~CaptureEncoder()
+{
+	// Tell the thread to exit, and wait for it.  The thread terminates
+	// any ffmpeg processes still running on the way out, and never waits
+	// on the UI thread, so this won't take long.  We have to wait for it
+	// to finish either way, since it's using this object.
+	SetEvent(hShutdownEvent);
+	if (hThread != NULL)
+		WaitForSingleObject(hThread, INFINITE);
+}
+
+void CaptureEncoder::Queue(const TCHAR *title, std::list<Job> &jobs)
+{
+	// ignore empty batches
+	if (jobs.size() == 0)
+		return;
+
+	// set up the batch, taking over the caller's jobs
+	std::unique_ptr<Batch> batch(new Batch(title));
+	batch->pending.splice(batch->pending.end(), jobs);
+
+	// If the thread is running, add the batch to the queue, and wake up
+	// the thread.  Check under the lock, since the thread sets the exit
+	// flag under the lock after its final pass over the queue.
+	{
+		CriticalSectionLocker locker(lock);
+		if (hThread != NULL && !threadExited)
+		{
+			batches.emplace_back(batch.release());
+			SetEvent(hWakeEvent);
+			return;
+		}
+	}
+
+	// The thread isn't running, so we can't run the jobs.  That should
+	// only happen if thread creation failed at startup, or the thread's
+	// wait failed, either of which would mean the system is in bad shape
+	// anyway, but don't leave the intermediate files behind.
+	FailBatch(batch.get());
+	ReportBatch(std::move(batch));
+}
+
+bool CaptureEncoder::IsPending(const TCHAR *filename)
+{
+	CriticalSectionLocker locker(lock);
+
+	// if the thread has exited, nothing is pending
+	if (threadExited)
+		return false;
+
+	// check the running jobs
+	for (auto &r : running)
+	{
+		if (_tcsicmp(r.job.filename.c_str(), filename) == 0)
+			return true;
+	}
+
+	// check the jobs not yet started
+	for (auto &b : batches)
+	{
+		for (auto &job : b->pending)
+		{
+			if (_tcsicmp(job.filename.c_str(), filename) == 0)
+				return true;
+		}
+	}
+
+	// not found
+	return false;
+}
+
+bool CaptureEncoder::LaunchFFmpeg(TSTRING &cmdline, DWORD creationFlags, HandleHolder &hProc)
+{
+	// open the NUL file as stdin for the child
+	SECURITY_ATTRIBUTES sa;
+	sa.nLength = sizeof(sa);
+	sa.lpSecurityDescriptor = NULL;
+	sa.bInheritHandle = TRUE;
+	HandleHolder hNulIn = CreateFile(_T("NUL"), GENERIC_READ, 0, &sa, OPEN_EXISTING, 0, NULL);
+
+	// Set up the startup info.  Use Show-No-Activate to try to keep
+	// the game window activated and in the foreground, since VP (and
+	// probably others) stop animations when in the background.
+	STARTUPINFO startupInfo;
+	ZeroMemory(&startupInfo, sizeof(startupInfo));
+	startupInfo.cb = sizeof(startupInfo);
+	startupInfo.dwFlags = STARTF_USESHOWWINDOW | STARTF_USESTDHANDLES;
+	startupInfo.wShowWindow = SW_SHOWNOACTIVATE;
+	startupInfo.hStdInput = hNulIn;
+	startupInfo.hStdOutput = startupInfo.hStdError = LogFile::Get()->GetFileHandle();
+
+	// launch the process
+	PROCESS_INFORMATION procInfo;
+	if (!CreateProcess(NULL, cmdline.data(), NULL, NULL, TRUE, creationFlags | CREATE_NO_WINDOW,
+		NULL, NULL, &startupInfo, &procInfo))
+		return false;
+
+	// pass back the process handle; we don't need the thread handle
+	hProc = procInfo.hProcess;
+	CloseHandle(procInfo.hThread);
+	return true;
+}
+
+DWORD WINAPI CaptureEncoder::SThreadMain(LPVOID param)
+{
+	return static_cast<CaptureEncoder*>(param)->ThreadMain();
+}
+
+DWORD CaptureEncoder::ThreadMain()
+{
+	// error message, if we exit on a wait error
+	TSTRING waitError;
+
+	for (;;)
+	{
+		// Start pending jobs, in order of submission, up to the limit.
+		// Collect any batches that are finished along the way.
+		std::list<std::unique_ptr<Batch>> done;
+		std::vector<HANDLE> h = { hShutdownEvent, hWakeEvent };
+		std::vector<Running*> hr;
+		{
+			CriticalSectionLocker locker(lock);
+			for (auto &b : batches)
+			{
+				while (b->pending.size() != 0 && (int)running.size() < maxRunning)
+				{
+					// move the job to the running list
+					auto &r = running.emplace_back(b.get(), std::move(b->pending.front()));
+					b->pending.pop_front();
+					++b->nRunning;
+
+					// log the command line, then launch the process at low priority
+					LogFile::Get()->Write(LogFile::Info, LogFile::SysCapture, _T("Background encoding, %s, %s:\n> %s\n\n"),
+						b->title.c_str(), r.job.desc.c_str(), r.job.cmdline.c_str());
+					if (!LaunchFFmpeg(r.job.cmdline, BELOW_NORMAL_PRIORITY_CLASS, r.hProc))
+					{
+						WindowsErrorMessage winErr;
+						FinishJob(r, false, winErr.Get());
+						running.pop_back();
+					}
+				}
+			}
+
+			// pull out the finished batches
+			for (auto it = batches.begin(); it != batches.end(); )
+			{
+				if ((*it)->pending.size() == 0 && (*it)->nRunning == 0)
+				{
+					done.emplace_back(std::move(*it));
+					it = batches.erase(it);
+				}
+				else
+					++it;
+			}
+
+			// set up the wait list with the running processes
+			for (auto &r : running)
+			{
+				h.push_back(r.hProc);
+				hr.push_back(&r);
+			}
+		}
+
+		// report the finished batches
+		for (auto &b : done)
+			ReportBatch(std::move(b));
+
+		// wait for a process to finish, new work, or shutdown
+		DWORD result = WaitForMultipleObjects((DWORD)h.size(), h.data(), FALSE, INFINITE);
+		if (result == WAIT_OBJECT_0 + 1)
+		{
+			// new work - go back and start it
+			continue;
+		}
+		else if (result >= WAIT_OBJECT_0 + 2 && result < WAIT_OBJECT_0 + h.size())
+		{
+			// A process finished.  Count it as successful if ffmpeg returned
+			// a zero exit code and produced the output file.
+			Running *r = hr[result - WAIT_OBJECT_0 - 2];
+			DWORD exitCode = 1;
+			GetExitCodeProcess(r->hProc, &exitCode);
+
+			CriticalSectionLocker locker(lock);
+			if (exitCode == 0 && FileExists(r->job.filename.c_str()))
+				FinishJob(*r, true, nullptr);
+			else
+				FinishJob(*r, false, MsgFmt(_T("ffmpeg exit code %d"), (int)exitCode));
+
+			running.remove_if([r](const Running &x) { return &x == r; });
+		}
+		else if (result == WAIT_OBJECT_0)
+		{
+			// shutdown - exit the loop
+			break;
+		}
+		else
+		{
+			// Wait error.  We can't monitor the processes without the wait,
+			// so log the error and give up.
+			WindowsErrorMessage winErr;
+			waitError = winErr.Get();
+			LogFile::Get()->Write(LogFile::Error, LogFile::SysCapture, _T("Background encoding stopped: wait failed: %s\n\n"), waitError.c_str());
+			break;
+		}
+	}
+
+	// We're exiting.  Terminate any processes still running, and
+	// delete their partial output files and intermediate files.  Delete
+	// the intermediate files for the jobs we never started, too.
+	std::list<std::unique_ptr<Batch>> abandoned;
+	{
+		CriticalSectionLocker locker(lock);
+		for (auto &r : running)
+		{
+			TerminateProcess(r.hProc, 1);
+			WaitForSingleObject(r.hProc, 1000);
+			DeleteFile(r.job.filename.c_str());
+			DeleteFile(r.job.tempFile.c_str());
+
+			// on a wait error, count the job as failed for the report
+			if (waitError.length() != 0)
+				FinishJob(r, false, waitError.c_str());
+		}
+		running.clear();
+
+		// On a wait error, we're not shutting down, so report the
+		// abandoned batches to the user.  Otherwise just discard them.
+		if (waitError.length() != 0)
+		{
+			for (auto &b : batches)
+				FailBatch(b.get());
+			abandoned.splice(abandoned.end(), batches);
+		}
+		else
+		{
+			for (auto &b : batches)
+			{
+				for (auto &job : b->pending)
+					DeleteFile(job.tempFile.c_str());
+			}
+			batches.clear();
+		}
+
+		// Flag that we've exited, so that new batches fail immediately
+		threadExited = true;
+	}
+
+	// report the abandoned batches
+	for (auto &b : abandoned)
+		ReportBatch(std::move(b));
+
+	// done
+	return 0;
+}
+
+void CaptureEncoder::FailBatch(Batch *batch)
+{
+	// delete the intermediate files, and record each job as not started
+	for (auto &job : batch->pending)
+	{
+		DeleteFile(job.tempFile.c_str());
+		batch->statusList.Error(MsgFmt(_T("%s: %s"), job.desc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_NOT_STARTED).c_str()));
+		++batch->nFailed;
+	}
+	batch->pending.clear();
+}
+
+void CaptureEncoder::FinishJob(Running &r, bool ok, const TCHAR *detail)
+{
+	// the intermediate file is no longer needed
+	if (r.job.tempFile.length() != 0)
+		DeleteFile(r.job.tempFile.c_str());
+
+	// note the new file, for the media index update when we report the batch
+	r.batch->changedFiles.push_back(r.job.filename);
+
+	// record the result
+	auto batch = r.batch;
+	if (ok)
+	{
+		batch->statusList.Error(MsgFmt(_T("%s: %s"), r.job.desc.c_str(), LoadStringT(IDS_ERR_CAP_ITEM_OK).c_str()));
+	}
+	else
+	{
+		batch->statusList.Error(MsgFmt(_T("%s: %s"), r.job.desc.c_str(), MsgFmt(IDS_ERR_CAP_ITEM_FAILED, detail).Get()));
+		++batch->nFailed;
+	}
+
+	// the job is no longer running
+	--batch->nRunning;
+}
+
+void CaptureEncoder::ReportBatch(std::unique_ptr<Batch> &&batch)
+{
+	// Post the batch to the playfield view.  Post rather than send, so
+	// that we never wait for the UI thread; the UI thread waits for us
+	// at shutdown.  If the post succeeds, the window owns the batch.
+	HWND hwnd = NULL;
+	if (auto pfv = Application::Get()->GetPlayfieldView(); pfv != nullptr)
+		hwnd = pfv->GetHWnd();
+	if (hwnd != NULL && ::PostMessage(hwnd, PFVMsgCaptureEncodeDone, 0, reinterpret_cast<LPARAM>(batch.get())))
+	{
+		batch.release();
+		return;
+	}
+
+	// there's no window to report to, so just log the results
+	LogFile::Get()->Write(LogFile::Info, LogFile::SysCapture, _T("Background encoding for %s finished, %d job(s) failed\n\n"),
+		batch->title.c_str(), batch->nFailed);
+}
+
+void CaptureEncoder::OnBatchDone(LPARAM lParam)
+{
+	// take ownership of the batch
+	std::unique_ptr<Batch> batch(reinterpret_cast<Batch*>(lParam));
+
+	// update the media index for the new files
+	if (auto gl = GameList::Get(); gl != nullptr)
+	{
+		for (auto &f : batch->changedFiles)
+			gl->GetMediaIndex()->OnFileChanged(f.c_str());
+	}
+
+	// show the results the same way the capture session does
+	TSTRINGEx summary;
+	summary.Format(LoadStringT(batch->nFailed == 0 ? IDS_ERR_CAP_ENCODE_SUCCESS : IDS_ERR_CAP_ENCODE_FAILED), batch->title.c_str());
+	Application::AsyncErrorHandler eh;
+	eh.GroupError(batch->nFailed == 0 ? EIT_Information : EIT_Error, summary.c_str(), batch->statusList);
+}
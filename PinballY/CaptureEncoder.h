@@ -0,0 +1,165 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Background capture encoder
+//
+// This runs the second-pass encoding steps from two-pass media
+// captures (see CapturePlanner.h).  The second pass is the slow part
+// of a two-pass capture - it usually takes longer than the capture
+// itself, since two-pass mode is meant for machines that can't encode
+// in real time - and it doesn't need the game to be running.  So
+// rather than keeping the game open and the user waiting while the
+// encoding runs, the capture session hands the steps off to us and
+// exits the game as soon as the capture is done.  The user can go on
+// to launch the next game (or the next capture) while the last one's
+// videos are still being compressed.
+//
+// We run the encoder processes at below-normal priority, so that they
+// don't take CPU time away from a running game, or from the real-time
+// capture of a later session.  Several steps can run at once, up to a
+// limit based on the number of processors.
+//
+// When all of the steps from one capture session are finished, we
+// post the results to the playfield view, which updates the media index
+// for the new files and shows the results message on the UI thread.
+// We don't touch the game list from the encoder thread, since the
+// encoding can outlive the game session, and the UI thread can reload
+// the game list (on a config reload, say) while we're running.
+
+#pragma once
+
+class CaptureEncoder
+{
+public:
+	// Create/destroy the global singleton
+	static void Init();
+	static void Shutdown();
+	static CaptureEncoder *Get() { return inst; }
+
+	// Encoding job
+	struct Job
+	{
+		Job(const TCHAR *cmdline, const TCHAR *desc, const TCHAR *filename, const TCHAR *tempFile) :
+			cmdline(cmdline), desc(desc), filename(filename), tempFile(tempFile) { }
+
+		// ffmpeg command line
+		TSTRING cmdline;
+
+		// item description, for the status report
+		TSTRING desc;
+
+		// output file
+		TSTRING filename;
+
+		// intermediate file, which we delete when the job is done
+		TSTRING tempFile;
+	};
+
+	// Queue a batch of jobs from a capture session.  'title' is the game
+	// title, for the results message.
+	void Queue(const TCHAR *title, std::list<Job> &jobs);
+
+	// Is an output file pending?  Returns true if there's a queued or
+	// running job that writes the file.  A new capture session uses this
+	// to avoid capturing over a file that's still being encoded.
+	bool IsPending(const TCHAR *filename);
+
+	// Launch ffmpeg with the given command line, with stdin connected to
+	// the NUL device and stdout and stderr going to the log file.  Returns
+	// true on success, with the process handle in 'hProc'.  This is also
+	// used to run the capture steps.
+	static bool LaunchFFmpeg(TSTRING &cmdline, DWORD creationFlags, HandleHolder &hProc);
+
+	// Handle a PFVMsgCaptureEncodeDone message.  The playfield view calls
+	// this on the UI thread with the message's LPARAM.  This updates the
+	// media index for the batch's output files, shows the results, and
+	// deletes the batch.
+	static void OnBatchDone(LPARAM lParam);
+
+protected:
+	CaptureEncoder();
+	~CaptureEncoder();
+
+	// global singleton instance
+	static CaptureEncoder *inst;
+
+	// thread entrypoint
+	static DWORD WINAPI SThreadMain(LPVOID param);
+	DWORD ThreadMain();
+
+	// Batch.  This is the set of jobs from one capture session.
+	struct Batch
+	{
+		Batch(const TCHAR *title) : title(title), nRunning(0), nFailed(0) { }
+
+		// game title
+		TSTRING title;
+
+		// jobs not yet started
+		std::list<Job> pending;
+
+		// number of jobs running
+		int nRunning;
+
+		// number of jobs that failed
+		int nFailed;
+
+		// results list
+		CapturingErrorHandler statusList;
+
+		// output files written or deleted, for the media index update
+		std::list<TSTRING> changedFiles;
+	};
+
+	// Running job
+	struct Running
+	{
+		Running(Batch *batch, Job &&job) : batch(batch), job(std::move(job)) { }
+
+		// batch the job belongs to
+		Batch *batch;
+
+		// the job
+		Job job;
+
+		// ffmpeg process handle
+		HandleHolder hProc;
+	};
+
+	// finish a job
+	void FinishJob(Running &r, bool ok, const TCHAR *detail);
+
+	// fail the jobs in a batch that haven't been started
+	void FailBatch(Batch *batch);
+
+	// Report a finished batch.  This posts the batch to the playfield
+	// view, which takes ownership of it.
+	void ReportBatch(std::unique_ptr<Batch> &&batch);
+
+	// lock for our shared data
+	CriticalSection lock;
+
+	// batches, in order of submission
+	std::list<std::unique_ptr<Batch>> batches;
+
+	// running jobs
+	std::list<Running> running;
+
+	// maximum number of jobs to run at once
+	int maxRunning;
+
+	// worker thread
+	HandleHolder hThread;
+
+	// Has the worker thread exited?  The thread normally runs until
+	// shutdown, but it gives up early if its wait fails.  It sets this
+	// (under the lock) on the way out, after clearing the queue, so that
+	// later batches fail immediately instead of waiting forever.
+	volatile bool threadExited;
+
+	// wake event, to tell the thread that new work is available
+	HandleHolder hWakeEvent;
+
+	// shutdown event
+	HandleHolder hShutdownEvent;
+};
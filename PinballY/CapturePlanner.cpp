@@ -0,0 +1,147 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media capture planner
+
+#include "stdafx.h"
+#include "CapturePlanner.h"
+
+void CapturePlanner::MakePlan(const std::vector<Item> &items, const Options &opts, Plan &plan)
+{
+	plan.capture.clear();
+	plan.encode.clear();
+
+	if (opts.combine)
+	{
+		// combined mode - capture everything in one step
+		std::vector<size_t> group;
+		for (size_t i = 0; i < items.size(); ++i)
+			group.push_back(i);
+
+		if (group.size() != 0)
+			AddCaptureStep(items, group, opts, plan);
+	}
+	else
+	{
+		// separate mode - one step per item
+		for (size_t i = 0; i < items.size(); ++i)
+			AddCaptureStep(items, std::vector<size_t>{ i }, opts, plan);
+	}
+}
+
+void CapturePlanner::AddCaptureStep(const std::vector<Item> &items, const std::vector<size_t> &group,
+	const Options &opts, Plan &plan)
+{
+	Step step;
+	TSTRING cmd = MsgFmt(_T("\"%s\" -loglevel error"), opts.ffmpeg.c_str()).Get();
+
+	// Add a gdigrab input for each distinct capture area, and note which
+	// input each item uses
+	std::vector<RECT> inputs;
+	std::vector<size_t> inputFor;
+	for (auto i : group)
+	{
+		auto &item = items[i];
+		auto it = std::find_if(inputs.begin(), inputs.end(), [&item](const RECT &rc) { return EqualRect(&rc, &item.rc) != 0; });
+		if (it == inputs.end())
+		{
+			cmd += MsgFmt(_T(" -f gdigrab -framerate 30 -offset_x %d -offset_y %d -video_size %dx%d -i desktop"),
+				item.rc.left, item.rc.top, item.rc.right - item.rc.left, item.rc.bottom - item.rc.top).Get();
+			it = inputs.insert(inputs.end(), item.rc);
+		}
+		inputFor.push_back(it - inputs.begin());
+	}
+
+	// if any item records audio, add the audio device as another input
+	int audioInput = -1;
+	if (opts.audioDevice.length() != 0
+		&& std::any_of(group.begin(), group.end(), [&items](size_t i) { return items[i].isVideo && items[i].withAudio; }))
+	{
+		audioInput = (int)inputs.size();
+		cmd += MsgFmt(_T(" -f dshow -i audio=\"%s\""), opts.audioDevice.c_str()).Get();
+	}
+
+	// add an output for each item
+	for (size_t k = 0; k < group.size(); ++k)
+	{
+		size_t i = group[k];
+		auto &item = items[i];
+		step.items.push_back(i);
+
+		// map the video from the item's capture area
+		cmd += MsgFmt(_T(" -map %d:v"), (int)inputFor[k]).Get();
+
+		if (!item.isVideo)
+		{
+			// still image - capture one frame
+			cmd += MsgFmt(_T(" -vframes 1%s \"%s\""), RotateFilter(item.rotation), item.filename.c_str()).Get();
+			continue;
+		}
+
+		// video - map the audio if desired
+		if (item.withAudio && audioInput >= 0)
+			cmd += MsgFmt(_T(" -map %d:a"), audioInput).Get();
+
+		// the step runs until the longest item is done
+		step.time = max(step.time, item.captureTime);
+
+		if (opts.twoPass)
+		{
+			// Two-pass encoding.  Capture the video with the lossless h264
+			// codec in the fastest mode, with no rotation, to a temp file.
+			// We'll re-encode to the actual output file and apply rotations
+			// in the second pass.
+			TSTRING tmpfile = TempFileName(item.filename, opts.sessionId);
+			cmd += MsgFmt(_T(" -c:v libx264 -crf 0 -preset ultrafast -t %d \"%s\""),
+				item.captureTime / 1000, tmpfile.c_str()).Get();
+			step.tempFiles.push_back(tmpfile);
+
+			// Add the encoding step.  Two-pass mode is meant for machines
+			// that can't encode in real time, so the encoding will probably
+			// take longer than the capture, but probably not more than twice
+			// as long on any machine that can run the games well.  Split the
+			// difference and estimate 1.5 times the running time.
+			Step &enc = plan.encode.emplace_back();
+			enc.cmdline = MsgFmt(_T("\"%s\" -loglevel error -i \"%s\"%s -c:a copy -max_muxing_queue_size 1024 \"%s\""),
+				opts.ffmpeg.c_str(), tmpfile.c_str(), RotateFilter(item.rotation), item.filename.c_str()).Get();
+			enc.items.push_back(i);
+			enc.time = item.captureTime * 3 / 2;
+			enc.tempFiles.push_back(tmpfile);
+		}
+		else
+		{
+			// normal one-pass encoding directly to the output file
+			cmd += MsgFmt(_T("%s -t %d \"%s\""),
+				RotateFilter(item.rotation), item.captureTime / 1000, item.filename.c_str()).Get();
+		}
+	}
+
+	// add the step
+	step.cmdline = cmd;
+	plan.capture.emplace_back(std::move(step));
+}
+
+const TCHAR *CapturePlanner::RotateFilter(int rotation)
+{
+	switch ((rotation % 360 + 360) % 360)
+	{
+	case 90:
+		return _T(" -vf \"transpose=1\"");     // 90 degrees clockwise
+
+	case 180:
+		return _T(" -vf \"hflip,vflip\"");     // mirror both axes
+
+	case 270:
+		return _T(" -vf \"transpose=2\"");     // 90 degrees counterclockwise
+
+	default:
+		return _T("");
+	}
+}
+
+TSTRING CapturePlanner::TempFileName(const TSTRING &filename, DWORD sessionId)
+{
+	// insert ".tmp<session>" ahead of the extension
+	return std::regex_replace(filename, std::basic_regex<TCHAR>(_T("\\.([^.]+)$")),
+		MsgFmt(_T(".tmp%lu.$1"), sessionId).Get());
+}
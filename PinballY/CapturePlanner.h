@@ -0,0 +1,153 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media capture planner
+//
+// This works out the ffmpeg command lines for a media capture session.
+// The simple approach is to run a separate ffmpeg capture for each
+// media item, one after another, but that makes capturing the
+// playfield, backglass, DMD, and topper videos for a table take the
+// sum of all of the capture times.  ffmpeg can read several inputs and
+// write several outputs in a single run, though, so the planner
+// instead combines the items into one capture step:
+//
+// - Items are grouped by capture area (which is to say, by window).
+//   Each distinct area becomes one gdigrab input, shared by all of the
+//   items that capture it (the playfield image and playfield video, for
+//   example).
+//
+// - If any item records audio, the audio device is added as one more
+//   input, which is mapped into the outputs for those items.
+//
+// - Each item is a separate output, with its own stream mapping,
+//   rotation filter, and time limit.  ffmpeg closes each output when it
+//   reaches its time limit, so the step runs for the longest capture
+//   time in the group rather than the sum of them.
+//
+// In two-pass mode, the capture step writes lossless intermediate
+// files, and the planner adds a separate encoding step for each video.
+// The encoding steps don't need the game to be running, so the capture
+// session hands them off to the background encoder (see CaptureEncoder.h)
+// rather than keeping the game open while they run.
+//
+// Combined capture can be disabled, for a machine that can't keep up
+// with several simultaneous captures, in which case the planner makes
+// one capture step per item, in the original order.
+//
+// The planner only builds the command lines; it doesn't run anything.
+// The caller runs the capture steps with the game running, then passes
+// the encoding steps to the background encoder.  Since everything goes
+// through the command lines, a session can be checked by substituting
+// a stub program for ffmpeg that records its arguments and timing.  The
+// FFmpegStub project is such a program; the planner tests run it, and
+// the Capture.FFmpegPath config variable can point a live session at it.
+
+#pragma once
+
+class CapturePlanner
+{
+public:
+	// Capture item
+	struct Item
+	{
+		Item(const TCHAR *desc, const TCHAR *filename, const RECT &rc, int rotation,
+			bool isVideo, bool withAudio, DWORD captureTime) :
+			desc(desc),
+			filename(filename),
+			rc(rc),
+			rotation(rotation),
+			isVideo(isVideo),
+			withAudio(withAudio),
+			captureTime(captureTime)
+		{ }
+
+		// description, for status messages
+		TSTRING desc;
+
+		// output filename
+		TSTRING filename;
+
+		// screen area to capture, in screen coordinates
+		RECT rc;
+
+		// rotation to apply to the captured image, in degrees clockwise
+		int rotation;
+
+		// is it a video?  (If not, it's a still image.)
+		bool isVideo;
+
+		// for a video, should we record audio?
+		bool withAudio;
+
+		// capture time in milliseconds, for a video
+		DWORD captureTime;
+	};
+
+	// Planning options
+	struct Options
+	{
+		Options() : twoPass(false), combine(true), sessionId(0) { }
+
+		// ffmpeg executable path
+		TSTRING ffmpeg;
+
+		// audio capture device name, or empty if there's no audio device
+		TSTRING audioDevice;
+
+		// use two-pass encoding for videos
+		bool twoPass;
+
+		// combine the items into a single capture step
+		bool combine;
+
+		// Session ID.  This is used to make the names of the intermediate
+		// files in two-pass mode unique, so that a new capture session
+		// can't collide with files that an earlier session's encoding
+		// steps are still working on.
+		DWORD sessionId;
+	};
+
+	// Plan step.  This is a single ffmpeg run.
+	struct Step
+	{
+		Step() : time(0) { }
+
+		// ffmpeg command line
+		TSTRING cmdline;
+
+		// items covered by the step, as indices into the item list
+		std::vector<size_t> items;
+
+		// estimated running time, in milliseconds
+		DWORD time;
+
+		// Intermediate files.  For a two-pass capture step, these are the
+		// files the step writes; for an encoding step, this is the file
+		// the step reads.  The caller should delete these when the step
+		// (or the step that reads them) finishes, whether or not it
+		// succeeds.
+		std::vector<TSTRING> tempFiles;
+	};
+
+	// Plan.  The capture steps have to run while the game is running;
+	// the encoding steps can run afterwards, in any order.
+	struct Plan
+	{
+		std::vector<Step> capture;
+		std::vector<Step> encode;
+	};
+
+	// Build the plan for a list of items
+	static void MakePlan(const std::vector<Item> &items, const Options &opts, Plan &plan);
+
+protected:
+	// add a capture step for a group of items
+	static void AddCaptureStep(const std::vector<Item> &items, const std::vector<size_t> &group,
+		const Options &opts, Plan &plan);
+
+	// get the ffmpeg filter option for a rotation
+	static const TCHAR *RotateFilter(int rotation);
+
+	// get the intermediate filename for a two-pass capture
+	static TSTRING TempFileName(const TSTRING &filename, DWORD sessionId);
+};
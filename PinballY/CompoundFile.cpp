@@ -0,0 +1,392 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Compound File reader
+
+#include "stdafx.h"
+#include <wctype.h>
+#include "CompoundFile.h"
+
+// Read little-endian integers from the file data.  The CFB format is
+// always little-endian, regardless of the host byte order.
+static inline UINT16 Get16(const BYTE *p) { return UINT16(p[0] | (p[1] << 8)); }
+static inline UINT32 Get32(const BYTE *p) { return UINT32(p[0]) | (UINT32(p[1]) << 8) | (UINT32(p[2]) << 16) | (UINT32(p[3]) << 24); }
+static inline UINT64 Get64(const BYTE *p) { return UINT64(Get32(p)) | (UINT64(Get32(p + 4)) << 32); }
+
+// file header signature
+static const BYTE cfbSignature[8] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+
+// header field offsets
+static const size_t HdrSignature = 0x00;
+static const size_t HdrByteOrder = 0x1C;
+static const size_t HdrSectorShift = 0x1E;
+static const size_t HdrMiniSectorShift = 0x20;
+static const size_t HdrNumFatSectors = 0x2C;
+static const size_t HdrFirstDirSector = 0x30;
+static const size_t HdrMiniStreamCutoff = 0x38;
+static const size_t HdrFirstMiniFatSector = 0x3C;
+static const size_t HdrFirstDifatSector = 0x44;
+static const size_t HdrNumDifatSectors = 0x48;
+static const size_t HdrDifat = 0x4C;
+static const int HdrDifatCount = 109;
+
+// directory entry layout
+static const size_t DirEntrySize = 128;
+static const size_t DirName = 0x00;
+static const size_t DirNameLen = 0x40;
+static const size_t DirType = 0x42;
+static const size_t DirLeft = 0x44;
+static const size_t DirRight = 0x48;
+static const size_t DirChild = 0x4C;
+static const size_t DirStartSector = 0x74;
+static const size_t DirStreamSize = 0x78;
+
+CompoundFileReader::CompoundFileReader() :
+	view(nullptr),
+	viewSize(0),
+	sectorShift(9),
+	sectorSize(512),
+	miniSectorSize(64),
+	miniStreamCutoff(4096)
+{
+}
+
+CompoundFileReader::~CompoundFileReader()
+{
+	Close();
+}
+
+void CompoundFileReader::Close()
+{
+	fatSectors.clear();
+	miniFatSectors.clear();
+	dirSectors.clear();
+	miniStreamSectors.clear();
+	if (view != nullptr)
+	{
+		UnmapViewOfFile(view);
+		view = nullptr;
+		viewSize = 0;
+	}
+	hMapping.Clear();
+	hFile.Clear();
+}
+
+HRESULT CompoundFileReader::Open(const WCHAR *filename)
+{
+	// close any previous file
+	Close();
+
+	// open the file and map it into memory
+	hFile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size))
+		return HRESULT_FROM_WIN32(GetLastError());
+	if (size.HighPart != 0)
+		return STG_E_DOCFILETOOLARGE;
+	if (size.LowPart < 512)
+		return STG_E_INVALIDHEADER;
+
+	hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	view = static_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (view == nullptr)
+		return HRESULT_FROM_WIN32(GetLastError());
+	viewSize = size.LowPart;
+
+	// any structural problem makes the file invalid
+	auto Fail = [this]()
+	{
+		Close();
+		return STG_E_INVALIDHEADER;
+	};
+
+	// check the header signature, byte order mark, and sector sizes
+	if (memcmp(view + HdrSignature, cfbSignature, sizeof(cfbSignature)) != 0
+		|| Get16(view + HdrByteOrder) != 0xFFFE)
+		return Fail();
+
+	sectorShift = Get16(view + HdrSectorShift);
+	if (sectorShift != 9 && sectorShift != 12)
+		return Fail();
+	sectorSize = 1 << sectorShift;
+
+	if (Get16(view + HdrMiniSectorShift) != 6)
+		return Fail();
+	miniSectorSize = 64;
+	miniStreamCutoff = Get32(view + HdrMiniStreamCutoff);
+
+	// Collect the FAT sector numbers.  The first 109 are listed in the
+	// header; any more are in the DIFAT sector chain, where the last
+	// entry in each sector is the next DIFAT sector number.
+	UINT32 nFatSectors = Get32(view + HdrNumFatSectors);
+	if (nFatSectors > viewSize / sectorSize)
+		return Fail();
+	for (int i = 0; i < HdrDifatCount && fatSectors.size() < nFatSectors; ++i)
+		fatSectors.push_back(Get32(view + HdrDifat + i*4));
+
+	UINT32 difatSector = Get32(view + HdrFirstDifatSector);
+	UINT32 nDifatSectors = Get32(view + HdrNumDifatSectors);
+	UINT32 perDifat = sectorSize / 4 - 1;
+	for (UINT32 i = 0; i < nDifatSectors && fatSectors.size() < nFatSectors; ++i)
+	{
+		const BYTE *p = GetSector(difatSector);
+		if (p == nullptr)
+			return Fail();
+
+		for (UINT32 j = 0; j < perDifat && fatSectors.size() < nFatSectors; ++j)
+			fatSectors.push_back(Get32(p + j*4));
+
+		difatSector = Get32(p + perDifat*4);
+	}
+	if (fatSectors.size() != nFatSectors)
+		return Fail();
+
+	// follow the directory and MiniFAT chains
+	if (!GetChain(Get32(view + HdrFirstDirSector), dirSectors) || dirSectors.size() == 0
+		|| !GetChain(Get32(view + HdrFirstMiniFatSector), miniFatSectors))
+		return Fail();
+
+	// The mini stream is the root entry's stream data
+	const BYTE *root = GetEntry(RootEntry);
+	if (root == nullptr || root[DirType] != TypeRoot
+		|| !GetChain(Get32(root + DirStartSector), miniStreamSectors))
+		return Fail();
+
+	// success
+	return S_OK;
+}
+
+const BYTE *CompoundFileReader::GetSector(UINT32 sector) const
+{
+	// sector N starts after the header, which occupies one sector
+	if (sector > MaxRegSect)
+		return nullptr;
+
+	UINT64 ofs = (UINT64(sector) + 1) << sectorShift;
+	if (ofs + sectorSize > viewSize)
+		return nullptr;
+
+	return view + ofs;
+}
+
+const BYTE *CompoundFileReader::GetMiniSector(UINT32 sector) const
+{
+	// find the regular sector in the mini stream containing the mini sector
+	UINT64 ofs = UINT64(sector) * miniSectorSize;
+	UINT64 idx = ofs >> sectorShift;
+	if (idx >= miniStreamSectors.size())
+		return nullptr;
+
+	const BYTE *p = GetSector(miniStreamSectors[(size_t)idx]);
+	return p != nullptr ? p + (ofs & (sectorSize - 1)) : nullptr;
+}
+
+UINT32 CompoundFileReader::NextSector(UINT32 sector) const
+{
+	// find the FAT sector containing the entry for this sector
+	UINT32 perSector = sectorSize / 4;
+	UINT32 idx = sector / perSector;
+	const BYTE *p;
+	if (idx >= fatSectors.size() || (p = GetSector(fatSectors[idx])) == nullptr)
+		return EndOfChain;
+
+	// treat anything other than a regular sector number as end of chain
+	UINT32 next = Get32(p + (sector % perSector) * 4);
+	return next <= MaxRegSect ? next : EndOfChain;
+}
+
+UINT32 CompoundFileReader::NextMiniSector(UINT32 sector) const
+{
+	// find the MiniFAT sector containing the entry for this mini sector
+	UINT32 perSector = sectorSize / 4;
+	UINT32 idx = sector / perSector;
+	const BYTE *p;
+	if (idx >= miniFatSectors.size() || (p = GetSector(miniFatSectors[idx])) == nullptr)
+		return EndOfChain;
+
+	UINT32 next = Get32(p + (sector % perSector) * 4);
+	return next <= MaxRegSect ? next : EndOfChain;
+}
+
+bool CompoundFileReader::GetChain(UINT32 start, std::vector<UINT32> &chain) const
+{
+	// A valid chain can't be longer than the number of sectors in the
+	// file, so anything longer must contain a cycle.
+	chain.clear();
+	size_t maxLen = viewSize / sectorSize;
+	for (UINT32 s = start; s <= MaxRegSect; s = NextSector(s))
+	{
+		if (chain.size() >= maxLen)
+			return false;
+		chain.push_back(s);
+	}
+
+	return true;
+}
+
+const BYTE *CompoundFileReader::GetEntry(EntryID id) const
+{
+	UINT32 perSector = sectorSize / DirEntrySize;
+	UINT32 idx = id / perSector;
+	if (idx >= dirSectors.size())
+		return nullptr;
+
+	const BYTE *p = GetSector(dirSectors[idx]);
+	return p != nullptr ? p + (id % perSector) * DirEntrySize : nullptr;
+}
+
+CompoundFileReader::EntryID CompoundFileReader::FindChild(EntryID parent, const WCHAR *name) const
+{
+	// the parent must be a storage or the root
+	const BYTE *p = GetEntry(parent);
+	if (p == nullptr || (p[DirType] != TypeStorage && p[DirType] != TypeRoot))
+		return NoEntry;
+
+	// Search the parent's red-black tree of children.  The tree is
+	// ordered by name length first, then by the upper-case names.
+	size_t nameLen = wcslen(name);
+	size_t maxSteps = dirSectors.size() * (sectorSize / DirEntrySize);
+	EntryID cur = Get32(p + DirChild);
+	for (size_t steps = 0; cur != NoEntry && steps < maxSteps; ++steps)
+	{
+		const BYTE *e = GetEntry(cur);
+		if (e == nullptr)
+			return NoEntry;
+
+		// get the entry's name length in characters, minus the null
+		size_t entryLen = Get16(e + DirNameLen) / 2;
+		entryLen = entryLen != 0 ? min(entryLen - 1, (size_t)31) : 0;
+
+		// compare the names
+		int cmp = 0;
+		if (nameLen != entryLen)
+			cmp = nameLen < entryLen ? -1 : 1;
+		else
+		{
+			for (size_t i = 0; i < nameLen && cmp == 0; ++i)
+			{
+				wint_t a = towupper(name[i]);
+				wint_t b = towupper(Get16(e + DirName + i*2));
+				cmp = a < b ? -1 : a > b ? 1 : 0;
+			}
+		}
+
+		// if it matches, we found it; otherwise descend the tree
+		if (cmp == 0)
+			return e[DirType] != 0 ? cur : NoEntry;
+
+		cur = Get32(e + (cmp < 0 ? DirLeft : DirRight));
+	}
+
+	// not found
+	return NoEntry;
+}
+
+CompoundFileReader::EntryID CompoundFileReader::FindPath(const WCHAR *path) const
+{
+	// look up each path element in turn
+	EntryID cur = RootEntry;
+	for (const WCHAR *p = path; cur != NoEntry; )
+	{
+		const WCHAR *sep = wcschr(p, '/');
+		WSTRING elem = sep != nullptr ? WSTRING(p, sep - p) : WSTRING(p);
+		cur = FindChild(cur, elem.c_str());
+		if (sep == nullptr)
+			break;
+		p = sep + 1;
+	}
+
+	return cur;
+}
+
+UINT64 CompoundFileReader::GetStreamSize(EntryID stream) const
+{
+	const BYTE *e = GetEntry(stream);
+	if (e == nullptr || e[DirType] != TypeStream)
+		return 0;
+
+	// In version 3 files (512-byte sectors), only the low 32 bits of
+	// the size are valid; some writers leave garbage in the high part.
+	UINT64 size = Get64(e + DirStreamSize);
+	return sectorShift == 9 ? (size & 0xFFFFFFFF) : size;
+}
+
+bool CompoundFileReader::OpenStream(EntryID entry, Stream &stream) const
+{
+	const BYTE *e = GetEntry(entry);
+	if (e == nullptr || e[DirType] != TypeStream)
+		return false;
+
+	stream.file = this;
+	stream.remaining = GetStreamSize(entry);
+	stream.mini = stream.remaining < miniStreamCutoff;
+	stream.sector = Get32(e + DirStartSector);
+	stream.sectorOfs = 0;
+	return true;
+}
+
+bool CompoundFileReader::ReadStream(EntryID entry, std::vector<BYTE> &buf) const
+{
+	// open the stream, and make sure its size is plausible
+	Stream s;
+	if (!OpenStream(entry, s) || s.GetRemaining() > viewSize)
+		return false;
+
+	// read it
+	buf.resize((size_t)s.GetRemaining());
+	return s.Read(buf.data(), buf.size()) == buf.size();
+}
+
+size_t CompoundFileReader::Stream::Transfer(BYTE *dst, size_t len)
+{
+	size_t done = 0;
+	UINT32 curSectorSize = mini ? file->miniSectorSize : file->sectorSize;
+	while (len != 0 && remaining != 0)
+	{
+		// get the current sector; stop if the chain is broken
+		const BYTE *p = mini ? file->GetMiniSector(sector) : file->GetSector(sector);
+		if (p == nullptr)
+		{
+			remaining = 0;
+			break;
+		}
+
+		// copy as much as we can from this sector
+		size_t n = min(len, (size_t)(curSectorSize - sectorOfs));
+		if (n > remaining)
+			n = (size_t)remaining;
+		if (dst != nullptr)
+			memcpy(dst + done, p + sectorOfs, n);
+
+		done += n;
+		len -= n;
+		remaining -= n;
+		sectorOfs += (UINT32)n;
+
+		// advance to the next sector in the chain if we've used this one up
+		if (sectorOfs == curSectorSize)
+		{
+			sector = mini ? file->NextMiniSector(sector) : file->NextSector(sector);
+			sectorOfs = 0;
+		}
+	}
+
+	return done;
+}
+
+bool CompoundFileReader::Stream::ReadInt32(INT32 &val)
+{
+	BYTE b[4];
+	if (Read(b, 4) != 4)
+		return false;
+
+	val = (INT32)Get32(b);
+	return true;
+}
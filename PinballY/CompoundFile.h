@@ -0,0 +1,179 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Compound File reader
+//
+// This is a minimal read-only parser for the Microsoft Compound File
+// Binary format (CFB), the on-disk format of OLE Structured Storage.
+// Visual Pinball uses Structured Storage as the container format for
+// its table files, and we need to read a few small streams out of
+// each table file to get its metadata.
+//
+// The Windows structured storage API (StgOpenStorage) can do this, of
+// course, but it's a heavyweight way to get at a few hundred bytes of
+// data: it reads and validates the whole directory, allocates COM
+// objects for each storage and stream along the way, and opens the
+// file in exclusive mode.  That's fine for the occasional single file,
+// but it's slow when scanning a whole folder of tables, and the COM
+// dependency makes it awkward to use from worker threads.
+//
+// This reader instead maps the file into memory and parses the CFB
+// structures directly out of the mapped view.  We only follow the
+// sector chains for the directory entries and streams we actually
+// visit, so the cost of opening a stream is proportional to the size
+// of the stream, not the size of the file.  The parsing itself uses
+// nothing but the raw bytes of the file, so apart from the file
+// mapping, it has no dependencies on Windows APIs.
+//
+// The format is documented in Microsoft's [MS-CFB] specification.
+// Briefly, the file is divided into fixed-size sectors (512 bytes for
+// version 3 files, 4096 bytes for version 4).  The File Allocation
+// Table (FAT) links the sectors of each stream into a chain; the FAT
+// is itself stored in sectors listed in the "DIFAT" array, the first
+// 109 entries of which are in the file header.  Small streams (under
+// 4096 bytes) are instead stored in 64-byte "mini sectors" within a
+// special "mini stream", linked through a separate MiniFAT.  The
+// directory is a stream of 128-byte entries, with the children of
+// each storage arranged in a red-black tree.
+//
+
+#pragma once
+
+class CompoundFileReader
+{
+public:
+	CompoundFileReader();
+	~CompoundFileReader();
+
+	// Open a file.  Returns S_OK on success, or an error code if the
+	// file can't be opened or isn't a valid compound file.
+	HRESULT Open(const WCHAR *filename);
+
+	// Close the file
+	void Close();
+
+	// Directory entry ID.  Entry 0 is always the root storage.
+	typedef UINT32 EntryID;
+	static const EntryID NoEntry = 0xFFFFFFFF;
+	static const EntryID RootEntry = 0;
+
+	// Find a child (stream or storage) of a storage, by name.  Names
+	// are matched case-insensitively, as in Structured Storage.
+	// Returns NoEntry if the child doesn't exist.
+	EntryID FindChild(EntryID parent, const WCHAR *name) const;
+
+	// Find a child by path, with each element separated by '/', such
+	// as L"GameStg/GameData".
+	EntryID FindPath(const WCHAR *path) const;
+
+	// Get the size of a stream
+	UINT64 GetStreamSize(EntryID stream) const;
+
+	// Stream reader.  This reads a stream sequentially, following its
+	// sector chain through the file as it goes.
+	class Stream
+	{
+		friend class CompoundFileReader;
+
+	public:
+		Stream() : file(nullptr), sector(0), sectorOfs(0), remaining(0), mini(false) { }
+
+		// Read bytes from the stream into a buffer.  Returns the number
+		// of bytes read, which is less than requested if we reach the
+		// end of the stream or encounter a broken sector chain.
+		size_t Read(void *buf, size_t len) { return Transfer(static_cast<BYTE*>(buf), len); }
+
+		// Skip bytes.  Returns the number of bytes skipped.
+		size_t Skip(size_t len) { return Transfer(nullptr, len); }
+
+		// Read a little-endian 32-bit integer.  Returns false at end of
+		// stream.
+		bool ReadInt32(INT32 &val);
+
+		// number of bytes remaining in the stream
+		UINT64 GetRemaining() const { return remaining; }
+
+	protected:
+		// copy (or skip, if 'dst' is null) up to 'len' bytes
+		size_t Transfer(BYTE *dst, size_t len);
+
+		// containing file
+		const CompoundFileReader *file;
+
+		// current sector (or mini sector) number, and the offset of the
+		// current read position within the sector
+		UINT32 sector;
+		UINT32 sectorOfs;
+
+		// bytes remaining in the stream
+		UINT64 remaining;
+
+		// is this stream stored in the mini stream?
+		bool mini;
+	};
+
+	// Open a stream for reading.  Returns false if the entry isn't a
+	// stream.
+	bool OpenStream(EntryID entry, Stream &stream) const;
+
+	// Read an entire stream into a buffer.  Returns false if the entry
+	// isn't a stream, or the stream can't be read in full.
+	bool ReadStream(EntryID entry, std::vector<BYTE> &buf) const;
+
+protected:
+	// special sector numbers
+	static const UINT32 MaxRegSect = 0xFFFFFFFA;
+	static const UINT32 EndOfChain = 0xFFFFFFFE;
+
+	// directory entry types
+	static const BYTE TypeStorage = 1;
+	static const BYTE TypeStream = 2;
+	static const BYTE TypeRoot = 5;
+
+	// Get a pointer to a sector in the mapped view, or null if the
+	// sector number is out of range
+	const BYTE *GetSector(UINT32 sector) const;
+
+	// Get a pointer to a mini sector, or null if it's out of range
+	const BYTE *GetMiniSector(UINT32 sector) const;
+
+	// Get the next sector in a chain, from the FAT or MiniFAT.  Returns
+	// EndOfChain if the sector is the last in its chain, or if the chain
+	// is broken.
+	UINT32 NextSector(UINT32 sector) const;
+	UINT32 NextMiniSector(UINT32 sector) const;
+
+	// Follow a regular sector chain, listing its sectors
+	bool GetChain(UINT32 start, std::vector<UINT32> &chain) const;
+
+	// Get a directory entry, or null if the ID is out of range
+	const BYTE *GetEntry(EntryID id) const;
+
+	// file and mapping handles
+	HandleHolder hFile;
+	HandleHolder hMapping;
+
+	// mapped view
+	const BYTE *view;
+	size_t viewSize;
+
+	// sector sizes
+	UINT32 sectorShift;
+	UINT32 sectorSize;
+	UINT32 miniSectorSize;
+
+	// Streams smaller than this are stored in the mini stream
+	UINT32 miniStreamCutoff;
+
+	// FAT sector numbers, in order, collected from the DIFAT
+	std::vector<UINT32> fatSectors;
+
+	// MiniFAT sector chain
+	std::vector<UINT32> miniFatSectors;
+
+	// directory sector chain
+	std::vector<UINT32> dirSectors;
+
+	// mini stream sector chain (the root entry's stream)
+	std::vector<UINT32> miniStreamSectors;
+};
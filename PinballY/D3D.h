@@ -165,6 +165,13 @@ public:
 		ctx->UpdateSubresource(resource, 0, nullptr, srcData, 0, 0); 
 	}
 
+	// update a texture resource from memory with the given row pitch
+	inline void UpdateResource(ID3D11Resource *resource, const void *srcData, UINT rowPitch)
+	{
+		DeviceContextLocker ctx;
+		ctx->UpdateSubresource(resource, 0, nullptr, srcData, rowPitch, 0);
+	}
+
 	// create a vertex shader
 	inline HRESULT CreateVertexShader(const void *byteCode, SIZE_T byteCodeLength, ID3D11VertexShader **vs)
 		{ return device->CreateVertexShader(byteCode, byteCodeLength, nullptr, vs); }
@@ -298,6 +305,13 @@ public:
 		ctx->DrawIndexed(indexCount, 0, 0);
 	}
 
+	// draw a range of indices, offsetting the vertex indices by 'baseVertex'
+	inline void DrawIndexed(INT indexCount, UINT startIndex, INT baseVertex)
+	{
+		DeviceContextLocker ctx;
+		ctx->DrawIndexed(indexCount, startIndex, baseVertex);
+	}
+
 	// turn the depth stencil on or off
 	void SetUseDepthStencil(bool useDepth);
 
@@ -10,6 +10,8 @@
 #include "Application.h"
 #include "AudioManager.h"
 #include "Sprite.h"
+#include "SpriteCompositor.h"
+#include "DecodedImageCache.h"
 #include "VideoSprite.h"
 
 using namespace DirectX;
@@ -25,6 +27,8 @@ namespace ConfigVars
 // statics
 std::list<D3DView*> D3DView::activeD3DViews;
 std::list<D3DView::IdleEventSubscriber*> D3DView::idleEventSubscribers;
+HiResTimer D3DView::renderTimer;
+const double D3DView::maxStaticRenderInterval = 0.25;
 
 // construction
 D3DView::D3DView(int contextMenuId, const TCHAR *configVarPrefix) 
@@ -38,6 +42,13 @@ D3DView::D3DView(int contextMenuId, const TCHAR *configVarPrefix)
 	// clear modes
 	dragMode = DragModeNone;
 	szLayout = szClient;
+	fpsDisplay = false;
+
+	// we need an initial render; assume a 60Hz refresh rate until we
+	// know which monitor we're on
+	renderNeeded = true;
+	refreshInterval = 1.0 / 60.0;
+	lastRenderTime = 0.0;
 
 	// set up config vars
 	configVarRotation = MsgFmt(_T("%s.%s"), configVarPrefix, ConfigVars::Rotation);
@@ -151,6 +162,9 @@ bool D3DView::InitWin()
 	// set the initial ortho projection scale
 	SetOrthoScale(width, height);
 
+	// get the monitor refresh rate
+	UpdateRefreshInterval();
+
 	// create the text handler
 	textDraw = new TextDraw();
 	if (!textDraw->Init())
@@ -172,6 +186,40 @@ bool D3DView::InitWin()
 	return true;
 }
 
+LRESULT D3DView::WndProc(UINT message, WPARAM wParam, LPARAM lParam)
+{
+	// Any message to the window could change what it displays: timer
+	// messages drive animations, input events update the UI, and so
+	// on.  So assume that we need a new frame after any message.
+	renderNeeded = true;
+
+	// the refresh rate can change with the display mode
+	if (message == WM_DISPLAYCHANGE)
+		UpdateRefreshInterval();
+
+	// use the base class handling
+	return __super::WndProc(message, wParam, lParam);
+}
+
+void D3DView::UpdateRefreshInterval()
+{
+	// Get the refresh rate of the monitor containing the window.  A
+	// frequency of 0 or 1 means "hardware default", which tells us
+	// nothing, so assume a typical 60Hz in that case.
+	int hz = 60;
+	MONITORINFOEX mi;
+	mi.cbSize = sizeof(mi);
+	DEVMODE dm;
+	ZeroMemory(&dm, sizeof(dm));
+	dm.dmSize = sizeof(dm);
+	if (GetMonitorInfo(MonitorFromWindow(hWnd, MONITOR_DEFAULTTONEAREST), &mi)
+		&& EnumDisplaySettings(mi.szDevice, ENUM_CURRENT_SETTINGS, &dm)
+		&& dm.dmDisplayFrequency > 1)
+		hz = dm.dmDisplayFrequency;
+
+	refreshInterval = 1.0 / hz;
+}
+
 bool D3DView::OnNCDestroy()
 {
 	// remove myself from the active D3D view list, and release the list ref
@@ -210,10 +258,19 @@ void D3DView::SetOrthoScale()
 // loop painting, and also during idle processing.
 void D3DView::RenderFrame()
 {
+	// Note the render time, and clear the invalidation.  Do this
+	// first, so that a change made during the render will trigger
+	// another frame.
+	lastRenderTime = renderTimer.GetTime_seconds();
+	renderNeeded = false;
+
 	// skip hidden and minimized windows
 	if (IsIconic(hWnd) || !IsWindowVisible(hWnd))
 		return;
 
+	// time the frame
+	PERF_ZONE(_T("RenderFrame"));
+
 	// count the frame
 	perfMon.CountFrame();
 
@@ -242,7 +299,13 @@ void D3DView::RenderFrame()
 	textDraw->Render(camera);
 
 	// close out the frame
-	d3dwin->EndFrame();
+	{
+		PERF_ZONE(_T("Present"));
+		d3dwin->EndFrame();
+	}
+
+	// notify the subclass
+	OnFramePresented();
 }
 
 void D3DView::ScaleSprite(Sprite *sprite, float span, bool maintainAspect)
@@ -378,6 +441,11 @@ bool D3DView::HandleCommand(int cmd)
 		ToggleFrameCounter();
 		return true;
 
+	case ID_PERF_TRACE:
+		// save the performance zone trace
+		SavePerfTrace();
+		return true;
+
 	case ID_FULL_SCREEN:
 	case ID_HIDE:
 		// forward these commands to our parent
@@ -414,6 +482,9 @@ bool D3DView::OnTimer(WPARAM timer, LPARAM callback)
 	switch (timer)
 	{
 	case fpsTimerID:
+		// collect the latest performance zone timings
+		PerfZone::Collect();
+
 		// get the current statistics - update only if we have a new 
 		// instantaneous counter
 		if (perfMon.GetCurFPS(fpsCur, .5f))
@@ -525,6 +596,73 @@ void D3DView::UpdateText()
 			textDraw->Add(buf, dmdFont, color, x, y, 0);
 			y += lineHeight;
 		}
+
+		// add the media file index statistics
+		if (auto gl = GameList::Get(); gl != nullptr)
+		{
+			MediaFileIndex::Stats stats;
+			gl->GetMediaIndex()->GetStats(stats);
+			_stprintf_s(buf, _T("Media index: %I64d lookups, %I64d file probes saved"),
+				stats.lookups, stats.probesSaved);
+			textDraw->Add(buf, dmdFont, color, x, y, 0);
+			y += lineHeight;
+		}
+
+		// add the decoded image cache statistics
+		if (auto cache = DecodedImageCache::Get(); cache != nullptr)
+		{
+			DecodedImageCache::Stats stats;
+			cache->GetStats(stats);
+			_stprintf_s(buf, _T("Image cache: %I64d hits, %I64d decodes"), stats.hits, stats.misses);
+			textDraw->Add(buf, dmdFont, color, x, y, 0);
+			y += lineHeight;
+		}
+
+		// add the view-specific statistics
+		std::list<TSTRING> viewStats;
+		GetPerfOverlayText(viewStats);
+		for (auto &s : viewStats)
+		{
+			textDraw->Add(s.c_str(), dmdFont, color, x, y, 0);
+			y += lineHeight;
+		}
+
+		// add the performance zone timings
+		std::vector<PerfZone::ZoneStats> zones;
+		PerfZone::GetStats(zones);
+		for (auto &z : zones)
+		{
+			_stprintf_s(buf, _T("%s: p50 %.2f, p95 %.2f, p99 %.2f, max %.2f ms (%I64u)"),
+				z.name.c_str(), z.p50_ms, z.p95_ms, z.p99_ms, z.max_ms, z.count);
+			textDraw->Add(buf, dmdFont, color, x, y, 0);
+			y += lineHeight;
+		}
+
+		// note the last trace file saved
+		if (lastPerfTraceFile.length() != 0)
+		{
+			_stprintf_s(buf, _T("Trace saved to %s"), lastPerfTraceFile.c_str());
+			textDraw->Add(buf, dmdFont, color, x, y, 0);
+			y += lineHeight;
+		}
+	}
+}
+
+void D3DView::SavePerfTrace()
+{
+	// build the filename - <program folder>\PerfTrace.json
+	TCHAR fname[MAX_PATH];
+	GetExeFilePath(fname, countof(fname));
+	PathAppend(fname, _T("PerfTrace.json"));
+
+	// write the trace
+	Application::InUiErrorHandler eh;
+	if (PerfZone::WriteTrace(fname, eh))
+	{
+		// note it in the overlay
+		lastPerfTraceFile = fname;
+		if (fpsDisplay)
+			UpdateText();
 	}
 }
 
@@ -547,6 +685,9 @@ void D3DView::OnResize(int width, int height)
 	if (d3dwin != 0)
 		d3dwin->ResizeWindow(width, height);
 
+	// the window might have moved to a different monitor
+	UpdateRefreshInterval();
+
 	// resize the camera view to match
 	OnResizeCameraView();
 }
@@ -588,36 +729,123 @@ void D3DView::RenderAll()
 		it->RenderFrame();
 }
 
+D3DView::RenderStatus D3DView::GetRenderStatus() const
+{
+	// if we've been invalidated, or the frame counter is showing (which
+	// should show the actual frame rate), we need a new frame
+	if (renderNeeded || fpsDisplay)
+		return RenderNeeded;
+
+	// check the sprites
+	RenderStatus status = RenderIdle;
+	for (auto s : sprites)
+	{
+		if (s->NeedsRender())
+			return RenderNeeded;
+		if (s->IsAnimating())
+			status = RenderPolling;
+	}
+
+	return status;
+}
+
+bool D3DView::RenderNextDue(double &nextDeadline, bool &active)
+{
+	double now = renderTimer.GetTime_seconds();
+	nextDeadline = now + maxStaticRenderInterval;
+	active = false;
+
+	// find the view with the earliest deadline that has passed
+	D3DView *best = nullptr;
+	double bestDeadline = 0.0;
+	for (auto v : activeD3DViews)
+	{
+		// hidden and minimized windows don't need rendering
+		if (IsIconic(v->hWnd) || !IsWindowVisible(v->hWnd))
+			continue;
+
+		// Figure the view's deadline.  A view with something new to
+		// show is due one refresh interval after its last frame.  A
+		// view with nothing new is due at the static render interval.
+		double deadline = v->lastRenderTime + maxStaticRenderInterval;
+		switch (v->GetRenderStatus())
+		{
+		case RenderNeeded:
+			deadline = v->lastRenderTime + v->refreshInterval;
+			active = true;
+			break;
+
+		case RenderPolling:
+			// Nothing new yet, but something could change at any time,
+			// so check again after a refresh interval.  This is just a
+			// wake-up time for checking, not a render deadline.
+			nextDeadline = min(nextDeadline, now + v->refreshInterval);
+			active = true;
+			break;
+		}
+
+		// if it's due, see if it's the most overdue so far
+		if (deadline <= now)
+		{
+			if (best == nullptr || deadline < bestDeadline)
+				best = v, bestDeadline = deadline;
+		}
+		else
+			nextDeadline = min(nextDeadline, deadline);
+	}
+
+	// If we found a view that's due, render it.  We only render one
+	// view per pass so that we can get right back to the event loop,
+	// to minimize event processing latency.  We don't want key inputs
+	// to feel laggy by forcing them to wait for every window to render.
+	if (best != nullptr)
+	{
+		best->RenderFrame();
+		return true;
+	}
+
+	// nothing was due
+	return false;
+}
+
 int D3DView::MessageLoop()
 {
 	// stash the audio manager instance in a stack local for quicker reference
 	AudioManager *audioManager = AudioManager::Get();
 
-	// idle processing
-	DWORD lastIdleTime = GetTickCount();
-	int curRenderWinIndex = 0;
-	auto DoIdle = [&lastIdleTime, audioManager, &curRenderWinIndex]()
+	// Set the system timer resolution to 1ms while any view is animating
+	// or playing video, so that our waits for frame deadlines are
+	// accurate.  The default resolution (usually 15.6ms) is coarser than
+	// a frame time.  The timer resolution is a system-wide setting that
+	// costs power for every process, so we only hold it while we need
+	// it, releasing it after the views have been idle for a while.  (The
+	// delay keeps us from flipping it on and off between animations.)
+	struct TimerResolution
 	{
-		// Do graphics rendering in one D3D view when the message queue is idle.
-		// We work through the windows round-robin on each idle pass.  We only
-		// render one window per idle pass so that we can get right back to the
-		// event loop, to minimize event processing latency.  We don't want key
-		// inputs to feel laggy by forcing them to wait for every window to
-		// render.
-		int n = 0;
-		for (auto it : activeD3DViews)
+		TimerResolution() : on(false), lastActive(0) { }
+		~TimerResolution() { if (on) timeEndPeriod(1); }
+
+		void Update(bool active)
 		{
-			if (n++ == curRenderWinIndex)
+			DWORD now = GetTickCount();
+			if (active)
 			{
-				it->RenderFrame();
-				break;
+				lastActive = now;
+				if (!on)
+					timeBeginPeriod(1), on = true;
 			}
+			else if (on && now - lastActive > 1000)
+				timeEndPeriod(1), on = false;
 		}
 
-		// advance to the next render window for the next pass
-		curRenderWinIndex += 1;
-		curRenderWinIndex %= activeD3DViews.size();
+		bool on;
+		DWORD lastActive;
+	} timerResolution;
 
+	// idle processing
+	DWORD lastIdleTime = GetTickCount();
+	auto DoIdle = [&lastIdleTime, audioManager]()
+	{
 		// call idle event subscribers
 		for (auto it = idleEventSubscribers.begin(); it != idleEventSubscribers.end(); )
 		{
@@ -642,12 +870,49 @@ int D3DView::MessageLoop()
 		lastIdleTime = GetTickCount();
 	};
 
+	// Render pass.  This renders the most overdue view, if any, and
+	// does the other idle processing.  If nothing was due, we return
+	// the time to wait until the next view is due, in milliseconds.
+	auto DoRenderPass = [&DoIdle, &timerResolution]() -> DWORD
+	{
+		// Load any sprite images that the compositor has finished
+		// drawing.  We don't know which windows the sprites belong
+		// to, so if anything arrived, redraw all of the windows.
+		if (auto compositor = SpriteCompositor::Get(); compositor != nullptr && compositor->DeliverResults())
+		{
+			for (auto v : activeD3DViews)
+				v->InvalidateRender();
+		}
+
+		// render the next view that's due
+		double nextDeadline;
+		bool active;
+		bool rendered = RenderNextDue(nextDeadline, active);
+
+		// hold the fine timer resolution only while something is moving
+		timerResolution.Update(active);
+
+		// do the other idle work
+		DoIdle();
+
+		// If we rendered something, other views might be due as well,
+		// so don't wait.  Otherwise, wait until the next deadline, up
+		// to the maximum idle interval.
+		if (rendered)
+			return 0;
+
+		double dt = nextDeadline - renderTimer.GetTime_seconds();
+		return dt <= 0.0 ? 0 : min(static_cast<DWORD>(ceil(dt * 1000.0)), 100UL);
+	};
+
 	// loop until we get an application Quit message or the window closes
 	for (;;)
 	{
-		// Force a render pass if it's been too long
+		// Force a render pass if it's been too long.  This ensures that
+		// we keep rendering even when the message queue is continuously
+		// busy, such as during a rapid series of input events.
 		if (GetTickCount() > lastIdleTime + 100)
-			DoIdle();
+			DoRenderPass();
 
 		// Check for Windows messages.  If the application is in the foreground,
 		// use PeekMessage() so that we do D3D rendering on idle.  If not, we can
@@ -679,15 +944,23 @@ int D3DView::MessageLoop()
 			}
 			else
 			{
-				// Do idle processing
-				DoIdle();
+				// Do a render pass.  If nothing needs rendering yet, sleep
+				// until the next view is due, a message arrives, or the
+				// sprite compositor finishes an image, rather than spinning
+				// through the loop.
+				if (DWORD wait = DoRenderPass(); wait != 0)
+				{
+					auto compositor = SpriteCompositor::Get();
+					HANDLE hResults = compositor != nullptr ? compositor->GetResultsEvent() : NULL;
+					MsgWaitForMultipleObjectsEx(hResults != NULL ? 1 : 0, &hResults, wait, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+				}
 			}
 		}
 		else
 		{
 			// if an event isn't immediately available, do idle processing
 			if (!PeekMessage(&msg, nullptr, 0, 0, PM_NOREMOVE))
-				DoIdle();
+				DoRenderPass();
 
 			// We're in the background - wait for a message.  This will
 			// freeze D3D updates, which is fine when we're in the background,
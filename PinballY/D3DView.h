@@ -35,6 +35,13 @@ public:
 	// render a frame
 	void RenderFrame();
 
+	// Request a new frame.  This marks the view as needing a redraw,
+	// so that the render scheduler will render it at the next frame
+	// time.  Messages sent to the view automatically invalidate it,
+	// and so does UpdateDrawingList(), so this is only needed for
+	// other changes made from outside the view's own message handling.
+	void InvalidateRender() { renderNeeded = true; }
+
 	// get/set monitor rotation in degrees
 	int GetRotation() const { return camera->GetMonitorRotation(); }
 	void SetRotation(int rotation);
@@ -47,7 +54,9 @@ public:
 
 	// Windows message loop.  This can be used to process messages
 	// when D3D windows are displayed.  This does D3D rendering to
-	// all D3D windows whenever the message loop is idle.
+	// the D3D windows whenever the message loop is idle, scheduling
+	// each window according to whether it has anything new to show
+	// and its monitor's refresh rate.
 	static int MessageLoop();
 
 	// Render all D3D windows.  This can be explicitly called in nested
@@ -59,6 +68,9 @@ public:
 	// Toggle the frame counter display
 	void ToggleFrameCounter();
 
+	// Save the performance zone timing history to a Chrome trace file
+	void SavePerfTrace();
+
 	// Idle event subscriber
 	class IdleEventSubscriber
 	{
@@ -90,6 +102,9 @@ protected:
 	// initialize the window
 	virtual bool InitWin() override;
 
+	// window proc
+	virtual LRESULT WndProc(UINT message, WPARAM wParam, LPARAM lParam) override;
+
 	// Update the sprite drawing list.  Subclasses must override to populate
 	// 'sprites' and 'videos' with the current list of drawing items.  Subclasses
 	// must call this whenever a new sprite needs to be added to the list or 
@@ -103,6 +118,16 @@ protected:
 	// update the text overlay
 	void UpdateText();
 
+	// Get view-specific statistics for the frame counter overlay.  The
+	// base class has none; subclasses can add lines for their own caches
+	// and the like.
+	virtual void GetPerfOverlayText(std::list<TSTRING> &lines) { }
+
+	// Frame presented notification.  RenderFrame() calls this after
+	// presenting each frame, for subclasses that want to measure the
+	// time until their updates reach the screen.
+	virtual void OnFramePresented() { }
+
 	// Scale a sprite according to the window size.  'span' is the fraction
 	// of the window's width and/or height to fill, where 1.0 means we scale
 	// the sprite to exactly fill the width or height.  
@@ -210,12 +235,56 @@ protected:
 	// latest FPS statistics
 	float fpsCur, fpsAvg;
 
+	// name of the last performance trace file saved, for the overlay
+	TSTRING lastPerfTraceFile;
+
 	// config variable prefix for this window's variables
 	TSTRING configVarPrefix;
 	TSTRING configVarRotation;
 	TSTRING configVarMirrorHorz;
 	TSTRING configVarMirrorVert;
 
+	// Render scheduling.  Each view is rendered when it has something
+	// new to show, but no more often than its monitor's refresh rate.
+	// A view has something new to show when it's been invalidated (by
+	// a message to the window or an explicit InvalidateRender() call),
+	// or when one of its sprites needs a redraw (a fade in progress,
+	// a new video frame).  Views with nothing new are still redrawn
+	// at a slow rate, as a backstop for changes we don't detect.
+	enum RenderStatus
+	{
+		RenderIdle,       // nothing new to show
+		RenderPolling,    // nothing new yet, but sprites are animating
+		RenderNeeded      // the view needs to be redrawn
+	};
+	RenderStatus GetRenderStatus() const;
+
+	// Render the view that's most overdue for a frame, if any views
+	// are due.  Returns true if we rendered a view.  If no views are
+	// due, returns false and fills in 'nextDeadline' with the time
+	// the next view will be due, on the render timer's clock.  Sets
+	// 'active' if any visible view has something new to show or has
+	// animating sprites.
+	static bool RenderNextDue(double &nextDeadline, bool &active);
+
+	// update the refresh interval from the monitor's refresh rate
+	void UpdateRefreshInterval();
+
+	// has the view been invalidated since the last render?
+	bool renderNeeded;
+
+	// refresh interval of the window's monitor, in seconds
+	double refreshInterval;
+
+	// time of the last render, in seconds on the render timer's clock
+	double lastRenderTime;
+
+	// maximum time between renders for a view with nothing new to show
+	static const double maxStaticRenderInterval;
+
+	// render scheduling timer
+	static HiResTimer renderTimer;
+
 	// global list of active D3D windows
 	static std::list<D3DView*> activeD3DViews;
 
@@ -42,7 +42,7 @@ SIZE DMDFont::MeasureString(const TCHAR *str) const
 
 		// if it's a lower-case character, and the font doesn't contain
 		// this character, convert to upper-case
-		if (c >= 'a' && c <= 'z' && charWidths[c] == 0)
+		if (c >= 'a' && c <= 'z' && charWidths[c - 32] == 0)
 			c = c - 'a' + 'A';
 
 		// if it's in range, add its width
@@ -80,7 +80,7 @@ void DMDFont::DrawString32(const TCHAR *str, BYTE *dmdPix, int x, int y, const C
 
 			// if it's a lower-case character, and the font doesn't contain
 			// this character, convert to upper-case
-			if (c >= 'a' && c <= 'z' && charWidths[c] == 0)
+			if (c >= 'a' && c <= 'z' && charWidths[c - 32] == 0)
 				c = c - 'a' + 'A';
 
 			// if it's in range, draw it
@@ -127,7 +127,7 @@ void DMDFont::DrawString4(const TCHAR *str, BYTE *dmdPix, int x, int y) const
 
 			// if it's a lower-case character, and the font doesn't contain
 			// this character, convert to upper-case
-			if (c >= 'a' && c <= 'z' && charWidths[c] == 0)
+			if (c >= 'a' && c <= 'z' && charWidths[c - 32] == 0)
 				c = c - 'a' + 'A';
 
 			// if it's in range, draw it
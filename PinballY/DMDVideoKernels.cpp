@@ -0,0 +1,498 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DMD video frame conversion kernels
+
+#include "stdafx.h"
+#include <intrin.h>
+#include <immintrin.h>
+#include "DMDVideoKernels.h"
+
+// -----------------------------------------------------------------------
+//
+// Plain C++ versions.  These are the reference implementations; the
+// vector versions must produce identical results.
+//
+
+// Max-pool 'n' pixels of one row.  The vector versions use this for
+// the leftover pixels at the end of each row.
+static inline void MaxPool2x2Row_Scalar(const BYTE *s, BYTE *dst, int n, int srcPitch)
+{
+	for (int col = 0; col < n; ++col, s += 2)
+	{
+		// take the maximum of the 2x2 pixel block at this position
+		BYTE a = s[0], b = s[1], c = s[srcPitch], d = s[srcPitch + 1];
+		if (b > a) a = b;
+		if (c > a) a = c;
+		if (d > a) a = d;
+		*dst++ = a;
+	}
+}
+
+static void MaxPool2x2_Scalar(const BYTE *src, BYTE *dst, int width, int height)
+{
+	int srcPitch = width * 2;
+	for (int row = 0; row < height; ++row, src += srcPitch*2, dst += width)
+		MaxPool2x2Row_Scalar(src, dst, width, srcPitch);
+}
+
+static void Quantize16_Scalar(const BYTE *src, BYTE *dst, int n)
+{
+	for (int i = 0; i < n; ++i)
+		dst[i] = src[i] >> 4;
+}
+
+static void YUVToRGB24_Scalar(const BYTE *y, const BYTE *u, const BYTE *v, BYTE *rgb, int n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		// Calculate the RGB value using the standard formula:
+		//
+		//  Y' = 1.164*(Y-16)
+		//  U' = U - 128
+		//  V' = V - 128
+		//
+		//  R = Y' + 1.596*V'
+		//  G = Y' - 0.813*V' - 0.391*U'
+		//  B = Y' + 2.018*U'
+		//
+		// For efficiency, do the calculations in base-65536
+		// fixed-point representation.
+		int yp = (y[i] - 16)*76284;
+		int up = (u[i] - 128);
+		int vp = (v[i] - 128);
+		int rr = (yp + 104595*vp) >> 16;
+		int gg = (yp - 53281*vp - 25625*up) >> 16;
+		int bb = (yp + 132252*up) >> 16;
+
+		// clamp the results to 0..255 and store the RGB pixel
+		rr = max(rr, 0);
+		gg = max(gg, 0);
+		bb = max(bb, 0);
+		*rgb++ = (BYTE)min(rr, 255);
+		*rgb++ = (BYTE)min(gg, 255);
+		*rgb++ = (BYTE)min(bb, 255);
+	}
+}
+
+static void Upsample2x_Scalar(const BYTE *src, BYTE *dst, int n)
+{
+	for (int i = 0; i < n; ++i, dst += 2)
+		dst[0] = dst[1] = src[i];
+}
+
+// Reverse the bytes in the range [l, r).  The vector mirror versions
+// use this for the leftover bytes in the middle of each row.
+static inline void ReverseBytes_Scalar(BYTE *l, BYTE *r)
+{
+	for (--r; l < r; ++l, --r)
+	{
+		BYTE t = *l;
+		*l = *r;
+		*r = t;
+	}
+}
+
+static void MirrorHorz_Scalar(BYTE *buf, int width, int height, int bytesPerPixel)
+{
+	int pitch = width * bytesPerPixel;
+	for (int row = 0; row < height; ++row, buf += pitch)
+	{
+		// swap pixels from the two ends of the row, working inwards
+		BYTE *l = buf, *r = buf + pitch - bytesPerPixel;
+		for (; l < r; l += bytesPerPixel, r -= bytesPerPixel)
+		{
+			for (int i = 0; i < bytesPerPixel; ++i)
+			{
+				BYTE t = l[i];
+				l[i] = r[i];
+				r[i] = t;
+			}
+		}
+	}
+}
+
+void DMDVideoKernels::MirrorVert(BYTE *buf, int width, int height, int bytesPerPixel)
+{
+	// swap rows from the top and bottom, working inwards
+	int pitch = width * bytesPerPixel;
+	BYTE tmp[512];
+	for (BYTE *t = buf, *b = buf + (height - 1)*pitch; t < b; t += pitch, b -= pitch)
+	{
+		for (int ofs = 0; ofs < pitch; ofs += sizeof(tmp))
+		{
+			int n = min(pitch - ofs, (int)sizeof(tmp));
+			memcpy(tmp, t + ofs, n);
+			memcpy(t + ofs, b + ofs, n);
+			memcpy(b + ofs, tmp, n);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------
+//
+// SSE2 versions
+//
+
+static void MaxPool2x2_SSE2(const BYTE *src, BYTE *dst, int width, int height)
+{
+	// Each step takes 32 source bytes from each of the two source
+	// rows, and produces 16 output bytes.  The vertical max is a
+	// simple byte-wise max of the two rows.  For the horizontal max,
+	// we take the max of each byte and its neighbor (via a 16-bit
+	// shift), and then keep just the low byte of each 16-bit pair.
+	int srcPitch = width * 2;
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	for (int row = 0; row < height; ++row, src += srcPitch*2)
+	{
+		const BYTE *s0 = src, *s1 = src + srcPitch;
+		int col = 0;
+		for (; col + 16 <= width; col += 16, s0 += 32, s1 += 32, dst += 16)
+		{
+			__m128i a = _mm_max_epu8(_mm_loadu_si128((const __m128i*)s0), _mm_loadu_si128((const __m128i*)s1));
+			__m128i b = _mm_max_epu8(_mm_loadu_si128((const __m128i*)(s0 + 16)), _mm_loadu_si128((const __m128i*)(s1 + 16)));
+			a = _mm_and_si128(_mm_max_epu8(a, _mm_srli_epi16(a, 8)), lowBytes);
+			b = _mm_and_si128(_mm_max_epu8(b, _mm_srli_epi16(b, 8)), lowBytes);
+			_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(a, b));
+		}
+
+		// finish the row
+		MaxPool2x2Row_Scalar(s0, dst, width - col, srcPitch);
+		dst += width - col;
+	}
+}
+
+static void Quantize16_SSE2(const BYTE *src, BYTE *dst, int n)
+{
+	// there's no byte-wise shift, so shift 16-bit lanes and mask off
+	// the bits shifted in from the neighboring byte
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(_mm_srli_epi16(x, 4), mask));
+	}
+	Quantize16_Scalar(src + i, dst + i, n - i);
+}
+
+// 32-bit multiply, keeping the low 32 bits of the products.  SSE2 has
+// no direct equivalent of the SSE4.1 _mm_mullo_epi32, so we multiply
+// the even and odd lanes separately and merge the results.  The low
+// 32 bits of a product are the same for signed and unsigned operands.
+static inline __m128i MulLo32_SSE2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// Interleave 16 pixels of planar R, G, B data into packed RGB24
+static inline void StoreRGB24(BYTE *rgb, __m128i r, __m128i g, __m128i b)
+{
+	alignas(16) BYTE rr[16], gg[16], bb[16];
+	_mm_store_si128((__m128i*)rr, r);
+	_mm_store_si128((__m128i*)gg, g);
+	_mm_store_si128((__m128i*)bb, b);
+	for (int i = 0; i < 16; ++i)
+	{
+		*rgb++ = rr[i];
+		*rgb++ = gg[i];
+		*rgb++ = bb[i];
+	}
+}
+
+static void YUVToRGB24_SSE2(const BYTE *y, const BYTE *u, const BYTE *v, BYTE *rgb, int n)
+{
+	// Same fixed-point formula as the scalar version, in 32-bit lanes.
+	// The products all fit in 32 bits, and the final saturating packs
+	// (32 -> 16 -> 8 bits) do the clamping to 0..255.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c16 = _mm_set1_epi32(16), c128 = _mm_set1_epi32(128);
+	const __m128i kY = _mm_set1_epi32(76284), kRV = _mm_set1_epi32(104595);
+	const __m128i kGV = _mm_set1_epi32(53281), kGU = _mm_set1_epi32(25625);
+	const __m128i kBU = _mm_set1_epi32(132252);
+	int i = 0;
+	for (; i + 16 <= n; i += 16, rgb += 48)
+	{
+		// widen 16 samples of each plane to four vectors of 32-bit lanes
+		auto Widen = [zero](const BYTE *p, __m128i w[4])
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)p);
+			__m128i lo = _mm_unpacklo_epi8(x, zero), hi = _mm_unpackhi_epi8(x, zero);
+			w[0] = _mm_unpacklo_epi16(lo, zero);
+			w[1] = _mm_unpackhi_epi16(lo, zero);
+			w[2] = _mm_unpacklo_epi16(hi, zero);
+			w[3] = _mm_unpackhi_epi16(hi, zero);
+		};
+		__m128i yy[4], uu[4], vv[4], r[4], g[4], b[4];
+		Widen(y + i, yy);
+		Widen(u + i, uu);
+		Widen(v + i, vv);
+
+		for (int j = 0; j < 4; ++j)
+		{
+			__m128i yp = MulLo32_SSE2(_mm_sub_epi32(yy[j], c16), kY);
+			__m128i up = _mm_sub_epi32(uu[j], c128);
+			__m128i vp = _mm_sub_epi32(vv[j], c128);
+			r[j] = _mm_srai_epi32(_mm_add_epi32(yp, MulLo32_SSE2(vp, kRV)), 16);
+			g[j] = _mm_srai_epi32(_mm_sub_epi32(_mm_sub_epi32(yp, MulLo32_SSE2(vp, kGV)), MulLo32_SSE2(up, kGU)), 16);
+			b[j] = _mm_srai_epi32(_mm_add_epi32(yp, MulLo32_SSE2(up, kBU)), 16);
+		}
+
+		auto Pack = [](const __m128i x[4]) {
+			return _mm_packus_epi16(_mm_packs_epi32(x[0], x[1]), _mm_packs_epi32(x[2], x[3])); };
+		StoreRGB24(rgb, Pack(r), Pack(g), Pack(b));
+	}
+	YUVToRGB24_Scalar(y + i, u + i, v + i, rgb, n - i);
+}
+
+static void Upsample2x_SSE2(const BYTE *src, BYTE *dst, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16, dst += 32)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi8(x, x));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi8(x, x));
+	}
+	Upsample2x_Scalar(src + i, dst, n - i);
+}
+
+// reverse the order of the bytes in a vector
+static inline __m128i Reverse_SSE2(__m128i x)
+{
+	// swap the bytes within each 16-bit word, then reverse the words
+	x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+static void MirrorHorz_SSE2(BYTE *buf, int width, int height, int bytesPerPixel)
+{
+	// the vector version only handles single-byte pixels
+	if (bytesPerPixel != 1)
+		return MirrorHorz_Scalar(buf, width, height, bytesPerPixel);
+
+	// Swap and reverse vectors from the two ends of each row, while
+	// there's room for two non-overlapping vectors, then reverse
+	// whatever is left in the middle one byte at a time.
+	for (int row = 0; row < height; ++row, buf += width)
+	{
+		BYTE *l = buf, *r = buf + width;
+		for (; r - l >= 32; l += 16, r -= 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)l), b = _mm_loadu_si128((const __m128i*)(r - 16));
+			_mm_storeu_si128((__m128i*)l, Reverse_SSE2(b));
+			_mm_storeu_si128((__m128i*)(r - 16), Reverse_SSE2(a));
+		}
+		ReverseBytes_Scalar(l, r);
+	}
+}
+
+// -----------------------------------------------------------------------
+//
+// AVX2 versions.  Most AVX2 operations work within the two 128-bit
+// halves of a vector independently, so the packing and unpacking
+// steps need an extra permute to get the results back in order.
+//
+
+static void MaxPool2x2_AVX2(const BYTE *src, BYTE *dst, int width, int height)
+{
+	// same approach as the SSE2 version, 32 output bytes per step
+	int srcPitch = width * 2;
+	const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+	for (int row = 0; row < height; ++row, src += srcPitch*2)
+	{
+		const BYTE *s0 = src, *s1 = src + srcPitch;
+		int col = 0;
+		for (; col + 32 <= width; col += 32, s0 += 64, s1 += 64, dst += 32)
+		{
+			__m256i a = _mm256_max_epu8(_mm256_loadu_si256((const __m256i*)s0), _mm256_loadu_si256((const __m256i*)s1));
+			__m256i b = _mm256_max_epu8(_mm256_loadu_si256((const __m256i*)(s0 + 32)), _mm256_loadu_si256((const __m256i*)(s1 + 32)));
+			a = _mm256_and_si256(_mm256_max_epu8(a, _mm256_srli_epi16(a, 8)), lowBytes);
+			b = _mm256_and_si256(_mm256_max_epu8(b, _mm256_srli_epi16(b, 8)), lowBytes);
+			__m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i*)dst, p);
+		}
+
+		// finish the row
+		MaxPool2x2Row_Scalar(s0, dst, width - col, srcPitch);
+		dst += width - col;
+	}
+}
+
+static void Quantize16_AVX2(const BYTE *src, BYTE *dst, int n)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0F);
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+	}
+	Quantize16_SSE2(src + i, dst + i, n - i);
+}
+
+static void YUVToRGB24_AVX2(const BYTE *y, const BYTE *u, const BYTE *v, BYTE *rgb, int n)
+{
+	// same formula as the SSE2 version, with native 32-bit multiplies
+	const __m256i c16 = _mm256_set1_epi32(16), c128 = _mm256_set1_epi32(128);
+	const __m256i kY = _mm256_set1_epi32(76284), kRV = _mm256_set1_epi32(104595);
+	const __m256i kGV = _mm256_set1_epi32(53281), kGU = _mm256_set1_epi32(25625);
+	const __m256i kBU = _mm256_set1_epi32(132252);
+	int i = 0;
+	for (; i + 16 <= n; i += 16, rgb += 48)
+	{
+		__m256i r[2], g[2], b[2];
+		for (int j = 0; j < 2; ++j)
+		{
+			int k = i + j*8;
+			__m256i yy = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(y + k)));
+			__m256i uu = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(u + k)));
+			__m256i vv = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(v + k)));
+			__m256i yp = _mm256_mullo_epi32(_mm256_sub_epi32(yy, c16), kY);
+			__m256i up = _mm256_sub_epi32(uu, c128);
+			__m256i vp = _mm256_sub_epi32(vv, c128);
+			r[j] = _mm256_srai_epi32(_mm256_add_epi32(yp, _mm256_mullo_epi32(vp, kRV)), 16);
+			g[j] = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_sub_epi32(yp, _mm256_mullo_epi32(vp, kGV)), _mm256_mullo_epi32(up, kGU)), 16);
+			b[j] = _mm256_srai_epi32(_mm256_add_epi32(yp, _mm256_mullo_epi32(up, kBU)), 16);
+		}
+
+		// saturate to 16 bits, restore the lane order, then saturate to 8 bits
+		auto Pack = [](const __m256i x[2]) {
+			__m256i w = _mm256_permute4x64_epi64(_mm256_packs_epi32(x[0], x[1]), _MM_SHUFFLE(3, 1, 2, 0));
+			return _mm_packus_epi16(_mm256_castsi256_si128(w), _mm256_extracti128_si256(w, 1)); };
+		StoreRGB24(rgb, Pack(r), Pack(g), Pack(b));
+	}
+	YUVToRGB24_Scalar(y + i, u + i, v + i, rgb, n - i);
+}
+
+static void Upsample2x_AVX2(const BYTE *src, BYTE *dst, int n)
+{
+	// Reorder the 64-bit quarters so that the in-lane unpacks produce
+	// the output in order, 32 bytes at a time
+	int i = 0;
+	for (; i + 32 <= n; i += 32, dst += 64)
+	{
+		__m256i x = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(src + i)), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)dst, _mm256_unpacklo_epi8(x, x));
+		_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_unpackhi_epi8(x, x));
+	}
+
+	// do the rest with SSE2
+	Upsample2x_SSE2(src + i, dst, n - i);
+}
+
+static void MirrorHorz_AVX2(BYTE *buf, int width, int height, int bytesPerPixel)
+{
+	// the vector version only handles single-byte pixels
+	if (bytesPerPixel != 1)
+		return MirrorHorz_Scalar(buf, width, height, bytesPerPixel);
+
+	// reverse the bytes within each 128-bit lane, then swap the lanes
+	const __m256i rev = _mm256_setr_epi8(
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+		15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	auto Reverse = [&rev](__m256i x) {
+		return _mm256_permute2x128_si256(_mm256_shuffle_epi8(x, rev), _mm256_shuffle_epi8(x, rev), 0x01); };
+
+	// same approach as the SSE2 version, 32 bytes at each end per step
+	for (int row = 0; row < height; ++row, buf += width)
+	{
+		BYTE *l = buf, *r = buf + width;
+		for (; r - l >= 64; l += 32, r -= 32)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)l), b = _mm256_loadu_si256((const __m256i*)(r - 32));
+			_mm256_storeu_si256((__m256i*)l, Reverse(b));
+			_mm256_storeu_si256((__m256i*)(r - 32), Reverse(a));
+		}
+		ReverseBytes_Scalar(l, r);
+	}
+}
+
+// -----------------------------------------------------------------------
+//
+// Kernel selection
+//
+
+// Detect the best instruction set level for the CPU
+static DMDVideoKernels::Level DetectLevel()
+{
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	// check for SSE2 support
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!sse2)
+		return DMDVideoKernels::Scalar;
+
+	// AVX2 requires CPU support, plus OS support for saving the YMM
+	// registers on context switches
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 5)) != 0)
+			return DMDVideoKernels::AVX2;
+	}
+
+	return DMDVideoKernels::SSE2;
+}
+
+const DMDVideoKernels &DMDVideoKernels::Get()
+{
+	static const DMDVideoKernels kernels(DetectLevel());
+	return kernels;
+}
+
+const DMDVideoKernels *DMDVideoKernels::Get(Level level)
+{
+	static const DMDVideoKernels scalar(Scalar), sse2(SSE2), avx2(AVX2);
+	if (level > Get().level)
+		return nullptr;
+
+	switch (level)
+	{
+	case Scalar: return &scalar;
+	case SSE2: return &sse2;
+	case AVX2: return &avx2;
+	default: return nullptr;
+	}
+}
+
+DMDVideoKernels::DMDVideoKernels(Level level) : level(level)
+{
+	switch (level)
+	{
+	case Scalar:
+		MaxPool2x2 = MaxPool2x2_Scalar;
+		Quantize16 = Quantize16_Scalar;
+		YUVToRGB24 = YUVToRGB24_Scalar;
+		Upsample2x = Upsample2x_Scalar;
+		MirrorHorz = MirrorHorz_Scalar;
+		break;
+
+	case SSE2:
+		MaxPool2x2 = MaxPool2x2_SSE2;
+		Quantize16 = Quantize16_SSE2;
+		YUVToRGB24 = YUVToRGB24_SSE2;
+		Upsample2x = Upsample2x_SSE2;
+		MirrorHorz = MirrorHorz_SSE2;
+		break;
+
+	case AVX2:
+		MaxPool2x2 = MaxPool2x2_AVX2;
+		Quantize16 = Quantize16_AVX2;
+		YUVToRGB24 = YUVToRGB24_AVX2;
+		Upsample2x = Upsample2x_AVX2;
+		MirrorHorz = MirrorHorz_AVX2;
+		break;
+	}
+}
@@ -0,0 +1,69 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DMD video frame conversion kernels
+//
+// These are the pixel-format conversions that RealDMD uses to turn
+// decoded video frames into DMD device frames: 2x2 max-pooling for
+// double-size videos, luma quantization to 16 gray shades, YUV to
+// RGB24 conversion, and mirroring.  They run on the video decoder
+// thread for every DMD video frame, so they're worth some attention.
+//
+// Each kernel has a plain C++ implementation, plus SSE2 and AVX2
+// versions where they help.  Get() selects the best implementation
+// for the CPU at run-time.  The vector versions compute exactly the
+// same results as the plain versions, bit for bit, so the choice of
+// implementation is never visible in the output.  The kernels accept
+// any size; the vector versions finish any pixels left over after the
+// last whole vector with the plain code.
+//
+
+#pragma once
+
+class DMDVideoKernels
+{
+public:
+	// Get the kernel table for the current CPU
+	static const DMDVideoKernels &Get();
+
+	// Instruction set level of the selected kernels
+	enum Level
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+	Level level;
+
+	// Get the kernel table for a specific instruction set level.  This
+	// is for testing the implementations against each other.  Returns
+	// null if the CPU doesn't support the level.
+	static const DMDVideoKernels *Get(Level level);
+
+	// 2x2 max-pool.  Takes a source plane of (2*width) x (2*height)
+	// 8-bit pixels, and stores the maximum of each 2x2 block in the
+	// width x height destination plane.
+	void (*MaxPool2x2)(const BYTE *src, BYTE *dst, int width, int height);
+
+	// Quantize 8-bit luma to 16 shades (0..15).  The source and
+	// destination can be the same buffer.
+	void (*Quantize16)(const BYTE *src, BYTE *dst, int n);
+
+	// Convert a row of YUV pixels to packed RGB24 (R, G, B byte
+	// order), using the BT.601 studio-swing formula.  'u' and 'v'
+	// have one sample per pixel.
+	void (*YUVToRGB24)(const BYTE *y, const BYTE *u, const BYTE *v, BYTE *rgb, int n);
+
+	// Double a row of samples horizontally, repeating each sample
+	// twice.  This expands a row of 2x2 subsampled U or V data to one
+	// sample per pixel.  'n' is the number of source samples.
+	void (*Upsample2x)(const BYTE *src, BYTE *dst, int n);
+
+	// Mirror a frame horizontally or vertically, in place.  The frame
+	// rows are width*bytesPerPixel bytes long, with no padding.
+	void (*MirrorHorz)(BYTE *buf, int width, int height, int bytesPerPixel);
+	static void MirrorVert(BYTE *buf, int width, int height, int bytesPerPixel);
+
+protected:
+	DMDVideoKernels(Level level);
+};
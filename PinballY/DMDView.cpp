@@ -20,6 +20,7 @@
 #include "MouseButtons.h"
 #include "VPinMAMEIfc.h"
 #include "DMDFont.h"
+#include "HighScoreSlides.h"
 
 using namespace DirectX;
 
@@ -236,20 +237,56 @@ void DMDView::GenerateHighScoreImages()
 				txtColor = { (BYTE)b, (BYTE)g, (BYTE)r };
 		}
 
-		// Creating the high-score images can be rather time-consuming, 
-		// especially for the alphanumeric style, as GDI+ is painfully
-		// slow at copying the character cell images.  Alphanumeric prep
-		// times can be as long as 400ms.  That's way too long to stall
-		// the UI, so we have to do it on a background thread.
+		// Capture the message list.  Each sublist is a set of strings to
+		// display together on one slide; the overall list is the set of
+		// slides to display in time sequence.
+		std::list<std::list<TSTRING>> messages;
+		game->DispHighScoreGroups([&messages](const std::list<const TSTRING*> &group)
+		{
+			std::list<TSTRING> &list = messages.emplace_back();
+			for (auto s : group)
+				list.emplace_back(*s);
+		});
+
+		// If we've already rendered this exact slide show, install the
+		// cached slides and skip the rendering entirely.
+		TSTRING cacheKey = HighScoreSlideCache::MakeKey(game->GetGameId().c_str(), style, txtColor, messages);
+		if (std::list<HighScoreSlideCache::Slide> slides; highScoreCache.Get(cacheKey.c_str(), slides))
+		{
+			// build the image list, adding a reference for each sprite
+			std::list<HighScoreImage> images;
+			for (auto &s : slides)
+			{
+				s.sprite->AddRef();
+				images.emplace_back(s.sprite.Get(), s.displayTime);
+			}
+
+			// install it
+			highScoreCacheKey.clear();
+			SetHighScoreImages(highScoreRequestSeqNo, &images);
+			return;
+		}
+
+		// remember the key, so that we can cache the results when they arrive
+		highScoreCacheKey = cacheKey;
+
+		// Rendering the slides takes long enough (especially in typewriter
+		// style, which has to go through GDI+ to draw the text) that it
+		// would cause a noticeable stall in the UI, so do it on a
+		// background thread.
 		struct ThreadInfo
 		{
-			ThreadInfo(DMDView *view, DWORD seqno, RGBQUAD txtColor, const TCHAR *style) :
+			ThreadInfo(DMDView *view, DWORD seqno, RGBQUAD txtColor, const TCHAR *style,
+				std::list<std::list<TSTRING>> &messages) :
 				seqno(seqno),
 				txtColor(txtColor),
 				style(style)
 			{
 				// assign the view pointer explicitly, to add a ref count
 				this->view = view;
+
+				// take over the message list
+				this->messages.swap(messages);
 			}
 
 			// associated view window
@@ -264,432 +301,179 @@ void DMDView::GenerateHighScoreImages()
 			// display style for the game
 			TSTRING style;
 
-			// Messages to display.  Each sublist is a set of strings to
-			// display together on one display slide; the overall list is
-			// the set of slides to display in time sequence.
+			// messages to display, grouped by slide
 			std::list<std::list<TSTRING>> messages;
 
 			// thread entrypoint
 			static DWORD WINAPI SMain(LPVOID lParam) { return static_cast<ThreadInfo*>(lParam)->Main(); }
 			DWORD Main()
 			{
+				PERF_ZONE(_T("GenerateHighScoreImages"));
 
-				// Figure the background color, using the text color at reduced
-				// brightness.  This helps simulate the visible pixel structure of 
-				// a real DMD by showing a little of the text color even in pixels
-				// that are fully "off".
-				RGBQUAD bgColor = { (BYTE)(txtColor.rgbBlue / 10), (BYTE)(txtColor.rgbGreen / 10), (BYTE)(txtColor.rgbRed / 10) };
+				// generate the graphics according to the style
+				std::list<HighScoreImage> images;
+				if (_tcsicmp(style.c_str(), _T("alpha")) == 0)
+					RenderAlpha(images);
+				else if (_tcsicmp(style.c_str(), _T("tt")) == 0)
+					RenderTypewriter(images);
+				else
+					RenderDMD(images);
 
-				// Set up the 128x32 32bpp pixel array buffer
-				static const int dmdBytes = dmdWidth * dmdHeight * 4;
-				BYTE pix[dmdBytes];
+				// Send the sprite list back to the window
+				if (auto view = Application::Get()->GetDMDView(); view != nullptr)
+					view->SendMessage(DMVMsgHighScoreImage, seqno, reinterpret_cast<LPARAM>(&images));
 
-				// Set up a DIB descriptor for the 32bpp bitmap.  We'll use this
-				// to create the D3D texture for the DMD sprite.
+				// count the thread exist in the view object
+				InterlockedDecrement(&view->nHighScoreThreads);
+
+				// delete 'self'
+				delete this;
+
+				// done (thread return code isn't used)
+				return 0;
+			}
+
+			// Create a sprite from a rendered image and add it to the list
+			void AddImage(std::list<HighScoreImage> &images, Sprite *newSprite,
+				const HighScoreRasterizer::Image &image, const TCHAR *desc)
+			{
+				RefPtr<Sprite> sprite(newSprite);
 				BITMAPINFO bmi;
-				bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-				bmi.bmiHeader.biWidth = dmdWidth;
-				bmi.bmiHeader.biHeight = -dmdHeight;
-				bmi.bmiHeader.biBitCount = 32;
-				bmi.bmiHeader.biCompression = BI_RGB;
-				bmi.bmiHeader.biSizeImage = 0;
-				bmi.bmiHeader.biXPelsPerMeter = 0;
-				bmi.bmiHeader.biYPelsPerMeter = 0;
-				bmi.bmiHeader.biClrUsed = 0;
-				bmi.bmiHeader.biClrImportant = 0;
-
-				// Build a color index table, with a ramp of brightness values
-				// from the background color to the full-brightness text color.
-				int redSpan = txtColor.rgbRed - bgColor.rgbRed;
-				int greenSpan = txtColor.rgbGreen - bgColor.rgbGreen;
-				int blueSpan = txtColor.rgbBlue - bgColor.rgbBlue;
+				HighScoreSlideCache::GetBitmapInfo(image, bmi);
+				SilentErrorHandler eh;
+				if (sprite->Load(bmi, image.pix.data(), eh, desc))
+					images.emplace_back(sprite.Detach(), 3500);
+			}
+
+			// DMD style (this is also the default if the style setting
+			// isn't recognized)
+			void RenderDMD(std::list<HighScoreImage> &images)
+			{
+				// build the color ramp for the text color
 				DMDFont::Color colors[16];
-				for (int i = 0; i < 16; ++i)
-				{
-					colors[i].Set(
-						bgColor.rgbRed + redSpan * i / 15,
-						bgColor.rgbGreen + greenSpan * i / 15,
-						bgColor.rgbBlue + blueSpan * i / 15);
-				}
+				HighScoreRasterizer::BuildColorRamp(colors, txtColor.rgbRed, txtColor.rgbGreen, txtColor.rgbBlue);
 
-				// Count the character cells in an alphanumeric string.  This is
-				// slightly more complicated than just counting the characters,
-				// because of the special handling of '.' and ',': these combine
-				// with the previous character, since the dot/comma element in
-				// each cell can be "illuminated" in addition to any other glyph.
-				auto CountAlphaCells = [](const TCHAR *str)
+				// render each group
+				HighScoreRasterizer::Image image;
+				for (auto &group : messages)
 				{
-					int nCells = 0;
-					for (TCHAR prvChar = 0; *str != 0; ++str)
-					{
-						// get this character
-						TCHAR c = *str;
-
-						// Check for combining characters.  A '.' or ',' can combine
-						// with the previous character to form a single cell, provided
-						// that the previous character isn't also '.' or ',', and that
-						// this isn't the first cell.
-						if (!((c == '.' || c == ',') && !(nCells == 0 || prvChar == '.' || prvChar == ',')))
-							++nCells;
-
-						// this is the next character for the next iteration
-						prvChar = c;
-					}
-
-					// return the cell count
-					return nCells;
-				};
+					HighScoreRasterizer::RenderDMD(image, group, PickHighScoreFont(group), colors);
+					AddImage(images, new DMDSprite(), image, _T("DMD-style high score graphics"));
+				}
+			}
 
-				// If we're using alphanumeric segmented display style, we
-				// have a limited repertoire of colors for the pre-drawn images.
-				// Find the color that's closest to the VPM display color. 
-				//
-				// While we're at it, also figure the required grid size.  Alpha-
-				// numeric segmented displays use fixed character cells, so the 
-				// simulation is most convincing if the whole series of messages 
-				// is displayed on the same fixed grid layout.  This supports the
-				// illusion that the messages are being displayed on a physical
-				// segmented display unit.  Use the 1990-91 era Williams machines
-				// (e.g., Funhouse or Whirlwind) as the reference for the default 
-				// display size; these had two lines of 16 cells.  But we'll
-				// increase the width and/or height from there if any message
-				// groups require more, to make sure everything fits.
-				std::unique_ptr<Gdiplus::Bitmap> alphanumImage;
-				int alphaGridWid = 16, alphaGridHt = 2;
-				if (_tcsicmp(style.c_str(), _T("alpha")) == 0)
+			// Alphanumeric segmented display style
+			void RenderAlpha(std::list<HighScoreImage> &images)
+			{
+				// The segment images come in a limited repertoire of colors.
+				// Find the color that's closest to the VPM display color.
+				static const struct
 				{
-					static const struct
-					{
-						COLORREF color;
-						int imageId;
-					} colors[] = {
-						{ RGB(255, 88, 32), IDB_ALPHANUM_AMBER },
+					COLORREF color;
+					int imageId;
+				} colors[] = {
+					{ RGB(255, 88, 32), IDB_ALPHANUM_AMBER },
 					{ RGB(255, 0, 0), IDB_ALPHANUM_RED },
 					{ RGB(0, 255, 0), IDB_ALPHANUM_GREEN },
 					{ RGB(0, 0, 255), IDB_ALPHANUM_BLUE },
 					{ RGB(255, 255, 0), IDB_ALPHANUM_YELLOW },
 					{ RGB(255, 0, 255), IDB_ALPHANUM_PURPLE },
 					{ RGB(255, 255, 255), IDB_ALPHANUM_WHITE }
-					};
-
-					int dMin = 1000000;
-					int alphanumImageId = IDB_ALPHANUM_AMBER;
-					for (size_t i = 0; i < countof(colors); ++i)
+				};
+				int dMin = 1000000;
+				int alphanumImageId = IDB_ALPHANUM_AMBER;
+				for (size_t i = 0; i < countof(colors); ++i)
+				{
+					// figure the distance between this color and the desired text
+					// color, in RGB vector space
+					int dr = GetRValue(colors[i].color) - txtColor.rgbRed;
+					int dg = GetGValue(colors[i].color) - txtColor.rgbGreen;
+					int db = GetBValue(colors[i].color) - txtColor.rgbBlue;
+					int d = dr * dr + dg * dg + db * db;
+
+					// if this is the closest match so far, keep it
+					if (d < dMin)
 					{
-						// figure the distance between this color and the desired text
-						// color, in RGB vector space
-						int dr = GetRValue(colors[i].color) - txtColor.rgbRed;
-						int dg = GetGValue(colors[i].color) - txtColor.rgbGreen;
-						int db = GetBValue(colors[i].color) - txtColor.rgbBlue;
-						int d = dr * dr + dg * dg + db * db;
-
-						// if this is the closest match so far, keep it
-						if (d < dMin)
-						{
-							dMin = d;
-							alphanumImageId = colors[i].imageId;
-						}
+						dMin = d;
+						alphanumImageId = colors[i].imageId;
 					}
+				}
 
-					// load the image we settled on
-					alphanumImage.reset(GPBitmapFromPNG(alphanumImageId));
+				// get the decoded segment atlas for the color
+				auto atlas = HighScoreSlideCache::GetResourceImage(alphanumImageId);
+				if (atlas == nullptr)
+					return;
 
-					// scan the group to determine the required grid size
-					for (auto &group : messages)
-					{
-						// if this is the tallest message so far, remember it
-						if ((int)group.size() > alphaGridHt)
-							alphaGridHt = (int)group.size();
+				// use the same grid layout for all of the slides
+				int gridWid, gridHt;
+				HighScoreRasterizer::GetAlphaGridSize(messages, gridWid, gridHt);
 
-						// scan the group for the widest line
-						for (auto s : group)
-						{
-							// if this is the widest line so far, remember it
-							int wid = CountAlphaCells(s.c_str());
-							if (wid > alphaGridWid)
-								alphaGridWid = wid;
-						}
-					}
-				}
-
-				// load the background image for typewriter mode, if applicable
-				std::unique_ptr<Gdiplus::Bitmap> ttBkgImage;
-				if (_tcsicmp(style.c_str(), _T("tt")) == 0)
+				// render each group
+				HighScoreRasterizer::Image image;
+				for (auto &group : messages)
 				{
-					ttBkgImage.reset(GPBitmapFromPNG(IDB_INDEX_CARD));
+					HighScoreRasterizer::RenderAlpha(image, *atlas, group, gridWid, gridHt);
+					AddImage(images, new Sprite(), image, _T("Alphanumeric-style high score graphics"));
 				}
+			}
 
-				// generate the graphics for each text group
-				std::list<HighScoreImage> images;
-				for (auto &group : messages)
-				{
-					// note the number of lines in this message
-					int nLines = (int)group.size();
+			// Typewriter style.  This draws the text with GDI+ over the
+			// index card background, since it uses a regular Windows font.
+			void RenderTypewriter(std::list<HighScoreImage> &images)
+			{
+				// get the decoded index card background
+				auto card = HighScoreSlideCache::GetResourceImage(IDB_INDEX_CARD);
+				if (card == nullptr)
+					return;
 
-					// create a graphic according to the style
-					RefPtr<Sprite> sprite;
-					if (_tcsicmp(style.c_str(), _T("alpha")) == 0)
-					{
-						// Alphanumeric segmented display style
-
-						// Figure the pixel size required for the generated image.  The 
-						// image will consist of alphaGridHt x alphaGridWid character cells,
-						// plus margins and vertical padding between lines.  The character
-						// cells are of fixed size; we can determine the size of a cell from
-						// the size of the 'alphanumImage' PNG, which is laid out in a 16x8
-						// (col x row) grid.
-						//
-						// The margins and line spacing depend on the number of lines:
-						//
-						// - For a 2-line image, draw with 1/2 line of spacing top and bottom,
-						//   and 1/2 line of spacing between the two rows
-						//
-						// - For a 3-line image, draw with 1/2 line of spacing top and bottom
-						//   and 1/4 line between rows
-						//
-						// - For a 4-line image, draw with 1/4 line of spacing top and bottom
-						//   and 1/4 line between rows
-						//
-						const int charCellWid = alphanumImage.get()->GetWidth() / 16;
-						const int charCellHt = alphanumImage.get()->GetHeight() / 8;
-						int yPadding = alphaGridHt <= 2 ? charCellHt / 2 : charCellHt / 4;
-						int yMargin = alphaGridHt <= 2 ? charCellHt / 2 : charCellHt / 4;
-						int pixWid = alphaGridWid * charCellWid;
-						int pixHt = alphaGridHt * charCellHt + 2 * yMargin + yPadding * (alphaGridHt - 1);
-
-						// figure the top left cell position with these margins
-						int x0 = 0, y0 = yMargin;
-
-						// Pad this out to a 4:1 aspect ratio.  The video DMD display window
-						// is usually sized roughly 4:1 to match the proportions of real
-						// pinball DMDs from the 1990s, which were mostly 128x32.  The
-						// renderer will scale our image to the actual display size, so we
-						// don't have to match the exact size or proportions, but the result
-						// will look better if the image proportions are close to the display
-						// proportions, since that will cause less geometric distortion.
-						float aspect = (float)pixWid / (float)pixHt;
-						if (aspect > 4.0f)
-						{
-							y0 += (pixWid / 4 - pixHt) / 2;
-							pixHt = pixWid / 4;
-						}
-						else if (aspect < 4.0f)
-						{
-							x0 += (pixHt * 4 - pixWid) / 2;
-							pixWid = pixHt * 4;
-						}
+				// size the images to match the background
+				int wid = card->width, ht = card->height;
+				BITMAPINFO bmi;
+				HighScoreSlideCache::GetBitmapInfo(*card, bmi);
 
-						// create the image
-						sprite.Attach(new Sprite());
-						SilentErrorHandler eh;
-						sprite->Load(pixWid, pixHt, [&alphanumImage, &group,
-							pixWid, pixHt, charCellWid, charCellHt, alphaGridWid, alphaGridHt,
-							x0, y0, yPadding, &CountAlphaCells]
-							(HDC hdc, HBITMAP)
-						{
-							// set up the GDI+ context
-							Gdiplus::Graphics g(hdc);
-
-							// fill the background with black
-							Gdiplus::SolidBrush bkg(Gdiplus::Color(0, 0, 0));
-							g.FillRectangle(&bkg, 0, 0, charCellWid, charCellHt);
-
-							// center it vertically
-							int y = y0;
-							int blankLines = alphaGridHt - (int)group.size();
-							int blankTopLines = blankLines / 2;
-
-							// draw each line
-							auto s = group.begin();
-							for (int line = 0; line < alphaGridHt; ++line)
-							{
-								// get the next item, if available, otherwise show a blank line
-								const TCHAR *txt = _T("");
-								if (line >= blankTopLines && s != group.end())
-								{
-									txt = s->c_str();
-									++s;
-								}
-
-								// start at the left edge
-								int x = x0;
-
-								// figure the number of spaces to the left and
-								// right to center the line within the cell width
-								int nAdvChars = CountAlphaCells(txt);
-								int extraSpaces = alphaGridWid - nAdvChars;
-								int leftSpaces = extraSpaces / 2;
-								int rightSpaces = extraSpaces - leftSpaces;
-
-								// draw the left spaces
-								auto DrawSpaces = [&x, &alphanumImage, &g, &y, charCellWid, charCellHt](int n)
-								{
-									for (int i = 0; i < n; ++i)
-									{
-										// draw a space (code point 32 - grid row 2, column 0)
-										g.DrawImage(
-											alphanumImage.get(),
-											Gdiplus::RectF((float)x, (float)y, (float)charCellWid, (float)charCellHt),
-											0.0f, 2.0f*charCellHt, (float)charCellWid, (float)charCellHt,
-											Gdiplus::UnitPixel);
-
-										x += charCellWid;
-									}
-								};
-								DrawSpaces(leftSpaces);
-
-								// draw the characters
-								TCHAR prvChar = 0;
-								const TCHAR *p = txt;
-								TCHAR c = *p;
-								while (c != 0)
-								{
-									// Figure the cell coordinates in the image.  The image
-									// is a 16x8 grid arranged in Unicode order.  Note that
-									// only the first 128 code points (the basic ASCII set)
-									// are present; replacing anything else with '*'.
-									if (c > 127)
-										c = '*';
-									int cellx = (c % 16) * charCellWid;
-									int celly = (c / 16) * charCellHt;
-
-									// draw the character
-									g.DrawImage(
-										alphanumImage.get(),
-										Gdiplus::RectF((float)x, (float)y, (float)charCellWid, (float)charCellHt),
-										(float)cellx, (float)celly, (float)charCellWid, (float)charCellHt,
-										Gdiplus::UnitPixel);
-
-									// advance to the next character
-									prvChar = c;
-									c = *++p;
-
-									// advance to the next character cell, unless this is a
-									// non-advancing character
-									if (!((c == ',' || c == '.') && !(prvChar == ',' || prvChar == '.')))
-										x += charCellWid;
-								}
-
-								// draw the right spaces
-								DrawSpaces(rightSpaces);
-
-								// advance to the next line
-								y += charCellHt + yPadding;
-							}
-
-							// flush the bitmap
-							g.Flush();
-
-						}, eh, _T("Alphanumeric-style high score graphics"));
-					}
-					else if (_tcsicmp(style.c_str(), _T("tt")) == 0)
-					{
-						// typewriter style
+				// get the font
+				std::unique_ptr<Gdiplus::Font> font(CreateGPFontPixHt(_T("Courier New"), ht / 8, 400));
 
-						// size the image to match the background
-						int wid = ttBkgImage.get()->GetWidth();
-						int ht = ttBkgImage.get()->GetHeight();
+				// set up the text format, centered horizontally and vertically
+				Gdiplus::StringFormat fmt(Gdiplus::StringFormat::GenericTypographic());
+				fmt.SetAlignment(Gdiplus::StringAlignmentCenter);
+				fmt.SetLineAlignment(Gdiplus::StringAlignmentCenter);
+				Gdiplus::SolidBrush br(Gdiplus::Color(32, 32, 32));
 
-						// draw the image
-						sprite.Attach(new Sprite());
-						SilentErrorHandler eh;
-						sprite->Load(wid, ht, [&group, wid, ht, &ttBkgImage](HDC hdc, HBITMAP)
-						{
-							// set up the GDI+ context
-							Gdiplus::Graphics g(hdc);
-
-							// copy the background
-							g.DrawImage(ttBkgImage.get(), 0, 0, wid, ht);
-
-							// get the font
-							std::unique_ptr<Gdiplus::Font> font(CreateGPFontPixHt(_T("Courier New"), ht / 8, 400));
-
-							// combine the text into a single string separated by line breaks
-							TSTRING txt;
-							for (auto s : group)
-							{
-								if (txt.length() != 0)
-									txt += _T("\n");
-								txt += s.c_str();
-							}
-
-							// draw it centered horizontally and vertically
-							Gdiplus::StringFormat fmt(Gdiplus::StringFormat::GenericTypographic());
-							fmt.SetAlignment(Gdiplus::StringAlignmentCenter);
-							fmt.SetLineAlignment(Gdiplus::StringAlignmentCenter);
-							Gdiplus::SolidBrush br(Gdiplus::Color(32, 32, 32));
-							g.DrawString(txt.c_str(), -1, font.get(), Gdiplus::RectF(0, 0, (float)wid, (float)ht), &fmt, &br);
-
-							// flush graphics to the bitmap
-							g.Flush();
-
-						}, eh, _T("Typewriter-style high score graphic"));
-					}
-					else
+				// render each group
+				for (auto &group : messages)
+				{
+					RefPtr<Sprite> sprite(new Sprite());
+					SilentErrorHandler eh;
+					bool ok = sprite->Load(wid, ht, [&group, wid, ht, &bmi, card, &font, &fmt, &br](HDC hdc, HBITMAP)
 					{
-						// DMD style (this is also the default if the style setting
-						// isn't recognized)
-
-						// clear the buffer to the background color
-						BYTE *dst = pix;
-						for (int i = 0; i < dmdWidth*dmdHeight; ++i, dst += 4)
-							memcpy(dst, &colors[0], 4);
-
-						// pick the font
-						const DMDFont *font = PickHighScoreFont(group);
-
-						// figure the starting y offset, centering the text overall vertically
-						int totalTextHeight = font->cellHeight * nLines;
-						int y = (dmdHeight - totalTextHeight) / 2;
+						// copy the background
+						SetDIBitsToDevice(hdc, 0, 0, wid, ht, 0, 0, 0, ht, card->pix.data(), &bmi, DIB_RGB_COLORS);
 
-						// draw each string
-						for (auto s : group)
+						// combine the text into a single string separated by line breaks
+						TSTRING txt;
+						for (auto &s : group)
 						{
-							// measure the string
-							const TCHAR *str = s.c_str();
-							SIZE sz = font->MeasureString(str);
+							if (txt.length() != 0)
+								txt += _T("\n");
+							txt += s;
+						}
 
-							// draw it centered horizontally
-							font->DrawString32(str, pix, (dmdWidth - sz.cx) / 2, y, colors);
+						// draw it
+						Gdiplus::Graphics g(hdc);
+						g.DrawString(txt.c_str(), -1, font.get(), Gdiplus::RectF(0, 0, (float)wid, (float)ht), &fmt, &br);
 
-							// advance to the next line
-							y += font->cellHeight;
-						}
+						// flush graphics to the bitmap
+						g.Flush();
 
-						// create the sprite
-						sprite.Attach(new DMDSprite());
-						SilentErrorHandler eh;
-						sprite->Load(bmi, pix, eh, _T("DMD-style high score graphics"));
-					}
+					}, eh, _T("Typewriter-style high score graphic"));
 
-					// add the sprite to the list, handing over our reference on the sprite
-					if (sprite != nullptr)
+					if (ok)
 						images.emplace_back(sprite.Detach(), 3500);
 				}
-
-				// Send the sprite list back to the window
-				if (auto view = Application::Get()->GetDMDView(); view != nullptr)
-					view->SendMessage(DMVMsgHighScoreImage, seqno, reinterpret_cast<LPARAM>(&images));
-
-				// count the thread exist in the view object
-				InterlockedDecrement(&view->nHighScoreThreads);
-
-				// delete 'self'
-				delete this;
-
-				// done (thread return code isn't used)
-				return 0;
 			}
 		};
-		ThreadInfo *ti = new ThreadInfo(this, highScoreRequestSeqNo, txtColor, style);
-		
-		// capture the message list to the thread
-		game->DispHighScoreGroups([&ti](const std::list<const TSTRING*> &group)
-		{
-			std::list<TSTRING> &list = ti->messages.emplace_back();
-			for (auto s : group)
-				list.emplace_back(*s);
-		});
+		ThreadInfo *ti = new ThreadInfo(this, highScoreRequestSeqNo, txtColor, style, messages);
 
 		// count the thread
 		InterlockedIncrement(&nHighScoreThreads);
@@ -735,6 +519,21 @@ void DMDView::SetHighScoreImages(DWORD seqno, std::list<HighScoreImage> *images)
 	// this list of images
 	if (seqno == highScoreRequestSeqNo)
 	{
+		// If these are newly rendered images, add them to the cache, so
+		// that we can skip the rendering next time we show this game
+		if (highScoreCacheKey.length() != 0)
+		{
+			std::list<HighScoreSlideCache::Slide> slides;
+			for (auto &i : *images)
+			{
+				auto &s = slides.emplace_back();
+				s.sprite = i.sprite;
+				s.displayTime = i.displayTime;
+			}
+			highScoreCache.Add(highScoreCacheKey.c_str(), slides);
+			highScoreCacheKey.clear();
+		}
+
 		// transfer the images to our high score list
 		for (auto &i : *images)
 			highScoreImages.emplace_back(i.sprite.Detach(), i.displayTime);
@@ -17,6 +17,7 @@
 #include "BaseView.h"
 #include "SecondaryView.h"
 #include "BorderlessSecondaryView.h"
+#include "HighScoreSlides.h"
 
 class Sprite;
 class VideoSprite;
@@ -105,6 +106,11 @@ protected:
 	// Last high score request sequence number
 	DWORD highScoreRequestSeqNo;
 
+	// Rendered high score slides for recently shown games, and the cache
+	// key for the outstanding request, if it's being rendered
+	HighScoreSlideCache highScoreCache;
+	TSTRING highScoreCacheKey;
+
 	// Number of outstanding high score image generator threads
 	volatile DWORD nHighScoreThreads;
 
@@ -6,7 +6,7 @@
 #include <propvarutil.h>
 #include "../Utilities/ComUtil.h"
 #include "DOFClient.h"
-#include "DiceCoefficient.h"
+#include "DOFOutput.h"
 #include "GameList.h"
 #include "../rapidxml/rapidxml.hpp"
 
@@ -15,9 +15,28 @@
 // statics
 DOFClient *DOFClient::inst;
 
+// DOF output backend
+void DOFOutput::DOFClientBackend::SetNamedState(const WCHAR *name, int val)
+{
+	if (auto dof = DOFClient::Get(); dof != nullptr)
+		dof->SetNamedState(name, val);
+}
+
 // initialize
 bool DOFClient::Init(ErrorHandler &eh)
 {
+	// The DOF COM object is only used on the DOF output thread, so if
+	// that's running, create the object there.  Capture any errors and
+	// pass them along to the caller's handler on this thread.
+	if (auto output = DOFOutput::Get(); output != nullptr && !output->IsOutputThread())
+	{
+		CapturingErrorHandler errs;
+		bool ok = false;
+		output->Call([&errs, &ok]() { ok = Init(errs); });
+		errs.EnumErrors([&eh](const ErrorList::Item &item) { eh.SysError(item.message.c_str(), item.details.c_str()); });
+		return ok;
+	}
+
 	// if there's not an instance yet, create and initialize it
 	if (inst == nullptr)
 	{
@@ -38,6 +57,13 @@ bool DOFClient::Init(ErrorHandler &eh)
 // shut down
 void DOFClient::Shutdown()
 {
+	// release the COM object on the output thread, if it's running
+	if (auto output = DOFOutput::Get(); output != nullptr && !output->IsOutputThread())
+	{
+		output->Call([]() { Shutdown(); });
+		return;
+	}
+
 	if (inst != nullptr)
 	{
 		delete inst;
@@ -252,6 +278,7 @@ void DOFClient::LoadTableMap(ErrorHandler &eh)
 					{
 						// get the ROM name and add the mapping
 						TSTRING romName = AnsiToTSTRING(r->value());
+						titleRomIndex.Add((int)titleRomList.size(), SimplifiedTitle(tableName.c_str()).c_str());
 						titleRomList.emplace_back(tableName.c_str(), romName.c_str());
 
 						// add this ROM to the list of known ROMs
@@ -392,8 +419,8 @@ const TCHAR *DOFClient::GetRomForTitle(const TCHAR *title, const GameSystem *sys
 	TSTRING titleKey = SimplifiedTitle(title);
 
 	// pre-compute the bigram set for the string
-	DiceCoefficient::BigramSet<TCHAR> titleBigrams;
-	DiceCoefficient::BuildBigramSet(titleBigrams, titleKey.c_str());
+	FuzzyMatchIndex::BigramSet titleBigrams;
+	FuzzyMatchIndex::BuildBigramSet(titleBigrams, titleKey.c_str());
 
 	// The DOF config tool uses a naming convention to distinguish
 	// games with titles implemented in multiple systems:
@@ -409,39 +436,25 @@ const TCHAR *DOFClient::GetRomForTitle(const TCHAR *title, const GameSystem *sys
 	// system setting for the title, and try this alongside the plain
 	// title string for each stage of the match.
 	TSTRING prefixedTitleKey;
-	DiceCoefficient::BigramSet<TCHAR> prefixedBigrams;
+	FuzzyMatchIndex::BigramSet prefixedBigrams;
 	if (system != nullptr && system->dofTitlePrefix.length() != 0)
 	{
 		prefixedTitleKey = system->dofTitlePrefix + _T(" ") + titleKey;
-		DiceCoefficient::BuildBigramSet(prefixedBigrams, prefixedTitleKey.c_str());
+		FuzzyMatchIndex::BuildBigramSet(prefixedBigrams, prefixedTitleKey.c_str());
 	}
 
-	// Try finding the name via fuzzy match.  Start with a minimum score
-	// of 30% - this is an arbitrary threshold to reduce the chances that
-	// we match something wildly unrelated.
-	float bestScore = 0.3f;
-	TitleRomPair *bestMatch = 0;
-	for (auto it = titleRomList.begin(); it != titleRomList.end(); ++it)
-	{
-		// check the prefixed title, if present
-		float score;
-		if (prefixedTitleKey.length() != 0
-			&& (score = DiceCoefficient::DiceCoefficient(prefixedBigrams, it->titleBigrams)) > bestScore)
-		{
-			bestMatch = &*it;
-			bestScore = score;
-		}
-
-		// now try the base title
-		if ((score = DiceCoefficient::DiceCoefficient(titleBigrams, it->titleBigrams)) > bestScore)
-		{
-			bestMatch = &*it;
-			bestScore = score;
-		}
-	}
+	// Try finding the name via fuzzy match.  Use a minimum score of
+	// 30% - this is an arbitrary threshold to reduce the chances that
+	// we match something wildly unrelated.  If several entries tie for
+	// the best score, the search returns the earliest in the list.
+	std::vector<FuzzyMatchIndex::Match> matches;
+	if (prefixedTitleKey.length() != 0)
+		titleRomIndex.Search(matches, { &prefixedBigrams, &titleBigrams }, 0.3f, 1);
+	else
+		titleRomIndex.Search(matches, { &titleBigrams }, 0.3f, 1);
 
 	// return the best match we found, if any
-	return bestMatch != nullptr ? bestMatch->rom.c_str() : nullptr;
+	return matches.size() != 0 ? titleRomList[matches[0].id].rom.c_str() : nullptr;
 }
 
 // Simplified title generator.  Removes leading and trailing whitespace,
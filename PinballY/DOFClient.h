@@ -4,7 +4,7 @@
 #pragma once
 #include <unordered_set>
 #include <propvarutil.h>
-#include "DiceCoefficient.h"
+#include "FuzzyMatch.h"
 
 class ErrorHandler;
 class GameListItem;
@@ -20,7 +20,8 @@ public:
 	DOFClient();
 	~DOFClient();
 
-	// global singleton management
+	// Global singleton management.  If the DOF output thread is running,
+	// these create and delete the DOF COM object on that thread.
 	static bool Init(ErrorHandler &eh);
 	static void Shutdown();
 	static DOFClient *Get() { return inst; }
@@ -46,6 +47,9 @@ public:
 	// desired, or use a different set of state names entirely if the
 	// config tool were to add a separate database entry for us.
 	//
+	// This calls into the DOF COM object, so it's only called from the
+	// DOF output thread.  Other code should go through DOFOutput.
+	//
 	void SetNamedState(const WCHAR *name, int val);
 
 	// Map a table to a DOF ROM name.  This consults the table/ROM mapping
@@ -99,29 +103,23 @@ protected:
 	// behavior here.  
 	//
 	// Because of the need for fuzzy matching to the DOF mapping table,
-	// we store the mapping table as a simple list of title/ROM pairs.
-	// There are ways to index fuzzy-matched data more efficiently than
-	// a linear search, but we have a small data set, so I don't think
-	// it's worth the trouble.
+	// we store the mapping table as a simple list of title/ROM pairs,
+	// plus a fuzzy match index of the titles, keyed by list index.
 	//
-	// The simplifiedTitle is the title after running it through the
-	// SimplifyTitle() function.  This removes extra spaces and
-	// punctuation to make fuzzy matching easier.
+	// The index entries use the simplified titles, after running them
+	// through the SimplifyTitle() function.  This removes extra spaces
+	// and punctuation to make fuzzy matching easier.
 	//
 	struct TitleRomPair
 	{
 		TitleRomPair(const TCHAR *title, const TCHAR *rom)
-			: title(title), rom(rom)
-		{
-			// pre-compute the bigram set for the simplified title string
-			DiceCoefficient::BuildBigramSet(titleBigrams, SimplifiedTitle(title).c_str());
-		}
+			: title(title), rom(rom) { }
 
 		TSTRING title;
-		DiceCoefficient::BigramSet<TCHAR> titleBigrams;
 		TSTRING rom;
 	};
-	std::list<TitleRomPair> titleRomList;
+	std::vector<TitleRomPair> titleRomList;
+	FuzzyMatchIndex titleRomIndex;
 
 	// Simplified title string.  This removes punctuation marks and
 	// collapses runs of whitespace to single spaces.
@@ -0,0 +1,328 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DOF output thread
+
+#include "stdafx.h"
+#include <float.h>
+#include <math.h>
+#include "DOFOutput.h"
+
+// statics
+DOFOutput *DOFOutput::inst = nullptr;
+
+void DOFOutput::Init(Backend *backend)
+{
+	if (inst == nullptr)
+		inst = new DOFOutput(backend);
+	else
+		delete backend;
+}
+
+void DOFOutput::Shutdown()
+{
+	delete inst;
+	inst = nullptr;
+}
+
+DOFOutput::DOFOutput(Backend *backend) :
+	backend(backend),
+	nextSlot(0.0),
+	queueDepth(0),
+	maxQueueDepth(0),
+	sent(0),
+	coalesced(0),
+	totalLatency_ms(0.0),
+	latencyCount(0),
+	maxLatency_ms(0.0),
+	tid(0),
+	exiting(false)
+{
+	// set up the submission queue
+	InitializeSListHead(&queue);
+	hWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	// start the output thread
+	hThread = CreateThread(NULL, 0, &SThreadMain, this, 0, &tid);
+}
+
+DOFOutput::~DOFOutput()
+{
+	// Tell the thread to exit, and wait for it.  The thread works with
+	// our queues and backend until it returns, so we have to wait for
+	// it however long it takes; it checks the exit flag each time it
+	// wakes, so this only waits out a DOF update that's in progress.
+	exiting = true;
+	SetEvent(hWakeEvent);
+	if (hThread != NULL)
+		WaitForSingleObject(hThread, INFINITE);
+
+	// discard any unprocessed commands
+	for (PSLIST_ENTRY p = InterlockedFlushSList(&queue); p != nullptr; )
+	{
+		auto cmd = CONTAINING_RECORD(p, Command, link);
+		p = p->Next;
+		if (cmd->hDone != NULL)
+			SetEvent(cmd->hDone);
+		delete cmd;
+	}
+}
+
+void DOFOutput::SetState(const WCHAR *name, int val)
+{
+	Command *cmd = new Command();
+	cmd->type = Command::State;
+	cmd->name = name;
+	cmd->val = val;
+	Submit(cmd);
+}
+
+void DOFOutput::Pulse(const WCHAR *name)
+{
+	Command *cmd = new Command();
+	cmd->type = Command::Pulse;
+	cmd->name = name;
+	cmd->val = 1;
+	Submit(cmd);
+}
+
+void DOFOutput::Call(std::function<void()> func)
+{
+	// if we're already on the output thread, or the thread isn't
+	// running, just call the function directly
+	if (IsOutputThread() || hThread == NULL)
+	{
+		func();
+		return;
+	}
+
+	// submit the call, and wait for the output thread to run it
+	HandleHolder hDone(CreateEvent(NULL, TRUE, FALSE, NULL));
+	Command *cmd = new Command();
+	cmd->type = Command::Call;
+	cmd->func = &func;
+	cmd->hDone = hDone;
+	Submit(cmd);
+	WaitForSingleObject(hDone, INFINITE);
+}
+
+void DOFOutput::Submit(Command *cmd)
+{
+	// stamp the submission time
+	cmd->t = timer.GetTime_ticks();
+
+	// count it in the queue depth
+	LONG depth = InterlockedIncrement(&queueDepth);
+	for (LONG m = maxQueueDepth; depth > m; m = maxQueueDepth)
+	{
+		if (InterlockedCompareExchange(&maxQueueDepth, depth, m) == m)
+			break;
+	}
+
+	// queue it and wake the output thread
+	InterlockedPushEntrySList(&queue, &cmd->link);
+	SetEvent(hWakeEvent);
+}
+
+DWORD DOFOutput::ThreadMain()
+{
+	// The DOF COM object is created and used on this thread, so set up
+	// COM in multithreaded mode.  (The UI thread uses a single-threaded
+	// apartment, so an object created there couldn't be called here
+	// without marshalling the calls back to the UI thread.)
+	CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+	for (DWORD wait = INFINITE; ; )
+	{
+		// wait for a new submission or the next update deadline
+		WaitForSingleObject(hWakeEvent, wait);
+		if (exiting)
+			break;
+
+		// Take the submitted commands.  The SLIST is a stack, so the
+		// commands come out newest first; reverse the list to process
+		// them in submission order.
+		PSLIST_ENTRY p = InterlockedFlushSList(&queue);
+		PSLIST_ENTRY rev = nullptr;
+		while (p != nullptr)
+		{
+			PSLIST_ENTRY nxt = p->Next;
+			p->Next = rev;
+			rev = p;
+			p = nxt;
+		}
+
+		// process them
+		for (p = rev; p != nullptr; )
+		{
+			auto cmd = CONTAINING_RECORD(p, Command, link);
+			p = p->Next;
+			Process(cmd);
+			delete cmd;
+		}
+
+		// send whatever is due, and figure the wait for the next update
+		wait = SendDue();
+	}
+
+	// done with COM
+	CoUninitialize();
+	return 0;
+}
+
+void DOFOutput::Process(Command *cmd)
+{
+	switch (cmd->type)
+	{
+	case Command::State:
+		// State update.  If there's already an update pending for this
+		// state, replace its value.
+		if (auto it = pendingStates.find(cmd->name); it != pendingStates.end())
+		{
+			it->second.val = cmd->val;
+			Coalesced();
+		}
+		else
+		{
+			pendingStates.emplace(cmd->name, PendingState{ cmd->val, cmd->t });
+			pendingStateOrder.emplace_back(cmd->name);
+		}
+		break;
+
+	case Command::Pulse:
+		// Pulse.  If there's already a pulse for this effect, collapse
+		// the new one into it.
+		if (auto it = pulses.find(cmd->name); it != pulses.end())
+		{
+			// If the existing pulse is ON, extend it so that it stays on
+			// for the full hold time from now.  If it's still waiting to
+			// turn ON, the new pulse is covered already.
+			if (it->second.on)
+				it->second.offDeadline = Now_ms() + pulseHoldTime;
+
+			Coalesced();
+		}
+		else
+		{
+			pulses.emplace(cmd->name, ActivePulse{ false, cmd->t, 0.0 });
+			pulseOrder.emplace_back(cmd->name);
+		}
+		break;
+
+	case Command::Call:
+		// Function call.  Send any pending state updates first, so that
+		// the function sees them in effect, then call the function and
+		// release the caller.  Take the call out of the queue depth
+		// before releasing the caller, so that the caller sees the
+		// queue statistics with its call completed.
+		SendDue();
+		(*cmd->func)();
+		InterlockedDecrement(&queueDepth);
+		SetEvent(cmd->hDone);
+		break;
+	}
+}
+
+DWORD DOFOutput::SendDue()
+{
+	// send all pending state updates, in submission order
+	for (auto &name : pendingStateOrder)
+	{
+		auto &s = pendingStates[name];
+		Send(name.c_str(), s.val, s.t);
+		InterlockedDecrement(&queueDepth);
+	}
+	pendingStates.clear();
+	pendingStateOrder.clear();
+
+	// Send due pulse updates.  Each pulse update takes one update slot,
+	// so keep going until we run out of due updates or reach a slot
+	// that's still in the future.
+	for (;;)
+	{
+		// if nothing is pending, there's nothing to wait for
+		if (pulseOrder.size() == 0)
+			return INFINITE;
+
+		// Find the next update.  An OFF that's reached its deadline goes
+		// first, so that pulses don't stay on longer than necessary;
+		// otherwise, it's the ON for the oldest pulse that's waiting.
+		// Note the earliest OFF deadline in case nothing is due yet.
+		double now = Now_ms();
+		auto next = pulseOrder.end();
+		double nextDue = DBL_MAX;
+		for (auto it = pulseOrder.begin(); it != pulseOrder.end(); ++it)
+		{
+			auto &p = pulses[*it];
+			double due = p.on ? p.offDeadline : now;
+			if (due < nextDue)
+			{
+				nextDue = due;
+				next = it;
+			}
+		}
+
+		// the update can't go out until the next free slot
+		double sendTime = max(nextDue, nextSlot);
+		if (sendTime > now)
+			return (DWORD)ceil(sendTime - now);
+
+		// send it
+		auto &p = pulses[*next];
+		if (!p.on)
+		{
+			// turn it on, and set the OFF deadline
+			Send(next->c_str(), 1, p.t);
+			p.on = true;
+			p.offDeadline = now + pulseHoldTime;
+		}
+		else
+		{
+			// turn it off, and retire the pulse
+			Send(next->c_str(), 0, 0);
+			pulses.erase(*next);
+			pulseOrder.erase(next);
+			InterlockedDecrement(&queueDepth);
+		}
+
+		// this uses the current slot
+		nextSlot = now + updateInterval;
+	}
+}
+
+void DOFOutput::Send(const WCHAR *name, int val, int64_t t)
+{
+	// send it
+	backend->SetNamedState(name, val);
+
+	// update the statistics
+	CriticalSectionLocker locker(statsLock);
+	++sent;
+	if (t != 0)
+	{
+		double latency = (timer.GetTime_ticks() - t) * timer.GetTickTime_sec() * 1000.0;
+		totalLatency_ms += latency;
+		++latencyCount;
+		maxLatency_ms = max(maxLatency_ms, latency);
+	}
+}
+
+void DOFOutput::Coalesced()
+{
+	// the submission is no longer pending on its own
+	InterlockedDecrement(&queueDepth);
+
+	CriticalSectionLocker locker(statsLock);
+	++coalesced;
+}
+
+void DOFOutput::GetStats(Stats &stats)
+{
+	CriticalSectionLocker locker(statsLock);
+	stats.queueDepth = queueDepth;
+	stats.maxQueueDepth = maxQueueDepth;
+	stats.sent = sent;
+	stats.coalesced = coalesced;
+	stats.avgLatency_ms = latencyCount != 0 ? totalLatency_ms / latencyCount : 0.0;
+	stats.maxLatency_ms = maxLatency_ms;
+}
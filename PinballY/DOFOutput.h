@@ -0,0 +1,229 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DOF output thread
+//
+// This sends our named state updates to DOF from a dedicated thread.
+// Each DOF update is a synchronous IDispatch::Invoke into the DOF COM
+// object, which can take a while, so doing these on the UI thread adds
+// latency to the UI.  It's also awkward to pace pulsed events on the
+// UI thread (see below), since the UI thread can only check its timers
+// between messages.
+//
+// Callers submit two kinds of updates:
+//
+// - States, which set a named DOF effect to a value and leave it
+//   there, such as the UI context ("PBYMenu") or a key effect.  A state
+//   update is sent as soon as the output thread sees it.  If several
+//   updates to the same state arrive before the thread gets to them,
+//   only the latest value is sent.
+//
+// - Pulses, which turn an effect ON briefly and then OFF again, to
+//   signal an event such as a wheel step.  DOF was designed around
+//   VPinMAME switch states, and it polls its inputs, so a pulse has to
+//   stay ON long enough for DOF to notice it, and consecutive updates
+//   have to be spaced out so that DOF has time to digest each one.  We
+//   schedule the pulses against deadlines: each ON is sent at the next
+//   free update slot, and its OFF is due a hold time later.  Repeated
+//   pulses of the same effect are collapsed, the same way the old UI
+//   timer queue did it: a pulse that's still waiting to turn ON absorbs
+//   the new one, and a pulse that's already ON is simply extended.  So
+//   a fast wheel spin keeps the wheel effect ON for the duration of
+//   the spin, rather than building up a backlog of pulses that plays
+//   out for seconds after the wheel has stopped.
+//
+// Submissions go through a lock-free queue (a Windows interlocked
+// SLIST), so the UI thread never blocks on the output thread.
+//
+// The actual DOF calls go through a Backend object, so that the
+// scheduler can be run against something other than the live DOF COM
+// object, such as a stub that just records the calls and their times.
+// The application's backend, DOFClientBackend, sends the updates to
+// the DOFClient singleton.  It's implemented in DOFClient.cpp, so that
+// the scheduler itself has no dependency on the DOF COM client.
+// The DOF COM object is only ever used on the output thread, so
+// DOFClient::Init() and Shutdown() use Call() to create and destroy
+// it there.
+//
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include "HiResTimer.h"
+
+class DOFOutput
+{
+public:
+	// Output backend.  The output thread calls this to send each update.
+	class Backend
+	{
+	public:
+		virtual ~Backend() { }
+
+		// set a named state
+		virtual void SetNamedState(const WCHAR *name, int val) = 0;
+	};
+
+	// DOFClient backend, which sends updates to the DOFClient singleton,
+	// if DOF is active
+	class DOFClientBackend : public Backend
+	{
+	public:
+		virtual void SetNamedState(const WCHAR *name, int val) override;
+	};
+
+	// Create/destroy the global singleton.  The global instance takes
+	// ownership of the backend.
+	static void Init(Backend *backend);
+	static void Shutdown();
+	static DOFOutput *Get() { return inst; }
+
+	// Create an instance with a given backend.  The new object takes
+	// ownership of the backend.
+	DOFOutput(Backend *backend);
+	~DOFOutput();
+
+	// set a state
+	void SetState(const WCHAR *name, int val);
+
+	// pulse an effect
+	void Pulse(const WCHAR *name);
+
+	// Run a function on the output thread, and wait for it to finish.
+	// The function runs in order with the updates submitted ahead of it.
+	void Call(std::function<void()> func);
+
+	// is the current thread the output thread?
+	bool IsOutputThread() const { return GetCurrentThreadId() == tid; }
+
+	// Statistics
+	struct Stats
+	{
+		// Number of updates waiting: submissions the output thread hasn't
+		// picked up yet, plus pulses that haven't finished
+		LONG queueDepth;
+
+		// maximum queue depth seen
+		LONG maxQueueDepth;
+
+		// number of DOF updates sent
+		int64_t sent;
+
+		// number of submissions absorbed into earlier pending updates
+		int64_t coalesced;
+
+		// Latency from submission to sending the update (for states
+		// and pulse ONs), in milliseconds: average and maximum
+		double avgLatency_ms;
+		double maxLatency_ms;
+	};
+	void GetStats(Stats &stats);
+
+	// Pulse timing, in milliseconds.  updateInterval is the minimum
+	// spacing between pulse updates, and pulseHoldTime is how long a
+	// pulse stays ON.
+	static const DWORD updateInterval = 20;
+	static const DWORD pulseHoldTime = 20;
+
+protected:
+	// Submission.  These are allocated individually and linked into the
+	// queue through an interlocked SLIST, which requires the entries to
+	// have MEMORY_ALLOCATION_ALIGNMENT alignment.
+	struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Command
+	{
+		SLIST_ENTRY link;
+
+		enum Type { State, Pulse, Call } type;
+
+		// effect name and value, for State and Pulse
+		WSTRING name;
+		int val = 0;
+
+		// submission time, in HiResTimer ticks
+		int64_t t = 0;
+
+		// function and completion event, for Call
+		std::function<void()> *func = nullptr;
+		HANDLE hDone = NULL;
+	};
+
+	// add a command to the queue and wake the output thread
+	void Submit(Command *cmd);
+
+	// submission queue
+	SLIST_HEADER queue;
+
+	// event to wake the output thread
+	HandleHolder hWakeEvent;
+
+	// Output thread state.  These are only accessed on the output thread.
+	//
+	// Pending states, by name, with the submission time of the earliest
+	// update that's pending for the state, and the states in the order
+	// they were first submitted.
+	struct PendingState
+	{
+		int val;
+		int64_t t;
+	};
+	std::unordered_map<WSTRING, PendingState> pendingStates;
+	std::list<WSTRING> pendingStateOrder;
+
+	// Active pulses, by name, and in the order they were submitted.  A
+	// pulse is either waiting for its ON slot, or ON and waiting for its
+	// OFF deadline.
+	struct ActivePulse
+	{
+		bool on;
+		int64_t t;             // submission time
+		double offDeadline;    // OFF deadline, in milliseconds, if on
+	};
+	std::unordered_map<WSTRING, ActivePulse> pulses;
+	std::list<WSTRING> pulseOrder;
+
+	// time of the next free pulse update slot, in milliseconds
+	double nextSlot;
+
+	// process a command
+	void Process(Command *cmd);
+
+	// Send the due updates.  Returns the time to wait for the next
+	// update in milliseconds, or INFINITE if nothing is pending.
+	DWORD SendDue();
+
+	// send an update to the backend, and count it in the statistics
+	void Send(const WCHAR *name, int val, int64_t t);
+
+	// count a submission absorbed into a pending update
+	void Coalesced();
+
+	// backend
+	std::unique_ptr<Backend> backend;
+
+	// timer, and the current time on it in milliseconds
+	HiResTimer timer;
+	double Now_ms() { return timer.GetTime_seconds() * 1000.0; }
+
+	// statistics
+	volatile LONG queueDepth;
+	volatile LONG maxQueueDepth;
+	int64_t sent;
+	int64_t coalesced;
+	double totalLatency_ms;
+	int64_t latencyCount;
+	double maxLatency_ms;
+	CriticalSection statsLock;
+
+	// output thread
+	static DWORD WINAPI SThreadMain(LPVOID lParam) { return static_cast<DOFOutput*>(lParam)->ThreadMain(); }
+	DWORD ThreadMain();
+	HandleHolder hThread;
+	DWORD tid;
+
+	// shutdown flag
+	volatile bool exiting;
+
+	// global singleton
+	static DOFOutput *inst;
+};
@@ -0,0 +1,327 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Decoded image cache
+
+#include "stdafx.h"
+#include <wincodec.h>
+#include "DecodedImageCache.h"
+#include "PerfMon.h"
+
+#pragma comment(lib, "windowscodecs.lib")
+
+// statics
+DecodedImageCache *DecodedImageCache::inst = nullptr;
+
+void DecodedImageCache::Init()
+{
+	if (inst == nullptr)
+		inst = new DecodedImageCache();
+}
+
+void DecodedImageCache::Shutdown()
+{
+	delete inst;
+	inst = nullptr;
+}
+
+DecodedImageCache::DecodedImageCache() :
+	cacheBytes(0), pruning(0), hits(0), misses(0)
+{
+	// set up the cache folder
+	TCHAR buf[MAX_PATH];
+	GetDeployedFilePath(buf, _T("ImageCache"), _T(""));
+	folder = buf;
+	if (!DirectoryExists(buf))
+		CreateSubDirectory(buf, nullptr, nullptr);
+
+	// get the current cache size, and trim the cache to the size limit
+	Prune();
+}
+
+DecodedImageCache::~DecodedImageCache()
+{
+}
+
+int DecodedImageCache::GetMipLevel(SIZE nativeSize, SIZE displaySize)
+{
+	// get the long and short sides of each size
+	int nLong = max(nativeSize.cx, nativeSize.cy), nShort = min(nativeSize.cx, nativeSize.cy);
+	int dLong = max(displaySize.cx, displaySize.cy), dShort = min(displaySize.cx, displaySize.cy);
+
+	// ignore empty sizes
+	if (nShort <= 0 || dShort <= 0)
+		return 0;
+
+	// halve the native size for as long as the result still covers
+	// the display size
+	int level = 0;
+	while ((nLong >> (level + 1)) >= dLong && (nShort >> (level + 1)) >= dShort)
+		++level;
+
+	return level;
+}
+
+bool DecodedImageCache::Load(const TCHAR *filename, SIZE nativeSize, SIZE displaySize,
+	BITMAPINFO &bmi, std::vector<BYTE> &pixels)
+{
+	// figure the reduction level; if it's zero, use the original file
+	int level = GetMipLevel(nativeSize, displaySize);
+	if (level == 0)
+		return false;
+
+	// figure the reduced size
+	int width = max(nativeSize.cx >> level, 1);
+	int height = max(nativeSize.cy >> level, 1);
+
+	// get the full path, so that the key doesn't depend on the working
+	// directory, and fold it to lower case, since file names aren't
+	// case-sensitive
+	TCHAR fullPath[MAX_PATH];
+	if (GetFullPathName(filename, countof(fullPath), fullPath, nullptr) == 0)
+		return false;
+	CharLower(fullPath);
+
+	// get the file's modification time and size
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (!GetFileAttributesEx(fullPath, GetFileExInfoStandard, &attrs))
+		return false;
+
+	// build the key and cache file name
+	TSTRING key = MsgFmt(_T("%s|%08lx%08lx|%08lx%08lx|%d"), fullPath,
+		attrs.ftLastWriteTime.dwHighDateTime, attrs.ftLastWriteTime.dwLowDateTime,
+		attrs.nFileSizeHigh, attrs.nFileSizeLow, level).Get();
+	TCHAR cacheFile[MAX_PATH];
+	GetCacheFileName(cacheFile, key);
+
+	// set up the bitmap descriptor for a top-down 32bpp DIB
+	ZeroMemory(&bmi, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+	bmi.bmiHeader.biWidth = width;
+	bmi.bmiHeader.biHeight = -height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	// try loading it from the cache
+	{
+		PERF_ZONE(_T("ImageCache Hit"));
+		if (ReadCacheFile(cacheFile, key, width, height, pixels))
+		{
+			InterlockedIncrement64(&hits);
+			return true;
+		}
+	}
+
+	// It's not in the cache, so decode the original file
+	PERF_ZONE(_T("ImageCache Decode"));
+	InterlockedIncrement64(&misses);
+	if (!Decode(fullPath, width, height, pixels))
+		return false;
+
+	// save it in the cache for next time
+	WriteCacheFile(cacheFile, key, width, height, pixels);
+	return true;
+}
+
+void DecodedImageCache::GetCacheFileName(TCHAR *fname, const TSTRING &key) const
+{
+	// Hash the key with 64-bit FNV-1a.  The full key is stored in the
+	// file header and checked on load, so a hash collision just costs
+	// a cache miss.
+	UINT64 hash = 14695981039346656037ULL;
+	for (TCHAR c : key)
+	{
+		hash ^= (UINT64)c;
+		hash *= 1099511628211ULL;
+	}
+
+	// build the name
+	_tcscpy_s(fname, MAX_PATH, folder.c_str());
+	PathAppend(fname, MsgFmt(_T("%016I64x.pbyimg"), hash));
+}
+
+bool DecodedImageCache::ReadCacheFile(const TCHAR *fname, const TSTRING &key, int width, int height,
+	std::vector<BYTE> &pixels)
+{
+	// Open the file.  Open it with attribute write access as well, so
+	// that we can update the modification time to mark it as recently
+	// used for pruning.
+	HandleHolder h(CreateFile(fname, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+	if (h == INVALID_HANDLE_VALUE)
+		return false;
+
+	// read and check the header
+	FileHeader hdr;
+	DWORD actual;
+	if (!ReadFile(h, &hdr, sizeof(hdr), &actual, NULL) || actual != sizeof(hdr)
+		|| hdr.magic != fileMagic || hdr.version != fileVersion
+		|| hdr.width != (DWORD)width || hdr.height != (DWORD)height
+		|| hdr.keyLength != key.length())
+		return false;
+
+	// read and check the key
+	std::unique_ptr<WCHAR[]> fileKey(new WCHAR[hdr.keyLength]);
+	DWORD keyBytes = hdr.keyLength * sizeof(WCHAR);
+	if (!ReadFile(h, fileKey.get(), keyBytes, &actual, NULL) || actual != keyBytes
+		|| memcmp(fileKey.get(), key.c_str(), keyBytes) != 0)
+		return false;
+
+	// read the pixels
+	DWORD pixBytes = (DWORD)width * height * 4;
+	pixels.resize(pixBytes);
+	if (!ReadFile(h, pixels.data(), pixBytes, &actual, NULL) || actual != pixBytes)
+		return false;
+
+	// mark it as recently used
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(h, NULL, NULL, &now);
+
+	// success
+	return true;
+}
+
+void DecodedImageCache::WriteCacheFile(const TCHAR *fname, const TSTRING &key, int width, int height,
+	const std::vector<BYTE> &pixels)
+{
+	// Write to a temporary file first, then move it into place, so that
+	// another thread (or another instance of the program) never sees a
+	// partially written file.  Use the thread ID in the temp name in
+	// case two threads are writing the same image.
+	TCHAR tmpName[MAX_PATH];
+	_stprintf_s(tmpName, _T("%s.%lx.tmp"), fname, GetCurrentThreadId());
+	{
+		HandleHolder h(CreateFile(tmpName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+		if (h == INVALID_HANDLE_VALUE)
+			return;
+
+		// write the header, key, and pixels
+		FileHeader hdr = { fileMagic, fileVersion, (DWORD)width, (DWORD)height, (DWORD)key.length() };
+		DWORD keyBytes = (DWORD)key.length() * sizeof(WCHAR);
+		DWORD pixBytes = (DWORD)pixels.size();
+		DWORD actual;
+		if (!WriteFile(h, &hdr, sizeof(hdr), &actual, NULL) || actual != sizeof(hdr)
+			|| !WriteFile(h, key.c_str(), keyBytes, &actual, NULL) || actual != keyBytes
+			|| !WriteFile(h, pixels.data(), pixBytes, &actual, NULL) || actual != pixBytes)
+		{
+			h.Clear();
+			DeleteFile(tmpName);
+			return;
+		}
+	}
+
+	// If we're replacing an existing file, note its size, so that we
+	// only count the difference in the running total
+	int64_t oldBytes = 0;
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (GetFileAttributesEx(fname, GetFileExInfoStandard, &attrs))
+		oldBytes = ((int64_t)attrs.nFileSizeHigh << 32) | attrs.nFileSizeLow;
+
+	// move it into place
+	if (!MoveFileEx(tmpName, fname, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFile(tmpName);
+		return;
+	}
+
+	// update the running total, and prune if that takes us over the limit
+	int64_t newBytes = sizeof(FileHeader) + (int64_t)key.length() * sizeof(WCHAR) + (int64_t)pixels.size();
+	if (InterlockedAdd64(&cacheBytes, newBytes - oldBytes) > (int64_t)maxCacheBytes)
+		Prune();
+}
+
+bool DecodedImageCache::Decode(const TCHAR *filename, int width, int height, std::vector<BYTE> &pixels)
+{
+	// create the WIC factory
+	RefPtr<IWICImagingFactory> wic;
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wic))))
+		return false;
+
+	// open the file and get the first frame
+	RefPtr<IWICBitmapDecoder> decoder;
+	RefPtr<IWICBitmapFrameDecode> frame;
+	if (FAILED(wic->CreateDecoderFromFilename(filename, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder))
+		|| FAILED(decoder->GetFrame(0, &frame)))
+		return false;
+
+	// Convert to premultiplied alpha for the scaling, so that the colors
+	// of transparent pixels don't bleed into the edges of opaque areas,
+	// then scale, then convert to straight alpha for the texture.
+	RefPtr<IWICFormatConverter> pbgra, bgra;
+	RefPtr<IWICBitmapScaler> scaler;
+	if (FAILED(wic->CreateFormatConverter(&pbgra))
+		|| FAILED(pbgra->Initialize(frame, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom))
+		|| FAILED(wic->CreateBitmapScaler(&scaler))
+		|| FAILED(scaler->Initialize(pbgra, width, height, WICBitmapInterpolationModeFant))
+		|| FAILED(wic->CreateFormatConverter(&bgra))
+		|| FAILED(bgra->Initialize(scaler, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom)))
+		return false;
+
+	// retrieve the pixels
+	UINT stride = width * 4;
+	pixels.resize((size_t)stride * height);
+	return SUCCEEDED(bgra->CopyPixels(nullptr, stride, (UINT)pixels.size(), pixels.data()));
+}
+
+void DecodedImageCache::Prune()
+{
+	// if another thread is already pruning, leave it to that thread
+	if (InterlockedCompareExchange(&pruning, 1, 0) != 0)
+		return;
+
+	// list the cache files
+	struct FileInfo
+	{
+		TSTRING name;
+		FILETIME modified;
+		uint64_t size;
+	};
+	std::vector<FileInfo> files;
+	uint64_t totalBytes = 0;
+	TCHAR pat[MAX_PATH];
+	_tcscpy_s(pat, folder.c_str());
+	PathAppend(pat, _T("*.pbyimg"));
+	WIN32_FIND_DATA fd;
+	if (HANDLE hFind = FindFirstFile(pat, &fd); hFind != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			uint64_t size = ((uint64_t)fd.nFileSizeHigh << 32) | fd.nFileSizeLow;
+			files.push_back({ fd.cFileName, fd.ftLastWriteTime, size });
+			totalBytes += size;
+		} while (FindNextFile(hFind, &fd));
+		FindClose(hFind);
+	}
+
+	// if we're over the limit, prune back to the target size
+	if (totalBytes > maxCacheBytes)
+	{
+		// sort by modification time, oldest first
+		std::sort(files.begin(), files.end(), [](const FileInfo &a, const FileInfo &b) {
+			return CompareFileTime(&a.modified, &b.modified) < 0; });
+
+		// delete the oldest files until we're down to the target
+		for (auto &f : files)
+		{
+			if (totalBytes <= pruneTargetBytes)
+				break;
+
+			TCHAR fname[MAX_PATH];
+			_tcscpy_s(fname, folder.c_str());
+			PathAppend(fname, f.name.c_str());
+			if (DeleteFile(fname))
+				totalBytes -= f.size;
+		}
+	}
+
+	// Reset the running total to the actual folder size.  A write that
+	// finishes on another thread while we're scanning might be left out
+	// of the total, but that only delays the next pass slightly, and
+	// the next pass corrects it.
+	InterlockedExchange64(&cacheBytes, (int64_t)totalBytes);
+
+	// done
+	InterlockedExchange(&pruning, 0);
+}
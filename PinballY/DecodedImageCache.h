@@ -0,0 +1,145 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Decoded image cache.  This keeps reduced-size, already-decoded copies
+// of image media files on disk, so that we don't have to decode a large
+// PNG or JPEG file every time we display it at a much smaller size.
+//
+// Media packs often contain images at much higher resolutions than
+// we ever display them.  A 4K wheel image, for example, might only be
+// shown a few hundred pixels wide.  Decoding the full image and
+// uploading it to the GPU for every wheel step costs far more than
+// the visible result warrants.  For images like that, we decode the
+// file once, scale it down, and save the raw pixels in the cache
+// folder.  Later loads just read the pixels back, which is much faster
+// than decoding the original file.
+//
+// The reduced copies are always a power-of-two fraction of the native
+// size (1/2, 1/4, 1/8, ...), as in a mip chain.  We use the smallest
+// one that's still at least as large as the display size, so the image
+// never has to be scaled up for display.  Rounding to the mip levels
+// also means that modest changes in the window layout usually map to
+// the same cached copy, rather than creating a new one for every
+// window size.
+//
+// Cache entries are keyed by the source file's path, modification
+// time, and size, plus the mip level, so a changed file simply gets a
+// new entry.  Stale entries are eventually pruned, since we delete the
+// least recently used files whenever the cache folder exceeds its size
+// limit.  We check the folder size at startup, and keep a running total
+// as we add files, so that a long session that adds a lot of new images
+// is held to the limit as well.
+//
+// The cache is thread-safe, so it can be used from the media prefetcher
+// threads as well as the UI thread.
+//
+
+#pragma once
+#include <vector>
+
+class DecodedImageCache
+{
+public:
+	// create/destroy the global singleton
+	static void Init();
+	static void Shutdown();
+
+	// get the global singleton
+	static DecodedImageCache *Get() { return inst; }
+
+	// Load a reduced-size copy of an image file.  'nativeSize' is the
+	// image's size in pixels, per GetImageFileInfo(), and 'displaySize'
+	// is the pixel size where it will be displayed.  If the image is at
+	// least twice as large as the display size, this fills in 'bmi' and
+	// 'pixels' with the reduced image (as a top-down 32bpp BGRA DIB),
+	// either from the cache or by decoding and scaling the file, and
+	// returns true.  Returns false if the image isn't large enough to
+	// be worth reducing, or couldn't be decoded, in which case the
+	// caller should load the file directly.
+	bool Load(const TCHAR *filename, SIZE nativeSize, SIZE displaySize,
+		BITMAPINFO &bmi, std::vector<BYTE> &pixels);
+
+	// statistics, for the frame counter overlay
+	struct Stats
+	{
+		Stats() : hits(0), misses(0) { }
+
+		// number of loads satisfied from the cache files
+		int64_t hits;
+
+		// number of loads that had to decode the source file
+		int64_t misses;
+	};
+	void GetStats(Stats &stats) const { stats.hits = hits; stats.misses = misses; }
+
+protected:
+	DecodedImageCache();
+	~DecodedImageCache();
+
+	// Figure the mip level for an image: the largest power-of-two
+	// reduction of the native size that's still at least the display
+	// size.  We compare the long and short sides separately, so that
+	// it works for images that are displayed rotated, such as playfield
+	// images.  Returns 0 if the image shouldn't be reduced at all.
+	static int GetMipLevel(SIZE nativeSize, SIZE displaySize);
+
+	// get the cache file name for a key
+	void GetCacheFileName(TCHAR *fname, const TSTRING &key) const;
+
+	// Read a cache file.  Returns true if the file exists and contains
+	// the expected image.
+	bool ReadCacheFile(const TCHAR *fname, const TSTRING &key, int width, int height,
+		std::vector<BYTE> &pixels);
+
+	// write a cache file
+	void WriteCacheFile(const TCHAR *fname, const TSTRING &key, int width, int height,
+		const std::vector<BYTE> &pixels);
+
+	// Decode and scale an image file via WIC
+	static bool Decode(const TCHAR *filename, int width, int height, std::vector<BYTE> &pixels);
+
+	// Delete the least recently used cache files until the total size
+	// is within the pruning target, and reset the running total to the
+	// actual folder size.  If another thread is already pruning, this
+	// returns immediately, since that thread will take care of it.
+	void Prune();
+
+	// Cache file header.  This is followed by the key string (as WCHARs,
+	// without a null terminator), then the pixels.
+	struct FileHeader
+	{
+		DWORD magic;          // 'PBYI'
+		DWORD version;        // file format version
+		DWORD width;          // image width in pixels
+		DWORD height;         // image height in pixels
+		DWORD keyLength;      // key length in characters
+	};
+	static const DWORD fileMagic = 'PBYI';
+	static const DWORD fileVersion = 1;
+
+	// cache folder
+	TSTRING folder;
+
+	// Maximum total size of the cache folder, and the size we prune
+	// down to when it goes over.  Pruning to somewhat below the limit
+	// leaves room for a batch of new files before the next pass, so
+	// that we don't have to rescan the folder on every write once the
+	// cache is full.
+	static const uint64_t maxCacheBytes = 512 * 1024 * 1024;
+	static const uint64_t pruneTargetBytes = maxCacheBytes / 8 * 7;
+
+	// Running total size of the cache files.  This is set from the
+	// folder contents on each pruning pass, and updated as we write
+	// new files.
+	volatile int64_t cacheBytes;
+
+	// pruning in progress flag
+	volatile LONG pruning;
+
+	// statistics
+	volatile int64_t hits;
+	volatile int64_t misses;
+
+	// global singleton
+	static DecodedImageCache *inst;
+};
@@ -0,0 +1,136 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Filter selection cache
+//
+// This records the result of a filter's Include() test for every item
+// in a list, as a bit vector parallel to the list.  The game list uses
+// it to build the list of games passing the current filter from the
+// bit vector, rather than calling Include() on every game on every
+// refresh, which can be slow for filters that have to look up stats
+// db values (ratings, dates, categories).
+//
+// The selection for a filter is built lazily, the first time the
+// filter is used.  After that, it's only updated for items that the
+// owner reports as changed, via OnItemChanged(), and it's rebuilt
+// from scratch when the 'midnight' reference date changes, since the
+// recency filters depend on it.
+//
+// This is a template over the item and filter types, so that the
+// tests can exercise it with synthetic items.  The filter type must
+// provide Include(Item*, DATE midnight).
+
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+template<class Item, class Filter> class FilterSelectionCache
+{
+public:
+	// Cached selection for one filter
+	struct Selection
+	{
+		Selection() : midnight(0) { }
+
+		// Include() result for each item, indexed by list position
+		std::vector<bool> include;
+
+		// The 'midnight' value we passed to Include() when building the
+		// selection
+		DATE midnight;
+	};
+
+	// Discard all cached selections.  Call this when the set of items
+	// changes.
+	void Clear()
+	{
+		pos.clear();
+		selections.clear();
+		dirty.clear();
+	}
+
+	// Set the list order.  The list must contain the same items as in
+	// the last call (since the last Clear(), if any); this remaps the
+	// cached selections to the new order.  If we somehow find an item
+	// we didn't know about, we mark it for re-evaluation.
+	void SetOrder(const std::vector<Item*> &items)
+	{
+		// rebuild the position index
+		std::unordered_map<const Item*, int> oldPos;
+		oldPos.swap(pos);
+		for (int i = 0; i < (int)items.size(); ++i)
+			pos.emplace(items[i], i);
+
+		// permute the selections
+		for (auto &s : selections)
+		{
+			auto &include = s.second.include;
+			std::vector<bool> newInclude(items.size());
+			for (size_t i = 0; i < items.size(); ++i)
+			{
+				if (auto it = oldPos.find(items[i]); it != oldPos.end() && it->second < (int)include.size())
+					newInclude[i] = include[it->second];
+				else
+					dirty.emplace(items[i]);
+			}
+			include.swap(newInclude);
+		}
+	}
+
+	// Note that an item's filter-related data changed.  We'll re-run
+	// the Include() test for the item in all cached selections on the
+	// next Get().
+	void OnItemChanged(Item *item) { dirty.emplace(item); }
+
+	// Forget a filter's selection, when the filter is deleted
+	void Forget(const Filter *filter) { selections.erase(filter); }
+
+	// Get the selection for a filter, applying pending item updates,
+	// and building or rebuilding it as needed.  'items' is the list in
+	// the order last passed to SetOrder().
+	const Selection &Get(const Filter *filter, DATE midnight, const std::vector<Item*> &items)
+	{
+		// Apply pending item updates to the cached selections.  We only
+		// have to re-run the Include() test for the items that changed.
+		if (dirty.size() != 0)
+		{
+			for (auto item : dirty)
+			{
+				if (auto it = pos.find(item); it != pos.end())
+				{
+					for (auto &s : selections)
+					{
+						if (it->second < (int)s.second.include.size())
+							s.second.include[it->second] = s.first->Include(item, s.second.midnight);
+					}
+				}
+			}
+			dirty.clear();
+		}
+
+		// Get the cached selection for this filter.  If it's new, or it
+		// was built for a different day, build it now.
+		Selection &sel = selections[filter];
+		if (sel.include.size() != items.size() || sel.midnight != midnight)
+		{
+			sel.midnight = midnight;
+			sel.include.resize(items.size());
+			for (size_t i = 0; i < items.size(); ++i)
+				sel.include[i] = filter->Include(items[i], midnight);
+		}
+
+		// return the selection
+		return sel;
+	}
+
+protected:
+	// position of each item in the list
+	std::unordered_map<const Item*, int> pos;
+
+	// cached selections, by filter
+	std::unordered_map<const Filter*, Selection> selections;
+
+	// items whose filter-related data changed since the last Get()
+	std::unordered_set<Item*> dirty;
+};
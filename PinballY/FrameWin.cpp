@@ -568,6 +568,7 @@ bool FrameWin::DoCommand(int cmd)
 		return true;
 
 	case ID_FPS:
+	case ID_PERF_TRACE:
 	case ID_ROTATE_CW:
 		// forward these to the child view
 		if (view != 0)
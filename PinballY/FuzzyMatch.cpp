@@ -0,0 +1,109 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Fuzzy string match index
+
+#include "stdafx.h"
+#include "FuzzyMatch.h"
+
+float FuzzyMatchIndex::DiceCoefficient(const BigramSet &a, const BigramSet &b)
+{
+	// count the bigrams in common, via a merge of the sorted sets
+	int nIntersection = 0;
+	for (auto ia = a.begin(), ib = b.begin(); ia != a.end() && ib != b.end(); )
+	{
+		if (*ia < *ib)
+			++ia;
+		else if (*ib < *ia)
+			++ib;
+		else
+			++nIntersection, ++ia, ++ib;
+	}
+
+	// the Dice Coefficient is 2 x the number of bigrams in common,
+	// divided by the total number of bigrams in the two sets
+	return 2.0f * float(nIntersection) / float(a.size() + b.size());
+}
+
+void FuzzyMatchIndex::Add(int id, const BigramSet &set)
+{
+	// add the string entry
+	int stringIdx = (int)strings.size();
+	strings.emplace_back(id, set.size());
+	nIds = max(nIds, id + 1);
+
+	// add it to the posting list for each of its bigrams
+	for (auto b : set)
+		postings[b].push_back(stringIdx);
+}
+
+void FuzzyMatchIndex::Clear()
+{
+	strings.clear();
+	postings.clear();
+	nIds = 0;
+}
+
+void FuzzyMatchIndex::Search(std::vector<Match> &results, std::initializer_list<const BigramSet*> queries,
+	float threshold, size_t maxResults) const
+{
+	results.clear();
+
+	// Best score so far per candidate ID, and the list of IDs we've
+	// scored, so that we only have to visit those at the end.
+	std::vector<float> best(nIds, -1.0f);
+	std::vector<int> scoredIds;
+
+	// Shared bigram counts per string, and the list of strings with
+	// non-zero counts for the current query
+	std::vector<UINT32> counts(strings.size(), 0);
+	std::vector<int> touched;
+
+	for (auto q : queries)
+	{
+		// count the shared bigrams for each string that has any
+		touched.clear();
+		for (auto b : *q)
+		{
+			if (auto it = postings.find(b); it != postings.end())
+			{
+				for (int s : it->second)
+				{
+					if (counts[s]++ == 0)
+						touched.push_back(s);
+				}
+			}
+		}
+
+		// score the strings we visited, keeping the best per ID
+		for (int s : touched)
+		{
+			auto &str = strings[s];
+			float score = 2.0f * float(counts[s]) / float(q->size() + str.nBigrams);
+			counts[s] = 0;
+
+			if (best[str.id] < 0.0f)
+				scoredIds.push_back(str.id);
+			if (score > best[str.id])
+				best[str.id] = score;
+		}
+	}
+
+	// collect the results above the threshold
+	for (int id : scoredIds)
+	{
+		if (best[id] > threshold)
+			results.emplace_back(id, best[id]);
+	}
+
+	// sort by descending score, then ascending ID
+	auto Compare = [](const Match &a, const Match &b) {
+		return a.score != b.score ? a.score > b.score : a.id < b.id; };
+	if (maxResults != 0 && maxResults < results.size())
+	{
+		std::partial_sort(results.begin(), results.begin() + maxResults, results.end(), Compare);
+		results.erase(results.begin() + maxResults, results.end());
+	}
+	else
+		std::sort(results.begin(), results.end(), Compare);
+}
@@ -0,0 +1,124 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Fuzzy string match index
+//
+// This is an indexed version of the Dice coefficient string match in
+// DiceCoefficient.h, for searching a fixed list of candidate strings
+// for the best matches to a query string.  We use this for several
+// lookups that match game titles against reference lists: the IPDB
+// table list (RefTableList), the DOF title/ROM list (DOFClient), and
+// the PINemHi friendly ROM name list (HighScores).
+//
+// The bigram sets are computed exactly as in DiceCoefficient.h, so the
+// scores are identical, but the representation is much more compact.
+// Rather than storing each bigram as a separate heap-allocated string
+// in a hash set, we pack each bigram into a 32-bit integer (the two
+// 16-bit characters side by side), and store the set as a sorted
+// vector of these integers.  Two sets can then be intersected with a
+// simple linear merge.
+//
+// The index also keeps an inverted "posting list" for each bigram,
+// listing the candidate strings that contain it.  A search walks the
+// posting lists for the query's bigrams, counting the shared bigrams
+// for each candidate along the way, so it only visits candidates that
+// share at least one bigram with the query.  Everything else has a
+// score of zero by definition, so there's no need to look at it.
+//
+
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <type_traits>
+
+class FuzzyMatchIndex
+{
+public:
+	FuzzyMatchIndex() : nIds(0) { }
+
+	// Bigram set.  This is a sorted vector of unique packed bigrams.
+	typedef std::vector<UINT32> BigramSet;
+
+	// Build the bigram set for a string.  This uses the same bigrams
+	// as DiceCoefficient::BuildBigramSet(): a <null><first char> pair
+	// for the start of the string, followed by each adjacent pair of
+	// characters, including the <last char><null> pair at the end.
+	template<typename chartype>
+	static void BuildBigramSet(BigramSet &set, const chartype *str)
+	{
+		set.clear();
+		set.push_back(Pack<chartype>(0, str[0]));
+		for (int i = 0; str[i] != 0; ++i)
+			set.push_back(Pack(str[i], str[i + 1]));
+
+		std::sort(set.begin(), set.end());
+		set.erase(std::unique(set.begin(), set.end()), set.end());
+	}
+
+	// Figure the Dice coefficient for two bigram sets
+	static float DiceCoefficient(const BigramSet &a, const BigramSet &b);
+
+	// Add a candidate string to the index, under the given candidate ID.
+	// IDs are small integers chosen by the caller, typically the index
+	// of the item in the caller's own list.  The same ID can be added
+	// more than once with different strings (e.g., a name and alternate
+	// name for the same item); searches score each string separately
+	// and use the best score for the ID.
+	template<typename chartype>
+	void Add(int id, const chartype *str)
+	{
+		BigramSet set;
+		BuildBigramSet(set, str);
+		Add(id, set);
+	}
+	void Add(int id, const BigramSet &set);
+
+	// Clear the index
+	void Clear();
+
+	// number of candidate strings in the index
+	size_t GetCount() const { return strings.size(); }
+
+	// Search result
+	struct Match
+	{
+		Match(int id, float score) : id(id), score(score) { }
+		int id;			// candidate ID
+		float score;	// best Dice coefficient for the candidate
+	};
+
+	// Search the index.  Each candidate is scored against each query
+	// set, and its best score is used.  Candidates scoring strictly
+	// above 'threshold' are returned in 'results', sorted by descending
+	// score, with ties in ascending ID order.  If 'maxResults' is
+	// non-zero, only that many of the top results are returned.
+	void Search(std::vector<Match> &results, std::initializer_list<const BigramSet*> queries,
+		float threshold, size_t maxResults = 0) const;
+
+protected:
+	// pack a character pair into a bigram
+	template<typename chartype>
+	static UINT32 Pack(chartype a, chartype b)
+	{
+		typedef typename std::make_unsigned<chartype>::type uchar;
+		return (UINT32(uchar(a)) << 16) | UINT32(uchar(b));
+	}
+
+	// Candidate string entry
+	struct String
+	{
+		String(int id, size_t nBigrams) : id(id), nBigrams((UINT32)nBigrams) { }
+		int id;				// candidate ID
+		UINT32 nBigrams;	// number of bigrams in the string's set
+	};
+	std::vector<String> strings;
+
+	// Posting lists.  For each bigram, this lists the indices (in the
+	// 'strings' vector) of the strings that contain the bigram.  The
+	// lists are in ascending order, since we add strings in order.
+	std::unordered_map<UINT32, std::vector<int>> postings;
+
+	// number of candidate IDs (one more than the highest ID added)
+	int nIds;
+};
@@ -13,6 +13,9 @@
 #include "GameList.h"
 #include "DateUtil.h"
 #include "Application.h"
+#include "LogFile.h"
+#include "HiResTimer.h"
+#include "GameListSnapshot.h"
 
 #include <filesystem>
 namespace fs = std::experimental::filesystem;
@@ -55,16 +58,19 @@ GameList::GameList()
 	// get the media path from the configuration
 	mediaPath = GetDataFilePath(_T("MediaPath"), _T("Media"));
 
-	// Set up our stats columns
+	// Set up our stats columns.  Declare the types of the numeric,
+	// boolean, and date columns, so that the stats db keeps them in
+	// parsed form; the filters read these for every game on every
+	// filter refresh.
 	gameCol = statsDb.DefineColumn(_T("Game"));
-	lastPlayedCol = statsDb.DefineColumn(_T("Last Played"));
-	playCountCol = statsDb.DefineColumn(_T("Play Count"));
-	playTimeCol = statsDb.DefineColumn(_T("Play Time"));
-	favCol = statsDb.DefineColumn(_T("Is Favorite"));
-	ratingCol = statsDb.DefineColumn(_T("Rating"));
+	lastPlayedCol = statsDb.DefineColumn(_T("Last Played"), CSVFile::Column::Date);
+	playCountCol = statsDb.DefineColumn(_T("Play Count"), CSVFile::Column::Int);
+	playTimeCol = statsDb.DefineColumn(_T("Play Time"), CSVFile::Column::Int);
+	favCol = statsDb.DefineColumn(_T("Is Favorite"), CSVFile::Column::Bool);
+	ratingCol = statsDb.DefineColumn(_T("Rating"), CSVFile::Column::Float);
 	categoriesCol = statsDb.DefineColumn(_T("Categories"));
-	hiddenCol = statsDb.DefineColumn(_T("Is Hidden"));
-	dateAddedCol = statsDb.DefineColumn(_T("Date Added"));
+	hiddenCol = statsDb.DefineColumn(_T("Is Hidden"), CSVFile::Column::Bool);
+	dateAddedCol = statsDb.DefineColumn(_T("Date Added"), CSVFile::Column::Date);
 	highScoreStyleCol = statsDb.DefineColumn(_T("High Score Style"));
 
 	// find the game stats database file
@@ -380,14 +386,8 @@ float GameList::GetRating(GameListItem *game)
 	// imported rating from the XML file.  If there's no entry
 	// in the stats database, use the XML file value.
 	int row = GetStatsDbRow(game, false);
-	if (row >= 0)
-	{
-		// check if the column has a non-empty value; if so,
-		// interpret it as a float and return the value
-		const TCHAR *val = ratingCol->Get(row, nullptr);
-		if (val != nullptr && val[0] != 0)
-			return (float)_ttof(val);
-	}
+	if (row >= 0 && ratingCol->HasValue(row))
+		return ratingCol->GetFloat(row);
 
 	// There's no stats database entry, so fall back on the
 	// value from the XML database.  In the PinballX XML
@@ -402,6 +402,7 @@ void GameList::SetRating(GameListItem *game, float rating)
 {
 	// set the rating in the stats database, creating the row as needed
 	ratingCol->Set(GetStatsDbRow(game, true), rating);
+	OnGameFilterDataChanged(game);
 
 	// Set the PinballX rating.  -1 in our scheme means "undefined",
 	// which PBX represents as zero.  PBX has no way to represent zero
@@ -558,9 +559,14 @@ void GameList::RefreshFilter()
 	DATE dMidnight;
 	SystemTimeToVariantTime(&utcMidnight, &dMidnight);
 
+	// Get the filter's cached selection
+	auto const &sel = filterCache.Get(curFilter, dMidnight, byTitle);
+
 	// Construct the new list of games that pass the filter
-	for (auto g : byTitle)
+	for (size_t i = 0; i < byTitle.size(); ++i)
 	{
+		GameListItem *g = byTitle[i];
+
 		// If this game is hidden or disabled, check to see if the filter passes
 		// hidden games.  If not, skip it.
 		if (g->IsHidden() && !curFilter->IncludeHidden())
@@ -573,7 +579,7 @@ void GameList::RefreshFilter()
 			continue;
 
 		// If this game is included, add it to the list
-		if (curFilter->Include(g, dMidnight))
+		if (sel.include[i])
 		{
 			// note its new index, and add it to the list
 			int idx = (int)byTitleFiltered.size();
@@ -862,6 +868,39 @@ bool GameList::InitFromPinballX(ErrorHandler &eh)
 
 bool GameList::InitFromConfig(ErrorHandler &eh)
 {
+	// Loading proceeds in three phases:
+	//
+	// 1. Read the system configuration, create the system objects, and
+	//    list the XML files in each system's database folder.
+	//
+	// 2. Scan the table folders, and read and parse the XML files.  This
+	//    is the bulk of the I/O and CPU work, and each file set and XML
+	//    file is independent of the others, so we do this in parallel
+	//    on a pool of worker threads.
+	//
+	// 3. Merge the parsed XML files into the game list, on this thread,
+	//    in the same order we'd have loaded them serially.  This creates
+	//    the games, categories, manufacturers, and so on, which all
+	//    share structures and so must be serialized.
+	//
+	HiResTimer timer;
+	double t0 = timer.GetTime_seconds();
+
+	// XML database files to load, in the order we find them
+	struct DbFileLoad
+	{
+		DbFileLoad(const TCHAR *filename, const TCHAR *parentFolder, GameSystem *system) :
+			filename(filename), parentFolder(parentFolder), system(system), ok(false) { }
+
+		TSTRING filename;				// full path to the file
+		TSTRING parentFolder;			// system database folder name
+		GameSystem *system;				// system the file belongs to
+		std::unique_ptr<GameDatabaseFile> xml;	// parsed file
+		CapturingErrorHandler errs;		// errors captured during loading
+		bool ok;						// successfully loaded?
+	};
+	std::list<DbFileLoad> dbFileLoads;
+
 	// Get the database folder, using "data folder" rules
 	TSTRING dbDir = GetDataFilePath(_T("TableDatabasePath"), _T("Databases"));
 
@@ -1040,8 +1079,9 @@ bool GameList::InitFromConfig(ErrorHandler &eh)
 				tablePath = tablePathBuf;
 			}
 
-			// create the system object
-			GameSystem *system = CreateSystem(systemName, sysDbDir, tablePath, defExt);
+			// create the system object, deferring the table folder scan
+			// to the parallel phase
+			GameSystem *system = CreateSystem(systemName, sysDbDir, tablePath, defExt, false);
 
 			// Load the config variables for the system
 			system->databaseDir = databaseDir;
@@ -1068,16 +1108,97 @@ bool GameList::InitFromConfig(ErrorHandler &eh)
 				std::basic_regex<wchar_t> xmlExtPat(L".*\\.xml$", std::regex_constants::icase);
 				if (std::regex_match(fname, xmlExtPat))
 				{
-					// it's an XML file - load the table list
-					if (!LoadGameDatabaseFile(fname, databaseDir, system, eh))
-						return false;
+					// it's an XML file - queue it for loading
+					dbFileLoads.emplace_back(fname, databaseDir, system);
 				}
 			}
 		}
 	}
 
-	// success
-	return true;
+	// Restore what we can from the snapshot of the last load.  Any
+	// table folder that hasn't changed since the snapshot was written
+	// can be populated from the saved listing without a scan.
+	double t1 = timer.GetTime_seconds();
+	int nRestored = 0;
+	TSTRING snapshotFile = GameListSnapshot::GetFilename();
+	{
+		GameListSnapshot snapshot;
+		if (snapshot.Open(snapshotFile.c_str()))
+		{
+			for (auto &tfs : tableFileSets)
+			{
+				if (tfs.second.scanPending && snapshot.Restore(tfs.second))
+					++nRestored;
+			}
+		}
+	}
+
+	// Phase 2: build the task list for the parallel phase.  Add the
+	// table folder scans first, since those are typically the slowest
+	// individual items (a large table folder can hold thousands of
+	// files), so we want them started as early as possible.
+	double t1a = timer.GetTime_seconds();
+	std::vector<std::function<void()>> tasks;
+	int nScans = 0;
+	for (auto &tfs : tableFileSets)
+	{
+		if (tfs.second.scanPending)
+		{
+			tasks.emplace_back([tfs = &tfs.second]() { tfs->Scan(); });
+			++nScans;
+		}
+	}
+	for (auto &f : dbFileLoads)
+	{
+		tasks.emplace_back([&f]()
+		{
+			f.xml.reset(new GameDatabaseFile());
+			f.ok = f.xml->Load(f.filename.c_str(), f.errs);
+		});
+	}
+
+	// run the tasks
+	int nThreads = tasks.size() != 0 ? RunParallel(tasks) : 0;
+
+	// Phase 3: merge the XML files, in the original load order
+	double t2 = timer.GetTime_seconds();
+	bool ok = true;
+	for (auto &f : dbFileLoads)
+	{
+		// pass along any errors captured while loading the file
+		f.errs.EnumErrors([&eh](const ErrorList::Item &item)
+		{
+			if (item.details.length() != 0)
+				eh.SysError(item.message.c_str(), item.details.c_str());
+			else
+				eh.Error(item.message.c_str());
+		});
+
+		// merge it
+		if (!f.ok || !MergeGameDatabaseFile(f.xml, f.parentFolder.c_str(), f.system, eh))
+		{
+			ok = false;
+			break;
+		}
+	}
+
+	// If we had to scan any folders, save a new snapshot for next time
+	double t3 = timer.GetTime_seconds();
+	if (ok && nScans != 0)
+		GameListSnapshot::Save(snapshotFile.c_str(), tableFileSets);
+
+	// log the phase timing
+	double t4 = timer.GetTime_seconds();
+	LogFile::Get()->Write(LogFile::Info, LogFile::SysGameList,
+		_T("Game database load: config %.1f ms; snapshot restore %.1f ms (%d folders); ")
+		_T("table folder scan + XML read/parse %.1f ms (%d folders, %d files, %d threads); ")
+		_T("merge %.1f ms; snapshot save %.1f ms\n"),
+		(t1 - t0)*1000.0, (t1a - t1)*1000.0, nRestored,
+		(t2 - t1a)*1000.0, nScans, (int)dbFileLoads.size(), nThreads,
+		(t3 - t2)*1000.0, (t4 - t3)*1000.0);
+
+	// return the result
+	return ok;
 }
 
 bool GameList::Load(ErrorHandler &eh)
@@ -1098,10 +1219,14 @@ bool GameList::Load(ErrorHandler &eh)
 	// immediately without setting up their metadata and media files,
 	// and also let the user see which files haven't been set up yet
 	// and run the setup menus for them.
+	HiResTimer timer;
+	double t0 = timer.GetTime_seconds();
 	AddUnconfiguredGames();
 
 	// Build the title index
+	double t1 = timer.GetTime_seconds();
 	BuildTitleIndex();
+	double t2 = timer.GetTime_seconds();
 
 	// Create the master filter list.  The UI uses this to construct
 	// menus to select filters, by selecting subsets of the filters
@@ -1248,14 +1373,22 @@ bool GameList::Load(ErrorHandler &eh)
 	// set the "all games" filter to populate the initial filter list
 	SetFilter(&allGamesFilter);
 
+	// log the timing for the post-load phases
+	double t3 = timer.GetTime_seconds();
+	LogFile::Get()->Write(LogFile::Info, LogFile::SysGameList,
+		_T("Game list setup: unconfigured games %.1f ms; title index %.1f ms; filters %.1f ms (%d games)\n"),
+		(t1 - t0)*1000.0, (t2 - t1)*1000.0, (t3 - t2)*1000.0, (int)games.size());
+
 	// success
 	return true;
 }
 
 void GameList::BuildTitleIndex() 
 {
-	// clear any previous index
+	// clear any previous index, and discard the cached filter selections,
+	// since the game set might have changed
 	byTitle.clear();
+	filterCache.Clear();
 
 	// create the title index
 	for (auto &g : games)
@@ -1271,6 +1404,11 @@ void GameList::SortTitleIndex()
 	std::sort(byTitle.begin(), byTitle.end(), [](GameListItem* const &a, GameListItem* const &b) {
 		return lstrcmpi(a->title.c_str(), b->title.c_str()) < 0;
 	});
+
+	// Remap the cached filter selections to the new order.  The game
+	// set is the same (BuildTitleIndex discards the selections when it
+	// changes), so this is just a permutation.
+	filterCache.SetOrder(byTitle);
 }
 
 void GameList::AddUnconfiguredGames()
@@ -1339,7 +1477,7 @@ int GameList::AddNewFiles(const TSTRING &path, const TSTRING &ext,
 
 GameSystem *GameList::CreateSystem(
 	const TCHAR *systemName, const TCHAR *sysDatabaseDir, 
-	const TCHAR *tablePath, const TCHAR *defExt)
+	const TCHAR *tablePath, const TCHAR *defExt, bool scanTableFiles)
 {
 	// Look up the system by name
 	auto it = systems.find(systemName);
@@ -1375,7 +1513,7 @@ GameSystem *GameList::CreateSystem(
 		itfs = tableFileSets.emplace(
 			std::piecewise_construct,
 			std::forward_as_tuple(key),
-			std::forward_as_tuple(tablePath, defExt)).first;
+			std::forward_as_tuple(tablePath, defExt, scanTableFiles)).first;
 	}
 
 	// cross-reference the system and the table file set
@@ -1396,6 +1534,17 @@ bool GameList::LoadGameDatabaseFile(
 	if (!xml->Load(filename, eh))
 		return false;
 
+	// merge it into the game list
+	return MergeGameDatabaseFile(xml, parentFolder, system, eh);
+}
+
+bool GameList::MergeGameDatabaseFile(
+	std::unique_ptr<GameDatabaseFile> &xml, const TCHAR *parentFolder,
+	GameSystem *system, ErrorHandler &eh)
+{
+	// get the filename
+	const TCHAR *filename = xml->filename.c_str();
+
 	// make sure it has the root <menu> node
 	typedef xml_node<char> node;
 	typedef xml_attribute<char> attr;
@@ -1996,8 +2145,9 @@ void GameList::DeleteCategory(GameCategory *category)
 	for (auto &g : games)
 		RemoveCategory(&g, category);
 
-	// remove the category from the filter list
+	// remove the category from the filter list, and drop its cached selection
 	filters.remove(category);
+	filterCache.Forget(category);
 
 	// For debugging purposes and protection against self-inflicted errors,
 	// we're not going to actually delete the GameCategory object.  We hand
@@ -2164,6 +2314,9 @@ void GameList::MoveGameToDbFile(GameListItem *game, GameDatabaseFile *dbFile)
 
 void GameList::JustAddCategory(GameListItem *game, const GameCategory *category)
 {
+	// the game's category filter selections will change
+	OnGameFilterDataChanged(game);
+
 	// Check to see if we can categorize the game by XML file placement.
 	// If the game isn't currently in a categorizing database file (that
 	// is, it's either not in a database file at all, or it's in the
@@ -2237,6 +2390,9 @@ void GameList::RemoveCategory(GameListItem *game, const GameCategory *category)
 
 void GameList::JustRemoveCategory(GameListItem *game, const GameCategory *category)
 {
+	// the game's category filter selections will change
+	OnGameFilterDataChanged(game);
+
 	// Retrieve the parsed category list, if present.  There's no need
 	// to create one just to remove a category, as we obviously wouldn't
 	// find a list item to remove if there's no list at all.
@@ -2389,12 +2545,21 @@ void GameList::EnumManufacturers(std::function<void(const GameManufacturer*)> fu
 		func(&m.second);
 }
 
+void GameList::EnumGames(std::function<void(GameListItem*)> func)
+{
+	for (auto &g : games)
+		func(&g);
+}
+
 void GameList::ChangeSystem(GameListItem *game, GameSystem *newSystem)
 {
 	// If we're not changing systems, do nothing
 	if (newSystem == game->system)
 		return;
 
+	// the system filters will select the game differently
+	OnGameFilterDataChanged(game);
+
 	// If we're currently associated with a system, our XML record
 	// is in the old system's database file, so the first step is
 	// to remove it from the old XML tree.
@@ -2496,6 +2661,10 @@ void GameList::ChangeSystem(GameListItem *game, GameSystem *newSystem)
 
 void GameList::FlushToXml(GameListItem *game)
 {
+	// Flushing to XML means that the in-memory metadata has changed,
+	// which could affect the game's filter selections
+	OnGameFilterDataChanged(game);
+
 	// There's nothing to do if the game isn't in a db file
 	if (game->dbFile == nullptr)
 		return;
@@ -3007,6 +3176,17 @@ bool GameListItem::GetMediaItems(std::list<TSTRING> &filenames,
 	if (!mediaType.GetMediaPath(dir, system != nullptr ? system->mediaDir.c_str() : nullptr))
 		return false;
 
+	// If we're looking for existing files, consult the media file
+	// index rather than probing the file system for each possible
+	// name.  The index applies the same naming rules we'd apply in
+	// the exhaustive search below, and returns the files in the same
+	// order.
+	if (!forCapture)
+	{
+		GameList::Get()->GetMediaIndex()->GetMediaItems(filenames, dir, mediaType, mediaName.c_str());
+		return filenames.size() != 0;
+	}
+
 	// If this is an indexed media type, search for an arbitrary
 	// maximum number of index values.  For non-indexed types, we
 	// only need to make one index pass.
@@ -3073,13 +3253,12 @@ bool GameListItem::GetMediaItems(std::list<TSTRING> &filenames,
 				// null-terminate the path name
 				fullName[index] = 0;
 
-				// If the file exists, OR we're just getting the default name for
-				// capture purposes, include this name.  For capture, the filename
-				// to use for is always the first extension in the list, and it
-				// doesn't have to exist yet (since the whole point is to capture
-				// it anew), so we can simply return the first filename we form.
-				if (forCapture || FileExists(fullName))
-					filenames.emplace_back(fullName);
+				// We're just getting the default name for capture purposes, so
+				// include this name.  For capture, the filename to use for is
+				// always the first extension in the list, and it doesn't have to
+				// exist yet (since the whole point is to capture it anew), so we
+				// can simply return the first filename we form.
+				filenames.emplace_back(fullName);
 
 				// if we're at a space separator in the extension string, skip it
 				if (*ext == ' ')
@@ -3241,6 +3420,36 @@ void GameListItem::SetHidden(bool f, bool updateDatabases)
 	}
 }
 
+void GameListItem::SetHighScores(const TCHAR *txt)
+{
+	// clear any previous high score data
+	highScores.clear();
+
+	// break the new text into lines and populate the list
+	const TCHAR *start = txt;
+	for (;;)
+	{
+		// find the end of this line
+		const TCHAR *p = start;
+		for (; *p != 0 && *p != '\n' && *p != '\r'; ++p);
+
+		// add this line to the list
+		highScores.emplace_back(start, p - start);
+
+		// if this is the last line, we're done
+		if (*p == 0)
+			break;
+
+		// skip newline sequences - single \n or \r, or \n\r or \r\n pairs
+		if ((*p == '\n' && *(p + 1) == '\r') || (*p == '\r' && *(p + 1) == '\n'))
+			++p;
+		++p;
+
+		// this is the start of the next line
+		start = p;
+	}
+}
+
 void GameListItem::EnumHighScoreGroups(std::function<void(const std::list<const TSTRING*> &)> func)
 {
 	std::list<const TSTRING*> group;
@@ -3385,14 +3594,14 @@ bool RatingFilter::Include(GameListItem *game, DATE /*midnight*/) const
 
 bool RecentlyPlayedFilter::Include(GameListItem *game, DATE midnight) const
 {
-	// Get the game's last played time, as a DateTime value.
+	// Get the game's last played time, as a Variant DATE value.
 	// Note that this is in UTC.
-	DateTime lastPlayed(GameList::Get()->GetLastPlayed(game));
+	DATE lastPlayed = GameList::Get()->GetLastPlayedDate(game);
 
 	// If there's not a valid Last Played value for the game, treat it
 	// as "never played".  That means that this game can't pass any date
 	// inclusion filter, and that it passes every exclusion filter.
-	if (!lastPlayed.IsValid())
+	if (lastPlayed == 0)
 		return exclude;
 
 	// Figure the starting point of the filter interval, by
@@ -3406,7 +3615,7 @@ bool RecentlyPlayedFilter::Include(GameListItem *game, DATE midnight) const
 	DATE dStart = midnight - days;
 
 	// Determine if the Last Played time is within the interval
-	bool lastPlayedInInterval = lastPlayed.ToVariantDate() >= dStart;
+	bool lastPlayedInInterval = lastPlayed >= dStart;
 
 	// Now determine if it passes the filter: if it's an inclusion
 	// filter, it passes if the game was last played in the interval,
@@ -3426,16 +3635,16 @@ bool RecentlyAddedFilter::Include(GameListItem *game, DATE midnight) const
 	if (!game->isConfigured)
 		return false;
 
-	// Get the date/time the game was added, as a DateTime value.
+	// Get the date/time the game was added, as a Variant DATE value.
 	// This is in UTC.
-	DateTime added(GameList::Get()->GetDateAdded(game));
+	DATE added = GameList::Get()->GetDateAddedDate(game);
 
 	// If there's not a valid Added date, it must have come from a
 	// pre-existing PinballX database.  PBX doesn't track added dates,
 	// so all we can say is that the game was added before our first
 	// run.
-	if (!added.IsValid())
-		added = Application::Get()->GetFirstRunTime();
+	if (added == 0)
+		added = Application::Get()->GetFirstRunTime().ToVariantDate();
 
 	// Figure the starting point of the filter interval, by
 	// subtracting the filter's interval in days from the current
@@ -3445,7 +3654,7 @@ bool RecentlyAddedFilter::Include(GameListItem *game, DATE midnight) const
 	DATE dStart = midnight - days;
 
 	// Determine if the game was added during the interval
-	bool addedDuringInterval = added.ToVariantDate() >= dStart;
+	bool addedDuringInterval = added >= dStart;
 
 	// Now determine if it passes the filter: if it's an inclusion
 	// filter, it passes if the game was added within the interval,
@@ -3617,11 +3826,29 @@ bool GameDatabaseFile::Parse(ErrorHandler &eh)
 // Table file sets
 //
 
-TableFileSet::TableFileSet(const TCHAR *tablePath, const TCHAR *defExt) :
-	tablePath(tablePath), defExt(defExt)
+TableFileSet::TableFileSet(const TCHAR *tablePath, const TCHAR *defExt, bool scan) :
+	scanPending(true), tablePath(tablePath), defExt(defExt)
+{
+	folderTime.dwLowDateTime = folderTime.dwHighDateTime = 0;
+
+	// build our initial file set from a directory scan, unless the
+	// caller wants to defer that
+	if (scan)
+		Scan();
+}
+
+void TableFileSet::Scan()
 {
-	// build our initial file set from a directory scan
-	ScanFolder(tablePath, defExt, [this](const TCHAR *filename) { AddFile(filename); });
+	// Record the folder's modification time.  Do this before the scan,
+	// so that a change made while the scan is in progress will look
+	// like a change on the next check.
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (GetFileAttributesEx(tablePath.c_str(), GetFileExInfoStandard, &attrs))
+		folderTime = attrs.ftLastWriteTime;
+
+	// build the file set from a directory scan
+	ScanFolder(tablePath.c_str(), defExt.c_str(), [this](const TCHAR *filename) { AddFile(filename); });
+	scanPending = false;
 }
 
 void TableFileSet::ScanFolder(const TCHAR *path, const TCHAR *ext,
@@ -3855,6 +4082,11 @@ bool MediaType::SaveBackup(const TCHAR *filename, TSTRING &newName, ErrorHandler
 		return false;
 	}
 
+	// update the media index for the rename
+	auto mediaIndex = GameList::Get()->GetMediaIndex();
+	mediaIndex->OnFileChanged(filename);
+	mediaIndex->OnFileChanged(newName.c_str());
+
 	// success
 	return true;
 }
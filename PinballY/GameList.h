@@ -5,10 +5,13 @@
 
 #include <list>
 #include <unordered_map>
+#include <unordered_set>
 #include "../rapidxml/rapidxml.hpp"
 #include "Resource.h"
 #include "CSVFile.h"
 #include "DateUtil.h"
+#include "MediaFileIndex.h"
+#include "FilterSelectionCache.h"
 
 class ErrorHandler;
 class GameManufacturer;
@@ -410,6 +413,10 @@ public:
 		highScoresSet = false;
 	}
 
+	// Set the high scores from the PINemHi output text.  This breaks
+	// the text into lines and stores them in the high score list.
+	void SetHighScores(const TCHAR *txt);
+
 	// Divvy up the game's high score list into groups, invoking the
 	// callback for each group.  Groups are separated by blank lines.
 	void EnumHighScoreGroups(std::function<void(const std::list<const TSTRING*> &)> func);
@@ -787,7 +794,25 @@ public:
 class TableFileSet
 {
 public:
-	TableFileSet(const TCHAR *tablePath, const TCHAR *defExt);
+	// Create a table file set.  By default, this populates the file
+	// list immediately with a scan of the table folder.  If 'scan' is
+	// false, the scan is deferred until the caller invokes Scan(); the
+	// startup loader uses this to scan all of the table folders in
+	// parallel.
+	TableFileSet(const TCHAR *tablePath, const TCHAR *defExt, bool scan = true);
+
+	// Populate the file list by scanning the table folder.  This only
+	// touches this object, so scans of separate file sets can proceed
+	// concurrently on different threads.
+	void Scan();
+
+	// Is a deferred scan still pending?
+	bool scanPending;
+
+	// Table folder last-write time, as of the start of the last scan.
+	// GameListSnapshot uses this to determine if a saved listing of the
+	// folder is still current.
+	FILETIME folderTime;
 
 	// List of associated systems.  All of these systems use the same
 	// table path and extension.
@@ -979,19 +1004,34 @@ public:
 	// get the media folder path
 	const TCHAR *GetMediaPath() const { return mediaPath.c_str(); }
 
+	// Get the media file index.  Code that creates, deletes, or renames
+	// media files should notify the index via OnFileChanged().
+	MediaFileIndex *GetMediaIndex() { return &mediaIndex; }
+
 	// Load all game lists
 	bool Load(ErrorHandler &eh);
 
-	// Create a system
+	// Create a system.  If 'scanTableFiles' is false, and we have to
+	// create a new table file set for the system, the new file set's
+	// folder scan is deferred (see TableFileSet::Scan()).
 	GameSystem *CreateSystem(
 		const TCHAR *name, const TCHAR *sysDatabaseDir, 
-		const TCHAR *tablePath, const TCHAR *defExt);
+		const TCHAR *tablePath, const TCHAR *defExt,
+		bool scanTableFiles = true);
 
 	// Load a game database XML file
 	bool LoadGameDatabaseFile(
 		const TCHAR *filename, const TCHAR *parentFolderName,
 		GameSystem *system, ErrorHandler &eh);
 
+	// Merge a game database XML file that's already been read and
+	// parsed.  This populates the game list, categories, and other
+	// list structures from the file's contents, and takes ownership
+	// of the file object on success.
+	bool MergeGameDatabaseFile(
+		std::unique_ptr<GameDatabaseFile> &xml, const TCHAR *parentFolderName,
+		GameSystem *system, ErrorHandler &eh);
+
 	// Get the nth game relative to the current game.  0 is the current
 	// game.  1 is the next game (to the "right" in wheel order), 2 is
 	// the next game after that, etc.  -1 is the previous game ("left" 
@@ -1029,6 +1069,15 @@ public:
 	// filter selects.
 	void RefreshFilter();
 
+	// Note that a game's filter-related metadata has changed (rating,
+	// favorite status, categories, hidden status, played/added dates,
+	// year, manufacturer, system, configured status).  This marks the
+	// game for re-evaluation in the cached filter selections on the
+	// next RefreshFilter().  The stats and category setters below call
+	// this automatically; code that changes GameListItem fields directly
+	// must call it explicitly.
+	void OnGameFilterDataChanged(GameListItem *game) { filterCache.OnItemChanged(game); }
+
 	// get a filter by command ID
 	GameListFilter *GetFilterByCommand(int cmdID);
 
@@ -1066,22 +1115,32 @@ public:
 	const TCHAR *GetLastPlayed(GameListItem *game) 
 	    { return lastPlayedCol->Get(GetStatsDbRow(game)); }
 	void SetLastPlayed(GameListItem *game, const TCHAR *val) 
-	    { lastPlayedCol->Set(GetStatsDbRow(game, true), val); }
+	    { lastPlayedCol->Set(GetStatsDbRow(game, true), val); OnGameFilterDataChanged(game); }
 
 	// set the last played time to "now"
 	void SetLastPlayedNow(GameListItem *game);
 
+	// Get the Last Played time as a Variant DATE value, or 0 if the
+	// game has never been played.  This reads the parsed value from
+	// the stats db, so it's much faster than parsing GetLastPlayed().
+	DATE GetLastPlayedDate(GameListItem *game)
+		{ return lastPlayedCol->GetDate(GetStatsDbRow(game)); }
+
 	// Get/set the Date Added
 	const TCHAR *GetDateAdded(GameListItem *game)
 		{ return dateAddedCol->Get(GetStatsDbRow(game)); }
 	void SetDateAdded(GameListItem *game, const TCHAR *val)
-		{ dateAddedCol->Set(GetStatsDbRow(game, true), val); }
+		{ dateAddedCol->Set(GetStatsDbRow(game, true), val); OnGameFilterDataChanged(game); }
 	void SetDateAdded(GameListItem *game, DateTime val)
-		{ dateAddedCol->Set(GetStatsDbRow(game, true), val.ToString().c_str()); }
+		{ dateAddedCol->Set(GetStatsDbRow(game, true), val.ToString().c_str()); OnGameFilterDataChanged(game); }
 
 	// set the Date Added to "now"
 	 void SetDateAddedNow(GameListItem *game);
 
+	// Get the Date Added as a Variant DATE value, or 0 if not set
+	DATE GetDateAddedDate(GameListItem *game)
+		{ return dateAddedCol->GetDate(GetStatsDbRow(game)); }
+
 	// Get the high score style: DMD (dot matrix display), Alpha (segmented
 	// alphanumeric display, like the 1980s Williams machines), TT (typewriter
 	// font), None (no high score display).
@@ -1102,13 +1161,13 @@ public:
 
 	// get/set the "is favorite" flag
 	bool IsFavorite(GameListItem *game) { return favCol->GetBool(GetStatsDbRow(game)); }
-	void SetIsFavorite(GameListItem *game, bool f) { favCol->SetBool(GetStatsDbRow(game, true), f); }
+	void SetIsFavorite(GameListItem *game, bool f) { favCol->SetBool(GetStatsDbRow(game, true), f); OnGameFilterDataChanged(game); }
 
 	// get/set the game rating, in stars (0-5 scale, as a float value
 	// for fractional stars; -1 means unrated)
 	float GetRating(GameListItem *game);
 	void SetRating(GameListItem *game, float rating);
-	void ClearRating(GameListItem *game) { ratingCol->Set(GetStatsDbRow(game), -1.0f); }
+	void ClearRating(GameListItem *game) { ratingCol->Set(GetStatsDbRow(game), -1.0f); OnGameFilterDataChanged(game); }
 
 	// Get/set the Hidden status for a game.  
 	//
@@ -1117,7 +1176,7 @@ public:
 	// to keep the <enabled> status in the game's XML record in sync
 	//hidden == not enabled)
 	bool IsHidden(GameListItem *game) { return hiddenCol->GetBool(GetStatsDbRow(game)); }
-	void SetHidden(GameListItem *game, bool f) { hiddenCol->SetBool(GetStatsDbRow(game, true), f); }
+	void SetHidden(GameListItem *game, bool f) { hiddenCol->SetBool(GetStatsDbRow(game, true), f); OnGameFilterDataChanged(game); }
 
 	// Add a category to a game's category list
 	void AddCategory(GameListItem *game, const GameCategory *category);
@@ -1168,6 +1227,9 @@ public:
 	// Enumerate manufacturers
 	void EnumManufacturers(std::function<void(const GameManufacturer *)> func);
 
+	// Enumerate all games
+	void EnumGames(std::function<void(GameListItem *)> func);
+
 	// Flush a game's in-memory data to its XML database record
 	void FlushToXml(GameListItem *game);
 
@@ -1368,6 +1430,13 @@ protected:
 	// filtered index list, sorted by title
 	std::vector<GameListItem*> byTitleFiltered;
 
+	// Cached filter selections, parallel to the byTitle list.
+	// RefreshFilter() builds the list of games passing the filter from
+	// the cached Include() results.  The hidden and unconfigured tests
+	// are applied separately, since they depend on global options as
+	// well as the filter.
+	FilterSelectionCache<GameListItem, GameListFilter> filterCache;
+
 	// Populate the table list from PinballX.ini.  This reads the system
 	// list information using the PinballX.ini format.
 	bool InitFromPinballX(ErrorHandler &eh);
@@ -1378,5 +1447,9 @@ protected:
 	// Media folder path.  We use the HyperPin/PinballX directory tree
 	// structure under this folder.
 	TSTRING mediaPath;
+
+	// Media file index.  This caches the media folder listings so that
+	// media lookups don't have to probe the file system.
+	MediaFileIndex mediaIndex;
 };
 
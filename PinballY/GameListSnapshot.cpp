@@ -0,0 +1,242 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Game list snapshot
+
+#include "stdafx.h"
+#include "../Utilities/FileUtil.h"
+#include "GameListSnapshot.h"
+#include "GameList.h"
+#include "LogFile.h"
+
+// snapshot file signature and format version
+static const char snapshotSig[8] = { 'P', 'B', 'Y', 'S', 'N', 'A', 'P', 0 };
+static const UINT32 snapshotVersion = 1;
+
+GameListSnapshot::GameListSnapshot() :
+	view(nullptr),
+	viewSize(0)
+{
+}
+
+GameListSnapshot::~GameListSnapshot()
+{
+	Close();
+}
+
+TSTRING GameListSnapshot::GetFilename()
+{
+	// keep the snapshot alongside the game stats database
+	TCHAR buf[MAX_PATH];
+	GetDeployedFilePath(buf, _T("GameListSnapshot.dat"), _T(""));
+	return buf;
+}
+
+void GameListSnapshot::Close()
+{
+	sets.clear();
+	if (view != nullptr)
+	{
+		UnmapViewOfFile(view);
+		view = nullptr;
+		viewSize = 0;
+	}
+	hMapping.Clear();
+	hFile.Clear();
+}
+
+bool GameListSnapshot::Open(const TCHAR *filename)
+{
+	// close any previous file
+	Close();
+
+	// open the file and map it into memory
+	hFile = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart < 20 || size.HighPart != 0)
+		return false;
+
+	hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+		return false;
+
+	view = static_cast<const BYTE*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (view == nullptr)
+		return false;
+	viewSize = (size_t)size.QuadPart;
+
+	// Set up a bounds-checked reader for the view.  Any structural
+	// problem makes the whole snapshot invalid.
+	const BYTE *p = view, *endp = view + viewSize;
+	auto ReadU32 = [&p, endp](UINT32 &val) -> bool
+	{
+		if (endp - p < 4)
+			return false;
+		memcpy(&val, p, 4);
+		p += 4;
+		return true;
+	};
+	auto SkipChars = [&p, endp](UINT32 n) -> bool
+	{
+		if ((size_t)(endp - p) / sizeof(WCHAR) < n)
+			return false;
+		p += n * sizeof(WCHAR);
+		return true;
+	};
+	auto Fail = [this]()
+	{
+		Close();
+		return false;
+	};
+
+	// check the header
+	UINT32 version, totalSize, nSets;
+	if (memcmp(p, snapshotSig, sizeof(snapshotSig)) != 0)
+		return Fail();
+	p += sizeof(snapshotSig);
+	if (!ReadU32(version) || version != snapshotVersion
+		|| !ReadU32(totalSize) || totalSize != viewSize
+		|| !ReadU32(nSets))
+		return Fail();
+
+	// read the table file set entries
+	for (UINT32 i = 0; i < nSets; ++i)
+	{
+		// read the key
+		UINT32 keyLen;
+		if (!ReadU32(keyLen))
+			return Fail();
+		const BYTE *key = p;
+		if (!SkipChars(keyLen))
+			return Fail();
+
+		// read the folder timestamp and file count
+		SetEntry e;
+		if (!ReadU32((UINT32&)e.folderTime.dwLowDateTime)
+			|| !ReadU32((UINT32&)e.folderTime.dwHighDateTime)
+			|| !ReadU32(e.nFiles))
+			return Fail();
+
+		// validate the file list, and remember where it starts
+		e.files = p;
+		for (UINT32 j = 0; j < e.nFiles; ++j)
+		{
+			UINT32 nameLen;
+			if (!ReadU32(nameLen) || !SkipChars(nameLen))
+				return Fail();
+		}
+
+		// add the entry
+		WSTRING wkey(reinterpret_cast<const WCHAR*>(key), keyLen);
+		sets.emplace(WSTRINGToTSTRING(wkey), e);
+	}
+
+	// success
+	return true;
+}
+
+bool GameListSnapshot::Restore(TableFileSet &tfs)
+{
+	// look up the entry for this file set
+	auto it = sets.find(TableFileSet::GetKey(tfs.tablePath.c_str(), tfs.defExt.c_str()));
+	if (it == sets.end())
+		return false;
+
+	// Check the folder's current timestamp against the snapshot.  If
+	// the folder doesn't exist, there's nothing to restore; let the
+	// caller scan it, so that the normal error handling applies.
+	auto &e = it->second;
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (!GetFileAttributesEx(tfs.tablePath.c_str(), GetFileExInfoStandard, &attrs)
+		|| CompareFileTime(&attrs.ftLastWriteTime, &e.folderTime) != 0)
+		return false;
+
+	// The listing is current - populate the file set from the snapshot.
+	// (Open() already validated the structure.)
+	const BYTE *p = e.files;
+	for (UINT32 i = 0; i < e.nFiles; ++i)
+	{
+		UINT32 nameLen;
+		memcpy(&nameLen, p, 4);
+		p += 4;
+		WSTRING name(reinterpret_cast<const WCHAR*>(p), nameLen);
+		p += nameLen * sizeof(WCHAR);
+		tfs.AddFile(WSTRINGToTSTRING(name).c_str());
+	}
+
+	// the file set is now populated
+	tfs.folderTime = e.folderTime;
+	tfs.scanPending = false;
+	return true;
+}
+
+bool GameListSnapshot::Save(const TCHAR *filename,
+	const std::unordered_map<TSTRING, TableFileSet> &sets)
+{
+	// build the file contents in memory
+	std::vector<BYTE> buf;
+	auto PutU32 = [&buf](UINT32 val)
+	{
+		const BYTE *p = reinterpret_cast<const BYTE*>(&val);
+		buf.insert(buf.end(), p, p + 4);
+	};
+	auto PutStr = [&buf, &PutU32](const TSTRING &str)
+	{
+		WSTRING w = TSTRINGToWSTRING(str);
+		PutU32((UINT32)w.length());
+		const BYTE *p = reinterpret_cast<const BYTE*>(w.c_str());
+		buf.insert(buf.end(), p, p + w.length() * sizeof(WCHAR));
+	};
+
+	// write the header, with placeholders for the size and count
+	buf.insert(buf.end(), snapshotSig, snapshotSig + sizeof(snapshotSig));
+	PutU32(snapshotVersion);
+	PutU32(0);
+	PutU32(0);
+
+	// write the scanned file sets
+	UINT32 nSets = 0;
+	for (auto &s : sets)
+	{
+		// Skip sets that were never scanned, and sets where we couldn't
+		// get the folder timestamp.  A zero timestamp never matches a
+		// real folder, so there'd be no point in storing those.
+		auto &tfs = s.second;
+		if (tfs.scanPending || (tfs.folderTime.dwLowDateTime == 0 && tfs.folderTime.dwHighDateTime == 0))
+			continue;
+
+		PutStr(s.first);
+		PutU32(tfs.folderTime.dwLowDateTime);
+		PutU32(tfs.folderTime.dwHighDateTime);
+		PutU32((UINT32)tfs.files.size());
+		for (auto &f : tfs.files)
+			PutStr(f.second.filename);
+
+		++nSets;
+	}
+
+	// fill in the size and count
+	UINT32 totalSize = (UINT32)buf.size();
+	memcpy(&buf[sizeof(snapshotSig) + 4], &totalSize, 4);
+	memcpy(&buf[sizeof(snapshotSig) + 8], &nSets, 4);
+
+	// write the file
+	HandleHolder h = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD written = 0;
+	if (h == INVALID_HANDLE_VALUE
+		|| !WriteFile(h, buf.data(), totalSize, &written, NULL)
+		|| written != totalSize)
+	{
+		WindowsErrorMessage err;
+		LogFile::Get()->Write(LogFile::Warning, LogFile::SysGameList, _T("Unable to write game list snapshot %s: %s\n"), filename, err.Get());
+		return false;
+	}
+
+	// success
+	return true;
+}
@@ -0,0 +1,102 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Game list snapshot.  This is a compact binary file that records the
+// results of the table folder scans from the last successful game list
+// load, so that we can skip re-scanning folders that haven't changed
+// on the next startup.
+//
+// Scanning the table folders is usually the slowest part of loading
+// the game list, especially on a cold start with a spinning disk: a
+// typical VP installation has thousands of files in its Tables folder,
+// and the directory iterator queries the status of each one.  The XML
+// database files and the stats database, in contrast, are small, and
+// we have to keep their parsed forms in memory anyway, since the game
+// list edits them in place (each GameListItem points directly into the
+// XML DOM tree of its database file).  So the snapshot covers the part
+// of the load that can be safely replaced with a cached copy.
+//
+// Each table file set in the snapshot is keyed by its file set key
+// (the canonical "<path>\*.<ext>" pattern), and records the last-write
+// time of the table folder at the time of the scan.  NTFS updates a
+// folder's last-write time whenever an entry is added, removed, or
+// renamed, so if the folder's current timestamp matches the recorded
+// one, the listing is still valid.  Folders that have changed are
+// simply re-scanned.  New files that appear while we're running are
+// picked up by the usual new file scanner thread, which also runs
+// when the application first comes to the foreground.
+//
+// File format (all integers are little-endian):
+//
+//   char   signature[8]   "PBYSNAP\0"
+//   UINT32 version        format version (currently 1)
+//   UINT32 totalSize      total file size in bytes, for integrity checking
+//   UINT32 nSets          number of table file set entries
+//   nSets x table file set entry:
+//      UINT32 keyLen      length of the file set key, in WCHARs
+//      WCHAR  key[keyLen]
+//      UINT32 timeLow     folder last-write time (FILETIME low part)
+//      UINT32 timeHigh    folder last-write time (FILETIME high part)
+//      UINT32 nFiles      number of files
+//      nFiles x:
+//         UINT32 nameLen  length of the filename, in WCHARs
+//         WCHAR name[nameLen]
+//
+// The snapshot is memory-mapped when reading, and the file entries are
+// read directly out of the mapped view.
+
+#pragma once
+#include <unordered_map>
+
+class TableFileSet;
+
+class GameListSnapshot
+{
+public:
+	GameListSnapshot();
+	~GameListSnapshot();
+
+	// Get the snapshot filename
+	static TSTRING GetFilename();
+
+	// Open the snapshot file.  Returns true if the file exists and has
+	// a valid structure.
+	bool Open(const TCHAR *filename);
+
+	// Close the snapshot file
+	void Close();
+
+	// Restore a table file set from the snapshot.  If the snapshot has
+	// an entry for the set, and the table folder hasn't changed since
+	// the entry was written, this populates the set's file list from
+	// the snapshot and returns true.  Otherwise returns false, in which
+	// case the caller must scan the folder.
+	bool Restore(TableFileSet &tfs);
+
+	// Write a new snapshot file for a collection of table file sets.
+	// Sets that haven't been scanned are omitted.  The snapshot is only
+	// an optimization, so failures aren't reported to the user, but we
+	// note them in the log file.
+	static bool Save(const TCHAR *filename,
+		const std::unordered_map<TSTRING, TableFileSet> &sets);
+
+protected:
+	// table file set entry in the mapped view
+	struct SetEntry
+	{
+		FILETIME folderTime;		// table folder timestamp at last scan
+		UINT32 nFiles;				// number of files
+		const BYTE *files;			// start of the file list in the view
+	};
+
+	// table file set entries, keyed by file set key
+	std::unordered_map<TSTRING, SetEntry> sets;
+
+	// file and mapping handles
+	HandleHolder hFile;
+	HandleHolder hMapping;
+
+	// mapped view
+	const BYTE *view;
+	size_t viewSize;
+};
@@ -0,0 +1,267 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// High score slide rasterizer
+
+#include "stdafx.h"
+#include "HighScoreRasterizer.h"
+
+// native DMD size
+static const int dmdWidth = 128, dmdHeight = 32;
+
+void HighScoreRasterizer::Image::Alloc(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	pix.resize((size_t)width * height * 4);
+}
+
+void HighScoreRasterizer::Image::Fill(const BYTE bgra[4])
+{
+	BYTE *dst = pix.data();
+	for (size_t i = 0, n = (size_t)width * height; i < n; ++i, dst += 4)
+		memcpy(dst, bgra, 4);
+}
+
+void HighScoreRasterizer::BuildColorRamp(DMDFont::Color colors[16], BYTE r, BYTE g, BYTE b)
+{
+	// Figure the background color, using the text color at reduced
+	// brightness.  This helps simulate the visible pixel structure of
+	// a real DMD by showing a little of the text color even in pixels
+	// that are fully "off".
+	int rBg = r / 10, gBg = g / 10, bBg = b / 10;
+
+	// build the ramp from the background color to the text color
+	int redSpan = r - rBg;
+	int greenSpan = g - gBg;
+	int blueSpan = b - bBg;
+	for (int i = 0; i < 16; ++i)
+	{
+		colors[i].Set(
+			rBg + redSpan * i / 15,
+			gBg + greenSpan * i / 15,
+			bBg + blueSpan * i / 15);
+	}
+}
+
+void HighScoreRasterizer::RenderDMD(Image &image, const std::list<TSTRING> &group,
+	const DMDFont *font, const DMDFont::Color colors[16])
+{
+	// set up the 128x32 image, cleared to the background color
+	image.Alloc(dmdWidth, dmdHeight);
+	image.Fill(colors[0].c);
+
+	// figure the starting y offset, centering the text overall vertically
+	int totalTextHeight = font->cellHeight * (int)group.size();
+	int y = (dmdHeight - totalTextHeight) / 2;
+
+	// draw each string
+	for (auto &s : group)
+	{
+		// draw it centered horizontally
+		const TCHAR *str = s.c_str();
+		SIZE sz = font->MeasureString(str);
+		font->DrawString32(str, image.pix.data(), (dmdWidth - sz.cx) / 2, y, colors);
+
+		// advance to the next line
+		y += font->cellHeight;
+	}
+}
+
+int HighScoreRasterizer::CountAlphaCells(const TCHAR *str)
+{
+	int nCells = 0;
+	for (TCHAR prvChar = 0; *str != 0; ++str)
+	{
+		// get this character
+		TCHAR c = *str;
+
+		// Check for combining characters.  A '.' or ',' can combine
+		// with the previous character to form a single cell, provided
+		// that the previous character isn't also '.' or ',', and that
+		// this isn't the first cell.
+		if (!((c == '.' || c == ',') && !(nCells == 0 || prvChar == '.' || prvChar == ',')))
+			++nCells;
+
+		// this is the next character for the next iteration
+		prvChar = c;
+	}
+
+	// return the cell count
+	return nCells;
+}
+
+void HighScoreRasterizer::GetAlphaGridSize(const std::list<std::list<TSTRING>> &messages,
+	int &gridWid, int &gridHt)
+{
+	// start with the Williams 2x16 layout
+	gridWid = 16;
+	gridHt = 2;
+
+	// expand to fit the largest group
+	for (auto &group : messages)
+	{
+		// if this is the tallest message so far, remember it
+		if ((int)group.size() > gridHt)
+			gridHt = (int)group.size();
+
+		// scan the group for the widest line
+		for (auto &s : group)
+		{
+			int wid = CountAlphaCells(s.c_str());
+			if (wid > gridWid)
+				gridWid = wid;
+		}
+	}
+}
+
+void HighScoreRasterizer::RenderAlpha(Image &image, const Atlas &atlas,
+	const std::list<TSTRING> &group, int gridWid, int gridHt)
+{
+	// Figure the pixel size required for the image.  The image consists
+	// of gridHt x gridWid character cells, plus margins and vertical
+	// padding between lines.  The margins and line spacing depend on
+	// the number of lines:
+	//
+	// - For a 2-line image, draw with 1/2 line of spacing top and bottom,
+	//   and 1/2 line of spacing between the two rows
+	//
+	// - For 3 or more lines, draw with 1/4 line of spacing top and
+	//   bottom, and 1/4 line between rows
+	//
+	const int cellWid = atlas.CellWidth();
+	const int cellHt = atlas.CellHeight();
+	int yPadding = gridHt <= 2 ? cellHt / 2 : cellHt / 4;
+	int yMargin = gridHt <= 2 ? cellHt / 2 : cellHt / 4;
+	int pixWid = gridWid * cellWid;
+	int pixHt = gridHt * cellHt + 2 * yMargin + yPadding * (gridHt - 1);
+
+	// figure the top left cell position with these margins
+	int x0 = 0, y0 = yMargin;
+
+	// Pad this out to a 4:1 aspect ratio.  The video DMD display window
+	// is usually sized roughly 4:1 to match the proportions of real
+	// pinball DMDs from the 1990s, which were mostly 128x32.  The
+	// renderer will scale our image to the actual display size, so we
+	// don't have to match the exact size or proportions, but the result
+	// will look better if the image proportions are close to the display
+	// proportions, since that will cause less geometric distortion.
+	if (pixWid > pixHt * 4)
+	{
+		y0 += (pixWid / 4 - pixHt) / 2;
+		pixHt = pixWid / 4;
+	}
+	else if (pixWid < pixHt * 4)
+	{
+		x0 += (pixHt * 4 - pixWid) / 2;
+		pixWid = pixHt * 4;
+	}
+
+	// set up the image, cleared to opaque black
+	static const BYTE black[4] = { 0, 0, 0, 0xFF };
+	image.Alloc(pixWid, pixHt);
+	image.Fill(black);
+
+	// copy a character cell from the atlas.  The atlas only covers the
+	// basic ASCII set, so show anything outside of it as '*'.
+	auto DrawCell = [&image, &atlas, cellWid, cellHt](int x, int y, TCHAR c)
+	{
+		if (c > 127)
+			c = '*';
+		Composite(image, x, y, atlas, (c % 16) * cellWid, (c / 16) * cellHt, cellWid, cellHt);
+	};
+
+	// center the group vertically
+	int y = y0;
+	int blankTopLines = (gridHt - (int)group.size()) / 2;
+
+	// draw each line
+	auto s = group.begin();
+	for (int line = 0; line < gridHt; ++line)
+	{
+		// get the next item, if available, otherwise show a blank line
+		const TCHAR *txt = _T("");
+		if (line >= blankTopLines && s != group.end())
+		{
+			txt = s->c_str();
+			++s;
+		}
+
+		// figure the number of spaces to the left and right to center
+		// the line within the grid width
+		int extraSpaces = gridWid - CountAlphaCells(txt);
+		int leftSpaces = extraSpaces / 2;
+		int rightSpaces = extraSpaces - leftSpaces;
+
+		// draw the left spaces
+		int x = x0;
+		for (int i = 0; i < leftSpaces; ++i, x += cellWid)
+			DrawCell(x, y, ' ');
+
+		// draw the characters
+		TCHAR prvChar = 0;
+		for (const TCHAR *p = txt; *p != 0; )
+		{
+			// draw this character
+			TCHAR c = *p;
+			DrawCell(x, y, c);
+
+			// advance to the next character
+			prvChar = c;
+			c = *++p;
+
+			// Advance to the next character cell, unless the next character
+			// is a '.' or ',' that combines into this cell.  Compositing
+			// with the atlas alpha lets the punctuation glyph overlay the
+			// character already in the cell.
+			if (!((c == ',' || c == '.') && !(prvChar == ',' || prvChar == '.')))
+				x += cellWid;
+		}
+
+		// draw the right spaces
+		for (int i = 0; i < rightSpaces; ++i, x += cellWid)
+			DrawCell(x, y, ' ');
+
+		// advance to the next line
+		y += cellHt + yPadding;
+	}
+}
+
+void HighScoreRasterizer::Composite(Image &dst, int xDst, int yDst,
+	const Image &src, int xSrc, int ySrc, int wid, int ht)
+{
+	// clip against the left and top edges of both images
+	if (xDst < 0) { xSrc -= xDst; wid += xDst; xDst = 0; }
+	if (yDst < 0) { ySrc -= yDst; ht += yDst; yDst = 0; }
+	if (xSrc < 0) { xDst -= xSrc; wid += xSrc; xSrc = 0; }
+	if (ySrc < 0) { yDst -= ySrc; ht += ySrc; ySrc = 0; }
+
+	// clip against the right and bottom edges of both images
+	wid = min(wid, min(dst.width - xDst, src.width - xSrc));
+	ht = min(ht, min(dst.height - yDst, src.height - ySrc));
+	if (wid <= 0 || ht <= 0)
+		return;
+
+	// blend the rows
+	for (int i = 0; i < ht; ++i)
+	{
+		BYTE *d = dst.Row(yDst + i) + xDst * 4;
+		const BYTE *s = src.Row(ySrc + i) + xSrc * 4;
+		for (int j = 0; j < wid; ++j, d += 4, s += 4)
+		{
+			int a = s[3];
+			if (a == 0xFF)
+			{
+				// opaque - copy the pixel
+				memcpy(d, s, 4);
+			}
+			else if (a != 0)
+			{
+				// translucent - blend it over the destination
+				for (int k = 0; k < 3; ++k)
+					d[k] = (BYTE)((s[k] * a + d[k] * (255 - a) + 127) / 255);
+				d[3] = 0xFF;
+			}
+		}
+	}
+}
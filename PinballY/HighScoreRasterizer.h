@@ -0,0 +1,94 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// High score slide rasterizer
+//
+// This renders the DMD and alphanumeric high score slide styles into
+// 32-bit pixel buffers.  The DMD style draws with the DMDFont glyphs,
+// and the alphanumeric style copies character cells from a decoded
+// segment image atlas.  The rasterizer only works with plain memory
+// buffers, and deliberately has no dependencies on Sprite, D3D, GDI,
+// GDI+, or the Windows API beyond the basic BYTE and TCHAR types, so
+// its output depends only on its inputs.  That makes it safe to call
+// from any thread, and lets the unit tests compare its output against
+// stored golden images.
+//
+
+#pragma once
+#include <list>
+#include <vector>
+#include "DMDFont.h"
+
+class HighScoreRasterizer
+{
+public:
+	// 32-bit pixel image.  The pixels are in DIB byte order (B, G, R, A),
+	// arranged in top-down rows with no padding, so the buffer can be
+	// passed directly to Sprite::Load() with a top-down 32bpp BITMAPINFO
+	// (see HighScoreSlideCache::GetBitmapInfo()).
+	struct Image
+	{
+		Image() : width(0), height(0) { }
+
+		// allocate the buffer for the given size
+		void Alloc(int width, int height);
+
+		// fill the whole image with one color
+		void Fill(const BYTE bgra[4]);
+
+		// get a row pointer
+		BYTE *Row(int y) { return pix.data() + (size_t)y * width * 4; }
+		const BYTE *Row(int y) const { return pix.data() + (size_t)y * width * 4; }
+
+		int width;
+		int height;
+		std::vector<BYTE> pix;
+	};
+
+	// Alphanumeric segment atlas.  This is an image of the segmented
+	// display glyphs for the first 128 ASCII code points, laid out in
+	// a 16x8 (column x row) grid of equal-sized character cells.
+	struct Atlas : Image
+	{
+		int CellWidth() const { return width / 16; }
+		int CellHeight() const { return height / 8; }
+	};
+
+	// Build the DMD color ramp.  This fills in the 16 brightness levels
+	// used by DMDFont::DrawString32, from the background color (a dim
+	// version of the text color, which simulates the faint glow of the
+	// "off" pixels on a real DMD) to the full text color.
+	static void BuildColorRamp(DMDFont::Color colors[16], BYTE r, BYTE g, BYTE b);
+
+	// Render a DMD-style slide.  This draws the lines of the group
+	// centered in a 128x32 image, using the given font.
+	static void RenderDMD(Image &image, const std::list<TSTRING> &group,
+		const DMDFont *font, const DMDFont::Color colors[16]);
+
+	// Count the character cells in an alphanumeric string.  This is
+	// slightly more complicated than just counting the characters,
+	// because a '.' or ',' combines with the previous character: the
+	// dot/comma element in each cell can be "illuminated" in addition
+	// to any other glyph.
+	static int CountAlphaCells(const TCHAR *str);
+
+	// Figure the alphanumeric grid size for a slide show.  Real segmented
+	// displays have fixed character cells, so the simulation is most
+	// convincing if every slide is shown on the same grid.  We start
+	// with the 2x16 layout of the 1990-91 Williams machines, and expand
+	// it as needed to fit the largest group.
+	static void GetAlphaGridSize(const std::list<std::list<TSTRING>> &messages,
+		int &gridWid, int &gridHt);
+
+	// Render an alphanumeric-style slide.  This sizes the image to fit
+	// the grid, padded out to a 4:1 aspect ratio, and draws the lines of
+	// the group centered in the grid.
+	static void RenderAlpha(Image &image, const Atlas &atlas,
+		const std::list<TSTRING> &group, int gridWid, int gridHt);
+
+	// Composite a rectangle of pixels from one image over another,
+	// using the source alpha.  The destination is treated as opaque.
+	// The rectangle is clipped to both images.
+	static void Composite(Image &dst, int xDst, int yDst,
+		const Image &src, int xSrc, int ySrc, int wid, int ht);
+};
@@ -0,0 +1,151 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// High score slides
+
+#include "stdafx.h"
+#include "HighScoreSlides.h"
+#include "GraphicsUtil.h"
+
+// -----------------------------------------------------------------------
+//
+// Slide cache
+//
+
+HighScoreSlideCache::HighScoreSlideCache()
+{
+}
+
+HighScoreSlideCache::~HighScoreSlideCache()
+{
+}
+
+TSTRING HighScoreSlideCache::MakeKey(const TCHAR *gameId, const TCHAR *style, RGBQUAD txtColor,
+	const std::list<std::list<TSTRING>> &messages)
+{
+	// Hash the message text with 64-bit FNV-1a.  Include a separator
+	// after each line and each group, so that the same text broken up
+	// differently yields a different hash.
+	UINT64 hash = 14695981039346656037ULL;
+	auto Add = [&hash](TCHAR c)
+	{
+		hash ^= (UINT64)c;
+		hash *= 1099511628211ULL;
+	};
+	for (auto &group : messages)
+	{
+		for (auto &s : group)
+		{
+			for (const TCHAR *p = s.c_str(); *p != 0; ++p)
+				Add(*p);
+			Add('\n');
+		}
+		Add('\f');
+	}
+
+	// combine the elements into the key
+	return MsgFmt(_T("%s|%s|%02x%02x%02x|%016I64x"),
+		gameId, style, txtColor.rgbRed, txtColor.rgbGreen, txtColor.rgbBlue, hash).Get();
+}
+
+void HighScoreSlideCache::CopySlides(std::list<Slide> &dst, const std::list<Slide> &src)
+{
+	dst.clear();
+	for (auto &s : src)
+	{
+		auto &d = dst.emplace_back();
+		d.sprite = s.sprite;
+		d.displayTime = s.displayTime;
+	}
+}
+
+bool HighScoreSlideCache::Get(const TCHAR *key, std::list<Slide> &slides)
+{
+	// look up the key
+	auto it = cacheIndex.find(key);
+	if (it == cacheIndex.end())
+		return false;
+
+	// move it to the front of the LRU list
+	cache.splice(cache.begin(), cache, it->second);
+
+	// return the slides
+	CopySlides(slides, it->second->slides);
+	return true;
+}
+
+void HighScoreSlideCache::Add(const TCHAR *key, const std::list<Slide> &slides)
+{
+	// if the key is already present, just replace the slides
+	if (auto it = cacheIndex.find(key); it != cacheIndex.end())
+	{
+		cache.splice(cache.begin(), cache, it->second);
+		CopySlides(it->second->slides, slides);
+		return;
+	}
+
+	// evict the least recently used entry if we're at capacity
+	if (cache.size() >= capacity)
+	{
+		cacheIndex.erase(cache.back().key);
+		cache.pop_back();
+	}
+
+	// add the new entry at the front
+	auto &e = cache.emplace_front();
+	e.key = key;
+	CopySlides(e.slides, slides);
+	cacheIndex.emplace(e.key, cache.begin());
+}
+
+void HighScoreSlideCache::Clear()
+{
+	cacheIndex.clear();
+	cache.clear();
+}
+
+const HighScoreRasterizer::Atlas *HighScoreSlideCache::GetResourceImage(int resid)
+{
+	// decoded images, by resource ID
+	static CriticalSection lock;
+	static std::unordered_map<int, std::unique_ptr<HighScoreRasterizer::Atlas>> images;
+
+	// if we've already decoded it, return the cached copy
+	CriticalSectionLocker locker(lock);
+	if (auto it = images.find(resid); it != images.end())
+		return it->second.get();
+
+	// Decode the PNG, and copy out the pixels in 32bpp BGRA format.  Cache
+	// the result even on failure, so that we don't keep retrying.
+	std::unique_ptr<HighScoreRasterizer::Atlas> atlas;
+	std::unique_ptr<Gdiplus::Bitmap> bmp(GPBitmapFromPNG(resid));
+	if (bmp != nullptr)
+	{
+		Gdiplus::Rect rc(0, 0, bmp->GetWidth(), bmp->GetHeight());
+		Gdiplus::BitmapData bd;
+		if (bmp->LockBits(&rc, Gdiplus::ImageLockModeRead, PixelFormat32bppARGB, &bd) == Gdiplus::Ok)
+		{
+			atlas.reset(new HighScoreRasterizer::Atlas());
+			atlas->Alloc(rc.Width, rc.Height);
+			for (int y = 0; y < rc.Height; ++y)
+				memcpy(atlas->Row(y), static_cast<const BYTE*>(bd.Scan0) + y * bd.Stride, rc.Width * 4);
+			bmp->UnlockBits(&bd);
+		}
+	}
+
+	// add it to the table and return it
+	auto ret = atlas.get();
+	images.emplace(resid, std::move(atlas));
+	return ret;
+}
+
+void HighScoreSlideCache::GetBitmapInfo(const HighScoreRasterizer::Image &image, BITMAPINFO &bmi)
+{
+	ZeroMemory(&bmi, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	bmi.bmiHeader.biWidth = image.width;
+	bmi.bmiHeader.biHeight = -image.height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+}
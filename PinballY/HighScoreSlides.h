@@ -0,0 +1,91 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// High score slides
+//
+// The DMD window shows a game's high scores as a slide show, using a
+// graphic style that matches the game's era: a dot-matrix display,
+// an alphanumeric segmented display, or a typewritten index card.
+// The DMD and alphanumeric styles are drawn by HighScoreRasterizer
+// (see HighScoreRasterizer.h).  This module provides the cache that
+// keeps the finished slide sprites for recently displayed games, so
+// that returning to a game costs a lookup rather than a re-render.
+// It also holds the decoded segment and index card images, which are
+// otherwise re-decoded from the embedded PNGs on every render.
+//
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include "HighScoreRasterizer.h"
+#include "Sprite.h"
+
+class HighScoreSlideCache
+{
+public:
+	HighScoreSlideCache();
+	~HighScoreSlideCache();
+
+	// Cached slide
+	struct Slide
+	{
+		Slide() : displayTime(0) { }
+
+		// Slide sprite.  The DMD view only ever shows one slide at a time,
+		// and re-scales each slide when it's installed, so it can use the
+		// cached sprites directly rather than making copies.
+		RefPtr<Sprite> sprite;
+
+		// display time in milliseconds
+		DWORD displayTime;
+	};
+
+	// Build a cache key for a game's slide show.  The key covers
+	// everything that affects the rendered slides: the game, the
+	// display style, the text color, and the high score text itself
+	// (via a hash), so an updated score list or a color change simply
+	// produces a new key.
+	static TSTRING MakeKey(const TCHAR *gameId, const TCHAR *style, RGBQUAD txtColor,
+		const std::list<std::list<TSTRING>> &messages);
+
+	// Look up a slide show.  On success, fills in 'slides' (adding
+	// references to the cached sprites), marks the entry as most
+	// recently used, and returns true.
+	bool Get(const TCHAR *key, std::list<Slide> &slides);
+
+	// Add a slide show to the cache, evicting the least recently used
+	// entry if the cache is full
+	void Add(const TCHAR *key, const std::list<Slide> &slides);
+
+	// discard all cached slides
+	void Clear();
+
+	// Get a decoded image from a PNG resource, loading it on first use.
+	// The decoded images are shared by all threads and kept for the
+	// life of the process.  Returns null if the resource couldn't be
+	// decoded.  This is thread-safe.
+	static const HighScoreRasterizer::Atlas *GetResourceImage(int resid);
+
+	// set up a top-down 32bpp DIB header describing a rasterizer image,
+	// for loading the image into a sprite
+	static void GetBitmapInfo(const HighScoreRasterizer::Image &image, BITMAPINFO &bmi);
+
+protected:
+	// Cache entry.  Slide shows are only created and displayed on the
+	// UI thread, so the cache itself needs no locking.
+	struct Entry
+	{
+		TSTRING key;
+		std::list<Slide> slides;
+	};
+
+	// copy a slide list, adding sprite references
+	static void CopySlides(std::list<Slide> &dst, const std::list<Slide> &src);
+
+	// cached slide shows, most recently used first, and the index by key
+	std::list<Entry> cache;
+	std::unordered_map<TSTRING, std::list<Entry>::iterator> cacheIndex;
+
+	// maximum number of games to keep
+	static const size_t capacity = 32;
+};
@@ -8,13 +8,28 @@
 #include "Application.h"
 #include "PlayfieldView.h"
 #include "DOFClient.h"
+#include "CSVFile.h"
+#include "LogFile.h"
 
 #include <filesystem>
 namespace fs = std::experimental::filesystem;
 
 HighScores::HighScores() :
-	inited(false)
+	inited(false),
+	nWorkers(0),
+	nRunning(0),
+	exclusive(false),
+	gameListGeneration(0),
+	cacheDirty(false),
+	cacheSaveSeq(0),
+	cacheSavedSeq(0)
 {
+	// Use one worker per processor, up to a small limit.  The work is
+	// mostly process startup and file I/O, so there's little benefit
+	// in going wider.
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	maxWorkers = max(1, min((int)si.dwNumberOfProcessors, 4));
 }
 
 HighScores::~HighScores()
@@ -157,10 +172,12 @@ bool HighScores::Init()
 						// find or add a fuzzy ROM lookup entry
 						auto it = self->fuzzyRomFind.find(rootName);
 						if (it == self->fuzzyRomFind.end())
-							it = self->fuzzyRomFind.emplace(
-								std::piecewise_construct,
-								std::forward_as_tuple(rootName),
-								std::forward_as_tuple(rootName.c_str())).first;
+						{
+							// add the entry, and index its title for fuzzy matching
+							it = self->fuzzyRomFind.emplace(rootName, FuzzyRomEntry()).first;
+							self->fuzzyRomIndex.Add((int)self->fuzzyRomList.size(), rootName.c_str());
+							self->fuzzyRomList.push_back(&it->second);
+						}
 
 						// add this NVRAM file to the lookup entry's list
 						it->second.nvFiles.push_back(val);
@@ -178,6 +195,9 @@ bool HighScores::Init()
 			}
 		}
 
+		// load the high score cache
+		self->LoadCache();
+
 		// initialization is complete
 		self->inited = true;
 
@@ -469,27 +489,18 @@ bool HighScores::GetAllNvramFiles(std::list<TSTRING> &nvList, const TCHAR *gameT
 	title = std::regex_replace(title, punctPat, _T(""));
 
 	// get its bigram set
-	DiceCoefficient::BigramSet<CHAR> bigrams;
-	DiceCoefficient::BuildBigramSet(bigrams, TSTRINGToCSTRING(title).c_str());
+	FuzzyMatchIndex::BigramSet bigrams;
+	FuzzyMatchIndex::BuildBigramSet(bigrams, TSTRINGToCSTRING(title).c_str());
 
 	// search for the best match in the [romfind] list
-	float bestScore = 0.0f;
-	const FuzzyRomEntry *bestMatch = nullptr;
-	for (auto const &f : fuzzyRomFind)
-	{
-		float score = DiceCoefficient::DiceCoefficient(bigrams, f.second.bigrams);
-		if (score > bestScore)
-		{
-			bestScore = score;
-			bestMatch = &f.second;
-		}
-	}
+	std::vector<FuzzyMatchIndex::Match> matches;
+	fuzzyRomIndex.Search(matches, { &bigrams }, 0.7f, 1);
 
 	// if we found a good enough match, return its NVRAM list
-	if (bestScore > 0.7f)
+	if (matches.size() != 0)
 	{
 		// pass back the list
-		for (auto const &f : bestMatch->nvFiles)
+		for (auto const &f : fuzzyRomList[matches[0].id]->nvFiles)
 			nvList.emplace_back(CSTRINGToTSTRING(f));
 
 		// success
@@ -504,8 +515,8 @@ bool HighScores::GetVersion(HWND hwndNotify)
 {
 	// enqueue a version request, with the "-v" option
 	TSTRING empty;
-	EnqueueThread(new Thread(_T(" -v"), ProgramVersionQuery,
-		nullptr, empty, empty, this, nullptr, hwndNotify));
+	Enqueue(new Request(_T(" -v"), ProgramVersionQuery,
+		nullptr, empty, empty, nullptr, hwndNotify, false, gameListGeneration));
 
 	// success
 	return true;
@@ -543,110 +554,348 @@ bool HighScores::GetScores(GameListItem *game, HWND hwndNotify)
 	// Enqueue the request.  The command line is simply the name of the 
 	// NVRAM file, but note that PINemHi seems to require the command line
 	// to be constructed with a space before the first token.
-	EnqueueThread(new Thread(
+	Enqueue(new Request(
 		MsgFmt(_T(" %s"), nvramFile.c_str()), HighScoreQuery,
-		game, nvramPath, nvramFile, this, pathEntry, hwndNotify));
+		game, nvramPath, nvramFile, pathEntry, hwndNotify, false, gameListGeneration));
 
 	// the request was successfully submitted
 	return true;
 }
 
-void HighScores::EnqueueThread(Thread *thread)
+void HighScores::RefreshAll(HWND hwndNotify)
+{
+	// We can't proceed if initialization hasn't finished yet
+	if (!IsInited())
+		return;
+
+	// Queue a batch request for each game that doesn't have its high
+	// scores yet.  Resolving the NVRAM file involves the DOF config
+	// and the game database, which are only safe to access on the UI
+	// thread, so we do that part here.
+	GameList::Get()->EnumGames([this, hwndNotify](GameListItem *game)
+	{
+		// skip games that already have scores, or that have no system
+		if (game->highScoresSet || game->system == nullptr)
+			return;
+
+		// get the NVRAM file and the path entry for the system
+		TSTRING nvramPath, nvramFile;
+		const TSTRING &sysClass = game->system->systemClass;
+		PathEntry *pathEntry = sysClass == _T("VP") || sysClass == _T("VPX") ? &vpPath :
+			sysClass == _T("FP") ? &fpPath :
+			nullptr;
+		if (pathEntry == nullptr || !GetNvramFile(nvramPath, nvramFile, game))
+			return;
+
+		// apply the PINemHi path convention, as in GetScores()
+		if (!tstrEndsWith(nvramPath.c_str(), _T("\\")))
+			nvramPath.append(_T("\\"));
+
+		// enqueue the request
+		Enqueue(new Request(
+			MsgFmt(_T(" %s"), nvramFile.c_str()), HighScoreQuery,
+			game, nvramPath, nvramFile, pathEntry, hwndNotify, true, gameListGeneration));
+	});
+}
+
+void HighScores::OnGameListShutdown()
 {
-	// hold the thread lock while manipulating the queue
 	CriticalSectionLocker lock(threadLock);
 
-	// add the new thread
-	threadQueue.emplace_back(thread);
+	// discard the pending high score requests, since they refer to
+	// games in the old list
+	queue.remove_if([](const std::unique_ptr<Request> &r) { return r->game != nullptr; });
 
-	// If this is the only queue in the thread, launch it immediately.
-	// If there was already a thread in the queue, it's still running,
-	// so it will take care of starting the next thread when it exits.
-	if (threadQueue.size() == 1)
-		LaunchNextThread(nullptr);
+	// start a new generation, so that replies for running requests are
+	// recognizable as stale
+	++gameListGeneration;
 }
 
-void HighScores::LaunchNextThread(Thread *exitingThread)
+void HighScores::Enqueue(Request *request)
 {
-	// hold the thread lock while working
+	// hold the thread lock while manipulating the queue
 	CriticalSectionLocker lock(threadLock);
 
-	// if a thread is exiting, remove it from the queue
-	if (exitingThread != nullptr)
-		threadQueue.remove(exitingThread);
+	// Add the request.  Batch requests go at the end of the queue;
+	// anything else goes ahead of the first batch request, since it's
+	// presumably for something the user is looking at right now.
+	if (request->batch)
+		queue.emplace_back(request);
+	else
+	{
+		auto it = std::find_if(queue.begin(), queue.end(), [](const std::unique_ptr<Request> &r) { return r->batch; });
+		queue.emplace(it, request);
+	}
+
+	// Start a new worker if the pool isn't full.  If that fails, and
+	// there are no other workers to pick up the request, the request
+	// can't be carried out after all.
+	if (nWorkers < maxWorkers && !StartWorker() && nWorkers == 0)
+	{
+		// Send a notification reply to the caller to let them know
+		// that the request is finished (unsuccessfully).  Note that
+		// we're on the caller's thread, so the caller can't be waiting
+		// for the lock we're holding.
+		auto it = std::find_if(queue.begin(), queue.end(), [request](const std::unique_ptr<Request> &r) { return r.get() == request; });
+		std::unique_ptr<Request> r(std::move(*it));
+		queue.erase(it);
+		NotifyInfo ni(r->queryType, r->game, r->batch, r->gameListGeneration);
+		ni.status = NotifyInfo::ThreadLaunchFailed;
+		::SendMessage(r->hwndNotify, HSMsgHighScores, 0, reinterpret_cast<LPARAM>(&ni));
+	}
+}
+
+bool HighScores::StartWorker()
+{
+	// add a reference on behalf of the thread
+	AddRef();
+
+	// launch the thread
+	DWORD tid;
+	HandleHolder hThread(CreateThread(NULL, 0, &HighScores::SWorkerMain, this, 0, &tid));
+	if (hThread == NULL)
+	{
+		Release();
+		return false;
+	}
+
+	// count the new worker
+	++nWorkers;
+	return true;
+}
+
+DWORD WINAPI HighScores::SWorkerMain(LPVOID param)
+{
+	// take over the reference the launcher added for us
+	RefPtr<HighScores> self(static_cast<HighScores*>(param));
+
+	// run the worker
+	self->WorkerMain();
+
+	// done
+	return 0;
+}
 
-	// get the next thread out of the queue and launch it
-	while (threadQueue.size() != 0)
+void HighScores::WorkerMain()
+{
+	// process requests until the queue runs dry
+	std::unique_ptr<Request> request;
+	for (;;)
 	{
-		// get the next thread on the queue
-		Thread *thread = threadQueue.front();
+		// copy of the cache to save, if we're the last worker to finish
+		std::unique_ptr<CacheMap> cacheCopy;
+		DWORD cacheSeq = 0;
+		{
+			CriticalSectionLocker lock(threadLock);
+
+			// if we just finished a request, count it as done
+			if (request != nullptr)
+			{
+				--nRunning;
+				exclusive = false;
+				request.reset();
+			}
+
+			// get the next request; if there isn't one we can run now,
+			// the worker is done
+			if (TakeNextRequest(request))
+			{
+				// count the running request
+				++nRunning;
+			}
+			else if (--nWorkers == 0 && cacheDirty)
+			{
+				// This was the last worker, so the batch is finished, and
+				// it's a good time to save the cache.  Take a copy to write
+				// after we release the lock, so that the file I/O doesn't
+				// hold up the other threads.
+				cacheCopy.reset(new CacheMap(cache));
+				cacheSeq = ++cacheSaveSeq;
+				cacheDirty = false;
+			}
+		}
 
-		// launch it
-		DWORD tid;
-		HandleHolder hThread(CreateThread(NULL, 0, &Thread::SMain, thread, 0, &tid));
+		// if there's nothing more to run, the worker is done
+		if (request == nullptr)
+		{
+			if (cacheCopy != nullptr)
+				SaveCache(*cacheCopy, cacheSeq);
 
-		// If that succeeded, we're done - simply return and let the
-		// thread launch the next thread in the queue.
-		if (hThread != NULL)
 			return;
+		}
 
-		// The thread launch failed, so this request can't be
-		// carried out after all.  Send a notification reply
-		// to the caller to let them know that the request is
-		// finished (unsuccessfully).
-		NotifyInfo ni(thread->queryType, thread->game);
-		ni.status = NotifyInfo::ThreadLaunchFailed;
-		::SendMessage(thread->hwndNotify, HSMsgHighScores, 0, reinterpret_cast<LPARAM>(&ni));
+		// run the request
+		RunRequest(request.get());
+	}
+}
+
+bool HighScores::TakeNextRequest(std::unique_ptr<Request> &request)
+{
+	// if a request is running in exclusive mode, nothing else can start
+	if (exclusive || queue.size() == 0)
+		return false;
 
-		// failed - discard this thread and try the next one
-		threadQueue.pop_front();
+	// Find the first request that can run with the INI file as it is
+	// now: a general query that doesn't use the NVRAM paths, or a high
+	// score query for an NVRAM folder that matches the current path
+	// setting for its system.  Those can run alongside whatever else
+	// is running.
+	for (auto it = queue.begin(); it != queue.end(); ++it)
+	{
+		auto &r = *it;
+		if (r->pathEntry == nullptr || r->pathEntry->path == TSTRINGToCSTRING(r->nvramPath))
+		{
+			request = std::move(r);
+			queue.erase(it);
+			return true;
+		}
 	}
+
+	// Every pending request needs an INI file update.  We can only do
+	// that when nothing else is running, since any running PINemHi
+	// process might be reading the file.  If other requests are
+	// running, leave this for the last of them to pick up when it
+	// finishes.  Otherwise, take the first request, and run it in
+	// exclusive mode.
+	if (nRunning != 0)
+		return false;
+
+	request = std::move(queue.front());
+	queue.pop_front();
+	exclusive = true;
+	return true;
+}
+
+bool HighScores::GetCacheKey(const Request *request, TSTRING &key, UINT64 &modTime)
+{
+	// build the full NVRAM file path
+	TCHAR path[MAX_PATH];
+	PathCombine(path, request->nvramPath.c_str(), request->nvramFile.c_str());
+
+	// get the file's modification time
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (!GetFileAttributesEx(path, GetFileExInfoStandard, &attrs))
+		return false;
+	modTime = (UINT64(attrs.ftLastWriteTime.dwHighDateTime) << 32) | attrs.ftLastWriteTime.dwLowDateTime;
+
+	// key on the lower-case path
+	key = path;
+	std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+	return true;
 }
 
-HighScores::Thread::Thread(
-	const TCHAR *cmdline, QueryType queryType,
-	GameListItem *game, const TSTRING &nvramPath, const TSTRING &nvramFile,
-	HighScores *hs, PathEntry *pathEntry, HWND hwndNotify) :
-	cmdline(cmdline),
-	queryType(queryType),
-	hwndNotify(hwndNotify),
-	game(game),
-	nvramPath(nvramPath),
-	nvramFile(nvramFile),
-	pathEntry(pathEntry)
+TSTRING HighScores::GetCacheFilename()
 {
-	// explicitly assign the high score object so that we count the reference
-	this->hs = hs;
+	TCHAR buf[MAX_PATH];
+	GetDeployedFilePath(buf, _T("HighScoreCache.csv"), _T(""));
+	return buf;
 }
 
-DWORD HighScores::Thread::SMain(LPVOID param)
+void HighScores::LoadCache()
 {
-	// get a unique pointer to the thread, so that we delete it on exit
-	std::unique_ptr<Thread> self(reinterpret_cast<Thread*>(param));
+	// read the file, if it exists
+	CSVFile csv;
+	TSTRING filename = GetCacheFilename();
+	csv.SetFile(filename.c_str());
+	if (!FileExists(filename.c_str()) || !csv.Read(SilentErrorHandler()))
+		return;
+
+	// load the entries
+	auto fileCol = csv.DefineColumn(_T("NVRAM File"));
+	auto timeCol = csv.DefineColumn(_T("Modified"));
+	auto scoresCol = csv.DefineColumn(_T("Scores"));
+	CriticalSectionLocker lock(threadLock);
+	for (int i = 0, n = (int)csv.GetNumRows(); i < n; ++i)
+	{
+		if (const TCHAR *file = fileCol->Get(i); file != nullptr && file[0] != 0)
+		{
+			cache.emplace(file, CacheEntry(
+				_tcstoui64(timeCol->Get(i, _T("0")), nullptr, 10),
+				scoresCol->Get(i, _T(""))));
+		}
+	}
+}
 
-	// run the thread main entrypoint
-	self->Main();
+void HighScores::SaveCache(const CacheMap &entries, DWORD seq)
+{
+	// Only one thread can write the file at a time.  If another thread
+	// has already written a newer copy, there's nothing to do.
+	CriticalSectionLocker fileLock(cacheFileLock);
+	if (seq <= cacheSavedSeq)
+		return;
 
-	// before exiting, launch the next thread
-	self->hs->LaunchNextThread(self.get());
+	// build the CSV file
+	CSVFile csv;
+	TSTRING filename = GetCacheFilename();
+	csv.SetFile(filename.c_str());
+	auto fileCol = csv.DefineColumn(_T("NVRAM File"));
+	auto timeCol = csv.DefineColumn(_T("Modified"));
+	auto scoresCol = csv.DefineColumn(_T("Scores"));
+	for (auto const &e : entries)
+	{
+		int row = csv.CreateRow();
+		fileCol->Set(row, e.first.c_str());
+		timeCol->Set(row, MsgFmt(_T("%I64u"), e.second.modTime));
+		scoresCol->Set(row, e.second.results.c_str());
+	}
 
-	// done
-	return 0;
+	// write it; the cache is only an optimization, so just log failures
+	CapturingErrorHandler eh;
+	if (csv.Write(eh))
+	{
+		cacheSavedSeq = seq;
+	}
+	else
+	{
+		// mark the cache as dirty again, so that the next batch retries
+		LogFile::Get()->Write(LogFile::Warning, LogFile::SysHighScores, _T("Unable to write high score cache file %s\n"), filename.c_str());
+		CriticalSectionLocker lock(threadLock);
+		cacheDirty = true;
+	}
 }
 
-void HighScores::Thread::Main()
+void HighScores::RunRequest(Request *request)
 {
 	// Set up the results object to send to the notifier window.
 	// We'll send a notification whether we succeed or fail.
-	NotifyInfo ni(queryType, game);
+	NotifyInfo ni(request->queryType, request->game, request->batch, request->gameListGeneration);
 
 	// send the result message to the notification window
-	auto SendResult = [&ni, this](NotifyInfo::Status status)
+	auto SendResult = [&ni, request](NotifyInfo::Status status)
 	{
 		ni.status = status;
-		SendMessage(hwndNotify, HSMsgHighScores, 0, reinterpret_cast<LPARAM>(&ni));
+		SendMessage(request->hwndNotify, HSMsgHighScores, 0, reinterpret_cast<LPARAM>(&ni));
 	};
 
+	// For a high score query, check the cache.  If we have results for
+	// the NVRAM file, and the file hasn't changed since we got them,
+	// we can send back the cached results without running PINemHi.
+	TSTRING cacheKey;
+	UINT64 modTime = 0;
+	bool cacheable = request->queryType == HighScoreQuery && GetCacheKey(request, cacheKey, modTime);
+	if (cacheable)
+	{
+		bool found = false;
+		{
+			CriticalSectionLocker lock(threadLock);
+			if (auto it = cache.find(cacheKey); it != cache.end() && it->second.modTime == modTime)
+			{
+				ni.results = it->second.results;
+				found = true;
+			}
+		}
+
+		if (found)
+		{
+			SendResult(NotifyInfo::Success);
+			return;
+		}
+	}
+
+	// pull out the request parameters
+	PathEntry *pathEntry = request->pathEntry;
+	const TSTRING &nvramPath = request->nvramPath;
+
 	// Check to see if the current INI file path matches the one we
 	// inferred for this game.  If not, rewrite the INI file with the
 	// new path.  We do this for two reasons: first, so that the user
@@ -664,20 +913,18 @@ void HighScores::Thread::Main()
 	//
 	// Note that the pathEntry object is inside the shared HighScores
 	// object, so it might seem like we should hold the thread lock
-	// here.  We don't actually have to do that, though, because we
-	// only mess with the pathEntry objects within the launcher
-	// threads, and our thread dispatch setup ensures that only one
-	// of these threads is running at a time.
+	// here.  We don't actually have to do that, though, because the
+	// dispatcher (TakeNextRequest) only gives us a request with a
+	// path mismatch when no other request is running, and it doesn't
+	// start anything else until we finish.
 	//
 	// By the same token, the file itself is a shared resource among
-	// the launcher threads, since every invocation of PINemHi will
-	// read the file.  So we can't have one thread updating the file 
-	// while another thread is launching PINemHi.  That's actually the
-	// larger reason that we serialize execution of the launcher
-	// threads: going one at a time ensures that each PINemHi instance
-	// reads the version of the INI file that we prepared for it in 
-	// the same thread and eliminates any confusion about the order
-	// of events.
+	// the workers, since every invocation of PINemHi will read the
+	// file.  So we can't have one thread updating the file while
+	// another thread is launching PINemHi.  The same exclusive-mode
+	// rule takes care of that: each PINemHi instance that runs
+	// concurrently with others reads the same INI file contents, and
+	// a request that changes the file runs alone.
 	//
 	// If there's no path entry, it means that we're running PINemHi
 	// for a generic query (to get the program verion number, for
@@ -687,17 +934,17 @@ void HighScores::Thread::Main()
 	{
 		// open the INI file
 		FILE *fp;
-		if (_tfopen_s(&fp, hs->iniFileName.c_str(), _T("w")) == 0)
+		if (_tfopen_s(&fp, iniFileName.c_str(), _T("w")) == 0)
 		{
 			// write the contents
-			for (size_t i = 0; i < hs->iniLines.size(); ++i)
+			for (size_t i = 0; i < iniLines.size(); ++i)
 			{
 				// if this is the line we're updating, update it;
 				// otherwise just copy the original
 				if (i == pathEntry->lineNo)
 					fprintf(fp, "%s=%s\n", pathEntry->name.c_str(), nvramPathC.c_str());
 				else
-					fprintf(fp, "%s\n", hs->iniLines[i]);
+					fprintf(fp, "%s\n", iniLines[i]);
 			}
 
 			// if this entry didn't originally have an entry, add one for it
@@ -747,7 +994,7 @@ void HighScores::Thread::Main()
 	// onto the screen briefly.
 	PROCESS_INFORMATION pinfo;
 	ZeroMemory(&pinfo, sizeof(pinfo));
-	if (!CreateProcess(exe, cmdline.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW,
+	if (!CreateProcess(exe, request->cmdline.data(), NULL, NULL, TRUE, CREATE_NO_WINDOW,
 		NULL, folder, &sinfo, &pinfo))
 	{
 		SendResult(NotifyInfo::ProcessLaunchFailed);
@@ -771,12 +1018,20 @@ void HighScores::Thread::Main()
 		// Success - read the results
 		CHAR buf[4096];
 		DWORD bytesRead;
-		while (ReadFile(hReadPipe, buf, sizeof(buf), &bytesRead, NULL) && bytesRead != 0)
+		while (ReadFile(hReadPipe, buf, sizeof(buf) - 1, &bytesRead, NULL) && bytesRead != 0)
 		{
 			buf[bytesRead] = 0;
 			ni.results.append(AnsiToTSTRING(buf));
 		}
 
+		// cache the results for the NVRAM file
+		if (cacheable)
+		{
+			CriticalSectionLocker lock(threadLock);
+			cache[cacheKey] = CacheEntry(modTime, ni.results);
+			cacheDirty = true;
+		}
+
 		// Notify the callback window of the result
 		SendResult(NotifyInfo::Success);
 	}
@@ -9,10 +9,25 @@
 // the little data files that VPinMAME uses to emulate non-volatile RAM 
 // for ROM-based games; for FP, it uses the equivalent that FP uses to
 // store settings for its scripted games.
+//
+// Queries run on a small pool of worker threads, each of which runs
+// one PINemHi process at a time.  PINemHi reads its NVRAM paths from
+// its INI file, which we rewrite as needed to point to the right
+// folder for each game, so the pool only runs queries concurrently
+// when they all use the current INI settings.  A query that needs a
+// different path waits until the pool is idle, then runs by itself.
+//
+// Results are cached by NVRAM file, along with the file's modification
+// time, and the cache is saved to disk between sessions.  As long as
+// the NVRAM file hasn't changed since the last query, we can answer
+// from the cache without running PINemHi at all.  We use this to run
+// a background batch refresh of the high scores for all games after
+// startup and after each game session, so that the scores are usually
+// already loaded by the time the user selects a game.
 // 
 
 #pragma once
-#include "DiceCoefficient.h"
+#include "FuzzyMatch.h"
 
 class ErrorHandler;
 class GameListItem;
@@ -109,6 +124,24 @@ public:
 	// kind of results.
 	bool GetScores(GameListItem *game, HWND hwndNotify);
 
+	// Refresh the high scores for all games in the background.  This
+	// queues a low-priority request for each game whose high scores
+	// haven't been loaded yet.  Results are sent to the notification
+	// window as HSMsgHighScores messages, as with GetScores(), with the
+	// 'batch' flag set in the notification.  Interactive requests made
+	// via GetScores() take priority over pending batch requests.
+	void RefreshAll(HWND hwndNotify);
+
+	// Discard pending requests for the current game list.  The game
+	// list must call this before deleting its game objects, since
+	// pending requests refer to them.  Replies for requests that are
+	// already running will be sent with the old game list generation
+	// number, which tells the receiver to ignore them.
+	void OnGameListShutdown();
+
+	// Get the current game list generation number
+	DWORD GetGameListGeneration() const { return gameListGeneration; }
+
 	// Get the PINemHi version information.  This runs PINemHi in the
 	// background with the -v option (to retrieve the program version
 	// data).  Sends a HSMsgHighScores message to the notification
@@ -130,10 +163,12 @@ public:
 	// this as constant data.
 	struct NotifyInfo
 	{
-		NotifyInfo(QueryType queryType, GameListItem *game) :
+		NotifyInfo(QueryType queryType, GameListItem *game, bool batch = false, DWORD gameListGeneration = 0) :
 			status(Success),
 			queryType(queryType),
-			game(game)
+			game(game),
+			batch(batch),
+			gameListGeneration(gameListGeneration)
 		{ }
 
 		// query type
@@ -142,6 +177,15 @@ public:
 		// game we're fetching high scores for
 		GameListItem *game;
 
+		// is this the result of a batch refresh request?
+		bool batch;
+
+		// Game list generation at the time of the request.  If this
+		// doesn't match the current generation, the game list has been
+		// reloaded since the request was made, so 'game' is no longer
+		// valid.
+		DWORD gameListGeneration;
+
 		// status
 		enum Status
 		{
@@ -218,8 +262,8 @@ protected:
 
 	// Fuzzy ROM match table.  This is a list of the friendly
 	// names for the ROMs, with the version variation suffixes
-	// removed, and stored with their bigram sets for fuzzy
-	// matching via a Dice coefficient search.  The friendly
+	// removed, and indexed for fuzzy matching via a Dice
+	// coefficient search (see fuzzyRomIndex).  The friendly
 	// names are usually the table titles, so this lets us 
 	// search based on the table title from the game database.
 	// The snag is that most tables have multiple ROM versions
@@ -229,15 +273,6 @@ protected:
 	// versions of the ROM.
 	struct FuzzyRomEntry
 	{
-		FuzzyRomEntry(const CHAR *title)
-		{
-			// pre-compute the bigram set from the title
-			DiceCoefficient::BuildBigramSet(bigrams, title);
-		}
-
-		// title bigram set for fuzzy matching
-		DiceCoefficient::BigramSet<CHAR> bigrams;
-
 		// list of associated .nv files
 		std::list<CSTRING> nvFiles;
 	};
@@ -245,21 +280,26 @@ protected:
 	// map of fuzzy-lookup ROM entries, keyed by title
 	std::unordered_map<CSTRING, FuzzyRomEntry> fuzzyRomFind;
 
-	// Lock for resources accessed from the background thread
+	// Fuzzy match index of the fuzzyRomFind titles.  The IDs in the
+	// index are indices into fuzzyRomList, which points to the map
+	// entries.
+	FuzzyMatchIndex fuzzyRomIndex;
+	std::vector<const FuzzyRomEntry*> fuzzyRomList;
+
+	// Lock for resources accessed from the worker threads.  This
+	// protects the request queue, the worker counters, and the cache.
 	CriticalSection threadLock;
 
-	// Background thread to read the high score file
-	class Thread
+	// Query request
+	struct Request
 	{
-	public:
-		Thread(const TCHAR *cmdline, QueryType queryType,
-			GameListItem *game,	const TSTRING &nvramPath, const TSTRING &nvramFile,
-			HighScores *hs, PathEntry *pathEntry,
-			HWND hwndNotify);
-
-		// main entrypoint
-		static DWORD WINAPI SMain(LPVOID param);
-		void Main();
+		Request(const TCHAR *cmdline, QueryType queryType,
+			GameListItem *game, const TSTRING &nvramPath, const TSTRING &nvramFile,
+			PathEntry *pathEntry, HWND hwndNotify, bool batch, DWORD gameListGeneration) :
+			cmdline(cmdline), queryType(queryType), hwndNotify(hwndNotify),
+			game(game), nvramPath(nvramPath), nvramFile(nvramFile), pathEntry(pathEntry),
+			batch(batch), gameListGeneration(gameListGeneration)
+		{ }
 
 		// Command line to send to PINemHi
 		TSTRING cmdline;
@@ -267,9 +307,6 @@ protected:
 		// query type
 		QueryType queryType;
 
-		// high scores object
-		RefPtr<HighScores> hs;
-
 		// notification window - we send this window a message
 		// when finished to give it the new high score information
 		HWND hwndNotify;
@@ -287,18 +324,92 @@ protected:
 		// if we're running PINemHi for a general query, such as
 		// a program version check.
 		PathEntry *pathEntry;
+
+		// is this a batch refresh request?
+		bool batch;
+
+		// game list generation at the time of the request
+		DWORD gameListGeneration;
 	};
 
-	// Enqueue a thread
-	void EnqueueThread(Thread *thread);
+	// Enqueue a request, and start a worker thread to handle it if
+	// the pool isn't already at capacity.  Batch requests go at the
+	// end of the queue; other requests go ahead of any batch requests.
+	void Enqueue(Request *request);
 
-	// launch the next thread
-	void LaunchNextThread(Thread *exitingThread = nullptr);
+	// Start a new worker thread.  Returns true on success.
+	bool StartWorker();
 
-	// To simplify concurrent issues in our background threads,
-	// we only run one thread a time.  We queue pending threads
-	// here.  When one thread is about to exit, it launches the
-	// next one from the queue.
-	std::list<Thread*> threadQueue;
-};
+	// worker thread entrypoint
+	static DWORD WINAPI SWorkerMain(LPVOID param);
+	void WorkerMain();
+
+	// Take the next request that can run now off the queue.  The
+	// caller must hold the thread lock.  Returns false if there are no
+	// requests that can run right now, in which case the worker should
+	// exit.  (Any requests still in the queue will be picked up by the
+	// workers that are still running.)
+	bool TakeNextRequest(std::unique_ptr<Request> &request);
+
+	// Run a request on a worker thread
+	void RunRequest(Request *request);
+
+	// Pending requests, in priority order
+	std::list<std::unique_ptr<Request>> queue;
+
+	// Maximum number of worker threads, current number of worker
+	// threads, and number of workers currently running a request
+	int maxWorkers;
+	int nWorkers;
+	int nRunning;
+
+	// Exclusive mode.  This is set while a request that had to update
+	// the PINemHi INI file is running.  No other requests can start
+	// while this is set.
+	bool exclusive;
+
+	// Game list generation number.  OnGameListShutdown() increments
+	// this, to invalidate replies for requests against the old list.
+	DWORD gameListGeneration;
 
+	// High score cache entry
+	struct CacheEntry
+	{
+		CacheEntry() : modTime(0) { }
+		CacheEntry(UINT64 modTime, const TSTRING &results) : modTime(modTime), results(results) { }
+
+		// NVRAM file modification time at the time of the query
+		UINT64 modTime;
+
+		// PINemHi output
+		TSTRING results;
+	};
+
+	// High score cache, keyed by the full NVRAM file path, in lower case
+	typedef std::unordered_map<TSTRING, CacheEntry> CacheMap;
+	CacheMap cache;
+
+	// has the cache been updated since it was last saved?
+	bool cacheDirty;
+
+	// Cache save sequence numbers.  Each copy of the cache taken for
+	// saving gets the next sequence number, under threadLock.  The file
+	// writer records the sequence number of the last copy it wrote, so
+	// that a slow writer can't overwrite a newer copy with an older one.
+	DWORD cacheSaveSeq;
+	DWORD cacheSavedSeq;
+
+	// Cache file lock.  This serializes writes to the cache file.  It's
+	// separate from threadLock so that the file I/O doesn't block the
+	// worker threads.
+	CriticalSection cacheFileLock;
+
+	// Get the cache key and modification time for an NVRAM file.  Returns
+	// false if the file doesn't exist.
+	static bool GetCacheKey(const Request *request, TSTRING &key, UINT64 &modTime);
+
+	// load/save the cache file
+	static TSTRING GetCacheFilename();
+	void LoadCache();
+	void SaveCache(const CacheMap &entries, DWORD seq);
+};
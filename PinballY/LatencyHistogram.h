@@ -0,0 +1,88 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Latency histogram
+//
+// This accumulates a distribution of latency samples for display in
+// the frame counter overlay.  The buckets are powers of two in
+// milliseconds (under 1ms, 1-2ms, 2-4ms, ... 128ms and up), which
+// gives useful resolution over the range that matters for input
+// response: a few milliseconds of event handling up through several
+// frame times.  Percentiles are estimated from the buckets, so they're
+// reported as the upper bound of the bucket containing the percentile.
+
+#pragma once
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram() { Reset(); }
+
+	// number of buckets
+	static const int nBuckets = 9;
+
+	// clear all samples
+	void Reset()
+	{
+		for (int i = 0; i < nBuckets; ++i)
+			buckets[i] = 0;
+		count = 0;
+		total_ms = 0.0;
+		max_ms = 0.0;
+	}
+
+	// add a sample
+	void Add(double ms)
+	{
+		// find the bucket: 0 for <1ms, 1 for 1-2ms, 2 for 2-4ms, etc
+		int b = 0;
+		for (double limit = 1.0; b < nBuckets - 1 && ms >= limit; limit *= 2.0)
+			++b;
+
+		++buckets[b];
+		++count;
+		total_ms += ms;
+		if (ms > max_ms)
+			max_ms = ms;
+	}
+
+	// Get the upper bound of the bucket containing the given percentile
+	// (0-100), in milliseconds.  The last bucket is open-ended, so we
+	// use the maximum sample for that one.
+	double Percentile(double pct) const
+	{
+		UINT64 target = static_cast<UINT64>(count * pct / 100.0);
+		UINT64 n = 0;
+		double limit = 1.0;
+		for (int b = 0; b < nBuckets - 1; ++b, limit *= 2.0)
+		{
+			n += buckets[b];
+			if (n > target)
+				return limit;
+		}
+		return max_ms;
+	}
+
+	// Format a summary line for the overlay, with the sample count,
+	// average, median, 95th percentile, maximum, and bucket counts
+	TSTRING Format(const TCHAR *label) const
+	{
+		if (count == 0)
+			return MsgFmt(_T("%s: no samples"), label).Get();
+
+		TSTRING s = MsgFmt(_T("%s: n=%I64u, avg %.1fms, p50 <%.0fms, p95 <%.0fms, max %.1fms ["),
+			label, count, total_ms / count, Percentile(50), Percentile(95), max_ms).Get();
+		for (int b = 0; b < nBuckets; ++b)
+			s += MsgFmt(b == 0 ? _T("%I64u") : _T(" %I64u"), buckets[b]).Get();
+		s += _T("]");
+		return s;
+	}
+
+	// bucket counts
+	UINT64 buckets[nBuckets];
+
+	// number of samples, sum, and maximum
+	UINT64 count;
+	double total_ms;
+	double max_ms;
+};
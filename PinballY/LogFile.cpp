@@ -7,12 +7,26 @@
 #include <fcntl.h>
 #include "LogFile.h"
 #include "DateUtil.h"
+#include "PerfMon.h"
 
 // statics
 LogFile *LogFile::inst = nullptr;
+LPTOP_LEVEL_EXCEPTION_FILTER LogFile::prevCrashFilter = nullptr;
 
-LogFile::LogFile()
+// config variables
+namespace ConfigVars
 {
+	static const TCHAR *LogLevel = _T("Log.Level");
+	static const TCHAR *LogSubsystems = _T("Log.Subsystems");
+}
+
+LogFile::LogFile() :
+	minLevel(Info),
+	subsystemMask(SysAll)
+{
+	// set up the message queue
+	InitializeSListHead(&queue);
+
 	// build the filename - <program folder>\PinballY.log
 	TCHAR fname[MAX_PATH];
 	GetExeFilePath(fname, countof(fname));
@@ -28,6 +42,18 @@ LogFile::LogFile()
 	h = CreateFile(fname, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, &sa,
 		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
+	// start the writer thread
+	if (h != INVALID_HANDLE_VALUE)
+	{
+		hShutdownEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		DWORD tid;
+		hWriterThread = CreateThread(NULL, 0, &SWriterMain, this, 0, &tid);
+	}
+
+	// subscribe for config updates
+	if (auto cfg = ConfigManager::GetInstance(); cfg != nullptr)
+		cfg->Subscribe(this);
+
 	// write the starting time
 	if (h != INVALID_HANDLE_VALUE)
 	{
@@ -38,13 +64,30 @@ LogFile::LogFile()
 
 LogFile::~LogFile()
 {
+	// Stop the writer thread.  Wait for it to exit without a timeout,
+	// since it references the object we're about to delete.  It only
+	// waits on the shutdown event and writes the file, so it won't
+	// keep us waiting long.
+	if (hWriterThread != NULL)
+	{
+		SetEvent(hShutdownEvent);
+		WaitForSingleObject(hWriterThread, INFINITE);
+	}
+
+	// write anything still pending
+	Flush();
 }
 
 // initialize
 void LogFile::Init()
 {
 	if (inst == nullptr)
+	{
 		inst = new LogFile();
+
+		// install the crash handler
+		prevCrashFilter = SetUnhandledExceptionFilter(&CrashFilter);
+	}
 }
 
 // terminate
@@ -52,33 +95,220 @@ void LogFile::Shutdown()
 {
 	if (inst != nullptr)
 	{
+		// remove the crash handler
+		SetUnhandledExceptionFilter(prevCrashFilter);
+
+		// delete the instance; this flushes pending messages
 		delete inst;
 		inst = nullptr;
 	}
 }
 
+void LogFile::OnConfigReload()
+{
+	auto cfg = ConfigManager::GetInstance();
+
+	// get the minimum level
+	const TCHAR *level = cfg->Get(ConfigVars::LogLevel, _T("info"));
+	minLevel = _tcsicmp(level, _T("debug")) == 0 ? Debug :
+		_tcsicmp(level, _T("warning")) == 0 ? Warning :
+		_tcsicmp(level, _T("error")) == 0 ? Error :
+		Info;
+
+	// Get the subsystem list.  This is a comma-separated list of the
+	// subsystem names, or "all" (the default) for everything.
+	static const struct
+	{
+		const TCHAR *name;
+		UINT32 bit;
+	} names[] = {
+		{ _T("general"), SysGeneral },
+		{ _T("gamelist"), SysGameList },
+		{ _T("media"), SysMedia },
+		{ _T("video"), SysVideo },
+		{ _T("highscores"), SysHighScores },
+		{ _T("capture"), SysCapture },
+		{ _T("all"), SysAll }
+	};
+	TSTRINGEx list = cfg->Get(ConfigVars::LogSubsystems, _T("all"));
+	UINT32 mask = 0;
+	for (auto &s : list.Split(','))
+	{
+		// trim leading and trailing spaces
+		const TCHAR *p = s.c_str();
+		for (; _istspace(*p); ++p);
+		TSTRING name(p);
+		while (name.length() != 0 && _istspace(name.back()))
+			name.pop_back();
+
+		// look up the name
+		for (auto &n : names)
+		{
+			if (_tcsicmp(name.c_str(), n.name) == 0)
+				mask |= n.bit;
+		}
+	}
+
+	// General messages are always enabled, since they include the
+	// session header and messages from code that predates subsystems
+	subsystemMask = mask | SysGeneral;
+}
+
 void LogFile::Write(const TCHAR *fmt, ...)
 {
-	if (h != NULL && h != INVALID_HANDLE_VALUE)
+	if (IsEnabled(Info, SysGeneral))
 	{
-		// set up the varargs list
 		va_list ap;
 		va_start(ap, fmt);
+		WriteV(Info, fmt, ap);
+		va_end(ap);
+	}
+}
 
-		// format the message
-		TSTRINGEx s;
-		s.FormatV(fmt, ap);
-
-		// done with the varargs
+void LogFile::Write(Level level, UINT32 subsystem, const TCHAR *fmt, ...)
+{
+	if (IsEnabled(level, subsystem))
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		WriteV(level, fmt, ap);
 		va_end(ap);
+	}
+}
+
+void LogFile::WriteV(Level level, const TCHAR *fmt, va_list ap)
+{
+	// do nothing if the file isn't open
+	if (h == NULL || h == INVALID_HANDLE_VALUE)
+		return;
+
+	// time the caller-side cost
+	PERF_ZONE(_T("LogFile::Write"));
 
-		// convert the formatted text to single-byte characters, and convert
-		// C-style \n newlines to DOS-style \r\n newlines
-		static std::basic_regex<CHAR> nl("\n");
-		CSTRING c = std::regex_replace(TSTRINGToCSTRING(s), nl, "\r\n");
+	// Format the message into a thread-local buffer.  Keeping the buffers
+	// per thread avoids any locking, and re-using them avoids allocating
+	// on every call once they've grown to the typical message size.
+	static thread_local std::vector<TCHAR> tbuf;
+	static thread_local std::vector<CHAR> cbuf;
+	static const TCHAR *const prefixes[] = { _T("Debug: "), _T(""), _T("Warning: "), _T("Error: ") };
+	const TCHAR *prefix = prefixes[level];
+	size_t prefixLen = _tcslen(prefix);
+	va_list ap2;
+	va_copy(ap2, ap);
+	int len = _vsctprintf(fmt, ap2);
+	va_end(ap2);
+	if (len < 0)
+		return;
+	tbuf.resize(prefixLen + len + 1);
+	memcpy(tbuf.data(), prefix, prefixLen * sizeof(TCHAR));
+	_vstprintf_s(tbuf.data() + prefixLen, len + 1, fmt, ap);
+	len += (int)prefixLen;
 
-		// write to the file in single-byte characters
-		DWORD bytesWritten = 0;
-		WriteFile(h, c.c_str(), (DWORD)c.length(), &bytesWritten, NULL);
+	// convert to single-byte characters
+#ifdef UNICODE
+	int clen = WideCharToMultiByte(CP_ACP, 0, tbuf.data(), len, NULL, 0, NULL, NULL);
+	cbuf.resize(clen);
+	WideCharToMultiByte(CP_ACP, 0, tbuf.data(), len, cbuf.data(), clen, NULL, NULL);
+#else
+	int clen = len;
+	cbuf.assign(tbuf.data(), tbuf.data() + len);
+#endif
+
+	// count newlines, since we expand them to DOS-style \r\n newlines
+	int nNewlines = 0;
+	for (int i = 0; i < clen; ++i)
+		nNewlines += (cbuf[i] == '\n');
+
+	// allocate the queue entry
+	DWORD entryLen = clen + nNewlines;
+	auto e = static_cast<Entry*>(_aligned_malloc(offsetof(Entry, text) + entryLen, MEMORY_ALLOCATION_ALIGNMENT));
+	if (e == nullptr)
+		return;
+
+	// copy the text, expanding newlines
+	e->len = entryLen;
+	CHAR *dst = e->text;
+	for (int i = 0; i < clen; ++i)
+	{
+		if (cbuf[i] == '\n')
+			*dst++ = '\r';
+		*dst++ = cbuf[i];
 	}
+
+	// queue it
+	InterlockedPushEntrySList(&queue, &e->link);
+}
+
+void LogFile::DrainQueue(std::vector<CHAR> *batch)
+{
+	// take the whole pending list
+	PSLIST_ENTRY p = InterlockedFlushSList(&queue);
+	if (p == nullptr)
+		return;
+
+	// The list is in reverse order (most recent first), so reverse it
+	Entry *list = nullptr;
+	while (p != nullptr)
+	{
+		PSLIST_ENTRY nxt = p->Next;
+		p->Next = list != nullptr ? &list->link : nullptr;
+		list = CONTAINING_RECORD(p, Entry, link);
+		p = nxt;
+	}
+
+	// Gather the messages into the batch buffer, or write them one at
+	// a time if there's no buffer
+	DWORD bytesWritten = 0;
+	if (batch != nullptr)
+		batch->clear();
+	for (Entry *e = list; e != nullptr; )
+	{
+		if (batch != nullptr)
+			batch->insert(batch->end(), e->text, e->text + e->len);
+		else
+			WriteFile(h, e->text, e->len, &bytesWritten, NULL);
+
+		// Free the entry.  In the crash handler, leave it allocated
+		// instead: the process is going away anyway, and we don't want
+		// to touch a heap that might be the source of the crash.
+		Entry *nxt = e->link.Next != nullptr ? CONTAINING_RECORD(e->link.Next, Entry, link) : nullptr;
+		if (batch != nullptr)
+			_aligned_free(e);
+		e = nxt;
+	}
+
+	// write the batch
+	if (batch != nullptr)
+		WriteFile(h, batch->data(), (DWORD)batch->size(), &bytesWritten, NULL);
+}
+
+void LogFile::Flush()
+{
+	CriticalSectionLocker locker(writeLock);
+	DrainQueue(&batch);
+}
+
+DWORD LogFile::WriterMain()
+{
+	// Write out queued messages every flush interval, until shutdown
+	while (WaitForSingleObject(hShutdownEvent, flushInterval) == WAIT_TIMEOUT)
+		Flush();
+
+	// done
+	return 0;
+}
+
+LONG WINAPI LogFile::CrashFilter(EXCEPTION_POINTERS *ep)
+{
+	// Write out any pending messages, so that they're not lost when
+	// the process terminates.  Don't acquire the write lock: the writer
+	// thread could be holding it, and we can't count on it ever being
+	// released once the process is crashing.  For the same reason, we
+	// can't use the writer's batch buffer, so write the messages one
+	// at a time.
+	if (inst != nullptr)
+		inst->DrainQueue(nullptr);
+
+	// pass the exception to the previous filter, if any
+	return prevCrashFilter != nullptr ? prevCrashFilter(ep) : EXCEPTION_CONTINUE_SEARCH;
 }
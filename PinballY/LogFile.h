@@ -4,30 +4,139 @@
 // Log file interface.  The log file is global to the app, so there's
 // one singleton instance.
 //
+// Logging is asynchronous.  Write() formats the message on the calling
+// thread and pushes it onto a lock-free queue, and a background thread
+// writes the queued messages to disk in batches.  This keeps the file
+// I/O (and contention for the file handle) out of the callers, many
+// of which are on time-sensitive threads, such as the UI thread and
+// the video decoder callbacks.  Messages reach the file within the
+// flush interval, and any pending messages are written out when the
+// log is shut down, or if the program crashes.
+//
+// Each message has a severity level and a subsystem.  The config
+// variables Log.Level and Log.Subsystems select which messages are
+// written; messages that aren't selected are discarded before any
+// formatting is done, so disabled logging costs very little.
+//
 #pragma once
+#include "../Utilities/Config.h"
 
-class LogFile
+class LogFile : public ConfigManager::Subscriber
 {
 public:
 	// Initialize - creates the global singleton
 	static void Init();
 
-	// Shut down
+	// Shut down.  This writes any pending messages.
 	static void Shutdown();
 
 	// get the global singleton instance
 	static LogFile *Get() { return inst; }
 
-	// write a message
+	// severity levels
+	enum Level
+	{
+		Debug,
+		Info,
+		Warning,
+		Error
+	};
+
+	// Subsystem bits.  These can be combined into masks.
+	enum Subsystem : UINT32
+	{
+		SysGeneral    = 0x0001,    // general application messages
+		SysGameList   = 0x0002,    // game database loading and saving
+		SysMedia      = 0x0004,    // media files
+		SysVideo      = 0x0008,    // video playback
+		SysHighScores = 0x0010,    // high score retrieval
+		SysCapture    = 0x0020,    // media capture
+		SysAll        = 0xFFFFFFFF
+	};
+
+	// Write a message, at Info level in the General subsystem
 	void Write(const TCHAR *fmt, ...);
 
-	// get the underlying OS file handle
-	HANDLE GetFileHandle() const { return h; }
+	// write a message with the given level and subsystem
+	void Write(Level level, UINT32 subsystem, const TCHAR *fmt, ...);
+
+	// Is logging enabled for the given level and subsystem?  Callers
+	// can use this to skip work preparing a message that won't be
+	// written.
+	bool IsEnabled(Level level, UINT32 subsystem) const
+		{ return level >= minLevel && (subsystem & subsystemMask) != 0; }
+
+	// Write all pending messages to the file now
+	void Flush();
+
+	// Get the underlying OS file handle.  This flushes pending messages
+	// first, so that anything written directly to the handle (such as
+	// output from a child process) appears after the messages we've
+	// already logged.
+	HANDLE GetFileHandle() { Flush(); return h; }
+
+	// config subscriber interface
+	virtual void OnConfigReload() override;
 
 protected:
 	LogFile();
 	~LogFile();
 
+	// format a message and queue it
+	void WriteV(Level level, const TCHAR *fmt, va_list ap);
+
+	// Queued message.  These are allocated with the text inline, and
+	// linked into the queue through a Windows interlocked SLIST, which
+	// requires MEMORY_ALLOCATION_ALIGNMENT alignment for the entries.
+	struct DECLSPEC_ALIGN(MEMORY_ALLOCATION_ALIGNMENT) Entry
+	{
+		SLIST_ENTRY link;
+		DWORD len;
+		CHAR text[1];
+	};
+
+	// Message queue.  The SLIST is a lock-free stack, so it's safe for
+	// any number of threads to push messages concurrently.  The writer
+	// removes the entire list in one operation, and reverses it to get
+	// the messages back into the order they were written.
+	SLIST_HEADER queue;
+
+	// Write the queued messages to the file.  If 'batch' is provided,
+	// the messages are gathered into it and written in one call; the
+	// caller must hold the write lock, since the buffer belongs to the
+	// writer.  If 'batch' is null, each message is written separately,
+	// without using the heap at all; the crash handler uses this, since
+	// it can't take the lock and can't count on the heap being usable.
+	void DrainQueue(std::vector<CHAR> *batch);
+
+	// lock for writing to the file
+	CriticalSection writeLock;
+
+	// Batch buffer for DrainQueue(), protected by the write lock.  We
+	// keep this around between calls so that we only allocate it once
+	// it's grown to the typical batch size.
+	std::vector<CHAR> batch;
+
+	// Writer thread.  This wakes up every flushInterval milliseconds to
+	// write out any queued messages.
+	static const DWORD flushInterval = 100;
+	static DWORD WINAPI SWriterMain(LPVOID lParam) { return static_cast<LogFile*>(lParam)->WriterMain(); }
+	DWORD WriterMain();
+	HandleHolder hWriterThread;
+
+	// shutdown event, to tell the writer thread to exit
+	HandleHolder hShutdownEvent;
+
+	// Unhandled exception filter.  This writes out any pending messages
+	// before the process terminates, so that the messages leading up to
+	// a crash aren't lost.
+	static LONG WINAPI CrashFilter(EXCEPTION_POINTERS *ep);
+	static LPTOP_LEVEL_EXCEPTION_FILTER prevCrashFilter;
+
+	// message selection
+	volatile Level minLevel;
+	volatile UINT32 subsystemMask;
+
 	// OS file handle
 	HandleHolder h;
 
@@ -0,0 +1,367 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media drop importer
+
+#include "stdafx.h"
+#include "MediaDropImporter.h"
+#include "GameList.h"
+#include "PrivateWindowMessages.h"
+#include "Resource.h"
+
+MediaDropImporter::MediaDropImporter(HWND hwndNotify) :
+	hwndNotify(hwndNotify),
+	nWorkers(0),
+	nDone(0),
+	nInstalled(0),
+	bytesDone(0),
+	progressPosted(false),
+	lastProgressTime(0),
+	allFinished(false),
+	cancelled(FALSE)
+{
+	// Use one worker per processor, up to a small limit.  The work is
+	// a mix of decompression and disk writes, and beyond a few threads,
+	// the extra threads would just compete for the disk.
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	maxWorkers = max(1, min((int)si.dwNumberOfProcessors, 4));
+}
+
+MediaDropImporter::~MediaDropImporter()
+{
+}
+
+void MediaDropImporter::AddItem(const TCHAR *srcFile, int zipIndex, const TCHAR *destFile,
+	const TCHAR *backupFile, const MediaType *mediaType)
+{
+	items.emplace_back(srcFile, zipIndex, destFile, backupFile, mediaType);
+}
+
+void MediaDropImporter::SetPassword(const TCHAR *archive, const TCHAR *password)
+{
+	passwords.emplace_back(archive, password);
+}
+
+void MediaDropImporter::Start()
+{
+	CriticalSectionLocker locker(lock);
+
+	// Build the task list.  Group the archive entries by archive, so
+	// that we make one extraction pass per archive, and make a separate
+	// task for each directly dropped file.
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		auto &item = items[i];
+		if (item.zipIndex >= 0)
+		{
+			auto it = std::find_if(tasks.begin(), tasks.end(), [&item](const Task &t) {
+				return t.isArchive && _tcsicmp(t.srcFile.c_str(), item.srcFile.c_str()) == 0; });
+			if (it == tasks.end())
+				it = tasks.emplace(tasks.end(), item.srcFile.c_str(), true);
+			it->items.push_back(i);
+		}
+		else
+		{
+			tasks.emplace_back(item.srcFile.c_str(), false);
+			tasks.back().items.push_back(i);
+		}
+	}
+
+	// start the workers
+	StartWorkers();
+
+	// If we couldn't launch any threads at all, do the work on the
+	// calling thread.  That blocks the UI, but it's better than not
+	// doing the work at all.  (This also takes care of an empty item
+	// list, by posting the completion message immediately.)
+	if (nWorkers == 0)
+	{
+		++nWorkers;
+		locker.Unlock();
+		WorkerMain();
+	}
+}
+
+void MediaDropImporter::Cancel()
+{
+	// set the cancel flag; the workers check this periodically
+	cancelled = TRUE;
+}
+
+void MediaDropImporter::StartWorkers()
+{
+	// start one worker per pending task, up to the maximum
+	int target = min(maxWorkers, nWorkers + (int)tasks.size());
+	while (nWorkers < target)
+	{
+		// add a reference on behalf of the thread
+		AddRef();
+
+		// launch the thread
+		DWORD tid;
+		HandleHolder hThread(CreateThread(NULL, 0, &MediaDropImporter::SWorkerMain, this, 0, &tid));
+		if (hThread == NULL)
+		{
+			Release();
+			break;
+		}
+
+		// count the new worker
+		++nWorkers;
+	}
+}
+
+DWORD WINAPI MediaDropImporter::SWorkerMain(LPVOID param)
+{
+	// take over the reference the launcher added for us
+	RefPtr<MediaDropImporter> self(static_cast<MediaDropImporter*>(param));
+
+	// run the worker
+	self->WorkerMain();
+
+	// done
+	return 0;
+}
+
+void MediaDropImporter::WorkerMain()
+{
+	// process tasks until the queue runs dry
+	for (;;)
+	{
+		// get the next task
+		Task task(_T(""), false);
+		{
+			CriticalSectionLocker locker(lock);
+			if (tasks.size() == 0)
+			{
+				// No more tasks, so this worker is done.  If it's the
+				// last worker, the whole import is done, so notify the UI.
+				if (--nWorkers == 0)
+				{
+					allFinished = true;
+					::PostMessage(hwndNotify, PFVMsgMediaDropDone, 0, 0);
+				}
+				return;
+			}
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+
+		// run the task, capturing errors locally
+		CapturingErrorHandler eh;
+		if (task.isArchive)
+			RunArchiveTask(task, eh);
+		else
+			RunCopyTask(task, eh);
+
+		// merge the task's errors into the main list
+		CriticalSectionLocker locker(lock);
+		eh.EnumErrors([this](const ErrorList::Item &e) { errors.SysError(e.message.c_str(), e.details.c_str()); });
+	}
+}
+
+void MediaDropImporter::RunArchiveTask(Task &task, ErrorHandler &eh)
+{
+	// Set up the archive reader.  We're on a worker thread, so the
+	// reader can't ask for a password; use the one the UI collected,
+	// if any.
+	SevenZipArchive arch;
+	arch.DisablePasswordPrompt();
+	auto pw = std::find_if(passwords.begin(), passwords.end(), [&task](const std::pair<TSTRING, TSTRING> &p) {
+		return _tcsicmp(p.first.c_str(), task.srcFile.c_str()) == 0; });
+	if (pw != passwords.end())
+		arch.SetPassword(pw->second.c_str());
+
+	// open the archive
+	if (cancelled || !arch.OpenArchive(task.srcFile.c_str(), eh))
+	{
+		for (auto i : task.items)
+			FinishItem(i, false);
+		return;
+	}
+
+	// If this is a fresh batch with several entries, and the archive
+	// isn't solid, we can extract the entries in parallel, so split the
+	// batch.  This works for encrypted entries, too, since every reader
+	// gets the password up front.
+	size_t nBatches = min((size_t)maxWorkers, task.items.size());
+	if (!task.split && nBatches > 1 && !arch.IsSolid())
+	{
+		// Assign the entries to batches, largest first, adding each one
+		// to the batch with the smallest total size so far.  That keeps
+		// the batches about equal in size.
+		std::vector<std::pair<UINT64, size_t>> bySize;
+		for (auto i : task.items)
+			bySize.emplace_back(arch.GetSize(items[i].zipIndex), i);
+		std::sort(bySize.begin(), bySize.end(), std::greater<>());
+
+		std::vector<Task> batches(nBatches, Task(task.srcFile.c_str(), true));
+		std::vector<UINT64> batchSize(nBatches, 0);
+		for (auto &s : bySize)
+		{
+			size_t b = std::min_element(batchSize.begin(), batchSize.end()) - batchSize.begin();
+			batches[b].items.push_back(s.second);
+			batchSize[b] += s.first;
+		}
+
+		// Keep the first batch for ourselves, since we already have the
+		// archive open, and queue the rest for other workers.
+		task.items = std::move(batches[0].items);
+		CriticalSectionLocker locker(lock);
+		for (size_t b = 1; b < nBatches; ++b)
+		{
+			batches[b].split = true;
+			tasks.emplace_back(std::move(batches[b]));
+		}
+		StartWorkers();
+	}
+
+	// extract the batch
+	std::vector<SevenZipArchive::ExtractItem> batch;
+	for (auto i : task.items)
+		batch.emplace_back(items[i].zipIndex, items[i].destFile.c_str());
+	UINT64 lastDone = 0;
+	arch.ExtractBatch(batch,
+		[this, &task](size_t b, bool ok) { FinishItem(task.items[b], ok); },
+		[this, &lastDone](UINT64 done, UINT64 /*total*/)
+		{
+			// count the progress, and keep going unless we've been cancelled
+			if (done > lastDone)
+			{
+				AddBytesDone(done - lastDone);
+				lastDone = done;
+			}
+			return !cancelled;
+		},
+		eh);
+}
+
+void MediaDropImporter::RunCopyTask(Task &task, ErrorHandler &eh)
+{
+	for (auto i : task.items)
+	{
+		// Copy the file to a temporary name alongside the destination
+		// file, then rename it into place.  Note that the rename fails if
+		// the destination file already exists, the same as a plain copy
+		// with the "fail if exists" option.
+		auto &item = items[i];
+		TSTRING tempFile = item.destFile + _T(".~copy");
+		UINT64 lastDone = 0;
+		std::pair<MediaDropImporter*, UINT64*> ctx(this, &lastDone);
+		bool ok = false;
+		if (cancelled)
+		{
+			// cancelled - don't start the copy
+		}
+		// (CopyFileEx() takes a plain BOOL pointer, so we have to cast
+		// away the volatile; it re-reads the flag through the pointer
+		// between chunks, so it still sees the UI thread's update)
+		else if (CopyFileEx(item.srcFile.c_str(), tempFile.c_str(), &MediaDropImporter::SCopyProgress, &ctx, const_cast<LPBOOL>(&cancelled), 0)
+			&& MoveFileEx(tempFile.c_str(), item.destFile.c_str(), 0))
+		{
+			// success
+			ok = true;
+		}
+		else if (!cancelled)
+		{
+			// error in the copy - log it
+			WindowsErrorMessage winErr;
+			eh.Error(MsgFmt(IDS_ERR_DROP_COPY,
+				LoadStringT(item.mediaType->nameStrId).c_str(),
+				item.srcFile.c_str(), item.destFile.c_str(), winErr.Get()));
+		}
+
+		// don't leave the temporary file behind on failure
+		if (!ok)
+			DeleteFile(tempFile.c_str());
+
+		// the item is finished
+		FinishItem(i, ok);
+	}
+}
+
+DWORD CALLBACK MediaDropImporter::SCopyProgress(LARGE_INTEGER /*totalSize*/, LARGE_INTEGER totalDone,
+	LARGE_INTEGER, LARGE_INTEGER, DWORD, DWORD, HANDLE, HANDLE, LPVOID param)
+{
+	// count the new progress since the last call
+	auto ctx = static_cast<std::pair<MediaDropImporter*, UINT64*>*>(param);
+	UINT64 done = totalDone.QuadPart;
+	if (done > *ctx->second)
+	{
+		ctx->first->AddBytesDone(done - *ctx->second);
+		*ctx->second = done;
+	}
+
+	// keep going (cancellation goes through the CopyFileEx() cancel flag)
+	return PROGRESS_CONTINUE;
+}
+
+void MediaDropImporter::FinishItem(size_t i, bool ok)
+{
+	// If it failed, and the caller moved the existing file aside as a
+	// backup, undo the rename.  Ignore any errors that occur in that
+	// attempt, as we've already logged errors for this item, and we
+	// don't want to overload the user with alerts.  The user should be
+	// able to sort out the mess easily enough if the un-re-name fails,
+	// by manually inspecting the media folder.
+	auto &item = items[i];
+	if (!ok && item.backupFile.length() != 0)
+		MoveFile(item.backupFile.c_str(), item.destFile.c_str());
+
+	// record the result, and let the UI know
+	CriticalSectionLocker locker(lock);
+	item.ok = ok;
+	finished.push_back(i);
+	++nDone;
+	if (ok)
+		++nInstalled;
+	PostProgress();
+}
+
+void MediaDropImporter::AddBytesDone(UINT64 n)
+{
+	// count the bytes, and update the UI every so often
+	CriticalSectionLocker locker(lock);
+	bytesDone += n;
+	if (GetTickCount64() - lastProgressTime >= 100)
+		PostProgress();
+}
+
+void MediaDropImporter::PostProgress()
+{
+	// Post a message unless one is already pending.  This keeps us from
+	// flooding the UI queue when the UI is busy; the UI picks up all of
+	// the progress since the last message when it gets around to it.
+	if (!progressPosted)
+	{
+		progressPosted = true;
+		lastProgressTime = GetTickCount64();
+		::PostMessage(hwndNotify, PFVMsgMediaDropProgress, 0, 0);
+	}
+}
+
+void MediaDropImporter::GetProgress(Progress &progress)
+{
+	CriticalSectionLocker locker(lock);
+	progress.nItems = items.size();
+	progress.nDone = nDone;
+	progress.nInstalled = nInstalled;
+	progress.bytesDone = bytesDone;
+	progress.finished = allFinished;
+}
+
+void MediaDropImporter::TakeFinishedItems(std::list<Item> &list)
+{
+	CriticalSectionLocker locker(lock);
+
+	// pass back the finished items
+	for (auto i : finished)
+		list.push_back(items[i]);
+	finished.clear();
+
+	// the UI has picked up the latest progress, so the next update
+	// needs a new message
+	progressPosted = false;
+}
@@ -0,0 +1,216 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media drop importer
+//
+// This installs the files selected in the media drop menu (see
+// PlayfieldView::MediaDropGo()) on background threads, so that the UI
+// stays responsive while a large media pack is unpacked.
+//
+// The work is divided into tasks, which run on a small pool of worker
+// threads:
+//
+// - Each archive is opened once, and all of its selected entries are
+//   extracted in a single pass with SevenZipArchive::ExtractBatch().
+//   For a solid archive, that's the only reasonable way to do it, since
+//   the entries share one compressed stream.  The entries of a non-solid
+//   archive (such as an ordinary ZIP file) can be decompressed
+//   independently, so we split them into several batches of about equal
+//   size, each with its own reader on the archive, and extract the
+//   batches in parallel.
+//
+// - The worker threads can't show the archive password dialog, since
+//   that has to run on the UI thread.  The UI asks for the password for
+//   an encrypted archive before starting the import, and passes it in
+//   via SetPassword().  The workers never prompt; an entry that needs
+//   a password we don't have simply fails.
+//
+// - Each directly dropped file is copied as a separate task.
+//
+// Every output file is written under a temporary name and renamed into
+// place when complete, so a failure or cancellation never leaves a
+// partial file under a media file name.  If an item fails, and the
+// caller moved an existing file aside as a backup, we move the backup
+// back into place.
+//
+// The importer reports progress to the UI window by posting a
+// PFVMsgMediaDropProgress message when an item finishes, and
+// periodically as data is written, and posts PFVMsgMediaDropDone when
+// all of the work is finished.  The UI calls TakeFinishedItems() when
+// it receives either message, to update the media index with the files
+// installed so far.
+
+#pragma once
+#include "SevenZipIfc.h"
+
+struct MediaType;
+
+class MediaDropImporter : public RefCounted
+{
+public:
+	MediaDropImporter(HWND hwndNotify);
+	~MediaDropImporter();
+
+	// Import item
+	struct Item
+	{
+		Item(const TCHAR *srcFile, int zipIndex, const TCHAR *destFile,
+			const TCHAR *backupFile, const MediaType *mediaType) :
+			srcFile(srcFile),
+			zipIndex(zipIndex),
+			destFile(destFile),
+			backupFile(backupFile),
+			mediaType(mediaType),
+			ok(false)
+		{
+		}
+
+		// Source file.  For an archive entry, this is the archive file.
+		TSTRING srcFile;
+
+		// index of the entry in the archive, or -1 for a plain file
+		int zipIndex;
+
+		// destination file
+		TSTRING destFile;
+
+		// name of the backup of the existing destination file, or an
+		// empty string if there was no existing file
+		TSTRING backupFile;
+
+		// media type
+		const MediaType *mediaType;
+
+		// was the item successfully installed?
+		bool ok;
+	};
+
+	// Add an item.  All items must be added before calling Start().
+	void AddItem(const TCHAR *srcFile, int zipIndex, const TCHAR *destFile,
+		const TCHAR *backupFile, const MediaType *mediaType);
+
+	// Set the password for an archive.  Call this before Start().
+	void SetPassword(const TCHAR *archive, const TCHAR *password);
+
+	// Start the import
+	void Start();
+
+	// Cancel the import.  This stops the work in progress as quickly as
+	// possible; the PFVMsgMediaDropDone message is still posted when
+	// the worker threads finish.
+	void Cancel();
+
+	// Progress status
+	struct Progress
+	{
+		size_t nItems;           // total number of items
+		size_t nDone;            // number of items finished (successfully or not)
+		size_t nInstalled;       // number of items successfully installed
+		UINT64 bytesDone;        // bytes written so far
+		bool finished;           // all work is finished
+	};
+	void GetProgress(Progress &progress);
+
+	// Take the items finished since the last call.  This appends copies
+	// of the items to the list.  This also re-enables the next progress
+	// message, so the UI should call it on every PFVMsgMediaDropProgress.
+	void TakeFinishedItems(std::list<Item> &list);
+
+	// Get the errors that occurred.  This is only valid after the
+	// PFVMsgMediaDropDone message is posted.
+	const CapturingErrorHandler &GetErrors() const { return errors; }
+
+protected:
+	// Task.  This is a group of items from one archive that we extract
+	// in one pass, or a single directly dropped file.
+	struct Task
+	{
+		Task(const TCHAR *srcFile, bool isArchive) : srcFile(srcFile), isArchive(isArchive), split(false) { }
+
+		// source file
+		TSTRING srcFile;
+
+		// is it an archive?
+		bool isArchive;
+
+		// Has this task already been split from a larger batch?  A split
+		// task goes straight to extraction.
+		bool split;
+
+		// items, as indices into the item list
+		std::vector<size_t> items;
+	};
+
+	// start worker threads, up to the maximum and the number of tasks
+	// available; call with the lock held
+	void StartWorkers();
+
+	// worker thread entrypoint
+	static DWORD WINAPI SWorkerMain(LPVOID param);
+	void WorkerMain();
+
+	// run a task
+	void RunArchiveTask(Task &task, ErrorHandler &eh);
+	void RunCopyTask(Task &task, ErrorHandler &eh);
+
+	// CopyFileEx() progress callback
+	static DWORD CALLBACK SCopyProgress(LARGE_INTEGER totalSize, LARGE_INTEGER totalDone,
+		LARGE_INTEGER streamSize, LARGE_INTEGER streamDone, DWORD streamNum, DWORD reason,
+		HANDLE hSrc, HANDLE hDst, LPVOID param);
+
+	// mark an item as finished
+	void FinishItem(size_t item, bool ok);
+
+	// Add to the bytes-written count.  This posts a progress message
+	// if it's been a while since the last one.
+	void AddBytesDone(UINT64 n);
+
+	// Post a progress message to the UI window, if one isn't already
+	// pending.  Call with the lock held.
+	void PostProgress();
+
+	// UI window to notify
+	HWND hwndNotify;
+
+	// Lock.  This protects everything below that the threads share.
+	CriticalSection lock;
+
+	// items
+	std::vector<Item> items;
+
+	// Archive passwords, as archive filename/password pairs.  These are
+	// all set before Start(), and read-only after that.
+	std::vector<std::pair<TSTRING, TSTRING>> passwords;
+
+	// items finished since the last TakeFinishedItems() call
+	std::vector<size_t> finished;
+
+	// pending tasks
+	std::list<Task> tasks;
+
+	// number of running worker threads, and the maximum
+	int nWorkers;
+	int maxWorkers;
+
+	// progress counters
+	size_t nDone;
+	size_t nInstalled;
+	UINT64 bytesDone;
+
+	// is a progress message pending in the UI window's queue?
+	bool progressPosted;
+
+	// time of the last progress message, in GetTickCount64() milliseconds
+	ULONGLONG lastProgressTime;
+
+	// have all of the workers finished?
+	bool allFinished;
+
+	// Cancellation flag.  This is a BOOL because we pass it to
+	// CopyFileEx() as its cancel flag.  It's volatile because the UI
+	// thread sets it while the workers are polling it.
+	volatile BOOL cancelled;
+
+	// errors, merged from the tasks as they finish
+	CapturingErrorHandler errors;
+};
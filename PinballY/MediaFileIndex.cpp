@@ -0,0 +1,336 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media file index
+
+#include "stdafx.h"
+#include "MediaFileIndex.h"
+#include "GameList.h"
+
+MediaFileIndex::MediaFileIndex()
+{
+}
+
+MediaFileIndex::~MediaFileIndex()
+{
+}
+
+void MediaFileIndex::Clear()
+{
+	CriticalSectionLocker locker(lock);
+	folders.clear();
+	types.clear();
+	stats.filesIndexed = 0;
+}
+
+void MediaFileIndex::GetStats(Stats &s)
+{
+	CriticalSectionLocker locker(lock);
+	s = stats;
+}
+
+// get the lower-case version of a string, for use as a map key
+static TSTRING LowerKey(const TCHAR *str)
+{
+	TSTRING key(str);
+	std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+	return key;
+}
+
+MediaFileIndex::TypeIndex *MediaFileIndex::GetTypeIndex(const TCHAR *dir, const MediaType &mediaType)
+{
+	// look for an existing entry
+	TSTRING key = LowerKey(dir);
+	if (auto it = types.find(key); it != types.end())
+		return it->second.get();
+
+	// It's not there yet - create a new type index
+	TypeIndex *ti = types.emplace(key, new TypeIndex(&mediaType)).first->second.get();
+
+	// Add the physical folders that contribute to the type.  A paged
+	// type has one folder per page; other types just use the main
+	// media folder.
+	auto AddFolder = [this, ti](int page, const TCHAR *path)
+	{
+		folders.emplace(
+			std::piecewise_construct,
+			std::forward_as_tuple(LowerKey(path)),
+			std::forward_as_tuple(ti, page, path));
+	};
+	if (mediaType.pageList != nullptr)
+	{
+		for (int pageno = 0; mediaType.pageList[pageno] != nullptr; ++pageno)
+		{
+			TCHAR path[MAX_PATH];
+			PathCombine(path, dir, mediaType.pageList[pageno]);
+			AddFolder(pageno, path);
+		}
+	}
+	else
+		AddFolder(0, dir);
+
+	// return the new type index
+	return ti;
+}
+
+void MediaFileIndex::ListFolder(Folder &folder)
+{
+	// if the listing is current, there's nothing to do
+	if (folder.listed)
+		return;
+
+	// Record the folder's modification time.  Do this before listing
+	// the contents, so that any change made while we're in the middle
+	// of the listing will look like a change on the next check.  If
+	// the folder doesn't exist, leave the timestamp zeroed; we'll see
+	// it as a change if the folder is created later.
+	WIN32_FILE_ATTRIBUTE_DATA attrs;
+	if (GetFileAttributesEx(folder.path.c_str(), GetFileExInfoStandard, &attrs))
+		folder.lastWrite = attrs.ftLastWriteTime;
+	else
+		folder.lastWrite.dwLowDateTime = folder.lastWrite.dwHighDateTime = 0;
+
+	// remove any entries from a previous listing of the same folder
+	RemoveFiles(folder.typeIndex, folder.page, nullptr);
+
+	// List the files.  Use the "basic" info level and large fetch
+	// buffer, since we only need the names, and this is considerably
+	// faster on large folders.
+	TCHAR pat[MAX_PATH];
+	PathCombine(pat, folder.path.c_str(), _T("*"));
+	WIN32_FIND_DATA fd;
+	HANDLE hFind = FindFirstFileEx(pat, FindExInfoBasic, &fd, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+	if (hFind != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			// skip directories
+			if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+				continue;
+
+			// add the file
+			TCHAR path[MAX_PATH];
+			PathCombine(path, folder.path.c_str(), fd.cFileName);
+			AddFile(folder.typeIndex, folder.page, fd.cFileName, path);
+
+		} while (FindNextFile(hFind, &fd));
+
+		FindClose(hFind);
+	}
+
+	// the folder is now listed
+	folder.listed = true;
+	++stats.foldersListed;
+}
+
+void MediaFileIndex::AddFile(TypeIndex *ti, int page, const TCHAR *filename, const TCHAR *path)
+{
+	// Match the filename against the type's extension list.  Find the
+	// first extension in the list that matches, so that we can record
+	// its position for the sake of the search order.
+	const MediaType *mt = ti->mediaType;
+	size_t nameLen = _tcslen(filename);
+	int extIdx = 0;
+	size_t extLen = 0;
+	bool matched = false;
+	for (const TCHAR *p = mt->exts; *p != 0; ++extIdx)
+	{
+		// find the end of this extension
+		const TCHAR *start = p;
+		for (; *p != 0 && *p != ' '; ++p);
+
+		// check for a match to the end of the filename, ignoring case
+		size_t len = p - start;
+		if (len < nameLen && _tcsnicmp(filename + nameLen - len, start, len) == 0)
+		{
+			extLen = len;
+			matched = true;
+			break;
+		}
+
+		// skip the space delimiter
+		if (*p == ' ')
+			++p;
+	}
+
+	// if no extension matched, this file isn't part of the type
+	if (!matched)
+		return;
+
+	// get the lower-case base name (the filename minus the extension)
+	TSTRING lcName = LowerKey(filename);
+	TSTRING base(lcName, 0, nameLen - extLen);
+
+	// Add the entry under the full base name, as index 0
+	ti->entries[base].emplace_back(0, page, extIdx, lcName.c_str(), path);
+	++stats.filesIndexed;
+
+	// If the type is indexed, and the name has the form "<base> N",
+	// where N is an index number in the range we search (1..32), also
+	// enter the file under "<base>" with index N.  We can't tell which
+	// way the name was meant from the name itself, since a game's media
+	// name could legitimately end in a number, so we enter it both ways.
+	// Note that the lookup formats the number with "%d", so a number
+	// with leading zeros wouldn't have matched; we apply the same rule.
+	if (mt->indexed)
+	{
+		size_t i = base.length();
+		while (i > 0 && _istdigit(base[i - 1]))
+			--i;
+
+		size_t nDigits = base.length() - i;
+		if (nDigits >= 1 && nDigits <= 2 && i >= 2 && base[i - 1] == ' ' && base[i] != '0')
+		{
+			int n = _ttoi(base.c_str() + i);
+			if (n >= 1 && n <= 32)
+				ti->entries[base.substr(0, i - 1)].emplace_back(n, page, extIdx, lcName.c_str(), path);
+		}
+	}
+}
+
+void MediaFileIndex::RemoveFiles(TypeIndex *ti, int page, const TCHAR *filename)
+{
+	for (auto it = ti->entries.begin(); it != ti->entries.end(); )
+	{
+		// remove matching entries from this name's list
+		auto &v = it->second;
+		auto newEnd = std::remove_if(v.begin(), v.end(), [page, filename](const Entry &e) {
+			return e.page == page && (filename == nullptr || e.filename == filename); });
+
+		// count the full-name entries we're removing (index 0 entries
+		// correspond one-to-one with files)
+		for (auto e = newEnd; e != v.end(); ++e)
+		{
+			if (e->index == 0)
+				--stats.filesIndexed;
+		}
+		v.erase(newEnd, v.end());
+
+		// drop the name entirely if it's now empty
+		if (v.size() == 0)
+			it = ti->entries.erase(it);
+		else
+			++it;
+	}
+}
+
+bool MediaFileIndex::GetMediaItems(std::list<TSTRING> &filenames, const TCHAR *dir,
+	const MediaType &mediaType, const TCHAR *mediaName)
+{
+	CriticalSectionLocker locker(lock);
+
+	// get the type index, and make sure all of its folders are listed
+	TypeIndex *ti = GetTypeIndex(dir, mediaType);
+	int nPages = 1;
+	if (mediaType.pageList != nullptr)
+	{
+		for (nPages = 0; mediaType.pageList[nPages] != nullptr; ++nPages)
+		{
+			TCHAR path[MAX_PATH];
+			PathCombine(path, dir, mediaType.pageList[nPages]);
+			if (auto it = folders.find(LowerKey(path)); it != folders.end())
+				ListFolder(it->second);
+		}
+	}
+	else if (auto it = folders.find(LowerKey(dir)); it != folders.end())
+		ListFolder(it->second);
+
+	// Count the lookup, and count the probes that the exhaustive search
+	// would have done: one per extension, per page, per index number.
+	int nExts = 1;
+	for (const TCHAR *p = mediaType.exts; *p != 0; ++p)
+	{
+		if (*p == ' ')
+			++nExts;
+	}
+	++stats.lookups;
+	stats.probesSaved += (mediaType.indexed ? 33 : 1) * nPages * nExts;
+
+	// look up the media name
+	auto it = ti->entries.find(LowerKey(mediaName));
+	if (it == ti->entries.end())
+		return false;
+
+	// Sort the matches into the search order: index, page, extension
+	std::vector<const Entry*> matches;
+	for (auto &e : it->second)
+		matches.push_back(&e);
+	std::sort(matches.begin(), matches.end(), [](const Entry *a, const Entry *b) {
+		return a->index != b->index ? a->index < b->index :
+			a->page != b->page ? a->page < b->page :
+			a->ext < b->ext; });
+
+	// add them to the result list
+	for (auto e : matches)
+		filenames.emplace_back(e->path);
+
+	// we found at least one match if we got this far
+	return true;
+}
+
+void MediaFileIndex::OnFileChanged(const TCHAR *filename)
+{
+	// split the name into folder and file portions
+	TCHAR dir[MAX_PATH];
+	_tcscpy_s(dir, filename);
+	PathRemoveFileSpec(dir);
+	const TCHAR *name = PathFindFileName(filename);
+
+	CriticalSectionLocker locker(lock);
+
+	// If we're not indexing this folder, or we haven't listed it yet,
+	// there's nothing to update: the change will be picked up when we
+	// do the initial listing.
+	auto it = folders.find(LowerKey(dir));
+	if (it == folders.end() || !it->second.listed)
+		return;
+
+	// remove any existing entries for the file
+	Folder &folder = it->second;
+	RemoveFiles(folder.typeIndex, folder.page, LowerKey(name).c_str());
+
+	// if the file now exists, add it back
+	if (FileExists(filename))
+		AddFile(folder.typeIndex, folder.page, name, filename);
+}
+
+void MediaFileIndex::CheckForChanges()
+{
+	// Make a private copy of the folder list and timestamps.  We don't
+	// want to hold the lock while accessing the file system, since that
+	// could block the UI thread if it needs to do a lookup while we're
+	// working.
+	std::list<std::pair<TSTRING, FILETIME>> check;
+	{
+		CriticalSectionLocker locker(lock);
+		for (auto &f : folders)
+		{
+			if (f.second.listed)
+				check.emplace_back(f.first, f.second.lastWrite);
+		}
+	}
+
+	// check each folder's current timestamp
+	std::list<TSTRING> changed;
+	for (auto &c : check)
+	{
+		FILETIME ft = { 0, 0 };
+		WIN32_FILE_ATTRIBUTE_DATA attrs;
+		if (GetFileAttributesEx(c.first.c_str(), GetFileExInfoStandard, &attrs))
+			ft = attrs.ftLastWriteTime;
+
+		if (CompareFileTime(&ft, &c.second) != 0)
+			changed.emplace_back(c.first);
+	}
+
+	// mark the changed folders for re-listing on the next lookup
+	if (changed.size() != 0)
+	{
+		CriticalSectionLocker locker(lock);
+		for (auto &c : changed)
+		{
+			if (auto it = folders.find(c); it != folders.end())
+				it->second.listed = false;
+		}
+	}
+}
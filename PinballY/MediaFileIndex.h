@@ -0,0 +1,194 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media file index.  This keeps an in-memory listing of the media
+// folders, so that we can answer "which media files does this game
+// have?" queries without going to the file system.
+//
+// The media lookup rules (see GameListItem::GetMediaItems) allow a
+// lot of candidate names for each game and media type: up to 33 index
+// suffixes (for indexed types like instruction cards), times the
+// number of page subfolders (for paged types like flyers), times the
+// number of extensions allowed for the type.  Probing each candidate
+// individually via FileExists() is slow on spinning disks, and we do
+// it every time the wheel moves, for every window, for every media
+// type.  Instead, we enumerate each media folder once, the first time
+// it's needed, and build a case-insensitive map from media base name
+// to the matching files.  Lookups are then answered from memory.
+//
+// The index is kept up to date incrementally:
+//
+// - When we change a media file ourselves (file drops, captures,
+//   renames, backups), the code making the change calls OnFileChanged()
+//   with the affected filename, which updates just that entry.
+//
+// - Changes made by other programs while we're running are detected
+//   by CheckForChanges(), which compares each folder's last-write
+//   timestamp against the value we saw when we last listed it.  (NTFS
+//   updates a directory's write time whenever an entry is added,
+//   removed, or renamed.)  Folders that have changed are re-listed
+//   on the next lookup.  This is called from the new file scan thread
+//   when the application comes to the foreground.
+//
+// The index is thread-safe: all access is protected by an internal
+// critical section, so it can be consulted from background threads
+// (e.g., the capture thread and the new file scanner).
+
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include <list>
+
+struct MediaType;
+
+class MediaFileIndex
+{
+public:
+	MediaFileIndex();
+	~MediaFileIndex();
+
+	// Find the existing media files for a given media type and media
+	// base name.  'dir' is the media folder for the type, as returned by
+	// MediaType::GetMediaPath().  The matching files are appended to the
+	// list in the same order that the per-file probing search would
+	// have found them: by index number, then by page, then in the order
+	// the extensions are listed in the media type.  Returns true if any
+	// files were found.
+	bool GetMediaItems(std::list<TSTRING> &filenames, const TCHAR *dir,
+		const MediaType &mediaType, const TCHAR *mediaName);
+
+	// Notify the index that a file has been created, deleted, or renamed.
+	// For a rename, call this for both the old and new names.  This is
+	// harmless if the file isn't in a media folder we're indexing.
+	void OnFileChanged(const TCHAR *filename);
+
+	// Check for external changes.  This compares the last-write time of
+	// each folder we've indexed against the time recorded when we listed
+	// it, and marks changed folders for re-listing on the next lookup.
+	// This does a small amount of file system work per indexed folder,
+	// so it's best called from a background thread.
+	void CheckForChanges();
+
+	// Discard the entire index.  Everything will be re-listed on demand.
+	void Clear();
+
+	// Statistics
+	struct Stats
+	{
+		Stats() : lookups(0), probesSaved(0), foldersListed(0), filesIndexed(0) { }
+
+		// number of GetMediaItems() lookups answered from the index
+		int64_t lookups;
+
+		// Number of FileExists() probes avoided.  This is the number of
+		// individual file probes that the old per-candidate search would
+		// have performed for the lookups we've answered from memory.
+		int64_t probesSaved;
+
+		// number of folder listings performed (initial plus re-listings)
+		int64_t foldersListed;
+
+		// number of files currently in the index
+		int64_t filesIndexed;
+	};
+	void GetStats(Stats &stats);
+
+protected:
+	// Index entry.  This represents one file in a media folder, parsed
+	// according to its media type's naming rules.
+	struct Entry
+	{
+		Entry(int index, int page, int ext, const TCHAR *filename, const TCHAR *path) :
+			index(index), page(page), ext(ext), filename(filename), path(path) { }
+
+		// Index number.  For indexed types, a file named "<base> N.ext"
+		// has index N.  The un-suffixed "<base>.ext" file has index 0.
+		int index;
+
+		// Page number.  For paged types (e.g., Flyer Images), this is the
+		// index of the page subfolder in the media type's page list.  Zero
+		// for non-paged types.
+		int page;
+
+		// extension number, as an index in the media type's extension list
+		int ext;
+
+		// lower-case filename (without path), for matching deletions
+		TSTRING filename;
+
+		// full path to the file, with the casing found on disk
+		TSTRING path;
+	};
+
+	// Per-type index.  There's one of these for each media type folder
+	// we've consulted.  Since each media type has its own folder, the
+	// folder path uniquely identifies the type.
+	struct TypeIndex
+	{
+		TypeIndex(const MediaType *mediaType) : mediaType(mediaType) { }
+
+		// media type
+		const MediaType *mediaType;
+
+		// Entries, keyed by lower-case media base name.  For indexed types,
+		// a file "<base> N.ext" is entered under both "<base> N" (index 0)
+		// and "<base>" (index N), since either could be the media name of
+		// the game that owns it.
+		std::unordered_map<TSTRING, std::vector<Entry>> entries;
+	};
+
+	// Folder.  This represents one physical directory we've listed.  For
+	// a non-paged type, the folder is the type's media directory; for a
+	// paged type, there's one folder per page subdirectory.
+	struct Folder
+	{
+		Folder(TypeIndex *typeIndex, int page, const TCHAR *path) :
+			typeIndex(typeIndex), page(page), path(path), listed(false)
+		{
+			lastWrite.dwLowDateTime = lastWrite.dwHighDateTime = 0;
+		}
+
+		// the type index this folder contributes to
+		TypeIndex *typeIndex;
+
+		// page number within the media type
+		int page;
+
+		// full path
+		TSTRING path;
+
+		// Have we listed the folder's contents?  This is false initially,
+		// and is reset to false when CheckForChanges() detects that the
+		// folder has been modified externally.
+		bool listed;
+
+		// folder's last-write time as of our last listing
+		FILETIME lastWrite;
+	};
+
+	// get or create the type index for a media folder
+	TypeIndex *GetTypeIndex(const TCHAR *dir, const MediaType &mediaType);
+
+	// make sure a folder is listed
+	void ListFolder(Folder &folder);
+
+	// Add an entry for a file to a type index.  Does nothing if the file
+	// doesn't match the type's naming rules.
+	void AddFile(TypeIndex *ti, int page, const TCHAR *filename, const TCHAR *path);
+
+	// remove all entries matching a page, or a page plus filename (if
+	// 'filename' is non-null)
+	void RemoveFiles(TypeIndex *ti, int page, const TCHAR *filename);
+
+	// Type indices, keyed by lower-case media type folder path
+	std::unordered_map<TSTRING, std::unique_ptr<TypeIndex>> types;
+
+	// Folders, keyed by lower-case folder path
+	std::unordered_map<TSTRING, Folder> folders;
+
+	// statistics
+	Stats stats;
+
+	// resource lock
+	CriticalSection lock;
+};
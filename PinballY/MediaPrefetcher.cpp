@@ -0,0 +1,278 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media prefetcher
+
+#include "stdafx.h"
+#include "MediaPrefetcher.h"
+#include "Sprite.h"
+
+MediaPrefetcher::MediaPrefetcher() :
+	capacity(24),
+	generation(0),
+	exiting(false)
+{
+}
+
+MediaPrefetcher::~MediaPrefetcher()
+{
+	// Tell the thread to exit, and wait for it.  The thread checks the
+	// exit flag between requests and while warming files, so the wait
+	// is bounded by the time to finish the current sprite load.  Don't
+	// time out and kill the thread: that could leave the lock held, or
+	// a D3D call half done.
+	if (hThread != NULL)
+	{
+		exiting = true;
+		SetEvent(hRequestEvent);
+		WaitForSingleObject(hThread, INFINITE);
+	}
+}
+
+TSTRING MediaPrefetcher::MakeKey(const TCHAR *prefix, const TCHAR *filename)
+{
+	TSTRING key(prefix);
+	key += _T("|");
+	key += filename;
+	std::transform(key.begin(), key.end(), key.begin(), ::_totlower);
+	return key;
+}
+
+bool MediaPrefetcher::StartThread()
+{
+	// if the thread is already running, there's nothing to do
+	if (hThread != NULL)
+		return true;
+
+	// create the request event (auto-reset)
+	if (hRequestEvent == NULL)
+		hRequestEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (hRequestEvent == NULL)
+		return false;
+
+	// Launch the thread.  Run it below normal priority, so that it
+	// doesn't compete with the UI thread for rendering time.
+	DWORD tid;
+	hThread = CreateThread(NULL, 0, &SThreadMain, this, CREATE_SUSPENDED, &tid);
+	if (hThread == NULL)
+		return false;
+
+	SetThreadPriority(hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	ResumeThread(hThread);
+	return true;
+}
+
+void MediaPrefetcher::Prefetch(std::list<Request> &requests)
+{
+	// release anything the thread has evicted since our last call
+	ClearEvicted();
+
+	// make sure the thread is running
+	if (!StartThread())
+		return;
+
+	// replace the pending list with the new requests, skipping anything
+	// that's already in the cache
+	{
+		CriticalSectionLocker locker(lock);
+		pending.clear();
+		for (auto &r : requests)
+		{
+			if (cacheIndex.find(r.key) == cacheIndex.end())
+				pending.emplace_back(r);
+		}
+	}
+
+	// wake up the thread
+	SetEvent(hRequestEvent);
+}
+
+bool MediaPrefetcher::Get(const TCHAR *key, RefPtr<Sprite> &sprite)
+{
+	// release anything the thread has evicted since our last call
+	ClearEvicted();
+
+	// look up the item
+	CriticalSectionLocker locker(lock);
+	auto it = cacheIndex.find(key);
+	if (it == cacheIndex.end())
+		return false;
+
+	// move it to the front of the list, to mark it as most recently used
+	cache.splice(cache.begin(), cache, it->second);
+
+	// Return the sprite.  Note that file warming entries have no sprite,
+	// so they don't count as a hit here.
+	sprite = it->second->sprite;
+	return sprite != nullptr;
+}
+
+void MediaPrefetcher::SetCapacity(size_t n)
+{
+	// Set the new capacity, and trim the cache if necessary.  Move the
+	// trimmed entries into a local list, and let it go out of scope
+	// after we've released the lock, so that we don't hold the lock
+	// while D3D frees the sprites.
+	std::list<Entry> trimmed;
+	{
+		CriticalSectionLocker locker(lock);
+		capacity = n;
+		while (cache.size() > capacity)
+		{
+			cacheIndex.erase(cache.back().key);
+			trimmed.splice(trimmed.begin(), cache, std::prev(cache.end()));
+		}
+	}
+}
+
+void MediaPrefetcher::Clear()
+{
+	// release evicted sprites
+	ClearEvicted();
+
+	// Clear the cache and pending requests, and bump the generation
+	// number so that the thread discards any load now in progress.  As
+	// in SetCapacity(), move the cache entries into a local list so that
+	// the sprites are released after we've released the lock.
+	std::list<Entry> discarded;
+	{
+		CriticalSectionLocker locker(lock);
+		pending.clear();
+		cacheIndex.clear();
+		discarded.splice(discarded.end(), cache);
+		++generation;
+	}
+}
+
+void MediaPrefetcher::ClearEvicted()
+{
+	// Move the evicted list into a local under the lock, then let the
+	// local go out of scope after we've released the lock, so that we
+	// don't hold the lock while D3D frees the resources.
+	std::list<RefPtr<Sprite>> lst;
+	{
+		CriticalSectionLocker locker(lock);
+		lst.splice(lst.end(), evicted);
+	}
+}
+
+DWORD WINAPI MediaPrefetcher::SThreadMain(LPVOID lParam)
+{
+	return reinterpret_cast<MediaPrefetcher*>(lParam)->ThreadMain();
+}
+
+DWORD MediaPrefetcher::ThreadMain()
+{
+	// Initialize COM in multi-threaded mode.  The WIC image loader
+	// requires COM.
+	CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+	// process requests until told to exit
+	while (!exiting)
+	{
+		// wait for new requests
+		WaitForSingleObject(hRequestEvent, INFINITE);
+
+		// process the pending requests
+		while (!exiting)
+		{
+			// get the next request that isn't already in the cache
+			std::unique_ptr<Request> req;
+			DWORD gen;
+			{
+				CriticalSectionLocker locker(lock);
+				while (pending.size() != 0 && req == nullptr)
+				{
+					if (cacheIndex.find(pending.front().key) == cacheIndex.end())
+						req.reset(new Request(pending.front()));
+					pending.pop_front();
+				}
+				gen = generation;
+			}
+
+			// if there's nothing left to do, go back to waiting
+			if (req == nullptr)
+				break;
+
+			if (req->warmFile.length() != 0)
+			{
+				// File warming request.  Read the first part of the file,
+				// to bring it into the Windows file cache.  We don't need
+				// the whole file; the head contains the container headers
+				// and the first frames, which is what the video player needs
+				// to start playback.
+				HandleHolder hFile = CreateFile(req->warmFile.c_str(), GENERIC_READ,
+					FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+					FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+				if (hFile != INVALID_HANDLE_VALUE)
+				{
+					const DWORD warmSize = 2 * 1024 * 1024;
+					std::unique_ptr<BYTE[]> buf(new BYTE[65536]);
+					DWORD nRead;
+					for (DWORD total = 0; total < warmSize && !exiting; total += nRead)
+					{
+						if (!ReadFile(hFile, buf.get(), 65536, &nRead, NULL) || nRead == 0)
+							break;
+					}
+				}
+
+				// Enter the file in the cache with no sprite, so that we
+				// don't warm it again while it's still likely to be in the
+				// file cache.
+				CriticalSectionLocker locker(lock);
+				if (gen == generation && cacheIndex.find(req->key) == cacheIndex.end())
+				{
+					cache.emplace_front();
+					cache.front().key = req->key;
+					cacheIndex.emplace(req->key, cache.begin());
+				}
+			}
+			else
+			{
+				// Sprite request.  Create the sprite and invoke the loader.
+				RefPtr<Sprite> sprite(new Sprite());
+				bool ok = req->load(sprite);
+
+				// Add it to the cache, as long as the load succeeded and the
+				// cache hasn't been cleared while we were working.
+				CriticalSectionLocker locker(lock);
+				if (ok && gen == generation && cacheIndex.find(req->key) == cacheIndex.end())
+				{
+					cache.emplace_front();
+					cache.front().key = req->key;
+					cache.front().sprite.Attach(sprite.Detach());
+					cacheIndex.emplace(req->key, cache.begin());
+				}
+				else
+				{
+					// We're not keeping the sprite.  Don't release it here,
+					// since that would free the D3D resources on this thread;
+					// transfer our reference to the evicted list instead, so
+					// that the UI thread releases it.
+					evicted.emplace_back();
+					evicted.back().Attach(sprite.Detach());
+				}
+			}
+
+			// Trim the cache to the capacity limit, by evicting the least
+			// recently used items.  Park evicted sprites for release on
+			// the UI thread.
+			CriticalSectionLocker locker(lock);
+			while (cache.size() > capacity)
+			{
+				auto &e = cache.back();
+				if (e.sprite != nullptr)
+				{
+					evicted.emplace_back();
+					evicted.back().Attach(e.sprite.Detach());
+				}
+				cacheIndex.erase(e.key);
+				cache.pop_back();
+			}
+		}
+	}
+
+	// done with COM
+	CoUninitialize();
+	return 0;
+}
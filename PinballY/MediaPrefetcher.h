@@ -0,0 +1,140 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media prefetcher.  This loads media that we expect to need soon on
+// a background thread, and keeps the results in a bounded LRU cache.
+// The playfield view uses this to load the wheel images and playfield
+// media for the games adjacent to the current selection, so that the
+// media are already loaded when the user moves through the wheel.
+//
+// The cache holds "template" sprites: fully loaded Sprite objects with
+// their D3D textures and meshes.  Consumers don't use the template
+// sprites directly, since each on-screen sprite has its own position,
+// scale, and alpha.  Instead, they create a new sprite that shares the
+// template's texture via Sprite::Load(const Sprite*).  That lets the
+// same image appear in more than one place at a time (e.g., a short
+// game list that wraps around the wheel) without decoding it twice.
+//
+// The D3D11 device object is thread-safe, so the background thread can
+// create textures directly.  Everything else D3D-related stays on the
+// main UI thread, per the rules in D3D.h.  In particular, we never
+// release a cached sprite on the background thread: sprites evicted
+// by the background thread are parked in a list that the UI thread
+// clears the next time it calls in.
+//
+// Besides sprites, the prefetcher can "warm" a file, by reading its
+// initial portion into the Windows file cache.  We use this for video
+// files, which we can't decode in advance because playback is managed
+// by libvlc, but which open much faster when the head of the file is
+// already in memory (especially on spinning disks).
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <functional>
+
+class Sprite;
+
+class MediaPrefetcher
+{
+public:
+	MediaPrefetcher();
+	~MediaPrefetcher();
+
+	// Prefetch request
+	struct Request
+	{
+		// Sprite load request.  The 'load' callback runs on the
+		// background thread, so it must be thread-safe; the easiest way
+		// to accomplish this is to capture only copies of the data it
+		// needs, as with BaseView::AsyncSpriteLoader callbacks.  The
+		// callback returns true if the sprite loaded successfully.
+		Request(const TCHAR *key, std::function<bool(Sprite*)> load) :
+			key(key), load(load) { }
+
+		// File warming request
+		Request(const TCHAR *key, const TCHAR *warmFile) :
+			key(key), warmFile(warmFile) { }
+
+		// cache key
+		TSTRING key;
+
+		// sprite loader callback (for sprite requests)
+		std::function<bool(Sprite*)> load;
+
+		// file to pre-read (for file warming requests)
+		TSTRING warmFile;
+	};
+
+	// Set the prefetch list.  The requests are in priority order, most
+	// urgent first.  This replaces any pending requests that haven't
+	// been started yet, since they presumably reflect an older wheel
+	// position.  Requests for items already in the cache are skipped.
+	void Prefetch(std::list<Request> &requests);
+
+	// Look up a sprite in the cache.  If it's there, fills in 'sprite'
+	// with the cached template sprite, marks it as most recently used,
+	// and returns true.  Returns false if the item isn't cached (either
+	// because we never prefetched it, or because the background load
+	// hasn't finished yet).
+	bool Get(const TCHAR *key, RefPtr<Sprite> &sprite);
+
+	// Set the maximum number of cached items
+	void SetCapacity(size_t n);
+
+	// Discard all cached items and pending requests.  Call this when
+	// media files might have changed, or when the window layout changes
+	// in a way that affects the loaded media.
+	void Clear();
+
+	// Build a cache key from a category prefix and a filename
+	static TSTRING MakeKey(const TCHAR *prefix, const TCHAR *filename);
+
+protected:
+	// start the background thread, if it's not already running
+	bool StartThread();
+
+	// thread entrypoint
+	static DWORD WINAPI SThreadMain(LPVOID lParam);
+	DWORD ThreadMain();
+
+	// release sprites evicted by the background thread
+	void ClearEvicted();
+
+	// cache entry
+	struct Entry
+	{
+		TSTRING key;
+		RefPtr<Sprite> sprite;
+	};
+
+	// Cached items, most recently used first, and the index by key
+	std::list<Entry> cache;
+	std::unordered_map<TSTRING, std::list<Entry>::iterator> cacheIndex;
+
+	// maximum number of cached items
+	size_t capacity;
+
+	// Pending requests, in priority order
+	std::list<Request> pending;
+
+	// Cache generation.  Clear() increments this, so that the thread can
+	// tell that a load it started before the Clear() is now stale.
+	DWORD generation;
+
+	// Sprites evicted from the cache by the background thread, waiting
+	// to be released on the UI thread
+	std::list<RefPtr<Sprite>> evicted;
+
+	// background thread handle
+	HandleHolder hThread;
+
+	// request event - signaled when new requests are available
+	HandleHolder hRequestEvent;
+
+	// thread exit flag
+	volatile bool exiting;
+
+	// resource lock for the cache and request list
+	CriticalSection lock;
+};
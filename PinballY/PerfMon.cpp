@@ -8,6 +8,7 @@
 #include <d3d11_1.h>
 #include <DirectXMath.h>
 #include "PerfMon.h"
+#include "LogFile.h"
 
 #pragma comment(lib, "pdh.lib")
 #pragma comment(lib, "winmm.lib")
@@ -168,3 +169,259 @@ bool PerfMon::GetCPUMetrics(CPUMetrics &metrics)
 	// success
 	return true;
 }
+
+
+// -----------------------------------------------------------------------
+//
+// Performance zones
+//
+
+HiResTimer PerfZone::timer;
+
+PerfZone::State &PerfZone::GetState()
+{
+	static State state;
+	return state;
+}
+
+int PerfZone::Register(const TCHAR *name)
+{
+	auto &state = GetState();
+	CriticalSectionLocker locker(state.lock);
+	state.zones.emplace_back(name);
+	return (int)state.zones.size() - 1;
+}
+
+PerfZone::ThreadRing *PerfZone::GetThreadRing()
+{
+	// Thread-local ring holder.  When the thread exits, this releases
+	// the ring for re-use by another thread.
+	struct Holder
+	{
+		~Holder()
+		{
+			if (ring != nullptr)
+				InterlockedExchange(&ring->inUse, 0);
+		}
+		ThreadRing *ring = nullptr;
+	};
+	static thread_local Holder holder;
+
+	// assign a ring if we don't have one yet
+	if (holder.ring == nullptr)
+	{
+		auto &state = GetState();
+		CriticalSectionLocker locker(state.lock);
+
+		// look for a ring released by an exited thread
+		for (auto &r : state.rings)
+		{
+			if (InterlockedCompareExchange(&r->inUse, 1, 0) == 0)
+			{
+				holder.ring = r.get();
+				break;
+			}
+		}
+
+		// if there wasn't one, allocate a new one
+		if (holder.ring == nullptr)
+		{
+			holder.ring = state.rings.emplace_back(new ThreadRing()).get();
+			holder.ring->inUse = 1;
+		}
+
+		// assign it to this thread
+		holder.ring->tid = GetCurrentThreadId();
+	}
+
+	return holder.ring;
+}
+
+void PerfZone::Record(int zone, int64_t t0, int64_t t1)
+{
+	// Write the event into the thread's ring.  Only this thread writes
+	// to the ring, so we can simply store the event and then advance
+	// the head.  The interlocked store of the head is a full barrier,
+	// so the collector can't see the new head before the event data.
+	ThreadRing *ring = GetThreadRing();
+	LONG64 head = ring->head;
+	ring->events[head % ThreadRing::Size] = { zone, ring->tid, t0, t1 };
+	InterlockedExchange64(&ring->head, head + 1);
+}
+
+void PerfZone::Collect()
+{
+	auto &state = GetState();
+	CriticalSectionLocker locker(state.lock);
+	CollectLocked(state);
+}
+
+void PerfZone::CollectLocked(State &state)
+{
+	// allocate the history on first use
+	if (state.history.size() == 0)
+		state.history.resize(State::HistorySize);
+
+	for (auto &r : state.rings)
+	{
+		// If the writer has lapped us, skip ahead to the oldest event
+		// still in the ring.
+		LONG64 head = r->head;
+		LONG64 tail = max(r->tail, head - ThreadRing::Size);
+
+		for (; tail < head; ++tail)
+		{
+			// copy the event
+			Event ev = r->events[tail % ThreadRing::Size];
+
+			// Make sure the writer didn't overwrite the slot while we were
+			// copying it.  If it did, the writer is a full ring ahead of
+			// this event, so the event is lost anyway.  The writer stores
+			// event tail + Size into our slot *before* it advances the head
+			// past it, so the slot is suspect as soon as the head reaches
+			// tail + Size.
+			if (r->head - tail >= ThreadRing::Size)
+				continue;
+
+			// add it to the zone's statistics window
+			if (ev.zone >= 0 && ev.zone < (int)state.zones.size())
+			{
+				auto &z = state.zones[ev.zone];
+				float ms = float((ev.t1 - ev.t0) * timer.GetTickTime_sec() * 1000.0);
+				if (z.window.size() < ZoneInfo::WindowSize)
+					z.window.push_back(ms);
+				else
+					z.window[z.count % ZoneInfo::WindowSize] = ms;
+				++z.count;
+			}
+
+			// add it to the trace history
+			state.history[state.historyNext++ % State::HistorySize] = ev;
+		}
+
+		r->tail = tail;
+	}
+}
+
+void PerfZone::GetStats(std::vector<ZoneStats> &stats)
+{
+	auto &state = GetState();
+	CriticalSectionLocker locker(state.lock);
+
+	stats.clear();
+	std::vector<float> sorted;
+	for (auto &z : state.zones)
+	{
+		// skip zones that haven't run
+		if (z.window.size() == 0)
+			continue;
+
+		// sort the window to find the percentiles
+		sorted = z.window;
+		std::sort(sorted.begin(), sorted.end());
+		auto Pct = [&sorted](float p) { return sorted[(size_t)(p * (sorted.size() - 1) + 0.5f)]; };
+
+		auto &s = stats.emplace_back();
+		s.name = z.name;
+		s.count = z.count;
+		s.p50_ms = Pct(0.50f);
+		s.p95_ms = Pct(0.95f);
+		s.p99_ms = Pct(0.99f);
+		s.max_ms = sorted.back();
+	}
+}
+
+// Quote a string for use as a JSON string literal
+static CSTRING JsonQuote(const TCHAR *str)
+{
+	CSTRING s = TSTRINGToCSTRING(str);
+	CSTRING q = "\"";
+	for (auto c : s)
+	{
+		switch (c)
+		{
+		case '"':
+		case '\\':
+			q.push_back('\\');
+			q.push_back(c);
+			break;
+
+		default:
+			// escape control characters numerically
+			if ((unsigned char)c < 0x20)
+			{
+				char buf[8];
+				sprintf_s(buf, "\\u%04x", (unsigned char)c);
+				q.append(buf);
+			}
+			else
+				q.push_back(c);
+			break;
+		}
+	}
+	q.push_back('"');
+	return q;
+}
+
+bool PerfZone::WriteTrace(const TCHAR *filename, ErrorHandler &eh)
+{
+	auto &state = GetState();
+	CriticalSectionLocker locker(state.lock);
+
+	// bring in any pending events
+	CollectLocked(state);
+
+	// open the file
+	FILE *fp = nullptr;
+	if (int err = _tfopen_s(&fp, filename, _T("w")); err != 0)
+	{
+		eh.Error(MsgFmt(IDS_ERR_OPENFILE, filename, FileErrorMessage(err).c_str()));
+		return false;
+	}
+
+	// Figure the range of the history ring that's populated.  Events
+	// from different threads are interleaved in collection order, not
+	// time order, but the trace viewer sorts them by time anyway.
+	size_t n = min(state.historyNext, State::HistorySize);
+	size_t start = state.historyNext - n;
+
+	// Find the earliest time, to use as the trace origin.  Chrome
+	// trace timestamps are in microseconds.
+	int64_t origin = INT64_MAX;
+	for (size_t i = 0; i < n; ++i)
+		origin = min(origin, state.history[(start + i) % State::HistorySize].t0);
+	double usPerTick = timer.GetTickTime_us();
+
+	// quote the zone names for the JSON output
+	std::vector<CSTRING> names;
+	for (auto &z : state.zones)
+		names.emplace_back(JsonQuote(z.name.c_str()));
+
+	// write the events as "complete" (ph:X) events
+	DWORD pid = GetCurrentProcessId();
+	fprintf(fp, "{\"traceEvents\":[\n");
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Event &ev = state.history[(start + i) % State::HistorySize];
+		fprintf(fp, "%s{\"name\":%s,\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu}\n",
+			i == 0 ? "" : ",",
+			names[ev.zone].c_str(),
+			(ev.t0 - origin) * usPerTick, (ev.t1 - ev.t0) * usPerTick,
+			pid, ev.tid);
+	}
+	fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	// check for errors while closing the file
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok)
+	{
+		eh.Error(MsgFmt(IDS_ERR_WRITEFILE, filename, FileErrorMessage(errno).c_str()));
+		return false;
+	}
+
+	// log it
+	LogFile::Get()->Write(_T("Performance trace: %d events written to %s\n"), (int)n, filename);
+	return true;
+}
@@ -7,8 +7,11 @@
 
 #include "stdafx.h"
 #include <Pdh.h>
+#include <vector>
 #include "HiResTimer.h"
 
+class ErrorHandler;
+
 
 class PerfMon
 {
@@ -87,3 +90,138 @@ protected:
 	int nCpuCores;
 	HCOUNTER hCoreCounter[16];
 };
+
+
+// Performance zones.  A zone is a named section of code that we time
+// on each execution, such as a frame render or a media lookup.  Mark a
+// zone by putting PERF_ZONE(_T("name")) at the top of a block; this
+// times the execution from that point to the end of the block.
+//
+// Zones are meant for hot paths, so recording is cheap: each thread
+// writes its timings into its own fixed-size ring buffer, without any
+// locking.  The UI periodically calls Collect() to drain the thread
+// rings into the per-zone statistics, which track the percentiles
+// over a trailing window of executions.  We also keep a longer history
+// of individual events that can be written out as a Chrome trace file
+// (viewable in chrome://tracing or Perfetto), to see exactly where the
+// time went during a hitch.
+//
+class PerfZone
+{
+public:
+	// Register a zone name, returning its ID.  The PERF_ZONE macro does
+	// this once per call site, via a function-local static.
+	static int Register(const TCHAR *name);
+
+	// Scoped zone timer.  This times its own lifetime and records the
+	// result under its zone ID.
+	class Scope
+	{
+	public:
+		Scope(int zone) : zone(zone), t0(timer.GetTime_ticks()) { }
+		~Scope() { Record(zone, t0, timer.GetTime_ticks()); }
+
+	protected:
+		int zone;
+		int64_t t0;
+	};
+
+	// Record a zone execution, with start and end times in timer ticks
+	static void Record(int zone, int64_t t0, int64_t t1);
+
+	// Collect new events from all threads into the statistics.  This
+	// should be called periodically from the UI thread.
+	static void Collect();
+
+	// Zone statistics
+	struct ZoneStats
+	{
+		TSTRING name;       // zone name
+		UINT64 count;       // total executions recorded
+		float p50_ms;       // median time, in milliseconds
+		float p95_ms;       // 95th percentile
+		float p99_ms;       // 99th percentile
+		float max_ms;       // maximum
+	};
+
+	// Get the statistics for all zones that have been executed at least
+	// once.  The percentiles and maximum cover the most recent window of
+	// executions for each zone.
+	static void GetStats(std::vector<ZoneStats> &stats);
+
+	// Write the event history to a file in Chrome trace event JSON
+	// format.  This collects any pending events first.
+	static bool WriteTrace(const TCHAR *filename, ErrorHandler &eh);
+
+protected:
+	// timer
+	static HiResTimer timer;
+
+	// recorded event
+	struct Event
+	{
+		int zone;
+		DWORD tid;
+		int64_t t0;
+		int64_t t1;
+	};
+
+	// Per-thread event ring.  Only the owning thread writes events,
+	// advancing 'head'; only the collector reads them, advancing
+	// 'tail'.  If the writer gets more than a full ring ahead, the
+	// oldest events are lost.  Rings are recycled when threads exit,
+	// so that short-lived worker threads don't each leave a ring
+	// behind.
+	struct ThreadRing
+	{
+		static const int Size = 4096;
+		Event events[Size];
+		volatile LONG64 head = 0;
+		LONG64 tail = 0;
+		DWORD tid = 0;
+		volatile LONG inUse = 0;
+	};
+
+	// get the current thread's ring, assigning one if necessary
+	static ThreadRing *GetThreadRing();
+
+	// Statistics per zone.  We keep a window of recent execution
+	// times, in a ring, for the percentile calculations.
+	struct ZoneInfo
+	{
+		ZoneInfo(const TCHAR *name) : name(name), count(0) { }
+		TSTRING name;
+		UINT64 count;
+		static const int WindowSize = 1024;
+		std::vector<float> window;
+	};
+
+	// Global state.  This is allocated on first use, so that zones can
+	// be registered during static initialization.
+	struct State
+	{
+		// lock for the zone list, the thread ring list, and the statistics
+		CriticalSection lock;
+
+		// zones, indexed by ID
+		std::vector<ZoneInfo> zones;
+
+		// all thread rings ever allocated
+		std::vector<std::unique_ptr<ThreadRing>> rings;
+
+		// event history for trace files, as a ring
+		static const size_t HistorySize = 65536;
+		std::vector<Event> history;
+		size_t historyNext = 0;
+	};
+	static State &GetState();
+
+	// collect events; the caller must hold the state lock
+	static void CollectLocked(State &state);
+};
+
+#define PERF_ZONE_CONCAT2(a, b) a##b
+#define PERF_ZONE_CONCAT(a, b) PERF_ZONE_CONCAT2(a, b)
+#define PERF_ZONE(name) \
+	static const int PERF_ZONE_CONCAT(perfZoneId_, __LINE__) = PerfZone::Register(name); \
+	PerfZone::Scope PERF_ZONE_CONCAT(perfZoneScope_, __LINE__)(PERF_ZONE_CONCAT(perfZoneId_, __LINE__))
@@ -31,6 +31,7 @@
 #include "MouseButtons.h"
 #include "AudioManager.h"
 #include "DOFClient.h"
+#include "DOFOutput.h"
 #include "AudioVideoPlayer.h"
 #include "VLCAudioVideoPlayer.h"
 #include "DateUtil.h"
@@ -41,6 +42,7 @@
 #include "SevenZipIfc.h"
 #include "RealDMD.h"
 #include "VPinMAMEIfc.h"
+#include "CaptureEncoder.h"
 #include "../OptionsDialog/OptionsDialogExports.h"
 
 using namespace DirectX;
@@ -62,6 +64,7 @@ namespace ConfigVars
 	static const TCHAR *CreditBalance = _T("CreditBalance");
 	static const TCHAR *MaxCreditBalance = _T("MaxCreditBalance");
 	static const TCHAR *RealDMD = _T("RealDMD");
+	static const TCHAR *MediaPrefetchCount = _T("MediaPrefetch.Count");
 };
 
 // include the capture-related variables
@@ -84,11 +87,13 @@ PlayfieldView::PlayfieldView() :
 	wheelAnimMode = WheelAnimNone;
 	menuAnimMode = MenuAnimNone;
 	muteButtons = false;
-	lastDOFEventTime = 0;
 	coinBalance = 0.0f;
 	bankedCredits = 0.0f;
 	maxCredits = 0.0f;
 	lastInputEventTime = GetTickCount();
+	prefetchCount = 3;
+	nPendingPresentInputTimes = 0;
+	ZeroMemory(kbRawInputTime, sizeof(kbRawInputTime));
 	
 	// note the exit key mode
 	TSTRING exitMode = ConfigManager::GetInstance()->Get(ConfigVars::ExitKeyMode, _T("select"));
@@ -376,6 +381,10 @@ bool PlayfieldView::OnDestroy()
 	// revoke our drop target registration
 	RevokeDragDrop(hWnd);
 
+	// stop any media drop import in progress
+	if (mediaDropImporter != nullptr)
+		mediaDropImporter->Cancel();
+
 	// inherit the base class handling
 	return __super::OnDestroy();
 }
@@ -483,23 +492,10 @@ bool PlayfieldView::OnTimer(WPARAM timer, LPARAM callback)
 		KillTimer(hWnd, killGameTimerID);
 		return true;
 
-	case jsRepeatTimerID:
-		// process a joystick button auto-repeat
-		OnJsAutoRepeatTimer();
-		return true;
-
-	case kbRepeatTimerID:
-		OnKbAutoRepeatTimer();
-		return true;
-
 	case attractModeTimerID:
 		attractMode.OnTimer(this);
 		return true;
 
-	case dofPulseTimerID:
-		OnDOFTimer();
-		return true;
-
 	case creditsDispTimerID:
 		OnCreditsDispTimer();
 		return true;
@@ -986,10 +982,12 @@ bool PlayfieldView::HandleKeyEvent(BaseWin *win, UINT msg, WPARAM wParam, LPARAM
 	// or an auto-repeat event (KeyRepeat).  We can distinguish those by 
 	// bit 30 of the lParam.
 	KeyPressType mode;
+	int64_t inputTime;
 	if (msg == WM_KEYUP)
 	{
 		// key up event
 		mode = KeyUp;
+		inputTime = GetKeyEventTime(wParam);
 
 		// stop any auto-repeat in effect
 		StopAutoRepeat();
@@ -1000,23 +998,27 @@ bool PlayfieldView::HandleKeyEvent(BaseWin *win, UINT msg, WPARAM wParam, LPARAM
 		// so this is an auto-repeat.  Skip these: we synthesize our own
 		// repeat events instead using a timer, to make the handling more
 		// consistent across different keyboard types.  Simply treat the
-		// event as handled.
+		// event as handled.  Discard the raw input time for the repeat,
+		// since nothing will consume it.
+		if (wParam < countof(kbRawInputTime))
+			kbRawInputTime[wParam] = 0;
 		return true;
 	}
 	else
 	{
 		// first key-down event for a key press
 		mode = KeyDown;
+		inputTime = GetKeyEventTime(wParam);
 
 		// start a new auto-repeat timer
-		KbAutoRepeatStart(vkey, KeyRepeat);
+		KbAutoRepeatStart(vkey, KeyRepeat, inputTime);
 	}
 
 	// determine if we have a handler
 	if (auto it = vkeyToCommand.find(vkey); it != vkeyToCommand.end())
 	{
 		// We found a handler for the key.  Process the key press.
-		ProcessKeyPress(win->GetHWnd(), mode, it->second);
+		ProcessKeyPress(win->GetHWnd(), mode, it->second, inputTime);
 
 		// the key event was handled
 		return true;
@@ -1026,14 +1028,41 @@ bool PlayfieldView::HandleKeyEvent(BaseWin *win, UINT msg, WPARAM wParam, LPARAM
 	return false;
 }
 
+int64_t PlayfieldView::GetKeyEventTime(WPARAM vkey)
+{
+	// Use the arrival time of the raw input event for the key, if we
+	// saw one, consuming it so that it's not applied to a later event.
+	int64_t now = inputTimer.GetTime_ticks();
+	if (vkey < countof(kbRawInputTime) && kbRawInputTime[vkey] != 0)
+	{
+		int64_t t = kbRawInputTime[vkey];
+		kbRawInputTime[vkey] = 0;
+
+		// Windows delivers the raw input just ahead of the WM_KEYDOWN,
+		// so the raw input should be no older than the key message.  If
+		// it's older, it's left over from a key press whose WM_KEYDOWN
+		// went elsewhere (a dialog, say), so it doesn't apply.  The
+		// message time only has the system tick resolution, so allow
+		// a few ticks of slack.
+		const double slackMs = 50.0;
+		double rawAgeMs = (now - t) * inputTimer.GetTickTime_sec() * 1000.0;
+		DWORD msgAgeMs = GetTickCount() - static_cast<DWORD>(GetMessageTime());
+		if (rawAgeMs <= msgAgeMs + slackMs)
+			return t;
+	}
+
+	// no raw input time is available, so use the current time
+	return now;
+}
+
 // Add a key press to the queue and process it
-void PlayfieldView::ProcessKeyPress(HWND hwndSrc, KeyPressType mode, std::list<KeyCommandFunc> funcs)
+void PlayfieldView::ProcessKeyPress(HWND hwndSrc, KeyPressType mode, std::list<KeyCommandFunc> funcs, int64_t inputTime)
 {
 	// add each mapped function to the key queue
 	for  (auto f : funcs)
 	{
 		// queue the command
-		keyQueue.emplace_back(hwndSrc, mode, f);
+		keyQueue.emplace_back(hwndSrc, mode, f, inputTime);
 
 		// Immediately process any DOF effects associated with the key
 		if (f == &PlayfieldView::CmdNext)
@@ -2239,6 +2268,9 @@ void PlayfieldView::ReceiveHighScores(const HighScores::NotifyInfo *ni)
 		// initial high score request for the current game, since it would
 		// have bounced up until now
 		RequestHighScores();
+
+		// start a background refresh for the rest of the games
+		Application::Get()->highScores->RefreshAll(hWnd);
 		break;
 
 	case HighScores::ProgramVersionQuery:
@@ -2254,12 +2286,18 @@ void PlayfieldView::ReceiveHighScores(const HighScores::NotifyInfo *ni)
 		break;
 
 	case HighScores::HighScoreQuery:
-		// High score query results.  First, make sure that the game in the
-		// reply matches the currently selected game.  If it doesn't, ignore
-		// the reply.  This keeps things simple in terms of object lifetime
-		// for the GameListItem object: if the object matches the current
-		// game, we know the pointer is good.
-		if (ni->game == GameList::Get()->GetNthGame(0))
+		// High score query results.  First, make sure that the reply is
+		// for the current game list.  If the game list has been reloaded
+		// since the request was made, the game object no longer exists,
+		// so ignore the reply.
+		if (ni->gameListGeneration != Application::Get()->highScores->GetGameListGeneration())
+			break;
+
+		// Interactive requests are only of interest if the game in the
+		// reply is still the currently selected game.  Batch requests
+		// update any game, so that its scores are ready when the game
+		// is selected.
+		if (ni->batch || ni->game == GameList::Get()->GetNthGame(0))
 		{
 			// If the reply was successful, update the game with the new
 			// high score data from the reply.
@@ -2268,43 +2306,23 @@ void PlayfieldView::ReceiveHighScores(const HighScores::NotifyInfo *ni)
 				// note if this represents a change in the high score data
 				bool hadData = ni->game->highScores.size() != 0;
 
-				// clear any previous high score data
-				ni->game->highScores.clear();
+				// store the new high score data
+				ni->game->SetHighScores(ni->results.c_str());
 
-				// break the new text into lines and populate the list
-				const TCHAR *start = ni->results.c_str();
-				for (;;)
+				// the popups only reflect the current game
+				if (ni->game == GameList::Get()->GetNthGame(0))
 				{
-					// find the end of this line
-					const TCHAR *p = start;
-					for (; *p != 0 && *p != '\n' && *p != '\r'; ++p);
-
-					// add this line to the list
-					ni->game->highScores.emplace_back(start, p - start);
-
-					// if this is the last line, we're done
-					if (*p == 0)
-						break;
-
-					// skip newline sequences - single \n or \r, or \n\r or \r\n pairs
-					if ((*p == '\n' && *(p + 1) == '\r') || (*p == '\r' && *(p + 1) == '\n'))
-						++p;
-					++p;
-
-					// this is the start of the next line
-					start = p;
+					// If we didn't have high scores previously and we do now,
+					// and we're displaying the game info popup, update it to
+					// reflect that we now have high scores.
+					if (popupType == PopupGameInfo && !hadData && ni->results.length() != 0)
+						ShowGameInfo();
+
+					// If we're currently displaying the high scores popup, show 
+					// it again to update it with the new data.
+					if (popupType == PopupHighScores)
+						ShowHighScores();
 				}
-
-				// If we didn't have high scores previously and we do now,
-				// and we're displaying the game info popup, update it to
-				// reflect that we now have high scores.
-				if (popupType == PopupGameInfo && !hadData && ni->results.length() != 0)
-					ShowGameInfo();
-
-				// If we're currently displaying the high scores popup, show 
-				// it again to update it with the new data.
-				if (popupType == PopupHighScores)
-					ShowHighScores();
 			}
 
 			// Set the flag saying that we've queried this game's high
@@ -2413,6 +2431,17 @@ void PlayfieldView::ProcessKeyQueue()
 		QueuedKey key = keyQueue.front();
 		keyQueue.pop_front();
 
+		// Collect latency statistics for initial key presses.  Note the
+		// input time of a foreground press for the input-to-present
+		// measurement on the next frame.
+		if (key.mode == KeyDown || key.mode == KeyBgDown)
+		{
+			int64_t now = inputTimer.GetTime_ticks();
+			inputToCommandLatency.Add((now - key.inputTime) * inputTimer.GetTickTime_sec() * 1000.0);
+			if (key.mode == KeyDown && nPendingPresentInputTimes < countof(pendingPresentInputTime))
+				pendingPresentInputTime[nPendingPresentInputTimes++] = key.inputTime;
+		}
+
 		// process the command
 		(this->*key.func)(key);
 
@@ -2431,11 +2460,16 @@ bool PlayfieldView::IsGameValid(const GameListItem *game)
 
 void PlayfieldView::OnGameListRebuild()
 {
+	// the game list contents can appear in menus, so discard cached menu pages
+	menuPageCache.Clear();
+
 	UpdateSelection();
 }
 
 void PlayfieldView::UpdateSelection()
 {
+	PERF_ZONE(_T("UpdateSelection"));
+
 	// Get the current selection
 	GameListItem *curGame = GameList::Get()->GetNthGame(0);
 
@@ -2458,6 +2492,37 @@ void PlayfieldView::UpdateSelection()
 
 	// refresh the sprite list with the new wheel images
 	UpdateDrawingList();
+
+	// start loading media for the games around the new selection
+	PrefetchNeighbors();
+}
+
+// Figure the normalized sprite size for a playfield image.  Playfield
+// images are always stored "sideways", so the nominal width is the
+// display height.  We display playfield images at 1.0 times the
+// viewport height, so we just need to figure the relative width.
+static POINTF GetPlayfieldImageSize(const ImageFileDesc &imageDesc)
+{
+	float cx = imageDesc.size.cx != 0 ? float(imageDesc.size.cy) / float(imageDesc.size.cx) : 0.5f;
+	return { 1.0f, cx };
+}
+
+// Figure the normalized sprite size for a wheel image.  We use a fixed
+// width, scaling as always to the height, using 1920 pixels as the
+// reference height.
+static POINTF GetWheelImageSize(const ImageFileDesc &imageDesc)
+{
+	float aspect = imageDesc.size.cx != 0 ? float(imageDesc.size.cy) / float(imageDesc.size.cx) : 1.0f;
+	float width = 0.44f;
+	float height = width * aspect;
+
+	// If that makes the image too tall, scale it down to limit the height
+	if (height > 0.25f)
+	{
+		height = 0.25f;
+		width = height / (aspect > .01f ? aspect : 1.0f);
+	}
+	return { width, height };
 }
 
 void PlayfieldView::LoadIncomingPlayfieldMedia(GameListItem *game)
@@ -2486,6 +2551,29 @@ void PlayfieldView::LoadIncomingPlayfieldMedia(GameListItem *game)
 		game->GetMediaItem(image, GameListItem::playfieldImageType);
 	}
 
+	// If we're showing a still image, check the prefetch cache.  If
+	// the image is already loaded, we can simply share its texture in
+	// a new sprite, skipping the loader entirely.
+	RefPtr<Sprite> cached;
+	if (video.length() == 0 && image.length() != 0
+		&& prefetcher.Get(MediaPrefetcher::MakeKey(_T("pf"), image.c_str()).c_str(), cached))
+	{
+		RefPtr<VideoSprite> sprite(new VideoSprite());
+		if (sprite->Load(cached))
+		{
+			// set it up the same way the loader below would
+			sprite->alpha = 0;
+			sprite->rotation.z = XM_PI/2.0f;
+			sprite->UpdateWorld();
+			IncomingPlayfieldMediaDone(sprite);
+
+			// do the same post-load updates as the normal path
+			UpdateAllStatusText();
+			RequestHighScores();
+			return;
+		}
+	}
+
 	// Asynchronous loader function
 	HWND hWnd = this->hWnd;
 	SIZE szLayout = this->szLayout;
@@ -2509,15 +2597,10 @@ void PlayfieldView::LoadIncomingPlayfieldMedia(GameListItem *game)
 		// If there's no video, try a static image
 		if (!ok && image.length() != 0)
 		{
-			// Get the image's native size, and figure the aspect
-			// ratio.  Playfield images are always stored "sideways",
-			// so the nominal width is the display height.  We display
-			// playfield images at 1.0 times the viewport height, so
-			// we just need to figure the relative width.
+			// Get the image's native size, and figure the sprite size
 			ImageFileDesc imageDesc;
 			GetImageFileInfo(image.c_str(), imageDesc);
-			float cx = imageDesc.size.cx != 0 ? float(imageDesc.size.cy) / float(imageDesc.size.cx) : 0.5f;
-			POINTF normSize = { 1.0f, cx };
+			POINTF normSize = GetPlayfieldImageSize(imageDesc);
 
 			// figure the corresponding pixel size
 			SIZE pixSize = { (int)(normSize.y * szLayout.cy), (int)(normSize.x * szLayout.cx) };
@@ -2617,28 +2700,24 @@ Sprite *PlayfieldView::LoadWheelImage(const GameListItem *game)
     Application::InUiErrorHandler eh;
 	if (IsGameValid(game) && game->GetMediaItem(path, GameListItem::wheelImageType))
 	{
-		// Get the image's native size.  Figure the sprite size based on
-		// a fixed width, scaling as always to the height, using 1920 pixels
-		// as the reference height.
-		ImageFileDesc imageDesc;
-		GetImageFileInfo(path.c_str(), imageDesc);
-		float aspect = imageDesc.size.cx != 0 ? float(imageDesc.size.cy) / float(imageDesc.size.cx) : 1.0f;
-		float width = 0.44f;
-		float height = width * aspect;
+		// if the prefetcher has already loaded the image, share its texture
+		RefPtr<Sprite> cached;
+		if (prefetcher.Get(MediaPrefetcher::MakeKey(_T("wheel"), path.c_str()).c_str(), cached))
+			ok = sprite->Load(cached);
 
-		// If that makes the image too tall, scale it down to limit the height
-		if (height > 0.25f)
+		if (!ok)
 		{
-			height = 0.25f;
-			width = height / (aspect > .01f ? aspect : 1.0f);
-		}
-		POINTF normSize = { width, height };
+			// Get the image's native size, and figure the sprite size
+			ImageFileDesc imageDesc;
+			GetImageFileInfo(path.c_str(), imageDesc);
+			POINTF normSize = GetWheelImageSize(imageDesc);
 
-		// figure the corresponding pixel size
-		SIZE pixSize = { (int)(width * szLayout.cx), (int)(height * szLayout.cy) };
+			// figure the corresponding pixel size
+			SIZE pixSize = { (int)(normSize.x * szLayout.cx), (int)(normSize.y * szLayout.cy) };
 
-		// Load the image
-		ok = sprite->Load(path.c_str(), normSize, pixSize, eh);
+			// Load the image
+			ok = sprite->Load(path.c_str(), normSize, pixSize, eh);
+		}
 	}
 
 	// if we didn't load a sprite, synthesize a default image
@@ -2791,7 +2870,10 @@ void PlayfieldView::SwitchToGame(int n, bool fast, bool byUserCommand)
 		// has a database entry, mark it as configured
 		if (auto game = GameList::Get()->GetNthGame(0);
 			game != nullptr && !game->isConfigured && game->dbFile != nullptr)
+		{
 			game->isConfigured = true;
+			GameList::Get()->OnGameFilterDataChanged(game);
+		}
 	}
 
 	// Load the new wheel images coming into view.  The wheel shows
@@ -2888,10 +2970,91 @@ void PlayfieldView::SwitchToGame(int n, bool fast, bool byUserCommand)
 	// set the new selection in the game list
 	GameList::Get()->SetGame(n);
 
+	// start loading media for the games around the new selection
+	PrefetchNeighbors();
+
 	// enter wheel animation mode
 	StartWheelAnimation(fast);
 }
 
+void PlayfieldView::PrefetchNeighbors()
+{
+	// do nothing if prefetching is disabled
+	if (prefetchCount <= 0)
+		return;
+
+	// Build the request list, most urgent first.  Work outwards from the
+	// current selection, alternating directions, since the next game in
+	// either direction is the most likely to be needed next.  At each
+	// distance, we want the playfield media for the game at that distance,
+	// and the wheel image for the game that will come into view at the
+	// edge of the wheel if we move that far.  (The wheel already shows
+	// two games on either side of the selection.)
+	GameList *gl = GameList::Get();
+	bool enableVideo = Application::Get()->IsEnableVideo();
+	SIZE szLayout = this->szLayout;
+	std::list<MediaPrefetcher::Request> requests;
+	for (int i = 1; i <= prefetchCount; ++i)
+	{
+		for (int dir = 1; dir >= -1; dir -= 2)
+		{
+			// Playfield media.  If the game has a video, we can't decode it
+			// in advance, but we can at least read the head of the file into
+			// the OS file cache so that it opens quickly.  Otherwise, load
+			// the still image.
+			TSTRING path;
+			if (GameListItem *game = gl->GetNthGame(i * dir); IsGameValid(game))
+			{
+				if (enableVideo && game->GetMediaItem(path, GameListItem::playfieldVideoType))
+				{
+					requests.emplace_back(MediaPrefetcher::MakeKey(_T("pfvideo"), path.c_str()).c_str(), path.c_str());
+				}
+				else if (game->GetMediaItem(path, GameListItem::playfieldImageType))
+				{
+					requests.emplace_back(MediaPrefetcher::MakeKey(_T("pf"), path.c_str()).c_str(),
+						[path, szLayout](Sprite *sprite)
+					{
+						// Flash objects have to be loaded on the UI thread, so
+						// skip anything that isn't a plain image
+						ImageFileDesc imageDesc;
+						if (!GetImageFileInfo(path.c_str(), imageDesc) || imageDesc.imageType == ImageFileDesc::SWF)
+							return false;
+
+						// load it at the same size LoadIncomingPlayfieldMedia uses
+						POINTF normSize = GetPlayfieldImageSize(imageDesc);
+						SIZE pixSize = { (int)(normSize.y * szLayout.cy), (int)(normSize.x * szLayout.cx) };
+						SilentErrorHandler eh;
+						return sprite->Load(path.c_str(), normSize, pixSize, eh);
+					});
+				}
+			}
+
+			// wheel image for the game coming into view at the edge of the wheel
+			if (GameListItem *game = gl->GetNthGame((i + 2) * dir);
+				IsGameValid(game) && game->GetMediaItem(path, GameListItem::wheelImageType))
+			{
+				requests.emplace_back(MediaPrefetcher::MakeKey(_T("wheel"), path.c_str()).c_str(),
+					[path, szLayout](Sprite *sprite)
+				{
+					// skip Flash objects, as above
+					ImageFileDesc imageDesc;
+					if (!GetImageFileInfo(path.c_str(), imageDesc) || imageDesc.imageType == ImageFileDesc::SWF)
+						return false;
+
+					// load it at the same size LoadWheelImage uses
+					POINTF normSize = GetWheelImageSize(imageDesc);
+					SIZE pixSize = { (int)(normSize.x * szLayout.cx), (int)(normSize.y * szLayout.cy) };
+					SilentErrorHandler eh;
+					return sprite->Load(path.c_str(), normSize, pixSize, eh);
+				});
+			}
+		}
+	}
+
+	// send the new list to the prefetcher
+	prefetcher.Prefetch(requests);
+}
+
 // Start a wheel animation
 void PlayfieldView::StartWheelAnimation(bool fast)
 {
@@ -2914,6 +3077,9 @@ void PlayfieldView::ClearMedia()
 	// remove all wheel images
 	wheelImages.clear();
 
+	// discard prefetched media, since the files might be changing
+	prefetcher.Clear();
+
 	// update the drawing list for the change
 	UpdateDrawingList();
 
@@ -3100,6 +3266,11 @@ bool PlayfieldView::OnUserMessage(UINT msg, WPARAM wParam, LPARAM lParam)
 
 		// clean up the thread monitor in the application
 		Application::Get()->CleanGameMonitor();
+
+		// The game we just ran might have updated its high scores, so
+		// refresh scores in the background.  This picks up any game
+		// whose cached scores were cleared at launch.
+		Application::Get()->highScores->RefreshAll(hWnd);
 		return true;
 
 	case PFVMsgGameLaunchError:
@@ -3121,6 +3292,31 @@ bool PlayfieldView::OnUserMessage(UINT msg, WPARAM wParam, LPARAM lParam)
 		ShowSysError((const TCHAR *)wParam, (const TCHAR *)lParam);
 		return true;
 
+	case PFVMsgKbAutoRepeat:
+		// process a keyboard auto-repeat
+		OnKbAutoRepeatTimer(wParam);
+		return true;
+
+	case PFVMsgJsAutoRepeat:
+		// process a joystick button auto-repeat
+		OnJsAutoRepeatTimer(wParam);
+		return true;
+
+	case PFVMsgMediaDropProgress:
+		// media drop import progress update
+		OnMediaDropProgress();
+		return true;
+
+	case PFVMsgMediaDropDone:
+		// media drop import finished
+		OnMediaDropDone();
+		return true;
+
+	case PFVMsgCaptureEncodeDone:
+		// background capture encoding batch finished
+		CaptureEncoder::OnBatchDone(lParam);
+		return true;
+
 	case PFVMsgPlayElevReqd:
 		// The game we were trying to run failed to launch because the
 		// program requires Admin privileges.  This can be triggered in
@@ -3497,12 +3693,10 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 	tformat.SetAlignment(Gdiplus::StringAlignmentCenter);
 	tformat.SetFormatFlags(tformat.GetFormatFlags() & ~Gdiplus::StringFormatFlagsLineLimit);
 
-	// set up our main text font and checkmark font
+	// set up our main text font and dialog prompt font, for measuring
 	const int ptSize = 42, dlgPtSize = 36, weight = 500;
 	std::unique_ptr<Gdiplus::Font> txtfont(CreateGPFont(_T("Tahoma"), ptSize, weight));
 	std::unique_ptr<Gdiplus::Font> dlgfont(CreateGPFont(_T("Tahoma"), dlgPtSize, weight));
-	std::unique_ptr<Gdiplus::Font> symfont(CreateGPFont(_T("Wingdings"), ptSize, weight));
-	std::unique_ptr<Gdiplus::Font> symfont2(CreateGPFont(_T("Wingdings 3"), ptSize, weight));
 
 	// checkmark and bullet characters in Wingdings
 	static const TCHAR *checkmark = _T("\xFC ");
@@ -3684,12 +3878,26 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 	}, eh, _T("menu hilite")))
 		return;
 
-	// create the text item overlay
-	if (!m->sprItems->Load(boxWid, menuHt, 
-		[this, boxWid, menuHt, &txtfont, &dlgfont, &symfont, &symfont2, &items, &m, 
-		lineHt, spacerHt, yPadding, borderWidth, nPagedItems, nItemsPerPage, &tformat,
-		promptHt, &rcLayout, flags]
-	    (HDC hdc, HBITMAP hbmp)
+	// Lay out the text items for a page.  This figures the vertical
+	// position of each item and records the items to draw in a drawing
+	// list, so that the text rendering itself can be done off the UI
+	// thread.  If 'activate' is true, it also builds the list of active
+	// items and sets the initial selection; we skip that when laying out
+	// other pages to pre-render them.  None of this depends on the
+	// rendered text, so it's all quick.
+	struct MenuDrawItem
+	{
+		enum Type { Spacer, Prompt, Item } type;
+		int y;
+		TSTRING text;
+		bool symbol;       // draw the text in the Wingdings 3 font
+		bool group;        // group label (non-command) item
+		bool checked;      // checkmark
+		bool radioChecked; // radio button checkmark
+		bool hasSubmenu;   // submenu arrow
+	};
+	auto LayoutPage = [&m, borderWidth, spacerHt, lineHt, promptHt, nItemsPerPage, flags]
+		(int page, std::vector<MenuDrawItem> &drawList, bool activate)
 	{
 		// start just below the top border
 		int y = borderWidth;
@@ -3698,43 +3906,24 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 		bool inPagedSection = false;
 		int pagedItemNum = 0;
 
-		// if the page is negative, go to the last page; if we're past
-		// the last page, go to the first page
-		int lastPage = (nPagedItems - 1) / nItemsPerPage;
-		if (menuPage < 0)
-			menuPage = lastPage;
-		else if (menuPage > lastPage)
-			menuPage = 0;
-
 		// figure the range of paged items shown
-		int firstPagedItem = menuPage * nItemsPerPage;
+		int firstPagedItem = page * nItemsPerPage;
 		int lastPagedItem = firstPagedItem + nItemsPerPage - 1;
 
-		// set up the drawing objects
-		Gdiplus::Graphics g(hdc);
-		Gdiplus::SolidBrush textBr(Gdiplus::Color(0xFF, 0xFF, 0xFF, 0xFF));
-		Gdiplus::SolidBrush groupTextBr(Gdiplus::Color(0xFF, 0x00, 0xFF, 0xFF));
-		Gdiplus::Pen pen(Gdiplus::Color(0xff, 0xa0, 0xa0, 0xa0), 2.0f);
 		for (auto &i : m->descs)
 		{
 			// If the command ID is -1 and the text is empty, it's a spacer.
 			// Just add some vertical space.
 			if (i.cmd == -1 && i.text.length() == 0)
 			{
-				int yLine = y + spacerHt / 2 - 1;
-				int inset = 32;
-				g.DrawLine(&pen, inset, yLine, boxWid - inset, yLine);
+				drawList.push_back({ MenuDrawItem::Spacer, y });
 				y += spacerHt;
 				continue;
 			}
 
-			// use the regular text brush for regular items, or the group
-			// brush for non-command items
-			Gdiplus::SolidBrush *br = i.cmd == -1 ? &groupTextBr : &textBr;
-
 			// get the label
 			const TCHAR *text;
-			Gdiplus::Font *font;
+			bool symbol = false;
 			switch (i.cmd)
 			{
 			case ID_MENU_PAGE_UP:
@@ -3744,7 +3933,7 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 
 				// use the up arrow in the symbol font
 				text = upArrow;
-				font = symfont2.get();
+				symbol = true;
 
 				// note that we're entering the paged section
 				inPagedSection = true;
@@ -3757,7 +3946,7 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 
 				// use the down arrow in the symbol font
 				text = downArrow;
-				font = symfont2.get();
+				symbol = true;
 
 				// we're exiting the paged section
 				inPagedSection = false;
@@ -3773,7 +3962,6 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 			default:
 				// use the item's text label
 				text = i.text.c_str();
-				font = txtfont.get();
 
 				// If we're in the paged section, count the item and check
 				// to see if it's within the current page
@@ -3792,63 +3980,24 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 				break;
 			}
 
-			// If this is the prompt text in a dialog-style menu, draw it
-			// in the dialog font, and wrap the text across multiple lines
-			// as needed.
+			// If this is the prompt text in a dialog-style menu, it's drawn
+			// in the dialog font, wrapped across multiple lines as needed.
 			if ((flags & SHOWMENU_DIALOG_STYLE) != 0 && &i == &m->descs.front())
 			{
-				// draw it centered in the layout area
-				g.DrawString(text, -1, dlgfont.get(), rcLayout, &tformat, &textBr);
-
-				// advance by the prompt height
+				// add it to the drawing list, and advance by the prompt height
+				drawList.push_back({ MenuDrawItem::Prompt, y, text });
 				y += promptHt;
 
 				// we're done with this item 
 				continue;
 			}
 
-			// measure the string for centering
-			Gdiplus::RectF rc;
-			Gdiplus::PointF pt(0.0f, float(y + yPadding));
-			g.MeasureString(text, -1, font, pt, &tformat, &rc);
-
-			// figure the centering point
-			pt.X = (boxWid - rc.Width) / 2.0f;
-
-			// draw the checkmark or radio button checkmark if present
-			if (i.checked || i.radioChecked)
-			{
-				// get the appropriate checkmark character
-				const TCHAR *mark = i.checked ? checkmark : bullet;
-
-				// measure the checkmark - note that we center the string
-				// without counting the checkmark, so this hangs off the
-				// left of the box for the text
-				Gdiplus::RectF ckrc;
-				g.MeasureString(mark, -1, symfont.get(), pt, &tformat, &ckrc);
-
-				// draw it to the left of the text box
-				Gdiplus::PointF ptck(pt.X - ckrc.Width - 6, pt.Y + rc.Height - ckrc.Height + 4);
-				g.DrawString(mark, -1, symfont.get(), ptck, br);
-			}
-
-			// draw the submenu arrow if present
-			if (i.hasSubmenu)
-			{
-				// measure the arrow
-				Gdiplus::RectF arrowrc;
-				g.MeasureString(subMenuArrow, -1, symfont2.get(), pt, &tformat, &arrowrc);
-
-				// draw it to the right of the text box
-				Gdiplus::PointF ptarrow(pt.X + rc.Width + 8, pt.Y + rc.Height - arrowrc.Height);
-				g.DrawString(subMenuArrow, -1, symfont2.get(), ptarrow, br);
-			}
-
-			// draw the label text
-			g.DrawString(text, -1, font, pt, br);
+			// add it to the drawing list
+			drawList.push_back({ MenuDrawItem::Item, y, text, symbol, i.cmd == -1,
+				i.checked, i.radioChecked, i.hasSubmenu });
 
 			// If it has a valid command code, add it as an active item
-			if (i.cmd > 0)
+			if (activate && i.cmd > 0)
 			{
 				// Add the menu item to the list.  Note that Page Up and Page Down
 				// commands automatically get the "stay open" flag, since they
@@ -3875,11 +4024,183 @@ void PlayfieldView::ShowMenu(const std::list<MenuItemDesc> &items, DWORD flags,
 			// move to the next item vertically
 			y += lineHt;
 		}
+	};
 
-		// make sure the pixels hit the DIB
-		g.Flush();
-	}, eh, _T("menu items")))
-		return;
+	// Build the key for a page's text image.  The drawing list and the
+	// image size fully determine the image contents, so this identifies
+	// the image both for coalescing in the compositor and for the menu
+	// page cache.  Note that the selection isn't part of the key, since
+	// the selection highlight is a separate sprite.
+	auto MakeItemsKey = [boxWid, menuHt](const std::vector<MenuDrawItem> &drawList)
+	{
+		TSTRING key = MsgFmt(_T("menu items %dx%d"), boxWid, menuHt).Get();
+		for (auto &d : drawList)
+		{
+			key += MsgFmt(_T("\n%d,%d,%d%d%d%d%d:"), (int)d.type, d.y,
+				(int)d.symbol, (int)d.group, (int)d.checked, (int)d.radioChecked, (int)d.hasSubmenu).Get();
+			key += d.text;
+		}
+		return key;
+	};
+
+	// if the page is negative, go to the last page; if we're past
+	// the last page, go to the first page
+	int lastPage = (nPagedItems - 1) / nItemsPerPage;
+	if (menuPage < 0)
+		menuPage = lastPage;
+	else if (menuPage > lastPage)
+		menuPage = 0;
+
+	// lay out the current page
+	std::vector<MenuDrawItem> drawList;
+	LayoutPage(menuPage, drawList, true);
+	TSTRING itemsKey = MakeItemsKey(drawList);
+
+	// If we're replacing the current menu without animation, as when
+	// paging through a long menu, start the new text overlay with the
+	// old menu's text image if the menu size hasn't changed.  This
+	// keeps the text on screen in the brief interval until the new
+	// text image is ready, rather than flashing an empty menu box.
+	if ((flags & SHOWMENU_NO_ANIMATION) != 0 && curMenu != nullptr
+		&& curMenu->sprBkg->loadSize.x == m->sprBkg->loadSize.x
+		&& curMenu->sprBkg->loadSize.y == m->sprBkg->loadSize.y)
+		m->sprItems->Load(curMenu->sprItems);
+
+	// Create the drawing function for a page's text image.  This runs on
+	// a compositor thread, so the drawing function works entirely from
+	// its own copies of the layout data, and sets up its own GDI+ objects.
+	auto MakeDrawFunc = [boxWid, ptSize, dlgPtSize, weight, spacerHt, yPadding, rcLayout]
+		(const std::vector<MenuDrawItem> &drawList) -> std::function<void(HDC, HBITMAP)>
+	{
+		return [drawList, boxWid, ptSize, dlgPtSize, weight, spacerHt, yPadding, rcLayout]
+		    (HDC hdc, HBITMAP hbmp)
+		{
+			// set up the fonts
+			std::unique_ptr<Gdiplus::Font> txtfont(CreateGPFont(_T("Tahoma"), ptSize, weight));
+			std::unique_ptr<Gdiplus::Font> dlgfont(CreateGPFont(_T("Tahoma"), dlgPtSize, weight));
+			std::unique_ptr<Gdiplus::Font> symfont(CreateGPFont(_T("Wingdings"), ptSize, weight));
+			std::unique_ptr<Gdiplus::Font> symfont2(CreateGPFont(_T("Wingdings 3"), ptSize, weight));
+
+			// set up a generic typographic formatter
+			Gdiplus::StringFormat tformat(Gdiplus::StringFormat::GenericTypographic());
+			tformat.SetAlignment(Gdiplus::StringAlignmentCenter);
+			tformat.SetFormatFlags(tformat.GetFormatFlags() & ~Gdiplus::StringFormatFlagsLineLimit);
+
+			// set up the drawing objects
+			Gdiplus::Graphics g(hdc);
+			Gdiplus::SolidBrush textBr(Gdiplus::Color(0xFF, 0xFF, 0xFF, 0xFF));
+			Gdiplus::SolidBrush groupTextBr(Gdiplus::Color(0xFF, 0x00, 0xFF, 0xFF));
+			Gdiplus::Pen pen(Gdiplus::Color(0xff, 0xa0, 0xa0, 0xa0), 2.0f);
+			for (auto &d : drawList)
+			{
+				switch (d.type)
+				{
+				case MenuDrawItem::Spacer:
+					// spacer - draw a divider line
+					{
+						int yLine = d.y + spacerHt / 2 - 1;
+						int inset = 32;
+						g.DrawLine(&pen, inset, yLine, boxWid - inset, yLine);
+					}
+					break;
+
+				case MenuDrawItem::Prompt:
+					// dialog prompt - draw it centered in the layout area
+					g.DrawString(d.text.c_str(), -1, dlgfont.get(), rcLayout, &tformat, &textBr);
+					break;
+
+				case MenuDrawItem::Item:
+					{
+						// use the regular text brush for regular items, or the group
+						// brush for non-command items
+						Gdiplus::SolidBrush *br = d.group ? &groupTextBr : &textBr;
+						const TCHAR *text = d.text.c_str();
+						Gdiplus::Font *font = d.symbol ? symfont2.get() : txtfont.get();
+
+						// measure the string for centering
+						Gdiplus::RectF rc;
+						Gdiplus::PointF pt(0.0f, float(d.y + yPadding));
+						g.MeasureString(text, -1, font, pt, &tformat, &rc);
+
+						// figure the centering point
+						pt.X = (boxWid - rc.Width) / 2.0f;
+
+						// draw the checkmark or radio button checkmark if present
+						if (d.checked || d.radioChecked)
+						{
+							// get the appropriate checkmark character
+							const TCHAR *mark = d.checked ? checkmark : bullet;
+
+							// measure the checkmark - note that we center the string
+							// without counting the checkmark, so this hangs off the
+							// left of the box for the text
+							Gdiplus::RectF ckrc;
+							g.MeasureString(mark, -1, symfont.get(), pt, &tformat, &ckrc);
+
+							// draw it to the left of the text box
+							Gdiplus::PointF ptck(pt.X - ckrc.Width - 6, pt.Y + rc.Height - ckrc.Height + 4);
+							g.DrawString(mark, -1, symfont.get(), ptck, br);
+						}
+
+						// draw the submenu arrow if present
+						if (d.hasSubmenu)
+						{
+							// measure the arrow
+							Gdiplus::RectF arrowrc;
+							g.MeasureString(subMenuArrow, -1, symfont2.get(), pt, &tformat, &arrowrc);
+
+							// draw it to the right of the text box
+							Gdiplus::PointF ptarrow(pt.X + rc.Width + 8, pt.Y + rc.Height - arrowrc.Height);
+							g.DrawString(subMenuArrow, -1, symfont2.get(), ptarrow, br);
+						}
+
+						// draw the label text
+						g.DrawString(text, -1, font, pt, br);
+					}
+					break;
+				}
+			}
+
+			// make sure the pixels hit the DIB
+			g.Flush();
+		};
+	};
+
+	// Get the text image from the page cache if possible.  If it's not
+	// there, draw it, and add it to the cache.
+	if (Sprite *cached = menuPageCache.Get(itemsKey.c_str()); cached != nullptr)
+	{
+		// Share the cached texture.  If the cached image is still being
+		// drawn, load it the same way; the compositor will merge the two
+		// requests, since they have the same key.
+		if (!m->sprItems->Load(cached))
+			m->sprItems->LoadAsync(boxWid, menuHt, itemsKey.c_str(), MakeDrawFunc(drawList), _T("menu items"));
+	}
+	else
+	{
+		// Not cached.  Draw it into the menu sprite and into a new cache
+		// sprite.  Again, the compositor merges the identical requests,
+		// so this only renders the image once.
+		auto draw = MakeDrawFunc(drawList);
+		m->sprItems->LoadAsync(boxWid, menuHt, itemsKey.c_str(), draw, _T("menu items"));
+		menuPageCache.Add(itemsKey.c_str(), boxWid, menuHt, draw);
+
+		// If the menu is paged, pre-render the adjacent pages in the
+		// background, so that Page Up and Page Down can switch to them
+		// instantly.
+		if (m->paged && lastPage > 0)
+		{
+			for (int dir = -1; dir <= 1; dir += 2)
+			{
+				int page = (menuPage + dir + lastPage + 1) % (lastPage + 1);
+				std::vector<MenuDrawItem> pageDrawList;
+				LayoutPage(page, pageDrawList, false);
+				TSTRING pageKey = MakeItemsKey(pageDrawList);
+				if (!menuPageCache.Contains(pageKey.c_str()))
+					menuPageCache.Add(pageKey.c_str(), boxWid, menuHt, MakeDrawFunc(pageDrawList));
+			}
+		}
+	}
 
 	// Select the first item if we didn't already select something else
 	if (m->selected == m->items.end())
@@ -4023,6 +4344,84 @@ void PlayfieldView::Menu::Select(std::list<MenuItem>::iterator sel)
 	}
 }
 
+Sprite *PlayfieldView::MenuPageCache::Get(const TCHAR *key)
+{
+	// look up the page
+	auto it = index.find(key);
+	if (it == index.end())
+	{
+		++misses;
+		return nullptr;
+	}
+
+	// count the hit, and move the page to the front of the LRU list
+	++hits;
+	cache.splice(cache.begin(), cache, it->second);
+	return cache.front().sprite;
+}
+
+void PlayfieldView::MenuPageCache::Add(const TCHAR *key, int width, int height, std::function<void(HDC, HBITMAP)> draw)
+{
+	// if the cache is full, evict the least recently used page
+	if (cache.size() >= capacity)
+	{
+		index.erase(cache.back().key);
+		cache.pop_back();
+	}
+
+	// add the new page at the front of the list
+	cache.emplace_front();
+	Entry &e = cache.front();
+	e.key = key;
+	e.sprite.Attach(new Sprite());
+	index.emplace(e.key, cache.begin());
+
+	// start drawing the image
+	e.sprite->LoadAsync(width, height, key, draw, _T("menu items"));
+}
+
+void PlayfieldView::MenuPageCache::Clear()
+{
+	index.clear();
+	cache.clear();
+}
+
+void PlayfieldView::GetPerfOverlayText(std::list<TSTRING> &lines)
+{
+	// add the menu page cache hit rate
+	UINT64 lookups = menuPageCache.hits + menuPageCache.misses;
+	lines.emplace_back(MsgFmt(_T("Menu page cache: %.1f%% hits (%I64u of %I64u lookups)"),
+		lookups == 0 ? 0.0 : 100.0 * menuPageCache.hits / lookups, menuPageCache.hits, lookups).Get());
+
+	// add the input latency statistics
+	lines.emplace_back(inputToCommandLatency.Format(_T("Input to command")));
+	lines.emplace_back(inputToPresentLatency.Format(_T("Input to present")));
+	if (keyQueue.dropped != 0)
+		lines.emplace_back(MsgFmt(_T("Key queue overflows: %I64u"), keyQueue.dropped).Get());
+
+	// add the DOF output statistics, if DOF is active
+	if (auto output = DOFOutput::Get(); output != nullptr && DOFClient::Get() != nullptr)
+	{
+		DOFOutput::Stats s;
+		output->GetStats(s);
+		lines.emplace_back(MsgFmt(_T("DOF: queue %ld (max %ld), %I64d sent, %I64d coalesced, latency %.1fms avg/%.1fms max"),
+			s.queueDepth, s.maxQueueDepth, s.sent, s.coalesced, s.avgLatency_ms, s.maxLatency_ms).Get());
+	}
+}
+
+void PlayfieldView::OnFramePresented()
+{
+	// record the input-to-present latency for the commands dispatched
+	// since the last frame
+	if (nPendingPresentInputTimes != 0)
+	{
+		int64_t now = inputTimer.GetTime_ticks();
+		for (size_t i = 0; i < nPendingPresentInputTimes; ++i)
+			inputToPresentLatency.Add((now - pendingPresentInputTime[i]) * inputTimer.GetTickTime_sec() * 1000.0);
+		nPendingPresentInputTimes = 0;
+	}
+}
+
 void PlayfieldView::UpdatePopupAnimation(bool opening, float progress)
 {
 	// do nothing if there's no popup
@@ -4110,6 +4509,9 @@ void PlayfieldView::UpdateDrawingList()
 
 	// rescale sprites that vary by window size
 	ScaleSprites();
+
+	// request a new frame to show the updated list
+	InvalidateRender();
 }
 
 void PlayfieldView::ScaleSprites()
@@ -4653,9 +5055,17 @@ bool PlayfieldView::OnRawInputEvent(UINT rawInputCode, RAWINPUT *raw, DWORD dwSi
 
 			// look up the command; if we find a match, process the key press
 			if (auto it = vkeyToCommand.find(vkey); it != vkeyToCommand.end())
-				ProcessKeyPress(hWnd, KeyBgDown, it->second);
+				ProcessKeyPress(hWnd, KeyBgDown, it->second, GetRawInputEventTime());
 		}
 	}
+	else if (raw->header.dwType == RIM_TYPEKEYBOARD
+		&& raw->data.keyboard.VKey < countof(kbRawInputTime))
+	{
+		// Foreground key press or release.  Note the arrival time, so
+		// that we can timestamp the WM_KEYDOWN or WM_KEYUP that Windows
+		// will generate for it.
+		kbRawInputTime[raw->data.keyboard.VKey] = GetRawInputEventTime();
+	}
 
 	// if it's a keyboard event, note the event time, for the purposes 
 	// of the running game inactivity timer
@@ -4681,13 +5091,14 @@ bool PlayfieldView::OnJoystickButtonChange(
 		// figure the key press mode
 		KeyPressType mode = pressed ? (foreground ? KeyDown : KeyBgDown) : KeyUp;
 
-		// process the key press
-		ProcessKeyPress(hWnd, mode, it->second);
+		// process the key press, timestamped with the raw input arrival time
+		int64_t inputTime = GetRawInputEventTime();
+		ProcessKeyPress(hWnd, mode, it->second, inputTime);
 
 		// if it's a key-press event, start auto-repeat; otherwise cancel
 		// any existing auto-repeat
 		if (pressed)
-			JsAutoRepeatStart(js->logjs->index, button, foreground ? KeyRepeat : KeyBgRepeat);
+			JsAutoRepeatStart(js->logjs->index, button, foreground ? KeyRepeat : KeyBgRepeat, inputTime);
 		else
 			StopAutoRepeat();
 	}
@@ -4697,7 +5108,37 @@ bool PlayfieldView::OnJoystickButtonChange(
 	return false;
 }
 
-void PlayfieldView::KbAutoRepeatStart(int vkey, KeyPressType repeatMode)
+int64_t PlayfieldView::GetAutoRepeatDelay()
+{
+	// The Windows parameter is documented as being only an approximation,
+	// but it's supposed to be in 250ms units with a minimum of 250ms.
+	int kbDelay;
+	SystemParametersInfo(SPI_GETKEYBOARDDELAY, 0, &kbDelay, 0);
+	return kbAutoRepeat.timer.MsToTicks(250 + kbDelay * 250);
+}
+
+int64_t PlayfieldView::GetAutoRepeatInterval()
+{
+	// The system parameter for the repeat rate is only approximate,
+	// since the actual repeat function is farmed out to the keyboard
+	// hardware, but the nominal unit system is a frequency value from
+	// 0 to 31, where 0 represents 2.5 Hz and 31 represents 30 Hz.  So
+	// we'll interpolate linearly over this range and invert the value
+	// to get a time value.
+	DWORD rate;
+	SystemParametersInfo(SPI_GETKEYBOARDSPEED, 0, &rate, 0);
+	return kbAutoRepeat.timer.MsToTicks(1000.0 / (2.5 + 0.917 * rate));
+}
+
+void PlayfieldView::ScheduleNextAutoRepeat(PrecisionTimer &timer, UINT msg)
+{
+	// schedule the next repeat one interval after the last one, or now
+	// if we've already passed that time
+	int64_t next = timer.GetDueTime() + GetAutoRepeatInterval();
+	timer.Set(hWnd, msg, 0, max(next, timer.Now()));
+}
+
+void PlayfieldView::KbAutoRepeatStart(int vkey, KeyPressType repeatMode, int64_t pressTime)
 {
 	// remember the key for auto-repeat
 	kbAutoRepeat.vkey = vkey;
@@ -4706,27 +5147,23 @@ void PlayfieldView::KbAutoRepeatStart(int vkey, KeyPressType repeatMode)
 	// auto-repeat is now active
 	kbAutoRepeat.active = true;
 
-	// Start the delay timer for the initial key repeat delay.  The
-	// Windows parameter is documented as being only an approximation,
-	// but it's supposed to be in 250ms units with a minimum of 250ms.
-	//
-	// Note that this replaces any previous auto-repeat timer, which
-	// has exactly the desired effect of starting a new repeat timing
-	// cycle for the new key press.
-	int kbDelay;
-	SystemParametersInfo(SPI_GETKEYBOARDDELAY, 0, &kbDelay, 0);
-	SetTimer(hWnd, kbRepeatTimerID, 250 + kbDelay * 250, 0);
+	// Start the timer for the initial key repeat delay, counting from
+	// the key press.  Note that this replaces any previous auto-repeat
+	// timer, which has exactly the desired effect of starting a new
+	// repeat timing cycle for the new key press.
+	kbAutoRepeat.timer.Set(hWnd, PFVMsgKbAutoRepeat, 0, pressTime + GetAutoRepeatDelay());
 }
 
-void PlayfieldView::OnKbAutoRepeatTimer()
+void PlayfieldView::OnKbAutoRepeatTimer(WPARAM seq)
 {
-	// If a key is active, execute an auto-repeat
-	if (kbAutoRepeat.active)
+	// If a key is active, execute an auto-repeat.  Ignore stale timer
+	// messages posted before the timer was reset.
+	if (kbAutoRepeat.active && kbAutoRepeat.timer.IsCurrent(seq))
 	{
 		// if the key isn't still pressed, cancel auto-repeat mode
 		if (GetAsyncKeyState(kbAutoRepeat.vkey) >= 0)
 		{
-			KillTimer(hWnd, kbRepeatTimerID);
+			kbAutoRepeat.timer.Cancel();
 			return;
 		}
 
@@ -4735,28 +5172,15 @@ void PlayfieldView::OnKbAutoRepeatTimer()
 		{
 			// look up the button in the command table
 			if (auto it = vkeyToCommand.find(kbAutoRepeat.vkey); it != vkeyToCommand.end())
-				ProcessKeyPress(hWnd, kbAutoRepeat.repeatMode, it->second);
+				ProcessKeyPress(hWnd, kbAutoRepeat.repeatMode, it->second, kbAutoRepeat.timer.GetDueTime());
 		}
 
-		// Reset the timer for the repeat interval.  The system parameter
-		// for the repeat rate is only approximate, since the actual repeat
-		// function is farmed out to the keyboard hardware, but the nominal
-		// unit system is a frequency value from 0 to 31, where 0 represents
-		// 2.5 Hz and 31 represents 30 Hz.  So we'll interpolate linearly
-		// over this range and invert the value to get a time value.  We
-		// only need a value to the nearest millisecond when we're done, so
-		// to make the calculation fast, use scaled integers.  Calculate the
-		// frequency value in mHz units by multiplying everything by 1000;
-		// inverting this give us kilo seconds, so we then multiply the
-		// result by a million to get milliseconds.  At this scale, 
-		// everything is in a nice range for the integer calculations.
-		DWORD rate;
-		SystemParametersInfo(SPI_GETKEYBOARDSPEED, 0, &rate, 0);
-		SetTimer(hWnd, kbRepeatTimerID, 1000000 / (2500 + 917 * rate), 0);
+		// schedule the next repeat
+		ScheduleNextAutoRepeat(kbAutoRepeat.timer, PFVMsgKbAutoRepeat);
 	}
 }
 
-void PlayfieldView::JsAutoRepeatStart(int unit, int button, KeyPressType repeatMode)
+void PlayfieldView::JsAutoRepeatStart(int unit, int button, KeyPressType repeatMode, int64_t pressTime)
 {
 	// remember the key for auto-repeat
 	jsAutoRepeat.unit = unit;
@@ -4766,46 +5190,29 @@ void PlayfieldView::JsAutoRepeatStart(int unit, int button, KeyPressType repeatM
 	// remember that we're in auto-repeat mode
 	jsAutoRepeat.active = true;
 
-	// Start the delay timer for the initial key repeat delay.  The
-	// Windows parameter is documented as being only an approximation,
-	// but it's supposed to be in 250ms units with a minimum of 250ms.
-	//
-	// Note that this replaces any previous auto-repeat timer, which
-	// has exactly the desired effect of starting a new repeat timing
-	// cycle for the new key press.
-	int kbDelay;
-	SystemParametersInfo(SPI_GETKEYBOARDDELAY, 0, &kbDelay, 0);
-	SetTimer(hWnd, jsRepeatTimerID, 250 + kbDelay * 250, 0);
+	// Start the timer for the initial key repeat delay, counting from
+	// the button press.  Note that this replaces any previous auto-repeat
+	// timer, which has exactly the desired effect of starting a new
+	// repeat timing cycle for the new key press.
+	jsAutoRepeat.timer.Set(hWnd, PFVMsgJsAutoRepeat, 0, pressTime + GetAutoRepeatDelay());
 }
 
-void PlayfieldView::OnJsAutoRepeatTimer()
+void PlayfieldView::OnJsAutoRepeatTimer(WPARAM seq)
 {
-	// If a key is active, execute an auto-repeat
-	if (jsAutoRepeat.active)
+	// If a key is active, execute an auto-repeat.  Ignore stale timer
+	// messages posted before the timer was reset.
+	if (jsAutoRepeat.active && jsAutoRepeat.timer.IsCurrent(seq))
 	{
 		// don't deliver auto-repeat events when a wheel animation is running
 		if (wheelAnimMode == WheelAnimNone)
 		{
 			// look up the button in the command table
 			if (auto it = jsCommands.find(JsCommandKey(jsAutoRepeat.unit, jsAutoRepeat.button)); it != jsCommands.end())
-				ProcessKeyPress(hWnd, jsAutoRepeat.repeatMode, it->second);
+				ProcessKeyPress(hWnd, jsAutoRepeat.repeatMode, it->second, jsAutoRepeat.timer.GetDueTime());
 		}
 
-		// Reset the timer for the repeat interval.  The system parameter
-		// for the repeat rate is only approximate, since the actual repeat
-		// function is farmed out to the keyboard hardware, but the nominal
-		// unit system is a frequency value from 0 to 31, where 0 represents
-		// 2.5 Hz and 31 represents 30 Hz.  So we'll interpolate linearly
-		// over this range and invert the value to get a time value.  We
-		// only need a value to the nearest millisecond when we're done, so
-		// to make the calculation fast, use scaled integers.  Calculate the
-		// frequency value in mHz units by multiplying everything by 1000;
-		// inverting this give us kilo seconds, so we then multiply the
-		// result by a million to get milliseconds.  At this scale, 
-		// everything is in a nice range for the integer calculations.
-		DWORD rate;
-		SystemParametersInfo(SPI_GETKEYBOARDSPEED, 0, &rate, 0);
-		SetTimer(hWnd, jsRepeatTimerID, 1000000/(2500 + 917*rate), 0);
+		// schedule the next repeat
+		ScheduleNextAutoRepeat(jsAutoRepeat.timer, PFVMsgJsAutoRepeat);
 	}
 }
 
@@ -4815,14 +5222,14 @@ void PlayfieldView::StopAutoRepeat()
 	if (jsAutoRepeat.active)
 	{
 		jsAutoRepeat.active = false;
-		KillTimer(hWnd, jsRepeatTimerID);
+		jsAutoRepeat.timer.Cancel();
 	}
 
 	// stop keyboard auto-repeat
 	if (kbAutoRepeat.active)
 	{
 		kbAutoRepeat.active = false;
-		KillTimer(hWnd, kbRepeatTimerID);
+		kbAutoRepeat.timer.Cancel();
 	}
 }
 
@@ -4840,6 +5247,9 @@ void PlayfieldView::ReloadSettings()
 
 void PlayfieldView::OnConfigChange()
 {
+	// discard cached menu pages, since settings can appear in menus
+	menuPageCache.Clear();
+
 	// load the attract mode settings
 	ConfigManager *cfg = ConfigManager::GetInstance();
 	attractMode.enabled = cfg->GetBool(ConfigVars::AttractModeEnabled, true);
@@ -4889,6 +5299,13 @@ void PlayfieldView::OnConfigChange()
 	// load the button mute setting
 	muteButtons = cfg->GetBool(ConfigVars::MuteButtons, false);
 
+	// Load the media prefetch distance.  Size the cache to hold a full
+	// set of prefetched media (a playfield item and a wheel image for
+	// each game on either side), plus a few recently used items so that
+	// reversing direction doesn't immediately reload everything.
+	prefetchCount = max(0, min(cfg->GetInt(ConfigVars::MediaPrefetchCount, 3), 20));
+	prefetcher.SetCapacity(prefetchCount * 4 + 8);
+
 	// load the instruction card location; lower-case it for case-insensitive comparisons
 	instCardLoc = cfg->Get(ConfigVars::InstCardLoc, _T(""));
 	std::transform(instCardLoc.begin(), instCardLoc.end(), instCardLoc.begin(), ::_totlower);
@@ -6357,6 +6774,13 @@ void PlayfieldView::EditGameInfo()
 								else
 									eh.Error(MsgFmt(IDS_ERR_MOVEFILE, f.first.c_str(), f.second.c_str(), winErr.Get()));
 							}
+							else
+							{
+								// success - update the media index for the old and new names
+								auto mediaIndex = gl->GetMediaIndex();
+								mediaIndex->OnFileChanged(f.first.c_str());
+								mediaIndex->OnFileChanged(f.second.c_str());
+							}
 						}
 						
 						// If the retry list is empty, we're done.  Note that we don't
@@ -7351,10 +7775,15 @@ void PlayfieldView::DisplayCaptureMenu(bool updating, int selectedCmd)
 	// each media type selected.  Images don't require any fixed wait
 	// time, since they just need one video frame, but include a
 	// couple of seconds per image in the time estimate to account
-	// for the overhead of launching the capture program.
+	// for the overhead of launching the capture program.  In combined
+	// mode, everything is captured in one run, so the longest item
+	// determines the time instead.  (The second pass of a two-pass
+	// capture doesn't count either way, since it runs in the
+	// background after the game exits.)
 	int timeEst = 5;
+	int maxTime = 0;
 	auto config = ConfigManager::GetInstance();
-	bool twoPass = config->GetInt(ConfigVars::CaptureTwoPassEncoding, false);
+	bool combined = config->GetBool(ConfigVars::CaptureCombined, true);
 	const int imageTime = 2;
 	const int defaultVideoTime = 30;
 	for (auto &cap : captureList)
@@ -7372,26 +7801,13 @@ void PlayfieldView::DisplayCaptureMenu(bool updating, int selectedCmd)
 				// use the video time
 				int videoTime = config->GetInt(cfgvar, defaultVideoTime);
 				timeEst += videoTime;
-
-				// If we're using two-pass encoding, add time for the second
-				// pass.  Use a factor of 1.5 of the video running time as a
-				// wild guess.  The actual time depends on the hardware, but 
-				// as explained in the comments for the similar calculation 
-				// in Application::GameMonitorThread::Launch, it probably
-				// won't be less than the running time (since otherwise
-				// the machine is fast enough for real-time encoding) and
-				// it's probably not more than about 2x real time (since
-				// if it were, the machine would be too underpowered to run
-				// any of the common pinball software, so probably isn't
-				// running PinballY).  So we'll take the middle of that
-				// band (1x to 2x) as our estimate.
-				if (twoPass)
-					timeEst += videoTime*3/2;
+				maxTime = max(maxTime, videoTime);
 			}
 			else
 			{
 				// use the image time
 				timeEst += imageTime;
+				maxTime = max(maxTime, imageTime);
 			}
 			break;
 
@@ -7403,6 +7819,10 @@ void PlayfieldView::DisplayCaptureMenu(bool updating, int selectedCmd)
 		}
 	}
 
+	// in combined mode, use the longest item's time plus the launch overhead
+	if (combined && maxTime != 0)
+		timeEst = 5 + imageTime + maxTime;
+
 	// Adjust the time to a round number, since it's really a very
 	// rough estimate given the number of external factors involved.
 	TSTRINGEx timeEstStr;
@@ -7980,20 +8400,73 @@ void PlayfieldView::MediaDropGo()
 	if (game == nullptr || game->system == nullptr)
 		return;
 
+	// We only run one import at a time.  The importer works from its 
+	// own copy of the drop list, but the overlapping progress reports
+	// would be confusing, and the two imports could be trying to 
+	// install the same files.
+	if (mediaDropImporter != nullptr)
+	{
+		ShowError(EIT_Information, LoadStringT(IDS_MEDIA_DROP_BUSY));
+		return;
+	}
+
 	// compile a list of errors as we go
-	CapturingErrorHandler eh;
+	mediaDropErrors = CapturingErrorHandler();
+	CapturingErrorHandler &eh = mediaDropErrors;
+
+	// Set up the importer.  This does the actual file extraction and
+	// copying on background threads, since that can take a while for
+	// a big media pack.
+	RefPtr<MediaDropImporter> importer(new MediaDropImporter(hWnd));
+
+	// Get the passwords for any encrypted archives.  The importer's
+	// worker threads can't show the password dialog, so we have to ask
+	// here, before starting the import.  Open each archive that has
+	// entries to install, and ask for the password if any of those
+	// entries are encrypted.  (If the archive's headers are encrypted,
+	// opening it asks for the password, so we'll already have it.)  If
+	// the user cancels the password dialog, skip the archive.
+	std::unordered_set<TSTRING> checkedArchives, skippedArchives;
+	for (auto &d : dropList)
+	{
+		// only consider archive entries we're going to install, and
+		// only check each archive once
+		if (d.zipIndex < 0
+			|| d.status == IDS_MEDIA_DROP_SKIP || d.status == IDS_MEDIA_DROP_KEEP
+			|| !checkedArchives.emplace(d.filename).second)
+			continue;
+
+		// Open the archive.  If this fails, let the importer report the
+		// error when it tries to open it.
+		SevenZipArchive arch;
+		SilentErrorHandler openEh;
+		if (!arch.OpenArchive(d.filename.c_str(), openEh))
+			continue;
+
+		// check for encrypted entries among the ones we're installing
+		bool encrypted = std::any_of(dropList.begin(), dropList.end(), [&d, &arch](const MediaDropItem &e) {
+			return e.filename == d.filename && e.zipIndex >= 0
+				&& e.status != IDS_MEDIA_DROP_SKIP && e.status != IDS_MEDIA_DROP_KEEP
+				&& arch.IsEncrypted(e.zipIndex); });
+
+		// ask for the password if needed, and pass it to the importer
+		TSTRING password;
+		if (encrypted && !arch.PromptForPassword())
+			skippedArchives.emplace(d.filename);
+		else if (arch.GetPassword(password))
+			importer->SetPassword(d.filename.c_str(), password.c_str());
+	}
 
 	// work though the drop list
-	int nInstalled = 0;
+	int nQueued = 0;
 	for (auto &d : dropList)
 	{
 		// if the status is "skip" or "keep existing", skip it
 		if (d.status == IDS_MEDIA_DROP_SKIP || d.status == IDS_MEDIA_DROP_KEEP)
 			continue;
 
-		// back up any existing file
-		TSTRING backupName;
-		if (d.exists && !d.mediaType->SaveBackup(d.destFile.c_str(), backupName, eh))
+		// skip entries from an archive whose password dialog was cancelled
+		if (d.zipIndex >= 0 && skippedArchives.count(d.filename) != 0)
 			continue;
 
 		// make sure the destination folder exists
@@ -8014,66 +8487,97 @@ void PlayfieldView::MediaDropGo()
 			}
 		}
 
-		// determine the file source
-		bool ok = false;
-		if (d.zipIndex >= 0)
-		{
-			// It's an entry in a ZIP file (or other recognized archive type).  
-			// Extract it to the destination file.
-			// 
-			// Note that we extract the file into d.destFile, ignoring the name
-			// stored in the archive, since we want to make sure the installed 
-			// file matches the game's media file name.  The destination name 
-			// already takes into account the proper media folder, page subfolder,
-			// and index number, as applicable.  We figured all of that out when
-			// we first built the drop list.  We also ignore the path of the
-			// archive entry at this point, since our mission is to install the
-			// file in the proper media database folder for the media type.  The
-			// path information from the archive isn't lost, though, since it 
-			// played a role in determining which type of media this entry 
-			// represents, which in turn determines the final output folder.
-			SevenZipArchive arch;
-			if (arch.OpenArchive(d.filename.c_str(), eh)
-				&& arch.Extract(d.zipIndex, d.destFile.c_str(), eh))
-			{
-				// success - count the file installed
-				++nInstalled;
-				ok = true;
-			}
-		}
+		// Back up any existing file.  The importer puts the backup back
+		// in place if the new file can't be installed.
+		TSTRING backupName;
+		if (d.exists && !d.mediaType->SaveBackup(d.destFile.c_str(), backupName, eh))
+			continue;
+
+		// Add the item to the import.  For an entry in a ZIP file (or
+		// other recognized archive type), the importer extracts the entry
+		// into d.destFile; for a directly dropped file, it copies the file.
+		// 
+		// Note that we extract into d.destFile, ignoring the name stored
+		// in the archive, since we want to make sure the installed file
+		// matches the game's media file name.  The destination name
+		// already takes into account the proper media folder, page 
+		// subfolder, and index number, as applicable.  We figured all of
+		// that out when we first built the drop list.  We also ignore the
+		// path of the archive entry at this point, since our mission is to
+		// install the file in the proper media database folder for the
+		// media type.  The path information from the archive isn't lost,
+		// though, since it played a role in determining which type of
+		// media this entry represents, which in turn determines the final
+		// output folder.
+		importer->AddItem(d.filename.c_str(), d.zipIndex, d.destFile.c_str(), backupName.c_str(), d.mediaType);
+		++nQueued;
+	}
+
+	// if there's nothing to install, report the results now
+	if (nQueued == 0)
+	{
+		if (eh.CountErrors() != 0)
+			ShowError(EIT_Error, LoadStringT(IDS_ERR_DROP_FAILED), &eh);
 		else
-		{
-			// It's a directly dropped file.  Copy the whole file.
-			if (CopyFile(d.filename.c_str(), d.destFile.c_str(), true))
-			{
-				// success - count the file installed
-				++nInstalled;
-				ok = true;
-			}
-			else
-			{
-				// error in the copy - log it
-				WindowsErrorMessage winErr;
-				eh.Error(MsgFmt(IDS_ERR_DROP_COPY,
-					LoadStringT(d.mediaType->nameStrId).c_str(),
-					d.filename.c_str(), d.destFile.c_str(), winErr.Get()));
-			}
-		}
+			ShowError(EIT_Information, LoadStringT(IDS_MEDIA_DROP_ALL_SKIPPED));
+		return;
+	}
 
-		// If it failed, and we renamed the original file as a backup
-		// copy, undo the rename.  Ignore any errors that occur in that
-		// attempt, as we've already logged errors for this operation
-		// and we don't want to overload the user with alerts.  The
-		// user should be able to sort out the mess easily enough if
-		// the un-re-name fails by manually inspecting the media folder.
-		if (!ok && d.exists)
-			MoveFile(backupName.c_str(), d.destFile.c_str());
+	// start the import, and show the progress popup
+	mediaDropImporter = importer;
+	ShowMediaDropProgress(false);
+	importer->Start();
+}
+
+void PlayfieldView::OnMediaDropProgress()
+{
+	// ignore stray messages from a finished import
+	if (mediaDropImporter == nullptr)
+		return;
+
+	// Update the media index for the files finished since the last
+	// update, so that they're available as soon as they're installed.
+	std::list<MediaDropImporter::Item> items;
+	mediaDropImporter->TakeFinishedItems(items);
+	auto mediaIndex = GameList::Get()->GetMediaIndex();
+	for (auto &item : items)
+	{
+		// if the item failed, the importer restored the backup file
+		if (!item.ok && item.backupFile.length() != 0)
+			mediaIndex->OnFileChanged(item.backupFile.c_str());
+
+		// update the media index for the new (or restored) file
+		mediaIndex->OnFileChanged(item.destFile.c_str());
 	}
 
+	// update the progress popup
+	ShowMediaDropProgress(true);
+}
+
+void PlayfieldView::OnMediaDropDone()
+{
+	// ignore stray messages from a finished import
+	if (mediaDropImporter == nullptr)
+		return;
+
+	// pick up the last batch of finished items
+	OnMediaDropProgress();
+
+	// get the final results, and forget the importer
+	MediaDropImporter::Progress progress;
+	mediaDropImporter->GetProgress(progress);
+	CapturingErrorHandler &eh = mediaDropErrors;
+	mediaDropImporter->GetErrors().EnumErrors([&eh](const ErrorList::Item &e) { eh.SysError(e.message.c_str(), e.details.c_str()); });
+	mediaDropImporter = nullptr;
+
+	// close the progress popup, if it's still showing
+	if (popupSprite != nullptr && popupType == PopupMediaDropProgress)
+		ClosePopup();
+
 	// report the results
 	if (eh.CountErrors() != 0)
 		ShowError(EIT_Error, LoadStringT(IDS_ERR_DROP_FAILED), &eh);
-	else if (nInstalled != 0)
+	else if (progress.nInstalled != 0)
 		ShowError(EIT_Information, LoadStringT(IDS_MEDIA_DROP_SUCCESS));
 	else
 		ShowError(EIT_Information, LoadStringT(IDS_MEDIA_DROP_ALL_SKIPPED));
@@ -8083,6 +8587,85 @@ void PlayfieldView::MediaDropGo()
 	UpdateSelection();
 }
 
+void PlayfieldView::ShowMediaDropProgress(bool update)
+{
+	// If we're updating, only proceed if the progress popup is still
+	// showing.  The user can dismiss it (the import keeps running in
+	// the background), and we don't want to cover up any other popup
+	// they've opened since, or interrupt the closing animation.
+	if (update && (popupSprite == nullptr || popupType != PopupMediaDropProgress || popupAnimMode == PopupAnimClose))
+		return;
+
+	// dismiss any menu if not updating
+	if (!update)
+		CloseMenusAndPopups();
+
+	// get the current progress
+	MediaDropImporter::Progress progress = { 0, 0, 0, 0, false };
+	if (mediaDropImporter != nullptr)
+		mediaDropImporter->GetProgress(progress);
+
+	// set up the new popup
+	const int width = 960, height = 320;
+	Application::InUiErrorHandler eh;
+	popupSprite.Attach(new Sprite());
+	if (popupSprite->Load(width, height, [this, width, height, &progress](HDC hdc, HBITMAP)
+	{
+		// set up the GDI+ context
+		Gdiplus::Graphics g(hdc);
+
+		// draw the background
+		Gdiplus::SolidBrush bkgBr(Gdiplus::Color(0xd0, 0x00, 0x00, 0x00));
+		g.FillRectangle(&bkgBr, 0, 0, width, height);
+
+		// draw the border
+		const int borderWidth = 2;
+		Gdiplus::Pen pen(Gdiplus::Color(0xe0, 0xff, 0xff, 0xff), float(borderWidth));
+		g.DrawRectangle(&pen, borderWidth / 2, borderWidth / 2, width - borderWidth, height - borderWidth);
+
+		// centered string formatter
+		Gdiplus::StringFormat centerFmt;
+		centerFmt.SetAlignment(Gdiplus::StringAlignmentCenter);
+		centerFmt.SetLineAlignment(Gdiplus::StringAlignmentCenter);
+
+		// draw the main text
+		Gdiplus::RectF rc(0.0f, 0.0f, (float)width, (float)height/3.0f);
+		std::unique_ptr<Gdiplus::Font> font1(CreateGPFont(_T("Tahoma"), 36, 400));
+		Gdiplus::SolidBrush textBr(Gdiplus::Color(0xFF, 0xFF, 0xFF, 0xFF));
+		g.DrawString(LoadStringT(IDS_MEDIA_DROP_PROGRESS1), -1, font1.get(), rc, &centerFmt, &textBr);
+
+		// draw the progress bar, based on the number of files finished
+		const float margin = 48.0f, barHeight = 32.0f;
+		float barTop = (float)height/2.0f - barHeight/2.0f;
+		float barWidth = (float)width - 2.0f*margin;
+		float frac = progress.nItems == 0 ? 0.0f : (float)progress.nDone / (float)progress.nItems;
+		Gdiplus::SolidBrush barBr(Gdiplus::Color(0xFF, 0x00, 0x80, 0xFF));
+		g.FillRectangle(&barBr, margin, barTop, barWidth * frac, barHeight);
+		g.DrawRectangle(&pen, margin, barTop, barWidth, barHeight);
+
+		// draw the counters
+		rc.Y = (float)height*2.0f/3.0f;
+		std::unique_ptr<Gdiplus::Font> font2(CreateGPFont(_T("Tahoma"), 20, 400));
+		g.DrawString(MsgFmt(IDS_MEDIA_DROP_PROGRESS2, (int)progress.nDone, (int)progress.nItems,
+			(double)progress.bytesDone / (1024.0*1024.0)), -1, font2.get(), rc, &centerFmt, &textBr);
+
+		// done with GDI+
+		g.Flush();
+
+	}, eh, _T("Media drop progress popup")))
+	{
+		AdjustSpritePosition(popupSprite);
+		if (popupType != PopupMediaDropProgress)
+			StartPopupAnimation(PopupMediaDropProgress, true);
+	}
+	else
+	{
+		popupSprite = nullptr;
+	}
+
+	UpdateDrawingList();
+}
+
 void PlayfieldView::InvertMediaDropState(int cmd)
 {
 	// Search all items matching the given command.  Note that there
@@ -8901,101 +9484,9 @@ void PlayfieldView::OnEndAttractMode()
 
 void PlayfieldView::QueueDOFPulse(const TCHAR *name)
 {
-	// Check to see if this pulse is already queued.  If it is, don't
-	// queue a new event, but instead extend the current event:
-	//
-	// - If there's a pending ON event for this pulse, simply leave
-	//   it as is.  We can't make a new event turn on any sooner, so
-	//   we'll use the existing ON as our ON.
-	//
-	// - If there's a pending OFF event for the pulse, replace it 
-	//   with a null event, and add a new OFF event at the end of
-	//   the queue.  This will effectively extend the pulse to last
-	//   until the "queue present time", after all of the past 
-	//   events in the queue have been processed.
-	bool foundOn = false;
-	for (auto &e : dofQueue)
-	{
-		// check for an ON event - if we find it, simply note it
-		if (e.name == name && e.val != 0)
-			foundOn = true;
-
-		// check for an OFF event - if we find it, replace it with
-		// a null event
-		if (e.name == name && e.val == 0)
-			e.name = _T("");
-	}
-
-	// if we didn't find a pending ON for the same event, queue one now
-	if (!foundOn)
-		QueueDOFEvent(name, 1);
-
-	// queue an OFF for the event (do this even if we found a pending
-	// event already in the queue, as we just replaced that with a
-	// null event to extend the ON duration of this event to the end
-	// of the current queue)
-	QueueDOFEvent(name, 0);
-}
-
-const DWORD dofPulseTimerInterval = 20;
-void PlayfieldView::QueueDOFEvent(const TCHAR *name, UINT8 val)
-{
-	if (DOFClient::Get() != nullptr)
-	{
-		// if the queue is empty, start the timer
-		if (dofQueue.size() == 0)
-		{
-			// There's nothing in the queue.  If it's been long enough
-			// since the last event, we can fire this event immediately.
-			if (GetTickCount64() - lastDOFEventTime > dofPulseTimerInterval)
-			{
-				FireDOFEvent(name, val);
-				return;
-			}
-
-			// It hasn't been long enough since we sent the last event;
-			// DOF needs time to digest updates.  We'll have to queue this
-			// event and handle it on our timer.  Since the queue is empty
-			// going in, the timer isn't running, so we have to start it.
-			SetTimer(hWnd, dofPulseTimerID, dofPulseTimerInterval, 0);
-		}
-
-		// queue the event
-		dofQueue.emplace_back(name, val);
-	}
-}
-
-void PlayfieldView::OnDOFTimer()
-{
-	// if there's anything in the queue, process the event
-	if (dofQueue.size() != 0)
-	{
-		// Send the effect to DOF, if DOF is active.  Note that
-		// we might have nulled out the event by replacing its name
-		// with an empty string; these are just there for timer
-		// padding, so don't send them to DOF but do count them as
-		// consuming this timer event.
-		auto &event = dofQueue.front();
-		if (event.name.length() != 0)
-			FireDOFEvent(event.name.c_str(), event.val);
-
-		// discard the event
-		dofQueue.pop_front();
-	}
-
-	// if the queue is empty, stop the timer
-	if (dofQueue.size() == 0)
-		KillTimer(hWnd, dofPulseTimerID);
-}
-
-void PlayfieldView::FireDOFEvent(const TCHAR *name, UINT8 val)
-{
-	// fire the event in DOF
-	if (DOFClient *dof = DOFClient::Get(); dof != nullptr)
-		dof->SetNamedState(name, val);
-
-	// note the last event time
-	lastDOFEventTime = GetTickCount64();
+	// send the pulse through the DOF output thread, if DOF is active
+	if (auto output = DOFOutput::Get(); output != nullptr && DOFClient::Get() != nullptr)
+		output->Pulse(name);
 }
 
 // -----------------------------------------------------------------------
@@ -9020,15 +9511,16 @@ void PlayfieldView::DOFIfc::SetContextItem(const WCHAR *newVal, WSTRING &itemVar
 		if (itemVar != newVal)
 		{
 			// turn off the current state, if any
+			auto output = DOFOutput::Get();
 			if (itemVar.length() != 0)
-				dof->SetNamedState(itemVar.c_str(), 0);
+				output->SetState(itemVar.c_str(), 0);
 
 			// remember the new state
 			itemVar = newVal != nullptr ? newVal : _T("");
 
 			// turn it on, if we have a new state
 			if (itemVar.length() != 0)
-				dof->SetNamedState(newVal, 1);
+				output->SetState(newVal, 1);
 		}
 	}
 }
@@ -9063,16 +9555,17 @@ void PlayfieldView::DOFIfc::SetKeyEffectState(const TCHAR *effect, bool keyDown)
 		it->second = keyDown;
 		
 		// update DOF, if active
-		if (auto dof = DOFClient::Get(); dof != nullptr)
-			dof->SetNamedState(effect, keyDown ? 1 : 0);
+		if (DOFClient::Get() != nullptr)
+			DOFOutput::Get()->SetState(effect, keyDown ? 1 : 0);
 	}
 }
 
 void PlayfieldView::DOFIfc::KeyEffectsOff()
 {
 	// if DOF is active, turn off all key effects
-	if (auto dof = DOFClient::Get(); dof != nullptr)
+	if (DOFClient::Get() != nullptr)
 	{
+		auto output = DOFOutput::Get();
 		// visit all key effects
 		for (auto &k : keyEffectState)
 		{
@@ -9080,7 +9573,7 @@ void PlayfieldView::DOFIfc::KeyEffectsOff()
 			if (k.second)
 			{
 				k.second = false;
-				dof->SetNamedState(k.first.c_str(), 0);
+				output->SetState(k.first.c_str(), 0);
 			}
 		}
 	}
@@ -24,6 +24,10 @@
 #include "AudioVideoPlayer.h"
 #include "HighScores.h"
 #include "GameList.h"
+#include "MediaPrefetcher.h"
+#include "PrecisionTimer.h"
+#include "LatencyHistogram.h"
+#include "MediaDropImporter.h"
 
 class Sprite;
 class TextureShader;
@@ -164,9 +168,15 @@ protected:
 	// Scale sprites that vary by window size
 	virtual void ScaleSprites() override;
 
+	// add our statistics to the frame counter overlay
+	virtual void GetPerfOverlayText(std::list<TSTRING> &lines) override;
+
 	// idle event handler
 	virtual void OnIdleEvent() override;
 
+	// frame presented - collect input-to-present latency samples
+	virtual void OnFramePresented() override;
+
 	// window creation
 	virtual bool OnCreate(CREATESTRUCT *cs) override;
 
@@ -215,10 +225,7 @@ protected:
 	static const int infoBoxSyncTimerID = 105;    // info box update timer
 	static const int statusLineTimerID = 106;     // status line update
 	static const int killGameTimerID = 107;		  // kill-game request pending
-	static const int jsRepeatTimerID = 108;		  // joystick button auto-repeat timer
-	static const int kbRepeatTimerID = 109;       // keyboard auto-repeat timer
 	static const int attractModeTimerID = 110;    // attract mode timer
-	static const int dofPulseTimerID = 111;		  // DOF signal pulse timer
 	static const int attractModeStatusLineTimerID = 112;   // attract mode status line timer
 	static const int creditsDispTimerID = 113;	  // number of credits display overlay timer
 	static const int gameTimeoutTimerID = 114;    // game inactivity timeout timer
@@ -245,6 +252,12 @@ protected:
 	// Load a wheel image
 	Sprite *LoadWheelImage(const GameListItem *game);
 
+	// Prefetch media for the games near the current wheel position.
+	// This queues background loads for the wheel images that will come
+	// into view next, and the playfield media for the adjacent games,
+	// so that they're ready when the user moves through the wheel.
+	void PrefetchNeighbors();
+
 	// Set a wheel image position.  'n' is the wheel image slot
 	// relative to the current selection.  'rot' is the additional
 	// rotation for animation.
@@ -559,8 +572,24 @@ protected:
 
 	// Add the media from the drop list.  This is invoked when the
 	// user clicks the "go" option from the drop confirmation menu.
+	// This starts the file installation on background threads; see
+	// MediaDropImporter.h.
 	void MediaDropGo();
 
+	// Media drop import in progress, if any
+	RefPtr<MediaDropImporter> mediaDropImporter;
+
+	// Errors from the media drop setup phase, before the import starts.
+	// We report these along with the import errors when it finishes.
+	CapturingErrorHandler mediaDropErrors;
+
+	// Handle import progress and completion messages from the importer
+	void OnMediaDropProgress();
+	void OnMediaDropDone();
+
+	// Show/update the media drop progress popup
+	void ShowMediaDropProgress(bool update);
+
 	// Check to see if we can add media to the game.  This checks to
 	// see if the game's manufacturer, system, and year are configured.
 	// If so, it simply returns true to indicate that media can be
@@ -730,6 +759,14 @@ protected:
 	// switch animations, we add the next game on the incoming side.
 	std::list<RefPtr<Sprite>> wheelImages;
 
+	// Media prefetcher, for the wheel images and playfield media of
+	// the games adjacent to the current selection
+	MediaPrefetcher prefetcher;
+
+	// Number of games to prefetch in each direction from the current
+	// selection.  Zero disables prefetching.
+	int prefetchCount;
+
 	// Game info box.  This is a popup that appears when we're idling
 	// with a game selected, showing the title and other metadata for
 	// the active selection.  This box is automatically removed when
@@ -759,7 +796,8 @@ protected:
 		PopupErrorMessage,	// error message alert
 		PopupRateGame,		// enter game rating "dialog"
 		PopupHighScores,    // high scores list
-		PopupCaptureDelay   // capture delay dialog
+		PopupCaptureDelay,  // capture delay dialog
+		PopupMediaDropProgress  // media drop import progress
 	} 
 	popupType;
 
@@ -939,6 +977,56 @@ protected:
 		RefPtr<Sprite> sprHilite;
 	};
 
+	// Menu page cache.  This keeps the rendered text images for
+	// recently displayed menu pages, so that re-opening a menu or
+	// flipping back to a page doesn't have to render the text again.
+	// The images are keyed by everything that goes into the rendering:
+	// the image size and the text, position, and decorations of each
+	// item on the page.  The selection isn't part of the key, since the
+	// selection highlight is drawn with a separate sprite.
+	class MenuPageCache
+	{
+	public:
+		MenuPageCache() : hits(0), misses(0) { }
+
+		// Look up a page image.  Returns the cached sprite (without
+		// adding a reference), or null if the page isn't in the cache.
+		// The sprite might not be loaded yet if the image is still being
+		// drawn.  This counts the lookup in the hit rate statistics.
+		Sprite *Get(const TCHAR *key);
+
+		// Is the page in the cache?  Unlike Get(), this doesn't count
+		// in the statistics or affect the eviction order.
+		bool Contains(const TCHAR *key) const { return index.find(key) != index.end(); }
+
+		// Add a page.  This starts drawing the image asynchronously into
+		// a new sprite, and evicts the least recently used page if the
+		// cache is full.
+		void Add(const TCHAR *key, int width, int height, std::function<void(HDC, HBITMAP)> draw);
+
+		// discard all pages
+		void Clear();
+
+		// lookup statistics, for the frame counter overlay
+		UINT64 hits;
+		UINT64 misses;
+
+	protected:
+		struct Entry
+		{
+			TSTRING key;
+			RefPtr<Sprite> sprite;
+		};
+
+		// pages, most recently used first, and the index by key
+		std::list<Entry> cache;
+		std::unordered_map<TSTRING, std::list<Entry>::iterator> index;
+
+		// maximum number of pages to keep
+		static const size_t capacity = 16;
+	};
+	MenuPageCache menuPageCache;
+
 	// Current active menu
 	RefPtr<Menu> curMenu;
 
@@ -1198,58 +1286,17 @@ protected:
 	// Are button/event sound effects muted?
 	bool muteButtons;
 
-	// DOF pulsed effect queue.  Some of the signals we send to DOF are
-	// states, where we turn a named DOF item ON for as long as we're in
-	// a particular UI state (e.g., showing a menu).  Other signals are
-	// of the nature of events, where we want to send DOF a message that
-	// something has happened, without leaving the effect ON beyond the
-	// momentary trigger signal.  DOF itself doesn't have a concept of
-	// events; it was designed around VPinMAME, which thinks in terms 
-	// of the physical switches on pinball machines.  So DOF's notion
-	// of an "event" is when a switch (or, in DOF terms, a named event)
-	// is switched ON briefly and then switched back off.  But it's not
-	// good enough to literally turn a DOF effect ON and immediately OFF
-	// again, because, again, DOF doesn't think in terms of events, but
-	// in terms of states, and it uses a polling model to check states.
-	// So to create a pulse that DOF notices, we have to turn the effect
-	// on and leave it on long enough for DOF's polling loop to see it.
-	// 
-	// This queue is for those sorts of events, where we have to pulse a
-	// DOF effect briefly, but not *too* briefly.  We could more easily
-	// turn an effect on, Sleep() for a few milliseconds, and then turn
-	// it off, but that's sucky because it blocks the UI/rendering 
-	// thread.  Instead, we use this queue.  Each time we need to pulse
-	// a DOF effect, we push an ON/OFF event pair onto the tail of this
-	// queue.  A WM_TIMER timer then pulls events off the queue and sends
-	// them to DOF.  This lets us leave the effects on for long enough to
-	// satisfy DOF without blocking the UI thread.
-	struct QueuedDOFEffect
-	{
-		QueuedDOFEffect(const TCHAR *name, UINT8 val) : name(name), val(val) { }
-		TSTRING name;	// effect name
-		UINT8 val;		// value to set the effect to
-	};
-	std::list<QueuedDOFEffect> dofQueue;
-
-	// Last DOF pulsed event time, as a GetTickCount64 value
-	ULONGLONG lastDOFEventTime;
-
-	// Queue a DOF ON/OFF pulse.   This queues an ON/OFF event pair
-	// for the effect.
+	// Queue a DOF ON/OFF pulse.  Some of the signals we send to DOF
+	// are states, where we turn a named DOF item ON for as long as we're
+	// in a particular UI state (e.g., showing a menu).  Others are
+	// events, where we want to tell DOF that something has happened
+	// without leaving the effect ON beyond a momentary trigger signal.
+	// DOF doesn't have a concept of events, so we signal an event by
+	// pulsing the effect ON and then OFF, leaving it ON long enough for
+	// DOF's polling loop to notice.  The DOF output thread handles the
+	// pulse timing; see DOFOutput.h.
 	void QueueDOFPulse(const TCHAR *name);
 
-	// Queue a DOF event.  Pushes the event onto the end of the DOF
-	// queue, and starts the timer if the queue was empty.
-	void QueueDOFEvent(const TCHAR *name, UINT8 val);
-
-	// Fire a DOF event immediately.
-	void FireDOFEvent(const TCHAR *name, UINT8 val);
-
-	// Handle the DOF queued event timer.  Pulls an event off the
-	// front of the queue and sends it to DOF.  Stops the timer if 
-	// the queue is empty after pulling this effect.
-	void OnDOFTimer();
-
 	// DOF interaction
 	class DOFIfc
 	{
@@ -1369,22 +1416,100 @@ protected:
 	// add a command to the vkeyToCommand list
 	void AddVkeyCommand(int vkey, KeyCommandFunc func);
 
-	// key event queue
+	// key event queue entry
 	struct QueuedKey
 	{
-		QueuedKey() : hWndSrc(NULL), mode(KeyUp), func(nullptr) { }
+		QueuedKey() : hWndSrc(NULL), mode(KeyUp), func(nullptr), inputTime(0) { }
 
-		QueuedKey(HWND hWndSrc, KeyPressType mode, KeyCommandFunc func)
-			: hWndSrc(hWndSrc), mode(mode), func(func) { }
+		QueuedKey(HWND hWndSrc, KeyPressType mode, KeyCommandFunc func, int64_t inputTime)
+			: hWndSrc(hWndSrc), mode(mode), func(func), inputTime(inputTime) { }
 
 		HWND hWndSrc;			// source window
 		KeyPressType mode;		// key press mode
 		KeyCommandFunc func;	// command handler
+
+		// Input time, in HiResTimer ticks.  For a key press, this is
+		// when the input reached the application; for an auto-repeat,
+		// it's the scheduled repeat time.  We use this to measure the
+		// latency from input to command dispatch and to the screen.
+		int64_t inputTime;
 	};
-	std::list<QueuedKey> keyQueue;
 
-	// Add a key press to the queue and process it
-	void ProcessKeyPress(HWND hwndSrc, KeyPressType mode, std::list<KeyCommandFunc> funcs);
+	// Key event queue.  This is a fixed-size ring buffer, so that
+	// queuing a key event never has to allocate memory.  Keys only
+	// accumulate here while an animation is running, and we skip
+	// ahead through wheel animations on each new key press, so the
+	// queue rarely holds more than a few events.  If it does fill
+	// up, we discard the oldest event to make room for the new one.
+	class KeyQueue
+	{
+	public:
+		KeyQueue() : head(0), count(0), dropped(0) { }
+
+		static const size_t capacity = 64;
+
+		size_t size() const { return count; }
+		void clear() { head = 0; count = 0; }
+		QueuedKey &front() { return ring[head]; }
+		void pop_front() { head = (head + 1) % capacity; --count; }
+
+		template<typename... Args> void emplace_back(Args&&... args)
+		{
+			// if the queue is full, discard the oldest entry
+			if (count == capacity)
+			{
+				pop_front();
+				++dropped;
+			}
+
+			ring[(head + count) % capacity] = QueuedKey(std::forward<Args>(args)...);
+			++count;
+		}
+
+		// number of events discarded due to overflow
+		UINT64 dropped;
+
+	protected:
+		QueuedKey ring[capacity];
+		size_t head;
+		size_t count;
+	};
+	KeyQueue keyQueue;
+
+	// Add a key press to the queue and process it.  'inputTime' is
+	// the time the input reached the application, in HiResTimer ticks.
+	void ProcessKeyPress(HWND hwndSrc, KeyPressType mode, std::list<KeyCommandFunc> funcs, int64_t inputTime);
+
+	// Get the input time for an event we're handling.  For raw input
+	// events (joystick buttons and background keys), this is the
+	// InputManager's arrival time for the WM_INPUT message.  For a
+	// regular WM_KEYDOWN or WM_KEYUP, it's the arrival time of the
+	// corresponding keyboard raw input message, which Windows delivers
+	// ahead of the key message, if we saw one and it's not older than
+	// the key message; otherwise it's the current time.
+	int64_t GetRawInputEventTime() const { return InputManager::GetInstance()->GetRawInputTime(); }
+	int64_t GetKeyEventTime(WPARAM vkey);
+
+	// Arrival times of the latest keyboard raw input events, by virtual
+	// key code.  HandleKeyEvent() consumes these to timestamp the
+	// corresponding WM_KEYDOWN and WM_KEYUP messages.
+	int64_t kbRawInputTime[256];
+
+	// Input latency statistics, for the frame counter overlay: from
+	// input arrival to command dispatch, and from input arrival to the
+	// next frame presented after the command.  We only count initial
+	// key presses, not auto-repeats or key releases.
+	LatencyHistogram inputToCommandLatency;
+	LatencyHistogram inputToPresentLatency;
+
+	// Input times of dispatched commands waiting for the next frame
+	// presented.  If more commands than this arrive between frames,
+	// we only sample the first few.
+	int64_t pendingPresentInputTime[16];
+	size_t nPendingPresentInputTimes;
+
+	// clock for input timing
+	HiResTimer inputTimer;
 
 	// Process the key queue.  On a keyboard event, we add the key
 	// to the queue and call this routine; we also call it whenever
@@ -1393,7 +1518,10 @@ protected:
 	void ProcessKeyQueue();
 
 	// Keyboard auto-repeat.  Rather than using the native Windows
-	// auto-repeat feature, we implement our own using a timer.  
+	// auto-repeat feature, we implement our own using a timer.  We use
+	// a PrecisionTimer rather than a WM_TIMER, so that the repeats come
+	// at the intended times, and we compute each repeat deadline from
+	// the previous one, so that the repeat rate doesn't drift.
 	//
 	// Handling auto-repeat ourselves lets us make the behavior more 
 	// uniform across keyboards.  Windows's native handling is 
@@ -1409,7 +1537,10 @@ protected:
 	// down a key creates a backlog of repeat events that keeps
 	// growing as long as the key is held down, which makes the app
 	// feel sluggish.  Using a timer, we can throttle the repeat
-	// rate to our actual consumption rate and avoid a backlog.
+	// rate to our actual consumption rate and avoid a backlog.  (The
+	// PrecisionTimer is one-shot, and we only re-arm it after we've
+	// processed the repeat, so a slow command still can't build up a
+	// backlog of repeats.)
 	struct KbAutoRepeat
 	{
 		KbAutoRepeat() { active = false; }
@@ -1417,6 +1548,7 @@ protected:
 		bool active;				// auto-repeat is active
 		int vkey;					// virtual key code we're repeating
 		KeyPressType repeatMode;	// key press mode for repeats
+		PrecisionTimer timer;		// repeat timer
 	} kbAutoRepeat;
 
 	// Joystick auto-repeat button.  This simulates the keyboard 
@@ -1431,19 +1563,33 @@ protected:
 		int unit;					// logical joystick unit number
 		int button;					// button number
 		KeyPressType repeatMode;	// key press mode for repeats
+		PrecisionTimer timer;		// repeat timer
 	} jsAutoRepeat;
 
-	// Start joystick auto repeat mode
-	void JsAutoRepeatStart(int unit, int button, KeyPressType repeatMode);
+	// Start joystick auto repeat mode.  'pressTime' is the input time
+	// of the button press, in HiResTimer ticks; the first repeat is
+	// scheduled for the repeat delay after this time.
+	void JsAutoRepeatStart(int unit, int button, KeyPressType repeatMode, int64_t pressTime);
 
 	// joystick auto repeat timer handler
-	void OnJsAutoRepeatTimer();
+	void OnJsAutoRepeatTimer(WPARAM seq);
 
 	// Start keyboard auto-repeat mode
-	void KbAutoRepeatStart(int vkey, KeyPressType repeatMode);
+	void KbAutoRepeatStart(int vkey, KeyPressType repeatMode, int64_t pressTime);
 
 	// Keyboard auto repeat timer handler
-	void OnKbAutoRepeatTimer();
+	void OnKbAutoRepeatTimer(WPARAM seq);
+
+	// Get the auto-repeat delay and interval, in HiResTimer ticks, from
+	// the Windows keyboard settings
+	int64_t GetAutoRepeatDelay();
+	int64_t GetAutoRepeatInterval();
+
+	// Schedule the next auto-repeat on a repeat timer, one repeat
+	// interval after the last one.  If we've fallen behind, the next
+	// repeat is scheduled for now instead, so that we don't try to
+	// catch up with a burst of repeats.
+	void ScheduleNextAutoRepeat(PrecisionTimer &timer, UINT msg);
 
 	// Stop keyboard and joystick auto-repeat timers.  We call this
 	// whenever a new joystick button or key press occurs, to stop
@@ -0,0 +1,93 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Precision message timer
+
+#include "stdafx.h"
+#include <math.h>
+#include "PrecisionTimer.h"
+
+PrecisionTimer::PrecisionTimer() :
+	hTimer(NULL),
+	armed(false),
+	highRes(false),
+	hwnd(NULL),
+	msg(0),
+	lParam(0),
+	seq(0),
+	dueTime(0)
+{
+}
+
+PrecisionTimer::~PrecisionTimer()
+{
+	Cancel();
+}
+
+void PrecisionTimer::Set(HWND hwnd, UINT msg, LPARAM lParam, int64_t dueTime)
+{
+	// Remove any previous timer.  Note that we don't Cancel(), since
+	// that would drop the timer resolution only to raise it again
+	// below; auto-repeat re-arms the timer on every repeat.
+	DeleteTimer();
+
+	// hold 1ms system timer resolution while the timer is set
+	if (!highRes)
+	{
+		timeBeginPeriod(1);
+		highRes = true;
+	}
+
+	// remember the new setting
+	this->hwnd = hwnd;
+	this->msg = msg;
+	this->lParam = lParam;
+	this->dueTime = dueTime;
+	armed = true;
+	++seq;
+
+	// figure the time remaining until the deadline, in milliseconds
+	double ms = (dueTime - timer.GetTime_ticks()) * timer.GetTickTime_sec() * 1000.0;
+	DWORD dueMs = ms <= 0.0 ? 0 : static_cast<DWORD>(ceil(ms));
+
+	// create the one-shot timer; if that fails, post the message now
+	// rather than losing the event
+	if (!CreateTimerQueueTimer(&hTimer, NULL, &TimerProc, this, dueMs, 0, WT_EXECUTEINTIMERTHREAD | WT_EXECUTEONLYONCE))
+	{
+		hTimer = NULL;
+		PostMessage(hwnd, msg, seq, lParam);
+	}
+}
+
+void PrecisionTimer::Cancel()
+{
+	// delete the timer
+	DeleteTimer();
+	armed = false;
+
+	// release our timer resolution request
+	if (highRes)
+	{
+		timeEndPeriod(1);
+		highRes = false;
+	}
+}
+
+void PrecisionTimer::DeleteTimer()
+{
+	// Delete the timer, waiting for the callback to finish if it's
+	// running, so that it's safe to change the settings afterwards.
+	// The callback only posts a message, so the wait is brief.
+	if (hTimer != NULL)
+	{
+		DeleteTimerQueueTimer(NULL, hTimer, INVALID_HANDLE_VALUE);
+		hTimer = NULL;
+	}
+}
+
+VOID CALLBACK PrecisionTimer::TimerProc(PVOID lpParameter, BOOLEAN)
+{
+	// post the message
+	auto self = static_cast<PrecisionTimer*>(lpParameter);
+	PostMessage(self->hwnd, self->msg, self->seq, self->lParam);
+}
@@ -0,0 +1,98 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Precision message timer
+//
+// This is a one-shot timer that posts a window message at a given time
+// on the HiResTimer clock.  We use it in place of SetTimer() where the
+// timing is visible to the user, such as key auto-repeat.
+//
+// WM_TIMER is a poor fit for that kind of thing.  Windows only
+// generates WM_TIMER when the message queue is otherwise empty, so a
+// busy queue delays it arbitrarily; and a periodic SetTimer() drifts,
+// since each interval starts whenever the last WM_TIMER happened to be
+// processed.  A timer queue timer runs its callback on a system thread
+// at the due time, to within the system timer resolution, and the
+// callback posts our message, which Windows delivers ahead of WM_TIMER
+// and WM_PAINT.  The main message loop only raises the resolution to
+// 1ms while a view is animating; at other times it's the system
+// default, usually 15.6ms, which is too coarse for auto-repeat.  So
+// the timer raises the resolution to 1ms itself while it's set, and
+// restores it when cancelled.  (timeBeginPeriod() requests are
+// counted, so this coexists with the message loop's setting.)  The caller
+// sets the timer against an absolute due time, so a repeating event
+// can compute each deadline from the last one and never drifts.
+//
+// The timer is one-shot: the caller re-arms it when it handles the
+// message.  That keeps a slow consumer from building up a backlog of
+// posted messages.  Each Set() gets a new sequence number, which is
+// passed as the message's WPARAM, so that a message posted just before
+// the timer was cancelled or reset can be recognized as stale and
+// ignored.  The timer must be used from a single thread (normally the
+// UI thread that owns the target window).
+
+#pragma once
+#include "HiResTimer.h"
+
+class PrecisionTimer
+{
+public:
+	PrecisionTimer();
+	~PrecisionTimer();
+
+	// Set the timer to post 'msg' to 'hwnd' at the given time, in
+	// HiResTimer ticks.  The message's WPARAM is the sequence number
+	// for the new timer setting, and its LPARAM is 'lParam'.  This
+	// replaces any pending setting.  A time that's already past posts
+	// the message immediately.
+	void Set(HWND hwnd, UINT msg, LPARAM lParam, int64_t dueTime);
+
+	// Cancel the timer.  This does nothing if the timer isn't set.
+	void Cancel();
+
+	// Is the timer set (or fired but not yet handled)?
+	bool IsSet() const { return armed; }
+
+	// Check a message received from the timer.  Returns true if the
+	// message is from the current setting, false if it's stale.
+	bool IsCurrent(WPARAM wParam) const { return armed && wParam == seq; }
+
+	// get the due time of the current setting, in HiResTimer ticks
+	int64_t GetDueTime() const { return dueTime; }
+
+	// get the current time, in HiResTimer ticks
+	int64_t Now() { return timer.GetTime_ticks(); }
+
+	// convert milliseconds to HiResTimer ticks
+	int64_t MsToTicks(double ms) const { return static_cast<int64_t>(ms / 1000.0 / timer.GetTickTime_sec()); }
+
+protected:
+	// delete the timer queue timer, if any
+	void DeleteTimer();
+
+	// timer queue callback
+	static VOID CALLBACK TimerProc(PVOID lpParameter, BOOLEAN timerOrWaitFired);
+
+	// timer queue timer handle
+	HANDLE hTimer;
+
+	// is the timer set?
+	bool armed;
+
+	// have we raised the system timer resolution for this setting?
+	bool highRes;
+
+	// message target
+	HWND hwnd;
+	UINT msg;
+	LPARAM lParam;
+
+	// sequence number of the current setting
+	WPARAM seq;
+
+	// due time of the current setting
+	int64_t dueTime;
+
+	// clock
+	HiResTimer timer;
+};
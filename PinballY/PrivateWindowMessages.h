@@ -43,6 +43,11 @@ const UINT PFVMsgGameLaunchError = WM_USER + 202;
 const UINT PFVMsgShowError = WM_USER + 203;			// LPARAM = const PFVMsgShowErrorParams *params
 const UINT PFVMsgShowSysError = WM_USER + 204;		// WPARAM = TCHAR *friendly, LPARAM = const TCHAR *details
 const UINT PFVMsgPlayElevReqd = WM_USER + 205;      // WPARAM = TCHAR *systemName, LPARAM = LONG_PTR(&GameListItem)
+const UINT PFVMsgKbAutoRepeat = WM_USER + 206;      // keyboard auto-repeat; WPARAM = PrecisionTimer sequence number
+const UINT PFVMsgJsAutoRepeat = WM_USER + 207;      // joystick auto-repeat; WPARAM = PrecisionTimer sequence number
+const UINT PFVMsgMediaDropProgress = WM_USER + 208; // media drop import progress (see MediaDropImporter.h)
+const UINT PFVMsgMediaDropDone = WM_USER + 209;     // media drop import finished (see MediaDropImporter.h)
+const UINT PFVMsgCaptureEncodeDone = WM_USER + 210; // background capture encoding batch finished; LPARAM = batch (see CaptureEncoder.h)
 
 // DMDView messages
 const UINT DMVMsgHighScoreImage = WM_USER + 300;    // WPARAM = DWORD seqno, LPARAM = std::list<DMDView::HighScoreImage> *images
@@ -13,6 +13,7 @@
 #include "VPinMAMEIfc.h"
 #include "DMDView.h"
 #include "DMDFont.h"
+#include "DMDVideoKernels.h"
 
 
 // We access the DMD device through VPinMAME's DLL interface.  That
@@ -987,74 +988,50 @@ bool RealDMD::SupportsRGBDisplay() const
 //
 void RealDMD::PresentVideoFrame(int width, int height, const BYTE *y, const BYTE *u, const BYTE *v)
 {
-	// Figure the output buffer pointers according to the mirroring
-	// settings.
-	int dstStartRow = 0, dstStartCol = 0, dstRowInc = 1, dstColInc = 1;
-	if (mirrorVert)
-		dstStartRow = 31, dstRowInc = -1;
-	if (mirrorHorz)
-		dstStartCol = 127, dstColInc = -1;
+	// The pixel conversions are done with the vectorized kernels for
+	// the current CPU (see DMDVideoKernels.h).  We build each frame in
+	// normal orientation, then mirror it in place if needed.
+	const DMDVideoKernels &k = DMDVideoKernels::Get();
+	auto Mirror = [this, &k](BYTE *buf, int bytesPerPixel)
+	{
+		if (mirrorHorz)
+			k.MirrorHorz(buf, dmdWidth, dmdHeight, bytesPerPixel);
+		if (mirrorVert)
+			DMDVideoKernels::MirrorVert(buf, dmdWidth, dmdHeight, bytesPerPixel);
+	};
+
+	// Get the 8-bit luma at the DMD size.  For a double-size frame,
+	// the frames should follow the convention where each DMD pixel is
+	// stored as a 2x2 block of video pixels, so that the video has
+	// the same visible pixel structure as a DMD when played back on a
+	// video device.  Look for the maximum pixel value in each block.
+	// A native-size frame maps one-to-one onto the DMD pixels.
+	alignas(32) UINT8 luma[dmdWidth * dmdHeight];
+	const BYTE *lumaSrc;
+	bool doubleSize = (width == dmdWidth*2 && height == dmdHeight*2);
+	if (doubleSize)
+	{
+		k.MaxPool2x2(y, luma, dmdWidth, dmdHeight);
+		lumaSrc = luma;
+	}
+	else if (width == dmdWidth && height == dmdHeight)
+		lumaSrc = y;
+	else
+		return;
 
 	// prepare the buffer according to the device color space we're
 	// rendering to
 	switch (videoColorSpace)
 	{
 	case DMD_COLOR_MONO16:
-		// 16-bit monochrome mode.  The Y plane is conveniently in
-		// 8-bit luma format, at the native device size of 128x32, so
-		// all we have to do is shift all of the pixel luma values 
-		// right by four bits to get 4-bit luma.  We can ignore the U 
-		// and V planes in this mode.
-		if (width == 256 && height == 64)
-		{
-			// Double-size frame.  These should follow the convention
-			// where each DMD pixel is stored as a 2x2 block of video
-			// pixels, so that the video has the same visible pixel
-			// structure as a DMD when played back on a video device.
-			// Look for the maximum pixel value in each block, and
-			// render that in 16-shade grayscale.
-			UINT8 gray[dmdWidth * dmdHeight];
-			UINT8 *dst;
-			for (int row = 0; row < dmdHeight; ++row, y += dmdWidth*2)
-			{
-				dst = gray + dstStartRow*dmdWidth + dstStartCol;
-				dstStartRow += dstRowInc;
-				for (int col = 0; col < dmdWidth; ++col, y += 2)
-				{
-					// get the 2x2 pixel block at this position
-					BYTE a = y[0], b = y[1], c = y[dmdWidth*2], d = y[dmdWidth*2 + 1];
-
-					// take the maximum of these values
-					if (b > a) a = b;
-					if (c > a) a = c;
-					if (d > a) a = d;
-
-					// downconvert from 8 bits to 4 bits, clamp to 0..15, and store it
-					a >>= 4;
-					*dst = min(a, 15);
-					dst += dstColInc;
-				}
-			}
-
-			// display it
-			Render_16_Shades_(dmdWidth, dmdHeight, gray);
-		}
-		else if (width == dmdWidth && height == dmdHeight)
+		// Monochrome mode.  The Y plane is conveniently in 8-bit luma
+		// format, so all we have to do is shift all of the pixel luma
+		// values right to get 4-bit luma.  We can ignore the U and V
+		// planes in this mode.
 		{
-			// native size frame - convert from 8-bit luma to 4-bit luma
-			UINT8 gray[dmdWidth * dmdHeight];
-			UINT8 *dst;
-			for (int row = 0; row < dmdHeight; ++row)
-			{
-				dst = gray + dstStartRow*dmdWidth + dstStartCol;
-				dstStartRow += dstRowInc;
-				for (int col = 0; col < dmdWidth; ++col, y += 2)
-				{
-					BYTE b = (*y++) >> 4;
-					*dst = min(b, 15);
-					dst += dstColInc;
-				}
-			}
+			alignas(32) UINT8 gray[dmdWidth * dmdHeight];
+			k.Quantize16(lumaSrc, gray, dmdWidth * dmdHeight);
+			Mirror(gray, 1);
 
 			// display it
 			Render_16_Shades_(dmdWidth, dmdHeight, gray);
@@ -1062,102 +1039,35 @@ void RealDMD::PresentVideoFrame(int width, int height, const BYTE *y, const BYTE
 		break;
 
 	case DMD_COLOR_RGB:
-		if (width == dmdWidth*2 && height == dmdHeight*2)
 		{
-			// Double-size frame.  Pick out the brightest pixel from
-			// each 2x2 block.
 			rgb24 rgb[dmdWidth * dmdHeight];
-			rgb24 *dst;
-			for (int row = 0; row < dmdHeight; ++row, y += dmdWidth*2)
+			BYTE *dst = reinterpret_cast<BYTE*>(rgb);
+			if (doubleSize)
 			{
-				dst = rgb + dstStartRow*dmdWidth + dstStartCol;
-				dstStartRow += dstRowInc;
-				for (int col = 0; col < dmdWidth; ++col, y += 2, ++u, ++v)
-				{
-					// get the 2x2 pixel block at this position
-					BYTE a = y[0], b = y[1], c = y[dmdWidth*2], d = y[dmdWidth*2 + 1];
-					int ofs = 0;
-
-					// take the maximum of these values
-					if (b > a) a = b;
-					if (c > a) a = c;
-					if (d > a) a = d;
-
-					// By some amazing coincidence, the U and V planes are 
-					// already subsampled in 2x2 blocks, so whichever pixel
-					// we just picked out, the U and V samples are the same.
-					// Calculate the RGB value using the standard formula:
-					//
-					//  Y' = 1.164*(Y-16)
-					//  U' = U - 128
-					//  V' = V - 128
-					//
-					//  R = Y' + 1.596*V'
-					//  G = Y' - 0.813*V' - 0.391*U'
-					//  B = Y' + 2.018*U'
-					//
-					// For efficiency, do the calculations in base-65536
-					// fixed-point representation.
-					int yp = (a - 16)*76284;
-					int up = (*u - 128);
-					int vp = (*v - 128);
-					int rr = (yp + 104595*vp) >> 16;
-					int gg = (yp - 53281*vp - 25625*up) >> 16;
-					int bb = (yp + 132252*up) >> 16;
-
-					// Clamp the results to 0..255
-					rr = max(rr, 0);
-					gg = max(gg, 0);
-					bb = max(bb, 0);
-					dst->red = min(rr, 255);
-					dst->green = min(gg, 255);
-					dst->blue = min(bb, 255);
-
-					dst += dstColInc;
-				}
+				// By some amazing coincidence, the U and V planes are 
+				// already subsampled in 2x2 blocks, so whichever pixel
+				// we picked out of each block, the U and V samples are
+				// the same, and the U and V planes line up one-to-one
+				// with the max-pooled luma.
+				k.YUVToRGB24(lumaSrc, u, v, dst, dmdWidth * dmdHeight);
 			}
-
-			// display it
-			Render_RGB24_(dmdWidth, dmdHeight, rgb);
-		}
-		else if (width == dmdWidth && height == dmdHeight)
-		{
-			// native size frame - convert from YUV to RGB
-			rgb24 rgb[dmdWidth * dmdHeight];
-			rgb24 *dst;
-			for (int row = 0; row < dmdHeight; ++row)
+			else
 			{
-				dst = rgb + dstStartRow*dmdWidth + dstStartCol;
-				dstStartRow += dstRowInc;
-				for (int col = 0; col < dmdWidth; ++col)
+				// Native size frame.  The U and V planes are subsampled
+				// in 2x2 blocks, so expand each U/V row to full width and
+				// use it for two luma rows.
+				alignas(32) BYTE uRow[dmdWidth], vRow[dmdWidth];
+				for (int row = 0; row < dmdHeight; ++row)
 				{
-					// Get the Y, U and V values for this pixel.  The U and V
-					// planes are subsampled in 2x2 blocks, so we need to figure
-					// the U/V index accordingly.
-					int yy = *y++;
-					int uvIdx = (row/2)*dmdWidth/2 + col/2;
-					int uu = u[uvIdx];
-					int vv = v[uvIdx];
-
-					// do the YUV -> RGB conversion
-					int yp = (yy - 16)*76284;
-					int up = (uu - 128);
-					int vp = (vv - 128);
-					int rr = (yp + 104595*vp) >> 16;
-					int gg = (yp - 53281*vp - 25625*up) >> 16;
-					int bb = (yp + 132252*up) >> 16;
-
-					// clamp the results to 0..255 and store the RGB pixel
-					rr = max(rr, 0);
-					gg = max(gg, 0);
-					bb = max(bb, 0);
-					dst->red = min(rr, 255);
-					dst->green = min(gg, 255);
-					dst->blue = min(bb, 255);
-
-					dst += dstColInc;
+					if ((row & 1) == 0)
+					{
+						k.Upsample2x(u + (row/2)*(dmdWidth/2), uRow, dmdWidth/2);
+						k.Upsample2x(v + (row/2)*(dmdWidth/2), vRow, dmdWidth/2);
+					}
+					k.YUVToRGB24(lumaSrc + row*dmdWidth, uRow, vRow, dst + row*dmdWidth*3, dmdWidth);
 				}
 			}
+			Mirror(dst, 3);
 
 			// display it
 			Render_RGB24_(dmdWidth, dmdHeight, rgb);
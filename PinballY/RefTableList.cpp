@@ -4,7 +4,6 @@
 #include "stdafx.h"
 #include "RefTableList.h"
 #include "Application.h"
-#include "DiceCoefficient.h"
 
 RefTableList::RefTableList()
 {
@@ -29,11 +28,11 @@ void RefTableList::GetTopMatches(const TCHAR *name, int n, std::list<Table> &lst
 	std::transform(lcName.begin(), lcName.end(), lcName.begin(), _totlower);
 
 	// build the bigram set for the name
-	DiceCoefficient::BigramSet<TCHAR> bg;
-	DiceCoefficient::BuildBigramSet(bg, lcName.c_str());
+	FuzzyMatchIndex::BigramSet bg;
+	FuzzyMatchIndex::BuildBigramSet(bg, lcName.c_str());
 
 	// get the number of rows in the reference list
-	size_t nRows = nameBigrams.size();
+	size_t nRows = csvFile.GetNumRows();
 
 	// If the target name has any parenthetical suffixes, remove them.
 	// It's common for table files to have names that either conform to
@@ -57,13 +56,56 @@ void RefTableList::GetTopMatches(const TCHAR *name, int n, std::list<Table> &lst
 		baseName = lcName;
 
 	// get the bigram set for the base name
-	DiceCoefficient::BigramSet<TCHAR> bgBase;
-	DiceCoefficient::BuildBigramSet(bgBase, baseName.c_str());
+	FuzzyMatchIndex::BigramSet bgBase;
+	FuzzyMatchIndex::BuildBigramSet(bgBase, baseName.c_str());
 
 	// there's nothing to do if the ref list is empty
 	if (nRows == 0)
 		return;
 
+	// Search the name index for the full name and base name.  This
+	// tries each against both the Name and AltName for each row, and
+	// yields the best of the four scores.  Rows that don't share any
+	// bigrams with either version of the name score zero, so the index
+	// doesn't even visit them.
+	std::vector<FuzzyMatchIndex::Match> matches;
+	nameIndex.Search(matches, { &bg, &bgBase }, 0.0f);
+
+	// Working score per row, for the rows with non-zero scores.  Start
+	// with the bigram matches.
+	std::unordered_map<int, float> scores;
+	for (auto &m : matches)
+		scores.emplace(m.id, m.score);
+
+	// Try matching the base name to the initials.  This isn't a bigram 
+	// match, just a substring match, but we need a score on the 0-1.0
+	// scale for comparison purposes.  Score it based on the number of
+	// initials.  Don't try to match based on a single initial at all.
+	auto MatchInitials = [&scores](const std::unordered_multimap<TSTRING, int> &index, const TSTRING &key)
+	{
+		auto range = index.equal_range(key);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			float score2 = float(key.length()) * 0.2f;
+			score2 = min(1.0f, score2);
+			auto &score = scores[it->second];
+			score = max(score, score2);
+		}
+	};
+	if (lcName.length() > 1)
+		MatchInitials(initialsIndex, lcName);
+	if (baseName.length() > 1 && baseName != lcName)
+		MatchInitials(initialsIndex, baseName);
+
+	// Try the same thing with the initials with a "T" prefix, for "The".
+	// We strip out "The" from the reference titles when building the
+	// initials string, but the "standard" initials for a very few games
+	// include the "T" from "The" in the initials, such as "The Addams
+	// Family".
+	MatchInitials(initialsWithTIndex, lcName);
+	if (baseName != lcName)
+		MatchInitials(initialsWithTIndex, baseName);
+
 	// working search results list
 	struct Result
 	{
@@ -72,62 +114,30 @@ void RefTableList::GetTopMatches(const TCHAR *name, int n, std::list<Table> &lst
 		float score;	// match score
 	};
 	std::vector<Result> searchResults;
-	searchResults.reserve(nRows);
+	searchResults.reserve(scores.size());
+	for (auto &s : scores)
+		searchResults.emplace_back(s.first, s.second);
 
-	// go through the table list and look for matches
-	for (size_t i = 0; i < nRows; ++i)
-	{
-		// figure the match strength for this item
-		float score = DiceCoefficient::DiceCoefficient(bg, nameBigrams[i]);
-
-		// figure the match strength for the shortened version of the name, and
-		// use this score if it's higher than the original
-		float score2 = DiceCoefficient::DiceCoefficient(bgBase, nameBigrams[i]);
-		score = max(score, score2);
-
-		// try again with the name against the alternate name
-		score2 = DiceCoefficient::DiceCoefficient(bg, altNameBigrams[i]);
-		score = max(score, score2);
-
-		// try once again the base name against the alt name
-		score2 = DiceCoefficient::DiceCoefficient(bgBase, altNameBigrams[i]);
-		score = max(score, score2);
-
-		// Try matching the base name to the initials.  This isn't a bigram 
-		// match, just a substring match, but we need a score on the 0-1.0
-		// scale for comparison purposes.  Score it based on the number of
-		// initials.  Don't try to match based on a single initial at all.
-		const TCHAR *initials = initialsCol->Get((int)i, _T(""));
-		size_t nInitials = _tcslen(initials);
-		if (nInitials > 1 && (lcName == initials || baseName == initials))
-		{
-			float score2 = float(nInitials) * 0.2f;
-			score2 = min(1.0f, score2);
-			score = max(score, score2);
-		}
+	// sort the list by descending score
+	std::sort(searchResults.begin(), searchResults.end(), [](const Result &a, const Result &b) {
+		return a.score != b.score ? a.score > b.score : a.idx < b.idx;
+	});
 
-		// Try the same thing with the initials with a "T" prefix, for "The".
-		// We strip out "The" from the reference titles when building the
-		// initials string, but the "standard" initials for a very few games
-		// include the "T" from "The" in the initials, such as "The Addams
-		// Family".
-		TSTRING initialsWithT = _T("t");
-		initialsWithT += initials;
-		if (lcName == initialsWithT || baseName == initialsWithT)
+	// If the best score is low enough that zero-score rows would pass
+	// the distance-from-top test below, pad the list out with zero-score
+	// rows, as though we'd scored the whole table.
+	if ((int)searchResults.size() < n && (searchResults.size() == 0 || searchResults[0].score < 0.3f))
+	{
+		for (int i = 0; i < (int)nRows && (int)searchResults.size() < n; ++i)
 		{
-			float score2 = float(nInitials + 1) * 0.2f;
-			score2 = min(1.0f, score2);
-			score = max(score, score2);
+			if (scores.find(i) == scores.end())
+				searchResults.emplace_back(i, 0.0f);
 		}
-
-		// add it to the results, using the highest score we found
-		searchResults.emplace_back((int)i, score);
 	}
 
-	// sort the list by descending score
-	std::sort(searchResults.begin(), searchResults.end(), [](const Result &a, const Result &b) {
-		return a.score > b.score;
-	});
+	// if we didn't find anything, there's nothing more to do
+	if (searchResults.size() == 0)
+		return;
 
 	// Get the highest score
 	float highestScore = searchResults[0].score;
@@ -227,26 +237,21 @@ void RefTableList::Init()
 		std::basic_regex<TCHAR> trimPat(_T("^(the|a|an)?\\s+|\\s+(,\\s+(the|a|an))?$"));
 		std::basic_regex<TCHAR> initPat(_T("(\\w)\\w+\\s*"));
 
-		// Build the bigram sets and sorting keys
+		// Build the fuzzy match index and sorting keys
 		size_t nRows = self->csvFile.GetNumRows();
-		self->nameBigrams.reserve(nRows);
-		self->altNameBigrams.reserve(nRows);
 		for (size_t i = 0; i < nRows; ++i)
 		{
 			// get the name, in lower-case
 			TSTRING name = self->nameCol->Get((int)i, _T(""));
 			std::transform(name.begin(), name.end(), name.begin(), _totlower);
 
-			// Emplace a new row in the bigram set vector, and build
-			// the bigram set for the title into the vector entry.
-			self->nameBigrams.emplace_back();
-			DiceCoefficient::BuildBigramSet(self->nameBigrams.back(), name.c_str());
+			// add it to the fuzzy match index under the row number
+			self->nameIndex.Add((int)i, name.c_str());
 
-			// likewise for the AltName bigrams
+			// likewise for the AltName
 			TSTRING altName = self->altNameCol->Get((int)i, _T(""));
 			std::transform(altName.begin(), altName.end(), altName.begin(), _totlower);
-			self->altNameBigrams.emplace_back();
-			DiceCoefficient::BuildBigramSet(self->altNameBigrams.back(), altName.c_str());
+			self->nameIndex.Add((int)i, altName.c_str());
 
 			// Synthesize the sorting key
 			self->MakeSortKey((int)i);
@@ -266,6 +271,10 @@ void RefTableList::Init()
 
 			// store it
 			self->initialsCol->Set((int)i, initName.c_str());
+
+			// add it to the initials indices
+			self->initialsIndex.emplace(initName, (int)i);
+			self->initialsWithTIndex.emplace(_T("t") + initName, (int)i);
 		}
 
 		// done (the thread return value isn't used, but we have to return
@@ -23,7 +23,7 @@
 
 #pragma once
 #include "CSVFile.h"
-#include "DiceCoefficient.h"
+#include "FuzzyMatch.h"
 
 class RefTableList
 {
@@ -73,11 +73,16 @@ protected:
 	// underlying CSV file data
 	CSVFile csvFile;
 
-	// Bigram sets for the Name, AltName, and Initials fields.  The 
-	// table is static, so we just build these vectors in parallel, 
-	// indexed by the row numbers in the CSV file data.
-	std::vector<DiceCoefficient::BigramSet<TCHAR>> nameBigrams;
-	std::vector<DiceCoefficient::BigramSet<TCHAR>> altNameBigrams;
+	// Fuzzy match index for the Name and AltName fields.  Both names
+	// for each row are indexed under the row number in the CSV file
+	// data, so a search yields the better of the two scores per row.
+	FuzzyMatchIndex nameIndex;
+
+	// Initials index.  This maps each row's initials string to the
+	// rows with those initials.  We also enter each row under its
+	// initials with a "t" prefix (for "The"); see GetTopMatches().
+	std::unordered_multimap<TSTRING, int> initialsIndex;
+	std::unordered_multimap<TSTRING, int> initialsWithTIndex;
 
 	// CSV file column accessors
 	CSVFile::Column *nameCol;
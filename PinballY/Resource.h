@@ -294,6 +294,10 @@
 #define IDS_ERR_DMDNODLL                685
 #define IDS_ERR_OPTS_DIALOG_DLL         686
 #define IDS_ERR_NOT_WHILE_RUNNING       687
+#define IDS_ERR_CAP_ITEM_ENCODING       688
+#define IDS_ERR_CAP_ENCODE_SUCCESS      689
+#define IDS_ERR_CAP_ENCODE_FAILED       690
+#define IDS_ERR_CAP_ITEM_ENCODING_BUSY  691
 
 #define IDS_PLAYED_WITHIN               800
 #define IDS_NOT_PLAYED_WITHIN           801
@@ -340,6 +344,9 @@
 #define IDS_MEDIA_DROP_CONFIRM          917
 #define IDS_MEDIA_DROP_SUCCESS          918
 #define IDS_MEDIA_DROP_ALL_SKIPPED      919
+#define IDS_MEDIA_DROP_PROGRESS1        920
+#define IDS_MEDIA_DROP_PROGRESS2        921
+#define IDS_MEDIA_DROP_BUSY             922
 
 #define IDS_ROMCOMBO_DEFAULT_EMPTY      930
 #define IDS_ROMCOMBO_DEFAULT_NAME       931
@@ -420,6 +427,7 @@
 #define ID_OPERATOR_MENU                32847
 #define ID_CAPTURE_ADJUSTDELAY          32848
 #define ID_FILTER_BY_ADDED              32849
+#define ID_PERF_TRACE                   32850
 
 
 // Next default values for new objects
@@ -428,7 +436,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        2000
-#define _APS_NEXT_COMMAND_VALUE         32850
+#define _APS_NEXT_COMMAND_VALUE         32851
 #define _APS_NEXT_CONTROL_VALUE         1200
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
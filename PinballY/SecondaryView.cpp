@@ -82,6 +82,11 @@ void SecondaryView::UpdateDrawingList()
 
 	// update sprite scaling
 	ScaleSprites();
+
+	// The list is often updated from outside our own message handling
+	// (e.g., when the main view changes games), so request a new frame
+	// explicitly rather than waiting for the static render backstop.
+	InvalidateRender();
 }
 
 void SecondaryView::AddBackgroundToDrawingList()
@@ -116,6 +116,10 @@ public:
 	// load the DLL if we haven't already
 	bool Load(ErrorHandler &eh)
 	{
+		// Archives can be opened on background threads (for media
+		// drop imports, for example), so serialize the loading.
+		CriticalSectionLocker locker(lock);
+
 		// if we haven't already loaded the DLL, try to do so now
 		if (hdll == NULL)
 		{
@@ -180,6 +184,9 @@ protected:
 
 	// CreateObject function
 	Func_CreateObject pCreateObj;
+
+	// loader lock
+	CriticalSection lock;
 };
 
 // singleton instance
@@ -191,7 +198,9 @@ SevenZipDll SevenZipDll::inst;
 // 7-Zip archive interface
 //
 
-SevenZipArchive::SevenZipArchive()
+SevenZipArchive::SevenZipArchive() :
+	hasPassword(false),
+	allowPasswordPrompt(true)
 {
 }
 
@@ -247,17 +256,15 @@ bool SevenZipArchive::OpenArchive(const TCHAR *fname, ErrorHandler &eh)
 	}
 
 	// Open callback object.  The archive classes use this to ask for
-	// a password for encrypted files.  We simply flag an error in
-	// these cases.
+	// a password for an archive with encrypted headers.
 	class CArchiveOpenCallback :
 		public IArchiveOpenCallback,
 		public ICryptoGetTextPassword,
 		public CMyUnknownImp
 	{
 	public:
-		CArchiveOpenCallback(const TCHAR *fname, ErrorHandler &eh) : fname(fname), eh(eh) { }
-		TSTRING fname;
-		ErrorHandler &eh;
+		CArchiveOpenCallback(SevenZipArchive *arch) : arch(arch) { }
+		SevenZipArchive *arch;
 
 		MY_UNKNOWN_IMP1(ICryptoGetTextPassword)
 
@@ -266,13 +273,13 @@ bool SevenZipArchive::OpenArchive(const TCHAR *fname, ErrorHandler &eh)
 
 		STDMETHOD(CryptoGetTextPassword)(BSTR *pbstrPassword)
 		{
-			return RunPasswordDialog(pbstrPassword, fname.c_str(), nullptr);
+			return arch->ProvidePassword(pbstrPassword, nullptr);
 		}
 	};
 
 	// open the archive
 	const UINT64 scanSize = 1 << 23;
-	RefPtr<CArchiveOpenCallback> openCb(new CArchiveOpenCallback(fname, eh));
+	RefPtr<CArchiveOpenCallback> openCb(new CArchiveOpenCallback(this));
 	openCb->AddRef();
 	if (!SUCCEEDED(hr = archive->Open(stream, &scanSize, openCb)))
 	{
@@ -333,11 +340,129 @@ bool SevenZipArchive::EnumFiles(std::function<void(UINT32 idx, const WCHAR *path
 	return allOk;
 }
 
+bool SevenZipArchive::IsSolid()
+{
+	// check the archive's 'solid' property
+	NWindows::NCOM::CPropVariant prop;
+	return archive != nullptr
+		&& SUCCEEDED(archive->GetArchiveProperty(kpidSolid, &prop))
+		&& prop.vt == VT_BOOL
+		&& prop.boolVal != 0;
+}
+
+bool SevenZipArchive::IsEncrypted(UINT32 idx)
+{
+	// check the entry's 'encrypted' property
+	NWindows::NCOM::CPropVariant prop;
+	return archive != nullptr
+		&& SUCCEEDED(archive->GetProperty(idx, kpidEncrypted, &prop))
+		&& prop.vt == VT_BOOL
+		&& prop.boolVal != 0;
+}
+
+UINT64 SevenZipArchive::GetSize(UINT32 idx)
+{
+	// read the entry's size property
+	NWindows::NCOM::CPropVariant prop;
+	if (archive == nullptr || !SUCCEEDED(archive->GetProperty(idx, kpidSize, &prop)))
+		return 0;
+
+	// the size is usually reported as a UI8, but allow for other types
+	switch (prop.vt)
+	{
+	case VT_UI8: return prop.uhVal.QuadPart;
+	case VT_UI4: return prop.ulVal;
+	default:     return 0;
+	}
+}
+
+bool SevenZipArchive::GetPassword(TSTRING &password) const
+{
+	if (!hasPassword)
+		return false;
+
+	password = this->password;
+	return true;
+}
+
+bool SevenZipArchive::PromptForPassword()
+{
+	// if we already have a password, there's no need to ask
+	if (hasPassword)
+		return true;
+
+	// ask the user, and remember the result
+	BSTR bstr = nullptr;
+	if (!SUCCEEDED(RunPasswordDialog(&bstr, filename.c_str(), nullptr)))
+		return false;
+
+	SetPassword(bstr);
+	SysFreeString(bstr);
+	return true;
+}
+
+HRESULT SevenZipArchive::ProvidePassword(BSTR *pbstrPassword, const TCHAR *entryName)
+{
+	// if we don't have a password yet, ask the user, if we can
+	if (!hasPassword)
+	{
+		if (!allowPasswordPrompt)
+			return E_ABORT;
+
+		BSTR bstr = nullptr;
+		HRESULT hr = RunPasswordDialog(&bstr, filename.c_str(), entryName);
+		if (!SUCCEEDED(hr))
+			return hr;
+
+		SetPassword(bstr);
+		SysFreeString(bstr);
+	}
+
+	// pass back a copy of the password
+	*pbstrPassword = SysAllocString(password.c_str());
+	return S_OK;
+}
+
 bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &eh)
 {
+	// extract it as a batch of one
+	std::vector<ExtractItem> items;
+	items.emplace_back(idx, destFile);
+	return ExtractBatch(items, nullptr, nullptr, eh);
+}
+
+bool SevenZipArchive::ExtractBatch(const std::vector<ExtractItem> &items,
+	std::function<void(size_t item, bool ok)> onItemDone,
+	std::function<bool(UINT64 done, UINT64 total)> onProgress,
+	ErrorHandler &eh)
+{
+	// if there's nothing to do, we're done
+	if (items.size() == 0)
+		return true;
+
+	// note the status of each item, so that we can report the items
+	// we never reach
+	std::vector<bool> reported(items.size(), false);
+	auto ItemDone = [&reported, &onItemDone](size_t item, bool ok)
+	{
+		if (!reported[item])
+		{
+			reported[item] = true;
+			if (onItemDone != nullptr)
+				onItemDone(item, ok);
+		}
+	};
+
 	// we need an open archive to proceed
 	if (archive == nullptr)
+	{
+		for (size_t i = 0; i < items.size(); ++i)
+			ItemDone(i, false);
 		return false;
+	}
+
+	// "no item" marker for the extraction callback's current item
+	static const size_t NoItem = ~size_t(0);
 
 	// set up the extraction callback object
 	class ExtractCallback :
@@ -346,23 +471,44 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 		public CMyUnknownImp
 	{
 	public:
-		ExtractCallback(SevenZipArchive *arch, const TCHAR *destFile, ErrorHandler &eh) : 
+		ExtractCallback(SevenZipArchive *arch, const std::vector<ExtractItem> &items,
+			std::function<void(size_t, bool)> itemDone,
+			std::function<bool(UINT64, UINT64)> &onProgress,
+			ErrorHandler &eh) :
 			arch(arch),
-			destFile(destFile),
-			eh(eh), 
-			nErrors(0)
+			items(items),
+			itemDone(itemDone),
+			onProgress(onProgress),
+			eh(eh),
+			cur(NoItem),
+			curErrors(0),
+			nErrors(0),
+			total(0),
+			cancelled(false)
 		{ 
-			// clear the file time and attributes
-			fileInfo.modTime.dwLowDateTime = 0;
-			fileInfo.modTime.dwHighDateTime = 0;
-			fileInfo.attr = INVALID_FILE_ATTRIBUTES;
+			// build the index from archive entry to list position
+			for (size_t i = 0; i < items.size(); ++i)
+				itemForEntry.emplace(items[i].idx, i);
 		}
 
 		MY_UNKNOWN_IMP1(ICryptoGetTextPassword)
 
 		// IProgress
-		STDMETHOD(SetTotal)(UInt64) { return S_OK; }
-		STDMETHOD(SetCompleted)(const UInt64 *) { return S_OK; }
+		STDMETHOD(SetTotal)(UInt64 n) 
+		{
+			total = n;
+			return S_OK; 
+		}
+		STDMETHOD(SetCompleted)(const UInt64 *n)
+		{
+			// pass the progress to the caller, and cancel if they say so
+			if (n != nullptr && onProgress != nullptr && !onProgress(*n, total))
+			{
+				cancelled = true;
+				return E_ABORT;
+			}
+			return S_OK; 
+		}
 
 		// IArchiveExtractCallback
 		STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream **pOutStream, Int32 askExtractMode)
@@ -370,6 +516,21 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 			// clear any previous output streams
 			*pOutStream = NULL;
 
+			// find the batch item for the entry; ignore entries we didn't ask for
+			if (auto it = itemForEntry.find(index); it != itemForEntry.end())
+				cur = it->second;
+			else
+			{
+				cur = NoItem;
+				return S_OK;
+			}
+
+			// start the new item with a clean slate
+			curErrors = 0;
+			fileInfo.modTime.dwLowDateTime = 0;
+			fileInfo.modTime.dwHighDateTime = 0;
+			fileInfo.attr = INVALID_FILE_ATTRIBUTES;
+
 			// get the name of the entry we're trying to extract
 			NWindows::NCOM::CPropVariant nameProp;
 			if (SUCCEEDED(arch->archive->GetProperty(index, kpidPath, &nameProp))
@@ -392,13 +553,22 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 				&& modTimeProp.vt == VT_FILETIME)
 				fileInfo.modTime = modTimeProp.filetime;
 
+			// Write the data to a temporary file alongside the destination
+			// file.  We'll rename it to the final name when it's complete.
+			// Keeping it in the same folder keeps it on the same volume,
+			// so the rename is atomic.
+			tempFile = items[cur].destFile + _T(".~extract");
+
 			// create the output stream (NB - the assignment adds a reference)
 			outStream = new COutFileStream();
 
 			// open the file
-			if (!outStream->Open(destFile.c_str(), CREATE_ALWAYS))
+			if (!outStream->Open(tempFile.c_str(), CREATE_ALWAYS))
 			{
-				eh.Error(MsgFmt(IDS_ERR_7Z_EXTRACT_OPEN_OUTPUT, arch->filename.c_str(), destFile.c_str()));
+				eh.Error(MsgFmt(IDS_ERR_7Z_EXTRACT_OPEN_OUTPUT, arch->filename.c_str(), tempFile.c_str()));
+				outStream = nullptr;
+				++nErrors;
+				FinishItem(false);
 				return E_ABORT;
 			}
 
@@ -416,6 +586,11 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 
 		STDMETHOD(SetOperationResult)(Int32 resultEOperationResult)
 		{
+			// ignore entries that aren't in our batch
+			if (cur == NoItem)
+				return S_OK;
+
+			const TCHAR *destFile = items[cur].destFile.c_str();
 			const char *detail = "other error";
 			switch (resultEOperationResult)
 			{ 
@@ -425,8 +600,14 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 
 			case NArchive::NExtract::NOperationResult::kWrongPassword:
 				// password error
-				++nErrors;
+				++curErrors;
 				eh.Error(MsgFmt(IDS_ERR_7Z_WRONG_PASSWORD, arch->filename.c_str()));
+
+				// Forget the password, so that we ask again for the next
+				// entry.  If we can't ask, there's no point in forgetting
+				// it, since the other entries will fail either way.
+				if (arch->allowPasswordPrompt)
+					arch->hasPassword = false;
 				break;
 
 			case NArchive::NExtract::NOperationResult::kUnsupportedMethod:  detail = "unsupported method"; goto genErr;
@@ -443,9 +624,9 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 				// can't be fixed by user action.  We provide details for these in the
 				// usual "system error" format, since they might be useful to the
 				// developers but won't be helpful to most users.
-				++nErrors;
+				++curErrors;
 				eh.SysError(
-					MsgFmt(IDS_ERR_7Z_EXTRACT_FAILED, arch->filename.c_str(), entryName.c_str(), destFile.c_str()),
+					MsgFmt(IDS_ERR_7Z_EXTRACT_FAILED, arch->filename.c_str(), entryName.c_str(), destFile),
 					MsgFmt(_T("7z.dll extract failed: %hs"), detail));
 			}
 
@@ -458,9 +639,20 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 
 				// close the stream
 				outStream->Close();
+				outStream = nullptr;
+
+				// if it succeeded, rename the temporary file to the final name
+				if (curErrors == 0 && !MoveFileEx(tempFile.c_str(), destFile, MOVEFILE_REPLACE_EXISTING))
+				{
+					WindowsErrorMessage winErr;
+					++curErrors;
+					eh.SysError(
+						MsgFmt(IDS_ERR_7Z_EXTRACT_FAILED, arch->filename.c_str(), entryName.c_str(), destFile),
+						MsgFmt(_T("Renaming temporary file %s: %s"), tempFile.c_str(), winErr.Get()));
+				}
 
 				// set the original file attributes
-				if (fileInfo.attr != INVALID_FILE_ATTRIBUTES)
+				if (curErrors == 0 && fileInfo.attr != INVALID_FILE_ATTRIBUTES)
 				{
 					// check for Posix flags
 					DWORD attr = fileInfo.attr;
@@ -468,32 +660,72 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 						attr &= 0x3FFF;
 
 					// set the attributes on the file
-					SetFileAttributes(destFile.c_str(), attr);
+					SetFileAttributes(destFile, attr);
 				}
 
-				// we're done with the stream
-				outStream = nullptr;
-
-				// if errors occurred, delete the file - we don't want to leave
-				// behind an empty or corrupted file
-				if (nErrors != 0)
-					DeleteFile(destFile.c_str());
+				// if errors occurred, delete the temporary file - we don't 
+				// want to leave behind an empty or corrupted file
+				if (curErrors != 0)
+					DeleteFile(tempFile.c_str());
 			}
 
+			// count the errors and report the item finished
+			nErrors += curErrors;
+			FinishItem(curErrors == 0);
 			return S_OK;
 		}
 
+		// Finish the current item, and report it to the caller
+		void FinishItem(bool ok)
+		{
+			if (cur != NoItem)
+			{
+				itemDone(cur, ok);
+				cur = NoItem;
+			}
+		}
+
+		// Clean up after an interrupted extraction.  If we were in the
+		// middle of an item, close and delete its temporary file.
+		void Abandon()
+		{
+			if (outStream != nullptr)
+			{
+				outStream->Close();
+				outStream = nullptr;
+				DeleteFile(tempFile.c_str());
+			}
+			FinishItem(false);
+		}
+
 		// ICryptoGetTextPassword
 		STDMETHOD(CryptoGetTextPassword)(BSTR *pbstrPassword)
 		{
-			return RunPasswordDialog(pbstrPassword, arch->filename.c_str(), WSTRINGToTSTRING(entryName).c_str());
+			// Get the password from the archive object.  It remembers
+			// the password once the user enters it, so that we only ask
+			// once per archive rather than once per entry.
+			return arch->ProvidePassword(pbstrPassword, WSTRINGToTSTRING(entryName).c_str());
 		}
 
 		// source archive object
 		SevenZipArchive *arch;
 
-		// destination file
-		TSTRING destFile;
+		// batch items
+		const std::vector<ExtractItem> &items;
+
+		// map from archive entry index to item list position
+		std::unordered_map<UInt32, size_t> itemForEntry;
+
+		// callbacks
+		std::function<void(size_t, bool)> itemDone;
+		std::function<bool(UINT64, UINT64)> &onProgress;
+
+		// current item, as a list position, or NoItem if we're not
+		// working on an item
+		size_t cur;
+
+		// temporary file for the current item
+		TSTRING tempFile;
 
 		// output stream
 		RefPtr<COutFileStream> outStream;
@@ -504,9 +736,16 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 		// error handler
 		ErrorHandler &eh;
 
-		// error count
+		// error count for the current item, and for the whole batch
+		int curErrors;
 		int nErrors;
 
+		// total number of bytes to extract, as reported by the archive
+		UINT64 total;
+
+		// did the caller cancel the extraction via the progress callback?
+		bool cancelled;
+
 		struct
 		{
 			FILETIME modTime;
@@ -514,21 +753,34 @@ bool SevenZipArchive::Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &e
 		} fileInfo;
 	};
 	RefPtr<ExtractCallback> cb;
-	cb = new ExtractCallback(this, destFile, eh);
-
-	// set up the object indices
-	UInt32 indices[] = { idx };
+	cb = new ExtractCallback(this, items, ItemDone, onProgress, eh);
+
+	// Set up the entry indices.  The archive readers require these to
+	// be in ascending order, so that they can make a single pass over
+	// the archive.
+	std::vector<UInt32> indices;
+	indices.reserve(items.size());
+	for (auto &item : items)
+		indices.push_back(item.idx);
+	std::sort(indices.begin(), indices.end());
+	indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+	// extract the items
+	HRESULT hr = archive->Extract(indices.data(), (UInt32)indices.size(), false, cb);
+
+	// clean up any item that was interrupted, and fail any items we never reached
+	cb->Abandon();
+	for (size_t i = 0; i < items.size(); ++i)
+		ItemDone(i, false);
 
-	// extract the item
-	HRESULT hr = archive->Extract(indices, countof(indices), false, cb);
 	if (!SUCCEEDED(hr))
 	{
 		// log a separate generic error if the callback didn't already log
-		// specific errors
-		if (cb->nErrors == 0)
+		// specific errors, unless the caller cancelled the extraction
+		if (cb->nErrors == 0 && !cb->cancelled)
 		{
 			eh.SysError(
-				MsgFmt(IDS_ERR_7Z_EXTRACT_FAILED, filename.c_str(), cb->entryName.c_str(), destFile),
+				MsgFmt(IDS_ERR_7Z_EXTRACT_FAILED, filename.c_str(), cb->entryName.c_str(), items[0].destFile.c_str()),
 				MsgFmt(_T("7z.dll!IInArchive::Extract failed, HRESULT %lx"), (long)hr));
 		}
 
@@ -20,14 +20,95 @@ public:
 	// enumerate the files in the archive
 	bool EnumFiles(std::function<void(UINT32 idx, const WCHAR *path, bool isDir)> func);
 
+	// Is the archive solid?  In a solid archive, the entries are
+	// compressed together as a single stream, so extracting any entry
+	// means decompressing everything ahead of it in the stream.
+	bool IsSolid();
+
+	// is the entry at the given index encrypted?
+	bool IsEncrypted(UINT32 idx);
+
+	// get the uncompressed size of the entry at the given index
+	UINT64 GetSize(UINT32 idx);
+
+	// Passwords.  When the archive needs a password, for an encrypted
+	// entry or for encrypted headers, it uses the password set with
+	// SetPassword() or entered earlier, if any, and otherwise asks the
+	// user via the password dialog.  A password the user enters is
+	// remembered for the rest of the archive object's lifetime, so the
+	// user only has to enter it once per archive.
+	//
+	// The password dialog can only run on the UI thread.  Code that
+	// works with an archive on a background thread must call
+	// DisablePasswordPrompt(), and get any password it needs up front
+	// on the UI thread.  With the prompt disabled, an encrypted entry
+	// simply fails to extract if we don't have the right password.
+	void SetPassword(const TCHAR *password) { this->password = password; hasPassword = true; }
+	void DisablePasswordPrompt() { allowPasswordPrompt = false; }
+
+	// Get the password, if we have one.  Returns false if not.
+	bool GetPassword(TSTRING &password) const;
+
+	// Ask the user for the password, if we don't have one already.  This
+	// must be called on the UI thread.  Returns false if the user cancels
+	// the dialog.
+	bool PromptForPassword();
+
 	// extract the file at the given index
 	bool Extract(UINT32 idx, const TCHAR *destFile, ErrorHandler &eh);
 
+	// Batch extraction item
+	struct ExtractItem
+	{
+		ExtractItem(UINT32 idx, const TCHAR *destFile) : idx(idx), destFile(destFile) { }
+
+		// index of the entry in the archive
+		UINT32 idx;
+
+		// destination file
+		TSTRING destFile;
+	};
+
+	// Extract a batch of entries in a single pass through the archive.
+	// This is much faster than extracting the entries one at a time
+	// when there are several of them, particularly for a solid archive,
+	// where each separate extraction would have to decompress the 
+	// stream from the beginning.
+	//
+	// Each entry is written to a temporary file in the destination
+	// folder, which is renamed to the destination name when the entry
+	// is complete, so an error or cancellation never leaves a partial
+	// file under the destination name.
+	//
+	// 'onItemDone' is called as each item finishes, with the item's
+	// position in the list and a success flag.  Every item gets exactly
+	// one call, including items that are never reached because of a
+	// cancellation or error.  'onProgress' is called periodically with
+	// the number of bytes extracted so far and the total for the batch;
+	// it can return false to cancel the extraction.  Either callback
+	// can be omitted.  Returns true if all of the items were extracted
+	// successfully.
+	bool ExtractBatch(const std::vector<ExtractItem> &items,
+		std::function<void(size_t item, bool ok)> onItemDone,
+		std::function<bool(UINT64 done, UINT64 total)> onProgress,
+		ErrorHandler &eh);
+
 protected:
+	// Provide the password for a 7z.dll password callback, prompting
+	// for it if necessary and allowed
+	HRESULT ProvidePassword(BSTR *pbstrPassword, const TCHAR *entryName);
+
 	// 7z.dll archive reader object
 	RefPtr<IInArchive> archive;
 
 	// filename
 	TSTRING filename;
+
+	// password, if we have one
+	TSTRING password;
+	bool hasPassword;
+
+	// can we show the password dialog?
+	bool allowPasswordPrompt;
 };
 
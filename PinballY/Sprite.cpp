@@ -12,6 +12,8 @@
 #include "Shader.h"
 #include "TextureShader.h"
 #include "Application.h"
+#include "SpriteCompositor.h"
+#include "DecodedImageCache.h"
 #include "FlashClient/FlashClient.h"
 
 
@@ -23,6 +25,7 @@ Sprite::Sprite()
 	offset = { 0.0f, 0.0f, 0.0f };
 	scale = { 1.0f, 1.0f, 1.0f };
 	rotation = { 0.0f, 0.0f, 0.0f };
+	asyncLoadSeq = 0;
 	UpdateWorld();
 }
 
@@ -76,7 +79,21 @@ bool Sprite::Load(const WCHAR *filename, POINTF normalizedSize, SIZE pixSize, Er
 	if (GetImageFileInfo(filename, desc) && desc.imageType == ImageFileDesc::SWF)
 		return LoadSWF(filename, normalizedSize, pixSize, eh);
 
-	// It's not an SWF.  Load the texture from the image file using WIC.
+	// It's not an SWF.  If the image is much larger than the display
+	// size, load a reduced copy through the decoded image cache.
+	if (auto cache = DecodedImageCache::Get(); cache != nullptr)
+	{
+		BITMAPINFO bmi;
+		std::vector<BYTE> pixels;
+		if (cache->Load(filename, desc.size, pixSize, bmi, pixels))
+		{
+			MsgFmt descForErrors(_T("file \"%ws\""), filename);
+			return CreateTextureFromBitmap(bmi, pixels.data(), eh, descForErrors)
+				&& CreateMesh(normalizedSize, eh, descForErrors);
+		}
+	}
+
+	// Load the texture from the image file using WIC.
 	HRESULT hr = CreateWICTextureFromFile(D3D::Get()->GetDevice(), filename, &texture, &rv);
 	if (FAILED(hr))
 	{
@@ -173,6 +190,74 @@ bool Sprite::Load(int pixWidth, int pixHeight, std::function<void(HDC, HBITMAP)>
 	return ret;
 }
 
+void Sprite::LoadAsync(int pixWidth, int pixHeight, const TCHAR *key,
+	std::function<void(HDC, HBITMAP)> drawingFunc, const TCHAR *descForErrors)
+{
+	// supersede any earlier request
+	DWORD seq = ++asyncLoadSeq;
+
+	// if the compositor isn't running, load synchronously
+	auto compositor = SpriteCompositor::Get();
+	if (compositor == nullptr)
+	{
+		Application::InUiErrorHandler eh;
+		Load(pixWidth, pixHeight, drawingFunc, eh, descForErrors);
+		return;
+	}
+
+	// Keep a reference on the sprite until the image is delivered.  The
+	// completion callback is only released on the UI thread, so the last
+	// reference can safely be dropped there.
+	AddRef();
+	std::shared_ptr<Sprite> self(this, [](Sprite *s) { s->Release(); });
+	TSTRING desc(descForErrors);
+
+	// submit the request
+	compositor->Compose(pixWidth, pixHeight, key, drawingFunc,
+		[self, seq, desc, pixWidth, pixHeight](const BITMAPINFO &bmi, const void *pixels, DWORD error)
+	{
+		// ignore the result if a newer request has been made since
+		if (self->asyncLoadSeq != seq)
+			return;
+
+		// load the image, or report the error if the compositor
+		// couldn't draw it
+		Application::InUiErrorHandler eh;
+		if (pixels != nullptr)
+		{
+			self->Load(bmi, pixels, eh, desc.c_str());
+		}
+		else
+		{
+			eh.SysError(
+				MsgFmt(IDS_ERR_IMGCREATE, desc.c_str()),
+				MsgFmt(_T("Sprite::LoadAsync, compositor couldn't create a %dx%d drawing surface, system error %ld"),
+					pixWidth, pixHeight, (long)error));
+		}
+	});
+}
+
+bool Sprite::Load(const Sprite *src)
+{
+	// we can't share a Flash object, or a sprite with nothing loaded
+	if (src->flashSite != nullptr || src->rv == nullptr)
+		return false;
+
+	// release any previous texture and Flash object
+	DetachFlash();
+	stagingTexture = 0;
+
+	// share the source's texture and mesh resources
+	texture = src->texture.Get();
+	rv = src->rv.Get();
+	vertexBuffer = src->vertexBuffer.Get();
+	indexBuffer = src->indexBuffer.Get();
+	loadSize = src->loadSize;
+
+	// success
+	return true;
+}
+
 bool Sprite::Load(HDC hdc, HBITMAP hbitmap, ErrorHandler &eh, const TCHAR *descForErrors)
 {
 	// get the size of the bitmap
@@ -342,6 +427,11 @@ bool Sprite::CreateMesh(POINTF sz, ErrorHandler &eh, const TCHAR *descForErrors)
 	return true;
 }
 
+bool Sprite::NeedsRender() const
+{
+	return IsFading() || (flashSite != nullptr && flashSite->NeedsRedraw());
+}
+
 void Sprite::Render(Camera *camera)
 {
 	// If we have a flash object, update its bitmap contents if necessary.
@@ -66,6 +66,31 @@ public:
 	bool Load(int pixWidth, int pixHeight, std::function<void(HDC, HBITMAP)> drawingFunc,
 		ErrorHandler &eh, const TCHAR *descForErrors);
 
+	// Load asynchronously by drawing into an off-screen HDC.  This works
+	// like the drawing callback version of Load(), but the drawing runs
+	// on a SpriteCompositor worker thread, and the texture is created
+	// when the finished pixels are delivered on the UI thread, normally
+	// within a frame or two.  Until then, the sprite keeps its current
+	// texture, if any, so a new sprite simply doesn't draw anything.
+	// The drawing function must follow the SpriteCompositor rules for
+	// worker thread callbacks: it can't reference UI thread data that
+	// could change while it's running, and it must create its own GDI+
+	// objects.  'key', if not null, identifies the image for coalescing
+	// identical requests; see SpriteCompositor::Compose().  A later call
+	// supersedes any earlier request that hasn't been delivered yet.
+	// Errors are reported through the in-UI error handler on delivery.
+	void LoadAsync(int pixWidth, int pixHeight, const TCHAR *key,
+		std::function<void(HDC, HBITMAP)> drawingFunc, const TCHAR *descForErrors);
+
+	// Load by sharing another sprite's texture and mesh.  This makes the
+	// new sprite a lightweight copy of the source, with its own position,
+	// scale, and alpha, but the same D3D resources, so the image doesn't
+	// have to be decoded again.  The media prefetcher uses this to hand
+	// out cached images.  Flash sprites can't be shared, since they're
+	// live objects with their own rasterization state; returns false if
+	// the source is a Flash sprite or isn't loaded.
+	bool Load(const Sprite *src);
+
 	// Render the sprite
 	virtual void Render(Camera *camera);
 
@@ -102,6 +127,18 @@ public:
 	// has the last fade completed?
 	bool IsFadeDone(bool reset = FALSE);
 
+	// Does the sprite need to be redrawn?  This returns true if the
+	// sprite's appearance has changed since it was last rendered, as
+	// happens during a fade or when a Flash object repaints.  The
+	// render scheduler uses this to decide which windows to redraw.
+	virtual bool NeedsRender() const;
+
+	// Is the sprite animating on its own?  This returns true if the
+	// sprite can change appearance at any time without any outside
+	// action, as with a Flash object or a playing video, so the render
+	// scheduler has to keep checking it with NeedsRender().
+	virtual bool IsAnimating() const { return flashSite != nullptr; }
+
 	// update our world transform for a change in offset, rotation, or scale
 	void UpdateWorld();
 
@@ -138,6 +175,11 @@ protected:
 	// the last fade has completed
 	bool fadeDone;
 
+	// Asynchronous load sequence number.  LoadAsync() increments this
+	// with each request, and only loads the delivered image if no newer
+	// request has been made in the meantime.
+	DWORD asyncLoadSeq;
+
 	// Vertex and index lists.  Our sprites are always rectangular, 
 	// so they consist of four vertices and two triangles.
 	CommonVertex vertex[4];
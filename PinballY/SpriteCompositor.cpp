@@ -0,0 +1,263 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Sprite compositor
+
+#include "stdafx.h"
+#include "SpriteCompositor.h"
+#include "GraphicsUtil.h"
+
+// statics
+SpriteCompositor *SpriteCompositor::inst = nullptr;
+
+void SpriteCompositor::Init()
+{
+	if (inst == nullptr)
+		inst = new SpriteCompositor();
+}
+
+void SpriteCompositor::Shutdown()
+{
+	delete inst;
+	inst = nullptr;
+}
+
+SpriteCompositor::SpriteCompositor() :
+	surfacePoolBytes(0),
+	exiting(false)
+{
+	// create the synchronization objects
+	hRequestSem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+	hResultsEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+	// start the workers
+	for (int i = 0; i < nWorkers; ++i)
+	{
+		DWORD tid;
+		hWorkers[i] = CreateThread(NULL, 0, &SWorkerMain, this, 0, &tid);
+	}
+}
+
+SpriteCompositor::~SpriteCompositor()
+{
+	// Tell the workers to exit, and wait for them.  The wait has to be
+	// open-ended, since the workers reference our queues and surface
+	// pool until they return.  A worker checks the exit flag before
+	// taking each request, so this only waits out a composite that's
+	// already in progress.
+	exiting = true;
+	ReleaseSemaphore(hRequestSem, nWorkers, NULL);
+	for (int i = 0; i < nWorkers; ++i)
+	{
+		if (hWorkers[i] != NULL)
+			WaitForSingleObject(hWorkers[i], INFINITE);
+	}
+
+	// return the surfaces from any undelivered images to the pool
+	for (auto &r : finished)
+		FreeSurface(r->surface);
+}
+
+SpriteCompositor::Surface::Surface(int width, int height) :
+	width(width), height(height), bits(nullptr), error(ERROR_SUCCESS)
+{
+	// set up the bitmap descriptor for a top-down 32bpp DIB
+	ZeroMemory(&bmi, sizeof(bmi));
+	bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+	bmi.bmiHeader.biWidth = width;
+	bmi.bmiHeader.biHeight = -height;
+	bmi.bmiHeader.biPlanes = 1;
+	bmi.bmiHeader.biBitCount = 32;
+	bmi.bmiHeader.biCompression = BI_RGB;
+
+	// create the DIB section
+	ScreenDC screenDC;
+	hbmp = CreateDIBSection(screenDC, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+	if (hbmp == NULL)
+		error = GetLastError();
+}
+
+SpriteCompositor::Surface::~Surface()
+{
+	if (hbmp != NULL)
+		DeleteObject(hbmp);
+}
+
+SpriteCompositor::Surface *SpriteCompositor::AllocSurface(int width, int height, DWORD &error)
+{
+	// look for a pooled surface of the same size
+	{
+		CriticalSectionLocker locker(lock);
+		for (auto it = surfacePool.begin(); it != surfacePool.end(); ++it)
+		{
+			if ((*it)->width == width && (*it)->height == height)
+			{
+				Surface *s = it->release();
+				surfacePool.erase(it);
+				surfacePoolBytes -= (size_t)width * height * 4;
+				return s;
+			}
+		}
+	}
+
+	// there's nothing suitable in the pool, so create a new one
+	std::unique_ptr<Surface> s(new Surface(width, height));
+	if (s->hbmp == NULL)
+	{
+		error = s->error;
+		return nullptr;
+	}
+	return s.release();
+}
+
+void SpriteCompositor::FreeSurface(Surface *surface)
+{
+	if (surface == nullptr)
+		return;
+
+	CriticalSectionLocker locker(lock);
+
+	// add it at the front of the pool
+	surfacePool.emplace_front(surface);
+	surfacePoolBytes += (size_t)surface->width * surface->height * 4;
+
+	// trim the oldest surfaces if we're over the limit
+	while (surfacePoolBytes > maxSurfacePoolBytes && surfacePool.size() > 1)
+	{
+		auto &s = surfacePool.back();
+		surfacePoolBytes -= (size_t)s->width * s->height * 4;
+		surfacePool.pop_back();
+	}
+}
+
+TSTRING SpriteCompositor::MakeCoalesceKey(const TCHAR *key, int width, int height)
+{
+	return MsgFmt(_T("%dx%d:%s"), width, height, key).Get();
+}
+
+void SpriteCompositor::Compose(int width, int height, const TCHAR *key, DrawingFunc draw, DoneFunc done)
+{
+	CriticalSectionLocker locker(lock);
+
+	// if there's an identical request in flight, add our callback to it
+	TSTRING ckey;
+	if (key != nullptr)
+	{
+		ckey = MakeCoalesceKey(key, width, height);
+		if (auto it = inFlight.find(ckey); it != inFlight.end())
+		{
+			it->second->done.emplace_back(done);
+			return;
+		}
+	}
+
+	// set up the new request
+	auto r = std::make_shared<Request>();
+	r->width = width;
+	r->height = height;
+	r->key = ckey;
+	r->draw = draw;
+	r->done.emplace_back(done);
+	r->surface = nullptr;
+	r->error = ERROR_SUCCESS;
+
+	// queue it, and wake a worker
+	pending.emplace_back(r);
+	if (ckey.length() != 0)
+		inFlight.emplace(ckey, r);
+	ReleaseSemaphore(hRequestSem, 1, NULL);
+}
+
+DWORD SpriteCompositor::WorkerMain()
+{
+	// set up a memory DC for the drawing
+	MemoryDC memdc;
+
+	for (;;)
+	{
+		// wait for a request
+		WaitForSingleObject(hRequestSem, INFINITE);
+		if (exiting)
+			break;
+
+		// take the next request off the queue
+		std::shared_ptr<Request> r;
+		{
+			CriticalSectionLocker locker(lock);
+			if (pending.size() == 0)
+				continue;
+			r = pending.front();
+			pending.pop_front();
+		}
+
+		// Get a surface, and clear it, since a pooled surface will still
+		// contain its last image.  If we can't get a surface, the request
+		// still goes on the finished list, so that DeliverResults() can
+		// report the error to the completion callbacks.
+		if ((r->surface = AllocSurface(r->width, r->height, r->error)) != nullptr)
+		{
+			memset(r->surface->bits, 0, (size_t)r->width * r->height * 4);
+
+			// draw into it
+			HGDIOBJ oldbmp = SelectObject(memdc, r->surface->hbmp);
+			r->draw(memdc, r->surface->hbmp);
+			GdiFlush();
+			SelectObject(memdc, oldbmp);
+		}
+
+		// Move it to the finished list.  Once it's out of the in-flight
+		// table, new requests with the same key will draw a new image,
+		// since the caller could have changed something that affects it
+		// after we started.
+		{
+			CriticalSectionLocker locker(lock);
+			if (r->key.length() != 0)
+			{
+				if (auto it = inFlight.find(r->key); it != inFlight.end() && it->second == r)
+					inFlight.erase(it);
+			}
+			finished.emplace_back(r);
+		}
+
+		// let the UI thread know there are results waiting
+		SetEvent(hResultsEvent);
+	}
+
+	// done
+	return 0;
+}
+
+bool SpriteCompositor::DeliverResults()
+{
+	// take the finished list
+	std::list<std::shared_ptr<Request>> results;
+	{
+		CriticalSectionLocker locker(lock);
+		results.swap(finished);
+	}
+
+	// invoke the completion callbacks for each result
+	for (auto &r : results)
+	{
+		if (r->surface != nullptr)
+		{
+			for (auto &done : r->done)
+				done(r->surface->bmi, r->surface->bits, ERROR_SUCCESS);
+		}
+		else
+		{
+			// we couldn't create the surface - report the error
+			BITMAPINFO bmi;
+			ZeroMemory(&bmi, sizeof(bmi));
+			for (auto &done : r->done)
+				done(bmi, nullptr, r->error);
+		}
+
+		// return the surface to the pool
+		FreeSurface(r->surface);
+		r->surface = nullptr;
+	}
+
+	// tell the caller whether we delivered anything
+	return results.size() != 0;
+}
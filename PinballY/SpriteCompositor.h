@@ -0,0 +1,170 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Sprite compositor
+//
+// This runs GDI/GDI+ drawing callbacks for dynamically generated
+// sprite graphics (menus, popups, and the like) on a small pool of
+// worker threads, so that the UI thread doesn't stall while GDI+
+// renders a large block of text.  It's the asynchronous counterpart
+// of DrawOffScreen(): the caller provides the image size and a
+// drawing callback, and gets the finished pixels back through a
+// completion callback.
+//
+// The completion callbacks run on the UI thread, from the main
+// message loop's render pass, so a typical completion callback
+// simply loads the pixels into a sprite's D3D texture.  This keeps
+// all of the D3D work other than resource creation on the UI thread,
+// per the rules in D3D.h.  Sprite::LoadAsync() packages this up for
+// the common case.
+//
+// Drawing surfaces are DIB sections, which we keep in a pool and
+// re-use for later requests of the same size, so re-showing a menu
+// doesn't allocate a new bitmap each time.  Identical requests are
+// coalesced: if a request arrives with the same key and size as one
+// that's still pending or running, we simply add its completion
+// callback to the existing request rather than drawing the image
+// again.
+//
+// Drawing callbacks run on a worker thread, so they must not touch
+// any UI thread data that could change while they're running.  The
+// easiest way to accomplish this is to capture copies of everything
+// the callback needs to draw.  GDI+ objects can't be shared across
+// threads, so the callback should create its own fonts, brushes, etc.
+//
+
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <functional>
+
+class SpriteCompositor
+{
+public:
+	// create/destroy the global singleton
+	static void Init();
+	static void Shutdown();
+
+	// get the global singleton
+	static SpriteCompositor *Get() { return inst; }
+
+	// Drawing callback.  This runs on a worker thread.  The DIB is
+	// cleared to all zeroes (transparent black) before the call.
+	typedef std::function<void(HDC, HBITMAP)> DrawingFunc;
+
+	// Completion callback.  This runs on the UI thread, from
+	// DeliverResults().  The pixels are only valid for the duration
+	// of the callback, since the DIB goes back into the pool
+	// afterwards.  If we couldn't create the drawing surface, the
+	// callback is still invoked, with 'pixels' set to null and
+	// 'error' set to the system error code, so that the caller can
+	// report the failure.
+	typedef std::function<void(const BITMAPINFO &bmi, const void *pixels, DWORD error)> DoneFunc;
+
+	// Submit a drawing request.  If 'key' is non-null, the request can
+	// be coalesced with another pending request with the same key and
+	// size, so the key must uniquely identify the rendered image.  Pass
+	// null for requests that can't be identified this way.
+	void Compose(int width, int height, const TCHAR *key, DrawingFunc draw, DoneFunc done);
+
+	// Deliver finished images to their completion callbacks.  The main
+	// message loop calls this on each render pass.  Returns true if any
+	// images were delivered, in which case the windows should be redrawn.
+	bool DeliverResults();
+
+	// Get the results event.  This is signaled when finished images
+	// are ready for delivery, so the message loop can wake up to
+	// deliver them rather than waiting for the next render pass.
+	HANDLE GetResultsEvent() const { return hResultsEvent; }
+
+protected:
+	SpriteCompositor();
+	~SpriteCompositor();
+
+	// Drawing surface.  This is a DIB section that we keep in the pool
+	// for re-use.
+	struct Surface
+	{
+		Surface(int width, int height);
+		~Surface();
+
+		int width;
+		int height;
+		HBITMAP hbmp;
+		void *bits;
+		BITMAPINFO bmi;
+
+		// system error code, if we couldn't create the DIB section
+		DWORD error;
+	};
+
+	// Get a surface of the given size from the pool, or create a new
+	// one if there are no matching surfaces available.  Returns null,
+	// with the system error code in 'error', if we can't create the
+	// surface.
+	Surface *AllocSurface(int width, int height, DWORD &error);
+
+	// Return a surface to the pool.  If the pool is over its size
+	// limit, this deletes the oldest surfaces to make room.
+	void FreeSurface(Surface *surface);
+
+	// pooled surfaces, most recently freed first
+	std::list<std::unique_ptr<Surface>> surfacePool;
+
+	// total size of the pooled surfaces in bytes, and the limit
+	size_t surfacePoolBytes;
+	static const size_t maxSurfacePoolBytes = 64 * 1024 * 1024;
+
+	// Request.  These are shared between the lists below, and are only
+	// ever deleted on the UI thread, since the completion callbacks
+	// can hold references to UI objects.
+	struct Request
+	{
+		int width;
+		int height;
+		TSTRING key;
+		DrawingFunc draw;
+		std::list<DoneFunc> done;
+
+		// surface with the finished image
+		Surface *surface;
+
+		// system error code, if we couldn't allocate the surface
+		DWORD error;
+	};
+
+	// Build the coalescing key for a request.  This combines the
+	// caller's key with the size.
+	static TSTRING MakeCoalesceKey(const TCHAR *key, int width, int height);
+
+	// Requests waiting for a worker, in submission order
+	std::list<std::shared_ptr<Request>> pending;
+
+	// requests pending or running that can be coalesced, by key
+	std::unordered_map<TSTRING, std::shared_ptr<Request>> inFlight;
+
+	// finished requests, waiting for delivery
+	std::list<std::shared_ptr<Request>> finished;
+
+	// lock for the surface pool and request lists
+	CriticalSection lock;
+
+	// worker threads
+	static DWORD WINAPI SWorkerMain(LPVOID lParam) { return static_cast<SpriteCompositor*>(lParam)->WorkerMain(); }
+	DWORD WorkerMain();
+	static const int nWorkers = 2;
+	HandleHolder hWorkers[nWorkers];
+
+	// Request semaphore.  We release one count per request, so that
+	// each request wakes one worker.
+	HandleHolder hRequestSem;
+
+	// results event
+	HandleHolder hResultsEvent;
+
+	// shutdown flag
+	volatile bool exiting;
+
+	// global singleton
+	static SpriteCompositor *inst;
+};
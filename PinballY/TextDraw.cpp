@@ -23,6 +23,7 @@ using namespace DirectX;
 TextDraw::TextDraw()
 {
 	shader = 0;
+	vertexBufferQuads = 0;
 }
 
 TextDraw::~TextDraw()
@@ -50,19 +51,123 @@ bool TextDraw::Init()
 	return true;
 }
 
+bool TextDraw::ReserveBuffers(size_t nQuads)
+{
+	D3D *d3d = D3D::Get();
+
+	// create the index buffer on first use
+	if (indexBuffer == nullptr)
+	{
+		// build the two-triangle index pattern for each quad
+		std::vector<WORD> indices;
+		indices.reserve(maxBatchQuads * 6);
+		for (size_t i = 0; i < maxBatchQuads; ++i)
+		{
+			WORD nv = (WORD)(i * 4);
+			indices.push_back(nv + 0);
+			indices.push_back(nv + 1);
+			indices.push_back(nv + 2);
+			indices.push_back(nv + 2);
+			indices.push_back(nv + 3);
+			indices.push_back(nv + 0);
+		}
+
+		// create the buffer
+		D3D11_BUFFER_DESC bd;
+		ZeroMemory(&bd, sizeof(bd));
+		bd.Usage = D3D11_USAGE_IMMUTABLE;
+		bd.ByteWidth = (UINT)(sizeof(WORD) * indices.size());
+		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+		D3D11_SUBRESOURCE_DATA sd;
+		ZeroMemory(&sd, sizeof(sd));
+		sd.pSysMem = indices.data();
+		if (FAILED(d3d->CreateBuffer(&bd, &sd, &indexBuffer, "TextDraw::indexBuffer")))
+			return false;
+	}
+
+	// grow the vertex buffer if necessary
+	if (vertexBuffer == nullptr || nQuads > vertexBufferQuads)
+	{
+		// Round up to a multiple of 1024 quads, so that a gradually
+		// growing text display doesn't re-create the buffer every time.
+		size_t newQuads = (nQuads + 1023) & ~(size_t)1023;
+
+		// create the new buffer
+		vertexBuffer = nullptr;
+		vertexBufferQuads = 0;
+		D3D11_BUFFER_DESC bd;
+		ZeroMemory(&bd, sizeof(bd));
+		bd.Usage = D3D11_USAGE_DYNAMIC;
+		bd.ByteWidth = (UINT)(sizeof(TextVertexType) * 4 * newQuads);
+		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		if (FAILED(d3d->CreateBuffer(&bd, &vertexBuffer, "TextDraw::vertexBuffer")))
+			return false;
+
+		vertexBufferQuads = newQuads;
+	}
+
+	// success
+	return true;
+}
+
 void TextDraw::Render(Camera *camera)
 {
 	D3D *d3d = D3D::Get();
 
+	// gather the vertices for all of the items into the batch
+	batch.Clear();
+	for (auto item : items)
+		item->AddToBatch(batch);
+
+	// if there's nothing to draw, we're done
+	size_t nQuads = batch.GetQuadCount();
+	if (nQuads == 0 || !ReserveBuffers(nQuads))
+		return;
+
+	// upload the batch
+	{
+		D3D::DeviceContextLocker ctx;
+		D3D11_MAPPED_SUBRESOURCE msr;
+		if (FAILED(ctx->Map(vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &msr)))
+			return;
+		auto &vertices = batch.GetVertices();
+		memcpy(msr.pData, vertices.data(), vertices.size() * sizeof(TextVertexType));
+		ctx->Unmap(vertexBuffer, 0);
+	}
+
 	// turn off the depth stencil
 	d3d->SetUseDepthStencil(false);
 
-	// set up rendering the shader
+	// Set up rendering the shader.  The item positions and colors are
+	// built into the vertices, so use an identity world transform and
+	// a white base color.
 	shader->PrepareForRendering(camera);
+	shader->SetColor(XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f));
+	d3d->UpdateWorldTransform(XMMatrixIdentity());
 
-	// draw each item in the list
-	for (auto it = items.begin(); it != items.end(); ++it)
-		(*it)->Render(shader);
+	// load the batch buffers
+	d3d->SetTriangleTopology();
+	d3d->IASetVertexBuffer(vertexBuffer, sizeof(TextVertexType));
+	d3d->IASetIndexBuffer(indexBuffer);
+
+	// Draw the batch.  Consecutive items that share a font texture are
+	// drawn with a single call, in chunks that fit the 16-bit index range.
+	batch.PlanDrawCalls(maxBatchQuads, drawCalls);
+	ID3D11ShaderResourceView *curSrv = nullptr;
+	for (auto &call : drawCalls)
+	{
+		// set the font texture, if it changed
+		auto srv = static_cast<ID3D11ShaderResourceView*>(const_cast<void*>(call.texture));
+		if (srv != curSrv)
+		{
+			d3d->PSSetShaderResources(0, 1, &srv);
+			curSrv = srv;
+		}
+
+		// draw the quads
+		d3d->DrawIndexed((INT)(call.nQuads * 6), 0, (INT)(call.firstQuad * 4));
+	}
 }
 
 void TextDraw::Clear()
@@ -122,16 +227,11 @@ TextDrawItem::TextDrawItem()
 	refCnt = 1;
 
 	// clear pointers
-	vertexBuffer = 0;
-	indexBuffer = 0;
-	indexCount = 0;
 	shaderResourceView = 0;
 }
 
 TextDrawItem::~TextDrawItem()
 {
-	if (vertexBuffer != 0) vertexBuffer->Release();
-	if (indexBuffer != 0) indexBuffer->Release();
 	if (shaderResourceView != 0)
 		shaderResourceView->Release();
 }
@@ -147,64 +247,21 @@ HRESULT TextDrawItem::Load(
 	this->rotation = rotation;
 	this->color = color;
 
-	// update the world matrix
-	RecalcWorld();
-
 	// remember the new font texture
 	ID3D11ShaderResourceView *oldsrv = shaderResourceView;
 	shaderResourceView = font->GetShaderResourceView();
-
-	// release old resources
-	if (indexBuffer != 0)
-	{
-		indexBuffer->Release();
-		indexBuffer = 0;
-	}
-	if (vertexBuffer != 0)
-	{
-		vertexBuffer->Release();
-		vertexBuffer = 0;
-	}
 	if (oldsrv != 0)
 		oldsrv->Release();
 
-	// load the buffer via the font
-	return font->CreateBuffers(text, &vertexBuffer, &indexBuffer, &indexCount);
-}
-
-void TextDrawItem::Render(TextShader *shader)
-{
-	// set the font texture
-	D3D *d3d = D3D::Get();
-	d3d->PSSetShaderResources(0, 1, &shaderResourceView);
-
-	// set our color in the shader
-	shader->SetColor(color);
-
-	// load our world transform for the vertex shader
-	d3d->UpdateWorldTransform(world);
-
-	// load our vertex and index buffers
-	d3d->SetTriangleTopology();
-	d3d->IASetVertexBuffer(vertexBuffer, sizeof(TextVertexType));
-	d3d->IASetIndexBuffer(indexBuffer);
-
-	// draw
-	d3d->DrawIndexed((INT)indexCount);
+	// get the layout from the font
+	layout = font->GetLayout(text);
+	return layout != nullptr ? S_OK : E_FAIL;
 }
 
-void TextDrawItem::RecalcWorld()
+void TextDrawItem::AddToBatch(TextBatch &batch) const
 {
-	// Figure our world translation matrix for our current rotation and
-	// position.  Note that the position is set in a window-like coordinate
-	// system where +X is right and +Y is down.  The D3D Y axis is the other
-	// way around, so we need to use the negative Y value.  The camera view
-	// automatically places the coordinate system origin at top left, so we
-	// don't need to worry about the view size or orientation here.
-	world = XMMatrixIdentity();
-	world = XMMatrixMultiply(world, XMMatrixRotationZ(rotation));
-	world = XMMatrixMultiply(world, XMMatrixTranslation(pos.x, -pos.y, 0));
-	world = XMMatrixTranspose(world);
+	if (layout != nullptr)
+		batch.Add(*layout, pos.x, pos.y, rotation, color, shaderResourceView);
 }
 
 
@@ -215,15 +272,11 @@ void TextDrawItem::RecalcWorld()
 
 TextDrawFont::TextDrawFont()
 {
-	defaultGlyph = 0;
-	nGlyphs = 0;
-	glyphs = 0;
 	shaderResourceView = 0;
 }
 
 TextDrawFont::~TextDrawFont()
 {
-	if (glyphs != 0) delete[] glyphs;
 	if (shaderResourceView != 0) shaderResourceView->Release();
 }
 
@@ -236,15 +289,6 @@ bool TextDrawFont::Load(const TCHAR *filename, ErrorHandler &handler)
 	if (!r.Load(filename, handler))
 		return false;
 
-	// delete old resources if present
-	if (glyphs != 0)
-	{
-		delete[] glyphs;
-		glyphs = 0;
-	}
-	defaultGlyph = 0;
-	glyphMap.clear();
-
 	// check the signature
 	static const char sig[] = "DXTKfont";
 	char filesig[8];
@@ -260,12 +304,14 @@ bool TextDrawFont::Load(const TCHAR *filename, ErrorHandler &handler)
     };
         
 	// read the glyph data
+	uint32_t nGlyphs;
 	if (!r.Read(nGlyphs))
 		return EofErr();
 
 	uint32_t defaultChar;
-	glyphs = new Glyph[nGlyphs];
-	if (!r.Read(glyphs, nGlyphs)
+	float lineSpacing;
+	std::vector<TextFontMetrics::Glyph> glyphs(nGlyphs);
+	if (!r.Read(glyphs.data(), nGlyphs)
 		|| !r.Read(lineSpacing)
         || !r.Read(defaultChar))
         return EofErr();
@@ -293,9 +339,6 @@ bool TextDrawFont::Load(const TCHAR *filename, ErrorHandler &handler)
         || !r.Read(texture.nRows))
         return EofErr();
 
-	// remember the texture size
-	textureSize = { texture.width, texture.height };
-
 	// read the texture data
 	texture.data = new UINT8[texture.stride * texture.nRows];
     if (!r.Read(texture.data, texture.stride * texture.nRows))
@@ -316,166 +359,9 @@ bool TextDrawFont::Load(const TCHAR *filename, ErrorHandler &handler)
 		return false;
 	}
 
-	// build the glyph hash
-	for (uint32_t i = 0; i < nGlyphs; ++i)
-		glyphMap.emplace(std::make_pair(glyphs[i].charCode, &glyphs[i]));
-
-	// look up the default character
-	auto it = glyphMap.find(defaultChar);
-	if (it != glyphMap.end())
-		defaultGlyph = it->second;
+	// set up the metrics
+	metrics.Init(std::move(glyphs), defaultChar, lineSpacing, texture.width, texture.height);
 
 	// success
 	return true;
 }
-
-HRESULT TextDrawFont::CreateBuffers(
-	const TCHAR *text,
-	ID3D11Buffer **vertexBuffer, ID3D11Buffer **indexBuffer, size_t *indexCount)
-{
-	D3D *d3d = D3D::Get();
-	HRESULT hr;
-
-	// start with empty vertex and index lists
-	std::vector<TextVertexType> vertices;
-	std::vector<WORD> indices;
-
-	// start at the top left corner
-	float x = 0, y = 0;
-
-	// no vertices in the list yet
-	int nv = 0;
-
-	// add each character
-	for (const TCHAR *p = text; *p != 0; ++p)
-	{
-		// handle newlines specially
-		if (*p == '\n')
-		{
-			x = 0;
-			y -= lineSpacing;
-			continue;
-		}
-
-		// skip carriage returns
-		if (*p == '\r')
-			continue;
-
-		// look up the glyph
-		auto it = glyphMap.find(*p);
-		Glyph *g = it != glyphMap.end() ? it->second : defaultGlyph;
-
-		// we must have a glyph to proceed
-		if (g == 0)
-			return E_FAIL;
-
-		// advance by the offset to get the start position for the character cell
-		x += g->xOffset;
-
-		// figure the advance distance for the character
-		float advance = g->subrect.right - g->subrect.left + g->xAdvance;
-
-		// build the graphics box for the character unless it's whitespace
-		if (!_istspace(*p))
-		{
-			// figure the character cell bounding box
-			float left = x;
-			float top = y - g->yOffset;
-			float right = left + g->subrect.right - g->subrect.left;
-			float bottom = top - (g->subrect.bottom - g->subrect.top);
-
-			// figure the texture coordinates
-			float u0 = float(g->subrect.left) / textureSize.width;
-			float u1 = float(g->subrect.right) / textureSize.width;
-			float v0 = float(g->subrect.top) / textureSize.height;
-			float v1 = float(g->subrect.bottom) / textureSize.height;
-
-			// create the box's vertex list
-			vertices.push_back({ XMFLOAT4(left, top, 0, 0), XMFLOAT2(u0, v0) });
-			vertices.push_back({ XMFLOAT4(right, top, 0, 0), XMFLOAT2(u1, v0) });
-			vertices.push_back({ XMFLOAT4(right, bottom, 0, 0), XMFLOAT2(u1, v1) });
-			vertices.push_back({ XMFLOAT4(left, bottom, 0, 0), XMFLOAT2(u0, v1) });
-
-			// create the index list
-			indices.push_back(nv + 0);
-			indices.push_back(nv + 1);
-			indices.push_back(nv + 2);
-			indices.push_back(nv + 2);
-			indices.push_back(nv + 3);
-			indices.push_back(nv + 0);
-
-			// advance the vertex counter
-			nv += 4;
-		}
-
-		// advance by the character width
-		x += advance;
-	}
-
-	// set up the vertex buffer descriptor
-	D3D11_BUFFER_DESC bd;
-	ZeroMemory(&bd, sizeof(bd));
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = (UINT)(sizeof(TextVertexType)*vertices.size());
-	bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
-	// set up the subresource descriptor
-	D3D11_SUBRESOURCE_DATA sd;
-	ZeroMemory(&sd, sizeof(sd));
-	sd.pSysMem = vertices.data();
-
-	// create the vertex buffer
-	if (FAILED(hr = d3d->CreateBuffer(&bd, &sd, vertexBuffer, "TextDraw::vertexBuffer")))
-		return hr;
-
-	// set up the index buffer descriptor
-	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = (UINT)(sizeof(WORD) * indices.size());
-	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	bd.CPUAccessFlags = 0;
-	sd.pSysMem = indices.data();
-	if (FAILED(hr = d3d->CreateBuffer(&bd, &sd, indexBuffer, "TextDraw::indexBuffer")))
-		return hr;
-
-	// remember the index count
-	*indexCount = indices.size();
-
-	// success
-	return S_OK;
-}
-
-POINTF TextDrawFont::MeasureText(const TCHAR *text) const
-{
-	// start at the top left corner
-	float x = 0, y = 0;
-
-	// iterate over the characters
-	for (const TCHAR *p = text; *p != 0; ++p)
-	{
-		// handle newlines specially
-		if (*p == '\n')
-		{
-			x = 0;
-			y -= lineSpacing;
-			continue;
-		}
-
-		// skip carriage returns
-		if (*p == '\r')
-			continue;
-
-		// look up the glyph
-		auto it = glyphMap.find(*p);
-		Glyph *g = it != glyphMap.end() ? it->second : defaultGlyph;
-
-		// skip missing characters
-		if (g == 0)
-			continue;
-
-		// figure the advance width
-		x += g->xOffset + (g->subrect.right - g->subrect.left) + g->xAdvance;
-	}
-
-	// return the result
-	return { x, y };
-}
@@ -12,6 +12,7 @@
 
 #include "stdafx.h"
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <d3d11_1.h>
 #include <DirectXMath.h>
@@ -19,13 +20,7 @@
 #include "Shader.h"
 #include "d3d.h"
 #include "TextShader.h"
-
-// text object vertex type
-struct TextVertexType
-{
-	DirectX::XMFLOAT4 position;
-	DirectX::XMFLOAT2 texCoord;
-};
+#include "TextLayout.h"
 
 // Font object - loads a DirectXTK formatted font file
 class TextDrawFont
@@ -45,51 +40,30 @@ public:
 		return shaderResourceView;
 	}
 
-	// Create a drawing list for a string
-	HRESULT CreateBuffers(
-		const TCHAR *text,
-		ID3D11Buffer **vertexBuffer, ID3D11Buffer **indexBuffer, size_t *indexCount);
+	// Get the layout for a string, using the layout cache.  Returns
+	// null if the string contains a character we can't draw.
+	std::shared_ptr<const TextLayout> GetLayout(const TCHAR *text) { return metrics.GetLayout(text); }
 
 	// get the line height
-	float GetLineHeight() const { return lineSpacing; }
+	float GetLineHeight() const { return metrics.GetLineHeight(); }
 
 	// measure text
-	POINTF MeasureText(const TCHAR *text) const;
+	POINTF MeasureText(const TCHAR *text) const { return metrics.MeasureText(text); }
 
 protected:
-	// Glyph descriptor.  This matches the byte layout of the objects
-	// in a font file created by MakeSpriteFont in the DirectXTK library.
-	struct Glyph
-	{
-		uint32_t charCode;
-		RECT subrect;
-		float xOffset;
-		float yOffset;
-		float xAdvance;
-	};
-
-	// texture dimensions
-	struct { uint32_t width, height;	} textureSize;
-
-	// glyph data
-	uint32_t nGlyphs;
-	Glyph *glyphs;
-
-	// glyph hash
-	std::unordered_map<uint32_t, Glyph *> glyphMap;
-
-	// default character
-	Glyph *defaultGlyph;
-
-	// line height
-	float lineSpacing;
+	// Font metrics.  This handles the glyph lookup and text layout,
+	// which only depend on the font file data, not on D3D.
+	TextFontMetrics metrics;
 
 	// shader resource view
 	ID3D11ShaderResourceView *shaderResourceView;
 };
 
-// Text item.  This is a D3D triangle list for a string of text.
-class TextDrawItem : public Align16
+// Text item.  This is a string of text laid out in a given font,
+// with its position, rotation, and color.  Items don't have their
+// own D3D buffers; TextDraw renders all of its items together from
+// a single shared vertex buffer.
+class TextDrawItem
 {
 public:
 	TextDrawItem();
@@ -109,14 +83,12 @@ public:
 	{
 		pos.x = x;
 		pos.y = y;
-		RecalcWorld();
 	}
 
 	// set the rotation
 	void SetRotation(float r)
 	{
 		rotation = r;
-		RecalcWorld();
 	}
 
 	// set the color
@@ -125,7 +97,9 @@ public:
 		this->color = color;
 	}
 
-	void Render(TextShader *shader);
+	// Add the item to a batch, at its current position, rotation,
+	// and color
+	void AddToBatch(TextBatch &batch) const;
 
 protected:
 	// reference count
@@ -144,21 +118,11 @@ protected:
 	// reference counting
 	~TextDrawItem();
 
-	// recalculate the world matrix for a change in position or rotation
-	void RecalcWorld();
-
-	// vertex buffer
-	ID3D11Buffer *vertexBuffer;
-
-	// index buffer
-	ID3D11Buffer *indexBuffer;
-	size_t indexCount;
+	// text layout, shared with the font's layout cache
+	std::shared_ptr<const TextLayout> layout;
 
 	// font texture
 	ID3D11ShaderResourceView *shaderResourceView;
-
-	// world transform matrix
-	DirectX::XMMATRIX world;
 };
 
 // TextDraw - create an instance of this to manage a collection of
@@ -198,6 +162,29 @@ protected:
 	// Shader
 	TextShader *shader;
 
+	// Make sure the batch buffers can hold the given number of quads
+	bool ReserveBuffers(size_t nQuads);
+
+	// Batch vertex buffer.  This is a dynamic buffer that we refill on
+	// each Render() with the vertices for all of the items, so that a
+	// frame's text takes one buffer upload rather than a buffer per
+	// string.  It's grown as needed, and never shrinks.
+	RefPtr<ID3D11Buffer> vertexBuffer;
+	size_t vertexBufferQuads;
+
+	// Index buffer.  This holds the fixed two-triangle index pattern for
+	// maxBatchQuads quads, which is the most that 16-bit indices can
+	// address.  Larger batches are drawn in chunks using a base vertex.
+	RefPtr<ID3D11Buffer> indexBuffer;
+	static const size_t maxBatchQuads = 65536 / 4;
+
+	// Text batch.  This collects the vertices for all of the items on
+	// each Render(); it's kept between frames to avoid re-allocating.
+	TextBatch batch;
+
+	// draw call list for the batch, also kept between frames
+	std::vector<TextBatch::DrawCall> drawCalls;
+
 	// font cache
 	std::unordered_map<TSTRING, TextDrawFont *> fontCache;
 
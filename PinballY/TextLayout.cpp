@@ -0,0 +1,234 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Text layout and batching
+
+#include "stdafx.h"
+#include <DirectXMath.h>
+#include "TextLayout.h"
+
+using namespace DirectX;
+
+// -------------------------------------------------------------------------
+//
+// Font metrics
+//
+
+TextFontMetrics::TextFontMetrics()
+{
+	defaultGlyph = nullptr;
+	for (auto &g : latinGlyphs)
+		g = nullptr;
+	lineSpacing = 0;
+	textureWidth = textureHeight = 1;
+}
+
+void TextFontMetrics::Init(std::vector<Glyph> &&glyphs, uint32_t defaultChar, float lineSpacing,
+	uint32_t textureWidth, uint32_t textureHeight)
+{
+	// take over the glyph list, and remember the font parameters
+	this->glyphs = std::move(glyphs);
+	this->lineSpacing = lineSpacing;
+	this->textureWidth = textureWidth;
+	this->textureHeight = textureHeight;
+
+	// any cached layouts are for the old glyphs
+	layoutCache.clear();
+
+	// build the glyph hash
+	glyphMap.clear();
+	for (auto &g : this->glyphs)
+		glyphMap.emplace(g.charCode, &g);
+
+	// look up the default character
+	auto it = glyphMap.find(defaultChar);
+	defaultGlyph = it != glyphMap.end() ? it->second : nullptr;
+
+	// build the Latin-1 table, using the default glyph for any gaps
+	for (uint32_t c = 0; c < countof(latinGlyphs); ++c)
+	{
+		auto cit = glyphMap.find(c);
+		latinGlyphs[c] = cit != glyphMap.end() ? cit->second : defaultGlyph;
+	}
+}
+
+std::shared_ptr<const TextLayout> TextFontMetrics::GetLayout(const TCHAR *text)
+{
+	// check the cache
+	if (auto it = layoutCache.find(text); it != layoutCache.end())
+		return it->second;
+
+	// not cached - lay it out
+	auto layout = std::make_shared<TextLayout>();
+	if (!LayoutText(text, *layout))
+		return nullptr;
+
+	// if the cache is full, start over
+	if (layoutCache.size() >= layoutCacheCapacity)
+		layoutCache.clear();
+
+	// add it to the cache
+	layoutCache.emplace(text, layout);
+	return layout;
+}
+
+bool TextFontMetrics::LayoutText(const TCHAR *text, TextLayout &layout) const
+{
+	// start with an empty layout
+	layout.clear();
+
+	// start at the top left corner
+	float x = 0, y = 0;
+
+	// add each character
+	for (const TCHAR *p = text; *p != 0; ++p)
+	{
+		// handle newlines specially
+		if (*p == '\n')
+		{
+			x = 0;
+			y -= lineSpacing;
+			continue;
+		}
+
+		// skip carriage returns
+		if (*p == '\r')
+			continue;
+
+		// look up the glyph; we must have a glyph to proceed
+		const Glyph *g = FindGlyph(*p);
+		if (g == 0)
+			return false;
+
+		// advance by the offset to get the start position for the character cell
+		x += g->xOffset;
+
+		// figure the advance distance for the character
+		float advance = g->subrect.right - g->subrect.left + g->xAdvance;
+
+		// build the graphics box for the character unless it's whitespace
+		if (!_istspace(*p))
+		{
+			// figure the character cell bounding box
+			float left = x;
+			float top = y - g->yOffset;
+			float right = left + g->subrect.right - g->subrect.left;
+			float bottom = top - (g->subrect.bottom - g->subrect.top);
+
+			// add the quad, with its texture coordinates
+			layout.push_back({
+				left, top, right, bottom,
+				float(g->subrect.left) / textureWidth,
+				float(g->subrect.top) / textureHeight,
+				float(g->subrect.right) / textureWidth,
+				float(g->subrect.bottom) / textureHeight });
+		}
+
+		// advance by the character width
+		x += advance;
+	}
+
+	// success
+	return true;
+}
+
+POINTF TextFontMetrics::MeasureText(const TCHAR *text) const
+{
+	// start at the top left corner
+	float x = 0, y = 0;
+
+	// iterate over the characters
+	for (const TCHAR *p = text; *p != 0; ++p)
+	{
+		// handle newlines specially
+		if (*p == '\n')
+		{
+			x = 0;
+			y -= lineSpacing;
+			continue;
+		}
+
+		// skip carriage returns
+		if (*p == '\r')
+			continue;
+
+		// look up the glyph
+		const Glyph *g = FindGlyph(*p);
+
+		// skip missing characters
+		if (g == 0)
+			continue;
+
+		// figure the advance width
+		x += g->xOffset + (g->subrect.right - g->subrect.left) + g->xAdvance;
+	}
+
+	// return the result
+	return { x, y };
+}
+
+// -------------------------------------------------------------------------
+//
+// Text batch
+//
+
+void TextBatch::Clear()
+{
+	vertices.clear();
+	runs.clear();
+}
+
+void TextBatch::Add(const TextLayout &layout, float x, float y, float rotation,
+	const XMFLOAT4 &color, const void *texture)
+{
+	// skip empty layouts
+	if (layout.size() == 0)
+		return;
+
+	// extend the current texture run, or start a new one
+	if (runs.size() != 0 && runs.back().texture == texture)
+		runs.back().nQuads += layout.size();
+	else
+		runs.push_back({ texture, layout.size() });
+
+	// Transform each corner by the rotation and position.  Note that the
+	// position is set in a window-like coordinate system where +X is right
+	// and +Y is down.  The D3D Y axis is the other way around, so we need
+	// to use the negative Y value.  The camera view automatically places
+	// the coordinate system origin at top left, so we don't need to worry
+	// about the view size or orientation here.
+	float c = cosf(rotation), s = sinf(rotation);
+	float dx = x, dy = -y;
+	auto Vertex = [c, s, dx, dy, &color](float x, float y, float u, float v) -> TextVertexType {
+		return { XMFLOAT4(x*c - y*s + dx, x*s + y*c + dy, 0, 0), XMFLOAT2(u, v), color };
+	};
+
+	// add the vertices for each quad
+	size_t base = vertices.size();
+	vertices.resize(base + layout.size() * 4);
+	TextVertexType *v = vertices.data() + base;
+	for (auto &q : layout)
+	{
+		*v++ = Vertex(q.left, q.top, q.u0, q.v0);
+		*v++ = Vertex(q.right, q.top, q.u1, q.v0);
+		*v++ = Vertex(q.right, q.bottom, q.u1, q.v1);
+		*v++ = Vertex(q.left, q.bottom, q.u0, q.v1);
+	}
+}
+
+void TextBatch::PlanDrawCalls(size_t maxQuadsPerCall, std::vector<DrawCall> &calls) const
+{
+	calls.clear();
+	size_t quad = 0;
+	for (auto &r : runs)
+	{
+		// draw the run in chunks that fit the per-call limit
+		for (size_t done = 0; done < r.nQuads; )
+		{
+			size_t n = min(r.nQuads - done, maxQuadsPerCall);
+			calls.push_back({ r.texture, quad + done, n });
+			done += n;
+		}
+		quad += r.nQuads;
+	}
+}
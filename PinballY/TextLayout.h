@@ -0,0 +1,170 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Text layout and batching for TextDraw.
+//
+// This is the part of the text drawing system that works purely with
+// the font metrics: looking up glyphs, laying out strings as textured
+// quads, caching the layouts, generating the vertices for a frame's
+// text batch, and dividing the batch into draw calls.  None of it
+// touches D3D, so it can be tested and benchmarked on its own.  The
+// D3D side (font textures, buffers, shaders) is in TextDraw.
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <DirectXMath.h>
+
+// text object vertex type
+struct TextVertexType
+{
+	DirectX::XMFLOAT4 position;
+	DirectX::XMFLOAT2 texCoord;
+	DirectX::XMFLOAT4 color;
+};
+
+// Laid-out glyph quad.  The position is relative to the top left of
+// the string, in the D3D text coordinate system (+Y up).
+struct TextGlyphQuad
+{
+	float left, top, right, bottom;
+	float u0, v0, u1, v1;
+};
+
+// Laid-out string: one quad per visible character, in string order
+typedef std::vector<TextGlyphQuad> TextLayout;
+
+// Font metrics.  This holds a font's glyph descriptors, and lays out
+// strings with them.
+class TextFontMetrics
+{
+public:
+	TextFontMetrics();
+
+	// Glyph descriptor.  This matches the byte layout of the objects
+	// in a font file created by MakeSpriteFont in the DirectXTK library.
+	struct Glyph
+	{
+		uint32_t charCode;
+		RECT subrect;
+		float xOffset;
+		float yOffset;
+		float xAdvance;
+	};
+
+	// Set up the metrics from the font file data.  This takes over the
+	// glyph list, builds the glyph lookup tables, and clears the layout
+	// cache.
+	void Init(std::vector<Glyph> &&glyphs, uint32_t defaultChar, float lineSpacing,
+		uint32_t textureWidth, uint32_t textureHeight);
+
+	// Look up the glyph for a character, returning the default glyph
+	// if the font doesn't have one for the character
+	const Glyph *FindGlyph(TCHAR c) const
+	{
+		if ((unsigned)c < countof(latinGlyphs))
+			return latinGlyphs[c];
+
+		auto it = glyphMap.find(c);
+		return it != glyphMap.end() ? it->second : defaultGlyph;
+	}
+
+	// Get the layout for a string.  The layout is computed the first
+	// time we see a string, and cached for re-use, since most of the
+	// text we draw is the same from one update to the next.  Returns
+	// null if the string contains a character we can't draw (which
+	// can only happen if the font has no default character).
+	std::shared_ptr<const TextLayout> GetLayout(const TCHAR *text);
+
+	// Lay out a string.  This does the actual layout work for GetLayout(),
+	// bypassing the cache.  Returns false if the string contains a
+	// character we can't draw.
+	bool LayoutText(const TCHAR *text, TextLayout &layout) const;
+
+	// get the line height
+	float GetLineHeight() const { return lineSpacing; }
+
+	// measure text
+	POINTF MeasureText(const TCHAR *text) const;
+
+	// maximum number of layouts we keep in the cache
+	static const size_t layoutCacheCapacity = 256;
+
+protected:
+	// glyph data
+	std::vector<Glyph> glyphs;
+
+	// Glyph table for the Latin-1 range.  This is a direct index by
+	// character code, which covers nearly everything we actually draw;
+	// characters the font doesn't define map to the default glyph.
+	const Glyph *latinGlyphs[256];
+
+	// glyph hash, for characters outside the Latin-1 range
+	std::unordered_map<uint32_t, const Glyph*> glyphMap;
+
+	// default character
+	const Glyph *defaultGlyph;
+
+	// Layout cache.  This maps strings to their layouts.  When the
+	// cache fills up, we simply discard everything and start over; the
+	// working set is small (a screenful of status text), so a refill
+	// is cheap, and it ages out transient strings like counter values.
+	std::unordered_map<TSTRING, std::shared_ptr<const TextLayout>> layoutCache;
+
+	// line height
+	float lineSpacing;
+
+	// texture dimensions, for figuring the glyph texture coordinates
+	uint32_t textureWidth, textureHeight;
+};
+
+// Text batch.  This collects the vertices for a frame's text items,
+// and plans the draw calls to render them.
+class TextBatch
+{
+public:
+	// Add a laid-out string to the batch.  This transforms the layout
+	// to the given position and rotation, and applies the color, so the
+	// batch can be drawn with an identity world transform.  The texture
+	// is an opaque handle for the font texture; consecutive items with
+	// the same texture are drawn together.  Adds four vertices per quad.
+	void Add(const TextLayout &layout, float x, float y, float rotation,
+		const DirectX::XMFLOAT4 &color, const void *texture);
+
+	// discard the batch contents
+	void Clear();
+
+	// Draw call.  Each call draws a range of quads from the batch with
+	// a single texture.
+	struct DrawCall
+	{
+		const void *texture;
+		size_t firstQuad;
+		size_t nQuads;
+	};
+
+	// Plan the draw calls for the batch.  Consecutive items that share
+	// a texture are combined into one call, and calls are split as needed
+	// so that none exceeds maxQuadsPerCall (the limit of the index range).
+	void PlanDrawCalls(size_t maxQuadsPerCall, std::vector<DrawCall> &calls) const;
+
+	// get the vertices
+	const std::vector<TextVertexType> &GetVertices() const { return vertices; }
+	size_t GetQuadCount() const { return vertices.size() / 4; }
+
+protected:
+	// Vertex list.  This is kept between frames, so that we don't have
+	// to re-allocate it once it's grown to the usual frame size.
+	std::vector<TextVertexType> vertices;
+
+	// texture runs: each entry is a texture and the number of quads in
+	// the run, in batch order
+	struct Run
+	{
+		const void *texture;
+		size_t nQuads;
+	};
+	std::vector<Run> runs;
+};
@@ -23,7 +23,7 @@ public:
 	// set shader inputs
 	virtual void SetShaderInputs(Camera *camera);
 
-	// set the color
+	// Set the base color.  This is multiplied by the per-vertex color.
 	void SetColor(DirectX::XMFLOAT4 color);
 
 	// Set the alpha transparency.  This shader doesn't support a separate
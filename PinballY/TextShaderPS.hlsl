@@ -13,9 +13,10 @@ struct PixelInputType
 {
 	float4 position: SV_POSITION;
 	float2 texCoord: TEXCOOR0;
+	float4 color: COLOR;
 };
 
 float4 PS(PixelInputType input) : SV_TARGET
 {
-	return Texture.Sample(TextureSampler, input.texCoord) * color;
+	return Texture.Sample(TextureSampler, input.texCoord) * input.color * color;
 }
@@ -18,12 +18,14 @@ struct VertexInputType
 {
 	float4 position: POSITION;
 	float2 texCoord: TEXCOORD;
+	float4 color: COLOR;
 };
 
 struct PixelInputType
 {
 	float4 position: SV_POSITION;
 	float2 texCoord: TEXCOOR0;
+	float4 color: COLOR;
 };
 
 PixelInputType VS(VertexInputType input)
@@ -37,6 +39,7 @@ PixelInputType VS(VertexInputType input)
 	output.position = mul(output.position, projectionMatrix);
 
 	output.texCoord = input.texCoord;
+	output.color = input.color;
 
 	return output;
 }
@@ -38,6 +38,7 @@
 #include "TextureShader.h"
 #include "I420Shader.h"
 #include "Application.h"
+#include "PerfMon.h"
 
 
 // The VLC public API depends on the Posix type ssize_t ("signed size_t"),
@@ -250,7 +251,9 @@ VLCAudioVideoPlayer::VLCAudioVideoPlayer(HWND hwndVideo, HWND hwndEvent, bool au
 	firstFramePresented(false),
 	shader(nullptr),
 	dmd(nullptr),
-	nPlanes(0)
+	nPlanes(0),
+	formatChanged(false),
+	textureValid(false)
 {
 	// load the libvlc DLLs if we haven't already
 	LoadLibvlc(Application::InUiErrorHandler());
@@ -515,7 +518,7 @@ unsigned int VLCAudioVideoPlayer::OnVideoSetFormat(void **opaque, char *chroma,
 
 	// plane descriptions, to be set according to the format
 	int nPlanes = 0;
-	FrameBuffer::Plane planes[3];
+	FrameFormat::Plane planes[3];
 
 	// shader, to be chosen according to the format
 	Shader *shader = nullptr;
@@ -557,7 +560,7 @@ unsigned int VLCAudioVideoPlayer::OnVideoSetFormat(void **opaque, char *chroma,
 		// set up the plane texture descriptors
 		planes[0].textureDesc = planes[1].textureDesc = planes[2].textureDesc = CD3D11_TEXTURE2D_DESC(
 			DXGI_FORMAT_R8_UNORM, pitches[0], lines[0], 1, 1,
-			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_IMMUTABLE, 0, 1, 0, 0);
+			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, 1, 0, 0);
 		
 		// use the I420/I444 shader
 		shader = Application::Get()->i420Shader.get();
@@ -587,11 +590,11 @@ unsigned int VLCAudioVideoPlayer::OnVideoSetFormat(void **opaque, char *chroma,
 		// set up the plane texture descriptors
 		planes[0].textureDesc = CD3D11_TEXTURE2D_DESC(
 			DXGI_FORMAT_R8_UNORM, *width, lines[0], 1, 1,
-			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_IMMUTABLE, 0, 1, 0, 0);
+			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, 1, 0, 0);
 		
 		planes[1].textureDesc = planes[2].textureDesc = CD3D11_TEXTURE2D_DESC(
 			DXGI_FORMAT_R8_UNORM, (*width+1)/2, lines[1], 1, 1,
-			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_IMMUTABLE, 0, 1, 0, 0);
+			D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, 1, 0, 0);
 
 		// use the I420/I444 shader
 		shader = Application::Get()->i420Shader.get();
@@ -610,122 +613,75 @@ unsigned int VLCAudioVideoPlayer::OnVideoSetFormat(void **opaque, char *chroma,
 		bufsize += pitches[i] * lines[i];
 	}
 
-	// lock the object while updating its fields
-	CriticalSectionLocker locker(self->lock);
-
-	// allocate the frame buffers
-	for (auto &f : self->frame)
-	{
-		// allocate a new frame
-		f.Attach(new FrameBuffer());
-
-		// remember the frame dimensions
-		f->dims.cx = *width;
-		f->dims.cy = *height;
+	// lock out the renderer while updating the format and buffers
+	CriticalSectionLocker locker(self->renderLock);
 
-		// remember the shader
-		f->shader = shader;
+	// remember the new format
+	auto &fmt = self->format;
+	fmt.dims.cx = *width;
+	fmt.dims.cy = *height;
+	fmt.shader = shader;
+	fmt.nPlanes = nPlanes;
+	for (int i = 0; i < nPlanes; ++i)
+		fmt.planes[i] = planes[i];
 
-		// remember the plane descriptors
-		f->nPlanes = nPlanes;
-		for (int i = 0; i < nPlanes; ++i)
-		{
-			f->planes[i].textureDesc = planes[i].textureDesc;
-			f->planes[i].bufOfs = planes[i].bufOfs;
-			f->planes[i].rowPitch = planes[i].rowPitch;
-		}
+	// tell the renderer to set up new textures
+	self->formatChanged = true;
 
-		// allocate the pixel array
-		f->pixBuf.reset(static_cast<BYTE*>(_mm_malloc(bufsize, 128)));
-		if (f->pixBuf == nullptr)
-			return 0;
-	}
+	// allocate the frame buffers
+	if (!self->frameRing.Allocate(nDecoderPictures + 2, bufsize, 128))
+		return 0;
 
 	// return the buffer count
-	return countof(self->frame);
+	return nDecoderPictures;
 }
 
 void VLCAudioVideoPlayer::OnVideoFormatCleanup(void *opaque)
 {
-	// get the 'this' pointer and lock it while working
+	// get the 'this' pointer
 	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
-	CriticalSectionLocker locker(self->lock);
 
-	// Free buffers
-	for (int i = 0; i < countof(self->frame); ++i)
-		self->frame[i] = nullptr;
+	// free the buffers, making sure the renderer isn't using them
+	CriticalSectionLocker locker(self->renderLock);
+	self->frameRing.Deallocate();
 }
 
 void *VLCAudioVideoPlayer::OnVideoFrameLock(void *opaque, void **planes)
 {
-	// get the 'this' pointer and lock it while working
-	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
-	CriticalSectionLocker locker(self->lock);
+	PERF_ZONE(_T("VLC Lock"));
 
-	// keep going until we can satisfy the request
-	for (;;)
-	{
-		// look for a free frame
-		for (auto &f : self->frame)
-		{
-			// use the buffer if it's free
-			if (f->status == FrameBuffer::Free)
-			{
-				// lock this frame
-				f->status = FrameBuffer::Locked;
-
-				// Return the pixel buffer for each plane.  Recall that
-				// the three planes are packed into a single byte array,
-				// so can find each plane's memory address by adding its
-				// offset to the base buffer address.
-				BYTE *p = f->pixBuf.get();
-				for (int i = 0; i < f->nPlanes; ++i)
-					planes[i] = p + f->planes[i].bufOfs;
-
-				// Add a reference to the frame on behalf of libvlc.
-				// This will ensure that the frame stays alive as long
-				// as libvlc is using it.
-				f->AddRef();
-
-				// the raw frame buffer object pointer is the frame ID
-				return f.Get();
-			}
-		}
-
-		// We failed to find a free frame buffer, so wait until one 
-		// becomes available.  Old frames are freed up as new frames 
-		// are presented, so we just have to wait a bit for the 
-		// presentation clock to catch up with the decoder.  While
-		// waiting, we have to release the object lock, so that the 
-		// presentation thread can update the frame status variables.
-		locker.Unlock();
+	// get the 'this' pointer
+	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
 
-		// pause briefly
-		Sleep(5);
+	// Get a buffer from the ring.  This never waits: if the renderer
+	// is behind, the ring drops stale frames or hands out a scratch
+	// buffer rather than making us wait for a buffer to free up.
+	int slot = self->frameRing.Lock();
+	if (slot == VideoFrameRing::NoSlot)
+		return nullptr;
 
-		// lock the object again and continue searching
-		locker.Lock(self->lock);
-	}
+	// Return the pixel buffer for each plane.  Recall that the planes
+	// are packed into a single buffer, so can find each plane's memory
+	// address by adding its offset to the base buffer address.  Note
+	// that we don't need to lock the format, since libvlc never calls
+	// the format callbacks concurrently with decoding.
+	BYTE *p = self->frameRing.GetBuffer(slot);
+	for (int i = 0; i < self->format.nPlanes; ++i)
+		planes[i] = p + self->format.planes[i].bufOfs;
+
+	// the slot number is the picture ID
+	return SlotToPicture(slot);
 }
 
 void VLCAudioVideoPlayer::OnVideoFrameUnlock(void *opaque, void *pictureId, void *const *planes)
 {
-	// Note: we don't have to hold the video player object lock
-	// at any point in this routine, even though we're accessing
-	// the buffer object.  The buffer's status==Locked makes it
-	// off-limits for any other threads to touch, so it's already
-	// protected.  And we don't have to access anything else in 
-	// the video player object itself.
-
 	// do nothing if the picture ID is null
 	if (pictureId == nullptr)
 		return;
 
-	// the "picture ID" is actually our frame buffer pointer
-	FrameBuffer *f = reinterpret_cast<FrameBuffer*>(pictureId);
-
 	// the buffer now has a valid decoded frame
-	f->status = FrameBuffer::Valid;
+	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
+	self->frameRing.Unlock(PictureToSlot(pictureId), static_cast<INT64>(self->timer.GetTime_us()));
 }
 
 void VLCAudioVideoPlayer::OnVideoFramePresent(void *opaque, void *pictureId)
@@ -734,36 +690,16 @@ void VLCAudioVideoPlayer::OnVideoFramePresent(void *opaque, void *pictureId)
 	if (pictureId == nullptr)
 		return;
 
-	// The "picture ID" is actually our frame buffer pointer.  Take
-	// over libvlc's reference on the frame object.
-	RefPtr<FrameBuffer> f(reinterpret_cast<FrameBuffer*>(pictureId));
-
 	// get the 'this' pointer
 	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
 
-	// hold the render resource lock while updating presentedFrame
-	{
-		// acquire the lock
-		CriticalSectionLocker renderLocker(self->renderLock);
-
-		// If another frame was previously presented, that frame is
-		// now free.  Note that it's okay to free the frame currenty
-		// locked by the renderer, because merely updating the buffer
-		// status won't affect the frame data.  Instead, we check
-		// in the 'lock' routine to make sure that we don't try to
-		// re-use a frame that's currently being used for rendering.
-		// We get finer resource access granularity and thus less
-		// contention by deferring that check until we actually need
-		// to write into a buffer.
-		if (self->presentedFrame != nullptr && self->presentedFrame != f)
-			self->presentedFrame->status = FrameBuffer::Free;
-
-		// this is now the presented frame
-		self->presentedFrame = f;
-
-		// advance its state to 'presented'
-		f->status = FrameBuffer::Presented;
-	}
+	PERF_ZONE(_T("VLC Present"));
+
+	// Post the frame for the renderer.  If the renderer hasn't picked
+	// up the previous frame yet, the ring drops it in favor of this
+	// newer one.
+	if (!self->frameRing.Present(PictureToSlot(pictureId)))
+		return;
 
 	// if this the first frame we've presented, notify the event window
 	CriticalSectionLocker locker(self->lock);
@@ -808,63 +744,72 @@ void VLCAudioVideoPlayer::OnMediaPlayerEndReached(const libvlc_event_t *event, v
 //
 bool VLCAudioVideoPlayer::Render(Camera *camera, Sprite *sprite)
 {
-	// Lock the current presentation frame.  Note that we only have
-	// to hold the object lock while manipulating the internal render
-	// frame variables; once we've marked the frame as locked, the
-	// background threads will respect our ownership of the frame and
-	// won't overwrite its contents until we release it.  This allows
-	// the VLC background threads to carry on other work with the
-	// frame buffers (such as decoding into other frame buffers)
-	// concurrently while we're doing the rendering.
-	RefPtr<FrameBuffer> newFrame;
+	// Pick up the newest presented frame, if any, and copy it into
+	// our textures.  The ring hand-off itself doesn't need any locks,
+	// but we do have to hold the render lock while copying the frame,
+	// to keep libvlc from reallocating the buffers if it changes the
+	// format mid-stream.  That's the only thing that contends for
+	// this lock, so we won't normally have to wait for it.
 	{
-		// lock against concurrent access by the VLC background threads
 		CriticalSectionLocker locker(renderLock);
 
-		// If there's a presented frame, take over the reference
-		if (presentedFrame != nullptr)
-			newFrame.Attach(presentedFrame.Detach());
-	}
-
-	// If we have a new presented frame, copy it to GPU memory
-	if (newFrame != nullptr)
-	{
-		// delete the the previous shader resource views
-		for (int i = 0; i < nPlanes; ++i)
-			shaderResourceView[i] = nullptr;
-
-		// use the shader from the frame
-		shader = newFrame->shader;
-
-		// set up the shader resource view descriptor for the frame
-		D3D11_SHADER_RESOURCE_VIEW_DESC srvd;
-		srvd.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-		srvd.Texture2D.MipLevels = 1;
-		srvd.Texture2D.MostDetailedMip = 0;
-
-		// create the shader resource views for each plane
-		D3D11_SUBRESOURCE_DATA srd;
-		srd.SysMemSlicePitch = 0;
-		nPlanes = newFrame->nPlanes;
-		for (int i = 0; i < nPlanes; ++i)
+		// if the format has changed, create new textures
+		if (formatChanged)
 		{
-			// get the plane
-			auto &plane = newFrame->planes[i];
-
-			// create the new texture and view
-			shaderResourceView[i] = nullptr;
-			srd.pSysMem = newFrame->pixBuf.get() + plane.bufOfs;
-			srd.SysMemPitch = plane.rowPitch;
-			srvd.Format = plane.textureDesc.Format;
-			D3D::Get()->CreateTexture2D(&plane.textureDesc, &srd, &srvd, &shaderResourceView[i], NULL);
+			// the new textures won't be valid until we copy a frame
+			formatChanged = false;
+			textureValid = false;
+
+			// release the old textures and views
+			for (int i = 0; i < countof(texture); ++i)
+			{
+				shaderResourceView[i] = nullptr;
+				texture[i] = nullptr;
+			}
+
+			// use the shader for the format
+			shader = format.shader;
+
+			// set up the shader resource view descriptor
+			D3D11_SHADER_RESOURCE_VIEW_DESC srvd;
+			srvd.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+			srvd.Texture2D.MipLevels = 1;
+			srvd.Texture2D.MostDetailedMip = 0;
+
+			// create a texture and view for each plane
+			nPlanes = format.nPlanes;
+			for (int i = 0; i < nPlanes; ++i)
+			{
+				auto &plane = format.planes[i];
+				srvd.Format = plane.textureDesc.Format;
+				D3D::Get()->CreateTexture2D(&plane.textureDesc, nullptr, &srvd, &shaderResourceView[i], &texture[i]);
+			}
 		}
 
-		// this frame can now be reused for a new decoded frame
-		newFrame->status = FrameBuffer::Free;
+		// take the newest presented frame
+		if (int slot = frameRing.Take(static_cast<INT64>(timer.GetTime_us())); slot != VideoFrameRing::NoSlot)
+		{
+			PERF_ZONE(_T("VLC Upload"));
+
+			// copy each plane into its texture
+			const BYTE *p = frameRing.GetBuffer(slot);
+			for (int i = 0; i < nPlanes; ++i)
+			{
+				if (texture[i] != nullptr)
+					D3D::Get()->UpdateResource(texture[i], p + format.planes[i].bufOfs, format.planes[i].rowPitch);
+			}
+
+			// The texture update copies the data, so the buffer can go
+			// straight back into the pool for a new decoded frame.
+			frameRing.Release(slot);
+
+			// the textures now have a frame to show
+			textureValid = true;
+		}
 	}
 
-	// if there's no shader yet, there's nothing to render
-	if (shader == nullptr)
+	// if there's no shader or frame yet, there's nothing to render
+	if (shader == nullptr || !textureValid)
 		return false;
 
 	// populate the resource view list to bind to the shader
@@ -945,37 +890,29 @@ unsigned int VLCAudioVideoPlayer::OnDMDSetFormat(void **opaque, char *chroma,
 	lines[0] = *height;
 	lines[1] = lines[2] = (*height + 1) / 2;
 
-	// lock the object while updating its fields
-	CriticalSectionLocker locker(self->lock);
-
-	// allocate the frame buffers
-	for (auto &f : self->frame)
+	// lock out other users of the format while updating it
+	CriticalSectionLocker locker(self->renderLock);
+
+	// remember the format
+	auto &fmt = self->format;
+	fmt.dims.cx = *width;
+	fmt.dims.cy = *height;
+	fmt.shader = nullptr;
+	fmt.nPlanes = 3;
+	UINT ofs = 0;
+	for (int i = 0; i < 3; ++i)
 	{
-		// allocate the new frame
-		f.Attach(new FrameBuffer());
-
-		// remember the frame dimensions
-		f->dims.cx = *width;
-		f->dims.cy = *height;
-
-		// set up the plane descriptors
-		f->nPlanes = 3;
-		UINT ofs = 0;
-		for (int i = 0; i < 3; ++i)
-		{
-			f->planes[i].bufOfs = ofs;
-			f->planes[i].rowPitch = pitches[i];
-			ofs += pitches[i] * lines[i];
-		}
-
-		// allocate the pixel buffer
-		f->pixBuf.reset(static_cast<BYTE*>(_mm_malloc(ofs, 16)));
-		if (f->pixBuf == nullptr)
-			return 0;
+		fmt.planes[i].bufOfs = ofs;
+		fmt.planes[i].rowPitch = pitches[i];
+		ofs += pitches[i] * lines[i];
 	}
 
+	// allocate the frame buffers
+	if (!self->frameRing.Allocate(nDecoderPictures + 2, ofs, 16))
+		return 0;
+
 	// return the buffer count
-	return countof(self->frame);
+	return nDecoderPictures;
 }
 
 void VLCAudioVideoPlayer::OnDMDFrameUnlock(void *opaque, void *pictureId, void *const *planes)
@@ -984,11 +921,9 @@ void VLCAudioVideoPlayer::OnDMDFrameUnlock(void *opaque, void *pictureId, void *
 	if (pictureId == nullptr)
 		return;
 
-	// the "picture ID" is actually our frame buffer pointer
-	FrameBuffer *f = reinterpret_cast<FrameBuffer*>(pictureId);
-
 	// the buffer now has a valid decoded frame
-	f->status = FrameBuffer::Valid;
+	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
+	self->frameRing.Unlock(PictureToSlot(pictureId), static_cast<INT64>(self->timer.GetTime_us()));
 }
 
 void VLCAudioVideoPlayer::OnDMDFramePresent(void *opaque, void *pictureId)
@@ -997,19 +932,25 @@ void VLCAudioVideoPlayer::OnDMDFramePresent(void *opaque, void *pictureId)
 	if (pictureId == nullptr)
 		return;
 
-	// the "picture ID" is actually our frame buffer pointer
-	RefPtr<FrameBuffer> f(reinterpret_cast<FrameBuffer*>(pictureId));
-
 	// get the 'this' pointer
 	auto self = reinterpret_cast<VLCAudioVideoPlayer*>(opaque);
 
+	// Claim the frame.  The DMD device takes frames as they're
+	// presented, so we bypass the renderer mailbox and go straight
+	// to the device.
+	int slot = PictureToSlot(pictureId);
+	if (!self->frameRing.PresentDirect(slot, static_cast<INT64>(self->timer.GetTime_us())))
+		return;
+
 	// send it to the DMD device
-	const BYTE *pix = f->pixBuf.get();
-	self->dmd->PresentVideoFrame(f->dims.cx, f->dims.cy, 
-		pix, pix + f->planes[1].bufOfs, pix + f->planes[2].bufOfs);
+	PERF_ZONE(_T("VLC DMD Present"));
+	const BYTE *pix = self->frameRing.GetBuffer(slot);
+	auto &fmt = self->format;
+	self->dmd->PresentVideoFrame(fmt.dims.cx, fmt.dims.cy,
+		pix, pix + fmt.planes[1].bufOfs, pix + fmt.planes[2].bufOfs);
 
 	// this frame is now free
-	f->status = FrameBuffer::Free;
+	self->frameRing.Release(slot);
 
 	// if this the first frame we've presented, notify the event window
 	CriticalSectionLocker locker(self->lock);
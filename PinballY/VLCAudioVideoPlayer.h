@@ -10,8 +10,9 @@
 // object.
 
 #pragma once
-#include <malloc.h>
 #include "AudioVideoPlayer.h"
+#include "VideoFrameRing.h"
+#include "HiResTimer.h"
 
 struct libvlc_instance_t;
 struct libvlc_event_t;
@@ -89,6 +90,11 @@ public:
 	// the caller is doing.
 	virtual bool IsFrameReady() const override { return firstFramePresented; }
 
+	// Is a new frame ready to render?  There's a new frame if one has
+	// been presented and not yet taken by the renderer, or if the
+	// format changed, in which case we need to set up new textures.
+	virtual bool IsNewFrameReady() const override { return frameRing.HasPresentedFrame() || formatChanged; }
+
 	// Set looping playback mode
 	virtual void SetLooping(bool f) override;
 
@@ -98,6 +104,11 @@ public:
 	// Render the current video frame onto a mesh
 	virtual bool Render(Camera *camera, Sprite *sprite) override;
 
+	// Get the frame pipeline statistics for the current session: frames
+	// decoded, presented, rendered, and dropped, decoder starvation
+	// events, and decode-to-render latency.
+	void GetFrameStats(VideoFrameRing::Stats &stats) const { frameRing.GetStats(stats); }
+
 protected:
 	// reference-counted -> self-destruction only
 	virtual ~VLCAudioVideoPlayer();
@@ -160,75 +171,36 @@ protected:
 	// Frame buffers for the video decoder and renderer.  These are
 	// the memory buffers that we return to libvlc from our "lock
 	// buffer" callback.  Libvlc decodes video frames directly into
-	// these buffers.  Each buffer holds one frame.
-	//
-	// We maintain a small pool of these buffers.  At any given time,
-	// a buffer can be in one of three states:  free, meaning it's
-	// not currently in use and is available for the next "lock"
-	// request from libvlc; locked, meaning that libvlc is actively
-	// decoding a frame into the buffer's memory; and valid, which
-	// means that libvlc has finished decoding a frame into this
-	// buffer.  Multiple valid frames might exist at any given time, 
-	// since libvlc can work ahead to decode future frames before 
-	// it's time to display them.  Libvlc tells us via our "present
-	// frame" callback precisely when it's time to display a frame.
-	// It only calls this with valid frames.
-	//
-	// Note that the usual D3D11 method for video playback is "usage
-	// dynamic" textures, which are optimized for streaming data 
-	// from the CPU to GPU.  We don't use this mechanism, though,
-	// because the shared CPU/GPU memory where dynamic textures have
-	// to be allocated is too scarce on many systems to allow for
-	// the kind of multi-stream playback we need to do.  Instead, we
-	// stream data to the GPU simply by creating a new texture for
-	// each frame.  This is less efficient than dynamic textures,
-	// but in testing it's more reliable.  (The key problem with 
-	// 'usage dynamic' textures is that the D3D11 call to allocate
-	// one flat out crashes when shared video memory is exhausted,
-	// rather than returning an error.  If it returned an error, we 
-	// could handle these conditions in app code, but there's no
-	// graceful way to handle the crash down in the D3D11 code.)
-	class FrameBuffer : public RefCounted
+	// these buffers.  The ring manages the hand-offs between the
+	// libvlc decoder and presentation threads and our renderer in
+	// the UI thread, without locking; see VideoFrameRing.h.
+	VideoFrameRing frameRing;
+
+	// Number of pictures we tell libvlc to allocate.  Libvlc won't
+	// hold more than this many buffers locked at once, so we give the
+	// ring two more slots than this, to cover the frame waiting in the
+	// mailbox and the frame being uploaded by the renderer.  That way
+	// the decoder never has to wait for the renderer.  We seem to get
+	// the best results with about 3-5 decoder buffers; we need more
+	// than one to allow for concurrent decoding and rendering, but
+	// more than about 10 actually slows things down quite a lot,
+	// perhaps because of the large amount of memory involved.
+	static const int nDecoderPictures = 3;
+
+	// Convert between ring slot numbers and libvlc picture IDs.  Libvlc
+	// treats a null picture ID as "no picture", so we offset by one.
+	static void *SlotToPicture(int slot) { return reinterpret_cast<void*>(static_cast<INT_PTR>(slot + 1)); }
+	static int PictureToSlot(void *picture) { return static_cast<int>(reinterpret_cast<INT_PTR>(picture)) - 1; }
+
+	// Frame format, as set up in the "set format" callback
+	struct FrameFormat
 	{
-	public:
-		FrameBuffer() : 
-			status(Free),
-			pixBuf(nullptr, &_aligned_free)
-		{ 
-		}
-
-		~FrameBuffer()
-		{
-		}
-
-		// frame status
-		enum FrameStatus
-		{
-			// Free: this frame buffer is available for a new decoded frame.
-			Free,
-
-			// Locked: VLC has locked this frame for writing, and is in the
-			// process of decoding frame data into it.
-			Locked,
-
-			// Valid:  VLC has finished rendering a frame into this buffer,
-			// but the frame hasn't yet been presented.
-			Valid,
-
-			// Presented:  VLC has presented this frame.
-			Presented
-		};
-		volatile FrameStatus status;
+		FrameFormat() : shader(nullptr), nPlanes(0) { dims = { 0, 0 }; }
 
 		// Frame dimensions in pixels
 		SIZE dims;
 
-		// Pixel buffer.  This is allocated in our libvlc "set format"
-		// callback, which tells us the size and pixel format of the frame
-		// so that we can allocate buffers.
-		std::unique_ptr<BYTE, decltype(&_aligned_free)> pixBuf;
-
-		// Shader to use for rendering this frame
+		// Shader to use for rendering frames
 		Shader *shader;
 
 		// Pixel plane layout.  Some formats (e.g., I420 or NV12) divide
@@ -238,10 +210,10 @@ protected:
 			// texture descriptor for this plane's data
 			D3D11_TEXTURE2D_DESC textureDesc;
 
-			// Offset in pixBuf of the start of this plane's data.
-			// (We pack all of a plane's frames into a single pixel
-			// buffer, end on end, so this tells us the byte offset
-			// of the start of this plane's data.)
+			// Offset in the frame buffer of the start of this plane's
+			// data.  (We pack all of a frame's planes into a single
+			// buffer, end on end, so this tells us the byte offset of
+			// the start of this plane's data.)
 			size_t bufOfs;
 
 			// row pitch of this plane
@@ -252,32 +224,51 @@ protected:
 		// number of planes in this format
 		int nPlanes;
 	};
+	FrameFormat format;
 
-	// Frame buffers.  We seem to get the best results with about
-	// 3-5 buffers.  We need more than one to allow for concurrent
-	// decoding and rendering, but more than about 10 actually
-	// slows things down quite a lot, perhaps because of the large
-	// amount of memory that has to be allocated.
-	RefPtr<FrameBuffer> frame[3];
+	// Has the format changed since the renderer last created its
+	// textures?  The renderer checks this to recreate its textures
+	// when libvlc sets up a new format.
+	bool formatChanged;
+
+	// Textures for the video frames.  We keep one texture per plane,
+	// and copy each new presented frame into it, rather than creating
+	// new textures for every frame.
+	//
+	// Note that the usual D3D11 method for video playback is "usage
+	// dynamic" textures, which are optimized for streaming data 
+	// from the CPU to GPU.  We don't use this mechanism, though,
+	// because the shared CPU/GPU memory where dynamic textures have
+	// to be allocated is too scarce on many systems to allow for
+	// the kind of multi-stream playback we need to do.  (The key
+	// problem with 'usage dynamic' textures is that the D3D11 call
+	// to allocate one flat out crashes when shared video memory is
+	// exhausted, rather than returning an error.)  Instead, we use
+	// "usage default" textures, which live in ordinary video memory,
+	// and update them with UpdateSubresource.
+	RefPtr<ID3D11Resource> texture[3];
 
 	// Shader for current rendered frame
 	Shader *shader;
 
-	// Shader resource views for the current frame we're rendering
+	// Shader resource views for the textures
 	int nPlanes;
 	RefPtr<ID3D11ShaderResourceView> shaderResourceView[3];
 
-	// Critical section locker for the rendering pointers.  This
-	// controls access to presentedFrame and renderFrame.  We use
-	// this separate lock for these two items, because they're the
-	// only items that the renderer needs to access.  Isolating
-	// them with their own lock minimizes contention between the
-	// renderer and decoder threads.  That helps avoid blocking
-	// the UI, as the renderer runs in the main UI thread.
+	// do the textures contain a frame yet?
+	bool textureValid;
+
+	// Critical section lock for the frame format and ring buffers.
+	// The per-frame hand-offs through the ring don't require any
+	// locking, but the renderer has to be sure that the ring buffers
+	// don't get reallocated out from under it while it's copying a
+	// frame to the GPU, which can happen if libvlc changes formats
+	// mid-stream.  The renderer holds this lock while working with
+	// a frame, and the format callbacks hold it while reallocating.
 	CriticalSection renderLock;
 
-	// Current presented frame
-	RefPtr<FrameBuffer> presentedFrame;
+	// timer, for the frame latency statistics
+	HiResTimer timer;
 
 	// has the first frame been presented yet?
 	bool firstFramePresented;
@@ -38,11 +38,22 @@
 // only takes about 5ms.  This is fast enough to do on-demand in UI
 // code.
 //
+// We read the Structured Storage container with our own CFB parser
+// (see CompoundFile.h) rather than through the Windows Structured
+// Storage API.  The parser works directly on a memory mapping of the
+// file, and only follows the sector chains for the streams we read,
+// which makes it cheap enough to scan a whole folder of tables at
+// once (see ReadBatch()).
+//
 
 #include "stdafx.h"
+#include <filesystem>
 #include "VPFileReader.h"
+#include "CompoundFile.h"
 #include "../Utilities/WinCryptUtil.h"
 
+namespace fs = std::experimental::filesystem;
+
 // File "tag" maker macro.  A tag is a four-character code
 // packed into four bytes in the FOURCC fashion.  'TAG(ABCD)'
 // gets this in UINT32 format for simple comparisons.  (This
@@ -67,53 +78,34 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 		return E_POINTER;
 
 	// VP's underlying raw storage format is OLE Structured Storage.  Open 
-	// the file as an IStorage.
-	RefPtr<IStorage> stg;
-	HRESULT hr = StgOpenStorage(filename, NULL, STGM_TRANSACTED | STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &stg);
+	// the file as a compound file.
+	CompoundFileReader cf;
+	HRESULT hr = cf.Open(filename);
 	if (FAILED(hr))
 		return hr;
 
-	// Set up a cryptography context, in case we need to decrypt a locked file
-	HCRYPTPROVHolder hcp;
-	if (!CryptAcquireContext(&hcp, NULL, NULL, PROV_RSA_FULL,
-		CRYPT_VERIFYCONTEXT | CRYPT_NEWKEYSET | CRYPT_SILENT))
-		return HRESULT_FROM_WIN32(GetLastError());
-
-	// Initialize an MD5 hasher for the password decryption
-	static const BYTE HASH_INIT_VECTOR[] = "Visual Pinball";
-	HCRYPTHASHHolder hchkey;
-	if (!CryptCreateHash(hcp, CALG_MD5, NULL, 0, &hchkey)
-		|| !CryptHashData(hchkey, HASH_INIT_VECTOR, 14, 0))
-		return HRESULT_FROM_WIN32(GetLastError());
-
-	// Read the Table Info stream
-	RefPtr<IStorage> infoStg;
-	if (SUCCEEDED(hr = stg->OpenStorage(L"TableInfo", NULL, STGM_DIRECT | STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &infoStg)))
+	// Read the Table Info streams
+	if (auto infoStg = cf.FindChild(CompoundFileReader::RootEntry, L"TableInfo"); infoStg != CompoundFileReader::NoEntry)
 	{
-		auto ReadValue = [&infoStg](const WCHAR *name, std::unique_ptr<WCHAR> &value)
+		auto ReadValue = [&cf, infoStg](const WCHAR *name, std::unique_ptr<WCHAR> &value)
 		{
 			// open the stream by name
-			RefPtr<IStream> stream;
-			HRESULT hr = infoStg->OpenStream(name, NULL, STGM_DIRECT | STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &stream);
-			if (FAILED(hr))
-				return hr;
+			CompoundFileReader::Stream stream;
+			if (!cf.OpenStream(cf.FindChild(infoStg, name), stream))
+				return STG_E_FILENOTFOUND;
 
 			// get the content size
-			STATSTG ss;
-			stream->Stat(&ss, STATFLAG_NONAME);
-			DWORD byteLen = ss.cbSize.LowPart;
+			DWORD byteLen = (DWORD)min(stream.GetRemaining(), (UINT64)0x7FFFFFFF);
 			DWORD charLen = byteLen / sizeof(WCHAR);
 
 			// allocate a buffer
 			value.reset(new WCHAR[charLen + 1]);
 
 			// read it
-			ULONG read;
-			if (FAILED(hr = stream->Read(value.get(), byteLen, &read)))
-				return hr;
+			size_t read = stream.Read(value.get(), charLen * sizeof(WCHAR));
 
 			// null-terminate it
-			value.get()[charLen] = 0;
+			value.get()[read / sizeof(WCHAR)] = 0;
 
 			// success
 			return S_OK;
@@ -132,30 +124,19 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 	}
 
 	// open the main "Game" substorage
-	RefPtr<IStorage> dataStg;
-	if (FAILED(hr = stg->OpenStorage(L"GameStg", NULL, STGM_DIRECT | STGM_READ | STGM_SHARE_EXCLUSIVE, NULL, 0, &dataStg)))
-		return hr;
+	auto dataStg = cf.FindChild(CompoundFileReader::RootEntry, L"GameStg");
+	if (dataStg == CompoundFileReader::NoEntry)
+		return STG_E_FILENOTFOUND;
 
-	// open the Version stream
-	RefPtr<IStream> versionStream;
-	HCRYPTKEYHolder hPasswordKey;
-	if (SUCCEEDED(hr = dataStg->OpenStream(L"Version", NULL, STGM_DIRECT | STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &versionStream)))
-	{
-		// read the version data
-		ULONG read;
-		if (SUCCEEDED(hr = versionStream->Read(&fileVersion, sizeof(fileVersion), &read)))
-		{
-			// Initialize the password decryption key according to the file version
-			CryptDeriveKey(hcp, CALG_RC2, hchkey,
-				(fileVersion == 600) ? CRYPT_EXPORTABLE : (CRYPT_EXPORTABLE | 0x00280000),
-				&hPasswordKey);
-		}
-	}
+	// read the Version stream
+	CompoundFileReader::Stream versionStream;
+	if (cf.OpenStream(cf.FindChild(dataStg, L"Version"), versionStream))
+		versionStream.ReadInt32(fileVersion);
 
 	// open the Game Data stream
-	RefPtr<IStream> gameStream;
-	if (FAILED(hr = dataStg->OpenStream(L"GameData", NULL, STGM_DIRECT | STGM_READ | STGM_SHARE_EXCLUSIVE, 0, &gameStream)))
-		return hr;
+	CompoundFileReader::Stream gameStream;
+	if (!cf.OpenStream(cf.FindChild(dataStg, L"GameData"), gameStream))
+		return STG_E_FILENOTFOUND;
 
 	// if we don't need any of the data items, we're done
 	if (!getScript)
@@ -164,13 +145,11 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 	// read records
 	for (bool done = false; !done; )
 	{
-		// read the record size and tag
+		// read the record size and tag; stop at the end of the stream
 		INT32 recLen;
 		INT32 tag;
-		ULONG read;
-		if (FAILED(hr = gameStream->Read(&recLen, sizeof(recLen), &read))
-			|| FAILED(hr = gameStream->Read(&tag, sizeof(tag), &read)))
-			return hr;
+		if (!gameStream.ReadInt32(recLen) || !gameStream.ReadInt32(tag))
+			break;
 
 		// the nominal record length includes the FOURCC tag, so deduct
 		// that from the remaining data, as we've read it now
@@ -182,15 +161,14 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 		case TAG(CODE):
 			// CODE is just an empty tag not stored in the usual format;
 			// a size prefix comes next, then the text.  Read the size.
-			if (FAILED(hr = gameStream->Read(&recLen, sizeof(recLen), &read)))
-				return hr;
+			if (!gameStream.ReadInt32(recLen) || recLen < 0 || (UINT64)recLen > gameStream.GetRemaining())
+				return STG_E_READFAULT;
 
 			// allocate space
 			script.reset(new CHAR[recLen + 1]);
 
 			// read the data
-			if (FAILED(hr = gameStream->Read(script.get(), recLen, &read)))
-				return hr;
+			gameStream.Read(script.get(), recLen);
 
 			// null-terminate it
 			script.get()[recLen] = 0;
@@ -198,8 +176,8 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 			// if necessary, decrypt the script
 			if ((protection.flags & (FileProtection::DISABLE_EVERYTHING | FileProtection::DISABLE_SCRIPT_EDITING)) != 0)
 			{
-				DWORD cryptLen = recLen;
-				CryptDecrypt(hPasswordKey, NULL, TRUE, 0, (BYTE*)script.get(), &cryptLen);
+				if (FAILED(hr = DecryptScript(recLen)))
+					return hr;
 			}
 
 			// done
@@ -207,8 +185,8 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 
 		case TAG(SECB):
 			// security data
-			if (FAILED(hr = gameStream->Read(&protection, sizeof(protection), &read)))
-				return hr;
+			if (gameStream.Read(&protection, sizeof(protection)) != sizeof(protection))
+				return STG_E_READFAULT;
 			break;
 
 		case TAG(ENDB):
@@ -217,13 +195,8 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 
 		default:
 			// skip the record
-			{
-				LARGE_INTEGER skip;
-				skip.HighPart = 0;
-				skip.LowPart = recLen;
-				if (FAILED(hr = gameStream->Seek(skip, STREAM_SEEK_CUR, NULL)))
-					return hr;
-			}
+			if (recLen < 0 || gameStream.Skip(recLen) != (size_t)recLen)
+				return STG_E_READFAULT;
 			break;
 		}
 	}
@@ -231,3 +204,111 @@ HRESULT VPFileReader::Read(const WCHAR *filename, bool getScript)
 	// success
 	return S_OK;
 }
+
+HRESULT VPFileReader::DecryptScript(INT32 len)
+{
+	// Set up a cryptography context
+	HCRYPTPROVHolder hcp;
+	if (!CryptAcquireContext(&hcp, NULL, NULL, PROV_RSA_FULL,
+		CRYPT_VERIFYCONTEXT | CRYPT_NEWKEYSET | CRYPT_SILENT))
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	// Initialize an MD5 hasher for the password decryption
+	static const BYTE HASH_INIT_VECTOR[] = "Visual Pinball";
+	HCRYPTHASHHolder hchkey;
+	if (!CryptCreateHash(hcp, CALG_MD5, NULL, 0, &hchkey)
+		|| !CryptHashData(hchkey, HASH_INIT_VECTOR, 14, 0))
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	// Initialize the password decryption key according to the file version
+	HCRYPTKEYHolder hPasswordKey;
+	if (!CryptDeriveKey(hcp, CALG_RC2, hchkey,
+		(fileVersion == 600) ? CRYPT_EXPORTABLE : (CRYPT_EXPORTABLE | 0x00280000),
+		&hPasswordKey))
+		return HRESULT_FROM_WIN32(GetLastError());
+
+	// decrypt the script in place
+	DWORD cryptLen = len;
+	CryptDecrypt(hPasswordKey, NULL, TRUE, 0, (BYTE*)script.get(), &cryptLen);
+	return S_OK;
+}
+
+bool VPFileReader::GetScriptRomName(TSTRING &romName) const
+{
+	// we need the script to find the ROM name
+	if (script == nullptr)
+		return false;
+
+	// VPinMAME tables conventionally set the ROM name in a script
+	// constant, as in 'Const cGameName = "afm_113b"'.  Look for the
+	// first assignment to cGameName with a string literal value.
+	static const char varName[] = "cgamename";
+	const size_t varLen = sizeof(varName) - 1;
+	for (const char *p = script.get(); *p != 0; ++p)
+	{
+		// check for the variable name, ignoring case
+		if (_strnicmp(p, varName, varLen) != 0)
+			continue;
+
+		// make sure it's not part of a longer identifier
+		if (p != script.get() && (isalnum((BYTE)p[-1]) || p[-1] == '_'))
+			continue;
+
+		// skip spaces and the '=', then look for the opening quote
+		const char *q = p + varLen;
+		for (; *q == ' ' || *q == '\t'; ++q);
+		if (*q++ != '=')
+			continue;
+		for (; *q == ' ' || *q == '\t'; ++q);
+		if (*q++ != '"')
+			continue;
+
+		// the name runs to the closing quote, which must be on the same line
+		const char *end = q;
+		for (; *end != '"' && *end != 0 && *end != '\n' && *end != '\r'; ++end);
+		if (*end != '"' || end == q)
+			continue;
+
+		// got it
+		romName = AnsiToTSTRING(CSTRING(q, end - q).c_str());
+		return true;
+	}
+
+	// not found
+	return false;
+}
+
+void VPFileReader::ReadBatch(std::vector<BatchItem> &items, bool getScript)
+{
+	// Each file is independent, so read them on the worker pool.  The
+	// reader doesn't throw exceptions, so there's nothing to propagate.
+	std::vector<std::function<void()>> tasks;
+	tasks.reserve(items.size());
+	for (auto &item : items)
+	{
+		tasks.emplace_back([&item, getScript]()
+		{
+			item.reader.reset(new VPFileReader());
+			item.hr = item.reader->Read(item.filename.c_str(), getScript);
+		});
+	}
+
+	if (tasks.size() != 0)
+		RunParallel(tasks);
+}
+
+void VPFileReader::ReadFolder(const WCHAR *folder, std::vector<BatchItem> &items, bool getScript)
+{
+	// find the VP table files in the folder
+	items.clear();
+	std::error_code ec;
+	for (auto &file : fs::directory_iterator(folder, ec))
+	{
+		const wchar_t *fname = file.path().c_str();
+		if (tstriEndsWith(fname, _T(".vpx")) || tstriEndsWith(fname, _T(".vpt")))
+			items.emplace_back(fname);
+	}
+
+	// read them
+	ReadBatch(items, getScript);
+}
@@ -11,6 +11,32 @@ public:
 
 	HRESULT Read(const WCHAR *filename, bool getScript);
 
+	// Get the ROM name from the script, if possible.  This looks for
+	// the conventional cGameName constant that VPinMAME tables use to
+	// select the ROM.  The script must have been loaded.
+	bool GetScriptRomName(TSTRING &romName) const;
+
+	// Batch read item
+	struct BatchItem
+	{
+		BatchItem(const WCHAR *filename) : filename(filename), hr(E_PENDING) { }
+
+		// file to read
+		WSTRING filename;
+
+		// result of the read, and the reader with the loaded data
+		HRESULT hr;
+		std::unique_ptr<VPFileReader> reader;
+	};
+
+	// Read a batch of files in parallel, on a pool of worker threads.
+	// This fills in the result and reader for each item.
+	static void ReadBatch(std::vector<BatchItem> &items, bool getScript);
+
+	// Read all of the VP table files (.vpx and .vpt) in a folder, in
+	// parallel.  This populates 'items' with the files found.
+	static void ReadFolder(const WCHAR *folder, std::vector<BatchItem> &items, bool getScript);
+
 	// Version loaded from the file
 	INT32 fileVersion;
 
@@ -51,4 +77,8 @@ public:
 		INT32   reserved[2];
 	} protection;
 
+protected:
+	// decrypt the script text, for a protected file
+	HRESULT DecryptScript(INT32 len);
+
 };
@@ -0,0 +1,234 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Video frame ring
+
+#include "stdafx.h"
+#include "VideoFrameRing.h"
+
+VideoFrameRing::VideoFrameRing() :
+	nSlots(0),
+	buf(nullptr),
+	slotSize(0),
+	mailbox(NoSlot),
+	nextSeq(0),
+	presentedSeq(0)
+{
+	ResetStats();
+}
+
+VideoFrameRing::~VideoFrameRing()
+{
+	Deallocate();
+}
+
+bool VideoFrameRing::Allocate(int nSlots, size_t bufSize, size_t align)
+{
+	// discard any existing buffers
+	Deallocate();
+
+	// Round the buffer size up to the alignment, so that every slot
+	// starts on an aligned boundary within the single allocation.
+	slotSize = (bufSize + align - 1) & ~(align - 1);
+
+	// allocate the buffer memory, with room for the scratch slot
+	if ((buf = static_cast<BYTE*>(_mm_malloc(slotSize * (nSlots + 1), align))) == nullptr)
+		return false;
+
+	// set up the slot descriptors, all initially free
+	slots.reset(new Slot[nSlots]);
+	for (int i = 0; i < nSlots; ++i)
+	{
+		slots[i].state = Free;
+		slots[i].seq = 0;
+		slots[i].unlockTime_us = 0;
+	}
+
+	// the ring is now ready
+	this->nSlots = nSlots;
+	mailbox = NoSlot;
+	nextSeq = 0;
+	presentedSeq = 0;
+	return true;
+}
+
+void VideoFrameRing::Deallocate()
+{
+	if (buf != nullptr)
+	{
+		_mm_free(buf);
+		buf = nullptr;
+	}
+	slots.reset();
+	nSlots = 0;
+	slotSize = 0;
+	mailbox = NoSlot;
+}
+
+int VideoFrameRing::Lock()
+{
+	// if the ring hasn't been allocated, there's nothing to hand out
+	if (nSlots == 0)
+		return NoSlot;
+
+	// look for a free slot
+	for (int i = 0; i < nSlots; ++i)
+	{
+		if (ChangeState(i, Free, Locked))
+		{
+			slots[i].seq = ++nextSeq;
+			return i;
+		}
+	}
+
+	// No free slots.  Look for a decoded frame that's older than the
+	// newest presented frame.  Frames are presented in decoding order,
+	// so the decoder has skipped any such frame, and it will never be
+	// presented.  Reclaim it.  Note that the compare-and-swap makes
+	// this safe even if the presenter is looking at the same slot: one
+	// of us will win the state change, and the other will back off.
+	LONG64 curPresentedSeq = presentedSeq;
+	for (int i = 0; i < nSlots; ++i)
+	{
+		if (slots[i].state == Valid && slots[i].seq < curPresentedSeq && ChangeState(i, Valid, Locked))
+		{
+			Count(nDropped);
+			slots[i].seq = ++nextSeq;
+			return i;
+		}
+	}
+
+	// Still nothing available.  Rather than stalling the decoder until
+	// the renderer catches up, let it decode into the scratch buffer.
+	// That frame will be discarded when presented.
+	Count(nStarved);
+	return nSlots;
+}
+
+void VideoFrameRing::Unlock(int slot, INT64 time_us)
+{
+	// ignore the scratch slot, which doesn't have a state
+	if (slot < 0 || slot >= nSlots)
+		return;
+
+	// note the time, and mark the frame as valid
+	slots[slot].unlockTime_us = time_us;
+	Count(nDecoded);
+	InterlockedExchange(&slots[slot].state, Valid);
+}
+
+void VideoFrameRing::SetPresentedSeq(LONG64 seq)
+{
+	// Advance the presented sequence number, but never move it
+	// backwards.  Only the presentation thread writes this, so a
+	// simple compare is sufficient.
+	if (seq > presentedSeq)
+		InterlockedExchange64(&presentedSeq, seq);
+}
+
+bool VideoFrameRing::Present(int slot)
+{
+	// frames in the scratch slot are always dropped
+	if (slot < 0 || slot >= nSlots)
+	{
+		Count(nDropped);
+		return false;
+	}
+
+	// Advance the frame to Presented.  If it's not in the Valid state,
+	// the decoder reclaimed it as stale, or it was already presented;
+	// either way, there's nothing more to do.
+	if (!ChangeState(slot, Valid, Presented))
+		return false;
+
+	// this is now the newest presented frame
+	SetPresentedSeq(slots[slot].seq);
+	Count(nPresented);
+
+	// Post it to the mailbox.  If the mailbox held an earlier frame
+	// that the renderer never picked up, that frame is now stale, so
+	// return it to the pool.
+	LONG prv = InterlockedExchange(&mailbox, slot);
+	if (prv != NoSlot && prv != slot)
+	{
+		Count(nDropped);
+		InterlockedExchange(&slots[prv].state, Free);
+	}
+
+	// presented
+	return true;
+}
+
+bool VideoFrameRing::PresentDirect(int slot, INT64 time_us)
+{
+	// frames in the scratch slot are always dropped
+	if (slot < 0 || slot >= nSlots)
+	{
+		Count(nDropped);
+		return false;
+	}
+
+	// move the frame straight to Rendering
+	if (!ChangeState(slot, Valid, Rendering))
+		return false;
+
+	// update the statistics as though it had gone through the mailbox
+	SetPresentedSeq(slots[slot].seq);
+	Count(nPresented);
+	Count(nRendered);
+	INT64 latency = time_us - slots[slot].unlockTime_us;
+	InterlockedAdd64(&latencyTotal_us, latency);
+	CountMax(latencyMax_us, latency);
+
+	// the caller now owns the frame
+	return true;
+}
+
+int VideoFrameRing::Take(INT64 time_us)
+{
+	// take whatever is in the mailbox, leaving it empty
+	LONG slot = InterlockedExchange(&mailbox, NoSlot);
+	if (slot == NoSlot)
+		return NoSlot;
+
+	// The slot is ours now.  Once it's out of the mailbox, neither the
+	// decoder nor the presenter will touch it until we release it.
+	InterlockedExchange(&slots[slot].state, Rendering);
+
+	// update the statistics
+	Count(nRendered);
+	INT64 latency = time_us - slots[slot].unlockTime_us;
+	InterlockedAdd64(&latencyTotal_us, latency);
+	CountMax(latencyMax_us, latency);
+
+	// return the slot
+	return slot;
+}
+
+void VideoFrameRing::Release(int slot)
+{
+	if (slot >= 0 && slot < nSlots)
+		InterlockedExchange(&slots[slot].state, Free);
+}
+
+void VideoFrameRing::GetStats(Stats &s) const
+{
+	s.nDecoded = nDecoded;
+	s.nPresented = nPresented;
+	s.nRendered = nRendered;
+	s.nDropped = nDropped;
+	s.nStarved = nStarved;
+	s.latencyTotal_us = latencyTotal_us;
+	s.latencyMax_us = latencyMax_us;
+}
+
+void VideoFrameRing::ResetStats()
+{
+	nDecoded = 0;
+	nPresented = 0;
+	nRendered = 0;
+	nDropped = 0;
+	nStarved = 0;
+	latencyTotal_us = 0;
+	latencyMax_us = 0;
+}
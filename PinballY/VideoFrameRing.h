@@ -0,0 +1,233 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Video frame ring
+//
+// This is the frame buffer pool that sits between a video decoder and
+// the renderer.  The decoder (libvlc, in practice) asks for an empty
+// buffer, decodes a frame into it, and later "presents" the frame when
+// its presentation time arrives.  The renderer, running in the UI
+// thread, picks up the most recently presented frame each time it
+// draws a video frame, copies the pixels to the GPU, and hands the
+// buffer back for re-use.
+//
+// The ring is designed so that none of the threads involved ever
+// waits for another:
+//
+// - Buffer ownership is tracked with a per-slot state word, changed
+//   only with interlocked compare-and-swap operations, so no locks
+//   are needed for the per-frame hand-offs.
+//
+// - The hand-off from the presenter to the renderer goes through a
+//   single-entry "mailbox" that always holds the newest presented
+//   frame.  If the presenter posts a new frame before the renderer
+//   has picked up the previous one, the previous one is stale (the
+//   renderer would never show it anyway), so it's simply returned to
+//   the free pool and counted as dropped.
+//
+// - If the decoder asks for a buffer when none are free, we first
+//   look for a decoded frame that's older than the last presented
+//   frame.  Since frames are presented in decoding order, such a frame
+//   has been skipped by the decoder and will never be presented, so we
+//   can reclaim it.  If there's still nothing available, we give the
+//   decoder a scratch buffer whose contents are discarded.  The frame
+//   decoded into it is lost, but the decoder doesn't stall, which
+//   would be worse: stalling the decoder delays every frame after it.
+//
+// The ring has no GPU or libvlc dependencies.  It only manages memory
+// buffers and their states, so it can be exercised on its own.
+//
+// Threading: Lock() and Unlock() are called on the decoder thread;
+// Present() and PresentDirect() on the presentation thread (which can
+// be the same as the decoder thread); Take() and Release() on the
+// renderer thread.  Allocate() and Deallocate() must not run
+// concurrently with any of the other operations; the owner is
+// responsible for serializing them.
+//
+
+#pragma once
+
+class VideoFrameRing
+{
+public:
+	VideoFrameRing();
+	~VideoFrameRing();
+
+	// Allocate the buffers.  'nSlots' is the number of buffers in the
+	// pool, not counting the scratch buffer, and 'bufSize' is the size
+	// in bytes of each buffer.  Each buffer is aligned on an 'align'
+	// byte boundary, which must be a power of 2.  Any existing buffers
+	// are freed first.  Returns false if the memory can't be allocated.
+	bool Allocate(int nSlots, size_t bufSize, size_t align);
+
+	// Free the buffers
+	void Deallocate();
+
+	// Get the number of slots, not counting the scratch buffer
+	int GetSlotCount() const { return nSlots; }
+
+	// Get a slot's buffer.  'slot' can be the scratch slot.
+	BYTE *GetBuffer(int slot) const { return buf + slot * slotSize; }
+
+	// Invalid slot number
+	static const int NoSlot = -1;
+
+	// Is the given slot the scratch slot?
+	bool IsScratch(int slot) const { return slot == nSlots; }
+
+	// Lock a buffer for decoding.  This always returns a buffer once
+	// the ring has been allocated, returning the scratch slot if no
+	// other buffers are available.  Returns NoSlot if the ring hasn't
+	// been allocated.
+	int Lock();
+
+	// Unlock a buffer after decoding a frame into it.  'time_us' is
+	// the current time in microseconds, which we use to measure the
+	// latency until the frame is taken by the renderer.
+	void Unlock(int slot, INT64 time_us);
+
+	// Present a frame.  This posts the frame to the mailbox for the
+	// renderer to pick up, replacing (and dropping) any frame that
+	// was posted earlier but hasn't been taken yet.  Returns false if
+	// the frame was dropped instead.
+	bool Present(int slot);
+
+	// Present a frame directly, without going through the mailbox,
+	// for a consumer that processes frames in the presentation thread
+	// as they arrive.  On success, the frame is in the Rendering state,
+	// exactly as though it had been presented and then taken, and the
+	// caller must Release() it when done.  Returns false if the frame
+	// was dropped.
+	bool PresentDirect(int slot, INT64 time_us);
+
+	// Is a presented frame waiting to be taken?
+	bool HasPresentedFrame() const { return mailbox != NoSlot; }
+
+	// Take the newest presented frame for rendering.  Returns NoSlot
+	// if no new frame has been presented since the last call.  The
+	// caller must Release() the slot when done with the pixels.
+	int Take(INT64 time_us);
+
+	// Release a slot taken for rendering, returning it to the pool
+	void Release(int slot);
+
+	// Statistics
+	struct Stats
+	{
+		Stats() { memset(this, 0, sizeof(*this)); }
+
+		// frames decoded into pool buffers
+		UINT64 nDecoded;
+
+		// frames presented, and frames taken by the renderer
+		UINT64 nPresented;
+		UINT64 nRendered;
+
+		// Frames dropped.  This counts frames replaced in the mailbox
+		// before the renderer took them, stale decoded frames that we
+		// reclaimed, and frames decoded into the scratch buffer.
+		UINT64 nDropped;
+
+		// Number of times the decoder asked for a buffer when none
+		// were available, so that we had to hand out the scratch buffer
+		UINT64 nStarved;
+
+		// Decode-to-render latency: the time between Unlock() and
+		// Take() for each rendered frame, in microseconds
+		INT64 latencyTotal_us;
+		INT64 latencyMax_us;
+
+		// average latency in microseconds
+		double GetAvgLatency_us() const { return nRendered != 0 ? double(latencyTotal_us) / double(nRendered) : 0.0; }
+	};
+
+	// Get a snapshot of the statistics
+	void GetStats(Stats &s) const;
+
+	// Reset the statistics
+	void ResetStats();
+
+protected:
+	// slot states
+	enum SlotState
+	{
+		Free,         // available for decoding
+		Locked,       // the decoder is writing a frame into the buffer
+		Valid,        // contains a decoded frame, not yet presented
+		Presented,    // presented, waiting in the mailbox
+		Rendering     // taken by the renderer
+	};
+
+	// slot descriptor
+	struct Slot
+	{
+		// current state, as a SlotState value
+		volatile LONG state;
+
+		// Lock sequence number.  This is assigned from a counter each
+		// time the slot is locked, so it gives the decoding order.
+		volatile LONG64 seq;
+
+		// time of the Unlock(), in microseconds
+		INT64 unlockTime_us;
+	};
+
+	// Change a slot's state from 'from' to 'to', if it's currently in
+	// state 'from'.  Returns true if the state was changed.
+	bool ChangeState(int slot, SlotState from, SlotState to)
+	{
+		return InterlockedCompareExchange(&slots[slot].state, to, from) == (LONG)from;
+	}
+
+	// increment a statistics counter
+	static void Count(volatile LONG64 &ctr) { InterlockedIncrement64(&ctr); }
+
+	// Raise a statistics maximum to 'val', if 'val' is higher.  This
+	// uses a compare-and-swap loop, so that a concurrent update from
+	// another thread can't replace a higher value with a lower one.
+	static void CountMax(volatile LONG64 &ctr, LONG64 val)
+	{
+		for (LONG64 cur = ctr; val > cur; )
+		{
+			LONG64 prv = InterlockedCompareExchange64(&ctr, val, cur);
+			if (prv == cur)
+				break;
+			cur = prv;
+		}
+	}
+
+	// Record a presented frame's sequence number as the newest presented
+	void SetPresentedSeq(LONG64 seq);
+
+	// number of slots, not counting the scratch slot
+	int nSlots;
+
+	// slot descriptors
+	std::unique_ptr<Slot[]> slots;
+
+	// Buffer memory.  This is a single allocation holding all of the
+	// slot buffers end to end, with the scratch buffer at the end.
+	BYTE *buf;
+
+	// size of each slot's buffer, rounded up to the alignment
+	size_t slotSize;
+
+	// Mailbox: the most recently presented slot not yet taken by the
+	// renderer, or NoSlot
+	volatile LONG mailbox;
+
+	// next lock sequence number; only accessed by the decoder thread
+	LONG64 nextSeq;
+
+	// sequence number of the newest presented frame
+	volatile LONG64 presentedSeq;
+
+	// statistics counters
+	volatile LONG64 nDecoded;
+	volatile LONG64 nPresented;
+	volatile LONG64 nRendered;
+	volatile LONG64 nDropped;
+	volatile LONG64 nStarved;
+	volatile LONG64 latencyTotal_us;
+	volatile LONG64 latencyMax_us;
+};
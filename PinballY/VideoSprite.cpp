@@ -124,6 +124,19 @@ bool VideoSprite::LoadVideo(
 	return true;
 }
 
+// Do we need to render?  We do if the base sprite does, or if the
+// video player has a new frame to show.
+bool VideoSprite::NeedsRender() const
+{
+	return __super::NeedsRender() || (videoPlayer != nullptr && videoPlayer->IsNewFrameReady());
+}
+
+// We're animating as long as the video is playing
+bool VideoSprite::IsAnimating() const
+{
+	return __super::IsAnimating() || (videoPlayer != nullptr && videoPlayer->IsPlaying());
+}
+
 // Render the video
 void VideoSprite::Render(Camera *camera)
 {
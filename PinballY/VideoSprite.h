@@ -26,6 +26,10 @@ public:
 	// Render the video
 	virtual void Render(Camera *camera) override;
 
+	// render scheduling status
+	virtual bool NeedsRender() const override;
+	virtual bool IsAnimating() const override;
+
 	// Do we have a video?
 	bool IsVideo() const { return videoPlayer != nullptr; }
 
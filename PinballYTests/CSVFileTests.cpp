@@ -0,0 +1,186 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// CSVFile tests and benchmarks
+//
+// CSVFile reads single-byte and UTF-8 files through a memory mapping,
+// and UTF-16 files through the original wide-character parser.  These
+// tests feed the same text through both readers and check that they
+// produce the same field values, which is how we verify that the
+// mapped reader parses quoted and stuttered-quote fields exactly the
+// way the original parser does.
+
+#include "stdafx.h"
+#include "../PinballY/CSVFile.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Write a copy of a multibyte file in UTF-16 format with a byte
+	// order mark, so that CSVFile reads it with the wide parser
+	bool WriteUTF16(TempFile &file, const char *text, size_t len, UINT codePage)
+	{
+		int wlen = MultiByteToWideChar(codePage, 0, text, (int)len, NULL, 0);
+		std::vector<WCHAR> buf(wlen + 1);
+		buf[0] = 0xFEFF;
+		MultiByteToWideChar(codePage, 0, text, (int)len, buf.data() + 1, wlen);
+		return file.Write(buf.data(), buf.size() * sizeof(WCHAR));
+	}
+
+	// Read a file into a CSVFile
+	bool ReadCSV(TestContext &t, CSVFile &csv, const TCHAR *filename, UINT codePage)
+	{
+		CapturingErrorHandler eh;
+		csv.SetFile(filename);
+		if (!csv.Read(eh, codePage))
+		{
+			t.Fail("error reading %ws", filename);
+			return false;
+		}
+		return true;
+	}
+
+	// Compare every field of two files, for the given columns
+	void CompareCSV(TestContext &t, CSVFile &a, CSVFile &b, std::initializer_list<const TCHAR*> colNames)
+	{
+		if (!CHECK(a.GetNumRows() == b.GetNumRows()))
+			return;
+
+		for (auto colName : colNames)
+		{
+			auto ca = a.DefineColumn(colName), cb = b.DefineColumn(colName);
+			for (int row = 0, n = (int)a.GetNumRows(); row < n; ++row)
+			{
+				// compare the values, distinguishing null from empty
+				const TCHAR *va = ca->Get(row), *vb = cb->Get(row);
+				if ((va == nullptr) != (vb == nullptr) || (va != nullptr && _tcscmp(va, vb) != 0))
+				{
+					t.Fail("row %d, column %ws: \"%ws\" vs \"%ws\"", row, colName,
+						va != nullptr ? va : _T("<null>"), vb != nullptr ? vb : _T("<null>"));
+					return;
+				}
+			}
+		}
+	}
+}
+
+// Quoting and stuttered quotes, including fields that straddle the
+// 16-byte blocks the mapped reader scans at a time
+TEST_CASE(CSVQuotedFields)
+{
+	static const char text[] =
+		"A,B,C,D\r\n"
+		"plain,\"quoted, comma\",\"say \"\"hi\"\"\",\"\"\r\n"
+		"\"\"\"lead\",\"trail\"\"\",\"a\"\"\"\"b\",\"multi\r\nline\"\r\n"
+		",,,\r\n"
+		"\"a long field that runs past sixteen bytes, with \"\"quotes\"\" in the middle\",x,\"\"\"\"\"\",y\r\n"
+		"\r\n\r\n"
+		"\"bad\"junk,\"unterminated\n"
+		"last,row,no,newline";
+
+	TempFile mb, wide;
+	if (!CHECK(mb.Write(text, sizeof(text) - 1)) || !CHECK(WriteUTF16(wide, text, sizeof(text) - 1, CP_ACP)))
+		return;
+
+	CSVFile a, b;
+	if (!ReadCSV(t, a, mb.GetPath(), CP_ACP) || !ReadCSV(t, b, wide.GetPath(), CP_ACP))
+		return;
+
+	// the two readers must agree on every field
+	CompareCSV(t, a, b, { _T("A"), _T("B"), _T("C"), _T("D") });
+
+	// spot-check the decoded values
+	auto A = a.DefineColumn(_T("A")), B = a.DefineColumn(_T("B")), C = a.DefineColumn(_T("C"));
+	CHECK(_tcscmp(B->Get(0, _T("")), _T("quoted, comma")) == 0);
+	CHECK(_tcscmp(C->Get(0, _T("")), _T("say \"hi\"")) == 0);
+	CHECK(_tcscmp(A->Get(1, _T("")), _T("\"lead")) == 0);
+	CHECK(_tcscmp(B->Get(1, _T("")), _T("trail\"")) == 0);
+	CHECK(_tcscmp(C->Get(1, _T("")), _T("a\"\"b")) == 0);
+	CHECK(_tcscmp(C->Get(3, _T("")), _T("\"\"")) == 0);
+}
+
+// The mapped reader must match the wide reader on the IPDB list
+TEST_CASE(CSVReferenceListMatchesWideReader)
+{
+	std::filesystem::path path;
+	if (!FindSourceTreeFile(path, "assets/ipdbTableList.csv"))
+	{
+		t.Fail("assets/ipdbTableList.csv not found");
+		return;
+	}
+
+	// make a UTF-16 copy for the wide reader
+	std::vector<char> text;
+	{
+		std::ifstream f(path, std::ios::binary);
+		text.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	}
+	TempFile wide;
+	if (!CHECK(WriteUTF16(wide, text.data(), text.size(), 1252)))
+		return;
+
+	CSVFile a, b;
+	if (!ReadCSV(t, a, path.c_str(), 1252) || !ReadCSV(t, b, wide.GetPath(), 1252))
+		return;
+
+	CHECK(a.GetNumRows() > 6000);
+	CompareCSV(t, a, b, { _T("Name"), _T("AltName"), _T("Manufacturer"), _T("ManufacturerShort"),
+		_T("Year"), _T("Players"), _T("Type"), _T("Theme") });
+}
+
+// Parse throughput on the IPDB list
+BENCHMARK(CSVReadReferenceList)
+{
+	std::filesystem::path path;
+	if (!FindSourceTreeFile(path, "assets/ipdbTableList.csv"))
+	{
+		t.Fail("assets/ipdbTableList.csv not found");
+		return;
+	}
+
+	std::vector<char> text;
+	{
+		std::ifstream f(path, std::ios::binary);
+		text.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+	}
+	TempFile wide;
+	if (!CHECK(WriteUTF16(wide, text.data(), text.size(), 1252)))
+		return;
+
+	// Time a read of the list, optionally followed by a pass that fetches
+	// every field, as RefTableList's index build does for the names.
+	static const TCHAR *cols[] = { _T("Name"), _T("AltName"), _T("Manufacturer"), _T("ManufacturerShort"),
+		_T("Year"), _T("Players"), _T("Type"), _T("Theme") };
+	auto Time = [&t, &cols](const TCHAR *filename, bool touchAll)
+	{
+		const int nPasses = 20;
+		Stopwatch sw;
+		for (int pass = 0; pass < nPasses; ++pass)
+		{
+			CSVFile csv;
+			if (!ReadCSV(t, csv, filename, 1252))
+				return 0.0;
+
+			if (touchAll)
+			{
+				for (auto colName : cols)
+				{
+					auto col = csv.DefineColumn(colName);
+					for (int row = 0, n = (int)csv.GetNumRows(); row < n; ++row)
+						col->Get(row);
+				}
+			}
+		}
+		return sw.ElapsedMs() / nPasses;
+	};
+
+	double mb = double(text.size()) / (1024.0 * 1024.0);
+	auto Report = [&t, mb](const char *desc, double ms) {
+		t.Log("%-40s %8.2f ms  %8.1f MB/s", desc, ms, mb / (ms / 1000.0));
+	};
+	t.Log("%d bytes", (int)text.size());
+	Report("Mapped read", Time(path.c_str(), false));
+	Report("Mapped read, fetch all fields", Time(path.c_str(), true));
+	Report("Wide read (UTF-16 copy)", Time(wide.GetPath(), false));
+	Report("Wide read (UTF-16 copy), fetch all fields", Time(wide.GetPath(), true));
+}
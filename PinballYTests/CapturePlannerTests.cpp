@@ -0,0 +1,464 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Media capture planner tests
+
+#include "stdafx.h"
+#include <shellapi.h>
+#include <sstream>
+#include "../PinballY/CapturePlanner.h"
+#include "TestHarness.h"
+
+#pragma comment(lib, "shell32.lib")
+
+namespace
+{
+	// ffmpeg command line, parsed the way ffmpeg reads it: each input
+	// and output is preceded by the options that apply to it.  For the
+	// options the planner uses, every option takes a value.
+	struct ParsedCommand
+	{
+		struct Target
+		{
+			// options, in command line order
+			std::vector<std::pair<TSTRING, TSTRING>> opts;
+
+			// input name or output filename
+			TSTRING name;
+
+			// is the option present?
+			bool Has(const TCHAR *opt) const
+			{
+				return std::any_of(opts.begin(), opts.end(), [opt](const std::pair<TSTRING, TSTRING> &o) { return o.first == opt; });
+			}
+
+			// get the first value of an option, or an empty string if it's not present
+			TSTRING Opt(const TCHAR *opt) const
+			{
+				auto it = std::find_if(opts.begin(), opts.end(), [opt](const std::pair<TSTRING, TSTRING> &o) { return o.first == opt; });
+				return it != opts.end() ? it->second : TSTRING();
+			}
+
+			// get all of the values of an option
+			std::vector<TSTRING> All(const TCHAR *opt) const
+			{
+				std::vector<TSTRING> v;
+				for (auto &o : opts)
+				{
+					if (o.first == opt)
+						v.push_back(o.second);
+				}
+				return v;
+			}
+		};
+
+		TSTRING program;
+		std::vector<Target> inputs;
+		std::vector<Target> outputs;
+	};
+
+	// Parse a command line.  Returns false if it's malformed (an option
+	// without a value, or options after the last output).
+	bool Parse(const TSTRING &cmdline, ParsedCommand &cmd)
+	{
+		int argc;
+		LPWSTR *argv = CommandLineToArgvW(cmdline.c_str(), &argc);
+		if (argv == nullptr)
+			return false;
+
+		bool ok = true;
+		cmd.program = argv[0];
+		ParsedCommand::Target cur;
+		for (int i = 1; i < argc && ok; ++i)
+		{
+			if (argv[i][0] != '-')
+			{
+				// output file
+				cur.name = argv[i];
+				cmd.outputs.emplace_back(std::move(cur));
+				cur = ParsedCommand::Target();
+			}
+			else if (i + 1 >= argc)
+			{
+				// option without a value
+				ok = false;
+			}
+			else if (wcscmp(argv[i], L"-i") == 0)
+			{
+				// input
+				cur.name = argv[++i];
+				cmd.inputs.emplace_back(std::move(cur));
+				cur = ParsedCommand::Target();
+			}
+			else
+			{
+				// option for the next input or output
+				cur.opts.emplace_back(argv[i], argv[i + 1]);
+				++i;
+			}
+		}
+
+		LocalFree(argv);
+		return ok && cur.opts.size() == 0;
+	}
+
+	typedef std::vector<TSTRING> Strings;
+
+	// window areas
+	const RECT rcPlayfield = { 0, 0, 1920, 1080 };
+	const RECT rcBackglass = { 1920, 0, 3200, 1024 };
+	const RECT rcDMD = { 1920, 1024, 2432, 1152 };
+
+	// Build the item list for a typical full capture: the playfield image
+	// and video (which share a window), the backglass video, and the DMD
+	// video, with rotations and audio on some of them
+	void TypicalItems(std::vector<CapturePlanner::Item> &items, const TSTRING &dir)
+	{
+		items.emplace_back(_T("Playfield image"), (dir + _T("\\Playfield Image.png")).c_str(), rcPlayfield, 90, false, false, 0);
+		items.emplace_back(_T("Playfield video"), (dir + _T("\\Playfield Video.mp4")).c_str(), rcPlayfield, 90, true, true, 20000);
+		items.emplace_back(_T("Backglass video"), (dir + _T("\\Backglass Video.mp4")).c_str(), rcBackglass, 0, true, false, 10000);
+		items.emplace_back(_T("DMD video"), (dir + _T("\\DMD Video.mp4")).c_str(), rcDMD, 180, true, true, 15000);
+	}
+
+	// is the input a screen capture of the given area?
+	bool IsGrab(const ParsedCommand::Target &input, const RECT &rc)
+	{
+		return input.Opt(_T("-f")) == _T("gdigrab")
+			&& input.name == _T("desktop")
+			&& input.Opt(_T("-offset_x")) == std::to_wstring(rc.left)
+			&& input.Opt(_T("-offset_y")) == std::to_wstring(rc.top)
+			&& input.Opt(_T("-video_size")) == MsgFmt(_T("%dx%d"), rc.right - rc.left, rc.bottom - rc.top).Get();
+	}
+
+	// is the input the audio device?
+	bool IsAudio(const ParsedCommand::Target &input, const TCHAR *device)
+	{
+		return input.Opt(_T("-f")) == _T("dshow") && input.name == MsgFmt(_T("audio=%s"), device).Get();
+	}
+}
+
+// Combined mode: one step, with one input per distinct window plus
+// the audio device, and one output per item with its own mapping,
+// rotation, and time limit
+TEST_CASE(CapturePlannerCombined)
+{
+	std::vector<CapturePlanner::Item> items;
+	TypicalItems(items, _T("C:\\Media"));
+	CapturePlanner::Options opts;
+	opts.ffmpeg = _T("C:\\PinballY\\ffmpeg\\ffmpeg.exe");
+	opts.audioDevice = _T("Stereo Mix");
+
+	CapturePlanner::Plan plan;
+	CapturePlanner::MakePlan(items, opts, plan);
+	CHECK(plan.encode.size() == 0);
+	if (!CHECK(plan.capture.size() == 1))
+		return;
+
+	// the step covers all of the items, and runs as long as the longest one
+	auto &step = plan.capture[0];
+	CHECK(step.items == std::vector<size_t>({ 0, 1, 2, 3 }));
+	CHECK(step.time == 20000);
+	CHECK(step.tempFiles.size() == 0);
+
+	ParsedCommand cmd;
+	if (!CHECK(Parse(step.cmdline, cmd)))
+		return;
+	CHECK(cmd.program == opts.ffmpeg);
+
+	// the playfield image and video share an input
+	if (CHECK(cmd.inputs.size() == 4))
+	{
+		CHECK(IsGrab(cmd.inputs[0], rcPlayfield));
+		CHECK(IsGrab(cmd.inputs[1], rcBackglass));
+		CHECK(IsGrab(cmd.inputs[2], rcDMD));
+		CHECK(IsAudio(cmd.inputs[3], _T("Stereo Mix")));
+	}
+
+	if (CHECK(cmd.outputs.size() == 4))
+	{
+		auto &o = cmd.outputs;
+		for (size_t i = 0; i < 4; ++i)
+			CHECK(o[i].name == items[i].filename);
+
+		// playfield image: one frame, rotated, no time limit
+		CHECK(o[0].All(_T("-map")) == Strings({ _T("0:v") }));
+		CHECK(o[0].Opt(_T("-vframes")) == _T("1"));
+		CHECK(o[0].Opt(_T("-vf")) == _T("transpose=1"));
+		CHECK(!o[0].Has(_T("-t")));
+
+		// playfield video: same input, with audio
+		CHECK(o[1].All(_T("-map")) == Strings({ _T("0:v"), _T("3:a") }));
+		CHECK(o[1].Opt(_T("-vf")) == _T("transpose=1"));
+		CHECK(o[1].Opt(_T("-t")) == _T("20"));
+
+		// backglass video: silent, not rotated
+		CHECK(o[2].All(_T("-map")) == Strings({ _T("1:v") }));
+		CHECK(!o[2].Has(_T("-vf")));
+		CHECK(o[2].Opt(_T("-t")) == _T("10"));
+
+		// DMD video: with audio, upside down
+		CHECK(o[3].All(_T("-map")) == Strings({ _T("2:v"), _T("3:a") }));
+		CHECK(o[3].Opt(_T("-vf")) == _T("hflip,vflip"));
+		CHECK(o[3].Opt(_T("-t")) == _T("15"));
+	}
+}
+
+// Without an audio device, there's no audio input, and nothing maps audio
+TEST_CASE(CapturePlannerNoAudioDevice)
+{
+	std::vector<CapturePlanner::Item> items;
+	TypicalItems(items, _T("C:\\Media"));
+	CapturePlanner::Options opts;
+	opts.ffmpeg = _T("ffmpeg.exe");
+
+	CapturePlanner::Plan plan;
+	CapturePlanner::MakePlan(items, opts, plan);
+	ParsedCommand cmd;
+	if (!CHECK(plan.capture.size() == 1) || !CHECK(Parse(plan.capture[0].cmdline, cmd)))
+		return;
+
+	CHECK(cmd.inputs.size() == 3);
+	for (auto &o : cmd.outputs)
+		CHECK(o.All(_T("-map")).size() == 1);
+}
+
+// Separate mode: one step per item, in the original order, each with
+// its own inputs
+TEST_CASE(CapturePlannerSeparate)
+{
+	std::vector<CapturePlanner::Item> items;
+	TypicalItems(items, _T("C:\\Media"));
+	CapturePlanner::Options opts;
+	opts.ffmpeg = _T("ffmpeg.exe");
+	opts.audioDevice = _T("Stereo Mix");
+	opts.combine = false;
+
+	CapturePlanner::Plan plan;
+	CapturePlanner::MakePlan(items, opts, plan);
+	CHECK(plan.encode.size() == 0);
+	if (!CHECK(plan.capture.size() == 4))
+		return;
+
+	const RECT *rc[] = { &rcPlayfield, &rcPlayfield, &rcBackglass, &rcDMD };
+	for (size_t i = 0; i < 4; ++i)
+	{
+		auto &step = plan.capture[i];
+		CHECK(step.items == std::vector<size_t>({ i }));
+		CHECK(step.time == (items[i].isVideo ? items[i].captureTime : 0));
+
+		// the item's window, plus the audio device if the item records audio
+		ParsedCommand cmd;
+		if (CHECK(Parse(step.cmdline, cmd)) && CHECK(cmd.outputs.size() == 1))
+		{
+			bool audio = items[i].withAudio;
+			if (CHECK(cmd.inputs.size() == (audio ? 2 : 1)))
+			{
+				CHECK(IsGrab(cmd.inputs[0], *rc[i]));
+				if (audio)
+					CHECK(IsAudio(cmd.inputs[1], _T("Stereo Mix")));
+			}
+
+			CHECK(cmd.outputs[0].name == items[i].filename);
+			CHECK(cmd.outputs[0].All(_T("-map")) == (audio ? Strings({ _T("0:v"), _T("1:a") }) : Strings({ _T("0:v") })));
+		}
+	}
+}
+
+// Two-pass mode: the capture step writes the videos to per-session
+// intermediate files, unrotated, and there's an encoding step for each
+// video that applies the rotation and writes the final file
+TEST_CASE(CapturePlannerTwoPass)
+{
+	std::vector<CapturePlanner::Item> items;
+	TypicalItems(items, _T("C:\\Media"));
+	CapturePlanner::Options opts;
+	opts.ffmpeg = _T("ffmpeg.exe");
+	opts.audioDevice = _T("Stereo Mix");
+	opts.twoPass = true;
+	opts.sessionId = 1234;
+
+	CapturePlanner::Plan plan;
+	CapturePlanner::MakePlan(items, opts, plan);
+	if (!CHECK(plan.capture.size() == 1) || !CHECK(plan.encode.size() == 3))
+		return;
+
+	// intermediate file names
+	Strings temps = {
+		_T("C:\\Media\\Playfield Video.tmp1234.mp4"),
+		_T("C:\\Media\\Backglass Video.tmp1234.mp4"),
+		_T("C:\\Media\\DMD Video.tmp1234.mp4")
+	};
+	auto &step = plan.capture[0];
+	CHECK(step.tempFiles == temps);
+	CHECK(step.time == 20000);
+
+	ParsedCommand cmd;
+	if (CHECK(Parse(step.cmdline, cmd)) && CHECK(cmd.outputs.size() == 4))
+	{
+		// the still image goes straight to its final file, rotated
+		CHECK(cmd.outputs[0].name == items[0].filename);
+		CHECK(cmd.outputs[0].Opt(_T("-vf")) == _T("transpose=1"));
+
+		// the videos go to the intermediate files, lossless and unrotated
+		for (size_t i = 1; i < 4; ++i)
+		{
+			auto &o = cmd.outputs[i];
+			CHECK(o.name == temps[i - 1]);
+			CHECK(o.Opt(_T("-c:v")) == _T("libx264"));
+			CHECK(o.Opt(_T("-crf")) == _T("0"));
+			CHECK(!o.Has(_T("-vf")));
+			CHECK(o.Opt(_T("-t")) == std::to_wstring(items[i].captureTime / 1000));
+		}
+	}
+
+	// each encoding step reads one intermediate file and writes the final file
+	const TCHAR *vf[] = { _T("transpose=1"), _T(""), _T("hflip,vflip") };
+	for (size_t k = 0; k < 3; ++k)
+	{
+		auto &enc = plan.encode[k];
+		size_t i = k + 1;
+		CHECK(enc.items == std::vector<size_t>({ i }));
+		CHECK(enc.tempFiles == Strings({ temps[k] }));
+		CHECK(enc.time == items[i].captureTime * 3 / 2);
+
+		ParsedCommand ecmd;
+		if (CHECK(Parse(enc.cmdline, ecmd)) && CHECK(ecmd.inputs.size() == 1) && CHECK(ecmd.outputs.size() == 1))
+		{
+			CHECK(ecmd.inputs[0].name == temps[k]);
+			CHECK(ecmd.outputs[0].name == items[i].filename);
+			CHECK(ecmd.outputs[0].Opt(_T("-vf")) == vf[k]);
+		}
+	}
+
+	// a different session gets different intermediate files
+	opts.sessionId = 1235;
+	CapturePlanner::Plan plan2;
+	CapturePlanner::MakePlan(items, opts, plan2);
+	if (CHECK(plan2.capture.size() == 1) && CHECK(plan2.capture[0].tempFiles.size() == 3))
+	{
+		for (size_t k = 0; k < 3; ++k)
+			CHECK(plan2.capture[0].tempFiles[k] != temps[k]);
+	}
+}
+
+// Run a combined capture step through the ffmpeg stub, and check the
+// timing.  The outputs should be written at their own time limits, and
+// the whole step should take as long as the longest item, rather than
+// the sum of the items as it would when capturing them one at a time.
+// The stub's time scale runs the 20-second capture in one second.
+TEST_CASE(CapturePlannerStubTiming)
+{
+	const double timeScale = 0.05;
+
+	// the stub is built into the same folder as the test program
+	TCHAR exe[MAX_PATH];
+	GetModuleFileName(NULL, exe, countof(exe));
+	std::filesystem::path stub = std::filesystem::path(exe).parent_path() / _T("FFmpegStub.exe");
+	if (!std::filesystem::exists(stub))
+	{
+		t.Fail("FFmpegStub.exe not found; build the FFmpegStub project");
+		return;
+	}
+
+	// set up an output folder
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / MsgFmt(_T("PinballYTests-%lu"), GetCurrentProcessId()).Get();
+	std::filesystem::create_directories(dir);
+
+	// plan the capture
+	std::vector<CapturePlanner::Item> items;
+	TypicalItems(items, dir.wstring());
+	CapturePlanner::Options opts;
+	opts.ffmpeg = stub.wstring();
+	opts.audioDevice = _T("Stereo Mix");
+	CapturePlanner::Plan plan;
+	CapturePlanner::MakePlan(items, opts, plan);
+
+	// run the step through the stub
+	TempFile log;
+	SetEnvironmentVariable(_T("FFMPEG_STUB_LOG"), log.GetPath());
+	SetEnvironmentVariable(_T("FFMPEG_STUB_TIME_SCALE"), MsgFmt(_T("%g"), timeScale));
+	STARTUPINFO si;
+	ZeroMemory(&si, sizeof(si));
+	si.cb = sizeof(si);
+	PROCESS_INFORMATION pi;
+	bool ran = false;
+	if (CHECK(plan.capture.size() == 1)
+		&& CHECK(CreateProcess(NULL, plan.capture[0].cmdline.data(), NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &si, &pi)))
+	{
+		DWORD exitCode = 1;
+		CHECK(WaitForSingleObject(pi.hProcess, 30000) == WAIT_OBJECT_0);
+		GetExitCodeProcess(pi.hProcess, &exitCode);
+		ran = CHECK(exitCode == 0);
+		CloseHandle(pi.hProcess);
+		CloseHandle(pi.hThread);
+	}
+	SetEnvironmentVariable(_T("FFMPEG_STUB_LOG"), NULL);
+	SetEnvironmentVariable(_T("FFMPEG_STUB_TIME_SCALE"), NULL);
+
+	if (ran)
+	{
+		// read the log: <time> <pid> <event> [<detail>]
+		long long tStart = -1, tEnd = -1;
+		std::unordered_map<TSTRING, long long> tOutput;
+		std::ifstream f(log.GetPath());
+		std::string line;
+		while (std::getline(f, line))
+		{
+			std::vector<std::string> fields;
+			std::istringstream s(line);
+			for (std::string field; std::getline(s, field, '\t'); )
+				fields.push_back(field);
+			if (fields.size() < 3)
+				continue;
+
+			long long time = std::stoll(fields[0]);
+			if (fields[2] == "start")
+				tStart = time;
+			else if (fields[2] == "end")
+				tEnd = time;
+			else if (fields[2] == "output" && fields.size() >= 4)
+			{
+				// the filename is UTF-8
+				WCHAR name[MAX_PATH];
+				int len = MultiByteToWideChar(CP_UTF8, 0, fields[3].c_str(), -1, name, countof(name));
+				if (len > 0)
+					tOutput[name] = time;
+			}
+		}
+
+		if (CHECK(tStart >= 0 && tEnd >= 0) && CHECK(tOutput.size() == 4))
+		{
+			// Each output should be written at its time limit.  Allow for
+			// the system clock resolution on the early side, and for the
+			// scheduler on the late side.
+			for (auto &item : items)
+			{
+				auto it = tOutput.find(item.filename);
+				if (!CHECK(it != tOutput.end()))
+					continue;
+
+				long long expected = (long long)((item.isVideo ? item.captureTime : 0) * timeScale);
+				long long actual = it->second - tStart;
+				if (actual < expected - 20 || actual > expected + 250)
+					t.Fail("%ls written at %lld ms, expected %lld ms", item.desc.c_str(), actual, expected);
+				CHECK(std::filesystem::exists(item.filename));
+			}
+
+			// the step should take as long as the longest item, not the sum
+			long long longest = 0, sum = 0;
+			for (auto &item : items)
+			{
+				longest = max(longest, (long long)item.captureTime);
+				sum += item.captureTime;
+			}
+			long long elapsed = tEnd - tStart;
+			CHECK(elapsed >= (long long)(longest * timeScale) - 20);
+			CHECK(elapsed < (long long)(sum * timeScale));
+			t.Log("combined capture step: %lld ms; longest item %lld ms, sum of items %lld ms",
+				elapsed, (long long)(longest * timeScale), (long long)(sum * timeScale));
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::remove_all(dir, ec);
+}
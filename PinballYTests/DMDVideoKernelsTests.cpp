@@ -0,0 +1,288 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DMDVideoKernels tests and benchmarks
+//
+// The vector kernels must produce exactly the same output as the plain
+// C++ kernels.  These tests run every kernel level the CPU supports on
+// the same inputs and compare the results byte for byte, at the DMD
+// frame size and at odd sizes that exercise the leftover pixels after
+// the last whole vector.
+
+#include "stdafx.h"
+#include "../PinballY/DMDVideoKernels.h"
+#include "TestHarness.h"
+
+namespace
+{
+	const int dmdWidth = 128, dmdHeight = 32;
+
+	// Simple repeatable pseudo-random fill
+	void Fill(std::vector<BYTE> &buf, UINT32 seed)
+	{
+		for (auto &b : buf)
+		{
+			seed = seed * 1664525 + 1013904223;
+			b = (BYTE)(seed >> 24);
+		}
+	}
+
+	// Run a test function for each vector level the CPU supports,
+	// passing the scalar kernels as the reference
+	void ForEachVectorLevel(TestContext &t, std::function<void(const char*, const DMDVideoKernels&, const DMDVideoKernels&)> func)
+	{
+		const DMDVideoKernels *ref = DMDVideoKernels::Get(DMDVideoKernels::Scalar);
+		static const struct { DMDVideoKernels::Level level; const char *name; } levels[] = {
+			{ DMDVideoKernels::SSE2, "SSE2" },
+			{ DMDVideoKernels::AVX2, "AVX2" },
+		};
+		for (auto &l : levels)
+		{
+			if (auto k = DMDVideoKernels::Get(l.level); k != nullptr)
+				func(l.name, *ref, *k);
+			else
+				t.Log("%s not supported on this CPU, skipped", l.name);
+		}
+	}
+
+	// Compare two buffers, reporting the first difference
+	bool Same(TestContext &t, const char *what, const char *level, int size,
+		const std::vector<BYTE> &a, const std::vector<BYTE> &b)
+	{
+		auto m = std::mismatch(a.begin(), a.end(), b.begin());
+		if (m.first == a.end())
+			return true;
+
+		t.Fail("%s, %s, size %d: byte %d is %d, expected %d", what, level, size,
+			(int)(m.first - a.begin()), *m.second, *m.first);
+		return false;
+	}
+
+	// sizes to try for row-at-a-time kernels: the DMD width, plus sizes
+	// around the 16- and 32-byte vector lengths
+	const int rowSizes[] = { 0, 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 127, 128, 129, 255 };
+}
+
+TEST_CASE(DMDKernelsMaxPool)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		for (int width : rowSizes)
+		{
+			for (int height : { 1, 3, dmdHeight })
+			{
+				std::vector<BYTE> src(width * height * 4), a(width * height), b(width * height);
+				Fill(src, width * 31 + height);
+				ref.MaxPool2x2(src.data(), a.data(), width, height);
+				k.MaxPool2x2(src.data(), b.data(), width, height);
+				Same(t, "MaxPool2x2", level, width, a, b);
+			}
+		}
+	});
+}
+
+TEST_CASE(DMDKernelsQuantize)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		for (int n : rowSizes)
+		{
+			std::vector<BYTE> src(n), a(n), b(n);
+			Fill(src, n);
+			ref.Quantize16(src.data(), a.data(), n);
+			k.Quantize16(src.data(), b.data(), n);
+			Same(t, "Quantize16", level, n, a, b);
+
+			// in place
+			b = src;
+			k.Quantize16(b.data(), b.data(), n);
+			Same(t, "Quantize16 in place", level, n, a, b);
+		}
+	});
+}
+
+TEST_CASE(DMDKernelsYUVToRGB)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		// random rows at the odd sizes
+		for (int n : rowSizes)
+		{
+			std::vector<BYTE> y(n), u(n), v(n), a(n * 3), b(n * 3);
+			Fill(y, n);
+			Fill(u, n + 1000);
+			Fill(v, n + 2000);
+			ref.YUVToRGB24(y.data(), u.data(), v.data(), a.data(), n);
+			k.YUVToRGB24(y.data(), u.data(), v.data(), b.data(), n);
+			Same(t, "YUVToRGB24", level, n, a, b);
+		}
+
+		// Every Y, U, V combination.  Each row takes all 256 Y values
+		// with one U, V pair.  This covers the clamping at both ends.
+		std::vector<BYTE> y(256), u(256), v(256), a(256 * 3), b(256 * 3);
+		for (int i = 0; i < 256; ++i)
+			y[i] = (BYTE)i;
+		for (int uu = 0; uu < 256; ++uu)
+		{
+			for (int vv = 0; vv < 256; ++vv)
+			{
+				std::fill(u.begin(), u.end(), (BYTE)uu);
+				std::fill(v.begin(), v.end(), (BYTE)vv);
+				ref.YUVToRGB24(y.data(), u.data(), v.data(), a.data(), 256);
+				k.YUVToRGB24(y.data(), u.data(), v.data(), b.data(), 256);
+				if (!Same(t, "YUVToRGB24 exhaustive", level, 256, a, b))
+					return;
+			}
+		}
+	});
+}
+
+TEST_CASE(DMDKernelsUpsample)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		for (int n : rowSizes)
+		{
+			std::vector<BYTE> src(n), a(n * 2), b(n * 2);
+			Fill(src, n);
+			ref.Upsample2x(src.data(), a.data(), n);
+			k.Upsample2x(src.data(), b.data(), n);
+			Same(t, "Upsample2x", level, n, a, b);
+		}
+	});
+}
+
+TEST_CASE(DMDKernelsMirror)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		for (int bytesPerPixel : { 1, 3 })
+		{
+			for (int width : rowSizes)
+			{
+				if (width == 0)
+					continue;
+
+				std::vector<BYTE> a(width * 3 * bytesPerPixel);
+				Fill(a, width);
+				auto b = a;
+				ref.MirrorHorz(a.data(), width, 3, bytesPerPixel);
+				k.MirrorHorz(b.data(), width, 3, bytesPerPixel);
+				Same(t, bytesPerPixel == 1 ? "MirrorHorz mono" : "MirrorHorz RGB", level, width, a, b);
+			}
+		}
+	});
+
+	// check the scalar version against the definition, for one row
+	std::vector<BYTE> row(33);
+	Fill(row, 1);
+	auto m = row;
+	DMDVideoKernels::Get(DMDVideoKernels::Scalar)->MirrorHorz(m.data(), 33, 1, 1);
+	CHECK(std::equal(row.rbegin(), row.rend(), m.begin()));
+}
+
+namespace
+{
+	// Build a complete DMD frame the way RealDMD::PresentVideoFrame does,
+	// for the monochrome and RGB color spaces, from a double-size or
+	// native-size YUV 4:2:0 frame.
+	void BuildFrame(const DMDVideoKernels &k, bool rgb, bool doubleSize, bool mirror,
+		const std::vector<BYTE> &y, const std::vector<BYTE> &u, const std::vector<BYTE> &v, std::vector<BYTE> &out)
+	{
+		std::vector<BYTE> luma(dmdWidth * dmdHeight);
+		const BYTE *lumaSrc = y.data();
+		if (doubleSize)
+		{
+			k.MaxPool2x2(y.data(), luma.data(), dmdWidth, dmdHeight);
+			lumaSrc = luma.data();
+		}
+
+		int bytesPerPixel = rgb ? 3 : 1;
+		out.resize(dmdWidth * dmdHeight * bytesPerPixel);
+		if (!rgb)
+			k.Quantize16(lumaSrc, out.data(), dmdWidth * dmdHeight);
+		else if (doubleSize)
+			k.YUVToRGB24(lumaSrc, u.data(), v.data(), out.data(), dmdWidth * dmdHeight);
+		else
+		{
+			BYTE uRow[dmdWidth], vRow[dmdWidth];
+			for (int row = 0; row < dmdHeight; ++row)
+			{
+				if ((row & 1) == 0)
+				{
+					k.Upsample2x(u.data() + (row/2)*(dmdWidth/2), uRow, dmdWidth/2);
+					k.Upsample2x(v.data() + (row/2)*(dmdWidth/2), vRow, dmdWidth/2);
+				}
+				k.YUVToRGB24(lumaSrc + row*dmdWidth, uRow, vRow, out.data() + row*dmdWidth*3, dmdWidth);
+			}
+		}
+
+		if (mirror)
+		{
+			k.MirrorHorz(out.data(), dmdWidth, dmdHeight, bytesPerPixel);
+			DMDVideoKernels::MirrorVert(out.data(), dmdWidth, dmdHeight, bytesPerPixel);
+		}
+	}
+
+	// Make a random YUV 4:2:0 frame
+	void MakeFrame(bool doubleSize, UINT32 seed, std::vector<BYTE> &y, std::vector<BYTE> &u, std::vector<BYTE> &v)
+	{
+		int w = doubleSize ? dmdWidth * 2 : dmdWidth, h = doubleSize ? dmdHeight * 2 : dmdHeight;
+		y.resize(w * h);
+		u.resize(w * h / 4);
+		v.resize(w * h / 4);
+		Fill(y, seed);
+		Fill(u, seed + 1);
+		Fill(v, seed + 2);
+	}
+}
+
+// whole frames, in each color space and source format
+TEST_CASE(DMDKernelsFrames)
+{
+	ForEachVectorLevel(t, [&t](const char *level, const DMDVideoKernels &ref, const DMDVideoKernels &k)
+	{
+		for (int mode = 0; mode < 8; ++mode)
+		{
+			bool rgb = (mode & 1) != 0, doubleSize = (mode & 2) != 0, mirror = (mode & 4) != 0;
+			std::vector<BYTE> y, u, v, a, b;
+			MakeFrame(doubleSize, mode, y, u, v);
+			BuildFrame(ref, rgb, doubleSize, mirror, y, u, v, a);
+			BuildFrame(k, rgb, doubleSize, mirror, y, u, v, b);
+			Same(t, rgb ? "RGB frame" : "Mono16 frame", level, mode, a, b);
+		}
+	});
+}
+
+BENCHMARK(DMDKernelsFrameTime)
+{
+	static const struct { DMDVideoKernels::Level level; const char *name; } levels[] = {
+		{ DMDVideoKernels::Scalar, "Scalar" },
+		{ DMDVideoKernels::SSE2, "SSE2" },
+		{ DMDVideoKernels::AVX2, "AVX2" },
+	};
+	static const struct { bool rgb; bool doubleSize; const char *name; } modes[] = {
+		{ false, true, "Mono16, 256x64 source" },
+		{ false, false, "Mono16, 128x32 source" },
+		{ true, true, "RGB, 256x64 source" },
+		{ true, false, "RGB, 128x32 source" },
+	};
+
+	const int nFrames = 20000;
+	for (auto &m : modes)
+	{
+		std::vector<BYTE> y, u, v, out;
+		MakeFrame(m.doubleSize, 1, y, u, v);
+		for (auto &l : levels)
+		{
+			auto k = DMDVideoKernels::Get(l.level);
+			if (k == nullptr)
+				continue;
+
+			Stopwatch sw;
+			for (int i = 0; i < nFrames; ++i)
+				BuildFrame(*k, m.rgb, m.doubleSize, true, y, u, v, out);
+			t.Log("%-24s %-6s %7.2f us/frame", m.name, l.name, sw.ElapsedMs() * 1000.0 / nFrames);
+		}
+	}
+}
@@ -0,0 +1,229 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// DOF output scheduler tests
+
+#include "stdafx.h"
+#include <thread>
+#include "../PinballY/DOFOutput.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Stub backend.  This records each update sent, with the time it
+	// was sent.
+	class StubBackend : public DOFOutput::Backend
+	{
+	public:
+		struct Update
+		{
+			WSTRING name;
+			int val;
+			double t;     // milliseconds on the stub's timer
+		};
+
+		virtual void SetNamedState(const WCHAR *name, int val) override
+		{
+			CriticalSectionLocker locker(lock);
+			updates.push_back({ name, val, Now_ms() });
+		}
+
+		// current time on the stub's timer, in milliseconds
+		double Now_ms() { return timer.GetTime_seconds() * 1000.0; }
+
+		// wait until at least n updates have been sent; returns false on timeout
+		bool WaitFor(size_t n, DWORD timeout_ms = 2000)
+		{
+			for (DWORD t0 = GetTickCount(); GetTickCount() - t0 < timeout_ms; Sleep(1))
+			{
+				if (GetUpdates().size() >= n)
+					return true;
+			}
+			return false;
+		}
+
+		// get a snapshot of the updates so far
+		std::vector<Update> GetUpdates()
+		{
+			CriticalSectionLocker locker(lock);
+			return updates;
+		}
+
+	protected:
+		std::vector<Update> updates;
+		CriticalSection lock;
+		HiResTimer timer;
+	};
+
+	// Output thread blocker.  This holds the output thread in a Call()
+	// until released, so that the submissions made in the meantime all
+	// reach the thread in one batch, as they would if the UI thread
+	// submitted a burst of updates while a slow DOF call was running.
+	class OutputBlocker
+	{
+	public:
+		OutputBlocker(DOFOutput &output) :
+			hGate(CreateEvent(NULL, TRUE, FALSE, NULL)),
+			hEntered(CreateEvent(NULL, TRUE, FALSE, NULL))
+		{
+			th = std::thread([this, &output]() {
+				output.Call([this]() { SetEvent(hEntered); WaitForSingleObject(hGate, INFINITE); });
+			});
+			WaitForSingleObject(hEntered, INFINITE);
+		}
+
+		~OutputBlocker() { Release(); }
+
+		void Release()
+		{
+			if (th.joinable())
+			{
+				SetEvent(hGate);
+				th.join();
+			}
+		}
+
+	protected:
+		HandleHolder hGate;
+		HandleHolder hEntered;
+		std::thread th;
+	};
+
+	// check an update against an expected name and value
+	bool IsUpdate(const StubBackend::Update &u, const WCHAR *name, int val)
+	{
+		return u.name == name && u.val == val;
+	}
+}
+
+// Repeated state updates that arrive together are collapsed to the
+// latest value, and the states go out in the order first submitted
+TEST_CASE(DOFOutputStateCoalescing)
+{
+	auto stub = new StubBackend();
+	DOFOutput output(stub);
+
+	{
+		OutputBlocker blocker(output);
+		output.SetState(L"PBYMenu", 1);
+		output.SetState(L"PBYKey", 1);
+		output.SetState(L"PBYMenu", 0);
+		output.SetState(L"PBYMenu", 2);
+	}
+
+	// a Call() sends the pending states before running the function
+	output.Call([]() { });
+
+	auto u = stub->GetUpdates();
+	if (CHECK(u.size() == 2))
+	{
+		CHECK(IsUpdate(u[0], L"PBYMenu", 2));
+		CHECK(IsUpdate(u[1], L"PBYKey", 1));
+	}
+
+	DOFOutput::Stats stats;
+	output.GetStats(stats);
+	CHECK(stats.sent == 2);
+	CHECK(stats.coalesced == 2);
+	CHECK(stats.queueDepth == 0);
+}
+
+// A burst of pulses of one effect produces a single ON/OFF pair, held
+// ON for the pulse hold time
+TEST_CASE(DOFOutputPulseCoalescing)
+{
+	auto stub = new StubBackend();
+	DOFOutput output(stub);
+
+	{
+		OutputBlocker blocker(output);
+		for (int i = 0; i < 5; ++i)
+			output.Pulse(L"PBYWheelNext");
+	}
+
+	if (CHECK(stub->WaitFor(2)))
+	{
+		// give it time to send anything extra, which it shouldn't
+		Sleep(DOFOutput::updateInterval * 3);
+		auto u = stub->GetUpdates();
+		if (CHECK(u.size() == 2))
+		{
+			CHECK(IsUpdate(u[0], L"PBYWheelNext", 1));
+			CHECK(IsUpdate(u[1], L"PBYWheelNext", 0));
+			CHECK(u[1].t - u[0].t >= DOFOutput::pulseHoldTime - 1.0);
+		}
+	}
+
+	DOFOutput::Stats stats;
+	output.GetStats(stats);
+	CHECK(stats.coalesced == 4);
+	CHECK(stats.queueDepth == 0);
+}
+
+// A pulse of an effect that's already ON extends the ON period to the
+// full hold time from the new pulse, rather than queuing a second pulse
+TEST_CASE(DOFOutputPulseExtend)
+{
+	auto stub = new StubBackend();
+	DOFOutput output(stub);
+
+	output.Pulse(L"PBYWheelNext");
+	if (!CHECK(stub->WaitFor(1)))
+		return;
+
+	Sleep(DOFOutput::pulseHoldTime / 2);
+	double tPulse = stub->Now_ms();
+	output.Pulse(L"PBYWheelNext");
+
+	if (CHECK(stub->WaitFor(2)))
+	{
+		Sleep(DOFOutput::updateInterval * 3);
+		auto u = stub->GetUpdates();
+		if (CHECK(u.size() == 2))
+		{
+			CHECK(IsUpdate(u[1], L"PBYWheelNext", 0));
+			CHECK(u[1].t - tPulse >= DOFOutput::pulseHoldTime - 1.0);
+		}
+	}
+}
+
+// Pulses of different effects go out in submission order, one update
+// per slot, with each pulse's OFF ahead of the next pulse's ON
+TEST_CASE(DOFOutputPulseOrdering)
+{
+	auto stub = new StubBackend();
+	DOFOutput output(stub);
+
+	{
+		OutputBlocker blocker(output);
+		output.Pulse(L"PBYA");
+		output.Pulse(L"PBYB");
+		output.Pulse(L"PBYC");
+	}
+
+	if (CHECK(stub->WaitFor(6)))
+	{
+		auto u = stub->GetUpdates();
+		if (CHECK(u.size() == 6))
+		{
+			CHECK(IsUpdate(u[0], L"PBYA", 1));
+			CHECK(IsUpdate(u[1], L"PBYA", 0));
+			CHECK(IsUpdate(u[2], L"PBYB", 1));
+			CHECK(IsUpdate(u[3], L"PBYB", 0));
+			CHECK(IsUpdate(u[4], L"PBYC", 1));
+			CHECK(IsUpdate(u[5], L"PBYC", 0));
+
+			// consecutive updates are at least one update interval apart
+			for (size_t i = 1; i < u.size(); ++i)
+			{
+				if (u[i].t - u[i - 1].t < DOFOutput::updateInterval - 1.0)
+					t.Fail("updates %d and %d only %.2f ms apart", (int)i - 1, (int)i, u[i].t - u[i - 1].t);
+			}
+		}
+	}
+
+	DOFOutput::Stats stats;
+	output.GetStats(stats);
+	CHECK(stats.sent == 6);
+	CHECK(stats.queueDepth == 0);
+}
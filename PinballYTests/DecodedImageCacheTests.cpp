@@ -0,0 +1,143 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Decoded image cache benchmark
+
+#include "stdafx.h"
+#include <wincodec.h>
+#include "../PinballY/DecodedImageCache.h"
+#include "TestHarness.h"
+
+#pragma comment(lib, "windowscodecs.lib")
+
+namespace
+{
+	// Write a synthetic image to a PNG file.  This fills the image with
+	// gradients plus some noise, so that it compresses roughly like a
+	// real wheel or backglass image rather than like a flat color.
+	bool WritePNG(const TCHAR *filename, int width, int height)
+	{
+		UINT stride = width * 4;
+		std::vector<BYTE> pixels((size_t)stride * height);
+		UINT32 seed = 12345;
+		for (int y = 0; y < height; ++y)
+		{
+			BYTE *p = pixels.data() + (size_t)y * stride;
+			for (int x = 0; x < width; ++x, p += 4)
+			{
+				seed = seed * 1664525 + 1013904223;
+				BYTE noise = (BYTE)(seed >> 28);
+				p[0] = (BYTE)(x * 255 / width) ^ noise;
+				p[1] = (BYTE)(y * 255 / height) ^ noise;
+				p[2] = (BYTE)((x + y) & 0xFF);
+				p[3] = 0xFF;
+			}
+		}
+
+		RefPtr<IWICImagingFactory> wic;
+		RefPtr<IWICStream> stream;
+		RefPtr<IWICBitmapEncoder> encoder;
+		RefPtr<IWICBitmapFrameEncode> frame;
+		WICPixelFormatGUID format = GUID_WICPixelFormat32bppBGRA;
+		return SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wic)))
+			&& SUCCEEDED(wic->CreateStream(&stream))
+			&& SUCCEEDED(stream->InitializeFromFilename(filename, GENERIC_WRITE))
+			&& SUCCEEDED(wic->CreateEncoder(GUID_ContainerFormatPng, nullptr, &encoder))
+			&& SUCCEEDED(encoder->Initialize(stream, WICBitmapEncoderNoCache))
+			&& SUCCEEDED(encoder->CreateNewFrame(&frame, nullptr))
+			&& SUCCEEDED(frame->Initialize(nullptr))
+			&& SUCCEEDED(frame->SetSize(width, height))
+			&& SUCCEEDED(frame->SetPixelFormat(&format))
+			&& format == GUID_WICPixelFormat32bppBGRA
+			&& SUCCEEDED(frame->WritePixels(height, stride, (UINT)pixels.size(), pixels.data()))
+			&& SUCCEEDED(frame->Commit())
+			&& SUCCEEDED(encoder->Commit());
+	}
+
+	// Decode a file at its native size, as the image loader does for an
+	// image that doesn't go through the cache
+	bool DecodeNative(const TCHAR *filename, std::vector<BYTE> &pixels)
+	{
+		RefPtr<IWICImagingFactory> wic;
+		RefPtr<IWICBitmapDecoder> decoder;
+		RefPtr<IWICBitmapFrameDecode> frame;
+		RefPtr<IWICFormatConverter> bgra;
+		UINT width, height;
+		if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wic)))
+			|| FAILED(wic->CreateDecoderFromFilename(filename, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder))
+			|| FAILED(decoder->GetFrame(0, &frame))
+			|| FAILED(frame->GetSize(&width, &height))
+			|| FAILED(wic->CreateFormatConverter(&bgra))
+			|| FAILED(bgra->Initialize(frame, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, nullptr, 0, WICBitmapPaletteTypeCustom)))
+			return false;
+
+		pixels.resize((size_t)width * height * 4);
+		return SUCCEEDED(bgra->CopyPixels(nullptr, width * 4, (UINT)pixels.size(), pixels.data()));
+	}
+}
+
+// Load time for a 4K image displayed at wheel size: decoding the full
+// image directly, a cold cache load (decode, scale, and write the cache
+// file), and a warm cache load (read the cache file back).  Each source
+// file is a new temp file, so the cold loads are always misses, even
+// when the cache folder has entries from earlier runs.
+BENCHMARK(DecodedImageCacheColdWarm)
+{
+	const int nImages = 8;
+	const SIZE nativeSize = { 3840, 2160 };
+	const SIZE displaySize = { 480, 270 };
+
+	CoInitializeEx(NULL, COINIT_APARTMENTTHREADED);
+	DecodedImageCache::Init();
+	auto cache = DecodedImageCache::Get();
+
+	// create the source images
+	std::vector<std::unique_ptr<TempFile>> files;
+	for (int i = 0; i < nImages; ++i)
+	{
+		files.emplace_back(new TempFile());
+		if (!CHECK(WritePNG(files.back()->GetPath(), nativeSize.cx, nativeSize.cy)))
+			break;
+	}
+
+	if (t.nFailed == 0)
+	{
+		DecodedImageCache::Stats stats0, stats1, stats2;
+		cache->GetStats(stats0);
+
+		// decode each image at full size, without the cache
+		std::vector<BYTE> pixels;
+		Stopwatch sw;
+		for (auto &f : files)
+			CHECK(DecodeNative(f->GetPath(), pixels));
+		double direct = sw.ElapsedMs() / nImages;
+
+		// cold loads
+		BITMAPINFO bmi;
+		sw.Reset();
+		for (auto &f : files)
+			CHECK(cache->Load(f->GetPath(), nativeSize, displaySize, bmi, pixels));
+		double cold = sw.ElapsedMs() / nImages;
+		cache->GetStats(stats1);
+
+		// warm loads
+		sw.Reset();
+		for (auto &f : files)
+			CHECK(cache->Load(f->GetPath(), nativeSize, displaySize, bmi, pixels));
+		double warm = sw.ElapsedMs() / nImages;
+		cache->GetStats(stats2);
+
+		// the cold pass should miss every time, and the warm pass hit every time
+		CHECK(stats1.misses - stats0.misses == nImages);
+		CHECK(stats2.hits - stats1.hits == nImages);
+		CHECK(bmi.bmiHeader.biWidth == 480 && bmi.bmiHeader.biHeight == -270);
+
+		t.Log("%dx%d image at %dx%d: direct decode %.2f ms, cold cache load %.2f ms, warm cache load %.2f ms (%.1fx faster than direct)",
+			(int)nativeSize.cx, (int)nativeSize.cy, (int)displaySize.cx, (int)displaySize.cy,
+			direct, cold, warm, direct / warm);
+	}
+
+	files.clear();
+	DecodedImageCache::Shutdown();
+	CoUninitialize();
+}
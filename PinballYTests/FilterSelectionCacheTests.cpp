@@ -0,0 +1,272 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Filter selection cache tests and benchmarks
+//
+// These run the cache over a synthetic game list, with filters modeled
+// on the game list's own: a year range filter that only looks at the
+// game object, a recently-played filter that reads a date column from
+// a stats database, and a category filter that searches a string
+// column.  Each refresh builds the filtered list the way
+// GameList::RefreshFilter() does, from the cached selection, and we
+// compare that against a full scan that calls Include() for every game.
+
+#include "stdafx.h"
+#include <random>
+#include "../PinballY/CSVFile.h"
+#include "../PinballY/DateUtil.h"
+#include "../PinballY/FilterSelectionCache.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Synthetic game
+	struct TestGame
+	{
+		TSTRING title;
+		int year;
+		int statsRow;
+	};
+
+	// Synthetic game list, with a stats database holding the last
+	// played dates and category lists
+	struct TestGameList
+	{
+		TestGameList(int nGames, DATE midnight)
+		{
+			lastPlayedCol = stats.DefineColumn(_T("Last Played"), CSVFile::Column::Date);
+			categoriesCol = stats.DefineColumn(_T("Categories"));
+
+			static const TCHAR *const categories[] = {
+				_T("Favorites"), _T("Classic EM"), _T("Williams,Favorites"),
+				_T("Bally,Solid State,Multiball"), _T("Stern,Modern"), _T("")
+			};
+
+			games.resize(nGames);
+			for (int i = 0; i < nGames; ++i)
+			{
+				auto &g = games[i];
+				TCHAR title[32];
+				_stprintf_s(title, _T("Table %05d"), (i * 7919) % nGames);
+				g.title = title;
+				g.year = 1950 + i % 70;
+				g.statsRow = stats.CreateRow();
+
+				// leave every third game unplayed
+				if (i % 3 != 0)
+					lastPlayedCol->Set(g.statsRow, DateTime(midnight - (i % 730) + 0.5).ToString().c_str());
+				categoriesCol->Set(g.statsRow, categories[i % countof(categories)]);
+			}
+
+			// build the title index
+			for (auto &g : games)
+				byTitle.push_back(&g);
+			SortByTitle();
+		}
+
+		void SortByTitle(bool reverse = false)
+		{
+			std::sort(byTitle.begin(), byTitle.end(), [reverse](TestGame *a, TestGame *b) {
+				return reverse ? a->title > b->title : a->title < b->title; });
+		}
+
+		std::vector<TestGame> games;
+		std::vector<TestGame*> byTitle;
+		CSVFile stats;
+		CSVFile::Column *lastPlayedCol;
+		CSVFile::Column *categoriesCol;
+	};
+
+	// Synthetic filters
+	struct TestFilter
+	{
+		virtual ~TestFilter() { }
+		virtual const char *GetName() const = 0;
+		virtual bool Include(TestGame *game, DATE midnight) const = 0;
+	};
+
+	struct YearFilter : TestFilter
+	{
+		YearFilter(int yearFrom, int yearTo) : yearFrom(yearFrom), yearTo(yearTo) { }
+		virtual const char *GetName() const override { return "Year range"; }
+		virtual bool Include(TestGame *game, DATE) const override
+			{ return game->year >= yearFrom && game->year <= yearTo; }
+		int yearFrom, yearTo;
+	};
+
+	struct RecentlyPlayedFilter : TestFilter
+	{
+		RecentlyPlayedFilter(const TestGameList &list, int days) : list(list), days(days) { }
+		virtual const char *GetName() const override { return "Recently played"; }
+		virtual bool Include(TestGame *game, DATE midnight) const override
+		{
+			DATE lastPlayed = list.lastPlayedCol->GetDate(game->statsRow);
+			return lastPlayed != 0 && lastPlayed >= midnight - days;
+		}
+		const TestGameList &list;
+		int days;
+	};
+
+	struct CategoryFilter : TestFilter
+	{
+		CategoryFilter(const TestGameList &list, const TCHAR *category) : list(list), category(category) { }
+		virtual const char *GetName() const override { return "Category"; }
+		virtual bool Include(TestGame *game, DATE) const override
+		{
+			// search the comma-separated category list
+			const TCHAR *p = list.categoriesCol->Get(game->statsRow, _T(""));
+			for (;;)
+			{
+				const TCHAR *end = _tcschr(p, ',');
+				size_t len = end != nullptr ? end - p : _tcslen(p);
+				if (len == category.length() && _tcsncmp(p, category.c_str(), len) == 0)
+					return true;
+				if (end == nullptr)
+					return false;
+				p = end + 1;
+			}
+		}
+		const TestGameList &list;
+		TSTRING category;
+	};
+
+	typedef FilterSelectionCache<TestGame, TestFilter> TestCache;
+
+	// Build the filtered list from the cached selection, as
+	// GameList::RefreshFilter() does
+	void CachedRefresh(TestCache &cache, const TestFilter *filter, DATE midnight,
+		const std::vector<TestGame*> &byTitle, std::vector<TestGame*> &filtered)
+	{
+		filtered.clear();
+		auto const &sel = cache.Get(filter, midnight, byTitle);
+		for (size_t i = 0; i < byTitle.size(); ++i)
+		{
+			if (sel.include[i])
+				filtered.push_back(byTitle[i]);
+		}
+	}
+
+	// Build the filtered list by calling Include() for every game
+	void FullScanRefresh(const TestFilter *filter, DATE midnight,
+		const std::vector<TestGame*> &byTitle, std::vector<TestGame*> &filtered)
+	{
+		filtered.clear();
+		for (auto g : byTitle)
+		{
+			if (filter->Include(g, midnight))
+				filtered.push_back(g);
+		}
+	}
+
+	// Check that the cached selection matches a full scan
+	bool CheckMatch(TestContext &t, TestCache &cache, const TestFilter *filter, DATE midnight,
+		const std::vector<TestGame*> &byTitle, const char *when)
+	{
+		std::vector<TestGame*> cached, full;
+		CachedRefresh(cache, filter, midnight, byTitle, cached);
+		FullScanRefresh(filter, midnight, byTitle, full);
+		if (cached != full)
+		{
+			t.Fail("%s filter, %s: cached selection has %d games, full scan has %d",
+				filter->GetName(), when, (int)cached.size(), (int)full.size());
+			return false;
+		}
+		return true;
+	}
+
+	// today's midnight, as a Variant DATE
+	DATE GetMidnight() { return floor(DateTime().ToVariantDate()); }
+}
+
+// The cached selections track game changes, re-sorting, and date
+// changes, and always match a full Include() scan
+TEST_CASE(FilterSelectionCacheMatchesFullScan)
+{
+	DATE midnight = GetMidnight();
+	TestGameList list(1000, midnight);
+	YearFilter year(1970, 1989);
+	RecentlyPlayedFilter recent(list, 30);
+	CategoryFilter favorites(list, _T("Favorites"));
+	const TestFilter *filters[] = { &year, &recent, &favorites };
+
+	TestCache cache;
+	cache.SetOrder(list.byTitle);
+	for (auto f : filters)
+		CheckMatch(t, cache, f, midnight, list.byTitle, "initial");
+
+	// change some games, and tell the cache about it
+	for (int i = 0; i < 1000; i += 97)
+	{
+		TestGame *g = &list.games[i];
+		g->year = 1975;
+		list.lastPlayedCol->Set(g->statsRow, DateTime(midnight + 0.25).ToString().c_str());
+		list.categoriesCol->Set(g->statsRow, _T("Favorites"));
+		cache.OnItemChanged(g);
+	}
+	for (auto f : filters)
+		CheckMatch(t, cache, f, midnight, list.byTitle, "after game updates");
+
+	// re-sort the list
+	list.SortByTitle(true);
+	cache.SetOrder(list.byTitle);
+	for (auto f : filters)
+		CheckMatch(t, cache, f, midnight, list.byTitle, "after re-sorting");
+
+	// move to a later day, which changes the recently played selection
+	for (auto f : filters)
+		CheckMatch(t, cache, f, midnight + 20, list.byTitle, "after the date changed");
+
+	// forget a filter, then use it again
+	cache.Forget(&recent);
+	CheckMatch(t, cache, &recent, midnight, list.byTitle, "after forgetting the filter");
+}
+
+// Filter refresh time on a 10,000-game list, with the cached selection
+// vs a full Include() scan.  Each refresh follows an update to one
+// game, as happens when a game's play time or rating changes between
+// filter switches.
+BENCHMARK(FilterSelectionCacheRefresh)
+{
+	const int nGames = 10000;
+	const int nRefreshes = 200;
+
+	DATE midnight = GetMidnight();
+	TestGameList list(nGames, midnight);
+	YearFilter year(1970, 1989);
+	RecentlyPlayedFilter recent(list, 30);
+	CategoryFilter favorites(list, _T("Favorites"));
+	const TestFilter *filters[] = { &year, &recent, &favorites };
+
+	TestCache cache;
+	cache.SetOrder(list.byTitle);
+	std::vector<TestGame*> filtered;
+	std::mt19937 rng(12345);
+	std::uniform_int_distribution<int> pick(0, nGames - 1);
+	for (auto f : filters)
+	{
+		// full scans
+		Stopwatch sw;
+		for (int i = 0; i < nRefreshes; ++i)
+			FullScanRefresh(f, midnight, list.byTitle, filtered);
+		double full = sw.ElapsedMs() / nRefreshes;
+
+		// first use of the filter, which builds the selection
+		sw.Reset();
+		CachedRefresh(cache, f, midnight, list.byTitle, filtered);
+		double first = sw.ElapsedMs();
+
+		// cached refreshes
+		sw.Reset();
+		for (int i = 0; i < nRefreshes; ++i)
+		{
+			cache.OnItemChanged(&list.games[pick(rng)]);
+			CachedRefresh(cache, f, midnight, list.byTitle, filtered);
+		}
+		double cached = sw.ElapsedMs() / nRefreshes;
+
+		t.Log("%-16s %d of %d games: full scan %7.3f ms, cached %7.3f ms (first use %7.3f ms), %5.1fx",
+			f->GetName(), (int)filtered.size(), nGames, full, cached, first, full / max(cached, 1.0e-6));
+
+		CheckMatch(t, cache, f, midnight, list.byTitle, "after the benchmark");
+	}
+}
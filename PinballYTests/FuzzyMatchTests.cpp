@@ -0,0 +1,238 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// FuzzyMatchIndex tests and benchmarks
+//
+// These compare the indexed matcher against the original linear scan
+// with the DiceCoefficient.h templates, using the IPDB table list from
+// the assets folder as the candidate list, the same way RefTableList
+// uses it.
+
+#include "stdafx.h"
+#include "../PinballY/FuzzyMatch.h"
+#include "../PinballY/DiceCoefficient.h"
+#include "../PinballY/CSVFile.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// IPDB reference list, with the names in lower case, as RefTableList
+	// stores them for matching
+	struct IpdbList
+	{
+		std::vector<TSTRING> names;
+		std::vector<TSTRING> altNames;
+	};
+
+	bool LoadIpdbList(TestContext &t, IpdbList &list)
+	{
+		// find the list file
+		std::filesystem::path path;
+		if (!FindSourceTreeFile(path, "assets/ipdbTableList.csv"))
+		{
+			t.Fail("assets/ipdbTableList.csv not found");
+			return false;
+		}
+
+		// load it, using the same code page as RefTableList
+		CSVFile csv;
+		CapturingErrorHandler eh;
+		csv.SetFile(path.c_str());
+		if (!csv.Read(eh, 1252))
+		{
+			t.Fail("error reading the IPDB table list");
+			return false;
+		}
+
+		// pull out the names in lower case
+		auto nameCol = csv.DefineColumn(_T("Name"));
+		auto altNameCol = csv.DefineColumn(_T("AltName"));
+		auto LC = [](const TCHAR *s)
+		{
+			TSTRING str = s;
+			std::transform(str.begin(), str.end(), str.begin(), _totlower);
+			return str;
+		};
+		for (int i = 0, n = (int)csv.GetNumRows(); i < n; ++i)
+		{
+			list.names.emplace_back(LC(nameCol->Get(i, _T(""))));
+			list.altNames.emplace_back(LC(altNameCol->Get(i, _T(""))));
+		}
+		return list.names.size() != 0;
+	}
+
+	// Build a list of query strings.  This uses a few hand-picked names
+	// in the style of table file names, plus a sampling of the list's
+	// own names with typical file-name decorations added.
+	void BuildQueries(const IpdbList &list, std::vector<TSTRING> &queries)
+	{
+		static const TCHAR *fixed[] = {
+			_T("addams family, the (bally 1992)"),
+			_T("medieval madness (williams 1997) vpw"),
+			_T("attack from mars"),
+			_T("twilight zone 1.2"),
+			_T("star wars (data east 1992)"),
+			_T("theatre of magic"),
+			_T("taf"),
+			_T("xyzzy"),
+		};
+		for (auto q : fixed)
+			queries.emplace_back(q);
+
+		for (size_t i = 0; i < list.names.size(); i += 97)
+			queries.emplace_back(list.names[i] + _T(" (mod 1.0)"));
+	}
+
+	// linear-scan result, matching FuzzyMatchIndex::Match
+	struct Result
+	{
+		Result(int id, float score) : id(id), score(score) { }
+		int id;
+		float score;
+	};
+
+	// Search the list with a linear scan using the DiceCoefficient.h
+	// templates, as RefTableList did before the index.  Returns all
+	// rows with non-zero scores, in the index's result order.
+	void LinearSearch(std::vector<Result> &results, const DiceCoefficient::BigramSet<TCHAR> &q,
+		const std::vector<DiceCoefficient::BigramSet<TCHAR>> &names,
+		const std::vector<DiceCoefficient::BigramSet<TCHAR>> &altNames)
+	{
+		results.clear();
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			float score = max(DiceCoefficient::DiceCoefficient(q, names[i]), DiceCoefficient::DiceCoefficient(q, altNames[i]));
+			if (score > 0.0f)
+				results.emplace_back((int)i, score);
+		}
+		std::sort(results.begin(), results.end(), [](const Result &a, const Result &b) {
+			return a.score != b.score ? a.score > b.score : a.id < b.id;
+		});
+	}
+}
+
+// The index must yield exactly the same scores and ordering as the
+// linear scan, for every query.
+TEST_CASE(FuzzyMatchAgreesWithDiceCoefficient)
+{
+	IpdbList list;
+	if (!LoadIpdbList(t, list))
+		return;
+
+	// build the linear-scan bigram sets and the index
+	std::vector<DiceCoefficient::BigramSet<TCHAR>> nameSets(list.names.size()), altNameSets(list.names.size());
+	FuzzyMatchIndex index;
+	for (size_t i = 0; i < list.names.size(); ++i)
+	{
+		DiceCoefficient::BuildBigramSet(nameSets[i], list.names[i].c_str());
+		DiceCoefficient::BuildBigramSet(altNameSets[i], list.altNames[i].c_str());
+		index.Add((int)i, list.names[i].c_str());
+		index.Add((int)i, list.altNames[i].c_str());
+	}
+
+	std::vector<TSTRING> queries;
+	BuildQueries(list, queries);
+	for (auto &q : queries)
+	{
+		// search both ways
+		DiceCoefficient::BigramSet<TCHAR> qs;
+		DiceCoefficient::BuildBigramSet(qs, q.c_str());
+		std::vector<Result> expected;
+		LinearSearch(expected, qs, nameSets, altNameSets);
+
+		FuzzyMatchIndex::BigramSet qi;
+		FuzzyMatchIndex::BuildBigramSet(qi, q.c_str());
+		std::vector<FuzzyMatchIndex::Match> actual;
+		index.Search(actual, { &qi }, 0.0f);
+
+		// compare the results
+		if (!CHECK(actual.size() == expected.size()))
+			continue;
+		for (size_t i = 0; i < actual.size(); ++i)
+		{
+			if (actual[i].id != expected[i].id || actual[i].score != expected[i].score)
+			{
+				t.Fail("query \"%ws\", result %d: index %d/%f, linear %d/%f", q.c_str(), (int)i,
+					actual[i].id, actual[i].score, expected[i].id, expected[i].score);
+				break;
+			}
+		}
+
+		// the top-N form must return a prefix of the full result
+		std::vector<FuzzyMatchIndex::Match> top;
+		index.Search(top, { &qi }, 0.0f, 5);
+		CHECK(top.size() == min(actual.size(), (size_t)5));
+		for (size_t i = 0; i < top.size() && i < actual.size(); ++i)
+			CHECK(top[i].id == actual[i].id);
+	}
+}
+
+// Time the full-list search both ways
+BENCHMARK(FuzzyMatchSearch)
+{
+	IpdbList list;
+	if (!LoadIpdbList(t, list))
+		return;
+
+	std::vector<TSTRING> queries;
+	BuildQueries(list, queries);
+	t.Log("%d candidates, %d queries", (int)list.names.size(), (int)queries.size());
+
+	// set up the linear scan lists
+	Stopwatch sw;
+	std::vector<DiceCoefficient::BigramSet<TCHAR>> nameSets(list.names.size()), altNameSets(list.names.size());
+	for (size_t i = 0; i < list.names.size(); ++i)
+	{
+		DiceCoefficient::BuildBigramSet(nameSets[i], list.names[i].c_str());
+		DiceCoefficient::BuildBigramSet(altNameSets[i], list.altNames[i].c_str());
+	}
+	double tLinearBuild = sw.ElapsedMs();
+
+	// set up the index
+	sw.Reset();
+	FuzzyMatchIndex index;
+	for (size_t i = 0; i < list.names.size(); ++i)
+	{
+		index.Add((int)i, list.names[i].c_str());
+		index.Add((int)i, list.altNames[i].c_str());
+	}
+	double tIndexBuild = sw.ElapsedMs();
+
+	// run the queries, several passes each
+	const int nPasses = 5;
+	size_t nLinear = 0, nIndex = 0;
+	sw.Reset();
+	for (int pass = 0; pass < nPasses; ++pass)
+	{
+		for (auto &q : queries)
+		{
+			DiceCoefficient::BigramSet<TCHAR> qs;
+			DiceCoefficient::BuildBigramSet(qs, q.c_str());
+			std::vector<Result> results;
+			LinearSearch(results, qs, nameSets, altNameSets);
+			nLinear += results.size();
+		}
+	}
+	double tLinear = sw.ElapsedMs();
+
+	sw.Reset();
+	for (int pass = 0; pass < nPasses; ++pass)
+	{
+		for (auto &q : queries)
+		{
+			FuzzyMatchIndex::BigramSet qi;
+			FuzzyMatchIndex::BuildBigramSet(qi, q.c_str());
+			std::vector<FuzzyMatchIndex::Match> results;
+			index.Search(results, { &qi }, 0.0f);
+			nIndex += results.size();
+		}
+	}
+	double tIndex = sw.ElapsedMs();
+
+	// report
+	double nQueries = double(queries.size() * nPasses);
+	t.Log("Build:  DiceCoefficient sets %.2f ms, FuzzyMatchIndex %.2f ms", tLinearBuild, tIndexBuild);
+	t.Log("Search: DiceCoefficient %.3f ms/query, FuzzyMatchIndex %.3f ms/query (%.1fx)",
+		tLinear / nQueries, tIndex / nQueries, tLinear / max(tIndex, 0.001));
+	CHECK(nLinear == nIndex);
+}
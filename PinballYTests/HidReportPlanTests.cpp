@@ -0,0 +1,806 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// HID report plan tests and benchmarks
+//
+// These replay input reports recorded from real devices.  The HidP
+// functions can only decode a report with the preparsed data for the
+// device that sent it, and Windows only hands out preparsed data for
+// attached devices, so each recording saves the device's preparsed
+// data along with its reports.  HidP can then decode the recorded
+// reports exactly as it did on the live device, which lets us compare
+// the compiled plans against HidP for both results and speed without
+// having the device attached.
+//
+// Recordings live in PinballYTests/HidRecordings in the source tree.
+// To make a new one, attach the device and run
+//
+//    PinballYTests HidRecordReports
+//
+// which records from each attached joystick in turn.  Press buttons
+// and nudge the cabinet while it's recording, so that the recording
+// contains a realistic mix of idle reports and state changes.  The
+// recording tests fail if there are no recordings, rather than passing
+// without having checked anything.
+//
+// The bit-level decoding (ExtractBits, ReadValue, and the button
+// bitmap) is also tested on synthetic reports, with layouts set up
+// directly rather than probed from a device's preparsed data, so those
+// tests run anywhere.
+
+#include "stdafx.h"
+#include <Hidsdi.h>
+#include "../Utilities/HidReportPlan.h"
+#include "../Utilities/Joystick.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Recorded HID input reports from one device
+	struct HidRecording
+	{
+		// device's preparsed data, from GetRawInputDeviceInfo(RIDI_PREPARSEDDATA)
+		std::vector<BYTE> ppd;
+
+		// report length, including the report ID prefix byte
+		DWORD reportLen = 0;
+
+		// report arrival times, in microseconds from the start of the recording
+		std::vector<DWORD> times;
+
+		// the reports, concatenated
+		std::vector<BYTE> reports;
+
+		size_t GetCount() const { return times.size(); }
+		const BYTE *GetReport(size_t i) const { return reports.data() + i * reportLen; }
+
+		PHIDP_PREPARSED_DATA GetPreparsedData() const { return (PHIDP_PREPARSED_DATA)ppd.data(); }
+
+		// File format: the header, then the preparsed data, then for each
+		// report, its arrival time (a DWORD) followed by the report bytes.
+		struct FileHeader
+		{
+			DWORD magic;
+			DWORD version;
+			DWORD ppdSize;
+			DWORD reportLen;
+			DWORD nReports;
+		};
+		static const DWORD fileMagic = 'PHID';
+		static const DWORD fileVersion = 1;
+
+		bool Load(const std::filesystem::path &path)
+		{
+			std::ifstream f(path, std::ios::binary);
+			FileHeader hdr;
+			if (!f.read((char*)&hdr, sizeof(hdr)) || hdr.magic != fileMagic || hdr.version != fileVersion
+				|| hdr.reportLen == 0)
+				return false;
+
+			reportLen = hdr.reportLen;
+			ppd.resize(hdr.ppdSize);
+			times.resize(hdr.nReports);
+			reports.resize((size_t)hdr.nReports * reportLen);
+			if (!f.read((char*)ppd.data(), ppd.size()))
+				return false;
+			for (DWORD i = 0; i < hdr.nReports; ++i)
+			{
+				if (!f.read((char*)&times[i], sizeof(DWORD)) || !f.read((char*)reports.data() + i * reportLen, reportLen))
+					return false;
+			}
+			return true;
+		}
+
+		bool Save(const std::filesystem::path &path) const
+		{
+			std::ofstream f(path, std::ios::binary);
+			FileHeader hdr = { fileMagic, fileVersion, (DWORD)ppd.size(), reportLen, (DWORD)GetCount() };
+			f.write((const char*)&hdr, sizeof(hdr));
+			f.write((const char*)ppd.data(), ppd.size());
+			for (size_t i = 0; i < GetCount(); ++i)
+			{
+				f.write((const char*)&times[i], sizeof(DWORD));
+				f.write((const char*)GetReport(i), reportLen);
+			}
+			return !!f;
+		}
+	};
+
+	// Load the recordings from the source tree
+	std::vector<std::pair<std::string, HidRecording>> LoadRecordings(TestContext &t)
+	{
+		std::vector<std::pair<std::string, HidRecording>> recs;
+		std::filesystem::path dir;
+		if (FindSourceTreeFile(dir, "PinballYTests/HidRecordings"))
+		{
+			for (auto &ent : std::filesystem::directory_iterator(dir))
+			{
+				if (ent.path().extension() != ".hidrec")
+					continue;
+
+				HidRecording rec;
+				if (CHECK(rec.Load(ent.path())))
+					recs.emplace_back(ent.path().filename().u8string(), std::move(rec));
+			}
+		}
+
+		if (recs.size() == 0)
+			t.Fail("No HID recordings found in PinballYTests/HidRecordings; run \"PinballYTests HidRecordReports\" with a device attached to make one");
+
+		return recs;
+	}
+
+	// Decoded state change: a button press or release, or an axis value
+	struct DecodedEvent
+	{
+		bool isButton;
+		USAGE usage;
+		LONG val;
+
+		bool operator==(const DecodedEvent &e) const { return isButton == e.isButton && usage == e.usage && val == e.val; }
+	};
+
+	// Report decoder.  This follows the joystick manager's report
+	// processing: buttons and the Generic Desktop axes, grouped by
+	// report ID, decoded either with the compiled plans (falling back
+	// on HidP for anything the plan doesn't cover, as the joystick
+	// manager does) or purely with HidP.
+	class ReplayDecoder
+	{
+	public:
+		ReplayDecoder(bool usePlan) : usePlan(usePlan), ppd(nullptr) { }
+
+		// set up the report groups for a device
+		bool Init(PHIDP_PREPARSED_DATA ppd)
+		{
+			this->ppd = ppd;
+			if (HidP_GetCaps(ppd, &caps) != HIDP_STATUS_SUCCESS)
+				return false;
+
+			// set up the button report groups
+			USHORT numBtnCaps = caps.NumberInputButtonCaps;
+			std::vector<HIDP_BUTTON_CAPS> btnCaps(numBtnCaps);
+			if (numBtnCaps != 0 && HidP_GetButtonCaps(HidP_Input, btnCaps.data(), &numBtnCaps, ppd) != HIDP_STATUS_SUCCESS)
+				return false;
+
+			USAGE maxButton = 0;
+			for (USHORT i = 0; i < numBtnCaps; ++i)
+			{
+				auto &bc = btnCaps[i];
+				if (bc.UsagePage != 9)
+					continue;
+
+				USAGE first = bc.IsRange ? bc.Range.UsageMin : bc.NotRange.Usage;
+				USAGE last = bc.IsRange ? bc.Range.UsageMax : bc.NotRange.Usage;
+				maxButton = max(maxButton, last);
+				GetGroup(bc.ReportID)->nButtons += last - first + 1;
+			}
+			buttonState.assign((size_t)maxButton + 1, 0);
+
+			for (auto &g : groups)
+			{
+				g.on[0].resize(g.nButtons);
+				g.on[1].resize(g.nButtons);
+				g.plan.CompileButtons(ppd, caps, btnCaps.data(), numBtnCaps, g.reportId, 9);
+			}
+
+			// set up the axis values
+			USHORT numValCaps = caps.NumberInputValueCaps;
+			std::vector<HIDP_VALUE_CAPS> valCaps(numValCaps);
+			if (numValCaps != 0 && HidP_GetValueCaps(HidP_Input, valCaps.data(), &numValCaps, ppd) != HIDP_STATUS_SUCCESS)
+				return false;
+
+			for (USHORT i = 0; i < numValCaps; ++i)
+			{
+				auto &vc = valCaps[i];
+				if (vc.UsagePage != 0x01)
+					continue;
+
+				USAGE last = vc.IsRange ? vc.Range.UsageMax : vc.NotRange.Usage;
+				for (UINT usage = vc.Range.UsageMin; usage <= last; ++usage)
+				{
+					if (usage >= 0x30 && usage <= 0x39)
+					{
+						Group::Value v;
+						v.usage = (USAGE)usage;
+						HidReportPlan::CompileValue(ppd, caps, vc, v.usage, v.field);
+						GetGroup(vc.ReportID)->values.push_back(v);
+					}
+				}
+			}
+
+			return true;
+		}
+
+		// Decode a report, calling sink(isButton, usage, val) for each
+		// button that changed state and each axis value that changed
+		template<typename Sink> void Decode(const BYTE *report, DWORD len, Sink sink)
+		{
+			for (auto &g : groups)
+			{
+				if (g.reportId != report[0])
+					continue;
+
+				if (usePlan && g.plan.IsButtonLayoutCompiled())
+				{
+					g.plan.DecodeButtons(report, len, [&sink](USAGE button, bool pressed) { sink(true, button, pressed ? 1 : 0); });
+				}
+				else
+				{
+					// Read the ON list, and compare it against the last
+					// one, using the same state-bit scheme as the joystick
+					// manager
+					int nextIndex = g.lastOnIndex ^ 1;
+					USAGE *nextOn = g.on[nextIndex].data();
+					ULONG nOn = g.nButtons;
+					if (HidP_GetUsages(HidP_Input, 9, 0, nextOn, &nOn, ppd, (PCHAR)report, len) == HIDP_STATUS_SUCCESS)
+					{
+						BYTE *bs = buttonState.data();
+						for (ULONG i = 0; i < nOn; ++i)
+						{
+							if ((bs[nextOn[i]] |= 0x02) == 0x02)
+								sink(true, nextOn[i], 1);
+						}
+						const USAGE *lastOn = g.on[g.lastOnIndex].data();
+						for (ULONG i = 0; i < g.nOn; ++i)
+						{
+							if (bs[lastOn[i]] == 0x01)
+							{
+								sink(true, lastOn[i], 0);
+								bs[lastOn[i]] = 0;
+							}
+						}
+						for (ULONG i = 0; i < nOn; ++i)
+							bs[nextOn[i]] = 1;
+
+						g.lastOnIndex = nextIndex;
+						g.nOn = nOn;
+					}
+				}
+
+				for (auto &v : g.values)
+				{
+					LONG newVal;
+					bool ok = usePlan && v.field.compiled ?
+						HidReportPlan::ReadValue(v.field, report, len, newVal) :
+						HidP_GetScaledUsageValue(HidP_Input, 0x01, 0, v.usage, &newVal, ppd, (PCHAR)report, len) == HIDP_STATUS_SUCCESS;
+					if (ok && newVal != v.last)
+					{
+						v.last = newVal;
+						sink(false, v.usage, newVal);
+					}
+				}
+				break;
+			}
+		}
+
+		// Describe the plan coverage: the number of report groups with
+		// compiled button layouts, and the number of compiled values
+		void GetCoverage(int &nGroups, int &nButtonGroups, int &nValues, int &nCompiledValues) const
+		{
+			nGroups = (int)groups.size();
+			nButtonGroups = nValues = nCompiledValues = 0;
+			for (auto &g : groups)
+			{
+				if (g.plan.IsButtonLayoutCompiled())
+					++nButtonGroups;
+				for (auto &v : g.values)
+				{
+					++nValues;
+					if (v.field.compiled)
+						++nCompiledValues;
+				}
+			}
+		}
+
+	protected:
+		struct Group
+		{
+			Group(BYTE reportId) : reportId(reportId) { }
+
+			BYTE reportId;
+			ULONG nButtons = 0;
+
+			// compiled plan
+			HidReportPlan plan;
+
+			// ON lists for the HidP path
+			std::vector<USAGE> on[2];
+			ULONG nOn = 0;
+			int lastOnIndex = 0;
+
+			// axis values
+			struct Value
+			{
+				USAGE usage = 0;
+				HidReportPlan::ValueField field;
+				LONG last = 0;
+			};
+			std::vector<Value> values;
+		};
+
+		Group *GetGroup(BYTE reportId)
+		{
+			for (auto &g : groups)
+			{
+				if (g.reportId == reportId)
+					return &g;
+			}
+			groups.emplace_back(reportId);
+			return &groups.back();
+		}
+
+		bool usePlan;
+		PHIDP_PREPARSED_DATA ppd;
+		HIDP_CAPS caps;
+		std::list<Group> groups;
+		std::vector<BYTE> buttonState;
+	};
+
+	// Decode a whole recording into an event list
+	std::vector<DecodedEvent> DecodeAll(const HidRecording &rec, bool usePlan)
+	{
+		std::vector<DecodedEvent> events;
+		ReplayDecoder dec(usePlan);
+		if (dec.Init(rec.GetPreparsedData()))
+		{
+			for (size_t i = 0; i < rec.GetCount(); ++i)
+				dec.Decode(rec.GetReport(i), rec.reportLen, [&events](bool isButton, USAGE usage, LONG val) {
+					events.push_back({ isButton, usage, val }); });
+		}
+		return events;
+	}
+
+	// Time the decoding of each report over a number of passes through a
+	// recording, and report the per-report latency statistics and the
+	// overall throughput
+	void TimeDecoding(TestContext &t, const HidRecording &rec, bool usePlan, int nPasses)
+	{
+		ReplayDecoder dec(usePlan);
+		if (!CHECK(dec.Init(rec.GetPreparsedData())))
+			return;
+
+		// The sink folds the events into a checksum, so that the work
+		// can't be optimized away, without adding allocation costs
+		DWORD checksum = 0;
+		auto sink = [&checksum](bool isButton, USAGE usage, LONG val) { checksum = checksum * 31 + usage * 7 + val; };
+
+		// per-report latency
+		LARGE_INTEGER freq, t0, t1;
+		QueryPerformanceFrequency(&freq);
+		double usPerTick = 1.0e6 / freq.QuadPart;
+		std::vector<double> samples;
+		samples.reserve(rec.GetCount() * nPasses);
+		for (int pass = 0; pass < nPasses; ++pass)
+		{
+			for (size_t i = 0; i < rec.GetCount(); ++i)
+			{
+				QueryPerformanceCounter(&t0);
+				dec.Decode(rec.GetReport(i), rec.reportLen, sink);
+				QueryPerformanceCounter(&t1);
+				samples.push_back((t1.QuadPart - t0.QuadPart) * usPerTick);
+			}
+		}
+
+		// throughput, without the per-report timer overhead
+		Stopwatch sw;
+		for (int pass = 0; pass < nPasses; ++pass)
+		{
+			for (size_t i = 0; i < rec.GetCount(); ++i)
+				dec.Decode(rec.GetReport(i), rec.reportLen, sink);
+		}
+		double ms = sw.ElapsedMs();
+
+		std::sort(samples.begin(), samples.end());
+		double sum = 0.0;
+		for (auto s : samples)
+			sum += s;
+		size_t n = samples.size();
+		t.Log("%-5s per report: mean %6.3f us, median %6.3f us, 99%% %6.3f us, max %7.2f us; %9.0f reports/s (checksum %08lx)",
+			usePlan ? "plan" : "HidP", sum / n, samples[n / 2], samples[n * 99 / 100], samples[n - 1],
+			n / (ms / 1000.0), checksum);
+	}
+}
+
+namespace
+{
+	// Store a bit field in a synthetic report, least significant bit first
+	void PutBits(std::vector<BYTE> &report, UINT bitOffset, UINT nBits, DWORD val)
+	{
+		for (UINT i = 0; i < nBits; ++i, ++bitOffset)
+		{
+			BYTE mask = (BYTE)(1 << (bitOffset & 7));
+			if ((val & (1UL << i)) != 0)
+				report[bitOffset >> 3] |= mask;
+			else
+				report[bitOffset >> 3] &= ~mask;
+		}
+	}
+
+	// Decode a synthetic report's buttons into a list of changes
+	typedef std::vector<std::pair<USAGE, bool>> ButtonChanges;
+	ButtonChanges DecodeButtonChanges(HidReportPlan &plan, const std::vector<BYTE> &report)
+	{
+		ButtonChanges changes;
+		plan.DecodeButtons(report.data(), report.size(), [&changes](USAGE button, bool pressed) {
+			changes.emplace_back(button, pressed); });
+		return changes;
+	}
+
+	// Make a value field description for ReadValue()
+	HidReportPlan::ValueField MakeField(UINT bitOffset, UINT bitSize, LONG logMin, LONG logMax, LONG phyMin = 0, LONG phyMax = 0)
+	{
+		HidReportPlan::ValueField f;
+		f.compiled = true;
+		f.bitOffset = bitOffset;
+		f.bitSize = bitSize;
+		f.isSigned = logMin < 0;
+		f.logMin = logMin;
+		f.logMax = logMax;
+		f.phyMin = phyMin;
+		f.phyMax = phyMax;
+		return f;
+	}
+}
+
+// Bit field extraction, including unaligned fields, full 32-bit fields
+// spanning five bytes, and fields running off the end of the report
+TEST_CASE(HidReportPlanExtractBits)
+{
+	const BYTE r[] = { 0x01, 0xA5, 0x3C, 0xFF, 0x80, 0x12 };
+	size_t len = sizeof(r);
+
+	CHECK(HidReportPlan::ExtractBits(r, len, 8, 8) == 0xA5);
+	CHECK(HidReportPlan::ExtractBits(r, len, 8, 1) == 1);
+	CHECK(HidReportPlan::ExtractBits(r, len, 9, 1) == 0);
+	CHECK(HidReportPlan::ExtractBits(r, len, 12, 8) == 0xCA);
+	CHECK(HidReportPlan::ExtractBits(r, len, 13, 3) == 0x05);
+	CHECK(HidReportPlan::ExtractBits(r, len, 8, 32) == 0x80FF3CA5);
+	CHECK(HidReportPlan::ExtractBits(r, len, 12, 32) == 0x280FF3CA);
+	CHECK(HidReportPlan::ExtractBits(r, len, 44, 8) == 0x01);
+	CHECK(HidReportPlan::ExtractBits(r, len, 48, 8) == 0);
+	CHECK(HidReportPlan::ExtractBits(r, len, 40, 32) == 0x12);
+}
+
+// Value fields: sign extension, null values outside the logical
+// range, and scaling to the physical range
+TEST_CASE(HidReportPlanReadValue)
+{
+	std::vector<BYTE> r(8);
+	LONG v;
+
+	// unsigned 8-bit, no physical range
+	auto u8 = MakeField(8, 8, 0, 255);
+	PutBits(r, 8, 8, 200);
+	CHECK(HidReportPlan::ReadValue(u8, r.data(), r.size(), v) && v == 200);
+
+	// signed 10-bit at an unaligned offset
+	auto s10 = MakeField(12, 10, -512, 511);
+	PutBits(r, 12, 10, 0x3FF);
+	CHECK(HidReportPlan::ReadValue(s10, r.data(), r.size(), v) && v == -1);
+	PutBits(r, 12, 10, 0x200);
+	CHECK(HidReportPlan::ReadValue(s10, r.data(), r.size(), v) && v == -512);
+	PutBits(r, 12, 10, 0x1FF);
+	CHECK(HidReportPlan::ReadValue(s10, r.data(), r.size(), v) && v == 511);
+
+	// signed 32-bit
+	auto s32 = MakeField(8, 32, -100000, 100000);
+	PutBits(r, 8, 32, (DWORD)-5);
+	CHECK(HidReportPlan::ReadValue(s32, r.data(), r.size(), v) && v == -5);
+	PutBits(r, 8, 32, 100001);
+	CHECK(!HidReportPlan::ReadValue(s32, r.data(), r.size(), v));
+
+	// values outside the logical range are null, and leave the result alone
+	auto null8 = MakeField(8, 8, 1, 100);
+	v = 1234;
+	PutBits(r, 8, 8, 0);
+	CHECK(!HidReportPlan::ReadValue(null8, r.data(), r.size(), v) && v == 1234);
+	PutBits(r, 8, 8, 101);
+	CHECK(!HidReportPlan::ReadValue(null8, r.data(), r.size(), v) && v == 1234);
+	PutBits(r, 8, 8, 100);
+	CHECK(HidReportPlan::ReadValue(null8, r.data(), r.size(), v) && v == 100);
+
+	// scaling to the physical range
+	auto scaled = MakeField(8, 8, 0, 255, 0, 1000);
+	PutBits(r, 8, 8, 128);
+	CHECK(HidReportPlan::ReadValue(scaled, r.data(), r.size(), v) && v == 501);
+	auto sscaled = MakeField(8, 8, -127, 127, -1000, 1000);
+	PutBits(r, 8, 8, (DWORD)-127);
+	CHECK(HidReportPlan::ReadValue(sscaled, r.data(), r.size(), v) && v == -1000);
+	PutBits(r, 8, 8, 0);
+	CHECK(HidReportPlan::ReadValue(sscaled, r.data(), r.size(), v) && v == 0);
+	PutBits(r, 8, 8, 127);
+	CHECK(HidReportPlan::ReadValue(sscaled, r.data(), r.size(), v) && v == 1000);
+
+	// a field that runs off the end of the report reads the missing bits as zero
+	auto u16 = MakeField(8, 16, 0, 65535);
+	const BYTE shortReport[] = { 0x01, 0xFF };
+	CHECK(HidReportPlan::ReadValue(u16, shortReport, sizeof(shortReport), v) && v == 0xFF);
+}
+
+// Button decoding for button counts around the bitmap word boundary.
+// The last button in each layout lands in the last bitmap word, which
+// is the one a miscounted word or index would drop or overrun.
+TEST_CASE(HidReportPlanDecodeButtonsWordBoundary)
+{
+	for (UINT nButtons : { 1, 31, 32, 33, 63, 64, 65 })
+	{
+		// one button per bit after the report ID byte, numbered from 1
+		std::vector<HidReportPlan::ButtonBit> bits;
+		for (UINT i = 0; i < nButtons; ++i)
+			bits.push_back({ 8 + i, (USAGE)(i + 1) });
+		HidReportPlan plan;
+		if (!CHECK(plan.SetButtonLayout(bits) && plan.IsButtonLayoutCompiled()))
+			continue;
+
+		std::vector<BYTE> r(1 + (nButtons + 7) / 8);
+		r[0] = 1;
+
+		// nothing pressed
+		CHECK(DecodeButtonChanges(plan, r).size() == 0);
+
+		// press the last button
+		PutBits(r, 8 + nButtons - 1, 1, 1);
+		auto c = DecodeButtonChanges(plan, r);
+		if (!(c.size() == 1 && c[0].first == nButtons && c[0].second))
+			t.Fail("%u buttons: pressing button %u reported %d changes", nButtons, nButtons, (int)c.size());
+
+		// press all of the others, then release everything
+		for (UINT i = 0; i < nButtons; ++i)
+			PutBits(r, 8 + i, 1, 1);
+		c = DecodeButtonChanges(plan, r);
+		CHECK(c.size() == nButtons - 1);
+		for (size_t i = 0; i < c.size(); ++i)
+			CHECK(c[i].first == (USAGE)(i + 1) && c[i].second);
+
+		std::fill(r.begin() + 1, r.end(), 0);
+		c = DecodeButtonChanges(plan, r);
+		CHECK(c.size() == nButtons);
+		for (size_t i = 0; i < c.size(); ++i)
+			CHECK(c[i].first == (USAGE)(i + 1) && !c[i].second);
+
+		// a report with no changes reports nothing
+		CHECK(DecodeButtonChanges(plan, r).size() == 0);
+	}
+}
+
+// Button decoding with several runs of buttons, listed out of report
+// order: a short run, a run of more than 32 buttons at an unaligned
+// bit offset (which the bitmap reader has to split into pieces, one of
+// which straddles two bitmap words), and a run after a gap
+TEST_CASE(HidReportPlanDecodeButtonRuns)
+{
+	struct Run { UINT bitOffset, count; } runs[] = { { 8, 5 }, { 19, 40 }, { 70, 3 } };
+	std::vector<HidReportPlan::ButtonBit> bits;
+	USAGE usage = 1;
+	for (auto &run : runs)
+	{
+		for (UINT i = 0; i < run.count; ++i)
+			bits.push_back({ run.bitOffset + i, usage++ });
+	}
+	std::reverse(bits.begin(), bits.end());
+
+	HidReportPlan plan;
+	if (!CHECK(plan.SetButtonLayout(bits)))
+		return;
+
+	// toggle each button on its own
+	std::vector<BYTE> r(10);
+	r[0] = 1;
+	CHECK(DecodeButtonChanges(plan, r).size() == 0);
+	for (auto &b : bits)
+	{
+		PutBits(r, b.bitOffset, 1, 1);
+		auto on = DecodeButtonChanges(plan, r);
+		PutBits(r, b.bitOffset, 1, 0);
+		auto off = DecodeButtonChanges(plan, r);
+		if (!(on.size() == 1 && on[0].first == b.usage && on[0].second
+			&& off.size() == 1 && off[0].first == b.usage && !off[0].second))
+			t.Fail("button %u at bit %u: %d changes on press, %d on release",
+				b.usage, b.bitOffset, (int)on.size(), (int)off.size());
+	}
+
+	// bits outside of the runs don't register
+	PutBits(r, 13, 6, 0x3F);
+	PutBits(r, 59, 11, 0x7FF);
+	CHECK(DecodeButtonChanges(plan, r).size() == 0);
+
+	// two buttons can't share a bit
+	bits.push_back(bits.front());
+	CHECK(!plan.SetButtonLayout(bits) && !plan.IsButtonLayoutCompiled());
+}
+
+// Button state updates stop at the end of the joystick's state array.
+// The array has nButtons entries, so button number nButtons is the
+// first one out of range.
+TEST_CASE(JoystickButtonStateBounds)
+{
+	JoystickManager::Joystick js(0, 0, _T("Test"));
+	js.nButtons = 33;
+
+	// allocate one extra entry as a guard
+	js.buttonState.reset(new BYTE[34]);
+	memset(js.buttonState.get(), 0, 34);
+
+	js.SetButtonState(32, 1);
+	CHECK(js.buttonState.get()[32] == 1 && js.IsButtonPressed(32));
+
+	js.SetButtonState(33, 1);
+	CHECK(js.buttonState.get()[33] == 0 && !js.IsButtonPressed(33));
+
+	js.SetButtonState(-1, 1);
+	js.SetButtonState(0, 1);
+	CHECK(js.IsButtonPressed(0) && !js.IsButtonPressed(-1));
+}
+
+// The compiled plans decode every recorded report the same way HidP does
+TEST_CASE(HidReportPlanMatchesHidP)
+{
+	for (auto &r : LoadRecordings(t))
+	{
+		auto &rec = r.second;
+		ReplayDecoder dec(true);
+		if (!CHECK(dec.Init(rec.GetPreparsedData())))
+			continue;
+
+		auto hidp = DecodeAll(rec, false);
+		auto plan = DecodeAll(rec, true);
+		t.Log("%s: %d reports, %d state changes", r.first.c_str(), (int)rec.GetCount(), (int)hidp.size());
+
+		if (!CHECK(plan.size() == hidp.size()))
+			continue;
+		for (size_t i = 0; i < plan.size(); ++i)
+		{
+			if (!(plan[i] == hidp[i]))
+			{
+				t.Fail("%s: event %d differs: plan %s %u = %ld, HidP %s %u = %ld", r.first.c_str(), (int)i,
+					plan[i].isButton ? "button" : "axis", plan[i].usage, plan[i].val,
+					hidp[i].isButton ? "button" : "axis", hidp[i].usage, hidp[i].val);
+				break;
+			}
+		}
+	}
+}
+
+// Per-report decoding latency and throughput, compiled plans vs HidP
+BENCHMARK(HidReportPlanReplay)
+{
+	for (auto &r : LoadRecordings(t))
+	{
+		auto &rec = r.second;
+
+		// describe the recording
+		int nGroups, nButtonGroups, nValues, nCompiledValues;
+		ReplayDecoder dec(true);
+		if (!CHECK(dec.Init(rec.GetPreparsedData())))
+			continue;
+		dec.GetCoverage(nGroups, nButtonGroups, nValues, nCompiledValues);
+		double secs = rec.GetCount() != 0 ? rec.times.back() / 1.0e6 : 0.0;
+		t.Log("%s: %d reports of %d bytes over %.1f s; %d/%d button groups and %d/%d axes compiled",
+			r.first.c_str(), (int)rec.GetCount(), (int)rec.reportLen, secs,
+			nButtonGroups, nGroups, nCompiledValues, nValues);
+
+		// replay at least 100,000 reports per decoder
+		int nPasses = max(1, (int)(100000 / max(rec.GetCount(), (size_t)1)));
+		TimeDecoding(t, rec, false, nPasses);
+		TimeDecoding(t, rec, true, nPasses);
+	}
+}
+
+// Record input reports from each attached joystick, and save them in
+// the source tree for the tests above
+TOOL(HidRecordReports)
+{
+	const DWORD recordTime_ms = 15000;
+
+	// find the recordings folder
+	std::filesystem::path dir;
+	if (!CHECK(FindSourceTreeFile(dir, "PinballYTests")))
+		return;
+	dir /= "HidRecordings";
+	std::error_code ec;
+	std::filesystem::create_directories(dir, ec);
+
+	// enumerate the raw input devices
+	UINT nDevices = 0;
+	GetRawInputDeviceList(NULL, &nDevices, sizeof(RAWINPUTDEVICELIST));
+	std::vector<RAWINPUTDEVICELIST> devices(nDevices);
+	if (nDevices == 0 || GetRawInputDeviceList(devices.data(), &nDevices, sizeof(RAWINPUTDEVICELIST)) == (UINT)-1)
+	{
+		t.Log("No input devices found");
+		return;
+	}
+
+	int nRecorded = 0;
+	for (auto &d : devices)
+	{
+		// we're only interested in joysticks and gamepads
+		RID_DEVICE_INFO info;
+		UINT sz = info.cbSize = sizeof(info);
+		if (d.dwType != RIM_TYPEHID
+			|| GetRawInputDeviceInfo(d.hDevice, RIDI_DEVICEINFO, &info, &sz) == (UINT)-1
+			|| info.hid.usUsagePage != 0x01 || (info.hid.usUsage != 0x04 && info.hid.usUsage != 0x05))
+			continue;
+
+		// get the device name and preparsed data
+		HidRecording rec;
+		UINT nameLen = 0, ppdSize = 0;
+		GetRawInputDeviceInfo(d.hDevice, RIDI_DEVICENAME, NULL, &nameLen);
+		GetRawInputDeviceInfo(d.hDevice, RIDI_PREPARSEDDATA, NULL, &ppdSize);
+		std::vector<TCHAR> name(nameLen + 1);
+		rec.ppd.resize(ppdSize);
+		HIDP_CAPS caps;
+		if (GetRawInputDeviceInfo(d.hDevice, RIDI_DEVICENAME, name.data(), &nameLen) == (UINT)-1
+			|| GetRawInputDeviceInfo(d.hDevice, RIDI_PREPARSEDDATA, rec.ppd.data(), &ppdSize) == (UINT)-1
+			|| HidP_GetCaps(rec.GetPreparsedData(), &caps) != HIDP_STATUS_SUCCESS)
+			continue;
+		rec.reportLen = caps.InputReportByteLength;
+
+		// open the device for overlapped reads
+		HandleHolder hDevice(CreateFile(name.data(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+			OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL));
+		if (hDevice == INVALID_HANDLE_VALUE)
+		{
+			t.Log("Can't open %ws", name.data());
+			continue;
+		}
+
+		// get the product name for the file name, keeping it to safe characters
+		WCHAR product[128] = L"";
+		HidD_GetProductString(hDevice, product, sizeof(product));
+		std::wstring fname = product[0] != 0 ? product : L"Joystick";
+		for (auto &c : fname)
+		{
+			if (!iswalnum(c))
+				c = '_';
+		}
+		auto path = dir / (fname + L".hidrec");
+
+		printf("  Recording %ws for %d seconds: press buttons and nudge...\n", product, (int)(recordTime_ms / 1000));
+
+		// read reports until the time is up
+		HandleHolder hEvent(CreateEvent(NULL, TRUE, FALSE, NULL));
+		std::vector<BYTE> buf(rec.reportLen);
+		Stopwatch sw;
+		for (;;)
+		{
+			double elapsed = sw.ElapsedMs();
+			if (elapsed >= recordTime_ms)
+				break;
+
+			OVERLAPPED ov;
+			ZeroMemory(&ov, sizeof(ov));
+			ov.hEvent = hEvent;
+			ResetEvent(hEvent);
+			DWORD n = 0;
+			if (!ReadFile(hDevice, buf.data(), rec.reportLen, &n, &ov))
+			{
+				if (GetLastError() != ERROR_IO_PENDING)
+					break;
+				if (WaitForSingleObject(hEvent, (DWORD)(recordTime_ms - elapsed)) != WAIT_OBJECT_0)
+				{
+					CancelIo(hDevice);
+					GetOverlappedResult(hDevice, &ov, &n, TRUE);
+					break;
+				}
+				if (!GetOverlappedResult(hDevice, &ov, &n, FALSE))
+					break;
+			}
+
+			if (n == rec.reportLen)
+			{
+				rec.times.push_back((DWORD)(sw.ElapsedMs() * 1000.0));
+				rec.reports.insert(rec.reports.end(), buf.begin(), buf.end());
+			}
+		}
+
+		if (CHECK(rec.Save(path)))
+		{
+			t.Log("Saved %d reports to %ws", (int)rec.GetCount(), path.c_str());
+			++nRecorded;
+		}
+	}
+
+	if (nRecorded == 0)
+		t.Log("No joysticks recorded");
+}
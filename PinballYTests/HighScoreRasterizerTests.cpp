@@ -0,0 +1,279 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// High score rasterizer tests
+//
+// The slide rendering tests compare the rasterizer output against
+// golden images stored in the Golden folder, in PAM format (32-bit
+// RGBA).  If a test fails, it writes the actual output to the system
+// temp folder.  When a rendering change is intentional, review the
+// new output, and copy it over the golden image.
+
+#include "stdafx.h"
+#include <sstream>
+#include "../PinballY/HighScoreRasterizer.h"
+#include "TestHarness.h"
+
+namespace
+{
+	typedef HighScoreRasterizer::Image Image;
+	typedef HighScoreRasterizer::Atlas Atlas;
+
+	// Build a synthetic alphanumeric atlas.  The real atlases are PNG
+	// resources, which need GDI+ to decode, so we use a stand-in with
+	// the same layout.  Each cell is an opaque block with a color and
+	// stripe pattern that identifies the character, except for '.' and
+	// ',', which are transparent apart from the dot itself, with a
+	// translucent fringe to exercise the blending.
+	void MakeAtlas(Atlas &atlas, int cellWid, int cellHt)
+	{
+		atlas.Alloc(cellWid * 16, cellHt * 8);
+		for (int c = 0; c < 128; ++c)
+		{
+			int x0 = (c % 16) * cellWid, y0 = (c / 16) * cellHt;
+			for (int y = 0; y < cellHt; ++y)
+			{
+				BYTE *p = atlas.Row(y0 + y) + x0 * 4;
+				for (int x = 0; x < cellWid; ++x, p += 4)
+				{
+					if (c == '.' || c == ',')
+					{
+						// dot in the bottom right corner, with a fringe
+						bool dot = x >= cellWid - 2 && y >= cellHt - (c == ',' ? 3 : 2);
+						bool fringe = x >= cellWid - 3 && y >= cellHt - (c == ',' ? 4 : 3);
+						p[0] = 0x20, p[1] = 0x80, p[2] = 0xFF;
+						p[3] = dot ? 0xFF : fringe ? 0x80 : 0x00;
+					}
+					else
+					{
+						// stripe the cell according to the character bits
+						bool on = ((c >> (y % 7)) & 1) != 0 && x != 0;
+						p[0] = (BYTE)(c * 2);
+						p[1] = on ? 0xFF : 0x10;
+						p[2] = (BYTE)(c * 37);
+						p[3] = 0xFF;
+					}
+				}
+			}
+		}
+	}
+
+	// Read a PAM image file.  We only handle our own output format:
+	// 4 channels (RGB_ALPHA), 8 bits per channel.
+	bool ReadPAM(const std::filesystem::path &path, Image &image)
+	{
+		std::ifstream f(path, std::ios::binary);
+		if (!f)
+			return false;
+
+		int width = -1, height = -1, depth = -1, maxval = -1;
+		std::string line;
+		if (!std::getline(f, line) || line != "P7")
+			return false;
+		while (std::getline(f, line) && line != "ENDHDR")
+		{
+			std::istringstream ls(line);
+			std::string key;
+			int val;
+			if (ls >> key >> val)
+			{
+				if (key == "WIDTH") width = val;
+				else if (key == "HEIGHT") height = val;
+				else if (key == "DEPTH") depth = val;
+				else if (key == "MAXVAL") maxval = val;
+			}
+		}
+		if (width <= 0 || height <= 0 || depth != 4 || maxval != 255)
+			return false;
+
+		// read the pixels, converting from RGBA to our BGRA order
+		image.Alloc(width, height);
+		if (!f.read(reinterpret_cast<char*>(image.pix.data()), image.pix.size()))
+			return false;
+		for (size_t i = 0; i < image.pix.size(); i += 4)
+			std::swap(image.pix[i], image.pix[i + 2]);
+		return true;
+	}
+
+	// Write a PAM image file
+	bool WritePAM(const std::filesystem::path &path, const Image &image)
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << "P7\nWIDTH " << image.width << "\nHEIGHT " << image.height
+			<< "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+		std::vector<BYTE> rgba(image.pix);
+		for (size_t i = 0; i < rgba.size(); i += 4)
+			std::swap(rgba[i], rgba[i + 2]);
+		f.write(reinterpret_cast<const char*>(rgba.data()), rgba.size());
+		return !!f;
+	}
+
+	// Compare an image against its golden image
+	void CheckGolden(TestContext &t, const char *name, const Image &image)
+	{
+		// load the golden image
+		std::string file = std::string(name) + ".pam";
+		std::filesystem::path goldenPath;
+		Image golden;
+		bool found = FindSourceTreeFile(goldenPath, ("PinballYTests/Golden/" + file).c_str());
+		if (found && !ReadPAM(goldenPath, golden))
+		{
+			t.Fail("%s: error reading golden image %s", name, goldenPath.u8string().c_str());
+			return;
+		}
+
+		// compare it
+		if (found && golden.width == image.width && golden.height == image.height && golden.pix == image.pix)
+			return;
+
+		// It doesn't match.  Report the first difference, and save the
+		// actual output for review.
+		auto actualPath = std::filesystem::temp_directory_path() / file;
+		WritePAM(actualPath, image);
+		if (!found)
+			t.Fail("%s: golden image not found; actual output written to %s", name, actualPath.u8string().c_str());
+		else if (golden.width != image.width || golden.height != image.height)
+		{
+			t.Fail("%s: size %dx%d, expected %dx%d; actual output written to %s", name,
+				image.width, image.height, golden.width, golden.height, actualPath.u8string().c_str());
+		}
+		else
+		{
+			size_t i = std::mismatch(image.pix.begin(), image.pix.end(), golden.pix.begin()).first - image.pix.begin();
+			int x = (int)(i / 4 % image.width), y = (int)(i / 4 / image.width);
+			t.Fail("%s: pixel (%d,%d) differs from the golden image; actual output written to %s",
+				name, x, y, actualPath.u8string().c_str());
+		}
+	}
+}
+
+// DMD color ramp runs from the dimmed background to the full text color
+TEST_CASE(HighScoreRasterizerColorRamp)
+{
+	DMDFont::Color colors[16];
+	HighScoreRasterizer::BuildColorRamp(colors, 255, 88, 32);
+
+	// B, G, R, A byte order
+	CHECK(colors[0].c[2] == 25 && colors[0].c[1] == 8 && colors[0].c[0] == 3 && colors[0].c[3] == 0xFF);
+	CHECK(colors[15].c[2] == 255 && colors[15].c[1] == 88 && colors[15].c[0] == 32 && colors[15].c[3] == 0xFF);
+	for (int i = 1; i < 16; ++i)
+		CHECK(colors[i].c[2] >= colors[i - 1].c[2] && colors[i].c[1] >= colors[i - 1].c[1] && colors[i].c[0] >= colors[i - 1].c[0]);
+}
+
+// Alphanumeric cell counting and grid sizing
+TEST_CASE(HighScoreRasterizerAlphaCells)
+{
+	// '.' and ',' combine with the preceding character, except at the
+	// start of the line or after another '.' or ','
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T("")) == 0);
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T("ABC")) == 3);
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T("1,000,000")) == 7);
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T(".5")) == 2);
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T("A..")) == 2);
+	CHECK(HighScoreRasterizer::CountAlphaCells(_T("A.,B")) == 3);
+
+	// the grid starts at 2x16, and grows to fit the largest group
+	int wid, ht;
+	std::list<std::list<TSTRING>> messages = { { _T("GRAND CHAMPION"), _T("ABC 1,000,000") } };
+	HighScoreRasterizer::GetAlphaGridSize(messages, wid, ht);
+	CHECK(wid == 16 && ht == 2);
+
+	messages.push_back({ _T("HIGHEST SCORES"), _T("1) ABC 12,345,678,900"), _T("2) DEF 9,000,000") });
+	HighScoreRasterizer::GetAlphaGridSize(messages, wid, ht);
+	CHECK(wid == 18 && ht == 3);
+}
+
+// Compositing: opaque copy, translucent blend, and clipping
+TEST_CASE(HighScoreRasterizerComposite)
+{
+	static const BYTE black[4] = { 0, 0, 0, 0xFF };
+	Image dst;
+	dst.Alloc(4, 4);
+	dst.Fill(black);
+
+	Image src;
+	src.Alloc(3, 1);
+	static const BYTE srcPix[] = {
+		0xFF, 0x00, 0x00, 0xFF,     // opaque blue
+		0x00, 0xFF, 0x00, 0x80,     // half-transparent green
+		0x00, 0x00, 0xFF, 0x00,     // fully transparent red
+	};
+	memcpy(src.pix.data(), srcPix, sizeof(srcPix));
+
+	// composite at the top left
+	HighScoreRasterizer::Composite(dst, 0, 0, src, 0, 0, 3, 1);
+	const BYTE *p = dst.Row(0);
+	CHECK(p[0] == 0xFF && p[1] == 0 && p[2] == 0 && p[3] == 0xFF);
+	CHECK(p[4] == 0 && p[5] == 0x80 && p[6] == 0 && p[7] == 0xFF);
+	CHECK(p[8] == 0 && p[9] == 0 && p[10] == 0 && p[11] == 0xFF);
+
+	// composite partly off the left and bottom edges: the first source
+	// pixel is clipped, so the green lands at (0,3), and the transparent
+	// red at (1,3) leaves the black showing
+	HighScoreRasterizer::Composite(dst, -1, 3, src, 0, 0, 3, 5);
+	p = dst.Row(3);
+	CHECK(p[0] == 0 && p[1] == 0x80 && p[2] == 0 && p[3] == 0xFF);
+	CHECK(p[4] == 0 && p[5] == 0 && p[6] == 0 && p[7] == 0xFF);
+
+	// completely outside: nothing changes
+	Image before = dst;
+	HighScoreRasterizer::Composite(dst, 4, 0, src, 0, 0, 3, 1);
+	HighScoreRasterizer::Composite(dst, 0, -1, src, 0, 0, 3, 1);
+	HighScoreRasterizer::Composite(dst, 0, 0, src, 3, 0, 3, 1);
+	CHECK(dst.pix == before.pix);
+}
+
+// DMD-style slides against the golden images
+TEST_CASE(HighScoreRasterizerDMDGolden)
+{
+	static const struct
+	{
+		const char *name;
+		const DMDFont *font;
+		BYTE r, g, b;
+		std::list<TSTRING> group;
+	} cases[] = {
+		{ "dmd_2line_7px", &DMDFonts::Font_CC_7px_az, 255, 88, 32, { _T("GRAND CHAMPION"), _T("MJR  52,000,000") } },
+		{ "dmd_3line_5px", &DMDFonts::Font_CC_5px_AZ, 255, 255, 255, { _T("HIGHEST SCORES"), _T("1) ABC 12,345,678"), _T("2) DEF 9,000,000") } },
+		{ "dmd_1line_12px", &DMDFonts::Font_CC_12px_az, 0, 255, 0, { _T("Replay 350,000") } },
+	};
+
+	for (auto &c : cases)
+	{
+		DMDFont::Color colors[16];
+		HighScoreRasterizer::BuildColorRamp(colors, c.r, c.g, c.b);
+		Image image;
+		HighScoreRasterizer::RenderDMD(image, c.group, c.font, colors);
+		CHECK(image.width == 128 && image.height == 32);
+		CheckGolden(t, c.name, image);
+	}
+}
+
+// Alphanumeric-style slides against the golden images
+TEST_CASE(HighScoreRasterizerAlphaGolden)
+{
+	Atlas atlas;
+	MakeAtlas(atlas, 8, 12);
+
+	// one slide show with a 2-line and a 3-line group, which share a
+	// 3-line grid, plus a 2-line slide show on the default grid
+	std::list<std::list<TSTRING>> show = {
+		{ _T("GRAND CHAMPION"), _T("MJR 1,234,567,890") },
+		{ _T("HIGHEST SCORES"), _T("1) ABC 12.5"), _T("2) DEF 9,000,000") },
+	};
+	std::list<std::list<TSTRING>> small = {
+		{ _T("REPLAY"), _T("3,500,000") },
+	};
+
+	int wid, ht;
+	Image image;
+	HighScoreRasterizer::GetAlphaGridSize(show, wid, ht);
+	HighScoreRasterizer::RenderAlpha(image, atlas, show.front(), wid, ht);
+	CheckGolden(t, "alpha_grid3_group1", image);
+	HighScoreRasterizer::RenderAlpha(image, atlas, show.back(), wid, ht);
+	CheckGolden(t, "alpha_grid3_group2", image);
+
+	HighScoreRasterizer::GetAlphaGridSize(small, wid, ht);
+	HighScoreRasterizer::RenderAlpha(image, atlas, small.front(), wid, ht);
+	CheckGolden(t, "alpha_grid2", image);
+}
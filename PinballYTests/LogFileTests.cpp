@@ -0,0 +1,184 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// LogFile tests
+
+#include "stdafx.h"
+#include <thread>
+#include <algorithm>
+#include "../PinballY/LogFile.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Read the log file.  The log holds the file open for writing, but
+	// allows shared reading.
+	std::string ReadLog()
+	{
+		TCHAR fname[MAX_PATH];
+		GetExeFilePath(fname, countof(fname));
+		PathAppend(fname, _T("PinballY.log"));
+
+		std::string s;
+		HandleHolder h = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (h == INVALID_HANDLE_VALUE)
+			return s;
+
+		char buf[65536];
+		DWORD n;
+		while (ReadFile(h, buf, sizeof(buf), &n, NULL) && n != 0)
+			s.append(buf, n);
+		return s;
+	}
+
+	// Log a series of messages from one thread, tagged with the thread
+	// number and sequence number
+	void LogSeries(int thread, int n, bool flush)
+	{
+		auto log = LogFile::Get();
+		for (int i = 0; i < n; ++i)
+		{
+			log->Write(_T("T%d %d\n"), thread, i);
+			if (flush && i % 100 == 0)
+				log->Flush();
+		}
+	}
+
+	// Per-call timing statistics, in microseconds
+	struct CallTimes
+	{
+		std::vector<double> samples;
+
+		void Report(TestContext &t, const char *desc)
+		{
+			std::sort(samples.begin(), samples.end());
+			double sum = 0.0;
+			for (auto x : samples)
+				sum += x;
+			size_t n = samples.size();
+			t.Log("%-28s mean %6.2f us, median %6.2f us, 99%% %7.2f us, max %8.1f us",
+				desc, sum / n, samples[n / 2], samples[n * 99 / 100], samples[n - 1]);
+		}
+	};
+
+	// Time a series of calls to a logging function, one sample per call
+	template<typename Func> void TimeCalls(CallTimes &ct, int thread, int n, Func func)
+	{
+		LARGE_INTEGER freq, t0, t1;
+		QueryPerformanceFrequency(&freq);
+		double usPerTick = 1.0e6 / freq.QuadPart;
+		ct.samples.reserve(n);
+		for (int i = 0; i < n; ++i)
+		{
+			QueryPerformanceCounter(&t0);
+			func(thread, i);
+			QueryPerformanceCounter(&t1);
+			ct.samples.push_back((t1.QuadPart - t0.QuadPart) * usPerTick);
+		}
+	}
+
+	// Run a timing series on several threads at once, collecting the
+	// samples from all threads
+	template<typename Func> void TimeThreads(CallTimes &ct, int nThreads, int n, Func func)
+	{
+		std::vector<CallTimes> per(nThreads);
+		std::vector<std::thread> threads;
+		for (int i = 0; i < nThreads; ++i)
+			threads.emplace_back([&per, i, n, &func]() { TimeCalls(per[i], i, n, func); });
+		for (auto &th : threads)
+			th.join();
+		for (auto &p : per)
+			ct.samples.insert(ct.samples.end(), p.samples.begin(), p.samples.end());
+	}
+}
+
+// Messages from concurrent threads all reach the file, each thread's
+// in the order written, with explicit flushes racing the writer thread
+TEST_CASE(LogFileConcurrentOrder)
+{
+	LogFile::Init();
+
+	const int nThreads = 4, nPerThread = 5000;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < nThreads; ++i)
+		threads.emplace_back(LogSeries, i, nPerThread, i == 0);
+	for (auto &th : threads)
+		th.join();
+	LogFile::Get()->Flush();
+
+	// check the messages
+	std::string s = ReadLog();
+	std::vector<int> next(nThreads, 0);
+	int nBad = 0;
+	for (size_t pos = 0; pos < s.length(); )
+	{
+		size_t eol = s.find("\r\n", pos);
+		if (!CHECK(eol != std::string::npos))
+			break;
+
+		int thread, seq;
+		if (sscanf_s(s.c_str() + pos, "T%d %d", &thread, &seq) == 2)
+		{
+			if (thread < 0 || thread >= nThreads || seq != next[thread]++)
+				++nBad;
+		}
+		pos = eol + 2;
+	}
+	CHECK(nBad == 0);
+	for (auto n : next)
+		CHECK(n == nPerThread);
+
+	LogFile::Shutdown();
+}
+
+// Caller-side cost of a log call, compared with formatting and writing
+// the message synchronously under a lock, which is what a caller would
+// pay without the queue
+BENCHMARK(LogFileWriteCost)
+{
+	const int nCalls = 50000;
+	const TCHAR *fmt = _T("Video: frame %d presented, latency %.2f ms, %s\n");
+
+	LogFile::Init();
+	for (int nThreads : { 1, 4 })
+	{
+		CallTimes ct;
+		TimeThreads(ct, nThreads, nCalls, [fmt](int thread, int i) {
+			LogFile::Get()->Write(LogFile::Info, LogFile::SysVideo, fmt, i, 1.25 * thread, _T("status line text"));
+		});
+		char desc[64];
+		sprintf_s(desc, "queued, %d thread(s)", nThreads);
+		ct.Report(t, desc);
+	}
+
+	// a disabled message should cost almost nothing
+	{
+		CallTimes ct;
+		TimeCalls(ct, 0, nCalls, [fmt](int thread, int i) {
+			LogFile::Get()->Write(LogFile::Debug, LogFile::SysVideo, fmt, i, 1.25, _T("status line text"));
+		});
+		ct.Report(t, "disabled (Debug level)");
+	}
+	LogFile::Shutdown();
+
+	// synchronous baseline
+	TempFile tf;
+	HandleHolder h = CreateFile(tf.GetPath(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	CriticalSection lock;
+	for (int nThreads : { 1, 4 })
+	{
+		CallTimes ct;
+		TimeThreads(ct, nThreads, nCalls, [fmt, &h, &lock](int thread, int i) {
+			TCHAR buf[256];
+			_stprintf_s(buf, fmt, i, 1.25 * thread, _T("status line text"));
+			CSTRING c = TSTRINGToCSTRING(buf);
+			CriticalSectionLocker locker(lock);
+			DWORD n;
+			WriteFile(h, c.data(), (DWORD)c.length(), &n, NULL);
+		});
+		char desc[64];
+		sprintf_s(desc, "synchronous, %d thread(s)", nThreads);
+		ct.Report(t, desc);
+	}
+}
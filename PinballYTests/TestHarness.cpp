@@ -0,0 +1,146 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Test harness
+
+#include "stdafx.h"
+#include "TestHarness.h"
+
+// registered test list
+static TestRegistration *firstTest = nullptr;
+
+TestRegistration::TestRegistration(const char *name, TestFunc *func, bool isBenchmark, bool isTool) :
+	name(name), func(func), isBenchmark(isBenchmark), isTool(isTool)
+{
+	// link it into the list
+	nxt = firstTest;
+	firstTest = this;
+}
+
+bool TestContext::Check(bool cond, const char *expr, const char *file, int line)
+{
+	if (!cond)
+	{
+		printf("  FAILED: %s (%s:%d)\n", expr, file, line);
+		++nFailed;
+	}
+	return cond;
+}
+
+void TestContext::Fail(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	printf("  FAILED: ");
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+	++nFailed;
+}
+
+void TestContext::Log(const char *fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	printf("  ");
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+}
+
+bool FindSourceTreeFile(std::filesystem::path &result, const char *relPath)
+{
+	// get the program folder
+	WCHAR exe[MAX_PATH];
+	GetModuleFileNameW(NULL, exe, countof(exe));
+
+	// search upwards from each starting folder
+	for (auto dir : { std::filesystem::path(exe).parent_path(), std::filesystem::current_path() })
+	{
+		for (;;)
+		{
+			auto p = dir / std::filesystem::u8path(relPath);
+			std::error_code ec;
+			if (std::filesystem::exists(p, ec))
+			{
+				result = p;
+				return true;
+			}
+
+			// stop at the root
+			auto parent = dir.parent_path();
+			if (parent == dir)
+				break;
+			dir = parent;
+		}
+	}
+
+	// not found
+	return false;
+}
+
+TempFile::TempFile()
+{
+	TCHAR dir[MAX_PATH], name[MAX_PATH];
+	GetTempPath(countof(dir), dir);
+	if (GetTempFileName(dir, _T("pyt"), 0, name) != 0)
+		path = name;
+}
+
+TempFile::~TempFile()
+{
+	if (path.length() != 0)
+		DeleteFile(path.c_str());
+}
+
+bool TempFile::Write(const void *data, size_t len)
+{
+	HandleHolder h = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD actual;
+	return h != NULL && h != INVALID_HANDLE_VALUE
+		&& WriteFile(h, data, (DWORD)len, &actual, NULL) && actual == len;
+}
+
+int main(int argc, char **argv)
+{
+	// parse options
+	bool bench = false;
+	std::vector<const char*> names;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-bench") == 0)
+			bench = true;
+		else
+			names.push_back(argv[i]);
+	}
+
+	// The list is in reverse order of registration, so reverse it to
+	// run the tests in source order.
+	std::vector<TestRegistration*> tests;
+	for (auto r = firstTest; r != nullptr; r = r->nxt)
+		tests.insert(tests.begin(), r);
+
+	// run the selected tests
+	int nRun = 0, nFailed = 0;
+	for (auto r : tests)
+	{
+		// If names were given, run only the named tests.  Otherwise
+		// run all of the tests, plus the benchmarks if -bench was given.
+		// Tools only run when named.
+		if (names.size() != 0 ?
+			std::none_of(names.begin(), names.end(), [r](const char *n) { return strcmp(n, r->name) == 0; }) :
+			(r->isTool || (r->isBenchmark && !bench)))
+			continue;
+
+		printf("%s %s\n", r->isTool ? "Tool" : r->isBenchmark ? "Benchmark" : "Test", r->name);
+		TestContext t(r->name);
+		r->func(t);
+		++nRun;
+		if (t.nFailed != 0)
+			++nFailed;
+	}
+
+	// summarize
+	printf("\n%d run, %d failed\n", nRun, nFailed);
+	return nFailed;
+}
@@ -0,0 +1,127 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Test harness
+//
+// This is a minimal harness for the unit tests and benchmarks for the
+// main program's self-contained components.  Each test or benchmark is
+// a function defined with the TEST_CASE() or BENCHMARK() macro, which
+// registers it with the harness at static initialization time.
+//
+// There's also a TOOL() macro, for helper functions that aren't tests
+// as such, like the one that records HID reports from a live device for
+// the HID benchmarks.  Tools only run when named on the command line.
+//
+// Command line usage:
+//
+//   PinballYTests                run all tests
+//   PinballYTests -bench         run all tests and benchmarks
+//   PinballYTests name...        run only the named tests/benchmarks/tools
+//
+// The process exit code is the number of tests that failed, so the
+// program can be used directly as a build step.
+//
+
+#pragma once
+
+// Test context.  This is passed to each test function, to collect the
+// test results and report progress.
+class TestContext
+{
+public:
+	TestContext(const char *name) : name(name), nFailed(0) { }
+
+	// Check a condition.  If the condition is false, this records a
+	// failure, citing the source expression and location.  Returns the
+	// condition, so that the caller can bail out on failure if later
+	// steps depend on the result.
+	bool Check(bool cond, const char *expr, const char *file, int line);
+
+	// Record a failure, with a printf-style message
+	void Fail(const char *fmt, ...);
+
+	// Write an informational message, such as a benchmark result
+	void Log(const char *fmt, ...);
+
+	// test name
+	const char *name;
+
+	// number of failures so far
+	int nFailed;
+};
+
+// Test/benchmark registration
+struct TestRegistration
+{
+	typedef void TestFunc(TestContext &t);
+	TestRegistration(const char *name, TestFunc *func, bool isBenchmark, bool isTool = false);
+
+	const char *name;
+	TestFunc *func;
+	bool isBenchmark;
+	bool isTool;
+	TestRegistration *nxt;
+};
+
+// Define a test or benchmark function
+#define TEST_CASE(name) \
+	static void name(TestContext &t); \
+	static TestRegistration name##_registration(#name, &name, false); \
+	static void name(TestContext &t)
+
+#define BENCHMARK(name) \
+	static void name(TestContext &t); \
+	static TestRegistration name##_registration(#name, &name, true); \
+	static void name(TestContext &t)
+
+#define TOOL(name) \
+	static void name(TestContext &t); \
+	static TestRegistration name##_registration(#name, &name, false, true); \
+	static void name(TestContext &t)
+
+// Check a condition within a test function
+#define CHECK(cond) t.Check(!!(cond), #cond, __FILE__, __LINE__)
+
+// Elapsed-time timer for benchmarks
+class Stopwatch
+{
+public:
+	Stopwatch() { Reset(); }
+
+	// restart the timer
+	void Reset() { t0 = std::chrono::steady_clock::now(); }
+
+	// elapsed time since the last reset, in milliseconds
+	double ElapsedMs() const 
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+protected:
+	std::chrono::steady_clock::time_point t0;
+};
+
+// Find a file in the source tree, given its path relative to the top
+// level of the tree (e.g., "assets/ipdbTableList.csv").  This searches
+// upwards from the program folder and the working directory, so that
+// it finds the file whether the program is run from the build output
+// folder or from the solution folder.  Returns true if found.
+bool FindSourceTreeFile(std::filesystem::path &result, const char *relPath);
+
+// Temporary file.  This creates a uniquely named empty file in the
+// system temp folder, and deletes it when the object is destroyed.
+class TempFile
+{
+public:
+	TempFile();
+	~TempFile();
+
+	// get the file's path
+	const TCHAR *GetPath() const { return path.c_str(); }
+
+	// replace the file's contents
+	bool Write(const void *data, size_t len);
+
+protected:
+	TSTRING path;
+};
@@ -0,0 +1,298 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// Text layout and batching tests
+
+#include "stdafx.h"
+#include "../PinballY/TextLayout.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// Synthetic font metrics.  Each printable ASCII character gets an
+	// 8x12 cell in a 16-column grid on a 128x128 texture, with a 1-unit
+	// left offset and 1-unit advance past the cell.  '?' is the default
+	// character, and there's one glyph outside the Latin-1 range, for
+	// Greek capital omega.
+	const float lineSpacing = 14.0f;
+	void MakeMetrics(TextFontMetrics &m, bool withDefault = true)
+	{
+		std::vector<TextFontMetrics::Glyph> glyphs;
+		auto AddGlyph = [&glyphs](uint32_t ch, int cell) {
+			LONG x = (cell % 16) * 8, y = (cell / 16) * 12;
+			glyphs.push_back({ ch, { x, y, x + 8, y + 12 }, 1.0f, 2.0f, 1.0f });
+		};
+		for (uint32_t ch = 32; ch < 127; ++ch)
+		{
+			if (ch != '?' || withDefault)
+				AddGlyph(ch, ch - 32);
+		}
+		AddGlyph(0x3A9, 95);
+		m.Init(std::move(glyphs), '?', lineSpacing, 128, 128);
+	}
+
+	// Check a quad's position and texture cell
+	bool QuadIs(const TextGlyphQuad &q, float left, float top, int cell)
+	{
+		float u0 = (cell % 16) * 8 / 128.0f, v0 = (cell / 16) * 12 / 128.0f;
+		return q.left == left && q.top == top && q.right == left + 8 && q.bottom == top - 12
+			&& q.u0 == u0 && q.v0 == v0 && q.u1 == u0 + 8 / 128.0f && q.v1 == v0 + 12 / 128.0f;
+	}
+
+	// Status-line text for the benchmarks, typical of the playfield
+	// view's status messages and the frame counter
+	const TCHAR *const statusLines[] = {
+		_T("Attract Mode"),
+		_T("Press Start to play"),
+		_T("Medieval Madness (Williams 1997)"),
+		_T("Played 27 times, 4 hours 12 minutes total"),
+		_T("High score: MJR 52,000,000"),
+		_T("Free Play"),
+		_T("Credits: 3"),
+		_T("Select a table with the flipper buttons"),
+		_T("Twilight Zone (Bally 1993)"),
+		_T("Categories: Favorites, Bally, 1990s"),
+	};
+}
+
+// quad equality, for comparing layouts
+static bool operator==(const TextGlyphQuad &a, const TextGlyphQuad &b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Glyph lookup: Latin-1 table, hash for other characters, default glyph
+TEST_CASE(TextLayoutGlyphLookup)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+
+	CHECK(m.FindGlyph('A') != nullptr && m.FindGlyph('A')->charCode == 'A');
+	CHECK(m.FindGlyph(' ')->charCode == ' ');
+	CHECK(m.FindGlyph(0x3A9)->charCode == 0x3A9);
+
+	// characters the font doesn't have map to the default glyph, in and
+	// out of the Latin-1 range
+	CHECK(m.FindGlyph(0xE9)->charCode == '?');
+	CHECK(m.FindGlyph(0x1F)->charCode == '?');
+	CHECK(m.FindGlyph(0x4E00)->charCode == '?');
+
+	// with no default character, missing glyphs can't be laid out
+	TextFontMetrics nd;
+	MakeMetrics(nd, false);
+	CHECK(nd.FindGlyph(0xE9) == nullptr);
+	TextLayout layout;
+	CHECK(nd.LayoutText(_T("AB"), layout));
+	CHECK(!nd.LayoutText(_T("A\x00E9"), layout));
+	CHECK(nd.GetLayout(_T("\x4E00")) == nullptr);
+}
+
+// Quad placement: offsets, advances, spaces, newlines, and returns
+TEST_CASE(TextLayoutQuads)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+
+	// Each character cell starts at the pen position plus the 1-unit x
+	// offset, and the pen then advances by the cell width plus the 1-unit
+	// advance, so cells are 10 units apart.  The y offset moves the cell
+	// down (-Y in D3D) by 2 units.
+	TextLayout layout;
+	CHECK(m.LayoutText(_T("AB C\r\nD"), layout));
+	if (CHECK(layout.size() == 4))
+	{
+		CHECK(QuadIs(layout[0], 1, -2, 'A' - 32));
+		CHECK(QuadIs(layout[1], 11, -2, 'B' - 32));
+		CHECK(QuadIs(layout[2], 31, -2, 'C' - 32));
+		CHECK(QuadIs(layout[3], 1, -2 - lineSpacing, 'D' - 32));
+	}
+
+	// a missing character uses the default glyph's cell
+	CHECK(m.LayoutText(_T("\x00E9"), layout));
+	CHECK(layout.size() == 1 && QuadIs(layout[0], 1, -2, '?' - 32));
+
+	// measuring agrees with the layout
+	POINTF sz = m.MeasureText(_T("AB C"));
+	CHECK(sz.x == 40 && sz.y == 0);
+	sz = m.MeasureText(_T("AB\nC"));
+	CHECK(sz.x == 10 && sz.y == -lineSpacing);
+}
+
+// Layout cache: repeated strings share a layout; a full cache starts over
+TEST_CASE(TextLayoutCache)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+
+	auto a = m.GetLayout(_T("Credits: 3"));
+	auto b = m.GetLayout(_T("Credits: 3"));
+	CHECK(a != nullptr && a == b);
+	CHECK(m.GetLayout(_T("Credits: 4")) != a);
+
+	// fill the cache to capacity, which discards the old entries
+	TCHAR buf[32];
+	for (size_t i = 0; i < TextFontMetrics::layoutCacheCapacity; ++i)
+	{
+		_stprintf_s(buf, _T("line %d"), (int)i);
+		m.GetLayout(buf);
+	}
+	auto c = m.GetLayout(_T("Credits: 3"));
+	CHECK(c != nullptr && c != a && *c == *a);
+
+	// re-initializing the metrics discards cached layouts
+	MakeMetrics(m);
+	CHECK(m.GetLayout(_T("Credits: 3")) != c);
+}
+
+// Batch vertices: position, rotation, and color
+TEST_CASE(TextLayoutBatchVertices)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+	auto layout = m.GetLayout(_T("AB"));
+
+	TextBatch batch;
+	DirectX::XMFLOAT4 red(1, 0, 0, 1), green(0, 1, 0, 0.5f);
+	int tex1 = 0;
+	batch.Add(*layout, 100, 50, 0, red, &tex1);
+	CHECK(batch.GetQuadCount() == 2);
+
+	// Unrotated, the corners are offset by (x, -y), in top-left,
+	// top-right, bottom-right, bottom-left order
+	auto &v = batch.GetVertices();
+	if (CHECK(v.size() == 8))
+	{
+		CHECK(v[0].position.x == 101 && v[0].position.y == -52);
+		CHECK(v[1].position.x == 109 && v[1].position.y == -52);
+		CHECK(v[2].position.x == 109 && v[2].position.y == -64);
+		CHECK(v[3].position.x == 101 && v[3].position.y == -64);
+		CHECK(v[4].position.x == 111 && v[4].position.y == -52);
+		CHECK(v[0].texCoord.x == (*layout)[0].u0 && v[2].texCoord.y == (*layout)[0].v1);
+		CHECK(v[5].color.x == 1 && v[5].color.y == 0 && v[5].color.w == 1);
+	}
+
+	// Rotated a quarter turn, (x, y) goes to (-y, x) before the offset
+	const float pi = 3.14159265f;
+	batch.Add(*layout, 0, 0, pi / 2, green, &tex1);
+	if (CHECK(v.size() == 16))
+	{
+		CHECK(fabsf(v[8].position.x - 2) < 1e-4f && fabsf(v[8].position.y - 1) < 1e-4f);
+		CHECK(fabsf(v[10].position.x - 14) < 1e-4f && fabsf(v[10].position.y - 9) < 1e-4f);
+		CHECK(v[8].color.y == 1 && v[8].color.w == 0.5f);
+	}
+
+	// clearing empties the batch
+	batch.Clear();
+	CHECK(batch.GetQuadCount() == 0 && batch.GetVertices().size() == 0);
+}
+
+// Draw call planning: texture runs, empty items, and the per-call limit
+TEST_CASE(TextLayoutBatchDrawCalls)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+	auto three = m.GetLayout(_T("abc"));
+	auto five = m.GetLayout(_T("hello"));
+	auto empty = m.GetLayout(_T("   "));
+	CHECK(empty != nullptr && empty->size() == 0);
+
+	int tex1 = 0, tex2 = 0;
+	DirectX::XMFLOAT4 white(1, 1, 1, 1);
+	TextBatch batch;
+	batch.Add(*three, 0, 0, 0, white, &tex1);
+	batch.Add(*empty, 0, 0, 0, white, &tex2);    // doesn't break the tex1 run
+	batch.Add(*five, 0, 0, 0, white, &tex1);
+	batch.Add(*five, 0, 0, 0, white, &tex2);
+	batch.Add(*three, 0, 0, 0, white, &tex1);
+
+	// with no effective limit, one call per texture run
+	std::vector<TextBatch::DrawCall> calls;
+	batch.PlanDrawCalls(1000, calls);
+	if (CHECK(calls.size() == 3))
+	{
+		CHECK(calls[0].texture == &tex1 && calls[0].firstQuad == 0 && calls[0].nQuads == 8);
+		CHECK(calls[1].texture == &tex2 && calls[1].firstQuad == 8 && calls[1].nQuads == 5);
+		CHECK(calls[2].texture == &tex1 && calls[2].firstQuad == 13 && calls[2].nQuads == 3);
+	}
+
+	// with a limit of 4 quads per call, the runs are split into chunks
+	batch.PlanDrawCalls(4, calls);
+	static const size_t expect[][2] = { { 0, 4 }, { 4, 4 }, { 8, 4 }, { 12, 1 }, { 13, 3 } };
+	if (CHECK(calls.size() == countof(expect)))
+	{
+		for (size_t i = 0; i < countof(expect); ++i)
+			CHECK(calls[i].firstQuad == expect[i][0] && calls[i].nQuads == expect[i][1]);
+		CHECK(calls[3].texture == &tex2 && calls[4].texture == &tex1);
+	}
+
+	// the calls cover the whole batch
+	size_t total = 0;
+	for (auto &c : calls)
+		total += c.nQuads;
+	CHECK(total == batch.GetQuadCount());
+}
+
+// Per-frame cost of laying out and batching a screenful of status text,
+// laying out every string on every frame (as the text drawing code did
+// before the layout cache), versus using the cache
+BENCHMARK(TextLayoutStatusLines)
+{
+	TextFontMetrics m;
+	MakeMetrics(m);
+	DirectX::XMFLOAT4 white(1, 1, 1, 1);
+	int tex = 0;
+	const int nFrames = 20000;
+
+	// uncached: lay out each string every frame
+	{
+		TextBatch batch;
+		TextLayout layout;
+		Stopwatch sw;
+		for (int frame = 0; frame < nFrames; ++frame)
+		{
+			batch.Clear();
+			float y = 0;
+			for (auto s : statusLines)
+			{
+				m.LayoutText(s, layout);
+				batch.Add(layout, 10, y += lineSpacing, 0, white, &tex);
+			}
+		}
+		t.Log("uncached layout + batch: %6.2f us/frame (%d quads)", sw.ElapsedMs() * 1000.0 / nFrames, (int)batch.GetQuadCount());
+	}
+
+	// cached: look up the layouts, as TextDrawItem::Load() does
+	{
+		TextBatch batch;
+		Stopwatch sw;
+		for (int frame = 0; frame < nFrames; ++frame)
+		{
+			batch.Clear();
+			float y = 0;
+			for (auto s : statusLines)
+				batch.Add(*m.GetLayout(s), 10, y += lineSpacing, 0, white, &tex);
+		}
+		t.Log("cached layout + batch:   %6.2f us/frame", sw.ElapsedMs() * 1000.0 / nFrames);
+	}
+
+	// batch only: the per-frame cost when the items are unchanged, so
+	// the layouts are already attached to the items
+	{
+		std::vector<std::shared_ptr<const TextLayout>> layouts;
+		for (auto s : statusLines)
+			layouts.push_back(m.GetLayout(s));
+
+		TextBatch batch;
+		std::vector<TextBatch::DrawCall> calls;
+		Stopwatch sw;
+		for (int frame = 0; frame < nFrames; ++frame)
+		{
+			batch.Clear();
+			float y = 0;
+			for (auto &l : layouts)
+				batch.Add(*l, 10, y += lineSpacing, 0, white, &tex);
+			batch.PlanDrawCalls(65536 / 4, calls);
+		}
+		t.Log("batch + plan only:       %6.2f us/frame (%d draw call(s))", sw.ElapsedMs() * 1000.0 / nFrames, (int)calls.size());
+	}
+}
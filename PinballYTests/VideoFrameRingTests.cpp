@@ -0,0 +1,279 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// VideoFrameRing tests
+
+#include "stdafx.h"
+#include <thread>
+#include <atomic>
+#include "../PinballY/VideoFrameRing.h"
+#include "TestHarness.h"
+
+namespace
+{
+	// decode a frame: lock a buffer, fill it with the frame number, and unlock it
+	int Decode(VideoFrameRing &ring, size_t bufSize, UINT32 frame, INT64 time_us)
+	{
+		int slot = ring.Lock();
+		if (slot != VideoFrameRing::NoSlot)
+		{
+			UINT32 *p = reinterpret_cast<UINT32*>(ring.GetBuffer(slot));
+			std::fill(p, p + bufSize / sizeof(UINT32), frame);
+			ring.Unlock(slot, time_us);
+		}
+		return slot;
+	}
+
+	// check that a buffer holds a complete frame, returning the frame number
+	bool CheckFrame(VideoFrameRing &ring, size_t bufSize, int slot, UINT32 &frame)
+	{
+		const UINT32 *p = reinterpret_cast<const UINT32*>(ring.GetBuffer(slot));
+		frame = p[0];
+		return std::all_of(p, p + bufSize / sizeof(UINT32), [frame](UINT32 x) { return x == frame; });
+	}
+}
+
+// Basic allocation and buffer layout
+TEST_CASE(VideoFrameRingAllocate)
+{
+	VideoFrameRing ring;
+	CHECK(ring.Lock() == VideoFrameRing::NoSlot);
+
+	CHECK(ring.Allocate(4, 1000, 64));
+	CHECK(ring.GetSlotCount() == 4);
+	for (int i = 0; i <= 4; ++i)
+		CHECK(((UINT_PTR)ring.GetBuffer(i) % 64) == 0);
+	CHECK(ring.GetBuffer(1) - ring.GetBuffer(0) >= 1000);
+	CHECK(ring.IsScratch(4) && !ring.IsScratch(3));
+}
+
+// Run many frames through a small ring, one at a time, so that the
+// slots are reused many times over
+TEST_CASE(VideoFrameRingWraparound)
+{
+	const size_t bufSize = 256;
+	VideoFrameRing ring;
+	if (!CHECK(ring.Allocate(3, bufSize, 16)))
+		return;
+
+	const UINT32 nFrames = 1000;
+	std::vector<int> uses(3, 0);
+	for (UINT32 i = 1; i <= nFrames; ++i)
+	{
+		int slot = Decode(ring, bufSize, i, i * 10);
+		if (!CHECK(slot >= 0 && slot < 3))
+			return;
+		++uses[slot];
+
+		CHECK(ring.Present(slot));
+		CHECK(ring.HasPresentedFrame());
+		int taken = ring.Take(i * 10 + 5);
+		CHECK(taken == slot);
+		CHECK(!ring.HasPresentedFrame());
+
+		UINT32 frame;
+		CHECK(CheckFrame(ring, bufSize, taken, frame) && frame == i);
+		ring.Release(taken);
+	}
+
+	// every frame was rendered, none dropped or starved
+	VideoFrameRing::Stats s;
+	ring.GetStats(s);
+	CHECK(s.nDecoded == nFrames && s.nPresented == nFrames && s.nRendered == nFrames);
+	CHECK(s.nDropped == 0 && s.nStarved == 0);
+	CHECK(s.latencyMax_us == 5 && s.GetAvgLatency_us() == 5.0);
+
+	// the free-slot search always finds the first slot when it's free
+	CHECK(uses[0] == (int)nFrames);
+
+	// now keep two frames in flight, so that the ring cycles through slots
+	std::fill(uses.begin(), uses.end(), 0);
+	int prev = Decode(ring, bufSize, 0, 0);
+	ring.Present(prev);
+	for (UINT32 i = 1; i <= nFrames; ++i)
+	{
+		int rendering = ring.Take(0);
+		int slot = Decode(ring, bufSize, i, 0);
+		CHECK(slot != rendering && !ring.IsScratch(slot));
+		++uses[slot];
+		ring.Release(rendering);
+		ring.Present(slot);
+	}
+	CHECK(uses[0] != 0 && uses[1] != 0);
+}
+
+// Presenting frames faster than the renderer takes them replaces the
+// mailbox frame, and the renderer only sees the newest
+TEST_CASE(VideoFrameRingOverwriteOldest)
+{
+	const size_t bufSize = 64;
+	VideoFrameRing ring;
+	if (!CHECK(ring.Allocate(4, bufSize, 16)))
+		return;
+
+	int a = Decode(ring, bufSize, 1, 100);
+	int b = Decode(ring, bufSize, 2, 200);
+	int c = Decode(ring, bufSize, 3, 300);
+	CHECK(a != b && b != c && a != c);
+
+	// present all three before the renderer gets around to taking one
+	CHECK(ring.Present(a));
+	CHECK(ring.Present(b));
+	CHECK(ring.Present(c));
+
+	// only the newest frame comes out of the mailbox
+	int t1 = ring.Take(1000);
+	UINT32 frame;
+	CHECK(t1 == c && CheckFrame(ring, bufSize, t1, frame) && frame == 3);
+	CHECK(ring.Take(1000) == VideoFrameRing::NoSlot);
+
+	// the replaced frames went back to the pool, so with one slot
+	// rendering, the other three are free to lock again
+	int d = Decode(ring, bufSize, 4, 400), e = Decode(ring, bufSize, 5, 500), f = Decode(ring, bufSize, 6, 600);
+	CHECK(d != c && e != c && f != c);
+	CHECK(!ring.IsScratch(d) && !ring.IsScratch(e) && !ring.IsScratch(f));
+
+	// the ring is now full; another lock gets the scratch buffer
+	int g = ring.Lock();
+	CHECK(ring.IsScratch(g));
+	ring.Unlock(g, 700);
+	CHECK(!ring.Present(g));
+
+	VideoFrameRing::Stats s;
+	ring.GetStats(s);
+	CHECK(s.nDropped == 3);
+	CHECK(s.nStarved == 1);
+	CHECK(s.latencyMax_us == 700);
+	ring.Release(t1);
+}
+
+// A decoded frame older than the newest presented frame has been
+// skipped by the decoder, so the ring reclaims it when it runs out of
+// free buffers
+TEST_CASE(VideoFrameRingReclaimSkipped)
+{
+	const size_t bufSize = 64;
+	VideoFrameRing ring;
+	if (!CHECK(ring.Allocate(3, bufSize, 16)))
+		return;
+
+	int a = Decode(ring, bufSize, 1, 0);	// skipped, never presented
+	int b = Decode(ring, bufSize, 2, 0);
+	int c = Decode(ring, bufSize, 3, 0);	// decoded ahead, not yet presented
+	CHECK(ring.Present(b));
+
+	// no free slots: the lock reclaims 'a', but not 'c', which is
+	// newer than the presented frame
+	int d = ring.Lock();
+	CHECK(d == a);
+	ring.Unlock(d, 0);
+
+	// 'a' can't be presented now that it's been reclaimed and reused
+	// for a later frame; 'c' is still valid
+	CHECK(ring.Present(c));
+	CHECK(ring.Take(0) == c);
+
+	VideoFrameRing::Stats s;
+	ring.GetStats(s);
+	CHECK(s.nDropped == 2);	// 'a' reclaimed, 'b' replaced in the mailbox
+}
+
+// Direct presentation bypasses the mailbox
+TEST_CASE(VideoFrameRingPresentDirect)
+{
+	const size_t bufSize = 64;
+	VideoFrameRing ring;
+	if (!CHECK(ring.Allocate(2, bufSize, 16)))
+		return;
+
+	int a = Decode(ring, bufSize, 1, 10);
+	CHECK(ring.PresentDirect(a, 40));
+	CHECK(!ring.HasPresentedFrame());
+	CHECK(!ring.PresentDirect(a, 50));	// already rendering
+
+	// the slot stays busy until released
+	int b = Decode(ring, bufSize, 2, 20);
+	CHECK(b != a);
+	CHECK(ring.IsScratch(ring.Lock()));
+	ring.Release(a);
+	CHECK(ring.Lock() == a);
+
+	VideoFrameRing::Stats s;
+	ring.GetStats(s);
+	CHECK(s.nRendered == 1 && s.latencyMax_us == 30);
+}
+
+// Decoder and renderer on separate threads.  The renderer must see
+// complete frames, in increasing frame order, and a frame must never
+// be overwritten while the renderer holds it.
+TEST_CASE(VideoFrameRingThreads)
+{
+	const size_t bufSize = 4096;
+	VideoFrameRing ring;
+	if (!CHECK(ring.Allocate(4, bufSize, 16)))
+		return;
+
+	const UINT32 nFrames = 100000;
+	std::atomic<bool> done(false);
+	std::atomic<int> errors(0);
+	UINT64 nSeen = 0;
+
+	// decoder/presenter thread
+	std::thread decoder([&]()
+	{
+		for (UINT32 i = 1; i <= nFrames; ++i)
+		{
+			int slot = Decode(ring, bufSize, i, i);
+			if (slot == VideoFrameRing::NoSlot)
+				++errors;
+			ring.Present(slot);
+
+			// give the renderer a chance to keep up some of the time
+			if ((i % 4) == 0)
+				std::this_thread::yield();
+		}
+		done = true;
+	});
+
+	// renderer: take frames until the decoder finishes and the mailbox
+	// is empty
+	UINT32 last = 0;
+	for (;;)
+	{
+		bool finished = done;
+		int slot = ring.Take(0);
+		if (slot == VideoFrameRing::NoSlot)
+		{
+			if (finished)
+				break;
+			std::this_thread::yield();
+			continue;
+		}
+
+		// check the frame, then check it again after a moment, to
+		// make sure the decoder doesn't write into it while we hold it
+		UINT32 frame, frame2;
+		if (!CheckFrame(ring, bufSize, slot, frame) || frame <= last)
+			++errors;
+		std::this_thread::yield();
+		if (!CheckFrame(ring, bufSize, slot, frame2) || frame2 != frame)
+			++errors;
+
+		last = frame;
+		++nSeen;
+		ring.Release(slot);
+	}
+	decoder.join();
+
+	CHECK(errors == 0);
+	CHECK(last == nFrames);
+
+	// every frame is accounted for: presented frames are either
+	// rendered or dropped, and scratch frames are dropped
+	VideoFrameRing::Stats s;
+	ring.GetStats(s);
+	CHECK(s.nRendered == nSeen);
+	CHECK(s.nPresented == s.nRendered + (s.nDropped - s.nStarved));
+	t.Log("%d frames: %d rendered, %d dropped, %d starved", (int)nFrames,
+		(int)s.nRendered, (int)s.nDropped, (int)s.nStarved);
+}
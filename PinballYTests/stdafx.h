@@ -0,0 +1,22 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+// The tests compile some of the main program's source files directly,
+// so we use the main program's precompiled header contents, plus the
+// extra standard headers the test harness needs.
+//
+
+#pragma once
+
+#include "../PinballY/stdafx.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <chrono>
+#include <string>
+#include <filesystem>
+#include <fstream>
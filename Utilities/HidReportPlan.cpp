@@ -0,0 +1,252 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// HID report extraction plan
+
+#include "stdafx.h"
+#include <algorithm>
+#include "HidReportPlan.h"
+
+bool HidReportPlan::CompileButtons(PHIDP_PREPARSED_DATA ppd, const HIDP_CAPS &caps,
+	const HIDP_BUTTON_CAPS *btnCaps, USHORT numBtnCaps,
+	BYTE reportId, USAGE usagePage)
+{
+	// start over with an empty layout
+	buttonsCompiled = false;
+	buttonRuns.clear();
+	buttonNumber.clear();
+
+	// have HidP build a blank report of this type to use as the baseline
+	ULONG len = caps.InputReportByteLength;
+	std::vector<BYTE> blank(len), probe(len);
+	if (HidP_InitializeReportForID(HidP_Input, reportId, ppd, (PCHAR)blank.data(), len) != HIDP_STATUS_SUCCESS)
+		return false;
+
+	// find the bit for each button in the report
+	std::vector<ButtonBit> bits;
+	const HIDP_BUTTON_CAPS *bc = btnCaps;
+	for (USHORT i = 0; i < numBtnCaps; ++i, ++bc)
+	{
+		// skip entries for other reports and usage pages
+		if (bc->ReportID != reportId || bc->UsagePage != usagePage)
+			continue;
+
+		// We can only compile Variable fields, where each button has
+		// its own bit.  (That's bit 0x02 of the Main item data.)  In an
+		// Array field, the report instead lists the usage numbers of
+		// the ON buttons, so there's no fixed bit for each button.
+		if ((bc->BitField & 0x02) == 0)
+			return false;
+
+		// Probe each button in the entry, by setting it in a copy of the
+		// blank report and seeing which bit changed.  Note that we use a
+		// UINT loop counter, since the range could go up to the maximum
+		// USAGE value.
+		UINT first = bc->IsRange ? bc->Range.UsageMin : bc->NotRange.Usage;
+		UINT last = bc->IsRange ? bc->Range.UsageMax : bc->NotRange.Usage;
+		for (UINT usage = first; usage <= last; ++usage)
+		{
+			probe = blank;
+			USAGE u = (USAGE)usage;
+			ULONG n = 1;
+			UINT bitOffset, nBits;
+			if (HidP_SetUsages(HidP_Input, usagePage, bc->LinkCollection, &u, &n, ppd, (PCHAR)probe.data(), len) != HIDP_STATUS_SUCCESS
+				|| !ProbeBits(blank, probe, bitOffset, nBits) || nBits != 1)
+				return false;
+
+			bits.push_back({ bitOffset, u });
+		}
+	}
+
+	// build the layout from the bit list
+	return SetButtonLayout(std::move(bits));
+}
+
+bool HidReportPlan::SetButtonLayout(std::vector<ButtonBit> bits)
+{
+	// start over with an empty layout
+	buttonsCompiled = false;
+	buttonRuns.clear();
+	buttonNumber.clear();
+
+	// put the buttons in report order, and make sure that each one
+	// has its own bit
+	std::sort(bits.begin(), bits.end(), [](const ButtonBit &a, const ButtonBit &b) { return a.bitOffset < b.bitOffset; });
+	for (size_t i = 1; i < bits.size(); ++i)
+	{
+		if (bits[i].bitOffset == bits[i - 1].bitOffset)
+			return false;
+	}
+
+	// Group the buttons into runs of consecutive bits.  The bitmap
+	// index of each button is its position in the sorted list.
+	for (size_t i = 0; i < bits.size(); ++i)
+	{
+		if (buttonRuns.size() != 0 && bits[i].bitOffset == buttonRuns.back().bitOffset + buttonRuns.back().count)
+			buttonRuns.back().count += 1;
+		else
+			buttonRuns.push_back({ bits[i].bitOffset, 1, (UINT)i });
+
+		buttonNumber.push_back(bits[i].usage);
+	}
+
+	// allocate the bitmaps, with all buttons initially OFF
+	size_t nWords = (bits.size() + 31) / 32;
+	bitmap[0].assign(nWords, 0);
+	bitmap[1].assign(nWords, 0);
+	lastIndex = 0;
+
+	// success
+	buttonsCompiled = true;
+	return true;
+}
+
+bool HidReportPlan::CompileValue(PHIDP_PREPARSED_DATA ppd, const HIDP_CAPS &caps,
+	const HIDP_VALUE_CAPS &vc, USAGE usage, ValueField &field)
+{
+	// assume we won't be able to compile it
+	field = ValueField();
+
+	// we can only handle single values of up to 32 bits
+	if (vc.ReportCount != 1 || vc.BitSize == 0 || vc.BitSize > 32)
+		return false;
+
+	// Build two reports, one with the value set to all '1' bits and
+	// one with it set to all '0' bits.  The bits that differ are the
+	// value field.
+	ULONG len = caps.InputReportByteLength;
+	std::vector<BYTE> blank(len), ones, zeros;
+	if (HidP_InitializeReportForID(HidP_Input, vc.ReportID, ppd, (PCHAR)blank.data(), len) != HIDP_STATUS_SUCCESS)
+		return false;
+
+	ULONG mask = vc.BitSize >= 32 ? 0xFFFFFFFFUL : (1UL << vc.BitSize) - 1;
+	ones = blank;
+	zeros = blank;
+	UINT bitOffset, nBits;
+	if (HidP_SetUsageValue(HidP_Input, vc.UsagePage, vc.LinkCollection, usage, mask, ppd, (PCHAR)ones.data(), len) != HIDP_STATUS_SUCCESS
+		|| HidP_SetUsageValue(HidP_Input, vc.UsagePage, vc.LinkCollection, usage, 0, ppd, (PCHAR)zeros.data(), len) != HIDP_STATUS_SUCCESS
+		|| !ProbeBits(ones, zeros, bitOffset, nBits) || nBits != vc.BitSize)
+		return false;
+
+	// fill in the field description
+	ValueField f;
+	f.bitOffset = bitOffset;
+	f.bitSize = nBits;
+	f.isSigned = vc.LogicalMin < 0;
+	f.logMin = vc.LogicalMin;
+	f.logMax = vc.LogicalMax;
+	f.phyMin = vc.PhysicalMin;
+	f.phyMax = vc.PhysicalMax;
+
+	// Check our decoding against HidP's for a selection of raw values:
+	// the ends and middle of the logical range, values just outside the
+	// range (which should read as null), zero, and all '1' bits.  If we
+	// disagree about any of them, leave the field to HidP.
+	LONGLONG tests[] = {
+		vc.LogicalMin, vc.LogicalMax, ((LONGLONG)vc.LogicalMin + vc.LogicalMax) / 2,
+		(LONGLONG)vc.LogicalMin - 1, (LONGLONG)vc.LogicalMax + 1, 0, mask
+	};
+	for (auto t : tests)
+	{
+		std::vector<BYTE> probe = blank;
+		if (HidP_SetUsageValue(HidP_Input, vc.UsagePage, vc.LinkCollection, usage, (ULONG)t & mask, ppd, (PCHAR)probe.data(), len) != HIDP_STATUS_SUCCESS)
+			return false;
+
+		LONG hidpVal = 0, ourVal = 0;
+		bool hidpOk = HidP_GetScaledUsageValue(HidP_Input, vc.UsagePage, 0, usage, &hidpVal, ppd, (PCHAR)probe.data(), len) == HIDP_STATUS_SUCCESS;
+		bool ourOk = ReadValue(f, probe.data(), len, ourVal);
+		if (hidpOk != ourOk || (hidpOk && hidpVal != ourVal))
+			return false;
+	}
+
+	// success
+	f.compiled = true;
+	field = f;
+	return true;
+}
+
+bool HidReportPlan::ReadValue(const ValueField &field, const BYTE *report, size_t len, LONG &val)
+{
+	// extract the raw bits
+	DWORD raw = ExtractBits(report, len, field.bitOffset, field.bitSize);
+
+	// sign-extend it if the logical range is signed
+	LONG v = (LONG)raw;
+	if (field.isSigned && field.bitSize < 32 && (raw & (1UL << (field.bitSize - 1))) != 0)
+		v = (LONG)(raw | ~((1UL << field.bitSize) - 1));
+
+	// a value outside of the logical range is a null value
+	if (field.logMin >= field.logMax || v < field.logMin || v > field.logMax)
+		return false;
+
+	// scale it to the physical range, if there is one
+	if (field.phyMin < field.phyMax)
+	{
+		v = (LONG)(field.phyMin + (LONGLONG)(v - field.logMin) * (field.phyMax - field.phyMin)
+			/ ((LONGLONG)field.logMax - field.logMin));
+	}
+
+	// success
+	val = v;
+	return true;
+}
+
+bool HidReportPlan::ProbeBits(const std::vector<BYTE> &a, const std::vector<BYTE> &b,
+	UINT &bitOffset, UINT &nBits)
+{
+	bitOffset = 0;
+	nBits = 0;
+	for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+	{
+		// skip bytes that don't differ
+		BYTE diff = a[i] ^ b[i];
+		if (diff == 0)
+			continue;
+
+		// check each differing bit
+		for (UINT bit = 0; bit < 8; ++bit)
+		{
+			if ((diff & (1 << bit)) != 0)
+			{
+				// the bits have to be contiguous
+				UINT pos = (UINT)i*8 + bit;
+				if (nBits == 0)
+					bitOffset = pos;
+				else if (pos != bitOffset + nBits)
+					return false;
+
+				++nBits;
+			}
+		}
+	}
+
+	// we need at least one bit
+	return nBits != 0;
+}
+
+void HidReportPlan::ReadButtonBitmap(const BYTE *report, size_t len, DWORD *bits)
+{
+	// clear the bitmap
+	size_t nWords = bitmap[0].size();
+	memset(bits, 0, nWords * sizeof(DWORD));
+
+	// copy each run into the bitmap, up to 32 bits at a time
+	for (auto const &run : buttonRuns)
+	{
+		for (UINT done = 0; done < run.count; )
+		{
+			UINT n = min(run.count - done, 32U);
+			DWORD v = ExtractBits(report, len, run.bitOffset + done, n);
+
+			// store it at the bitmap position, which might straddle
+			// two words
+			UINT index = run.index + done;
+			UINT w = index >> 5, shift = index & 31;
+			bits[w] |= v << shift;
+			if (shift != 0 && shift + n > 32)
+				bits[w + 1] |= v >> (32 - shift);
+
+			done += n;
+		}
+	}
+}
@@ -0,0 +1,196 @@
+// This file is part of PinballY
+// Copyright 2018 Michael J Roberts | GPL v3 or later | NO WARRANTY
+//
+// HID report extraction plan
+//
+// This is a precompiled decoder for one HID input report type (one
+// report ID) on one device.  The plain HidP approach to reading a
+// report is to call HidP_GetUsages() and HidP_GetScaledUsageValue()
+// for each button page and axis on every report.  Each of those calls
+// walks the device's preparsed data to find the field it's looking
+// for, and for a device like a Pinscape controller that sends reports
+// at up to 1 kHz, that adds up to a measurable share of the latency
+// from a flipper button press to the UI.
+//
+// The layout of a given report never changes, though, so we can work
+// out where each field lives once, when the device is added, and then
+// read the fields directly out of the report bytes.  A plan consists
+// of:
+//
+// - The bit offset of each button, grouped into runs of consecutive
+//   bits.  On each report, we gather the runs into a packed bitmap,
+//   one bit per button, and XOR it against the bitmap from the last
+//   report of the same type a word at a time.  That finds the changed
+//   buttons without visiting the unchanged ones.
+//
+// - The bit offset, size, and logical/physical ranges of each axis
+//   value, which lets us extract and scale the value with a few shifts
+//   and a multiply.
+//
+// Windows doesn't give user-mode code access to the raw report
+// descriptor, so we can't parse the descriptor language ourselves.
+// Instead, we derive the layout from the preparsed data by probing:
+// we ask HidP to build a blank report, set a single field in it, and
+// see which bits changed.  We then check our decoding of a few test
+// values for each field against HidP's own decoding.  Any field whose
+// layout we can't figure out this way (array-style button fields,
+// multi-element value arrays, and so on), or that doesn't decode the
+// same way HidP does, is left out of the plan, and the caller falls
+// back on the HidP calls for it.  So the plan is strictly an
+// optimization; it never changes the decoded results.
+
+#pragma once
+#include <vector>
+#include <Hidsdi.h>
+
+class HidReportPlan
+{
+public:
+	HidReportPlan() : buttonsCompiled(false), lastIndex(0) { }
+
+	// Compile the button layout for a report ID.  'btnCaps' is the
+	// device's full input button capabilities list, from which we pick
+	// out the entries for this report ID and usage page.  Returns true
+	// if we were able to compile the layout for all of the buttons in
+	// the report; if not, the caller must use HidP_GetUsages() to read
+	// the buttons.
+	bool CompileButtons(PHIDP_PREPARSED_DATA ppd, const HIDP_CAPS &caps,
+		const HIDP_BUTTON_CAPS *btnCaps, USHORT numBtnCaps,
+		BYTE reportId, USAGE usagePage);
+
+	// Set the button layout directly, from a list of the report bit
+	// offset of each button and its usage (button number).  This is the
+	// second half of CompileButtons(), after the probing; it's also the
+	// way to set up a plan for a synthetic report layout for testing.
+	// Returns false, leaving the layout uncompiled, if two buttons share
+	// a bit.
+	struct ButtonBit
+	{
+		UINT bitOffset;
+		USAGE usage;
+	};
+	bool SetButtonLayout(std::vector<ButtonBit> bits);
+
+	// Is the button layout compiled?
+	bool IsButtonLayoutCompiled() const { return buttonsCompiled; }
+
+	// Read the button states from a report into the NEXT button bitmap,
+	// compare it to the LAST bitmap, and call the callback for each
+	// button that changed state.  The NEXT bitmap then becomes the
+	// LAST bitmap for the next report.  The report must be of the type
+	// the plan was compiled for.
+	template<typename Func> void DecodeButtons(const BYTE *report, size_t len, Func onChange)
+	{
+		// read the report into the NEXT bitmap
+		int nextIndex = lastIndex ^ 1;
+		DWORD *next = bitmap[nextIndex].data();
+		ReadButtonBitmap(report, len, next);
+
+		// Compare against the LAST bitmap a word at a time.  Only the
+		// words with changed bits need any further attention.
+		const DWORD *last = bitmap[lastIndex].data();
+		for (size_t w = 0, nWords = bitmap[nextIndex].size(); w < nWords; ++w)
+		{
+			for (DWORD changed = next[w] ^ last[w]; changed != 0; changed &= changed - 1)
+			{
+				// get the lowest changed bit
+				DWORD bit;
+				_BitScanForward(&bit, changed);
+
+				// report the change
+				size_t index = w*32 + bit;
+				onChange(buttonNumber[index], (next[w] & (1UL << bit)) != 0);
+			}
+		}
+
+		// the NEXT bitmap is now the LAST bitmap
+		lastIndex = nextIndex;
+	}
+
+	// Compiled axis value field
+	struct ValueField
+	{
+		ValueField() : compiled(false), bitOffset(0), bitSize(0), isSigned(false),
+			logMin(0), logMax(0), phyMin(0), phyMax(0) { }
+
+		// Did we compile this field?  If not, the caller must read it
+		// with HidP_GetScaledUsageValue().
+		bool compiled;
+
+		// bit offset of the field from the start of the report, and its size
+		UINT bitOffset;
+		UINT bitSize;
+
+		// is the value signed?  (It is if the logical minimum is negative.)
+		bool isSigned;
+
+		// logical and physical ranges, for scaling
+		LONG logMin, logMax;
+		LONG phyMin, phyMax;
+	};
+
+	// Compile a value field.  'vc' is the value capabilities entry
+	// that covers the usage.  Fills in 'field', and returns true if the
+	// field was compiled.
+	static bool CompileValue(PHIDP_PREPARSED_DATA ppd, const HIDP_CAPS &caps,
+		const HIDP_VALUE_CAPS &vc, USAGE usage, ValueField &field);
+
+	// Read a compiled value field from a report, applying the same
+	// scaling as HidP_GetScaledUsageValue().  Returns false if the
+	// report contains a null (out-of-range) value for the field.
+	static bool ReadValue(const ValueField &field, const BYTE *report, size_t len, LONG &val);
+
+	// Extract a bit field of up to 32 bits from a report.  Bits past
+	// the end of the report read as zero.
+	static DWORD ExtractBits(const BYTE *report, size_t len, UINT bitOffset, UINT nBits)
+	{
+		// Gather the bytes spanned by the field into a 64-bit word.
+		// With a field of at most 32 bits starting at a bit offset of
+		// at most 7 within the first byte, that's at most 5 bytes.
+		size_t firstByte = bitOffset >> 3;
+		UINT shift = bitOffset & 7;
+		UINT nBytes = (shift + nBits + 7) >> 3;
+		UINT64 v = 0;
+		for (UINT i = 0; i < nBytes && firstByte + i < len; ++i)
+			v |= (UINT64)report[firstByte + i] << (i*8);
+
+		// shift out the leading bits and mask to the field size
+		v >>= shift;
+		return nBits >= 32 ? (DWORD)v : (DWORD)(v & ((1ULL << nBits) - 1));
+	}
+
+protected:
+	// Probe the bits occupied by a field.  The two reports were built
+	// by HidP with the field set to different values; any bits that
+	// differ between them belong to the field.  Fills in the offset
+	// and number of the differing bits, and returns true if they form
+	// a single contiguous run.
+	static bool ProbeBits(const std::vector<BYTE> &a, const std::vector<BYTE> &b,
+		UINT &bitOffset, UINT &nBits);
+
+	// Read the buttons from a report into a packed bitmap
+	void ReadButtonBitmap(const BYTE *report, size_t len, DWORD *bits);
+
+	// is the button layout compiled?
+	bool buttonsCompiled;
+
+	// Button run.  This is a group of buttons occupying consecutive
+	// bits in the report, which map to consecutive bits in the packed
+	// bitmap.
+	struct ButtonRun
+	{
+		UINT bitOffset;      // bit offset of the first button in the report
+		UINT count;          // number of buttons in the run
+		UINT index;          // bitmap index of the first button
+	};
+	std::vector<ButtonRun> buttonRuns;
+
+	// Button numbers (HID usages), indexed by bitmap position
+	std::vector<USAGE> buttonNumber;
+
+	// Packed button bitmaps.  At any given time, one of these holds
+	// the states from the LAST report and the other is scratch space
+	// for the NEXT report, as indicated by lastIndex.
+	std::vector<DWORD> bitmap[2];
+	int lastIndex;
+};
@@ -54,6 +54,11 @@ InputManager::InputManager()
 	// Raw input isn't yet initialized
 	rawInputHWnd = 0;
 
+	// no raw input buffer allocated yet
+	rawInputBufSize = 0;
+	rawInputBufInUse = false;
+	rawInputTime = 0;
+
 	// Command list.  This defines the set of commands that can be
 	// activated with keys and joystick buttons.  
 	//
@@ -193,6 +198,10 @@ void InputManager::UninitRawInput()
 
 void InputManager::ProcessRawInput(UINT rawInputCode, HRAWINPUT hRawInput)
 {
+	// note the arrival time, for event timestamps
+	LARGE_INTEGER arrivalTime;
+	QueryPerformanceCounter(&arrivalTime);
+
 	// assume we'll apply the default processing
 	bool callDefProc = true;
 
@@ -200,18 +209,54 @@ void InputManager::ProcessRawInput(UINT rawInputCode, HRAWINPUT hRawInput)
 	UINT dwSize;
 	GetRawInputData(hRawInput, RID_INPUT, 0, &dwSize, sizeof(RAWINPUTHEADER));
 
-	// allocate a buffer (and ignore the message if we don't save space)
-	std::unique_ptr<BYTE> buf(new (std::nothrow) BYTE[dwSize]);
-	if (buf.get() == 0)
+	// Get a buffer.  We normally reuse the same buffer for every
+	// message, growing it as needed, since joysticks can send input
+	// at up to 1000 reports per second and there's no reason to go
+	// through the heap for each one.  But a subscriber could run a
+	// modal loop while handling an event (to show a message box, say),
+	// and that could bring us back here with a new message while the
+	// outer message is still using the buffer.  In that case, use a
+	// separate temporary buffer for the nested message.
+	std::unique_ptr<BYTE> tempBuf;
+	BYTE *buf;
+	if (rawInputBufInUse)
+	{
+		// the shared buffer is busy - allocate a temporary one
+		tempBuf.reset(new (std::nothrow) BYTE[dwSize]);
+		buf = tempBuf.get();
+	}
+	else
+	{
+		// expand the shared buffer if necessary
+		if (rawInputBufSize < dwSize)
+		{
+			rawInputBuf.reset(new (std::nothrow) BYTE[dwSize]);
+			rawInputBufSize = rawInputBuf.get() != 0 ? dwSize : 0;
+		}
+		buf = rawInputBuf.get();
+	}
+
+	// ignore the message if we couldn't allocate space
+	if (buf == 0)
 		return;
 
 	// Read the data.  If it doesn't come back at the expected size, 
 	// ignore the message.
-	if (GetRawInputData(hRawInput, RID_INPUT, buf.get(), &dwSize, sizeof(RAWINPUTHEADER)) != dwSize)
+	if (GetRawInputData(hRawInput, RID_INPUT, buf, &dwSize, sizeof(RAWINPUTHEADER)) != dwSize)
 		return;
 
+	// mark the shared buffer as in use while we're processing the
+	// message (if this is a nested message, it's already marked)
+	bool wasInUse = rawInputBufInUse;
+	rawInputBufInUse = true;
+
+	// set the arrival time for the message, saving the outer message's
+	// time in case this is a nested message
+	INT64 outerRawInputTime = rawInputTime;
+	rawInputTime = arrivalTime.QuadPart;
+
 	// get it as a RAWINPUT struct
-	RAWINPUT *raw = (RAWINPUT *)buf.get();
+	RAWINPUT *raw = (RAWINPUT *)buf;
 
 	// if it's a HID input, send it to the joystick manager
 	if (raw->header.dwType == RIM_TYPEHID)
@@ -229,6 +274,12 @@ void InputManager::ProcessRawInput(UINT rawInputCode, HRAWINPUT hRawInput)
 			break;
 		}
 	}
+
+	// done with the shared buffer
+	rawInputBufInUse = wasInUse;
+
+	// restore the outer message's arrival time, if this was nested
+	rawInputTime = outerRawInputTime;
 }
 
 void InputManager::DiscoverRawInputDevices()
@@ -48,6 +48,12 @@ public:
 	// required cleanup on the input buffer data.
 	void ProcessRawInput(UINT rimType, HRAWINPUT hRawInput);
 
+	// Get the arrival time of the raw input message currently being
+	// processed, as a QueryPerformanceCounter() value.  Event handlers
+	// called from ProcessRawInput() can use this to timestamp their
+	// events at the point the input reached the application.
+	INT64 GetRawInputTime() const { return rawInputTime; }
+
 	// Process a device change notification.  The main window
 	// calls this on receiving a WM_INPUT_DEVICE_CHANGE message.
 	void ProcessDeviceChange(USHORT what, HANDLE hDevice);
@@ -218,5 +224,16 @@ protected:
 
 	// raw input message handler window
 	HWND rawInputHWnd;
+
+	// Raw input buffer.  We reuse this across WM_INPUT messages, so
+	// that we don't have to allocate a new buffer for every message.
+	// rawInputBufInUse is set while a message is being processed from
+	// the buffer, in case processing re-enters ProcessRawInput().
+	std::unique_ptr<BYTE> rawInputBuf;
+	UINT rawInputBufSize;
+	bool rawInputBufInUse;
+
+	// arrival time of the current raw input message
+	INT64 rawInputTime;
 };
 
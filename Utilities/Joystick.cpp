@@ -260,9 +260,13 @@ JoystickManager::PhysicalJoystick::PhysicalJoystick(
 	}
 
 	// allocate the ON lists in the button report groups, now that we
-	// know how many buttons can be reported in each group
+	// know how many buttons can be reported in each group, and compile
+	// the button layouts
 	for (auto& brg : buttonReportGroups)
+	{
 		brg.AllocOnLists();
+		brg.plan.CompileButtons(ppd, caps, btnCaps.get(), numBtnCaps, brg.reportId, brg.usagePage);
+	}
 
 	// allocate the button state array, now that we know how many
 	// buttons there are overall
@@ -337,8 +341,9 @@ JoystickManager::PhysicalJoystick::PhysicalJoystick(
 			// check if it's one we're interested in
 			if (usage >= iValFirst && usage <= iValLast)
 			{
-				// add the entry to the report group
+				// add the entry to the report group, and compile its layout
 				brg->usageVal.emplace_back(v->UsagePage, usage);
+				HidReportPlan::CompileValue(ppd, caps, *v, usage, brg->usageVal.back().field);
 			}
 		}
 	}
@@ -405,126 +410,147 @@ void JoystickManager::PhysicalJoystick::ProcessRawInput(UINT rawInputCode, RAWIN
 				// get the direct pointer
 				ButtonReportGroup *brg = &*brgit;
 
-				// Figure the NEXT and LAST on list indices
-				int lastOnIndex = brg->lastOnIndex;
-				int nextOnIndex = lastOnIndex ^ 1;
-
-				// Get the NEXT and LAST on list pointers
-				int nLastOn = brg->on[lastOnIndex].nOn;
-				USAGE *lastOn = brg->on[lastOnIndex].usage.get();
-				USAGE *nextOn = brg->on[nextOnIndex].usage.get();
-
-				// Get the Usages from the report for our button group's
-				// usage page.  A "Usage" in the case of a button is simply
-				// the button number, and for this particular API, the
-				// reported Usage list consists of all of the ON buttons
-				// in the report.  Retrieve the report into the NEXT OnList
-				// in the button group object.  The OnList has nButtons
-				// elements allocated.
-				ULONG usageLen = brg->nButtons;
-				if (HidP_GetUsages(HidP_Input, brg->usagePage, 0, nextOn, &usageLen, pp,
-					(PCHAR)raw->data.hid.bRawData, raw->data.hid.dwSizeHid) == HIDP_STATUS_SUCCESS)
+				// If we compiled the button layout, read the buttons directly
+				// from the report bits.  The plan calls us back for each
+				// button that changed state since the last report.
+				if (brg->plan.IsButtonLayoutCompiled())
 				{
-					// nextOn[] now contains usageLen Usages, i.e., button
-					// numbers for the ON buttons.  'OR' an 0x02 bit into
-					// each button.  This combines with the previous state
-					// of 0x00 for OFF or 0x01 for ON to give us our new
-					// state:
-					//
-					//   - If the button was previously OFF, it changes
-					//     from 0x00 to 0x02
-					//
-					//   - If the button was previously ON, it changes
-					//     from 0x01 to 0x03
-					//
-					// And note the effect on buttons that were previously
-					// ON but are now off, so aren't included in the nextOn
-					// list:
-					//
-					//   - If the button was previously ON and now OFF,
-					//     it stays at 0x01
-					//
-					// So we can tell the effect of this message on each
-					// of the buttons in the nextOn and lastOn lists just
-					// by looking at the updated button state, without
-					// having to cross-search either list:
-					//
-					//   0x01 -> was ON, now OFF -> OFF EVENT
-					//   0x02 -> was OFF, now ON -> ON EVENT
-					//   0x03 -> was ON, now ON -> no change
-					//
-					for (unsigned int i = 0; i < usageLen; ++i)
+					brg->plan.DecodeButtons(pRawData, dwSizeHid, [this, bs, foreground](USAGE button, bool pressed)
 					{
-						// shift a '1' into the low-order bit
-						int button = nextOn[i];
-						if ((bs[button] |= 0x02) == 0x02)
+						// update the button state here and in the logical joystick
+						BYTE state = pressed ? 1 : 0;
+						bs[button] = state;
+						logjs->SetButtonState(button, state);
+
+						// fire the event
+						JoystickManager::GetInstance()->SendButtonEvent(this, button, pressed, foreground);
+					});
+				}
+				else
+				{
+					// Figure the NEXT and LAST on list indices
+					int lastOnIndex = brg->lastOnIndex;
+					int nextOnIndex = lastOnIndex ^ 1;
+
+					// Get the NEXT and LAST on list pointers
+					int nLastOn = brg->on[lastOnIndex].nOn;
+					USAGE *lastOn = brg->on[lastOnIndex].usage.get();
+					USAGE *nextOn = brg->on[nextOnIndex].usage.get();
+
+					// Get the Usages from the report for our button group's
+					// usage page.  A "Usage" in the case of a button is simply
+					// the button number, and for this particular API, the
+					// reported Usage list consists of all of the ON buttons
+					// in the report.  Retrieve the report into the NEXT OnList
+					// in the button group object.  The OnList has nButtons
+					// elements allocated.
+					ULONG usageLen = brg->nButtons;
+					if (HidP_GetUsages(HidP_Input, brg->usagePage, 0, nextOn, &usageLen, pp,
+						(PCHAR)pRawData, dwSizeHid) == HIDP_STATUS_SUCCESS)
+					{
+						// nextOn[] now contains usageLen Usages, i.e., button
+						// numbers for the ON buttons.  'OR' an 0x02 bit into
+						// each button.  This combines with the previous state
+						// of 0x00 for OFF or 0x01 for ON to give us our new
+						// state:
+						//
+						//   - If the button was previously OFF, it changes
+						//     from 0x00 to 0x02
+						//
+						//   - If the button was previously ON, it changes
+						//     from 0x01 to 0x03
+						//
+						// And note the effect on buttons that were previously
+						// ON but are now off, so aren't included in the nextOn
+						// list:
+						//
+						//   - If the button was previously ON and now OFF,
+						//     it stays at 0x01
+						//
+						// So we can tell the effect of this message on each
+						// of the buttons in the nextOn and lastOn lists just
+						// by looking at the updated button state, without
+						// having to cross-search either list:
+						//
+						//   0x01 -> was ON, now OFF -> OFF EVENT
+						//   0x02 -> was OFF, now ON -> ON EVENT
+						//   0x03 -> was ON, now ON -> no change
+						//
+						for (unsigned int i = 0; i < usageLen; ++i)
 						{
-							// this button is newly on - fire an event
-							JoystickManager::GetInstance()->SendButtonEvent(
-								this, button, true, foreground);
+							// shift a '1' into the low-order bit
+							int button = nextOn[i];
+							if ((bs[button] |= 0x02) == 0x02)
+							{
+								// this button is newly on - fire an event
+								JoystickManager::GetInstance()->SendButtonEvent(
+									this, button, true, foreground);
+							}
 						}
-					}
 
-					// Now visit each button in the PREVIOUS On list.
-					// That came from exactly the same report type as the
-					// current On list, so it covers exactly the same set
-					// of buttons.  Therefore, any button that was ON in
-					// the OLD list but wasn't mentioned as ON in the new
-					// list must have just turned OFF.  
-					//
-					// As explained above, our first pass over the nextOn[]
-					// list updated our buttonState[] array in such a way
-					// that we can tell if a button in the lastOn[] list
-					// is still on, without any need to search for it in 
-					// the nextOn[] list.  If X is a button in the lastOn[]
-					// list, and buttonState[X] is 0x01, that button just
-					// switched off; if its state is 0x03, it's still on
-					// (therefore unchanged).
-					for (int i = 0; i < nLastOn; ++i)
-					{
-						int button = lastOn[i];
-						if (bs[button] == 0x01)
+						// Now visit each button in the PREVIOUS On list.
+						// That came from exactly the same report type as the
+						// current On list, so it covers exactly the same set
+						// of buttons.  Therefore, any button that was ON in
+						// the OLD list but wasn't mentioned as ON in the new
+						// list must have just turned OFF.  
+						//
+						// As explained above, our first pass over the nextOn[]
+						// list updated our buttonState[] array in such a way
+						// that we can tell if a button in the lastOn[] list
+						// is still on, without any need to search for it in 
+						// the nextOn[] list.  If X is a button in the lastOn[]
+						// list, and buttonState[X] is 0x01, that button just
+						// switched off; if its state is 0x03, it's still on
+						// (therefore unchanged).
+						for (int i = 0; i < nLastOn; ++i)
 						{
-							// this button is now off - fire an event
-							JoystickManager::GetInstance()->SendButtonEvent(
-								this, button, false, foreground);
+							int button = lastOn[i];
+							if (bs[button] == 0x01)
+							{
+								// this button is now off - fire an event
+								JoystickManager::GetInstance()->SendButtonEvent(
+									this, button, false, foreground);
+
+								// set its state to OFF (0)
+								bs[button] = 0;
+
+								// copy it to the logical joystick state as well
+								logjs->SetButtonState(button, 0);
+							}
+						}
 
-							// set its state to OFF (0)
-							bs[button] = 0;
+						// Clean up the button states for next time, by
+						// setting all of the ON button states to 0x01.
+						for (unsigned int i = 0; i < usageLen; ++i)
+						{
+							// set this button state to ON (1)
+							int button = nextOn[i];
+							bs[button] = 1;
 
 							// copy it to the logical joystick state as well
-							if (button < logjs->nButtons)
-								logjs->buttonState.get()[button] = 0;
+							logjs->SetButtonState(button, 1);
 						}
-					}
 
-					// Clean up the button states for next time, by
-					// setting all of the ON button states to 0x01.
-					for (unsigned int i = 0; i < usageLen; ++i)
-					{
-						// set this button state to ON (1)
-						int button = nextOn[i];
-						bs[button] = 1;
-
-						// copy it to the logical joystick state as well
-						if (button <= logjs->nButtons)
-							logjs->buttonState.get()[button] = 1;
+						// And finally, the new ON list now becomes the prior
+						// ON list for the next event.
+						brg->lastOnIndex = nextOnIndex;
+						brg->on[nextOnIndex].nOn = usageLen;
 					}
-
-					// And finally, the new ON list now becomes the prior
-					// ON list for the next event.
-					brg->lastOnIndex = nextOnIndex;
-					brg->on[nextOnIndex].nOn = usageLen;
 				}
 
 				// Read the axis value updates
 				for (auto const& v : brg->usageVal)
 				{
-					// parse the value from the report
+					// Parse the value from the report, directly from the
+					// report bits if we compiled the field, otherwise via HidP
 					LONG newVal;
 					USAGE usage = v.usage;
-					if (HidP_GetScaledUsageValue(HidP_Input, v.usagePage, 0, usage, &newVal, pp,
-						(PCHAR)raw->data.hid.bRawData, raw->data.hid.dwSizeHid) == HIDP_STATUS_SUCCESS)
+					bool ok = v.field.compiled ?
+						HidReportPlan::ReadValue(v.field, pRawData, dwSizeHid, newVal) :
+						HidP_GetScaledUsageValue(HidP_Input, v.usagePage, 0, usage, &newVal, pp,
+							(PCHAR)pRawData, dwSizeHid) == HIDP_STATUS_SUCCESS;
+					if (ok)
 					{
 						// if the value has changed, update it here and in our logical device
 						int iVal = usage - iValFirst;
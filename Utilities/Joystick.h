@@ -82,6 +82,14 @@
 // Direct Input, or anything else, as everything goes through the raw
 // input layer first.
 //
+// That said, a Pinscape unit can send reports at up to 1 kHz, and the
+// HidP decoding calls are on the path from a flipper button press to
+// the UI, so we now skip most of that work on each report.  When a
+// device is added, we compile each report type's layout into a plan
+// that reads the buttons and axes directly from the report bits (see
+// HidReportPlan.h), and we only use the HidP calls for fields that
+// can't be compiled that way.
+//
 // So the bottom line is that even though it looks like we have more
 // code here than a DirectInput version would have, we actually have 
 // less overall, because the code here would have been in DirectInput
@@ -105,6 +113,7 @@
 #include <memory>
 #include <unordered_map>
 #include <Hidsdi.h>
+#include "HidReportPlan.h"
 
 // Joystick manager.
 class JoystickManager
@@ -226,6 +235,15 @@ public:
 			return button >= 0 && button < nButtons && buttonState.get()[button] != 0;
 		}
 
+		// Set a button state.  Button numbers outside of the state
+		// array are ignored.  (The array holds nButtons entries, so
+		// button number nButtons is already past the end.)
+		void SetButtonState(int button, BYTE state)
+		{
+			if (button >= 0 && button < nButtons)
+				buttonState.get()[button] = state;
+		}
+
 		// Control value usages.  These are the usage IDs
 		// in the HID Generic Desktop Page for the joystick
 		// controls we're interested in.
@@ -352,6 +370,12 @@ public:
 		// to do any array copying aside from the unavoidable
 		// copy step that the HidP API does.
 		//
+		// All of the above describes the HidP fallback path.  For
+		// most devices, we compile the report layout when the device
+		// is added, and then decode the buttons directly from the
+		// report bits via 'plan', which tracks the button states in
+		// packed bitmaps instead of the ON lists.
+		//
 		struct ButtonReportGroup
 		{
 			ButtonReportGroup(BYTE reportId, int usagePage)
@@ -419,6 +443,11 @@ public:
 				on[1].usage.reset(new USAGE[nButtons]);
 			}
 
+			// Compiled extraction plan for the report.  If the button
+			// layout is compiled, we use this instead of HidP_GetUsages()
+			// and the ON lists to read the buttons.
+			HidReportPlan plan;
+
 			// Usage value descriptor.  For each usage value that
 			// appears under this report ID, we create a value
 			// here.  When we receive a report of this type, we
@@ -431,6 +460,9 @@ public:
 
 				USAGE usagePage;
 				USAGE usage;
+
+				// compiled field layout, if available
+				HidReportPlan::ValueField field;
 			};
 			std::vector<UsageValueDesc> usageVal;
 		};
@@ -9,6 +9,7 @@
 #include <commdlg.h>
 #include <Dlgs.h>
 #include <math.h>
+#include <exception>
 #include "../rapidxml/rapidxml.hpp"
 #include "Util.h"
 #include "WinUtil.h"
@@ -822,3 +823,81 @@ bool GetProgramForExt(TSTRING &prog, const TCHAR *ext)
 	return false;
 }
 
+// -----------------------------------------------------------------------
+//
+// Parallel task runner
+//
+int RunParallel(std::vector<std::function<void()>> &tasks, int maxThreads)
+{
+	// worker context
+	struct Context
+	{
+		Context(std::vector<std::function<void()>> &tasks) :
+			tasks(tasks), exc(tasks.size()), next(0) { }
+
+		std::vector<std::function<void()>> &tasks;
+		std::vector<std::exception_ptr> exc;
+		volatile LONG next;
+
+		// run tasks until the batch is exhausted
+		void Run()
+		{
+			for (;;)
+			{
+				LONG i = InterlockedIncrement(&next) - 1;
+				if (i >= (LONG)tasks.size())
+					break;
+
+				try
+				{
+					tasks[i]();
+				}
+				catch (...)
+				{
+					exc[i] = std::current_exception();
+				}
+			}
+		}
+
+		static DWORD WINAPI SMain(LPVOID lParam)
+		{
+			reinterpret_cast<Context*>(lParam)->Run();
+			return 0;
+		}
+	};
+	Context ctx(tasks);
+
+	// Figure the number of worker threads: one per processor (counting
+	// the calling thread), but no more than the number of tasks or the
+	// caller's limit.
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	int nThreads = min((int)si.dwNumberOfProcessors, min((int)tasks.size(), maxThreads));
+
+	// launch the workers
+	std::vector<HANDLE> threads;
+	for (int i = 1; i < nThreads; ++i)
+	{
+		DWORD tid;
+		if (HANDLE h = CreateThread(NULL, 0, &Context::SMain, &ctx, 0, &tid); h != NULL)
+			threads.push_back(h);
+	}
+
+	// work on the batch on this thread, then wait for the workers
+	ctx.Run();
+	for (auto h : threads)
+	{
+		WaitForSingleObject(h, INFINITE);
+		CloseHandle(h);
+	}
+
+	// re-throw the first exception, if any
+	for (auto &e : ctx.exc)
+	{
+		if (e != nullptr)
+			std::rethrow_exception(e);
+	}
+
+	// return the number of threads that did the work
+	return (int)threads.size() + 1;
+}
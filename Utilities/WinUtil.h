@@ -4,6 +4,8 @@
 // Windows utility functions
 
 #pragma once
+#include <vector>
+#include <functional>
 #include "../rapidxml/rapidxml.hpp"
 #include "StringUtil.h"
 
@@ -82,6 +84,24 @@ HWND FindMainWindowForProcess(DWORD pid, DWORD *pThreadId);
 void SaferTerminateProcess(HANDLE hProcess);
 
 
+// -----------------------------------------------------------------------
+//
+// Parallel task runner
+//
+
+// Run a batch of independent tasks on a pool of worker threads, and
+// wait for them all to finish.  The calling thread works on the batch
+// along with the workers.  We use at most one thread per processor,
+// and at most 'maxThreads' threads in total; the default limit is
+// modest, since our typical batches are largely file I/O.  If any
+// tasks throw exceptions, we catch them on the worker threads and
+// re-throw the first one (in task order) on the calling thread after
+// the whole batch completes, so the caller sees the same exception it
+// would have seen running the tasks serially.  Returns the number of
+// threads (including the calling thread) that worked on the batch.
+int RunParallel(std::vector<std::function<void()>> &tasks, int maxThreads = 8);
+
+
 // -----------------------------------------------------------------------
 //
 // Program manifest reader